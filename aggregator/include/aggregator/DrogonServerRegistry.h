@@ -1,5 +1,6 @@
 #pragma once
 
+#include <aggregator/IServerRegistry.h>
 #include <drogon/WebSocketConnection.h>
 
 namespace aggregator {
@@ -8,17 +9,140 @@ class DrogonServerRegistry {
 public:
     static DrogonServerRegistry& instance();
 
-    void AddConnection(const drogon::WebSocketConnectionPtr& conn);
     void AddServer(const drogon::WebSocketConnectionPtr& conn);
     void RemoveConnection(const drogon::WebSocketConnectionPtr& conn);  
-    std::vector<std::string> GetServers();
-    void SendToClients(const chat::Envelope& env) const;
+    // Lock-free, readers share the snapshot published by the last change of a server or of its load.
+    std::shared_ptr<const ServerListSnapshot> GetServers() const;
+    void ReportServerLoad(const drogon::WebSocketConnectionPtr& conn, const chat::ServerLoadReport& report);
+    // Unlists a server that is shutting down, as if it had left, clients and rooms are sent elsewhere.
+    // It keeps taking part in the cluster bus until it disconnects, its remaining clients still need the events.
+    void DrainServer(const drogon::WebSocketConnectionPtr& conn);
+    // Closes the servers that missed MISSED_HEARTBEATS load reports in a row, called periodically.
+    void EvictSilentServers();
+
+    // The server list is versioned. Subscribed clients get one compacted ServerListDiff per DIFF_WINDOW
+    // instead of a message per change, so a flapping server costs at most one broadcast per window.
+    chat::SubscribeServersResponse SubscribeServers(const drogon::WebSocketConnectionPtr& conn, const chat::SubscribeServersRequest& req);
+    // Long polling for GET /servers: calls done with the snapshot once it no longer carries `etag`,
+    // or with the current one after `timeout` seconds. Called on the loop that waits.
+    void WaitForServers(const std::string& etag, double timeout, std::function<void(std::shared_ptr<const ServerListSnapshot>)> done);
+
+    // Room subscriptions of the registered servers, for relaying ClusterPublish between them.
+    void Subscribe(const drogon::WebSocketConnectionPtr& conn, const std::vector<int32_t>& room_ids);
+    void Unsubscribe(const drogon::WebSocketConnectionPtr& conn, const std::vector<int32_t>& room_ids);
+    void Publish(const drogon::WebSocketConnectionPtr& origin, const chat::ClusterPublish& publish) const;
+
+    // Room affinity: the server the members of a room should connect to, so its fan-out stays on one node.
+    // A room that already has members somewhere stays on the server holding most of them, otherwise
+    // the room is placed by consistent hashing, so adding or removing a server only moves a share of rooms.
+    // Full servers are skipped on the ring, the room goes to the next server that has room for it.
+    std::optional<std::string> GetRoomServer(int32_t room_id) const;
+    void ReportRoomLoad(const drogon::WebSocketConnectionPtr& conn, const chat::RoomLoadReport& report);
+
+    // Peer aggregators: each one gossips the servers registered to it, which are listed, placed on the ring
+    // and counted for room affinity here as if they were local. A server registered here wins over a peer's listing.
+    void FillGossip(chat::RegistryGossip& gossip) const;
+    // Replaces the servers of the gossiping peer, a gossip not newer than the last one of its epoch is ignored.
+    void ApplyGossip(const chat::RegistryGossip& gossip);
+    // Drops the servers of the peers that missed MISSED_HEARTBEATS gossips in a row, called periodically.
+    void ExpirePeers();
 
 private:
-    void SendToClients_unsafe(const chat::Envelope& env) const;
+    // Points per server on the hash ring, enough to spread rooms evenly over a handful of servers.
+    static constexpr int VIRTUAL_NODES = 128;
+    // Reports a server may miss before it is considered dead, tolerates a GC pause or a slow loop.
+    static constexpr int MISSED_HEARTBEATS = 3;
+    // How long server list changes are collected before subscribed clients are told.
+    static constexpr double DIFF_WINDOW = 0.25;
+    // Changes kept for incremental subscriptions, a client further behind gets a full list.
+    static constexpr size_t CHANGE_LOG_LIMIT = 1024;
+
+    // The subscribed clients owned by one IO loop, only touched on that loop so it needs no locking.
+    // A broadcast posts one task per loop and each task writes to its own sockets.
+    struct LoopClients {
+        std::unordered_set<drogon::WebSocketConnectionPtr> clients;
+    };
+
+    // A server registered to a peer aggregator, as of its last gossip.
+    struct RemoteServer {
+        std::string aggregator_id;
+        std::optional<chat::ServerLoadReport> load;
+        bool draining = false;
+        std::unordered_map<int32_t, uint32_t> room_load;
+    };
+
+    struct Peer {
+        uint64_t epoch = 0;
+        uint64_t seq = 0;
+        std::chrono::steady_clock::time_point expires;
+        std::vector<std::string> hosts;
+    };
+
+    struct ServerChange {
+        uint64_t version;
+        std::string host;
+        bool added;
+    };
+
+    // A request parked by WaitForServers, completed by the next republish or its timeout, whichever comes first.
+    struct ServerListWaiter {
+        std::function<void(std::shared_ptr<const ServerListSnapshot>)> done;
+        trantor::EventLoop* loop;
+        std::atomic<bool> completed = false;
+    };
+
+    DrogonServerRegistry();
+
+    // Runs fn against the client set of a loop, on that loop. Runs inline when already there.
+    void WithLoopClients(size_t loop_index, std::function<void(LoopClients&)> fn) const;
+    void RecordChange_unsafe(const std::string& host, bool added);
+    // Fills a diff from `from_version` to the current version, false if the change log no longer reaches back.
+    bool FillDiff_unsafe(uint64_t from_version, chat::ServerListDiff& diff) const;
+    void FillSnapshot_unsafe(chat::ServerListDiff& diff) const;
+    void FlushServerDiff();
+    // Rebuilds and publishes the snapshot returned by GetServers. Assumes m_mutex is held exclusively.
+    void PublishSnapshot_unsafe();
+    // Completes every parked GET /servers with the snapshot just published.
+    void WakeServerListWaiters(const std::shared_ptr<const ServerListSnapshot>& snapshot);
+    void Unsubscribe_unsafe(const drogon::WebSocketConnectionPtr& conn, int32_t room_id);
+    void SetRoomLoad_unsafe(const drogon::WebSocketConnectionPtr& conn, int32_t room_id, uint32_t connections);
+    // Whether a host is offered to clients, by its own connection if registered here, by its peer's gossip otherwise.
+    bool IsListed_unsafe(const std::string& host) const;
+    // Puts a host on or takes it off the ring after its listing may have changed, and records the change if it did.
+    void Relist_unsafe(const std::string& host, bool was_listed);
+    // Replaces the servers gossiped by a peer with `servers`, none for a peer that went away.
+    void SetPeerServers_unsafe(const std::string& aggregator_id, Peer& peer, const google::protobuf::RepeatedPtrField<chat::PeerServer>& servers);
+    // Calls fn with every listed host and its latest load report, local ones first.
+    void ForEachListed_unsafe(const std::function<void(const std::string&, const std::optional<chat::ServerLoadReport>&)>& fn) const;
+    void AddToRing_unsafe(const std::string& host);
+    void RemoveFromRing_unsafe(const std::string& host);
+    bool IsFull_unsafe(const std::string& host) const;
 
-    std::unordered_set<drogon::WebSocketConnectionPtr> m_conns;
+    // Client connections subscribed to the server list, per IO loop. The servers themselves are in m_host_id_to_conn.
+    mutable std::vector<LoopClients> m_loop_clients;
     std::unordered_map<std::string, drogon::WebSocketConnectionPtr> m_host_id_to_conn;
+    std::unordered_map<int32_t, std::unordered_set<drogon::WebSocketConnectionPtr>> m_room_subscribers;
+    // Ring position to host, each server owns the arc ending at its points.
+    std::map<uint64_t, std::string> m_ring;
+    // Room ID to the servers with members of it and their connection counts.
+    std::unordered_map<int32_t, std::unordered_map<drogon::WebSocketConnectionPtr, uint32_t>> m_room_load;
+    // The servers gossiped by the peers by host, and the peers by aggregator ID.
+    std::unordered_map<std::string, RemoteServer> m_remote_servers;
+    std::unordered_map<std::string, Peer> m_peers;
+    const uint64_t m_epoch;
+    uint64_t m_version = 0;
+    // The version the subscribed clients were last brought to.
+    uint64_t m_pushed_version = 0;
+    std::deque<ServerChange> m_changes;
+    bool m_diff_flush_armed = false;
+    std::atomic<std::shared_ptr<const ServerListSnapshot>> m_snapshot;
+    // Counts the republishes, the entity tag of a snapshot is the epoch and this.
+    uint64_t m_snapshot_generation = 0;
+    // Parked GET /servers, under their own lock so that waiting never contends with the registry.
+    std::vector<std::shared_ptr<ServerListWaiter>> m_waiters;
+    // Waiters that timed out stay until the next republish, they are swept once the list doubles.
+    size_t m_waiters_sweep_at = 64;
+    std::mutex m_waiters_mutex;
     mutable std::shared_mutex m_mutex;
 };
 
@@ -1,15 +1,49 @@
 #pragma once
 
+#include <common/utils/utils.h>
+
 namespace aggregator {
 
+struct RankedServer {
+    std::string host;
+    // Empty until the server sent its first load report.
+    std::optional<float> load;
+};
+
+// An immutable view of the registered servers, republished on every change and shared by all readers.
+struct ServerListSnapshot {
+    std::vector<RankedServer> servers;
+    // Least loaded first, servers that have not reported yet last.
+    std::vector<RankedServer> ranked;
+    // The matching GetServerNodesResponse envelopes, encoded once for every request until the next change.
+    common::SerializedEnvelope response;
+    common::SerializedEnvelope ranked_response;
+    // The ranked list as served by GET /servers, and its entity tag. The tag changes with
+    // every republish, a cached copy carrying it is current.
+    std::string json;
+    std::string etag;
+};
+
 class IServerRegistry {
 public:
     virtual ~IServerRegistry() = default;
-    virtual void AddConnection() = 0;
     virtual void AddServer() = 0;
     virtual void RemoveConnection() = 0;
-    virtual std::vector<std::string> GetServers() = 0;
-    virtual void SendToClients(const chat::Envelope& env) const = 0;
+    virtual std::shared_ptr<const ServerListSnapshot> GetServers() const = 0;
+    virtual chat::SubscribeServersResponse SubscribeServers(const chat::SubscribeServersRequest& req) = 0;
+    virtual void Subscribe(const std::vector<int32_t>& room_ids) = 0;
+    virtual void Unsubscribe(const std::vector<int32_t>& room_ids) = 0;
+    virtual void Publish(const chat::ClusterPublish& publish) const = 0;
+    virtual std::optional<std::string> GetRoomServer(int32_t room_id) const = 0;
+    virtual void ReportRoomLoad(const chat::RoomLoadReport& report) = 0;
+    virtual void ReportServerLoad(const chat::ServerLoadReport& report) = 0;
+    virtual void DrainServer() = 0;
+    virtual void ApplyGossip(const chat::RegistryGossip& gossip) = 0;
 };
 
+// A registry the MessageHandlers can be instantiated for: the final ServerRegistry in production, its calls
+// bound at compile time, or IServerRegistry itself for any other implementation through the interface.
+template<typename T>
+concept ServerRegistryLike = std::derived_from<T, IServerRegistry>;
+
 } // namespace aggregator
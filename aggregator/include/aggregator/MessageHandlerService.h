@@ -1,19 +1,32 @@
 #pragma once
 
+#include <common/utils/dispatch.h>
+
 namespace aggregator {
 
 class MessageHandlers;
-class IServerRegistry;
+class ServerRegistry;
 struct WsData;
 
+/// What a handler is given besides its request, see common::Dispatcher.
+struct HandlerContext {
+    const std::shared_ptr<WsData>& wsData;
+    // The concrete registry, so the handlers call DrogonServerRegistry without virtual calls.
+    ServerRegistry& registry;
+};
+
 class MessageHandlerService {
 public:
     explicit MessageHandlerService(std::unique_ptr<MessageHandlers> handlers);
     ~MessageHandlerService();
 
-    drogon::Task<chat::Envelope> processMessage(const std::shared_ptr<WsData>& wsData, const chat::Envelope& env, IServerRegistry& registry) const;
+    /// One-way messages leave the returned envelope empty, it is not to be sent.
+    drogon::Task<chat::Envelope> processMessage(const std::shared_ptr<WsData>& wsData, const chat::Envelope& env, ServerRegistry& registry) const;
 private:
+    void registerHandlers();
+
     std::unique_ptr<MessageHandlers> m_handlers;
+    common::Dispatcher<HandlerContext> m_dispatcher;
 };
 
 } // namespace aggregator
@@ -1,16 +1,47 @@
 #pragma once
 
 #include <drogon/orm/DbClient.h>
+#include <aggregator/IServerRegistry.h>
 
 namespace aggregator {
 
-class IServerRegistry;
 struct WsData;
 
+// Templates over the registry, instantiated in MessageHandlers.cpp for ServerRegistry and IServerRegistry.
 class MessageHandlers {
 public:
-    drogon::Task<chat::RegisterServerResponse> handleServerRegister(const std::shared_ptr<WsData>& wsData, const chat::RegisterServerRequest& req, IServerRegistry& registry) const;
-    drogon::Task<chat::GetServerNodesResponse> handleGetServers(const std::shared_ptr<WsData>& wsData, const chat::GetServerNodesRequest& req, IServerRegistry& registry) const;
+    template<ServerRegistryLike Registry>
+    drogon::Task<chat::RegisterServerResponse> handleServerRegister(const std::shared_ptr<WsData>& wsData, const chat::RegisterServerRequest& req, Registry& registry) const;
+    template<ServerRegistryLike Registry>
+    drogon::Task<chat::GetServerNodesResponse> handleGetServers(const std::shared_ptr<WsData>& wsData, const chat::GetServerNodesRequest& req, Registry& registry) const;
+    template<ServerRegistryLike Registry>
+    drogon::Task<chat::SubscribeServersResponse> handleSubscribeServers(const std::shared_ptr<WsData>& wsData, const chat::SubscribeServersRequest& req, Registry& registry) const;
+    template<ServerRegistryLike Registry>
+    drogon::Task<chat::GetRoomServerResponse> handleGetRoomServer(const std::shared_ptr<WsData>& wsData, const chat::GetRoomServerRequest& req, Registry& registry) const;
+    template<ServerRegistryLike Registry>
+    drogon::Task<chat::ListRoomsResponse> handleListRooms(const std::shared_ptr<WsData>& wsData, const chat::ListRoomsRequest& req, Registry& registry) const;
+
+    // Cluster traffic from registered servers, none of these get a response.
+    template<ServerRegistryLike Registry>
+    drogon::Task<> handleClusterSubscribe(const std::shared_ptr<WsData>& wsData, const chat::ClusterSubscribe& req, Registry& registry) const;
+    template<ServerRegistryLike Registry>
+    drogon::Task<> handleClusterUnsubscribe(const std::shared_ptr<WsData>& wsData, const chat::ClusterUnsubscribe& req, Registry& registry) const;
+    template<ServerRegistryLike Registry>
+    drogon::Task<> handleClusterPublish(const std::shared_ptr<WsData>& wsData, const chat::ClusterPublish& req, Registry& registry) const;
+    template<ServerRegistryLike Registry>
+    drogon::Task<> handleServerLoadReport(const std::shared_ptr<WsData>& wsData, const chat::ServerLoadReport& req, Registry& registry) const;
+    template<ServerRegistryLike Registry>
+    drogon::Task<> handleDrainServer(const std::shared_ptr<WsData>& wsData, const chat::DrainServerRequest& req, Registry& registry) const;
+    template<ServerRegistryLike Registry>
+    drogon::Task<> handleRoomLoadReport(const std::shared_ptr<WsData>& wsData, const chat::RoomLoadReport& req, Registry& registry) const;
+    template<ServerRegistryLike Registry>
+    drogon::Task<> handleRoomDirectoryUpdate(const std::shared_ptr<WsData>& wsData, const chat::RoomDirectoryUpdate& req, Registry& registry) const;
+
+    // Traffic from peer aggregators, see PeerGossip.
+    template<ServerRegistryLike Registry>
+    drogon::Task<> handleRegistryGossip(const std::shared_ptr<WsData>& wsData, const chat::RegistryGossip& req, Registry& registry) const;
+    template<ServerRegistryLike Registry>
+    drogon::Task<> handlePeerRelay(const std::shared_ptr<WsData>& wsData, const chat::PeerRelay& req, Registry& registry) const;
 };
 
 } // namespace aggregator
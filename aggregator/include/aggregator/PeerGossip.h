@@ -0,0 +1,67 @@
+#pragma once
+
+#include <drogon/WebSocketClient.h>
+#include <common/utils/utils.h>
+#include <random>
+#include <unordered_set>
+
+namespace aggregator {
+
+// Links this aggregator to its peers, so servers may register to any of them and clients may ask any of them.
+// Every interval each aggregator pushes the servers registered to it in a RegistryGossip to every peer,
+// which lists them next to its own ones. Cluster traffic of the local servers is relayed in a PeerRelay.
+// The peers form a full mesh, each aggregator dials every peer and only sends on the links it dialed.
+class PeerGossip {
+public:
+    static constexpr std::string_view PEER_TOKEN_HEADER = "X-Peer-Token";
+
+    static PeerGossip& instance();
+
+    // Connects to the peers of the "peers" section or of AGGREGATOR_PEERS, does nothing without any.
+    void Start(const Json::Value& config);
+    const std::string& Id() const;
+    // Whether a connection from `addr` that sent `token` in PEER_TOKEN_HEADER comes from a configured peer.
+    // With a token configured only the token counts, without one the address must be one a peer URL resolved to
+    // or a peer was reached at.
+    bool IsPeer(const trantor::InetAddress& addr, const std::string& token);
+    // Sends cluster traffic of the local servers to every connected peer, a peer that is down misses it.
+    void Relay(const chat::PeerRelay& relay);
+
+private:
+    // Reconnect delays double per failed attempt up to this.
+    static constexpr double MAX_RECONNECT_DELAY = 30.0;
+    static constexpr double MIN_RECONNECT_DELAY = 0.5;
+
+    struct Link {
+        std::string server;
+        std::string path;
+        drogon::WebSocketClientPtr client;
+        drogon::WebSocketConnectionPtr conn;
+        uint32_t attempt = 0;
+    };
+
+    PeerGossip();
+
+    // Opens a new connection to a peer. Assumes m_mutex is held.
+    void Connect_unsafe(size_t index);
+    void ScheduleReconnect_unsafe(size_t index);
+    // Pushes the local servers to every connected peer.
+    void SendGossip();
+    void Send_unsafe(const common::SerializedEnvelope& bytes);
+
+    std::mutex m_mutex;
+    // Fixed once started, callbacks refer to a link by its index.
+    std::vector<Link> m_links;
+    std::string m_id;
+    // Shared by the peers, sent when dialing them, from "token" or AGGREGATOR_PEER_TOKEN.
+    std::string m_token;
+    // The addresses the peer URLs resolved to at start and the ones the peers were reached at since.
+    std::unordered_set<std::string> m_peer_ips;
+    // Wall clock based, a restarted aggregator starts a new epoch its peers do not confuse with the old one.
+    const uint64_t m_epoch;
+    uint64_t m_seq = 0;
+    std::chrono::milliseconds m_interval{1000};
+    std::minstd_rand m_rng{std::random_device{}()};
+};
+
+} // namespace aggregator
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <set>
+#include <shared_mutex>
+
+namespace aggregator {
+
+// Every room of the cluster with its member count, kept from the RoomDirectoryUpdate of the servers,
+// so clients can browse and search rooms before picking a server to connect to.
+// A few dozen bytes per room, tens of thousands of rooms fit in a few megabytes.
+class RoomDirectory {
+public:
+    static RoomDirectory& instance();
+
+    void Apply(const chat::RoomDirectoryUpdate& update);
+    // Whether a snapshot arrived since the aggregator started, until then servers are asked for one.
+    bool Populated() const;
+    // A page of the rooms whose names start with the prefix, without their hosts.
+    chat::ListRoomsResponse List(const chat::ListRoomsRequest& req) const;
+
+private:
+    static constexpr uint32_t DEFAULT_PAGE_SIZE = 50;
+    static constexpr uint32_t MAX_PAGE_SIZE = 100;
+
+    struct Room {
+        std::string name;
+        uint32_t member_count = 0;
+    };
+
+    // Rooms ordered by their folded name, then ID, a prefix is a contiguous range.
+    using NameKey = std::pair<std::string, int32_t>;
+
+    RoomDirectory() = default;
+
+    void Upsert_unsafe(const chat::RoomDirectoryEntry& entry);
+    void Remove_unsafe(int32_t room_id);
+
+    std::unordered_map<int32_t, Room> m_rooms;
+    std::set<NameKey, std::less<>> m_by_name;
+    bool m_populated = false;
+    mutable std::shared_mutex m_mutex;
+};
+
+} // namespace aggregator
@@ -1,18 +1,30 @@
 #pragma once
 
 #include <aggregator/IServerRegistry.h>
+#include <aggregator/DrogonServerRegistry.h>
 #include <drogon/WebSocketConnection.h>
 
 namespace aggregator {
 
-class ServerRegistry : public IServerRegistry {
+// The registry as seen by one connection, forwarding to DrogonServerRegistry. Built on the stack per request,
+// and final with its forwards inline so the handlers instantiated for it call the registry directly.
+class ServerRegistry final : public IServerRegistry {
 public:
-    ServerRegistry(const drogon::WebSocketConnectionPtr& conn);
-    void AddConnection() override;
-    void AddServer() override;
-    void RemoveConnection() override;
-    std::vector<std::string> GetServers() override;
-    void SendToClients(const chat::Envelope& env) const override;
+    ServerRegistry(const drogon::WebSocketConnectionPtr& conn) : m_conn(conn) {}
+    void AddServer() override { DrogonServerRegistry::instance().AddServer(m_conn); }
+    void RemoveConnection() override { DrogonServerRegistry::instance().RemoveConnection(m_conn); }
+    std::shared_ptr<const ServerListSnapshot> GetServers() const override { return DrogonServerRegistry::instance().GetServers(); }
+    chat::SubscribeServersResponse SubscribeServers(const chat::SubscribeServersRequest& req) override {
+        return DrogonServerRegistry::instance().SubscribeServers(m_conn, req);
+    }
+    void Subscribe(const std::vector<int32_t>& room_ids) override { DrogonServerRegistry::instance().Subscribe(m_conn, room_ids); }
+    void Unsubscribe(const std::vector<int32_t>& room_ids) override { DrogonServerRegistry::instance().Unsubscribe(m_conn, room_ids); }
+    void Publish(const chat::ClusterPublish& publish) const override { DrogonServerRegistry::instance().Publish(m_conn, publish); }
+    std::optional<std::string> GetRoomServer(int32_t room_id) const override { return DrogonServerRegistry::instance().GetRoomServer(room_id); }
+    void ReportRoomLoad(const chat::RoomLoadReport& report) override { DrogonServerRegistry::instance().ReportRoomLoad(m_conn, report); }
+    void ReportServerLoad(const chat::ServerLoadReport& report) override { DrogonServerRegistry::instance().ReportServerLoad(m_conn, report); }
+    void DrainServer() override { DrogonServerRegistry::instance().DrainServer(m_conn); }
+    void ApplyGossip(const chat::RegistryGossip& gossip) override { DrogonServerRegistry::instance().ApplyGossip(gossip); }
 
 private:
     const drogon::WebSocketConnectionPtr& m_conn;
@@ -4,6 +4,25 @@ namespace aggregator {
 
 struct WsData {
     std::optional<std::string> serverHost;
+    // Where the connection comes from and the peer token it sent, checked by PeerGossip::IsPeer on every gossip.
+    trantor::InetAddress remoteAddr;
+    std::string peerToken;
+    // Set once a configured peer aggregator gossiped over the connection, only peers may relay cluster traffic.
+    std::optional<std::string> peerId;
+    // The IO loop that owns the connection, its client set lives in that loop's slot of the registry.
+    size_t loopIndex = 0;
+    // How often a server promised to report its load, 0 if it is never evicted for silence.
+    std::chrono::milliseconds heartbeatInterval{0};
+    // When the server registered or last reported, guarded by the registry's mutex.
+    std::chrono::steady_clock::time_point lastHeartbeat;
+    // The rooms a server subscribed to, guarded by the registry's mutex.
+    std::unordered_set<int32_t> rooms;
+    // The last reported connection count per room of a server, guarded by the registry's mutex.
+    std::unordered_map<int32_t, uint32_t> room_load;
+    // The latest health and capacity report of a server, guarded by the registry's mutex.
+    std::optional<chat::ServerLoadReport> load;
+    // Set once a server announced it is shutting down, guarded by the registry's mutex.
+    bool draining = false;
 };
 
 } // namespace aggregator
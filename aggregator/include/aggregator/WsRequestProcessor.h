@@ -11,8 +11,11 @@ public:
     explicit WsRequestProcessor(std::unique_ptr<MessageHandlerService> dispatcher);
     ~WsRequestProcessor();
 
-    drogon::Task<> handleIncomingMessage(drogon::WebSocketConnectionPtr conn, std::string bytes) const;
+    /// Parses a frame before returning, then handles the request on a coroutine of its own.
+    void handleIncomingMessage(const drogon::WebSocketConnectionPtr& conn, std::string_view bytes) const;
 private:
+    drogon::Task<> processRequest(drogon::WebSocketConnectionPtr conn, chat::Envelope env) const;
+
     std::unique_ptr<MessageHandlerService> m_dispatcher;
 };
 
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <drogon/HttpController.h>
+
+namespace aggregator {
+
+// The server list over plain HTTP, so that a client only looking for a server needs no WebSocket.
+// GET /servers answers the ranked list as JSON with an ETag: a request whose If-None-Match
+// carries it gets 304, with `wait=<seconds>` only once the list changed or the wait ran out.
+class HttpController : public drogon::HttpController<HttpController> {
+public:
+    void listServers(const drogon::HttpRequestPtr& req, std::function<void(const drogon::HttpResponsePtr&)>&& callback) const;
+    // A CPU profile of the next `seconds` or a heap snapshot of this aggregator, see common::Profiler.
+    // Only with `profiling.enabled` and its `token` sent as `Authorization: Bearer <token>`.
+    void profile(const drogon::HttpRequestPtr& req, std::function<void(const drogon::HttpResponsePtr&)>&& callback, const std::string& kind) const;
+
+    METHOD_LIST_BEGIN
+        ADD_METHOD_TO(HttpController::listServers, "/servers", drogon::Get);
+        ADD_METHOD_TO(HttpController::profile, "/debug/profile/{1}", drogon::Get);
+    METHOD_LIST_END
+
+private:
+    // The longest a poll is held, below the idle timeout of the proxies in between.
+    static constexpr double MAX_WAIT_SECONDS = 55;
+};
+
+} // namespace aggregator
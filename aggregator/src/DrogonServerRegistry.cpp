@@ -1,63 +1,626 @@
 #include <aggregator/DrogonServerRegistry.h>
 #include <aggregator/WsData.h>
 #include <common/utils/utils.h>
+#include <cmath>
 
 namespace aggregator {
 
+// FNV-1a, stable across runs unlike std::hash, so a restarted aggregator places rooms the same way.
+static uint64_t hashBytes(std::string_view bytes) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(unsigned char c : bytes) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// The splitmix64 finalizer, spreads sequential room IDs and similar host names over the whole ring.
+static uint64_t mixHash(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t ringPoint(const std::string& host, int replica) {
+    return mixHash(hashBytes(host + "#" + std::to_string(replica)));
+}
+
 DrogonServerRegistry& DrogonServerRegistry::instance() {
     static DrogonServerRegistry inst;
     return inst;
 }
 
-void DrogonServerRegistry::AddConnection(const drogon::WebSocketConnectionPtr& conn) {
-    std::unique_lock lock(m_mutex);
-    m_conns.insert(conn);
+// Wall clock based, so a restarted aggregator does not reuse the epoch clients remember.
+DrogonServerRegistry::DrogonServerRegistry()
+    : m_epoch(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count())) {
+    m_loop_clients.resize(std::max<size_t>(drogon::app().getThreadNum(), 1));
+    PublishSnapshot_unsafe();
+}
+
+void DrogonServerRegistry::WithLoopClients(size_t loop_index, std::function<void(LoopClients&)> fn) const {
+    if(loop_index >= m_loop_clients.size()) {
+        LOG_WARN << "Connection of unknown IO loop " << loop_index << ", falling back to loop 0";
+        loop_index = 0;
+    }
+    drogon::app().getIOLoop(loop_index)->runInLoop([this, loop_index, fn = std::move(fn)] {
+        fn(m_loop_clients[loop_index]);
+    });
 }
 
 void DrogonServerRegistry::AddServer(const drogon::WebSocketConnectionPtr& conn) {
     std::unique_lock lock(m_mutex);
     auto& ws_data = conn->getContextRef<WsData>();
-    m_host_id_to_conn[*ws_data.serverHost] = conn;
+    ws_data.lastHeartbeat = std::chrono::steady_clock::now();
+    WithLoopClients(ws_data.loopIndex, [conn](LoopClients& loop) { loop.clients.erase(conn); });
+    const auto& host = *ws_data.serverHost;
+    // Possibly listed already, through its previous connection or by a peer it was registered to before.
+    const bool was_listed = IsListed_unsafe(host);
+    auto [it, added] = m_host_id_to_conn.try_emplace(host, conn);
+    if(!added) {
+        // The server reconnected before its old connection was noticed to be dead, the new one takes over.
+        if(it->second != conn) {
+            LOG_INFO << "Server " << host << " re-registered, closing its previous connection";
+            auto stale = std::exchange(it->second, conn);
+            // Listed again if it restarted after draining.
+            Relist_unsafe(host, was_listed);
+            PublishSnapshot_unsafe();
+            lock.unlock();
+            // Outside the lock, the close handler may run right away and calls RemoveConnection.
+            stale->forceClose();
+        }
+        return;
+    }
+    Relist_unsafe(host, was_listed);
+    PublishSnapshot_unsafe();
+}
+
+void DrogonServerRegistry::RemoveConnection(const drogon::WebSocketConnectionPtr& conn) {
+    std::unique_lock lock(m_mutex);
+    auto& ws_data = conn->getContextRef<WsData>();
+    WithLoopClients(ws_data.loopIndex, [conn](LoopClients& loop) { loop.clients.erase(conn); });
+    for(int32_t room_id : ws_data.rooms) {
+        if(auto it = m_room_subscribers.find(room_id); it != m_room_subscribers.end()) {
+            it->second.erase(conn);
+            if(it->second.empty()) {
+                m_room_subscribers.erase(it);
+            }
+        }
+    }
+    ws_data.rooms.clear();
+    for(const auto& [room_id, connections] : ws_data.room_load) {
+        if(auto it = m_room_load.find(room_id); it != m_room_load.end()) {
+            it->second.erase(conn);
+            if(it->second.empty()) {
+                m_room_load.erase(it);
+            }
+        }
+    }
+    ws_data.room_load.clear();
+    // A connection replaced by a re-registration no longer owns its host.
+    if(auto it = ws_data.serverHost ? m_host_id_to_conn.find(*ws_data.serverHost) : m_host_id_to_conn.end();
+       it != m_host_id_to_conn.end() && it->second == conn) {
+        // A drained server was unlisted already, one a peer lists too stays.
+        const bool was_listed = IsListed_unsafe(*ws_data.serverHost);
+        m_host_id_to_conn.erase(it);
+        Relist_unsafe(*ws_data.serverHost, was_listed);
+        PublishSnapshot_unsafe();
+    }
+}
+
+void DrogonServerRegistry::DrainServer(const drogon::WebSocketConnectionPtr& conn) {
+    std::unique_lock lock(m_mutex);
+    auto& ws_data = conn->getContextRef<WsData>();
+    if(ws_data.draining) {
+        return;
+    }
+    const bool was_listed = IsListed_unsafe(*ws_data.serverHost);
+    ws_data.draining = true;
+    if(auto it = m_host_id_to_conn.find(*ws_data.serverHost); it != m_host_id_to_conn.end() && it->second == conn) {
+        Relist_unsafe(*ws_data.serverHost, was_listed);
+        PublishSnapshot_unsafe();
+    }
+}
+
+std::shared_ptr<const ServerListSnapshot> DrogonServerRegistry::GetServers() const {
+    return m_snapshot.load(std::memory_order_acquire);
+}
+
+chat::SubscribeServersResponse DrogonServerRegistry::SubscribeServers(const drogon::WebSocketConnectionPtr& conn, const chat::SubscribeServersRequest& req) {
+    chat::SubscribeServersResponse resp;
+    std::unique_lock lock(m_mutex);
+    // Inline on the connection's loop, so every diff flushed after this response reaches the client.
+    WithLoopClients(conn->getContextRef<WsData>().loopIndex, [conn](LoopClients& loop) { loop.clients.insert(conn); });
+    // From now on the client gets every push, the response brings it to the current version.
+    const bool known = req.has_epoch() && req.epoch() == m_epoch && req.has_version() && req.version() <= m_version;
+    if(known && FillDiff_unsafe(req.version(), *resp.mutable_diff())) {
+        resp.set_incremental(true);
+    } else {
+        resp.clear_diff();
+        FillSnapshot_unsafe(*resp.mutable_diff());
+    }
+    return resp;
+}
 
+void DrogonServerRegistry::RecordChange_unsafe(const std::string& host, bool added) {
+    m_changes.push_back({ ++m_version, host, added });
+    if(m_changes.size() > CHANGE_LOG_LIMIT) {
+        m_changes.pop_front();
+    }
+    if(m_diff_flush_armed) {
+        return;
+    }
+    m_diff_flush_armed = true;
+    drogon::app().getLoop()->runAfter(DIFF_WINDOW, [this] { FlushServerDiff(); });
+}
+
+bool DrogonServerRegistry::FillDiff_unsafe(uint64_t from_version, chat::ServerListDiff& diff) const {
+    if(from_version < m_version && (m_changes.empty() || m_changes.front().version > from_version + 1)) {
+        return false;
+    }
+    diff.set_epoch(m_epoch);
+    diff.set_from_version(from_version);
+    diff.set_version(m_version);
+
+    // Only the last change of each host counts, an add followed by a remove is just a remove.
+    std::unordered_map<std::string_view, bool> net;
+    for(auto it = m_changes.rbegin(); it != m_changes.rend() && it->version > from_version; ++it) {
+        net.try_emplace(it->host, it->added);
+    }
+    for(const auto& [host, added] : net) {
+        if(added) {
+            diff.add_added()->set_host(std::string(host));
+        } else {
+            diff.add_removed(std::string(host));
+        }
+    }
+    return true;
+}
+
+void DrogonServerRegistry::FillSnapshot_unsafe(chat::ServerListDiff& diff) const {
+    diff.set_epoch(m_epoch);
+    diff.set_from_version(0);
+    diff.set_version(m_version);
+    ForEachListed_unsafe([&diff](const std::string& host, const std::optional<chat::ServerLoadReport>&) {
+        diff.add_added()->set_host(host);
+    });
+}
+
+void DrogonServerRegistry::FlushServerDiff() {
     chat::Envelope env;
-    env.mutable_server_added()->mutable_server()->set_host(*ws_data.serverHost);
-    SendToClients_unsafe(env);
+    {
+        std::unique_lock lock(m_mutex);
+        m_diff_flush_armed = false;
+        if(m_pushed_version == m_version) {
+            return;
+        }
+        // A burst of more than CHANGE_LOG_LIMIT changes in one window outruns the log, clients then get the full list.
+        if(!FillDiff_unsafe(m_pushed_version, *env.mutable_server_list_diff())) {
+            env.clear_server_list_diff();
+            FillSnapshot_unsafe(*env.mutable_server_list_diff());
+        }
+        m_pushed_version = m_version;
+    }
+    // Encoded once, every client receives the same buffer.
+    const auto bytes = common::serializeEnvelope(env);
+    if(!bytes) {
+        return;
+    }
+    for(size_t loop_index = 0; loop_index < m_loop_clients.size(); ++loop_index) {
+        WithLoopClients(loop_index, [bytes](LoopClients& loop) {
+            for(const auto& conn : loop.clients) {
+                common::sendSerialized(conn, bytes);
+            }
+        });
+    }
 }
 
-void DrogonServerRegistry::RemoveConnection(const drogon::WebSocketConnectionPtr& conn) {
+void DrogonServerRegistry::Subscribe(const drogon::WebSocketConnectionPtr& conn, const std::vector<int32_t>& room_ids) {
     std::unique_lock lock(m_mutex);
     auto& ws_data = conn->getContextRef<WsData>();
-    m_conns.erase(conn);
-    if(ws_data.serverHost) {
-        m_host_id_to_conn.erase(*ws_data.serverHost);
-        chat::Envelope env;
-        env.mutable_server_removed()->mutable_server()->set_host(*ws_data.serverHost);
-        SendToClients_unsafe(env);
+    for(int32_t room_id : room_ids) {
+        ws_data.rooms.insert(room_id);
+        m_room_subscribers[room_id].insert(conn);
+    }
+}
+
+void DrogonServerRegistry::Unsubscribe(const drogon::WebSocketConnectionPtr& conn, const std::vector<int32_t>& room_ids) {
+    std::unique_lock lock(m_mutex);
+    for(int32_t room_id : room_ids) {
+        Unsubscribe_unsafe(conn, room_id);
     }
 }
 
-std::vector<std::string> DrogonServerRegistry::GetServers() {
+void DrogonServerRegistry::Unsubscribe_unsafe(const drogon::WebSocketConnectionPtr& conn, int32_t room_id) {
+    conn->getContextRef<WsData>().rooms.erase(room_id);
+    if(auto it = m_room_subscribers.find(room_id); it != m_room_subscribers.end()) {
+        it->second.erase(conn);
+        if(it->second.empty()) {
+            m_room_subscribers.erase(it);
+        }
+    }
+}
+
+void DrogonServerRegistry::Publish(const drogon::WebSocketConnectionPtr& origin, const chat::ClusterPublish& publish) const {
+    chat::Envelope env;
+    *env.mutable_cluster_publish() = publish;
+    // Encoded once, every target server receives the same buffer.
+    const auto bytes = common::serializeEnvelope(env);
+    if(!bytes) {
+        return;
+    }
+
     std::shared_lock lock(m_mutex);
-    std::vector<std::string> resp;
-    resp.reserve(m_host_id_to_conn.size());
-    for(const auto& p : m_host_id_to_conn) {
-        resp.emplace_back(p.first);
+    if(publish.has_room_id()) {
+        if(auto it = m_room_subscribers.find(publish.room_id()); it != m_room_subscribers.end()) {
+            for(const auto& conn : it->second) {
+                if(conn != origin) {
+                    common::sendSerialized(conn, bytes);
+                }
+            }
+        }
+        return;
+    }
+    for(const auto& [host, conn] : m_host_id_to_conn) {
+        if(conn != origin) {
+            common::sendSerialized(conn, bytes);
+        }
     }
-    return resp;
 }
 
-void DrogonServerRegistry::SendToClients(const chat::Envelope& env) const {
+std::optional<std::string> DrogonServerRegistry::GetRoomServer(int32_t room_id) const {
     std::shared_lock lock(m_mutex);
-    SendToClients_unsafe(env);
+    const std::string* busiest = nullptr;
+    uint32_t most = 0;
+    if(auto it = m_room_load.find(room_id); it != m_room_load.end()) {
+        for(const auto& [conn, connections] : it->second) {
+            const auto& ws_data = conn->getContextRef<WsData>();
+            if(connections > most && !ws_data.draining && ws_data.serverHost) {
+                busiest = &*ws_data.serverHost;
+                most = connections;
+            }
+        }
+    }
+    // The servers of the peers count the same, so every aggregator sends a room's members to the same server.
+    for(const auto& [host, remote] : m_remote_servers) {
+        if(remote.draining || m_host_id_to_conn.contains(host)) {
+            continue;
+        }
+        if(auto room = remote.room_load.find(room_id); room != remote.room_load.end() && room->second > most) {
+            busiest = &host;
+            most = room->second;
+        }
+    }
+    if(busiest) {
+        return *busiest;
+    }
+    if(m_ring.empty()) {
+        return std::nullopt;
+    }
+    const auto start = m_ring.lower_bound(mixHash(static_cast<uint32_t>(room_id)));
+    auto it = start == m_ring.end() ? m_ring.begin() : start;
+    const auto owner = it;
+    // Walks clockwise past full servers, every server has many points so this ends after a few steps.
+    for(size_t step = 0; step < m_ring.size(); ++step) {
+        if(!IsFull_unsafe(it->second)) {
+            return it->second;
+        }
+        if(++it == m_ring.end()) {
+            it = m_ring.begin();
+        }
+    }
+    // Everyone is full, stick to the owner rather than scattering the room.
+    return owner->second;
+}
+
+static common::SerializedEnvelope encodeServers(const std::vector<RankedServer>& servers, bool with_load) {
+    chat::Envelope env;
+    auto* resp = env.mutable_get_servers_response();
+    for(const auto& server : servers) {
+        auto* server_info = resp->add_servers();
+        server_info->set_host(server.host);
+        if(with_load && server.load) {
+            server_info->set_load(*server.load);
+        }
+    }
+    common::setStatus(*resp, chat::STATUS_SUCCESS);
+    return common::serializeEnvelope(env);
 }
 
-void DrogonServerRegistry::SendToClients_unsafe(const chat::Envelope& env) const {
-    for(const auto& conn : m_conns) {
-        auto& ws_data = conn->getContextRef<WsData>();
-        if(ws_data.serverHost) {
+static std::string encodeServersJson(const std::vector<RankedServer>& servers, uint64_t epoch, uint64_t version) {
+    Json::Value root;
+    root["epoch"] = static_cast<Json::UInt64>(epoch);
+    root["version"] = static_cast<Json::UInt64>(version);
+    auto& list = root["servers"];
+    list = Json::arrayValue;
+    for(const auto& server : servers) {
+        Json::Value entry;
+        entry["host"] = server.host;
+        // Rounded to a tenth, finer changes are noise to a client picking a server.
+        if(server.load) {
+            entry["load"] = std::round(*server.load * 10.0) / 10.0;
+        }
+        list.append(std::move(entry));
+    }
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    return Json::writeString(builder, root);
+}
+
+void DrogonServerRegistry::PublishSnapshot_unsafe() {
+    auto snapshot = std::make_shared<ServerListSnapshot>();
+    snapshot->servers.reserve(m_host_id_to_conn.size() + m_remote_servers.size());
+    ForEachListed_unsafe([&snapshot](const std::string& host, const std::optional<chat::ServerLoadReport>& load) {
+        snapshot->servers.push_back({ host, load ? std::optional<float>(load->load()) : std::nullopt });
+    });
+    snapshot->ranked = snapshot->servers;
+    std::ranges::stable_sort(snapshot->ranked, [](const RankedServer& a, const RankedServer& b) {
+        if(a.load.has_value() != b.load.has_value()) {
+            return a.load.has_value();
+        }
+        return a.load.value_or(0) < b.load.value_or(0);
+    });
+    snapshot->response = encodeServers(snapshot->servers, false);
+    snapshot->ranked_response = encodeServers(snapshot->ranked, true);
+    snapshot->json = encodeServersJson(snapshot->ranked, m_epoch, m_version);
+    // Most republishes are load reports that did not move a server by a tenth, the tag and the pollers stay.
+    const auto previous = m_snapshot.load(std::memory_order_relaxed);
+    const bool changed = !previous || previous->json != snapshot->json;
+    snapshot->etag = changed ? "\"" + std::to_string(m_epoch) + "-" + std::to_string(++m_snapshot_generation) + "\"" : previous->etag;
+    std::shared_ptr<const ServerListSnapshot> published = std::move(snapshot);
+    m_snapshot.store(published, std::memory_order_release);
+    if(changed) {
+        WakeServerListWaiters(published);
+    }
+}
+
+void DrogonServerRegistry::WaitForServers(const std::string& etag, double timeout,
+                                          std::function<void(std::shared_ptr<const ServerListSnapshot>)> done) {
+    auto* loop = trantor::EventLoop::getEventLoopOfCurrentThread();
+    auto waiter = std::make_shared<ServerListWaiter>(std::move(done), loop);
+    std::shared_ptr<const ServerListSnapshot> changed;
+    {
+        std::lock_guard lock(m_waiters_mutex);
+        // Republished before the lock, a waker taking it after us sees the waiter.
+        if(auto current = GetServers(); current->etag != etag) {
+            changed = std::move(current);
+        } else {
+            if(m_waiters.size() >= m_waiters_sweep_at) {
+                std::erase_if(m_waiters, [](const auto& parked) { return parked->completed.load(); });
+                m_waiters_sweep_at = std::max<size_t>(64, m_waiters.size() * 2);
+            }
+            m_waiters.push_back(waiter);
+        }
+    }
+    if(changed) {
+        waiter->done(std::move(changed));
+        return;
+    }
+    loop->runAfter(timeout, [this, waiter] {
+        if(!waiter->completed.exchange(true)) {
+            waiter->done(GetServers());
+        }
+    });
+}
+
+void DrogonServerRegistry::WakeServerListWaiters(const std::shared_ptr<const ServerListSnapshot>& snapshot) {
+    std::vector<std::shared_ptr<ServerListWaiter>> waiters;
+    {
+        std::lock_guard lock(m_waiters_mutex);
+        waiters.swap(m_waiters);
+        m_waiters_sweep_at = 64;
+    }
+    for(auto& waiter : waiters) {
+        if(waiter->completed.exchange(true)) {
+            continue;
+        }
+        waiter->loop->queueInLoop([waiter, snapshot] { waiter->done(snapshot); });
+    }
+}
+
+void DrogonServerRegistry::ReportServerLoad(const drogon::WebSocketConnectionPtr& conn, const chat::ServerLoadReport& report) {
+    std::unique_lock lock(m_mutex);
+    auto& ws_data = conn->getContextRef<WsData>();
+    ws_data.load = report;
+    ws_data.lastHeartbeat = std::chrono::steady_clock::now();
+    // The ranking may have changed, only a listed server can move in it.
+    if(ws_data.serverHost && m_host_id_to_conn.contains(*ws_data.serverHost)) {
+        PublishSnapshot_unsafe();
+    }
+}
+
+void DrogonServerRegistry::EvictSilentServers() {
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<drogon::WebSocketConnectionPtr> silent;
+    {
+        std::shared_lock lock(m_mutex);
+        for(const auto& [host, conn] : m_host_id_to_conn) {
+            const auto& ws_data = conn->getContextRef<WsData>();
+            if(ws_data.heartbeatInterval.count() > 0 && now - ws_data.lastHeartbeat > ws_data.heartbeatInterval * MISSED_HEARTBEATS) {
+                LOG_WARN << "Server " << host << " stopped reporting, evicting it";
+                silent.push_back(conn);
+            }
+        }
+    }
+    // Outside the lock, the close handler removes the server through RemoveConnection.
+    for(const auto& conn : silent) {
+        conn->forceClose();
+    }
+}
+
+bool DrogonServerRegistry::IsFull_unsafe(const std::string& host) const {
+    if(auto it = m_host_id_to_conn.find(host); it != m_host_id_to_conn.end()) {
+        const auto& ws_data = it->second->getContextRef<WsData>();
+        return ws_data.draining || (ws_data.load && ws_data.load->load() >= 1.0f);
+    }
+    if(auto it = m_remote_servers.find(host); it != m_remote_servers.end()) {
+        const auto& remote = it->second;
+        return remote.draining || (remote.load && remote.load->load() >= 1.0f);
+    }
+    return true;
+}
+
+bool DrogonServerRegistry::IsListed_unsafe(const std::string& host) const {
+    if(auto it = m_host_id_to_conn.find(host); it != m_host_id_to_conn.end()) {
+        return !it->second->getContextRef<WsData>().draining;
+    }
+    auto it = m_remote_servers.find(host);
+    return it != m_remote_servers.end() && !it->second.draining;
+}
+
+void DrogonServerRegistry::Relist_unsafe(const std::string& host, bool was_listed) {
+    const bool listed = IsListed_unsafe(host);
+    if(listed == was_listed) {
+        return;
+    }
+    if(listed) {
+        AddToRing_unsafe(host);
+    } else {
+        RemoveFromRing_unsafe(host);
+    }
+    RecordChange_unsafe(host, listed);
+}
+
+void DrogonServerRegistry::ForEachListed_unsafe(const std::function<void(const std::string&, const std::optional<chat::ServerLoadReport>&)>& fn) const {
+    for(const auto& [host, conn] : m_host_id_to_conn) {
+        const auto& ws_data = conn->getContextRef<WsData>();
+        if(!ws_data.draining) {
+            fn(host, ws_data.load);
+        }
+    }
+    for(const auto& [host, remote] : m_remote_servers) {
+        if(!remote.draining && !m_host_id_to_conn.contains(host)) {
+            fn(host, remote.load);
+        }
+    }
+}
+
+void DrogonServerRegistry::FillGossip(chat::RegistryGossip& gossip) const {
+    std::shared_lock lock(m_mutex);
+    // Only the servers registered here, each aggregator speaks for its own ones.
+    for(const auto& [host, conn] : m_host_id_to_conn) {
+        const auto& ws_data = conn->getContextRef<WsData>();
+        auto* server = gossip.add_servers();
+        server->set_host(host);
+        if(ws_data.load) {
+            *server->mutable_load() = *ws_data.load;
+        }
+        server->set_draining(ws_data.draining);
+        for(const auto& [room_id, connections] : ws_data.room_load) {
+            auto* room = server->add_room_load();
+            room->set_room_id(room_id);
+            room->set_connections(connections);
+        }
+    }
+}
+
+void DrogonServerRegistry::ApplyGossip(const chat::RegistryGossip& gossip) {
+    std::unique_lock lock(m_mutex);
+    auto& peer = m_peers[gossip.aggregator_id()];
+    if(gossip.epoch() < peer.epoch || (gossip.epoch() == peer.epoch && gossip.seq() <= peer.seq)) {
+        return;
+    }
+    if(gossip.epoch() != peer.epoch) {
+        LOG_INFO << "Peer aggregator " << gossip.aggregator_id() << " gossips " << gossip.servers_size() << " servers";
+    }
+    peer.epoch = gossip.epoch();
+    peer.seq = gossip.seq();
+    const auto interval = std::chrono::milliseconds{std::max<uint32_t>(gossip.interval_ms(), 100)};
+    peer.expires = std::chrono::steady_clock::now() + interval * MISSED_HEARTBEATS;
+    SetPeerServers_unsafe(gossip.aggregator_id(), peer, gossip.servers());
+    PublishSnapshot_unsafe();
+}
+
+void DrogonServerRegistry::ExpirePeers() {
+    const auto now = std::chrono::steady_clock::now();
+    std::unique_lock lock(m_mutex);
+    bool expired = false;
+    for(auto it = m_peers.begin(); it != m_peers.end();) {
+        if(it->second.expires > now) {
+            ++it;
+            continue;
+        }
+        LOG_WARN << "Peer aggregator " << it->first << " stopped gossiping, unlisting its " << it->second.hosts.size() << " servers";
+        SetPeerServers_unsafe(it->first, it->second, {});
+        it = m_peers.erase(it);
+        expired = true;
+    }
+    if(expired) {
+        PublishSnapshot_unsafe();
+    }
+}
+
+void DrogonServerRegistry::SetPeerServers_unsafe(const std::string& aggregator_id, Peer& peer, const google::protobuf::RepeatedPtrField<chat::PeerServer>& servers) {
+    // Whether each touched host was listed before, to record only the hosts that changed.
+    std::unordered_map<std::string, bool> was_listed;
+    for(const auto& host : peer.hosts) {
+        // The server may have moved to another peer since, whose listing stays.
+        auto it = m_remote_servers.find(host);
+        if(it == m_remote_servers.end() || it->second.aggregator_id != aggregator_id) {
             continue;
         }
-        common::sendEnvelope(conn, env);
+        was_listed.try_emplace(host, IsListed_unsafe(host));
+        m_remote_servers.erase(it);
+    }
+    peer.hosts.clear();
+    for(const auto& server : servers) {
+        was_listed.try_emplace(server.host(), IsListed_unsafe(server.host()));
+        RemoteServer remote;
+        remote.aggregator_id = aggregator_id;
+        if(server.has_load()) {
+            remote.load = server.load();
+        }
+        remote.draining = server.draining();
+        for(const auto& room : server.room_load()) {
+            remote.room_load[room.room_id()] = room.connections();
+        }
+        m_remote_servers.insert_or_assign(server.host(), std::move(remote));
+        peer.hosts.push_back(server.host());
+    }
+    for(const auto& [host, listed] : was_listed) {
+        Relist_unsafe(host, listed);
+    }
+}
+
+void DrogonServerRegistry::ReportRoomLoad(const drogon::WebSocketConnectionPtr& conn, const chat::RoomLoadReport& report) {
+    std::unique_lock lock(m_mutex);
+    for(const auto& room : report.rooms()) {
+        SetRoomLoad_unsafe(conn, room.room_id(), room.connections());
+    }
+}
+
+void DrogonServerRegistry::SetRoomLoad_unsafe(const drogon::WebSocketConnectionPtr& conn, int32_t room_id, uint32_t connections) {
+    auto& ws_data = conn->getContextRef<WsData>();
+    if(connections > 0) {
+        ws_data.room_load[room_id] = connections;
+        m_room_load[room_id][conn] = connections;
+        return;
+    }
+    ws_data.room_load.erase(room_id);
+    if(auto it = m_room_load.find(room_id); it != m_room_load.end()) {
+        it->second.erase(conn);
+        if(it->second.empty()) {
+            m_room_load.erase(it);
+        }
+    }
+}
+
+void DrogonServerRegistry::AddToRing_unsafe(const std::string& host) {
+    for(int replica = 0; replica < VIRTUAL_NODES; ++replica) {
+        // A collision with another host's point is resolved by keeping the first one, it only skews the split slightly.
+        m_ring.emplace(ringPoint(host, replica), host);
+    }
+}
+
+void DrogonServerRegistry::RemoveFromRing_unsafe(const std::string& host) {
+    for(int replica = 0; replica < VIRTUAL_NODES; ++replica) {
+        if(auto it = m_ring.find(ringPoint(host, replica)); it != m_ring.end() && it->second == host) {
+            m_ring.erase(it);
+        }
     }
 }
 
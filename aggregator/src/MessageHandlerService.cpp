@@ -1,31 +1,71 @@
 #include <aggregator/MessageHandlerService.h>
 #include <aggregator/MessageHandlers.h>
+#include <aggregator/ServerRegistry.h>
 #include <common/utils/utils.h>
 
 namespace aggregator {
 
 MessageHandlerService::MessageHandlerService(std::unique_ptr<MessageHandlers> handlers)
-    : m_handlers(std::move(handlers)) {}
+    : m_handlers(std::move(handlers)),
+      m_dispatcher("aggregator_request_duration_seconds", "Time spent in MessageHandlerService::processMessage, per handler.") {
+    registerHandlers();
+}
 
 MessageHandlerService::~MessageHandlerService() = default;
 
-drogon::Task<chat::Envelope> MessageHandlerService::processMessage(const std::shared_ptr<WsData>& wsData, const chat::Envelope& env, IServerRegistry& registry) const {
+drogon::Task<chat::Envelope> MessageHandlerService::processMessage(const std::shared_ptr<WsData>& wsData, const chat::Envelope& env, ServerRegistry& registry) const {
     chat::Envelope respEnv;
-    switch(env.payload_case()) {
-        case chat::Envelope::kRegisterServerRequest: {
-            *respEnv.mutable_register_server_response() = co_await m_handlers->handleServerRegister(wsData, env.register_server_request(), registry);
-            break;
-        }
-        case chat::Envelope::kGetServersRequest: {
-            *respEnv.mutable_get_servers_response() = co_await m_handlers->handleGetServers(wsData, env.get_servers_request(), registry);
-            break;
-        }
-        default: {
-            respEnv = common::makeGenericErrorEnvelope("Unknown or empty payload");
-            break;
-        }
-    }
+    HandlerContext ctx{wsData, registry};
+    co_await m_dispatcher.dispatch(ctx, env, respEnv);
     co_return respEnv;
 }
 
+void MessageHandlerService::registerHandlers() {
+    auto* h = m_handlers.get();
+    m_dispatcher
+        .on<chat::RegisterServerRequest>("RegisterServer", [h](HandlerContext& ctx, const chat::RegisterServerRequest& req) {
+            return h->handleServerRegister(ctx.wsData, req, ctx.registry);
+        })
+        .on<chat::GetServerNodesRequest>("GetServers", [h](HandlerContext& ctx, const chat::GetServerNodesRequest& req) {
+            return h->handleGetServers(ctx.wsData, req, ctx.registry);
+        })
+        .on<chat::SubscribeServersRequest>("SubscribeServers", [h](HandlerContext& ctx, const chat::SubscribeServersRequest& req) {
+            return h->handleSubscribeServers(ctx.wsData, req, ctx.registry);
+        })
+        .on<chat::GetRoomServerRequest>("GetRoomServer", [h](HandlerContext& ctx, const chat::GetRoomServerRequest& req) {
+            return h->handleGetRoomServer(ctx.wsData, req, ctx.registry);
+        })
+        .on<chat::ListRoomsRequest>("ListRooms", [h](HandlerContext& ctx, const chat::ListRoomsRequest& req) {
+            return h->handleListRooms(ctx.wsData, req, ctx.registry);
+        })
+        // One-way cluster traffic, the empty envelope tells the processor not to answer.
+        .on<chat::ClusterSubscribe>("ClusterSubscribe", [h](HandlerContext& ctx, const chat::ClusterSubscribe& req) {
+            return h->handleClusterSubscribe(ctx.wsData, req, ctx.registry);
+        })
+        .on<chat::ClusterUnsubscribe>("ClusterUnsubscribe", [h](HandlerContext& ctx, const chat::ClusterUnsubscribe& req) {
+            return h->handleClusterUnsubscribe(ctx.wsData, req, ctx.registry);
+        })
+        .on<chat::ClusterPublish>("ClusterPublish", [h](HandlerContext& ctx, const chat::ClusterPublish& req) {
+            return h->handleClusterPublish(ctx.wsData, req, ctx.registry);
+        })
+        .on<chat::ServerLoadReport>("ServerLoadReport", [h](HandlerContext& ctx, const chat::ServerLoadReport& req) {
+            return h->handleServerLoadReport(ctx.wsData, req, ctx.registry);
+        })
+        .on<chat::RoomLoadReport>("RoomLoadReport", [h](HandlerContext& ctx, const chat::RoomLoadReport& req) {
+            return h->handleRoomLoadReport(ctx.wsData, req, ctx.registry);
+        })
+        .on<chat::DrainServerRequest>("DrainServer", [h](HandlerContext& ctx, const chat::DrainServerRequest& req) {
+            return h->handleDrainServer(ctx.wsData, req, ctx.registry);
+        })
+        .on<chat::RoomDirectoryUpdate>("RoomDirectoryUpdate", [h](HandlerContext& ctx, const chat::RoomDirectoryUpdate& req) {
+            return h->handleRoomDirectoryUpdate(ctx.wsData, req, ctx.registry);
+        })
+        .on<chat::RegistryGossip>("RegistryGossip", [h](HandlerContext& ctx, const chat::RegistryGossip& req) {
+            return h->handleRegistryGossip(ctx.wsData, req, ctx.registry);
+        })
+        .on<chat::PeerRelay>("PeerRelay", [h](HandlerContext& ctx, const chat::PeerRelay& req) {
+            return h->handlePeerRelay(ctx.wsData, req, ctx.registry);
+        });
+}
+
 } // namespace aggregator
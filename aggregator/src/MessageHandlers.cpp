@@ -1,28 +1,205 @@
 #include <aggregator/MessageHandlers.h>
 #include <aggregator/WsData.h>
-#include <aggregator/IServerRegistry.h>
+#include <aggregator/ServerRegistry.h>
+#include <aggregator/RoomDirectory.h>
+#include <aggregator/PeerGossip.h>
 #include <common/utils/utils.h>
 
 namespace aggregator {
 
-drogon::Task<chat::RegisterServerResponse> MessageHandlers::handleServerRegister(const std::shared_ptr<WsData>& wsData, const chat::RegisterServerRequest& req, IServerRegistry& registry) const {
+template<ServerRegistryLike Registry>
+drogon::Task<chat::RegisterServerResponse> MessageHandlers::handleServerRegister(const std::shared_ptr<WsData>& wsData, const chat::RegisterServerRequest& req, Registry& registry) const {
     chat::RegisterServerResponse resp;
     wsData->serverHost = req.host();
+    wsData->heartbeatInterval = std::chrono::milliseconds{req.heartbeat_interval_ms()};
     registry.AddServer();
+    resp.set_room_directory_wanted(!RoomDirectory::instance().Populated());
     common::setStatus(resp, chat::STATUS_SUCCESS);
     co_return resp;
 }
 
-drogon::Task<chat::GetServerNodesResponse> MessageHandlers::handleGetServers([[maybe_unused]] const std::shared_ptr<WsData>& wsData, [[maybe_unused]] const chat::GetServerNodesRequest& req, IServerRegistry& registry) const {
+template<ServerRegistryLike Registry>
+drogon::Task<chat::GetServerNodesResponse> MessageHandlers::handleGetServers([[maybe_unused]] const std::shared_ptr<WsData>& wsData, const chat::GetServerNodesRequest& req, Registry& registry) const {
     chat::GetServerNodesResponse resp;
 
-    for(const auto& server : registry.GetServers()) {
+    const auto snapshot = registry.GetServers();
+    for(const auto& server : req.ranked() ? snapshot->ranked : snapshot->servers) {
         auto* server_info = resp.add_servers();
-        server_info->set_host(server);
+        server_info->set_host(server.host);
+        if(req.ranked() && server.load) {
+            server_info->set_load(*server.load);
+        }
     }
 
     common::setStatus(resp, chat::STATUS_SUCCESS);
     co_return resp;
 }
 
+template<ServerRegistryLike Registry>
+drogon::Task<chat::SubscribeServersResponse> MessageHandlers::handleSubscribeServers(const std::shared_ptr<WsData>& wsData, const chat::SubscribeServersRequest& req, Registry& registry) const {
+    if(wsData->serverHost) {
+        chat::SubscribeServersResponse resp;
+        common::setStatus(resp, chat::STATUS_FAILURE, "Servers cannot subscribe to the server list");
+        co_return resp;
+    }
+    auto resp = registry.SubscribeServers(req);
+    common::setStatus(resp, chat::STATUS_SUCCESS);
+    co_return resp;
+}
+
+template<ServerRegistryLike Registry>
+drogon::Task<chat::GetRoomServerResponse> MessageHandlers::handleGetRoomServer([[maybe_unused]] const std::shared_ptr<WsData>& wsData, const chat::GetRoomServerRequest& req, Registry& registry) const {
+    chat::GetRoomServerResponse resp;
+    resp.set_room_id(req.room_id());
+    if(auto host = registry.GetRoomServer(req.room_id())) {
+        resp.mutable_server()->set_host(*host);
+        common::setStatus(resp, chat::STATUS_SUCCESS);
+    } else {
+        common::setStatus(resp, chat::STATUS_FAILURE, "No server is available");
+    }
+    co_return resp;
+}
+
+template<ServerRegistryLike Registry>
+drogon::Task<chat::ListRoomsResponse> MessageHandlers::handleListRooms([[maybe_unused]] const std::shared_ptr<WsData>& wsData, const chat::ListRoomsRequest& req, Registry& registry) const {
+    auto resp = RoomDirectory::instance().List(req);
+    // Placed now rather than stored, the host of a room moves with its members.
+    for(auto& room : *resp.mutable_rooms()) {
+        if(auto host = registry.GetRoomServer(room.room_id())) {
+            room.set_host(*host);
+        }
+    }
+    common::setStatus(resp, chat::STATUS_SUCCESS);
+    co_return resp;
+}
+
+template<ServerRegistryLike Registry>
+drogon::Task<> MessageHandlers::handleClusterSubscribe(const std::shared_ptr<WsData>& wsData, const chat::ClusterSubscribe& req, Registry& registry) const {
+    if(!wsData->serverHost) {
+        LOG_WARN << "Cluster subscription from an unregistered connection, ignoring";
+        co_return;
+    }
+    registry.Subscribe({ req.room_ids().begin(), req.room_ids().end() });
+}
+
+template<ServerRegistryLike Registry>
+drogon::Task<> MessageHandlers::handleClusterUnsubscribe(const std::shared_ptr<WsData>& wsData, const chat::ClusterUnsubscribe& req, Registry& registry) const {
+    if(!wsData->serverHost) {
+        co_return;
+    }
+    registry.Unsubscribe({ req.room_ids().begin(), req.room_ids().end() });
+}
+
+template<ServerRegistryLike Registry>
+drogon::Task<> MessageHandlers::handleClusterPublish(const std::shared_ptr<WsData>& wsData, const chat::ClusterPublish& req, Registry& registry) const {
+    if(!wsData->serverHost) {
+        LOG_WARN << "Cluster publish from an unregistered connection, ignoring";
+        co_return;
+    }
+    registry.Publish(req);
+    // Every peer gets it, a peer without subscribers of the room drops it.
+    chat::PeerRelay relay;
+    *relay.mutable_publish() = req;
+    PeerGossip::instance().Relay(relay);
+}
+
+template<ServerRegistryLike Registry>
+drogon::Task<> MessageHandlers::handleServerLoadReport(const std::shared_ptr<WsData>& wsData, const chat::ServerLoadReport& req, Registry& registry) const {
+    if(!wsData->serverHost) {
+        LOG_WARN << "Server load report from an unregistered connection, ignoring";
+        co_return;
+    }
+    registry.ReportServerLoad(req);
+}
+
+template<ServerRegistryLike Registry>
+drogon::Task<> MessageHandlers::handleDrainServer(const std::shared_ptr<WsData>& wsData, [[maybe_unused]] const chat::DrainServerRequest& req, Registry& registry) const {
+    if(!wsData->serverHost) {
+        LOG_WARN << "Drain from an unregistered connection, ignoring";
+        co_return;
+    }
+    LOG_INFO << "Server " << *wsData->serverHost << " is draining, no longer listing it";
+    registry.DrainServer();
+}
+
+template<ServerRegistryLike Registry>
+drogon::Task<> MessageHandlers::handleRoomLoadReport(const std::shared_ptr<WsData>& wsData, const chat::RoomLoadReport& req, Registry& registry) const {
+    if(!wsData->serverHost) {
+        LOG_WARN << "Room load report from an unregistered connection, ignoring";
+        co_return;
+    }
+    registry.ReportRoomLoad(req);
+}
+
+template<ServerRegistryLike Registry>
+drogon::Task<> MessageHandlers::handleRoomDirectoryUpdate(const std::shared_ptr<WsData>& wsData, const chat::RoomDirectoryUpdate& req, [[maybe_unused]] Registry& registry) const {
+    if(!wsData->serverHost) {
+        LOG_WARN << "Room directory update from an unregistered connection, ignoring";
+        co_return;
+    }
+    RoomDirectory::instance().Apply(req);
+    chat::PeerRelay relay;
+    *relay.mutable_directory() = req;
+    PeerGossip::instance().Relay(relay);
+}
+
+template<ServerRegistryLike Registry>
+drogon::Task<> MessageHandlers::handleRegistryGossip(const std::shared_ptr<WsData>& wsData, const chat::RegistryGossip& req, Registry& registry) const {
+    if(wsData->serverHost) {
+        LOG_WARN << "Registry gossip from a registered server, ignoring";
+        co_return;
+    }
+    // Checked on every gossip rather than on connect, a peer may dial us before we reached it and learned its address.
+    if(!PeerGossip::instance().IsPeer(wsData->remoteAddr, wsData->peerToken)) {
+        LOG_WARN << "Registry gossip from " << wsData->remoteAddr.toIp() << ", which is not a configured peer, ignoring";
+        co_return;
+    }
+    if(req.aggregator_id().empty() || req.aggregator_id() == PeerGossip::instance().Id()) {
+        LOG_WARN << "Registry gossip without a peer ID or with our own, check the peers of the aggregators";
+        co_return;
+    }
+    wsData->peerId = req.aggregator_id();
+    registry.ApplyGossip(req);
+}
+
+template<ServerRegistryLike Registry>
+drogon::Task<> MessageHandlers::handlePeerRelay(const std::shared_ptr<WsData>& wsData, const chat::PeerRelay& req, Registry& registry) const {
+    if(!wsData->peerId) {
+        LOG_WARN << "Peer relay from a connection that never gossiped, ignoring";
+        co_return;
+    }
+    // Only to the servers registered here, the sender relayed it to every other peer itself.
+    switch(req.payload_case()) {
+        case chat::PeerRelay::kPublish:
+            registry.Publish(req.publish());
+            break;
+        case chat::PeerRelay::kDirectory:
+            RoomDirectory::instance().Apply(req.directory());
+            break;
+        default:
+            break;
+    }
+}
+
+// The registries the handlers are built for, see ServerRegistryLike.
+#define INSTANTIATE_HANDLERS(Registry) \
+    template drogon::Task<chat::RegisterServerResponse> MessageHandlers::handleServerRegister(const std::shared_ptr<WsData>&, const chat::RegisterServerRequest&, Registry&) const; \
+    template drogon::Task<chat::GetServerNodesResponse> MessageHandlers::handleGetServers(const std::shared_ptr<WsData>&, const chat::GetServerNodesRequest&, Registry&) const; \
+    template drogon::Task<chat::SubscribeServersResponse> MessageHandlers::handleSubscribeServers(const std::shared_ptr<WsData>&, const chat::SubscribeServersRequest&, Registry&) const; \
+    template drogon::Task<chat::GetRoomServerResponse> MessageHandlers::handleGetRoomServer(const std::shared_ptr<WsData>&, const chat::GetRoomServerRequest&, Registry&) const; \
+    template drogon::Task<chat::ListRoomsResponse> MessageHandlers::handleListRooms(const std::shared_ptr<WsData>&, const chat::ListRoomsRequest&, Registry&) const; \
+    template drogon::Task<> MessageHandlers::handleClusterSubscribe(const std::shared_ptr<WsData>&, const chat::ClusterSubscribe&, Registry&) const; \
+    template drogon::Task<> MessageHandlers::handleClusterUnsubscribe(const std::shared_ptr<WsData>&, const chat::ClusterUnsubscribe&, Registry&) const; \
+    template drogon::Task<> MessageHandlers::handleClusterPublish(const std::shared_ptr<WsData>&, const chat::ClusterPublish&, Registry&) const; \
+    template drogon::Task<> MessageHandlers::handleServerLoadReport(const std::shared_ptr<WsData>&, const chat::ServerLoadReport&, Registry&) const; \
+    template drogon::Task<> MessageHandlers::handleDrainServer(const std::shared_ptr<WsData>&, const chat::DrainServerRequest&, Registry&) const; \
+    template drogon::Task<> MessageHandlers::handleRoomLoadReport(const std::shared_ptr<WsData>&, const chat::RoomLoadReport&, Registry&) const; \
+    template drogon::Task<> MessageHandlers::handleRoomDirectoryUpdate(const std::shared_ptr<WsData>&, const chat::RoomDirectoryUpdate&, Registry&) const; \
+    template drogon::Task<> MessageHandlers::handleRegistryGossip(const std::shared_ptr<WsData>&, const chat::RegistryGossip&, Registry&) const; \
+    template drogon::Task<> MessageHandlers::handlePeerRelay(const std::shared_ptr<WsData>&, const chat::PeerRelay&, Registry&) const;
+
+INSTANTIATE_HANDLERS(ServerRegistry)
+INSTANTIATE_HANDLERS(IServerRegistry)
+#undef INSTANTIATE_HANDLERS
+
 } // namespace aggregator
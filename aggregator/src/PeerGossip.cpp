@@ -0,0 +1,227 @@
+#include <aggregator/PeerGossip.h>
+#include <aggregator/DrogonServerRegistry.h>
+#include <netdb.h>
+#include <sstream>
+
+namespace aggregator {
+
+PeerGossip& PeerGossip::instance() {
+    static PeerGossip inst;
+    return inst;
+}
+
+PeerGossip::PeerGossip()
+    : m_epoch(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count())) {
+    std::random_device rd;
+    m_id = std::to_string((static_cast<uint64_t>(rd()) << 32) | rd());
+}
+
+// Comma separated, blanks around the entries are dropped.
+static std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> entries;
+    std::stringstream stream(list);
+    std::string entry;
+    while(std::getline(stream, entry, ',')) {
+        const auto first = entry.find_first_not_of(" \t");
+        if(first == std::string::npos) {
+            continue;
+        }
+        entries.push_back(entry.substr(first, entry.find_last_not_of(" \t") - first + 1));
+    }
+    return entries;
+}
+
+// The host of a "ws://host:port" server, without the brackets of an IPv6 address.
+static std::string hostOf(const std::string& server) {
+    auto host = server.substr(server.find("://") == std::string::npos ? 0 : server.find("://") + 3);
+    if(host.starts_with('[')) {
+        return host.substr(1, host.find(']') - 1);
+    }
+    return host.substr(0, host.find(':'));
+}
+
+// Every address `host` resolves to, blocking, only called at start.
+static std::vector<std::string> resolve(const std::string& host) {
+    std::vector<std::string> ips;
+    addrinfo hints{};
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    if(::getaddrinfo(host.c_str(), nullptr, &hints, &found) != 0) {
+        LOG_WARN << "Cannot resolve peer aggregator " << host << ", accepting it once it is reached";
+        return ips;
+    }
+    for(auto* info = found; info; info = info->ai_next) {
+        if(info->ai_family == AF_INET) {
+            ips.push_back(trantor::InetAddress(*reinterpret_cast<const sockaddr_in*>(info->ai_addr)).toIp());
+        } else if(info->ai_family == AF_INET6) {
+            ips.push_back(trantor::InetAddress(*reinterpret_cast<const sockaddr_in6*>(info->ai_addr)).toIp());
+        }
+    }
+    ::freeaddrinfo(found);
+    return ips;
+}
+
+// Compares every byte whatever the first mismatch, so the time taken tells nothing about the token.
+static bool sameToken(const std::string& given, const std::string& token) {
+    if(given.size() != token.size()) {
+        return false;
+    }
+    unsigned char diff = 0;
+    for(size_t i = 0; i < token.size(); ++i) {
+        diff |= static_cast<unsigned char>(given[i] ^ token[i]);
+    }
+    return diff == 0;
+}
+
+void PeerGossip::Start(const Json::Value& config) {
+    std::vector<std::string> urls;
+    if(const auto env = common::getEnvVar("AGGREGATOR_PEERS"); !env.empty()) {
+        urls = splitList(env);
+    } else {
+        for(const auto& url : config["urls"]) {
+            urls.push_back(url.asString());
+        }
+    }
+    if(const auto id = common::getEnvVar("AGGREGATOR_ID"); !id.empty()) {
+        m_id = id;
+    } else if(const auto configured = config["id"].asString(); !configured.empty()) {
+        m_id = configured;
+    }
+    if(const auto token = common::getEnvVar("AGGREGATOR_PEER_TOKEN"); !token.empty()) {
+        m_token = token;
+    } else {
+        m_token = config["token"].asString();
+    }
+    if(urls.empty()) {
+        LOG_INFO << "No peer aggregators configured, this one only lists its own servers";
+        return;
+    }
+    m_interval = std::chrono::milliseconds{std::max(config.get("gossip_interval_ms", 1000).asInt(), 100)};
+
+    std::lock_guard lock(m_mutex);
+    if(!m_links.empty()) {
+        return;
+    }
+    for(const auto& url : urls) {
+        auto [server, path] = common::splitUrl(url);
+        auto& link = m_links.emplace_back();
+        for(auto& ip : resolve(hostOf(server))) {
+            m_peer_ips.insert(std::move(ip));
+        }
+        link.server = std::move(server);
+        link.path = std::move(path);
+    }
+    LOG_INFO << "Aggregator " << m_id << " gossiping with " << m_links.size() << " peers every " << m_interval.count() << " ms";
+    drogon::app().getLoop()->runEvery(std::chrono::duration<double>(m_interval).count(), [this] { SendGossip(); });
+    for(size_t index = 0; index < m_links.size(); ++index) {
+        Connect_unsafe(index);
+    }
+}
+
+const std::string& PeerGossip::Id() const {
+    return m_id;
+}
+
+bool PeerGossip::IsPeer(const trantor::InetAddress& addr, const std::string& token) {
+    std::lock_guard lock(m_mutex);
+    if(!m_token.empty()) {
+        return sameToken(token, m_token);
+    }
+    return m_peer_ips.contains(addr.toIp());
+}
+
+void PeerGossip::Connect_unsafe(size_t index) {
+    auto& link = m_links[index];
+    // A fresh client per attempt, callbacks of an abandoned one are recognized and ignored.
+    link.client = drogon::WebSocketClient::newWebSocketClient(link.server);
+    auto req = drogon::HttpRequest::newHttpRequest();
+    req->setPath(link.path);
+    if(!m_token.empty()) {
+        req->addHeader(std::string(PEER_TOKEN_HEADER), m_token);
+    }
+
+    link.client->setConnectionClosedHandler([this, index](const drogon::WebSocketClientPtr& wsPtr) {
+        std::lock_guard lock(m_mutex);
+        auto& link = m_links[index];
+        if(wsPtr != link.client) {
+            return;
+        }
+        LOG_WARN << "Connection to peer aggregator " << link.server << " closed";
+        link.conn.reset();
+        ScheduleReconnect_unsafe(index);
+    });
+
+    link.client->connectToServer(req, [this, index](drogon::ReqResult r, const drogon::HttpResponsePtr&, const drogon::WebSocketClientPtr& wsPtr) {
+        {
+            std::lock_guard lock(m_mutex);
+            auto& link = m_links[index];
+            if(wsPtr != link.client) {
+                return;
+            }
+            if(r != drogon::ReqResult::Ok) {
+                link.conn.reset();
+                ScheduleReconnect_unsafe(index);
+                return;
+            }
+            LOG_INFO << "Connected to peer aggregator " << link.server;
+            link.conn = wsPtr->getConnection();
+            link.attempt = 0;
+            // The peer dials from the address we reached it at, unless it sits behind a proxy.
+            m_peer_ips.insert(link.conn->peerAddr().toIp());
+        }
+        // Right away, so the peer lists our servers without waiting for the next tick.
+        SendGossip();
+    });
+}
+
+void PeerGossip::ScheduleReconnect_unsafe(size_t index) {
+    auto& link = m_links[index];
+    const double delay = std::min(MAX_RECONNECT_DELAY, MIN_RECONNECT_DELAY * static_cast<double>(1u << std::min<uint32_t>(link.attempt, 10)));
+    // Jittered in [delay / 2, delay], so aggregators restarted together do not dial each other in lockstep.
+    const double wait = std::uniform_real_distribution<double>(delay / 2, delay)(m_rng);
+    ++link.attempt;
+    LOG_DEBUG << "Reconnecting to peer aggregator " << link.server << " in " << wait << " s";
+    drogon::app().getLoop()->runAfter(wait, [this, index] {
+        std::lock_guard lock(m_mutex);
+        Connect_unsafe(index);
+    });
+}
+
+void PeerGossip::SendGossip() {
+    chat::Envelope env;
+    auto* gossip = env.mutable_registry_gossip();
+    // Filled before taking our lock, the registry is never locked while m_mutex is held.
+    DrogonServerRegistry::instance().FillGossip(*gossip);
+    gossip->set_aggregator_id(m_id);
+    gossip->set_epoch(m_epoch);
+    gossip->set_interval_ms(static_cast<uint32_t>(m_interval.count()));
+
+    std::lock_guard lock(m_mutex);
+    gossip->set_seq(++m_seq);
+    Send_unsafe(common::serializeEnvelope(env));
+}
+
+void PeerGossip::Relay(const chat::PeerRelay& relay) {
+    std::lock_guard lock(m_mutex);
+    if(m_links.empty()) {
+        return;
+    }
+    chat::Envelope env;
+    *env.mutable_peer_relay() = relay;
+    // Encoded once, every peer receives the same buffer.
+    Send_unsafe(common::serializeEnvelope(env));
+}
+
+void PeerGossip::Send_unsafe(const common::SerializedEnvelope& bytes) {
+    if(!bytes) {
+        return;
+    }
+    for(const auto& link : m_links) {
+        if(link.conn && link.conn->connected()) {
+            common::sendSerialized(link.conn, bytes);
+        }
+    }
+}
+
+} // namespace aggregator
@@ -0,0 +1,96 @@
+#include <aggregator/RoomDirectory.h>
+#include <common/utils/utils.h>
+#include <limits>
+
+namespace aggregator {
+
+// ASCII only, the other scripts match as typed. Names are compared byte-wise, which orders UTF-8 by code point.
+static std::string foldName(std::string_view name) {
+    std::string folded(name);
+    for(char& c : folded) {
+        if(c >= 'A' && c <= 'Z') {
+            c = static_cast<char>(c - 'A' + 'a');
+        }
+    }
+    return folded;
+}
+
+RoomDirectory& RoomDirectory::instance() {
+    static RoomDirectory inst;
+    return inst;
+}
+
+void RoomDirectory::Apply(const chat::RoomDirectoryUpdate& update) {
+    std::unique_lock lock(m_mutex);
+    if(update.snapshot()) {
+        m_rooms.clear();
+        m_by_name.clear();
+        m_populated = true;
+    }
+    for(const auto& entry : update.upserted()) {
+        Upsert_unsafe(entry);
+    }
+    for(int32_t room_id : update.removed()) {
+        Remove_unsafe(room_id);
+    }
+    for(int32_t room_id : update.joined()) {
+        if(auto it = m_rooms.find(room_id); it != m_rooms.end()) {
+            ++it->second.member_count;
+        }
+    }
+    if(update.snapshot()) {
+        LOG_INFO << "Room directory populated with " << m_rooms.size() << " rooms";
+    }
+}
+
+void RoomDirectory::Upsert_unsafe(const chat::RoomDirectoryEntry& entry) {
+    auto [it, added] = m_rooms.try_emplace(entry.room_id());
+    auto& room = it->second;
+    if(!added) {
+        m_by_name.erase(NameKey{ foldName(room.name), entry.room_id() });
+    }
+    room.name = entry.room_name();
+    if(entry.has_member_count()) {
+        room.member_count = entry.member_count();
+    }
+    m_by_name.emplace(foldName(room.name), entry.room_id());
+}
+
+void RoomDirectory::Remove_unsafe(int32_t room_id) {
+    if(auto it = m_rooms.find(room_id); it != m_rooms.end()) {
+        m_by_name.erase(NameKey{ foldName(it->second.name), room_id });
+        m_rooms.erase(it);
+    }
+}
+
+bool RoomDirectory::Populated() const {
+    std::shared_lock lock(m_mutex);
+    return m_populated;
+}
+
+chat::ListRoomsResponse RoomDirectory::List(const chat::ListRoomsRequest& req) const {
+    chat::ListRoomsResponse resp;
+    const auto prefix = foldName(req.prefix());
+    const uint32_t limit = req.limit() == 0 ? DEFAULT_PAGE_SIZE : std::min(req.limit(), MAX_PAGE_SIZE);
+
+    std::shared_lock lock(m_mutex);
+    auto it = m_by_name.lower_bound(NameKey{ prefix, std::numeric_limits<int32_t>::min() });
+    // Past the last room of the previous page, unless that one came before the prefix.
+    if(NameKey after{ foldName(req.after_name()), req.after_room_id() }; req.has_after_name() && it != m_by_name.end() && !(after < *it)) {
+        it = m_by_name.upper_bound(after);
+    }
+    for(; it != m_by_name.end() && it->first.starts_with(prefix); ++it) {
+        if(static_cast<uint32_t>(resp.rooms_size()) == limit) {
+            resp.set_more(true);
+            break;
+        }
+        const auto& room = m_rooms.at(it->second);
+        auto* entry = resp.add_rooms();
+        entry->set_room_id(it->second);
+        entry->set_room_name(room.name);
+        entry->set_member_count(room.member_count);
+    }
+    return resp;
+}
+
+} // namespace aggregator
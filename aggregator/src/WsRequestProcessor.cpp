@@ -11,18 +11,33 @@ WsRequestProcessor::WsRequestProcessor(std::unique_ptr<MessageHandlerService> di
 
 WsRequestProcessor::~WsRequestProcessor() = default;
 
-drogon::Task<> WsRequestProcessor::handleIncomingMessage(drogon::WebSocketConnectionPtr conn, std::string bytes) const {
+void WsRequestProcessor::handleIncomingMessage(const drogon::WebSocketConnectionPtr& conn, std::string_view bytes) const {
+    chat::Envelope env;
+    if(!env.ParseFromArray(bytes.data(), static_cast<int>(bytes.size()))) {
+        common::sendEnvelope(conn, common::makeGenericErrorEnvelope("Malformed protobuf message"));
+        return;
+    }
+    // Moving a heap envelope swaps its internals, nothing is copied into the coroutine frame.
+    drogon::async_run([this, conn, env = std::move(env)]() mutable {
+        return processRequest(conn, std::move(env));
+    });
+}
+
+drogon::Task<> WsRequestProcessor::processRequest(drogon::WebSocketConnectionPtr conn, chat::Envelope env) const {
     try {
-        chat::Envelope env;
-        if(!env.ParseFromString(bytes)) {
-            common::sendEnvelope(conn, common::makeGenericErrorEnvelope("Malformed protobuf message"));
+        ServerRegistry registry{conn};
+        // The hottest request after an outage, answered with the payload encoded when the list last changed.
+        if(env.payload_case() == chat::Envelope::kGetServersRequest) {
+            const auto snapshot = registry.GetServers();
+            common::sendSerialized(conn, env.get_servers_request().ranked() ? snapshot->ranked_response : snapshot->response);
             co_return;
         }
-        bytes.resize(0);
-        ServerRegistry registry{conn};
-        common::sendEnvelope(conn, co_await m_dispatcher->processMessage(conn->getContext<WsData>(), env, registry));
+        auto response = co_await m_dispatcher->processMessage(conn->getContext<WsData>(), env, registry);
+        if(response.payload_case() != chat::Envelope::PAYLOAD_NOT_SET) {
+            common::sendEnvelope(conn, response);
+        }
     } catch(const std::exception& e) {
-        LOG_ERROR << "Critical error in WsRequestProcessor::handleIncomingMessage: " << e.what();
+        LOG_ERROR << "Critical error in WsRequestProcessor::processRequest: " << e.what();
         common::sendEnvelope(conn, common::makeGenericErrorEnvelope("Critical server error during message handling."));
         co_return;
     }
@@ -0,0 +1,72 @@
+#include <aggregator/controller/HttpController.h>
+#include <aggregator/DrogonServerRegistry.h>
+#include <common/utils/profiler.h>
+
+namespace aggregator {
+
+static drogon::HttpResponsePtr serversResponse(const ServerListSnapshot& snapshot, const std::string& if_none_match) {
+    auto resp = drogon::HttpResponse::newHttpResponse();
+    if(snapshot.etag == if_none_match) {
+        resp->setStatusCode(drogon::k304NotModified);
+    } else {
+        resp->setStatusCode(drogon::k200OK);
+        resp->setContentTypeCode(drogon::CT_APPLICATION_JSON);
+        resp->setBody(snapshot.json);
+    }
+    resp->addHeader("ETag", snapshot.etag);
+    // Caches may keep it but have to revalidate, the list changes whenever a server comes or goes.
+    resp->addHeader("Cache-Control", "no-cache");
+    return resp;
+}
+
+void HttpController::listServers(const drogon::HttpRequestPtr& req, std::function<void(const drogon::HttpResponsePtr&)>&& callback) const {
+    auto& registry = DrogonServerRegistry::instance();
+    const auto& if_none_match = req->getHeader("If-None-Match");
+    const auto snapshot = registry.GetServers();
+    double wait = 0;
+    if(const auto& param = req->getParameter("wait"); !param.empty()) {
+        std::from_chars(param.data(), param.data() + param.size(), wait);
+    }
+    // Only a client that has the current list waits, anyone else is behind already.
+    if(wait <= 0 || snapshot->etag != if_none_match) {
+        callback(serversResponse(*snapshot, if_none_match));
+        return;
+    }
+    registry.WaitForServers(if_none_match, std::min(wait, MAX_WAIT_SECONDS),
+                            [callback = std::move(callback), if_none_match](std::shared_ptr<const ServerListSnapshot> current) {
+        callback(serversResponse(*current, if_none_match));
+    });
+}
+
+// Compares every byte whatever the first mismatch, so the time taken tells nothing about the token.
+static bool sameToken(const std::string& given, const std::string& token) {
+    if(given.size() != token.size()) {
+        return false;
+    }
+    unsigned char diff = 0;
+    for(size_t i = 0; i < token.size(); ++i) {
+        diff |= static_cast<unsigned char>(given[i] ^ token[i]);
+    }
+    return diff == 0;
+}
+
+void HttpController::profile(const drogon::HttpRequestPtr& req, std::function<void(const drogon::HttpResponsePtr&)>&& callback, const std::string& kind) const {
+    static const auto options = common::ProfilingOptions::fromJson(drogon::app().getCustomConfig()["profiling"]);
+    static const std::string bearer = "Bearer ";
+    if(!options.enabled || options.token.empty()) {
+        auto resp = drogon::HttpResponse::newHttpResponse();
+        resp->setStatusCode(drogon::k404NotFound);
+        callback(resp);
+        return;
+    }
+    const auto& authorization = req->getHeader("Authorization");
+    if(!authorization.starts_with(bearer) || !sameToken(authorization.substr(bearer.size()), options.token)) {
+        auto resp = drogon::HttpResponse::newHttpResponse();
+        resp->setStatusCode(drogon::k401Unauthorized);
+        callback(resp);
+        return;
+    }
+    common::serveProfile(options, req, kind, std::move(callback));
+}
+
+} // namespace aggregator
@@ -3,6 +3,7 @@
 #include <aggregator/MessageHandlerService.h>
 #include <aggregator/MessageHandlers.h>
 #include <aggregator/DrogonServerRegistry.h>
+#include <aggregator/PeerGossip.h>
 #include <aggregator/WsData.h>
 #include <common/utils/utils.h>
 #include <common/version.h>
@@ -21,10 +22,13 @@ WsController::WsController() {
 
 WsController::~WsController() = default;
 
-void WsController::handleNewConnection([[maybe_unused]] const drogon::HttpRequestPtr& req, const drogon::WebSocketConnectionPtr& conn) {
+void WsController::handleNewConnection(const drogon::HttpRequestPtr& req, const drogon::WebSocketConnectionPtr& conn) {
     LOG_TRACE << "WS connect: " << conn->peerAddr().toIpPort();
-    conn->setContext(std::make_shared<WsData>());
-    DrogonServerRegistry::instance().AddConnection(conn);
+    auto ws_data = std::make_shared<WsData>();
+    ws_data->loopIndex = drogon::app().getCurrentThreadIndex();
+    ws_data->remoteAddr = conn->peerAddr();
+    ws_data->peerToken = req->getHeader(std::string(PeerGossip::PEER_TOKEN_HEADER));
+    conn->setContext(std::move(ws_data));
     chat::Envelope helloEnv;
     helloEnv.mutable_server_hello()->set_type(chat::ServerType::TYPE_AGGREGATOR);
     helloEnv.mutable_server_hello()->set_protocol_version(common::version::PROTOCOL_VERSION);
@@ -37,7 +41,8 @@ void WsController::handleNewMessage(const drogon::WebSocketConnectionPtr& conn,
         return;
     }
 
-    drogon::async_run(std::bind(&WsRequestProcessor::handleIncomingMessage, m_requestProcessor.get(), conn, std::move(msg_str)));
+    // Parsed in place, the frame is released as soon as this returns.
+    m_requestProcessor->handleIncomingMessage(conn, msg_str);
 }
 
 void WsController::handleConnectionClosed(const drogon::WebSocketConnectionPtr& conn) {
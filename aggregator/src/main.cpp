@@ -1,9 +1,21 @@
 #include <aggregator/controller/WsController.h>
+#include <aggregator/DrogonServerRegistry.h>
+#include <aggregator/PeerGossip.h>
+#include <common/utils/tls.h>
 
 int main() {
     std::filesystem::create_directory("logs");
     LOG_INFO << "Starting Drogon application...";
     drogon::app().loadConfigFile("config.json");
+    if(!common::addTlsListener(common::TlsOptions::fromJson(drogon::app().getCustomConfig()["tls"]))) {
+        return 1;
+    }
+    LOG_INFO << "Using " << drogon::app().getThreadNum() << " IO threads";
+    drogon::app().getLoop()->runEvery(1.0, [] {
+        aggregator::DrogonServerRegistry::instance().EvictSilentServers();
+        aggregator::DrogonServerRegistry::instance().ExpirePeers();
+    });
+    aggregator::PeerGossip::instance().Start(drogon::app().getCustomConfig()["peers"]);
     LOG_INFO << "Entering main loop...";
     drogon::app().run();
     LOG_INFO << "Drogon stopped.";
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <drogon/drogon.h>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+
+/**
+ * @file Database.h
+ * @brief The disposable PostgreSQL database the handler benchmarks seed and query.
+ */
+
+namespace bench {
+
+/// @brief The connection string of the database, `CHAT_BENCH_PG`, empty when the handler benchmarks are skipped.
+inline std::string databaseDsn() {
+    const char* dsn = std::getenv("CHAT_BENCH_PG");
+    return dsn ? dsn : "";
+}
+
+/**
+ * @brief Adds the "default" client on `CHAT_BENCH_PG` to the application, called by `main` before it runs.
+ * @details The DSN is given as `host=... port=... dbname=... user=... password=...`, unset keys
+ * fall back to libpq's defaults. Does nothing without a DSN.
+ */
+inline void configureDatabase() {
+    const auto dsn = databaseDsn();
+    if(dsn.empty()) {
+        return;
+    }
+    std::map<std::string, std::string> keys;
+    std::istringstream stream(dsn);
+    std::string pair;
+    while(stream >> pair) {
+        if(const auto eq = pair.find('='); eq != std::string::npos) {
+            keys[pair.substr(0, eq)] = pair.substr(eq + 1);
+        }
+    }
+    const auto value = [&keys](const std::string& key, const std::string& fallback) {
+        const auto it = keys.find(key);
+        return it != keys.end() ? it->second : fallback;
+    };
+    drogon::app().createDbClient("postgresql", value("host", "localhost"),
+        static_cast<unsigned short>(std::stoi(value("port", "5432"))), value("dbname", "postgres"),
+        value("user", "postgres"), value("password", ""), 4, "", "default");
+}
+
+} // namespace bench
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <drogon/drogon.h>
+#include <future>
+
+/**
+ * @file EventLoops.h
+ * @brief Helpers for benchmarks that need Drogon's IO loops running.
+ */
+
+namespace bench {
+
+/// @brief The number of IO loops `main` runs the Drogon application with.
+inline constexpr size_t IO_THREADS = 4;
+
+/**
+ * @brief Runs a coroutine on an IO loop and blocks the benchmark thread until it has finished.
+ * @param make_task A callable returning the `drogon::Task<>` to run, invoked on the loop.
+ */
+template <typename F>
+void runOnLoop(size_t loop_index, F&& make_task) {
+    std::promise<void> done;
+    drogon::app().getIOLoop(loop_index)->queueInLoop([&] {
+        drogon::async_run([&]() -> drogon::Task<> {
+            co_await make_task();
+            done.set_value();
+        });
+    });
+    done.get_future().wait();
+}
+
+/// @brief Blocks until every IO loop has run the tasks queued on it before the call.
+inline void drainLoops() {
+    std::vector<std::promise<void>> drained(drogon::app().getThreadNum());
+    for(size_t i = 0; i < drained.size(); ++i) {
+        drogon::app().getIOLoop(i)->queueInLoop([&promise = drained[i]] { promise.set_value(); });
+    }
+    for(auto& promise : drained) {
+        promise.get_future().wait();
+    }
+}
+
+/**
+ * @class NullConnection
+ * @brief A WebSocket connection that counts what is sent to it and writes nothing.
+ */
+class NullConnection : public drogon::WebSocketConnection {
+public:
+    void send(const char*, uint64_t len, const drogon::WebSocketMessageType) override { m_bytes += len; }
+    void send(std::string_view msg, const drogon::WebSocketMessageType) override { m_bytes += msg.size(); }
+    void sendJson(const Json::Value&, const drogon::WebSocketMessageType) override {}
+    bool connected() const override { return true; }
+    bool disconnected() const override { return false; }
+    void shutdown(const drogon::CloseCode, const std::string&) override {}
+    void forceClose() override {}
+    void setPingMessage(const std::string&, const std::chrono::duration<double>&) override {}
+    void disablePing() override {}
+    const trantor::InetAddress& peerAddr() const override { return m_addr; }
+    const trantor::InetAddress& localAddr() const override { return m_addr; }
+
+    uint64_t bytesSent() const noexcept { return m_bytes.load(std::memory_order_relaxed); }
+
+private:
+    trantor::InetAddress m_addr;
+    std::atomic<uint64_t> m_bytes{0};
+};
+
+} // namespace bench
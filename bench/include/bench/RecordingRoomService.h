@@ -0,0 +1,121 @@
+#pragma once
+
+#include <server/chat/IChatRoomService.h>
+#include <map>
+
+/**
+ * @file RecordingRoomService.h
+ * @brief An in-memory room service for driving `MessageHandlers` without connections.
+ */
+
+namespace bench {
+
+/**
+ * @class RecordingRoomService
+ * @brief Keeps the rosters in memory and counts the calls and broadcasts, sending nothing.
+ * @details Stands in for `ChatRoomManager`, so a handler benchmark measures the handler and its
+ * queries rather than the fan-out. Not thread-safe, the benchmarks run every handler on one loop.
+ */
+class RecordingRoomService : public server::IChatRoomService {
+public:
+    drogon::Task<void> login(const server::WsData&) override {
+        ++m_calls;
+        co_return;
+    }
+
+    drogon::Task<void> logout(const server::WsData& locked_data) override {
+        co_await leaveCurrentRoom(locked_data);
+    }
+
+    drogon::Task<void> joinRoom(const server::WsData& locked_data, bool) override {
+        ++m_calls;
+        if(locked_data.user && locked_data.room) {
+            auto& member = m_rosters[locked_data.room->id][locked_data.user->id];
+            member.set_user_id(locked_data.user->id);
+            member.set_user_name(*locked_data.user->name());
+            member.set_user_room_rights(locked_data.room->rights);
+        }
+        co_return;
+    }
+
+    drogon::Task<void> leaveCurrentRoom(const server::WsData& locked_data) override {
+        ++m_calls;
+        if(locked_data.user && locked_data.room) {
+            m_rosters[locked_data.room->id].erase(locked_data.user->id);
+        }
+        co_return;
+    }
+
+    drogon::Task<server::RoomRoster> getUsersInRoom(int32_t room_id, std::optional<server::RosterVersion>) const override {
+        ++m_calls;
+        server::RoomRoster roster;
+        roster.presence_epoch = 1;
+        if(const auto it = m_rosters.find(room_id); it != m_rosters.end()) {
+            for(const auto& [user_id, member] : it->second) {
+                roster.users.push_back(member);
+            }
+        }
+        co_return roster;
+    }
+
+    drogon::Task<void> sendToRoom(int32_t, const chat::Envelope&) const override {
+        ++m_broadcasts;
+        co_return;
+    }
+
+    drogon::Task<void> sendToAll(const chat::Envelope&) const override {
+        ++m_broadcasts;
+        co_return;
+    }
+
+    drogon::Task<void> sendToDirectory(int32_t, const chat::Envelope& message) const override {
+        ++m_broadcasts;
+        // CreateRoomResponse carries no ID, the announcement of the new room does.
+        if(message.has_new_room_created()) {
+            m_last_created_room = message.new_room_created().room().room_id();
+        }
+        co_return;
+    }
+
+    void subscribeDirectory(const server::WsData&, bool) override {
+        ++m_calls;
+    }
+
+    drogon::Task<void> onRoomDeleted(int32_t room_id) override {
+        ++m_calls;
+        m_rosters.erase(room_id);
+        co_return;
+    }
+
+    drogon::Task<void> updateUserRoomRights(int32_t, int32_t, chat::UserRights newRights, server::WsData& locked_data) override {
+        ++m_calls;
+        if(locked_data.room) {
+            locked_data.room->rights = newRights;
+            locked_data.publishView();
+        }
+        co_return;
+    }
+
+    drogon::Task<void> renameUser(int32_t, const std::string&, const std::vector<int32_t>&) override {
+        ++m_calls;
+        co_return;
+    }
+
+    void setTyping(int32_t, const chat::UserInfo&, bool) override {
+        ++m_calls;
+    }
+
+    /// @brief The ID of the room announced last by `sendToDirectory`, 0 before any.
+    int32_t lastCreatedRoom() const noexcept { return m_last_created_room; }
+    uint64_t calls() const noexcept { return m_calls; }
+    uint64_t broadcasts() const noexcept { return m_broadcasts; }
+
+private:
+    /// Room ID to user ID to the member, one entry per user.
+    std::map<int32_t, std::map<int32_t, chat::UserInfo>> m_rosters;
+    mutable uint64_t m_calls = 0;
+    mutable uint64_t m_broadcasts = 0;
+    mutable int32_t m_last_created_room = 0;
+};
+
+} // namespace bench
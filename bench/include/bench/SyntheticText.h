@@ -0,0 +1,93 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <string_view>
+
+/**
+ * @file SyntheticText.h
+ * @brief Deterministic message texts for the client benchmarks, in UTF-8.
+ */
+
+namespace bench {
+
+/// @brief The shapes of text the client has to lay out.
+enum class TextKind : int64_t {
+    /// A few words, the bulk of any room.
+    Chat,
+    /// Thousands of characters with one space in a while, wrapped over many lines.
+    LongLine,
+    /// Emoji outside the BMP, surrogate pairs in UTF-16, with modifiers and ZWJ sequences.
+    Emoji,
+    /// Latin, Cyrillic, CJK, Arabic and Hebrew interleaved.
+    MixedScripts,
+};
+
+/// @brief The name a benchmark reports for a kind.
+inline const char* textKindName(TextKind kind) {
+    switch(kind) {
+        case TextKind::Chat: return "chat";
+        case TextKind::LongLine: return "long_line";
+        case TextKind::Emoji: return "emoji";
+        case TextKind::MixedScripts: return "mixed_scripts";
+    }
+    return "unknown";
+}
+
+/**
+ * @brief Builds the text of message number `seed` of a kind.
+ * @details The same seed always gives the same text, so runs compare.
+ */
+inline std::string syntheticText(TextKind kind, uint32_t seed) {
+    static constexpr std::array<std::string_view, 10> WORDS{
+        "hello", "world", "the", "server", "is", "back", "anyone", "around", "tonight", "ok"};
+    static constexpr std::array<std::string_view, 8> EMOJI{
+        "\xF0\x9F\x98\x80", "\xF0\x9F\x91\x8D\xF0\x9F\x8F\xBD", "\xF0\x9F\x8E\x89", "\xE2\x9D\xA4\xEF\xB8\x8F",
+        "\xF0\x9F\x91\xA8\xE2\x80\x8D\xF0\x9F\x91\xA9\xE2\x80\x8D\xF0\x9F\x91\xA7", "\xF0\x9F\x94\xA5",
+        "\xF0\x9F\x90\xB1", "\xF0\x9F\x87\xBA\xF0\x9F\x87\xA6"};
+    static constexpr std::array<std::string_view, 6> SCRIPTS{
+        "привет", "你好世界", "مرحبا", "שלום", "hello", "こんにちは"};
+
+    std::minstd_rand rng(seed + 1);
+    auto pick = [&rng](const auto& items) { return items[rng() % items.size()]; };
+    std::string text;
+    switch(kind) {
+        case TextKind::Chat:
+            for(int words = 3 + static_cast<int>(rng() % 10); words > 0; --words) {
+                text += pick(WORDS);
+                text += ' ';
+            }
+            break;
+        case TextKind::LongLine:
+            while(text.size() < 3000) {
+                // Mostly unbroken, the wrapping has to split inside words.
+                text.append(40 + rng() % 200, static_cast<char>('a' + rng() % 26));
+                text += ' ';
+            }
+            break;
+        case TextKind::Emoji:
+            for(int items = 10 + static_cast<int>(rng() % 30); items > 0; --items) {
+                text += pick(EMOJI);
+                if(rng() % 3 == 0) {
+                    text += ' ';
+                    text += pick(WORDS);
+                    text += ' ';
+                }
+            }
+            break;
+        case TextKind::MixedScripts:
+            for(int words = 10 + static_cast<int>(rng() % 40); words > 0; --words) {
+                text += pick(SCRIPTS);
+                text += ' ';
+            }
+            break;
+    }
+    if(!text.empty() && text.back() == ' ') {
+        text.pop_back();
+    }
+    return text;
+}
+
+} // namespace bench
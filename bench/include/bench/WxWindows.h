@@ -0,0 +1,63 @@
+#pragma once
+
+#include <bench/SyntheticText.h>
+#include <client/chatPanel.h>
+#include <client/message.h>
+#include <client/user.h>
+#include <wx/frame.h>
+#include <vector>
+
+/**
+ * @file WxWindows.h
+ * @brief The widgets the client benchmarks drive, in a frame that is never shown.
+ */
+
+namespace bench {
+
+/// @brief The client area the chat is laid out in, a small laptop window.
+inline constexpr int WINDOW_WIDTH = 1024;
+inline constexpr int WINDOW_HEIGHT = 720;
+
+/**
+ * @brief A chat panel in a hidden top-level frame, created on first use.
+ * @details Without a main window above it the panel has no session, so only the paths
+ * that need none may be driven: live messages, rewrapping, rosters. Only used from the
+ * benchmark thread, which is the wx main thread.
+ */
+inline client::ChatPanel& chatPanel() {
+    static client::ChatPanel* panel = [] {
+        auto* frame = new wxFrame(nullptr, wxID_ANY, "wx_client_bench");
+        auto* chat = new client::ChatPanel(frame);
+        frame->SetClientSize(WINDOW_WIDTH, WINDOW_HEIGHT);
+        frame->Layout();
+        return chat;
+    }();
+    return *panel;
+}
+
+/// @brief Message `index` of a synthetic room, kept as the client keeps received messages.
+inline client::Message syntheticMessage(TextKind kind, uint32_t index) {
+    const int32_t userId = static_cast<int32_t>(index % 50) + 1;
+    const int64_t timestamp = 1'700'000'000'000'000LL + static_cast<int64_t>(index) * 1'000'000;
+    return client::Message{client::UserNames::Intern("user" + std::to_string(userId))
+        , userId
+        , syntheticText(kind, index)
+        , timestamp
+        , static_cast<int32_t>(index) + 1
+        , static_cast<int64_t>(index) + 1};
+}
+
+/// @brief A roster of `count` users, a tenth of them moderators and owners.
+inline std::vector<client::User> syntheticUsers(size_t count) {
+    std::vector<client::User> users;
+    users.reserve(count);
+    for(size_t i = 0; i < count; ++i) {
+        const auto role = i % 10 == 0 ? (i % 20 == 0 ? chat::UserRights::OWNER : chat::UserRights::MODERATOR) : chat::UserRights::REGULAR;
+        client::User user(static_cast<int32_t>(i) + 1, wxString::FromUTF8(syntheticText(TextKind::MixedScripts, static_cast<uint32_t>(i))).Left(12), role);
+        user.count = i % 3 == 0 ? 0 : 1;
+        users.push_back(std::move(user));
+    }
+    return users;
+}
+
+} // namespace bench
@@ -0,0 +1,106 @@
+#include <benchmark/benchmark.h>
+#include <bench/EventLoops.h>
+#include <common/utils/AwaitableGuarded.h>
+
+using Counter = common::AwaitableGuarded<uint64_t>;
+
+// Uncontended acquisitions never suspend, so they run on the benchmark thread.
+static void BM_AwaitableGuarded_UniqueUncontended(benchmark::State& state) {
+    auto guarded = Counter::create(0u);
+    for(auto _ : state) {
+        drogon::sync_wait([&]() -> drogon::Task<> {
+            auto value = co_await guarded->lock_unique();
+            ++*value;
+        }());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AwaitableGuarded_UniqueUncontended);
+
+static void BM_AwaitableGuarded_SharedUncontended(benchmark::State& state) {
+    auto guarded = Counter::create(0u);
+    for(auto _ : state) {
+        drogon::sync_wait([&]() -> drogon::Task<> {
+            auto value = co_await guarded->lock_shared();
+            benchmark::DoNotOptimize(*value);
+        }());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AwaitableGuarded_SharedUncontended);
+
+// state.range(0) coroutines per IO loop take the unique lock state.range(1) times each, and
+// yield while holding it so the others queue up. One iteration is the whole round.
+static void BM_AwaitableGuarded_UniqueContended(benchmark::State& state) {
+    const auto per_loop = static_cast<size_t>(state.range(0));
+    const auto rounds = static_cast<size_t>(state.range(1));
+    const size_t loops = drogon::app().getThreadNum();
+    auto guarded = Counter::create(0u);
+
+    for(auto _ : state) {
+        std::atomic<size_t> remaining{loops * per_loop};
+        std::promise<void> done;
+        for(size_t loop = 0; loop < loops; ++loop) {
+            drogon::app().getIOLoop(loop)->queueInLoop([&, loop] {
+                for(size_t i = 0; i < per_loop; ++i) {
+                    drogon::async_run([&, loop]() -> drogon::Task<> {
+                        for(size_t round = 0; round < rounds; ++round) {
+                            auto value = co_await guarded->lock_unique();
+                            ++*value;
+                            // Hand the loop over while holding the lock, as a handler awaiting the database would.
+                            co_await drogon::queueInLoopCoro<void>(drogon::app().getIOLoop(loop), [] {});
+                        }
+                        if(remaining.fetch_sub(1) == 1) {
+                            done.set_value();
+                        }
+                    });
+                }
+            });
+        }
+        done.get_future().wait();
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<int64_t>(loops * per_loop * rounds));
+}
+BENCHMARK(BM_AwaitableGuarded_UniqueContended)->Args({1, 100})->Args({8, 100})->Args({64, 20})->UseRealTime();
+
+// A writer among readers: readers of every loop share the lock while one writer keeps queueing for it.
+static void BM_AwaitableGuarded_MixedContended(benchmark::State& state) {
+    const auto readers_per_loop = static_cast<size_t>(state.range(0));
+    const size_t loops = drogon::app().getThreadNum();
+    auto guarded = Counter::create(0u);
+
+    for(auto _ : state) {
+        std::atomic<size_t> remaining{loops * readers_per_loop + 1};
+        std::promise<void> done;
+        const auto finish = [&] {
+            if(remaining.fetch_sub(1) == 1) {
+                done.set_value();
+            }
+        };
+        for(size_t loop = 0; loop < loops; ++loop) {
+            drogon::app().getIOLoop(loop)->queueInLoop([&, loop] {
+                for(size_t i = 0; i < readers_per_loop; ++i) {
+                    drogon::async_run([&, loop]() -> drogon::Task<> {
+                        for(int round = 0; round < 20; ++round) {
+                            auto value = co_await guarded->lock_shared();
+                            benchmark::DoNotOptimize(*value);
+                            co_await drogon::queueInLoopCoro<void>(drogon::app().getIOLoop(loop), [] {});
+                        }
+                        finish();
+                    });
+                }
+            });
+        }
+        drogon::app().getIOLoop(0)->queueInLoop([&] {
+            drogon::async_run([&]() -> drogon::Task<> {
+                for(int round = 0; round < 20; ++round) {
+                    auto value = co_await guarded->lock_unique();
+                    ++*value;
+                }
+                finish();
+            });
+        });
+        done.get_future().wait();
+    }
+}
+BENCHMARK(BM_AwaitableGuarded_MixedContended)->Arg(4)->Arg(32)->UseRealTime();
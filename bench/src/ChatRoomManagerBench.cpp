@@ -0,0 +1,67 @@
+#include <benchmark/benchmark.h>
+#include <bench/EventLoops.h>
+#include <server/chat/ChatRoomManager.h>
+#include <common/utils/utils.h>
+
+/// @brief Room IDs start here, each fan-out size gets a room of its own.
+static constexpr int32_t FIRST_ROOM_ID = 1'000'000;
+
+/**
+ * @brief The members of one benchmark room, spread round-robin over the IO loops.
+ * @details Built once per size and kept, the manager is a process-wide singleton.
+ */
+struct BenchRoom {
+    int32_t room_id;
+    std::vector<std::shared_ptr<bench::NullConnection>> conns;
+};
+
+static BenchRoom& roomOfSize(size_t members) {
+    static std::map<size_t, BenchRoom> rooms;
+    auto [it, added] = rooms.try_emplace(members);
+    if(!added) {
+        return it->second;
+    }
+    auto& room = it->second;
+    room.room_id = FIRST_ROOM_ID + static_cast<int32_t>(rooms.size());
+    auto& manager = server::ChatRoomManager::instance();
+    for(size_t i = 0; i < members; ++i) {
+        auto conn = std::make_shared<bench::NullConnection>();
+        room.conns.push_back(conn);
+        const auto user_id = static_cast<int32_t>(room.room_id * 100 + static_cast<int32_t>(i));
+        server::WsData data{
+            .user = server::User{.id = user_id, .shared_name = server::UserDirectory::instance().acquire(user_id, "bench-" + std::to_string(i))},
+            .room = server::CurrentRoom{.id = room.room_id, .rights = chat::UserRights::REGULAR},
+            .status = server::USER_STATUS::Authenticated,
+        };
+        // Registered on the loop the connection would live on.
+        bench::runOnLoop(i % drogon::app().getThreadNum(), [&]() -> drogon::Task<> {
+            co_await manager.registerConnection(user_id, conn);
+            co_await manager.addConnectionToRoom(conn, data, false);
+        });
+    }
+    // Let the join announcements go out before measuring.
+    std::this_thread::sleep_for(std::chrono::milliseconds{300});
+    bench::drainLoops();
+    return room;
+}
+
+// One broadcast to a room, from the takeover of the shard lock until every loop has written to its members.
+static void BM_ChatRoomManager_SendToRoom(benchmark::State& state) {
+    auto& room = roomOfSize(static_cast<size_t>(state.range(0)));
+    chat::Envelope env;
+    auto* message = env.mutable_room_message()->mutable_message();
+    message->mutable_from()->set_user_id(1);
+    message->mutable_from()->set_user_name("bench");
+    message->set_message(std::string(64, 'x'));
+    const auto bytes = common::serializeEnvelope(env);
+    auto& manager = server::ChatRoomManager::instance();
+
+    for(auto _ : state) {
+        bench::runOnLoop(0, [&]() -> drogon::Task<> {
+            co_await manager.sendToRoom(room.room_id, bytes, false);
+        });
+        bench::drainLoops();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ChatRoomManager_SendToRoom)->Arg(1)->Arg(10)->Arg(100)->Arg(1000)->Arg(10'000)->UseRealTime();
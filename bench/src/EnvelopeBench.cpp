@@ -0,0 +1,141 @@
+#include <benchmark/benchmark.h>
+#include <bench/EventLoops.h>
+#include <server/chat/RequestArena.h>
+#include <common/utils/utils.h>
+#include <common/utils/packed_messages.h>
+
+static void fillMessage(chat::MessageInfo& message, int32_t id, size_t text_bytes) {
+    message.mutable_from()->set_user_id(id % 50);
+    message.mutable_from()->set_user_name("user-" + std::to_string(id % 50));
+    message.set_message(std::string(text_bytes, 'x'));
+    message.set_timestamp(1'700'000'000'000'000 + id);
+    message.set_message_id(id);
+}
+
+static chat::Envelope roomMessage(size_t text_bytes) {
+    chat::Envelope env;
+    fillMessage(*env.mutable_room_message()->mutable_message(), 1, text_bytes);
+    return env;
+}
+
+static chat::Envelope historyPage(int32_t messages) {
+    chat::Envelope env;
+    auto* resp = env.mutable_get_messages_response();
+    common::setStatus(*resp, chat::STATUS_SUCCESS);
+    for(int32_t i = 0; i < messages; ++i) {
+        fillMessage(*resp->add_message(), i, 80);
+    }
+    return env;
+}
+
+// common::sendEnvelope serializes into a fresh string and sends it, as every reply does.
+static void BM_SendEnvelope_RoomMessage(benchmark::State& state) {
+    const auto env = roomMessage(static_cast<size_t>(state.range(0)));
+    auto conn = std::make_shared<bench::NullConnection>();
+    for(auto _ : state) {
+        common::sendEnvelope(conn, env);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(conn->bytesSent()));
+}
+BENCHMARK(BM_SendEnvelope_RoomMessage)->Arg(16)->Arg(256)->Arg(4096);
+
+static void BM_SendEnvelope_HistoryPage(benchmark::State& state) {
+    const auto env = historyPage(static_cast<int32_t>(state.range(0)));
+    auto conn = std::make_shared<bench::NullConnection>();
+    for(auto _ : state) {
+        common::sendEnvelope(conn, env);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(conn->bytesSent()));
+}
+BENCHMARK(BM_SendEnvelope_HistoryPage)->Arg(10)->Arg(100)->Arg(200);
+
+// Broadcasts serialize once into a shared buffer.
+static void BM_SerializeEnvelope_HistoryPage(benchmark::State& state) {
+    const auto env = historyPage(static_cast<int32_t>(state.range(0)));
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(common::serializeEnvelope(env));
+    }
+}
+BENCHMARK(BM_SerializeEnvelope_HistoryPage)->Arg(10)->Arg(100);
+
+static void BM_CompressEnvelope_HistoryPage(benchmark::State& state) {
+    const auto bytes = common::serializeEnvelope(historyPage(static_cast<int32_t>(state.range(0))));
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(common::compressEnvelope(bytes, chat::COMPRESSION_GZIP));
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(bytes->size()));
+}
+BENCHMARK(BM_CompressEnvelope_HistoryPage)->Arg(10)->Arg(100);
+
+static void BM_ParseEnvelope_HistoryPage(benchmark::State& state) {
+    const auto bytes = common::serializeEnvelope(historyPage(static_cast<int32_t>(state.range(0))));
+    for(auto _ : state) {
+        chat::Envelope env;
+        benchmark::DoNotOptimize(env.ParseFromString(*bytes));
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(bytes->size()));
+}
+BENCHMARK(BM_ParseEnvelope_HistoryPage)->Arg(10)->Arg(100);
+
+// A page packed as a GetMessagesRequest.packed asks, with the size it ends up at next to the plain one.
+static void BM_PackMessages_HistoryPage(benchmark::State& state) {
+    const auto page = historyPage(static_cast<int32_t>(state.range(0)));
+    const auto& messages = page.get_messages_response().message();
+    chat::PackedMessages packed;
+    for(auto _ : state) {
+        common::packMessages(messages, packed);
+        benchmark::DoNotOptimize(packed);
+    }
+    state.counters["packed_ratio"] = static_cast<double>(packed.ByteSizeLong()) / static_cast<double>(page.get_messages_response().ByteSizeLong());
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_PackMessages_HistoryPage)->Arg(10)->Arg(100);
+
+static void BM_UnpackMessages_HistoryPage(benchmark::State& state) {
+    chat::PackedMessages packed;
+    common::packMessages(historyPage(static_cast<int32_t>(state.range(0))).get_messages_response().message(), packed);
+    for(auto _ : state) {
+        google::protobuf::RepeatedPtrField<chat::MessageInfo> messages;
+        benchmark::DoNotOptimize(common::unpackMessages(packed, messages));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_UnpackMessages_HistoryPage)->Arg(10)->Arg(100);
+
+// Builds and frees a history page on the heap, one allocation per message, string and author.
+static void BM_BuildHistoryPage_Heap(benchmark::State& state) {
+    const auto messages = static_cast<int32_t>(state.range(0));
+    for(auto _ : state) {
+        chat::Envelope env;
+        auto* resp = env.mutable_get_messages_response();
+        for(int32_t i = 0; i < messages; ++i) {
+            fillMessage(*resp->add_message(), i, 80);
+        }
+        benchmark::DoNotOptimize(env);
+    }
+}
+BENCHMARK(BM_BuildHistoryPage_Heap)->Arg(10)->Arg(100);
+
+// The same page on a server::RequestArena, as the request path builds it, released in one go.
+static void BM_BuildHistoryPage_Arena(benchmark::State& state) {
+    const auto messages = static_cast<int32_t>(state.range(0));
+    for(auto _ : state) {
+        server::RequestArena exchange;
+        auto* resp = exchange.response->mutable_get_messages_response();
+        for(int32_t i = 0; i < messages; ++i) {
+            fillMessage(*resp->add_message(), i, 80);
+        }
+        benchmark::DoNotOptimize(exchange.response);
+    }
+}
+BENCHMARK(BM_BuildHistoryPage_Arena)->Arg(10)->Arg(100);
+
+static void BM_ParseEnvelope_HistoryPage_Arena(benchmark::State& state) {
+    const auto bytes = common::serializeEnvelope(historyPage(static_cast<int32_t>(state.range(0))));
+    for(auto _ : state) {
+        server::RequestArena exchange;
+        benchmark::DoNotOptimize(exchange.request->ParseFromString(*bytes));
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(bytes->size()));
+}
+BENCHMARK(BM_ParseEnvelope_HistoryPage_Arena)->Arg(10)->Arg(100);
@@ -0,0 +1,234 @@
+#include <benchmark/benchmark.h>
+#include <bench/Database.h>
+#include <bench/EventLoops.h>
+#include <bench/RecordingRoomService.h>
+#include <server/chat/MessageHandlers.h>
+#include <server/db/migrations.h>
+#include <server/utils/switch_to_io_loop.h>
+
+// Whole handlers against a seeded database, with the rooms kept by a RecordingRoomService.
+// Each benchmark reports the database operations and the rounds of them per call next to its time.
+
+static constexpr int ROOMS = 4;
+static constexpr int MESSAGES_PER_ROOM = 1000;
+static constexpr auto PASSWORD_HASH = "bench-hash";
+
+/**
+ * @brief The user, rooms and sessions the benchmarks run with, seeded once through the handlers themselves.
+ * @details Names are unique per run, so the same database can be reused.
+ */
+struct Seed {
+    std::unique_ptr<server::MessageHandlers> handlers;
+    bench::RecordingRoomService rooms;
+    /// What the handlers are given, they are instantiated for the interface rather than for each implementation.
+    server::IChatRoomService& service = rooms;
+    std::string user_name;
+    std::vector<int32_t> room_ids;
+    /// Logged in and in the last seeded room.
+    server::WsDataPtr session;
+    /// Another session of the user for the joins, which leaves `session` where it is.
+    server::WsDataPtr switcher;
+    /// Why the benchmarks are skipped, empty when seeded.
+    std::string error;
+};
+
+static bool ok(const auto& resp) {
+    return resp.status().code() == chat::STATUS_SUCCESS;
+}
+
+static drogon::Task<server::WsDataPtr> login(Seed& seed) {
+    auto ws = server::WsDataGuarded::create();
+    chat::InitialAuthRequest initial;
+    initial.set_username(seed.user_name);
+    if(!ok(co_await seed.handlers->handleAuthInitial(ws, initial))) {
+        co_return nullptr;
+    }
+    chat::AuthRequest auth;
+    auth.set_hash(PASSWORD_HASH);
+    if(!ok(co_await seed.handlers->handleAuth(ws, auth, seed.service))) {
+        co_return nullptr;
+    }
+    co_return ws;
+}
+
+static drogon::Task<bool> join(Seed& seed, const server::WsDataPtr& ws, int32_t room_id, bool history) {
+    chat::JoinRoomRequest req;
+    req.set_room_id(room_id);
+    if(history) {
+        req.mutable_history()->set_limit(50);
+    }
+    co_return ok(co_await seed.handlers->handleJoinRoom(ws, req, seed.service));
+}
+
+static void seedDatabase(Seed& seed) {
+    if(bench::databaseDsn().empty()) {
+        seed.error = "CHAT_BENCH_PG is not set";
+        return;
+    }
+    auto db = drogon::app().getDbClient("default");
+    seed.handlers = std::make_unique<server::MessageHandlers>(db);
+    seed.user_name = "hb" + std::to_string(std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+
+    bench::runOnLoop(0, [&]() -> drogon::Task<> {
+        if(!co_await server::MigrateDatabase(db)) {
+            seed.error = "Migrations failed, chat_bench looks for db/ in the working directory";
+            co_return;
+        }
+        auto ws = server::WsDataGuarded::create();
+        chat::InitialRegisterRequest initial;
+        initial.set_username(seed.user_name);
+        chat::RegisterRequest reg;
+        reg.set_salt("bench-salt");
+        reg.set_hash(PASSWORD_HASH);
+        if(!ok(co_await seed.handlers->handleRegisterInitial(ws, initial)) || !ok(co_await seed.handlers->handleRegister(ws, reg))) {
+            seed.error = "Could not register the benchmark user";
+            co_return;
+        }
+        seed.session = co_await login(seed);
+        seed.switcher = co_await login(seed);
+        if(!seed.session || !seed.switcher) {
+            seed.error = "Could not log in the benchmark user";
+            co_return;
+        }
+        for(int room = 0; room < ROOMS; ++room) {
+            chat::CreateRoomRequest create;
+            create.set_room_name(seed.user_name + "-" + std::to_string(room));
+            if(!ok(co_await seed.handlers->handleCreateRoom(seed.session, create, seed.service))
+                || !co_await join(seed, seed.session, seed.rooms.lastCreatedRoom(), false)) {
+                seed.error = "Could not create the benchmark rooms";
+                co_return;
+            }
+            seed.room_ids.push_back(seed.rooms.lastCreatedRoom());
+            for(int i = 0; i < MESSAGES_PER_ROOM; ++i) {
+                chat::SendMessageRequest send;
+                send.set_message("bench message " + std::to_string(i) + " of room " + std::to_string(room) + ", lorem ipsum");
+                if(!ok(co_await seed.handlers->handleSendMessage(seed.session->get_unsafe(), send, seed.service))) {
+                    seed.error = "Could not send the seed messages";
+                    co_return;
+                }
+            }
+        }
+    });
+    // The batcher writes the last messages shortly after they were answered.
+    std::this_thread::sleep_for(std::chrono::seconds{1});
+}
+
+static Seed& seeded() {
+    static Seed seed;
+    static std::once_flag once;
+    std::call_once(once, [] { seedDatabase(seed); });
+    return seed;
+}
+
+/**
+ * @brief Runs `call(seed)` once per iteration on the first IO loop, reporting `queries` and `round_trips` per call.
+ * @details A round trip is a stretch with at least one operation in flight, see `server::DbOperationCounters`,
+ * so queries issued together count once. Writes the handler leaves to `MessageBatcher` are not counted.
+ */
+template <typename F>
+static void measure(benchmark::State& state, F&& call) {
+    auto& seed = seeded();
+    if(!seed.error.empty()) {
+        state.SkipWithError(seed.error.c_str());
+        return;
+    }
+    auto& counters = server::dbOperationCounters();
+    const auto operations = counters.operations.load();
+    const auto rounds = counters.rounds.load();
+    for(auto _ : state) {
+        bool success = false;
+        bench::runOnLoop(0, [&]() -> drogon::Task<> {
+            success = co_await call(seed);
+        });
+        if(!success) {
+            state.SkipWithError("The handler failed");
+            break;
+        }
+    }
+    state.counters["queries"] = benchmark::Counter(static_cast<double>(counters.operations.load() - operations), benchmark::Counter::kAvgIterations);
+    state.counters["round_trips"] = benchmark::Counter(static_cast<double>(counters.rounds.load() - rounds), benchmark::Counter::kAvgIterations);
+}
+
+// InitialAuthRequest and AuthRequest of a fresh connection, the room list included.
+static void BM_Handler_Login(benchmark::State& state) {
+    measure(state, [](Seed& seed) -> drogon::Task<bool> {
+        co_return co_await login(seed) != nullptr;
+    });
+}
+BENCHMARK(BM_Handler_Login)->UseRealTime();
+
+// A room switch, with the first history page in the response or without.
+static void BM_Handler_JoinRoom(benchmark::State& state) {
+    size_t next = 0;
+    const bool history = state.range(0) != 0;
+    measure(state, [&](Seed& seed) -> drogon::Task<bool> {
+        co_return co_await join(seed, seed.switcher, seed.room_ids[next++ % seed.room_ids.size()], history);
+    });
+}
+BENCHMARK(BM_Handler_JoinRoom)->ArgName("history")->Arg(0)->Arg(1)->UseRealTime();
+
+// The newest page, mostly served by the history cache, and one from the middle of the room.
+static void BM_Handler_GetMessages(benchmark::State& state) {
+    const auto limit = static_cast<int32_t>(state.range(0));
+    const bool older = state.range(1) != 0;
+    measure(state, [&](Seed& seed) -> drogon::Task<bool> {
+        chat::GetMessagesRequest req;
+        req.set_limit(limit);
+        if(older) {
+            req.set_offset_seq(MESSAGES_PER_ROOM / 2);
+        }
+        chat::GetMessagesResponse resp;
+        co_await seed.handlers->handleGetMessages(seed.session->get_unsafe(), req, resp);
+        co_return ok(resp);
+    });
+}
+BENCHMARK(BM_Handler_GetMessages)->ArgNames({"limit", "older"})->Args({50, 0})->Args({50, 1})->Args({200, 1})->UseRealTime();
+
+static void BM_Handler_SendMessage(benchmark::State& state) {
+    uint64_t sent = 0;
+    measure(state, [&](Seed& seed) -> drogon::Task<bool> {
+        chat::SendMessageRequest req;
+        req.set_message("bench message, lorem ipsum");
+        req.set_client_key(seed.user_name + "-" + std::to_string(sent++));
+        co_return ok(co_await seed.handlers->handleSendMessage(seed.session->get_unsafe(), req, seed.service));
+    });
+}
+BENCHMARK(BM_Handler_SendMessage)->UseRealTime();
+
+static void BM_Handler_GetRoomMembers(benchmark::State& state) {
+    measure(state, [](Seed& seed) -> drogon::Task<bool> {
+        chat::GetRoomMembersRequest req;
+        req.set_room_id(seed.room_ids.back());
+        chat::GetRoomMembersResponse resp;
+        co_await seed.handlers->handleGetRoomMembers(seed.session->get_unsafe(), req, resp);
+        co_return ok(resp);
+    });
+}
+BENCHMARK(BM_Handler_GetRoomMembers)->UseRealTime();
+
+// A word every seeded message contains, in one room or in all of them.
+static void BM_Handler_SearchMessages(benchmark::State& state) {
+    const bool all_rooms = state.range(0) != 0;
+    measure(state, [&](Seed& seed) -> drogon::Task<bool> {
+        chat::SearchMessagesRequest req;
+        req.set_query("lorem");
+        req.set_room_id(all_rooms ? 0 : seed.room_ids.back());
+        chat::SearchMessagesResponse resp;
+        co_await seed.handlers->handleSearchMessages(seed.session->get_unsafe(), req, resp);
+        co_return ok(resp);
+    });
+}
+BENCHMARK(BM_Handler_SearchMessages)->ArgName("all_rooms")->Arg(0)->Arg(1)->UseRealTime();
+
+// A reconnected client catching up on a room from the start.
+static void BM_Handler_SyncRoom(benchmark::State& state) {
+    measure(state, [](Seed& seed) -> drogon::Task<bool> {
+        chat::SyncRoomRequest req;
+        req.set_room_id(seed.room_ids.back());
+        chat::SyncRoomResponse resp;
+        co_await seed.handlers->handleSyncRoom(seed.session->get_unsafe(), req, resp);
+        co_return ok(resp);
+    });
+}
+BENCHMARK(BM_Handler_SyncRoom)->UseRealTime();
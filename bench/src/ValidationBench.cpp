@@ -0,0 +1,73 @@
+#include <benchmark/benchmark.h>
+#include <server/chat/MessageHandlers.h>
+#include <server/db/migrations.h>
+
+static std::string repeatToLength(std::string_view unit, size_t bytes) {
+    std::string out;
+    while(out.size() + unit.size() <= bytes) {
+        out += unit;
+    }
+    return out;
+}
+
+static void BM_ValidateUtf8String_Ascii(benchmark::State& state) {
+    const auto text = repeatToLength("hello world ", static_cast<size_t>(state.range(0)));
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(server::MessageHandlers::validateUtf8String(text, 1'000'000, "message"));
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(text.size()));
+}
+BENCHMARK(BM_ValidateUtf8String_Ascii)->Arg(64)->Arg(1024)->Arg(16 * 1024);
+
+static void BM_ValidateUtf8String_Cyrillic(benchmark::State& state) {
+    const auto text = repeatToLength("привет мир ", static_cast<size_t>(state.range(0)));
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(server::MessageHandlers::validateUtf8String(text, 1'000'000, "message"));
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(text.size()));
+}
+BENCHMARK(BM_ValidateUtf8String_Cyrillic)->Arg(64)->Arg(1024)->Arg(16 * 1024);
+
+// The error path builds a message, a limit exceeded by a long text is the case clients can trigger at will.
+static void BM_ValidateUtf8String_TooLong(benchmark::State& state) {
+    const auto text = repeatToLength("hello world ", 16 * 1024);
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(server::MessageHandlers::validateUtf8String(text, 1024, "message"));
+    }
+}
+BENCHMARK(BM_ValidateUtf8String_TooLong);
+
+// A stray continuation byte at the end, the whole text is read before it is turned down.
+static void BM_ValidateUtf8String_Invalid(benchmark::State& state) {
+    const auto text = repeatToLength("привет мир ", 1000) + "\x80";
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(server::MessageHandlers::validateUtf8String(text, 1'000'000, "message"));
+    }
+}
+BENCHMARK(BM_ValidateUtf8String_Invalid);
+
+// A name is scanned for a letter or a digit; punctuation and emoji only are read to the end.
+static void BM_ValidateName_NoLetter(benchmark::State& state) {
+    const auto text = repeatToLength("\xF0\x9F\x98\x80 !", static_cast<size_t>(state.range(0)));
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(server::MessageHandlers::validateName(text, 1'000'000, "room name"));
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(text.size()));
+}
+BENCHMARK(BM_ValidateName_NoLetter)->Arg(64)->Arg(16 * 1024);
+
+static void BM_SplitSqlStatements(benchmark::State& state) {
+    std::string script;
+    for(int64_t i = 0; i < state.range(0); ++i) {
+        script += "\n  CREATE INDEX IF NOT EXISTS idx_" + std::to_string(i) + " ON messages (room_id, created_at DESC) ;\n";
+    }
+    for(auto _ : state) {
+        size_t statements = 0;
+        for(const auto& statement : server::splitSqlStatements(script)) {
+            statements += !statement.empty();
+        }
+        benchmark::DoNotOptimize(statements);
+    }
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(script.size()));
+}
+BENCHMARK(BM_SplitSqlStatements)->Arg(10)->Arg(1000);
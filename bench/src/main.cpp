@@ -0,0 +1,26 @@
+#include <benchmark/benchmark.h>
+#include <bench/Database.h>
+#include <bench/EventLoops.h>
+
+// Drogon runs on a background thread, so the benchmarks can post work to its IO loops and wait for it.
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if(benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+
+    std::promise<void> started;
+    drogon::app().setThreadNum(bench::IO_THREADS);
+    drogon::app().setLogLevel(trantor::Logger::kWarn);
+    bench::configureDatabase();
+    drogon::app().registerBeginningAdvice([&started] { started.set_value(); });
+    std::thread app([] { drogon::app().run(); });
+    started.get_future().wait();
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    drogon::app().getLoop()->queueInLoop([] { drogon::app().quit(); });
+    app.join();
+    return 0;
+}
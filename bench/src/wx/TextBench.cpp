@@ -0,0 +1,135 @@
+#include <benchmark/benchmark.h>
+#include <bench/WxWindows.h>
+#include <client/cachedColorText.h>
+#include <client/lineBitmapCache.h>
+#include <client/messageView.h>
+#include <client/textUtil.h>
+#include <wx/settings.h>
+#include <wx/tokenzr.h>
+
+using bench::TextKind;
+
+static const TextKind KINDS[] = {TextKind::Chat, TextKind::LongLine, TextKind::Emoji, TextKind::MixedScripts};
+
+static void kindArgs(benchmark::internal::Benchmark* b) {
+    for(TextKind kind : KINDS) {
+        b->Arg(static_cast<int64_t>(kind));
+    }
+}
+
+static TextKind kindOf(const benchmark::State& state) {
+    return static_cast<TextKind>(state.range(0));
+}
+
+// The width the message view wraps at in the benchmark window.
+static int wrapWidth() {
+    return bench::chatPanel().m_messageView->GetClientSize().x;
+}
+
+static wxFont messageFont() {
+    return bench::chatPanel().m_messageView->GetFont();
+}
+
+static void BM_WrapText(benchmark::State& state) {
+    const TextKind kind = kindOf(state);
+    auto* view = bench::chatPanel().m_messageView;
+    const wxFont font = messageFont();
+    const int width = wrapWidth();
+    uint32_t seed = 0;
+    for(auto _ : state) {
+        // A new text each time, as every message arriving is.
+        state.PauseTiming();
+        const wxString text = wxString::FromUTF8(bench::syntheticText(kind, seed++));
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(client::TextUtil::WrapText(view, text, width, font));
+    }
+    state.SetLabel(bench::textKindName(kind));
+}
+BENCHMARK(BM_WrapText)->Apply(kindArgs);
+
+// A resize drag: the same messages rewrapped at a width that changes every frame.
+static void BM_WrappedText_Resize(benchmark::State& state) {
+    const TextKind kind = kindOf(state);
+    const wxFont font = messageFont();
+    std::vector<client::TextUtil::WrappedText> texts(100);
+    for(size_t i = 0; i < texts.size(); ++i) {
+        texts[i].SetText(wxString::FromUTF8(bench::syntheticText(kind, static_cast<uint32_t>(i))));
+    }
+    const int widest = wrapWidth();
+    int frame = 0;
+    for(auto _ : state) {
+        // Narrowed by 8 pixels a frame, over a third of the window.
+        const int width = widest - (frame++ % 40) * 8;
+        for(auto& text : texts) {
+            benchmark::DoNotOptimize(text.Wrap(width, font));
+        }
+    }
+    state.counters["frames_per_second"] = benchmark::Counter(static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+    state.SetLabel(bench::textKindName(kind));
+}
+BENCHMARK(BM_WrappedText_Resize)->Apply(kindArgs)->UseRealTime();
+
+// The lines of one wrapped message, as the message view and CachedColorText draw them.
+static wxArrayString wrappedLines(TextKind kind, uint32_t seed) {
+    const wxString text = wxString::FromUTF8(bench::syntheticText(kind, seed));
+    const wxString wrapped = client::TextUtil::WrapText(bench::chatPanel().m_messageView, text, wrapWidth(), messageFont());
+    return wxStringTokenize(wrapped, "\n", wxTOKEN_RET_EMPTY_ALL);
+}
+
+// Every line rasterized on each frame, as after a theme change or on a cold start.
+static void BM_LineBitmapCache_Cold(benchmark::State& state) {
+    const TextKind kind = kindOf(state);
+    const wxArrayString lines = wrappedLines(kind, 1);
+    const wxFont font = messageFont();
+    const wxColour foreground = wxSystemSettings::GetColour(wxSYS_COLOUR_WINDOWTEXT);
+    const wxColour background = wxSystemSettings::GetColour(wxSYS_COLOUR_WINDOW);
+    auto& cache = client::LineBitmapCache::Get();
+    for(auto _ : state) {
+        cache.Clear();
+        for(const auto& line : lines) {
+            benchmark::DoNotOptimize(cache.GetLine(line, font, foreground, background));
+        }
+    }
+    cache.Clear();
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * lines.size()));
+    state.SetLabel(bench::textKindName(kind));
+}
+BENCHMARK(BM_LineBitmapCache_Cold)->Apply(kindArgs);
+
+// The same lines drawn again, as on every scroll and repaint.
+static void BM_LineBitmapCache_Warm(benchmark::State& state) {
+    const TextKind kind = kindOf(state);
+    const wxArrayString lines = wrappedLines(kind, 1);
+    const wxFont font = messageFont();
+    const wxColour foreground = wxSystemSettings::GetColour(wxSYS_COLOUR_WINDOWTEXT);
+    const wxColour background = wxSystemSettings::GetColour(wxSYS_COLOUR_WINDOW);
+    auto& cache = client::LineBitmapCache::Get();
+    cache.Clear();
+    for(auto _ : state) {
+        for(const auto& line : lines) {
+            benchmark::DoNotOptimize(cache.GetLine(line, font, foreground, background));
+        }
+    }
+    cache.Clear();
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * lines.size()));
+    state.SetLabel(bench::textKindName(kind));
+}
+BENCHMARK(BM_LineBitmapCache_Warm)->Apply(kindArgs);
+
+// A label changing its text and being laid out again, as the room header and typing indicator are.
+static void BM_CachedColorText_SetLabel(benchmark::State& state) {
+    const TextKind kind = kindOf(state);
+    auto* label = new client::CachedColorText(&bench::chatPanel(), wxID_ANY, wxEmptyString);
+    std::vector<wxString> texts;
+    for(uint32_t i = 0; i < 16; ++i) {
+        texts.push_back(wxString::FromUTF8(bench::syntheticText(kind, i)));
+    }
+    size_t next = 0;
+    for(auto _ : state) {
+        label->SetLabel(texts[next++ % texts.size()]);
+        benchmark::DoNotOptimize(label->GetBestSize());
+    }
+    label->Destroy();
+    state.SetLabel(bench::textKindName(kind));
+}
+BENCHMARK(BM_CachedColorText_SetLabel)->Apply(kindArgs);
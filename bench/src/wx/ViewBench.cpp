@@ -0,0 +1,145 @@
+#include <benchmark/benchmark.h>
+#include <bench/WxWindows.h>
+#include <client/lineBitmapCache.h>
+#include <client/messageView.h>
+#include <client/roomsPanel.h>
+#include <client/userListPanel.h>
+
+using bench::TextKind;
+
+// A room receiving `batch` live messages a frame, scrolled to the present. Past the row limit
+// every frame also drops the oldest rows, which is where a busy room spends its time.
+static void BM_MessageView_Live(benchmark::State& state) {
+    const auto kind = static_cast<TextKind>(state.range(0));
+    const auto batch = static_cast<uint32_t>(state.range(1));
+    auto* view = bench::chatPanel().m_messageView;
+    view->Clear();
+    uint32_t index = 0;
+    for(auto _ : state) {
+        state.PauseTiming();
+        std::vector<client::Message> messages;
+        for(uint32_t i = 0; i < batch; ++i) {
+            messages.push_back(bench::syntheticMessage(kind, index++));
+        }
+        state.ResumeTiming();
+        view->OnMessagesReceived(messages, false);
+    }
+    state.counters["line_cache_bytes"] = static_cast<double>(client::LineBitmapCache::Get().GetStats().bytes);
+    view->Clear();
+    state.counters["frames_per_second"] = benchmark::Counter(static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+    state.SetItemsProcessed(static_cast<int64_t>(index));
+    state.SetLabel(bench::textKindName(kind));
+}
+BENCHMARK(BM_MessageView_Live)
+    ->ArgsProduct({{static_cast<int64_t>(TextKind::Chat), static_cast<int64_t>(TextKind::LongLine),
+                    static_cast<int64_t>(TextKind::Emoji), static_cast<int64_t>(TextKind::MixedScripts)},
+                   {1, 10, 100}})
+    ->UseRealTime();
+
+// A full view rewrapped at a width that changes every frame, a resize drag.
+static void BM_MessageView_Resize(benchmark::State& state) {
+    const auto kind = static_cast<TextKind>(state.range(0));
+    auto* view = bench::chatPanel().m_messageView;
+    view->Clear();
+    std::vector<client::Message> messages;
+    for(uint32_t i = 0; i < static_cast<uint32_t>(state.range(1)); ++i) {
+        messages.push_back(bench::syntheticMessage(kind, i));
+    }
+    view->OnMessagesReceived(messages, false);
+    const int widest = view->GetClientSize().x;
+    int frame = 0;
+    for(auto _ : state) {
+        // Narrowed by 8 pixels a frame, never the same width twice in a row.
+        view->ReWrapAllMessages(widest - (frame++ % 40) * 8 - 8);
+    }
+    view->Clear();
+    view->ReWrapAllMessages(widest);
+    state.counters["frames_per_second"] = benchmark::Counter(static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+    state.SetLabel(bench::textKindName(kind));
+}
+BENCHMARK(BM_MessageView_Resize)
+    ->ArgsProduct({{static_cast<int64_t>(TextKind::Chat), static_cast<int64_t>(TextKind::LongLine),
+                    static_cast<int64_t>(TextKind::Emoji), static_cast<int64_t>(TextKind::MixedScripts)},
+                   {100, 2000}})
+    ->UseRealTime();
+
+// The roster a room is joined with, sorted and laid out in one go.
+static void BM_UserListPanel_SetUserList(benchmark::State& state) {
+    const auto users = bench::syntheticUsers(static_cast<size_t>(state.range(0)));
+    auto* panel = bench::chatPanel().m_userListPanel;
+    for(auto _ : state) {
+        panel->SetUserList(users);
+    }
+    panel->Clear();
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_UserListPanel_SetUserList)->Arg(100)->Arg(1000)->Arg(10000);
+
+// A room directory of `count` rooms named like the rosters, a quarter of them joined.
+static std::vector<std::unique_ptr<client::Room>> syntheticRooms(size_t count) {
+    std::vector<std::unique_ptr<client::Room>> rooms;
+    rooms.reserve(count);
+    for(size_t i = 0; i < count; ++i) {
+        rooms.push_back(std::make_unique<client::Room>(static_cast<int32_t>(i) + 1,
+            wxString::FromUTF8(bench::syntheticText(TextKind::MixedScripts, static_cast<uint32_t>(i))).Left(24), i % 4 == 0));
+    }
+    return rooms;
+}
+
+static client::RoomListView& roomListView() {
+    static auto* view = new client::RoomListView(bench::chatPanel().GetParent(), wxID_ANY);
+    return *view;
+}
+
+// The directory a login brings, sorted in one go.
+static void BM_RoomListView_SetRooms(benchmark::State& state) {
+    const auto rooms = syntheticRooms(static_cast<size_t>(state.range(0)));
+    std::vector<client::Room*> list;
+    for(const auto& room : rooms) {
+        list.push_back(room.get());
+    }
+    auto& view = roomListView();
+    for(auto _ : state) {
+        view.SetRooms(list);
+    }
+    view.SetRooms({});
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * state.range(0));
+}
+BENCHMARK(BM_RoomListView_SetRooms)->Arg(1000)->Arg(10000)->Arg(100000);
+
+// A room created and deleted in a directory of `count`, the directory events after login.
+static void BM_RoomListView_InsertErase(benchmark::State& state) {
+    const auto rooms = syntheticRooms(static_cast<size_t>(state.range(0)) + 1);
+    std::vector<client::Room*> list;
+    for(size_t i = 1; i < rooms.size(); ++i) {
+        list.push_back(rooms[i].get());
+    }
+    auto& view = roomListView();
+    view.SetRooms(list);
+    for(auto _ : state) {
+        view.Insert(rooms.front().get());
+        view.Erase(rooms.front().get());
+    }
+    view.SetRooms({});
+}
+BENCHMARK(BM_RoomListView_InsertErase)->Arg(1000)->Arg(10000)->Arg(100000);
+
+// One more character typed into the filter of a directory of `count`, then cleared.
+static void BM_RoomListView_Filter(benchmark::State& state) {
+    const auto rooms = syntheticRooms(static_cast<size_t>(state.range(0)));
+    std::vector<client::Room*> list;
+    for(const auto& room : rooms) {
+        list.push_back(room.get());
+    }
+    auto& view = roomListView();
+    view.SetRooms(list);
+    const wxString typed = rooms.front()->room_name.Left(3);
+    for(auto _ : state) {
+        for(size_t length = 1; length <= typed.length(); ++length) {
+            view.SetFilter(typed.Left(length));
+        }
+        view.SetFilter(wxString());
+    }
+    view.SetRooms({});
+}
+BENCHMARK(BM_RoomListView_Filter)->Arg(1000)->Arg(10000)->Arg(100000);
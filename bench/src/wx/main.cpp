@@ -0,0 +1,32 @@
+#include <benchmark/benchmark.h>
+#include <client/app.h>
+#include <wx/dir.h>
+#include <wx/font.h>
+#include <wx/init.h>
+
+// The client's widgets ask wxGetApp() for it, but OnInit() never runs: no main window, no network.
+wxIMPLEMENT_APP_NO_MAIN(client::MyApp);
+
+// wx is initialized on this thread, which draws every widget the benchmarks lay out. The frame
+// holding them is never shown, on Linux a display is still needed: run under xvfb-run without one.
+int main(int argc, char** argv) {
+    benchmark::Initialize(&argc, argv);
+    if(benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+
+    if(!wxEntryStart(argc, argv)) {
+        return 1;
+    }
+    wxArrayString fontFiles;
+    wxDir::GetAllFiles(CHAT_BENCH_FONT_DIR, &fontFiles, "*.ttf", wxDIR_FILES);
+    for(const wxString& fontFile : fontFiles) {
+        wxFont::AddPrivateFont(fontFile);
+    }
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    wxEntryCleanup();
+    return 0;
+}
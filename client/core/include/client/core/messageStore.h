@@ -0,0 +1,101 @@
+#pragma once
+
+#include <client/core/model.h>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace client::core {
+
+// Read-only mapping of a whole file, empty files map to nothing.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile() { Unmap(); }
+
+    bool Map(const std::filesystem::path& path);
+    void Unmap();
+
+    const char* Data() const { return m_data; }
+    size_t Size() const { return m_size; }
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+/**
+ * @brief The most recent history of one room, kept on disk between sessions.
+ *
+ * The file is a contiguous run of messages in timestamp order, there are never gaps in
+ * it: messages are only added right after the newest or right before the oldest one.
+ * It is memory-mapped and only record headers are read when it's opened, messages are
+ * decoded when a page of them is asked for. New messages are appended, anything else
+ * (prepending older pages, deletions, renames, trimming) rewrites the file.
+ *
+ * Not thread-safe, the client only uses it from its network loop.
+ */
+class MessageStore {
+public:
+    // The file of a room, under the history directory of a server and account.
+    static std::filesystem::path PathFor(const std::filesystem::path& dataDir, const std::string& server, int32_t userId, int32_t roomId);
+
+    explicit MessageStore(std::filesystem::path path);
+
+    bool Empty() const { return m_index.empty(); }
+    size_t Size() const { return m_index.size(); }
+    int64_t OldestTimestamp() const { return m_index.front().timestamp; }
+    int64_t NewestTimestamp() const { return m_index.back().timestamp; }
+    // The seq of the newest message, 0 when the server did not number it.
+    int64_t NewestSeq() const { return m_index.back().seq; }
+
+    // Up to limit messages older than before, newest first, like a GetMessages page.
+    std::vector<Message> Older(int64_t before, size_t limit) const;
+    // Up to limit messages newer than after, oldest first.
+    std::vector<Message> Newer(int64_t after, size_t limit) const;
+
+    // Adds the messages newer than NewestTimestamp(), given oldest first.
+    void Append(const std::vector<Message>& messages);
+    // Adds the messages older than OldestTimestamp(), given oldest first, as far as MAX_MESSAGES allows.
+    void Prepend(const std::vector<Message>& messages);
+    // Adds the messages not stored yet, given oldest first: in their place among the stored ones,
+    // for one that committed after newer messages, or after NewestTimestamp(). Older ones are left out.
+    // Returns the messages added, oldest first.
+    std::vector<Message> Merge(const std::vector<Message>& messages);
+    // Replaces everything, the messages given oldest first.
+    void Reset(const std::vector<Message>& messages);
+    void Erase(const std::vector<int32_t>& messageIds);
+    void Rename(int32_t userId, const std::string& username);
+    void Clear();
+
+    static const size_t MAX_MESSAGES = 2000;
+
+private:
+    struct Entry {
+        size_t offset; // Of the record in the file.
+        size_t size;   // Of the whole record.
+        int64_t timestamp;
+        int64_t seq;
+        int32_t messageId;
+        int32_t userId;
+    };
+
+    // Maps the file and indexes its records, dropping a torn or out of order tail.
+    void Load();
+    Message Decode(const Entry& entry) const;
+    static void Encode(std::string& out, const Message& message);
+    // Writes a new file with the given records and reloads it.
+    void Rewrite(const std::string& records);
+    std::string RecordBytes(size_t first, size_t last) const;
+
+    std::filesystem::path m_path;
+    MappedFile m_file;
+    std::vector<Entry> m_index;
+};
+
+} // namespace client::core
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <common/proto/chat.pb.h>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace client::core {
+
+// What the client core knows of the chat, as decoded from the protocol. Text is UTF-8,
+// the toolkits convert it to their own strings when they show it.
+
+struct Message {
+    std::string user;
+    int32_t userId = 0;
+    std::string text;
+    int64_t timestamp = 0;
+    int32_t messageId = 0;
+    int64_t seq = 0; // Number of the message in its room, 0 when unknown.
+    std::string clientKey; // Of a live message sent by this client, see ChatSession::sendMessage().
+};
+
+struct User {
+    int32_t id = 0;
+    std::string name;
+    chat::UserRights role = chat::UserRights::REGULAR;
+};
+
+struct Room {
+    int32_t id = 0;
+    std::string name;
+    bool member = false;
+    int64_t unread = 0;
+};
+
+// A listed server with what was measured of it, see ChatSession's ranking.
+struct ServerEntry {
+    std::string host;
+    std::optional<double> rttMs{};
+    std::optional<float> load{};
+    bool available = true;
+};
+
+} // namespace client::core
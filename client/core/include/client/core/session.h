@@ -0,0 +1,314 @@
+#pragma once
+
+#include <client/core/model.h>
+#include <drogon/WebSocketClient.h>
+#include <drogon/HttpClient.h>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+namespace client::core {
+
+class MessageStore;
+
+/**
+ * @brief What a ChatSession reports to the UI toolkit on top of it.
+ *
+ * Everything is called on the network loop, the implementation hands it over to its UI
+ * thread. Every event is already decoded and in order, the toolkit only shows it.
+ */
+class SessionListener {
+public:
+    virtual ~SessionListener() = default;
+
+    virtual void onError(const std::string& message) = 0;
+    virtual void onInfo(const std::string& message) = 0;
+
+    // The screen to show, the session moved to a state where it needs the user.
+    virtual void onShowInitial() = 0;
+    virtual void onShowServers() = 0;
+    virtual void onShowAuth() = 0;
+    virtual void onShowRooms() = 0;
+
+    // The server took the user name, the password step follows.
+    virtual void onRegisterContinue() = 0;
+    // The salt to derive the key from, empty for an account without one yet.
+    virtual void onAuthContinue(const std::string& salt) = 0;
+    virtual void onLoggedIn(const User& self) = 0;
+    // The salt for a password change, nullopt when the server did not give it.
+    virtual void onMySalt(const std::optional<std::string>& salt) = 0;
+
+    virtual void onRooms(std::vector<Room> rooms) = 0;
+    virtual void onRoomAdded(const Room& room) = 0;
+    virtual void onRoomRenamed(int32_t roomId, const std::string& name) = 0;
+    virtual void onRoomRemoved(int32_t roomId) = 0;
+    // A room is being rejoined after a reconnect, the UI selects it before it is shown.
+    virtual void onRestoringRoom(int32_t roomId) = 0;
+    virtual void onBecameMember() = 0;
+
+    // Joined a room: the joining user, those of the members online, and how many members there are.
+    // The other members come page by page from ChatSession::getRoomMembers().
+    virtual void onJoinedRoom(int32_t roomId, std::vector<User> members, std::vector<User> online, uint32_t memberCount) = 0;
+    // A page of the members of the joined room, highest rights first. `more` when another page follows.
+    virtual void onRoomMembers(int32_t roomId, std::vector<User> members, bool more) = 0;
+    virtual void onUserJoined(const User& user) = 0;
+    virtual void onUserLeft(const User& user) = 0;
+    virtual void onPresence(int32_t roomId, std::vector<User> newMembers, std::vector<User> joined, std::vector<User> left) = 0;
+    virtual void onUserRoleChanged(int32_t userId, chat::UserRights role) = 0;
+    virtual void onUsernameChanged(int32_t userId, const std::string& username) = 0;
+    virtual void onTyping(const User& user, bool started) = 0;
+    virtual void onTypingUsers(int32_t roomId, std::vector<User> users) = 0;
+
+    /**
+     * Messages of the joined room. Live ones come oldest first, at most once per frame.
+     * A history page is the answer to ChatSession::getMessages(), newest first for older
+     * pages and oldest first for newer ones.
+     */
+    virtual void onMessages(std::vector<Message> messages, bool history) = 0;
+    virtual void onMessagesDeleted(const std::vector<int32_t>& messageIds) = 0;
+    // The server took a message sent with ChatSession::sendMessage(), with the id, timestamp and
+    // seq it got. Its broadcast may come before or after this, with the same key.
+    virtual void onMessageSent(const std::string& key, const Message& message) = 0;
+    // The server refused a message, it will not be broadcast.
+    virtual void onMessageFailed(const std::string& key, const std::string& error) = 0;
+    // The answer to ChatSession::getMessagesAround(), oldest first, without the message if it was
+    // deleted. Whether the room has messages before and after them. Empty when it was not found.
+    virtual void onMessagesAround(int32_t messageId, std::vector<Message> messages, bool hasOlder, bool hasNewer) = 0;
+    // The history shown is stale, the view starts over from the newest page.
+    virtual void onHistoryReset() = 0;
+
+    // The servers listed by the aggregator, best first.
+    virtual void onServers(std::vector<ServerEntry> servers) = 0;
+    // The server is going away, the UI starts the session on the given one.
+    virtual void onMoveToServer(const std::string& host) = 0;
+};
+
+/**
+ * @brief The protocol side of the client, shared by the wx and Qt clients.
+ *
+ * Holds the connection and everything the protocol keeps across envelopes: reconnection
+ * with session resumption, the chunks of large responses, the presence of the joined
+ * room, the local history of it (see MessageStore) and its read cursor, batching of live
+ * messages, and the server list with its probing and ranking. It runs on drogon's main
+ * loop; the requests may be made from any thread.
+ */
+class ChatSession {
+public:
+    ChatSession(SessionListener& listener, std::filesystem::path historyDir);
+    virtual ~ChatSession();
+
+    void start(const std::string& address);
+    void stop();
+    // Address passed to the last start().
+    const std::string& server() const { return currentServer; }
+
+    void requestInitialRegister(const std::string& username);
+    void requestInitialAuth(const std::string& username);
+    void completeRegister(const std::string& hash, const std::string& salt);
+    void completeAuth(const std::string& hash, const std::optional<std::string>& password, const std::optional<std::string>& salt);
+    void createRoom(const std::string& roomName);
+    void joinRoom(int32_t room_id);
+    void leaveRoom();
+    // Returns the key the message is sent with, which its onMessageSent/onMessageFailed and broadcast carry.
+    std::string sendMessage(const std::string& message);
+    // A page of history: limit messages older than offset_ts, or -limit newer ones.
+    void getMessages(int32_t limit, int64_t offset_ts);
+    // The messages around one of the joined room, for jumping to it, see SessionListener::onMessagesAround().
+    void getMessagesAround(int32_t messageId, int32_t before, int32_t after);
+    void logout();
+    void getServers();
+    void subscribeServers();
+    void renameRoom(int32_t roomId, const std::string& newName);
+    void deleteRoom(int32_t roomId);
+    void assignRole(int32_t roomId, int32_t userId, chat::UserRights role);
+    // A page of the members of the joined room after `after`, the last member of the previous page.
+    void getRoomMembers(int32_t roomId, const std::string& prefix, const std::optional<User>& after, uint32_t limit = 0);
+    void deleteMessage(int32_t messageId);
+    void deleteUserMessages(int32_t userId, int32_t count);
+    void sendTypingStart();
+    void sendTypingStop();
+    void becomeMember(int32_t roomId);
+    void changeUsername(const std::string& username);
+    void requestMySalt();
+    void changePassword(const std::string& old_hash, const std::string& new_hash, const std::string& new_salt);
+
+private:
+    // Opens a connection to loopServer, on the network loop.
+    void connect();
+    // Connects again after a jittered, exponentially growing delay, unless already armed.
+    void scheduleReconnect();
+    // Queues a request for the end of this pass of the network loop, see flushOutbound().
+    void sendEnvelope(chat::Envelope env);
+    void queueEnvelope(chat::Envelope env);
+    // Sends the queued requests, adjacent ones that may share a frame as one BatchRequest.
+    void flushOutbound();
+    // Drops the requests not sent yet, with the typing state sent on the connection.
+    void clearOutbound();
+    struct UnackedSend {
+        std::string key;
+        int32_t roomId = 0;
+        std::string text;
+    };
+    void sendUnacked(const UnackedSend& send);
+    // Sends the unanswered messages of the room just joined again, and forgets those of the other rooms.
+    void resendUnacked(int32_t roomId);
+    void handleMessage(const std::string& msg);
+    void handleEnvelope(chat::Envelope env);
+    // rooms are only the unread counts when roomsUnchanged, the rest comes from roomLists.
+    void handleLogin(const chat::UserInfo& authenticated,
+                     const google::protobuf::RepeatedPtrField<chat::RoomInfo>& rooms,
+                     const std::string& resumeToken, uint64_t roomsHash, bool roomsUnchanged);
+
+    static User toUser(const chat::UserInfo& info);
+    static Message toMessage(const chat::MessageInfo& mi);
+    void showRoomMessage(const chat::MessageInfo& mi);
+    void flushRoomMessages();
+    void showMessageHistory(std::vector<Message> messages);
+    void setServers();
+    // Measures the round trip to every listed server not measured lately, then ranks them again.
+    void probeServers();
+    void probeRound(std::string host, drogon::HttpClientPtr http, int round, std::optional<double> best);
+    void rankServers();
+    // The names of the joined room's users, which live events refer to by id, see SetCompressionRequest.user_refs.
+    void rememberUser(const chat::UserInfo& user);
+    // Fills in the name of a user referred to by id. False when it is not known.
+    bool resolveUser(chat::UserInfo& user) const;
+    void handlePresenceDelta(chat::RoomPresenceDelta delta);
+    void applyPresenceDelta(chat::RoomPresenceDelta& delta);
+    void applyServerListDiff(const chat::ServerListDiff& diff, bool replace);
+    // Long polls the aggregator's GET /servers while `generation` is current. The first request
+    // does not wait, and falls back to the WebSocket subscription when it fails.
+    void pollServers(uint64_t generation, bool first);
+
+    // Local history of the joined room, see MessageStore.
+    enum class HistorySync { None, Initial, CatchUp };
+    struct HistoryRequest {
+        int32_t limit = 0;
+        int64_t offsetTs = 0;
+        HistorySync sync = HistorySync::None;
+    };
+    // Moves the read cursor of the joined room to the newest message shown, see MarkRoomReadRequest.
+    void noteSeen(const std::vector<Message>& messages);
+    void sendMarkRead();
+    void openStore(int32_t roomId);
+    void closeStore();
+    void requestHistory(int32_t limit, int64_t offsetTs);
+    void sendHistoryRequest(int32_t limit, int64_t offsetTs, HistorySync sync);
+    void handleHistoryResponse(const chat::GetMessagesResponse& response);
+    // Unpacks a PackedMessages page in place, failing its status when it is malformed.
+    static void unpackPage(chat::GetMessagesResponse& response);
+    static void unpackPage(chat::GetMessagesAroundResponse& response);
+    // Stores the page that came with JoinRoomResponse, so the view's first request is served from it.
+    void applyJoinHistory(chat::GetMessagesResponse& response);
+    // Drops the chunks of a response that will not come anymore.
+    void clearChunks();
+    void sendSyncRequest(int64_t sinceCursor);
+    void handleSyncResponse(const chat::SyncRoomResponse& response);
+
+    SessionListener& listener;
+    std::shared_ptr<drogon::WebSocketConnection> conn;
+    drogon::WebSocketClientPtr client;
+    std::string currentServer;
+    // Whether the server's hello offered packed history pages.
+    bool packedHistory = false;
+    // The most requests the server's hello lets one BatchRequest carry, 0 to send them one by one.
+    uint32_t maxBatch = 0;
+
+    // Requests made during this pass of the network loop, only touched from it. A typing state
+    // replaces the one still queued and is dropped when the server already has it, a history
+    // page queued already is not asked for twice.
+    std::vector<chat::Envelope> outbound;
+    bool outboundScheduled = false;
+    bool typingSent = false;
+
+    // Presence state of the joined room, only touched from handleMessage.
+    int32_t presenceRoomId = 0;
+    uint64_t presenceSeq = 0;
+    bool presenceSynced = false;
+    // Deltas received before the roster they apply to.
+    std::vector<chat::RoomPresenceDelta> earlyPresence;
+    // Messages from users not known yet, received before the roster that names them.
+    std::vector<chat::MessageInfo> earlyMessages;
+    // User ID to name of everyone the joined room's roster, deltas and member pages named.
+    std::unordered_map<int32_t, std::string> roomUserNames;
+
+    // Messages sent and not answered yet, only touched from the network loop. Those of the room
+    // joined again after a reconnect are sent again with their key, which the server answers
+    // with the original instead of sending a message twice.
+    std::vector<UnackedSend> unackedSends;
+
+    // Room messages waiting for the next frame, only touched from handleMessage.
+    std::vector<Message> pendingMessages;
+    bool flushScheduled = false;
+
+    // Message history kept on disk, only touched from the network loop. A store is synced
+    // once its newest message is known to be followed directly by the live ones, until then
+    // live messages are held back and stored with the response that syncs it.
+    std::filesystem::path historyDir;
+    int32_t loopUserId = 0;
+    std::unique_ptr<MessageStore> store;
+    int32_t storeRoomId = 0;
+    bool storeSynced = false;
+    // The seq the next sync of the store starts from, as the last one answered, 0 for its newest
+    // message. It may stay below that while a message before it can still commit.
+    int64_t storeSeqCursor = 0;
+    HistorySync syncing = HistorySync::None;
+    std::vector<Message> heldMessages;
+    // GetMessages requests awaiting their response, the server answers a connection in order.
+    std::deque<HistoryRequest> historyRequests;
+    // The chunks received of the large response being sent, see MessagesChunk and RoomListChunk.
+    google::protobuf::RepeatedPtrField<chat::MessageInfo> messageChunks;
+    google::protobuf::RepeatedPtrField<chat::RoomInfo> roomChunks;
+    // Newest seq shown in the joined room and the one its read cursor was last moved to.
+    int64_t seenSeq = 0;
+    int64_t markedSeq = 0;
+    bool markReadArmed = false;
+
+    // Reconnection after a lost connection, only touched from the network loop. The
+    // connection is re-established with the session token, and the room we were in is
+    // joined again, its history catching up from the local store.
+    bool autoReconnect = false;
+    bool reconnectArmed = false;
+    // The wait a busy server asked for before the next reconnect, see ServerBusy.
+    double retryAfterSeconds = 0;
+    uint32_t reconnectAttempt = 0;
+    int32_t restoreRoomId = 0;
+    std::minstd_rand reconnectRng{std::random_device{}()};
+
+    // Resumption token of the last login per server address, only touched from handleMessage.
+    std::string loopServer;
+    std::unordered_map<std::string, std::string> resumeTokens;
+    // The room list of the last login per server address, sent back by its hash so an unchanged one is not.
+    struct CachedRoomList {
+        uint64_t hash = 0;
+        std::vector<Room> rooms;
+    };
+    std::unordered_map<std::string, CachedRoomList> roomLists;
+
+    // Server list from the aggregator, kept across reconnects to subscribe incrementally.
+    std::vector<std::string> servers;
+    std::optional<uint64_t> serverListEpoch;
+    uint64_t serverListVersion = 0;
+    // The server list over HTTP instead, and the entity tag of the last list received.
+    drogon::HttpClientPtr serverListHttp;
+    std::string serverListEtag;
+    uint64_t serverPollGeneration = 0;
+
+    // What is known of each listed server to rank them, only touched from the network loop.
+    struct ServerProbe {
+        std::optional<double> rttMs;
+        std::optional<float> load;
+        bool available = true;
+        bool inFlight = false;
+        std::optional<std::chrono::steady_clock::time_point> measuredAt;
+    };
+    std::unordered_map<std::string, ServerProbe> serverProbes;
+    size_t probesInFlight = 0;
+};
+
+} // namespace client::core
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace client::core {
+
+// Formats a message timestamp in microseconds for display: the time alone for today, the
+// day and month within this year, the full date otherwise. Callable from any thread.
+std::string formatMessageTimestamp(int64_t timestamp);
+
+} // namespace client::core
@@ -0,0 +1,377 @@
+#include <client/core/messageStore.h>
+
+#include <drogon/utils/Utilities.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <system_error>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace client::core {
+
+// Identifies the format, bumped when the records change.
+static const char MAGIC[8] = {'S', 'P', 'C', 'H', 'I', 'S', 'T', '2'};
+
+// Fixed part of a record, followed by the UTF-8 user name and message text.
+struct RecordHeader {
+    int64_t timestamp;
+    int64_t seq;
+    int32_t messageId;
+    int32_t userId;
+    uint32_t userBytes;
+    uint32_t textBytes;
+};
+
+bool MappedFile::Map(const std::filesystem::path& path) {
+    Unmap();
+#if defined(_WIN32)
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return size.QuadPart == 0;
+    }
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if(!mapping) {
+        return false;
+    }
+    // The view keeps the mapping alive.
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if(!view) {
+        return false;
+    }
+    m_data = static_cast<const char*>(view);
+    m_size = static_cast<size_t>(size.QuadPart);
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+    // An empty file cannot be mapped, it is an empty history.
+    if(st.st_size == 0) {
+        ::close(fd);
+        return true;
+    }
+    void* view = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(view == MAP_FAILED) {
+        return false;
+    }
+    m_data = static_cast<const char*>(view);
+    m_size = static_cast<size_t>(st.st_size);
+#endif
+    return true;
+}
+
+void MappedFile::Unmap() {
+    if(!m_data) {
+        return;
+    }
+#if defined(_WIN32)
+    UnmapViewOfFile(m_data);
+#else
+    munmap(const_cast<char*>(m_data), m_size);
+#endif
+    m_data = nullptr;
+    m_size = 0;
+}
+
+std::filesystem::path MessageStore::PathFor(const std::filesystem::path& dataDir, const std::string& server, int32_t userId, int32_t roomId) {
+    // Per account too, another account on the same server may not see the same rooms.
+    const std::string key = drogon::utils::getSha256(server + '\n' + std::to_string(userId)).substr(0, 16);
+    return dataDir / "history" / key / (std::to_string(roomId) + ".msgs");
+}
+
+MessageStore::MessageStore(std::filesystem::path path) : m_path(std::move(path)) {
+    std::error_code ec;
+    std::filesystem::create_directories(m_path.parent_path(), ec);
+    Load();
+}
+
+void MessageStore::Load() {
+    m_index.clear();
+    if(std::error_code ec; !std::filesystem::exists(m_path, ec) || !m_file.Map(m_path)) {
+        m_file.Unmap();
+        return;
+    }
+    const char* data = m_file.Data();
+    const size_t size = m_file.Size();
+    if(size < sizeof(MAGIC) || std::memcmp(data, MAGIC, sizeof(MAGIC)) != 0) {
+        LOG_WARN << "Discarding unreadable message history " << m_path.string();
+        Rewrite({});
+        return;
+    }
+
+    size_t offset = sizeof(MAGIC);
+    while(offset + sizeof(RecordHeader) <= size) {
+        RecordHeader header;
+        std::memcpy(&header, data + offset, sizeof(header));
+        const size_t recordSize = sizeof(header) + header.userBytes + header.textBytes;
+        if(recordSize > size - offset || (!m_index.empty() && header.timestamp <= m_index.back().timestamp)) {
+            break;
+        }
+        m_index.push_back(Entry{offset, recordSize, header.timestamp, header.seq, header.messageId, header.userId});
+        offset += recordSize;
+    }
+    if(offset != size) {
+        // An append cut short, everything before it is still valid.
+        LOG_WARN << "Dropping the torn tail of message history " << m_path.string();
+        Rewrite(RecordBytes(0, m_index.size()));
+    }
+}
+
+Message MessageStore::Decode(const Entry& entry) const {
+    const char* record = m_file.Data() + entry.offset;
+    RecordHeader header;
+    std::memcpy(&header, record, sizeof(header));
+    const char* user = record + sizeof(header);
+    const char* text = user + header.userBytes;
+    return Message{std::string(user, header.userBytes)
+        , header.userId
+        , std::string(text, header.textBytes)
+        , header.timestamp
+        , header.messageId
+        , header.seq};
+}
+
+void MessageStore::Encode(std::string& out, const Message& message) {
+    const RecordHeader header{message.timestamp, message.seq, message.messageId, message.userId,
+                              static_cast<uint32_t>(message.user.size()), static_cast<uint32_t>(message.text.size())};
+    out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    out += message.user;
+    out += message.text;
+}
+
+std::string MessageStore::RecordBytes(size_t first, size_t last) const {
+    if(first >= last) {
+        return {};
+    }
+    const size_t begin = m_index[first].offset;
+    const size_t end = m_index[last - 1].offset + m_index[last - 1].size;
+    return std::string(m_file.Data() + begin, end - begin);
+}
+
+void MessageStore::Rewrite(const std::string& records) {
+    // Nothing may map the file while it's replaced, Windows refuses to.
+    m_file.Unmap();
+    m_index.clear();
+
+    std::filesystem::path temp = m_path;
+    temp += ".tmp";
+    {
+        std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+        if(!file.write(MAGIC, sizeof(MAGIC)) || !file.write(records.data(), static_cast<std::streamsize>(records.size())) || !file.flush()) {
+            LOG_ERROR << "Failed to write message history " << temp.string();
+            return;
+        }
+    }
+    // Replaces the old file in one step, on Windows too.
+    std::error_code ec;
+    std::filesystem::rename(temp, m_path, ec);
+    if(ec) {
+        LOG_ERROR << "Failed to replace message history " << m_path.string() << ": " << ec.message();
+        std::filesystem::remove(temp, ec);
+    }
+    Load();
+}
+
+std::vector<Message> MessageStore::Older(int64_t before, size_t limit) const {
+    std::vector<Message> messages;
+    auto it = std::lower_bound(m_index.begin(), m_index.end(), before,
+                               [](const Entry& entry, int64_t ts) { return entry.timestamp < ts; });
+    while(it != m_index.begin() && messages.size() < limit) {
+        messages.push_back(Decode(*--it));
+    }
+    return messages;
+}
+
+std::vector<Message> MessageStore::Newer(int64_t after, size_t limit) const {
+    std::vector<Message> messages;
+    auto it = std::upper_bound(m_index.begin(), m_index.end(), after,
+                               [](int64_t ts, const Entry& entry) { return ts < entry.timestamp; });
+    for(; it != m_index.end() && messages.size() < limit; ++it) {
+        messages.push_back(Decode(*it));
+    }
+    return messages;
+}
+
+void MessageStore::Append(const std::vector<Message>& messages) {
+    std::string records;
+    int64_t newest = Empty() ? std::numeric_limits<int64_t>::min() : NewestTimestamp();
+    size_t count = 0;
+    for(const auto& message : messages) {
+        if(message.timestamp > newest) {
+            Encode(records, message);
+            newest = message.timestamp;
+            ++count;
+        }
+    }
+    if(records.empty()) {
+        return;
+    }
+
+    if(Size() + count > 2 * MAX_MESSAGES) {
+        // Trimmed in batches, a rewrite per message would cost far more than the space.
+        const size_t keep = std::min(Size(), MAX_MESSAGES > count ? MAX_MESSAGES - count : 0);
+        Rewrite(RecordBytes(Size() - keep, Size()) + records);
+        return;
+    }
+
+    std::error_code ec;
+    const bool existed = std::filesystem::exists(m_path, ec) && m_file.Data();
+    m_file.Unmap();
+    {
+        std::ofstream file(m_path, std::ios::binary | (existed ? std::ios::app : std::ios::trunc));
+        if(!file) {
+            LOG_ERROR << "Failed to open message history " << m_path.string();
+            Load();
+            return;
+        }
+        if(!existed) {
+            file.write(MAGIC, sizeof(MAGIC));
+        }
+        // A short write leaves a torn record, which the next Load() drops.
+        file.write(records.data(), static_cast<std::streamsize>(records.size()));
+    }
+    Load();
+}
+
+void MessageStore::Prepend(const std::vector<Message>& messages) {
+    if(Size() >= MAX_MESSAGES) {
+        return;
+    }
+    // The newest of the older messages are the ones adjacent to the store.
+    std::vector<const Message*> older;
+    for(auto it = messages.rbegin(); it != messages.rend() && Size() + older.size() < MAX_MESSAGES; ++it) {
+        const int64_t limit = older.empty() ? (Empty() ? std::numeric_limits<int64_t>::max() : OldestTimestamp()) : older.back()->timestamp;
+        if(it->timestamp < limit) {
+            older.push_back(&*it);
+        }
+    }
+    if(older.empty()) {
+        return;
+    }
+    std::string records;
+    for(auto it = older.rbegin(); it != older.rend(); ++it) {
+        Encode(records, **it);
+    }
+    Rewrite(records + RecordBytes(0, Size()));
+}
+
+std::vector<Message> MessageStore::Merge(const std::vector<Message>& messages) {
+    // Given in seq order, a message that committed late has an earlier timestamp than the one before it.
+    std::vector<Message> sorted = messages;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Message& a, const Message& b) { return a.timestamp < b.timestamp; });
+
+    std::vector<Message> added;
+    std::string records;
+    size_t next = 0;
+    if(!Empty()) {
+        records.reserve(m_file.Size());
+        for(size_t i = 0; i < Size(); ++i) {
+            for(; next < sorted.size() && sorted[next].timestamp <= m_index[i].timestamp; ++next) {
+                const auto& message = sorted[next];
+                // Before the oldest there may be a gap, on a stored timestamp there is a message already.
+                if(i > 0 && message.timestamp < m_index[i].timestamp
+                   && std::none_of(m_index.begin(), m_index.end(), [&message](const Entry& entry) { return entry.messageId == message.messageId; })) {
+                    added.push_back(message);
+                    Encode(records, message);
+                }
+            }
+            records += RecordBytes(i, i + 1);
+        }
+    }
+    if(!added.empty()) {
+        Rewrite(records);
+    }
+    const std::vector<Message> newer(sorted.begin() + static_cast<std::ptrdiff_t>(next), sorted.end());
+    int64_t newest = Empty() ? std::numeric_limits<int64_t>::min() : NewestTimestamp();
+    for(const auto& message : newer) {
+        if(message.timestamp > newest) {
+            added.push_back(message);
+            newest = message.timestamp;
+        }
+    }
+    Append(newer);
+    return added;
+}
+
+void MessageStore::Reset(const std::vector<Message>& messages) {
+    std::string records;
+    int64_t newest = std::numeric_limits<int64_t>::min();
+    const size_t skip = messages.size() > MAX_MESSAGES ? messages.size() - MAX_MESSAGES : 0;
+    for(size_t i = skip; i < messages.size(); ++i) {
+        if(messages[i].timestamp > newest) {
+            Encode(records, messages[i]);
+            newest = messages[i].timestamp;
+        }
+    }
+    Rewrite(records);
+}
+
+void MessageStore::Erase(const std::vector<int32_t>& messageIds) {
+    const auto erased = [&messageIds](const Entry& entry) {
+        return std::find(messageIds.begin(), messageIds.end(), entry.messageId) != messageIds.end();
+    };
+    if(std::none_of(m_index.begin(), m_index.end(), erased)) {
+        return;
+    }
+    std::string records;
+    records.reserve(m_file.Size());
+    for(size_t i = 0; i < Size(); ++i) {
+        if(!erased(m_index[i])) {
+            records += RecordBytes(i, i + 1);
+        }
+    }
+    Rewrite(records);
+}
+
+void MessageStore::Rename(int32_t userId, const std::string& username) {
+    if(std::none_of(m_index.begin(), m_index.end(), [userId](const Entry& entry) { return entry.userId == userId; })) {
+        return;
+    }
+    std::string records;
+    records.reserve(m_file.Size());
+    for(size_t i = 0; i < Size(); ++i) {
+        if(m_index[i].userId == userId) {
+            Message message = Decode(m_index[i]);
+            message.user = username;
+            Encode(records, message);
+        } else {
+            records += RecordBytes(i, i + 1);
+        }
+    }
+    Rewrite(records);
+}
+
+void MessageStore::Clear() {
+    m_file.Unmap();
+    m_index.clear();
+    std::error_code ec;
+    std::filesystem::remove(m_path, ec);
+}
+
+} // namespace client::core
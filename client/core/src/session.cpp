@@ -0,0 +1,1659 @@
+#include <client/core/session.h>
+#include <client/core/messageStore.h>
+#include <common/utils/utils.h>
+#include <common/utils/packed_messages.h>
+#include <common/version.h>
+#include <drogon/HttpRequest.h>
+#include <drogon/HttpAppFramework.h>
+#include <ada.h>
+#include <algorithm>
+
+namespace client::core {
+
+ChatSession::ChatSession(SessionListener& listener_, std::filesystem::path historyDir_)
+    : listener(listener_), historyDir(std::move(historyDir_)) {}
+
+ChatSession::~ChatSession() = default;
+
+// The server sends the leading items of a large response as chunks right before it.
+template <typename Item>
+static void appendChunk(google::protobuf::RepeatedPtrField<Item>& chunk, google::protobuf::RepeatedPtrField<Item>& received) {
+    for(auto& item : chunk) {
+        *received.Add() = std::move(item);
+    }
+}
+
+// Puts the chunks received so far in front of the items of the response that ends them.
+template <typename Item>
+static void prependChunks(google::protobuf::RepeatedPtrField<Item>& received, google::protobuf::RepeatedPtrField<Item>& items) {
+    if(received.empty()) {
+        return;
+    }
+    appendChunk(items, received);
+    items.Swap(&received);
+    received.Clear();
+}
+
+// The HTTP endpoints served next to a WebSocket address, its scheme and host.
+static std::optional<std::string> httpBase(const std::string& wsAddress) {
+    auto url = ada::parse<ada::url_aggregator>(wsAddress);
+    if(!url) {
+        return std::nullopt;
+    }
+    return std::string(url->get_protocol() == "wss:" ? "https://" : "http://") + std::string(url->get_host());
+}
+
+// Bounds of the delay before reconnecting, it doubles with every failed attempt.
+static constexpr double RECONNECT_MIN_SECONDS = 0.5;
+static constexpr double RECONNECT_MAX_SECONDS = 30;
+
+void ChatSession::stop() {
+    drogon::app().getLoop()->runInLoop([this]{
+        LOG_INFO << "ChatSession::stop()";
+        autoReconnect = false;
+        reconnectAttempt = 0;
+        restoreRoomId = 0;
+        pendingMessages.clear();
+        unackedSends.clear();
+        historyRequests.clear();
+        clearChunks();
+        closeStore();
+        // The read cursor closeStore() moved still goes out.
+        flushOutbound();
+        clearOutbound();
+        conn.reset();
+        client.reset();
+        ++serverPollGeneration;
+        serverListHttp.reset();
+    });
+}
+
+void ChatSession::start(const std::string& address) {
+    stop();
+    currentServer = address;
+
+    drogon::app().getLoop()->runInLoop([this, address]{
+        LOG_INFO << "ChatSession::start()";
+        loopServer = address;
+        autoReconnect = true;
+        connect();
+    });
+}
+
+void ChatSession::connect() {
+    auto result = ada::parse<ada::url_aggregator>(loopServer);
+
+    auto server = std::string(result->get_protocol()) + "//" + std::string(result->get_hostname());
+
+    auto port = result->get_port();
+    if (!port.empty()) {
+        server += std::string(":") + std::string(port);
+    }
+
+    client = drogon::WebSocketClient::newWebSocketClient(server);
+    auto req = drogon::HttpRequest::newHttpRequest();
+    req->setPath(std::string(result->get_pathname()));
+
+    client->setMessageHandler([this](const std::string& message,
+                                    const drogon::WebSocketClientPtr&,
+                                    const drogon::WebSocketMessageType& type) {
+        if(type == drogon::WebSocketMessageType::Binary) {
+            handleMessage(message);
+        }
+    });
+
+    // Callbacks of a client that was replaced since are ignored.
+    client->setConnectionClosedHandler([this](const drogon::WebSocketClientPtr& wsPtr) {
+        if(wsPtr != client || !autoReconnect) {
+            return;
+        }
+        LOG_WARN << "Connection to " << loopServer << " lost, reconnecting";
+        conn.reset();
+        historyRequests.clear();
+        clearChunks();
+        clearOutbound();
+        // Rejoined once logged in again, the history then syncs from the local store.
+        if(store) {
+            restoreRoomId = storeRoomId;
+        }
+        closeStore();
+        presenceSynced = false;
+        earlyPresence.clear();
+        earlyMessages.clear();
+        scheduleReconnect();
+    });
+
+    LOG_INFO << "Connecting to WebSocket at " << server;
+    client->connectToServer(
+        req,
+        [this](drogon::ReqResult r, const drogon::HttpResponsePtr&, const drogon::WebSocketClientPtr& wsPtr) {
+            if(wsPtr != client) {
+                return;
+            }
+            if(r != drogon::ReqResult::Ok) {
+                conn.reset();
+                // Only retried once we had a connection, a server that never answered is left to the user.
+                if(autoReconnect && reconnectAttempt > 0) {
+                    scheduleReconnect();
+                }
+                return;
+            }
+            conn = wsPtr->getConnection();
+            // Responses to requests of the previous connection will never come.
+            historyRequests.clear();
+            clearChunks();
+            clearOutbound();
+            maxBatch = 0;
+        }
+    );
+}
+
+void ChatSession::scheduleReconnect() {
+    if(reconnectArmed) {
+        return;
+    }
+    reconnectArmed = true;
+    // Jittered within [delay / 2, delay], so the clients of a server that went down do not all come back at once.
+    const double delay = std::min(RECONNECT_MAX_SECONDS, RECONNECT_MIN_SECONDS * static_cast<double>(1u << std::min(reconnectAttempt, 16u)));
+    // A server that turned us away asked for at least this long, already spread out by the server.
+    const double wait = std::max(std::uniform_real_distribution<double>(delay / 2, delay)(reconnectRng), retryAfterSeconds);
+    retryAfterSeconds = 0;
+    ++reconnectAttempt;
+    LOG_INFO << "Reconnecting to " << loopServer << " in " << static_cast<int>(wait * 1000) << " ms (attempt " << reconnectAttempt << ")";
+    drogon::app().getLoop()->runAfter(wait, [this] {
+        reconnectArmed = false;
+        if(autoReconnect) {
+            connect();
+        }
+    });
+}
+
+void ChatSession::requestInitialRegister(const std::string &username) {
+    chat::Envelope env;
+    env.mutable_initial_register_request()->set_username(username);
+    sendEnvelope(env);
+}
+
+void ChatSession::requestInitialAuth(const std::string &username) {
+    chat::Envelope env;
+    env.mutable_initial_auth_request()->set_username(username);
+    sendEnvelope(env);
+}
+
+void ChatSession::completeRegister(const std::string &hash, const std::string& salt) {
+    chat::Envelope env;
+    auto* req = env.mutable_register_request();
+    req->set_hash(hash);
+    req->set_salt(salt);
+    sendEnvelope(env);
+}
+
+void ChatSession::completeAuth(const std::string& hash, const std::optional<std::string>& password, const std::optional<std::string>& salt) {
+    chat::Envelope env;
+    auto* req = env.mutable_auth_request();
+    req->set_hash(hash);
+    if (password) req->set_password(*password);
+    if (salt) req->set_salt(*salt);
+    // On the loop, where the cached room lists are kept.
+    drogon::app().getLoop()->runInLoop([this, env = std::move(env)]() mutable {
+        if(auto it = roomLists.find(loopServer); it != roomLists.end()) {
+            env.mutable_auth_request()->set_rooms_hash(it->second.hash);
+        }
+        sendEnvelope(env);
+    });
+}
+
+void ChatSession::createRoom(const std::string& roomName) {
+    chat::Envelope env;
+    env.mutable_create_room_request()->set_room_name(roomName);
+    sendEnvelope(env);
+}
+
+// The newest page of a room nothing is stored of, asked for with the join.
+static constexpr int32_t JOIN_HISTORY_LIMIT = 25;
+
+void ChatSession::joinRoom(int32_t room_id) {
+    drogon::app().getLoop()->runInLoop([this, room_id] {
+        chat::Envelope env;
+        auto* request = env.mutable_join_room_request();
+        request->set_room_id(room_id);
+        // The member list pages through the rest, see getRoomMembers().
+        request->set_members_on_demand(true);
+        // A stored room starts from the store and syncs, any other one with the newest page.
+        std::error_code ec;
+        if(!std::filesystem::exists(MessageStore::PathFor(historyDir, loopServer, loopUserId, room_id), ec)) {
+            auto* history = request->mutable_history();
+            history->set_limit(JOIN_HISTORY_LIMIT);
+            history->set_offset_ts(std::numeric_limits<int64_t>::max());
+            history->set_packed(packedHistory);
+        }
+        sendEnvelope(env);
+    });
+}
+
+void ChatSession::leaveRoom() {
+    chat::Envelope env;
+    env.mutable_leave_room_request();
+    sendEnvelope(env);
+}
+
+std::string ChatSession::sendMessage(const std::string& message) {
+    auto key = drogon::utils::getUuid();
+    drogon::app().getLoop()->runInLoop([this, key, message] {
+        sendUnacked(unackedSends.emplace_back(UnackedSend{key, presenceRoomId, message}));
+    });
+    return key;
+}
+
+void ChatSession::sendUnacked(const UnackedSend& send) {
+    chat::Envelope env;
+    auto* req = env.mutable_send_message_request();
+    req->set_message(send.text);
+    req->set_client_key(send.key);
+    sendEnvelope(env);
+}
+
+void ChatSession::resendUnacked(int32_t roomId) {
+    std::erase_if(unackedSends, [roomId](const UnackedSend& send) { return send.roomId != roomId; });
+    for(const auto& send : unackedSends) {
+        sendUnacked(send);
+    }
+}
+
+// Requests of one pass of the loop that may go out in one BatchRequest. Those changing what
+// the connection is, and whose responses may come in chunks, are sent in a frame of their own:
+// the server only splits a response sent at the top level, a history page inside a batch
+// response would come in one frame however large.
+static bool batchable(const chat::Envelope& env) {
+    switch(env.payload_case()) {
+        case chat::Envelope::kGetMessagesRequest:
+        case chat::Envelope::kInitialRegisterRequest:
+        case chat::Envelope::kRegisterRequest:
+        case chat::Envelope::kInitialAuthRequest:
+        case chat::Envelope::kAuthRequest:
+        case chat::Envelope::kResumeSessionRequest:
+        case chat::Envelope::kSetCompressionRequest:
+        case chat::Envelope::kLogoutRequest:
+        case chat::Envelope::kBatchRequest:
+            return false;
+        default:
+            return true;
+    }
+}
+
+static bool isTyping(const chat::Envelope& env) {
+    return env.has_user_typing_start_request() || env.has_user_typing_stop_request();
+}
+
+// The server forgets the typing state of a user with the room.
+static bool leavesRoom(const chat::Envelope& env) {
+    return env.has_join_room_request() || env.has_leave_room_request();
+}
+
+// A slow request holds back the responses of those batched with it, so batches stay short.
+static constexpr uint32_t MAX_CLIENT_BATCH = 16;
+// Requests queued in one pass of the loop beyond this are refused, a typing state is dropped.
+static constexpr size_t MAX_OUTBOUND = 256;
+
+void ChatSession::sendEnvelope(chat::Envelope env) {
+    drogon::app().getLoop()->runInLoop([this, env = std::move(env)]() mutable { queueEnvelope(std::move(env)); });
+}
+
+void ChatSession::queueEnvelope(chat::Envelope env) {
+    if(!conn || !conn->connected()) {
+        listener.onError("Not connected to server!");
+        return;
+    }
+    const bool typing = isTyping(env);
+    if(typing) {
+        // Only the last state counts, and only when it differs from the one the server will have.
+        bool serverTyping = typingSent;
+        for(auto it = outbound.end(); it != outbound.begin();) {
+            --it;
+            if(leavesRoom(*it)) {
+                serverTyping = false;
+                break;
+            }
+            if(isTyping(*it)) {
+                it = outbound.erase(it);
+            }
+        }
+        if(env.has_user_typing_start_request() == serverTyping) {
+            return;
+        }
+    }
+    if(outbound.size() >= MAX_OUTBOUND) {
+        if(!typing) {
+            listener.onError("Too many requests waiting to be sent!");
+        }
+        return;
+    }
+    outbound.push_back(std::move(env));
+    if(!outboundScheduled) {
+        outboundScheduled = true;
+        // After whatever else runs in this pass, so the requests it makes share the frame.
+        drogon::app().getLoop()->queueInLoop([this] { flushOutbound(); });
+    }
+}
+
+void ChatSession::flushOutbound() {
+    outboundScheduled = false;
+    auto queued = std::move(outbound);
+    outbound.clear();
+    if(queued.empty()) {
+        return;
+    }
+    if(!conn || !conn->connected()) {
+        listener.onError("Not connected to server!");
+        return;
+    }
+    const auto send = [this](const chat::Envelope& env) {
+        std::string out;
+        if(env.SerializeToString(&out)) {
+            conn->send(out, drogon::WebSocketMessageType::Binary);
+        } else {
+            listener.onError("Failed to serialize message!");
+        }
+    };
+    for(const auto& env : queued) {
+        if(isTyping(env)) {
+            typingSent = env.has_user_typing_start_request();
+        } else if(leavesRoom(env)) {
+            typingSent = false;
+        }
+    }
+    const size_t limit = std::min(maxBatch, MAX_CLIENT_BATCH);
+    for(size_t i = 0; i < queued.size();) {
+        size_t end = i + 1;
+        while(limit > 1 && batchable(queued[i]) && end < queued.size() && end - i < limit && batchable(queued[end])) {
+            ++end;
+        }
+        if(end - i == 1) {
+            send(queued[i++]);
+            continue;
+        }
+        // Answered by one BatchResponse, its responses in the order of the requests.
+        chat::Envelope batch;
+        auto* requests = batch.mutable_batch_request()->mutable_requests();
+        for(; i < end; ++i) {
+            *requests->Add() = std::move(queued[i]);
+        }
+        send(batch);
+    }
+}
+
+void ChatSession::clearOutbound() {
+    outbound.clear();
+    typingSent = false;
+}
+
+void ChatSession::getMessages(int32_t limit, int64_t offset_ts) {
+    drogon::app().getLoop()->runInLoop([this, limit, offset_ts] { requestHistory(limit, offset_ts); });
+}
+
+// Always from the server: the local history only holds the newest stretch of the room, and
+// a window around an older message is not stored, it would leave a gap in it.
+void ChatSession::getMessagesAround(int32_t messageId, int32_t before, int32_t after) {
+    drogon::app().getLoop()->runInLoop([this, messageId, before, after] {
+        chat::Envelope env;
+        auto* request = env.mutable_get_messages_around_request();
+        request->set_message_id(messageId);
+        request->set_before(before);
+        request->set_after(after);
+        request->set_packed(packedHistory);
+        sendEnvelope(env);
+    });
+}
+
+void ChatSession::logout() {
+    drogon::app().getLoop()->runInLoop([this] { resumeTokens.erase(loopServer); });
+    chat::Envelope env;
+    env.mutable_logout_request();
+    sendEnvelope(env);
+}
+
+void ChatSession::getServers() {
+    chat::Envelope env;
+    // Least loaded first, so picking the top entry spreads new clients over the cluster.
+    env.mutable_get_servers_request()->set_ranked(true);
+    sendEnvelope(env);
+}
+
+void ChatSession::subscribeServers() {
+    chat::Envelope env;
+    auto* request = env.mutable_subscribe_servers_request();
+    if(serverListEpoch) {
+        request->set_epoch(*serverListEpoch);
+        request->set_version(serverListVersion);
+    }
+    sendEnvelope(env);
+}
+
+void ChatSession::renameRoom(int32_t roomId, const std::string& newName) {
+    chat::Envelope env;
+    auto* request = env.mutable_rename_room_request();
+    request->set_room_id(roomId);
+    request->set_name(newName);
+    sendEnvelope(env);
+}
+
+void ChatSession::deleteRoom(int32_t roomId) {
+    chat::Envelope env;
+    auto* request = env.mutable_delete_room_request();
+    request->set_room_id(roomId);
+    sendEnvelope(env);
+}
+
+void ChatSession::assignRole(int32_t roomId, int32_t userId, chat::UserRights role) {
+    chat::Envelope env;
+    auto* req = env.mutable_assign_role_request();
+    req->set_room_id(roomId);
+    req->set_user_id(userId);
+    req->set_new_role(role);
+    sendEnvelope(env);
+}
+
+void ChatSession::getRoomMembers(int32_t roomId, const std::string& prefix, const std::optional<User>& after, uint32_t limit) {
+    chat::Envelope env;
+    auto* req = env.mutable_get_room_members_request();
+    req->set_room_id(roomId);
+    req->set_prefix(prefix);
+    if (after) {
+        auto* last = req->mutable_after();
+        last->set_user_id(after->id);
+        last->set_user_name(after->name);
+        if (after->role != chat::UserRights::REGULAR) {
+            last->set_user_room_rights(after->role);
+        }
+    }
+    req->set_limit(limit);
+    sendEnvelope(env);
+}
+
+void ChatSession::deleteMessage(int32_t messageId) {
+    chat::Envelope env;
+    auto* request = env.mutable_delete_message_request();
+    request->set_message_id(messageId);
+    sendEnvelope(env);
+}
+
+void ChatSession::deleteUserMessages(int32_t userId, int32_t count) {
+    chat::Envelope env;
+    auto* request = env.mutable_delete_user_messages_request();
+    request->set_user_id(userId);
+    request->set_count(count);
+    sendEnvelope(env);
+}
+
+void ChatSession::sendTypingStart() {
+    chat::Envelope env;
+    env.mutable_user_typing_start_request();
+    sendEnvelope(env);
+}
+
+void ChatSession::sendTypingStop() {
+    chat::Envelope env;
+    env.mutable_user_typing_stop_request();
+    sendEnvelope(env);
+}
+
+void ChatSession::becomeMember(int32_t roomId) {
+    chat::Envelope env;
+    env.mutable_become_member_request()->set_room_id(roomId);
+    sendEnvelope(env);
+}
+
+void ChatSession::changeUsername(const std::string& username) {
+    chat::Envelope env;
+    auto* request = env.mutable_change_username_request();
+    request->set_new_username(username);
+    sendEnvelope(env);
+}
+
+void ChatSession::requestMySalt() {
+    chat::Envelope env;
+    env.mutable_get_my_salt_request();
+    sendEnvelope(env);
+}
+
+void ChatSession::changePassword(const std::string& old_hash, const std::string& new_hash, const std::string& new_salt) {
+    chat::Envelope env;
+    auto* request = env.mutable_change_password_request();
+    request->set_old_password_hash(old_hash);
+    request->set_new_password_hash(new_hash);
+    request->set_new_salt(new_salt);
+	sendEnvelope(env);
+}
+
+void ChatSession::handleMessage(const std::string& msg) {
+    chat::Envelope env;
+    if(!env.ParseFromString(msg)) {
+        listener.onError("Invalid protobuf message received!");
+        return;
+    }
+    if(env.has_compressed_envelope()) {
+        auto inner = common::decompressEnvelope(env.compressed_envelope());
+        if(!inner) {
+            listener.onError("Invalid compressed message received!");
+            return;
+        }
+        env = std::move(*inner);
+    }
+    handleEnvelope(std::move(env));
+}
+
+void ChatSession::handleEnvelope(chat::Envelope env) {
+    using SC = chat::StatusCode;
+    auto statusOk = [](const chat::Status& s) { return s.code() == SC::STATUS_SUCCESS; };
+
+    // Anything else goes to the UI after the messages received before it.
+    if(env.payload_case() != chat::Envelope::kRoomMessage && env.payload_case() != chat::Envelope::kBatchResponse) {
+        flushRoomMessages();
+    }
+
+    switch(env.payload_case()) {
+        case chat::Envelope::kServerHello: {
+            // The server took us, the backoff starts over next time.
+            reconnectAttempt = 0;
+            if(env.server_hello().protocol_version() != common::version::PROTOCOL_VERSION) {
+                listener.onError("Version mismatch, update your client");
+                listener.onShowInitial();
+            } else if(env.server_hello().type() == chat::ServerType::TYPE_AGGREGATOR) {
+                LOG_TRACE << "Aggregator, getting initial list of servers";
+                listener.onShowServers();
+                // Over HTTP when the aggregator serves it, the WebSocket is then closed.
+                if(auto base = httpBase(loopServer)) {
+                    serverListHttp = drogon::HttpClient::newHttpClient(*base, drogon::app().getLoop());
+                    pollServers(++serverPollGeneration, true);
+                } else {
+                    subscribeServers();
+                    getServers();
+                }
+            } else {
+                packedHistory = env.server_hello().packed_history();
+                maxBatch = env.server_hello().max_batch();
+                const auto& codecs = env.server_hello().compression();
+                const bool gzip = std::find(codecs.begin(), codecs.end(), chat::COMPRESSION_GZIP) != codecs.end();
+                if(gzip || env.server_hello().user_refs()) {
+                    chat::Envelope request;
+                    auto* compression = request.mutable_set_compression_request();
+                    compression->set_compression(gzip ? chat::COMPRESSION_GZIP : chat::COMPRESSION_NONE);
+                    compression->set_user_refs(env.server_hello().user_refs());
+                    sendEnvelope(request);
+                }
+                // A token from an earlier login on this server skips the salt round trip.
+                if(auto token = resumeTokens.extract(loopServer)) {
+                    chat::Envelope request;
+                    auto* resume = request.mutable_resume_session_request();
+                    resume->set_token(std::move(token.mapped()));
+                    resume->set_with_rooms(true);
+                    if(auto it = roomLists.find(loopServer); it != roomLists.end()) {
+                        resume->set_rooms_hash(it->second.hash);
+                    }
+                    sendEnvelope(request);
+                } else {
+                    listener.onShowAuth();
+                }
+            }
+            break;
+        }
+        case chat::Envelope::kRoomListChunk: {
+            appendChunk(*env.mutable_room_list_chunk()->mutable_rooms(), roomChunks);
+            break;
+        }
+        case chat::Envelope::kMessagesChunk: {
+            appendChunk(*env.mutable_messages_chunk()->mutable_message(), messageChunks);
+            break;
+        }
+        case chat::Envelope::kResumeSessionResponse: {
+            prependChunks(roomChunks, *env.mutable_resume_session_response()->mutable_rooms());
+            const auto& resp = env.resume_session_response();
+            if(statusOk(resp.status())) {
+                handleLogin(resp.authenticated_user(), resp.rooms(), resp.resume_token(), resp.rooms_hash(), resp.rooms_unchanged());
+            } else {
+                LOG_INFO << "Session not resumed: " << resp.status().message();
+                listener.onShowAuth();
+            }
+            break;
+        }
+        case chat::Envelope::kBatchResponse: {
+            if(!statusOk(env.batch_response().status())) {
+                listener.onError("Batch request failed: " + env.batch_response().status().message());
+                break;
+            }
+            for(auto& response : *env.mutable_batch_response()->mutable_responses()) {
+                handleEnvelope(std::move(response));
+            }
+            break;
+        }
+        case chat::Envelope::kSetCompressionResponse: {
+            if(!statusOk(env.set_compression_response().status())) {
+                LOG_WARN << "Server declined compression, responses stay uncompressed";
+            }
+            break;
+        }
+        case chat::Envelope::kRoomMessage: {
+            auto& message = *env.mutable_room_message()->mutable_message();
+            // Held until the join response names the sender, and the ones after it so the order stays.
+            if((!earlyMessages.empty() || !resolveUser(*message.mutable_from())) && !presenceSynced) {
+                earlyMessages.push_back(std::move(message));
+                break;
+            }
+            showRoomMessage(message);
+            break;
+        }
+        case chat::Envelope::kJoinRoomResponse: {
+            if (statusOk(env.join_room_response().status())) {
+                roomUserNames.clear();
+                std::vector<User> members;
+                members.reserve(env.join_room_response().all_users().size());
+                for (const auto& user : env.join_room_response().all_users()) {
+                    rememberUser(user);
+                    members.push_back(toUser(user));
+                }
+                std::vector<User> online;
+                online.reserve(env.join_room_response().active_users().size());
+                for (const auto& user : env.join_room_response().active_users()) {
+                    rememberUser(user);
+                    online.push_back(toUser(user));
+                }
+                listener.onJoinedRoom(env.join_room_response().room_id(), std::move(members), std::move(online),
+                                      env.join_room_response().member_count());
+
+                openStore(env.join_room_response().room_id());
+                if (env.join_room_response().has_history()) {
+                    applyJoinHistory(*env.mutable_join_room_response()->mutable_history());
+                }
+                presenceRoomId = env.join_room_response().room_id();
+                presenceSeq = env.join_room_response().presence_seq();
+                resendUnacked(presenceRoomId);
+                presenceSynced = true;
+                auto early = std::move(earlyPresence);
+                earlyPresence.clear();
+                for (auto& delta : early) {
+                    handlePresenceDelta(std::move(delta));
+                }
+                auto earlyRoomMessages = std::move(earlyMessages);
+                earlyMessages.clear();
+                for (auto& message : earlyRoomMessages) {
+                    resolveUser(*message.mutable_from());
+                    showRoomMessage(message);
+                }
+            } else {
+                presenceSynced = false;
+                earlyPresence.clear();
+                earlyMessages.clear();
+                listener.onError("Failed to join room.");
+            }
+            break;
+        }
+        case chat::Envelope::kRoomPresenceDelta: {
+            handlePresenceDelta(std::move(*env.mutable_room_presence_delta()));
+            break;
+        }
+        case chat::Envelope::kUserJoined: {
+            listener.onUserJoined(toUser(env.user_joined().user()));
+            break;
+        }
+        case chat::Envelope::kUserLeft: {
+            listener.onUserLeft(toUser(env.user_left().user()));
+            break;
+        }
+        case chat::Envelope::kLeaveRoomResponse: {
+            if(statusOk(env.leave_room_response().status())) {
+                closeStore();
+                presenceSynced = false;
+                earlyPresence.clear();
+                earlyMessages.clear();
+                listener.onShowRooms();
+            } else {
+                listener.onError("Failed to leave room.");
+            }
+            break;
+        }
+        case chat::Envelope::kCreateRoomResponse: {
+            if(!statusOk(env.create_room_response().status())) {
+                listener.onError("Failed to create room");
+            }
+            break;
+        }
+        case chat::Envelope::kInitialRegisterResponse: {
+            if (statusOk(env.initial_register_response().status())){
+                listener.onRegisterContinue();
+            } else {
+                listener.onError("Failed to register user: " + env.initial_register_response().status().message());
+            }
+            break;
+        }
+        case chat::Envelope::kInitialAuthResponse: {
+            if (statusOk(env.initial_auth_response().status())){
+                auto& response = *env.mutable_initial_auth_response();
+                std::string salt;
+                if(response.has_salt()) {
+                    salt = std::move(*response.mutable_salt());
+                }
+                listener.onAuthContinue(salt);
+            } else {
+                listener.onError("Failed to login");
+            }
+            break;
+        }
+        case chat::Envelope::kLogoutResponse: {
+            if(statusOk(env.logout_response().status())) {
+                listener.onShowAuth();
+            } else {
+                listener.onError("Failed to logout");
+            }
+            break;
+        }
+        case chat::Envelope::kAuthResponse: {
+            prependChunks(roomChunks, *env.mutable_auth_response()->mutable_rooms());
+            if(statusOk(env.auth_response().status())) {
+                listener.onInfo("Login successful!");
+                const auto& resp = env.auth_response();
+                handleLogin(resp.authenticated_user(), resp.rooms(), resp.resume_token(), resp.rooms_hash(), resp.rooms_unchanged());
+            } else {
+                listener.onError("Login failed! " + env.auth_response().status().message());
+            }
+            break;
+        }
+        case chat::Envelope::kRegisterResponse: {
+            if(statusOk(env.register_response().status())) {
+                listener.onInfo("Registration successful!");
+            } else {
+                listener.onError("Registration failed! " + env.register_response().status().message());
+            }
+            break;
+        }
+        case chat::Envelope::kSendMessageResponse: {
+            const auto& resp = env.send_message_response();
+            auto it = std::ranges::find(unackedSends, resp.client_key(), &UnackedSend::key);
+            if(it == unackedSends.end()) {
+                // Forgotten since, its room was left.
+                if(!statusOk(resp.status())) {
+                    listener.onError("Failed to send message!");
+                }
+                break;
+            }
+            auto send = std::move(*it);
+            unackedSends.erase(it);
+            if(statusOk(resp.status())) {
+                listener.onMessageSent(send.key, Message{{}, loopUserId, std::move(send.text), resp.timestamp(), resp.message_id(), resp.seq(), send.key});
+            } else {
+                listener.onMessageFailed(send.key, resp.status().message());
+            }
+            break;
+        }
+        case chat::Envelope::kGetServersResponse: {
+            std::vector<std::string> servers;
+
+            LOG_TRACE << "got servers resp";
+            for(const auto& server : env.get_servers_response().servers()) {
+                LOG_TRACE << server.host();
+                servers.emplace_back(server.host());
+                if(server.has_load()) {
+                    serverProbes[server.host()].load = server.load();
+                }
+            }
+            this->servers = servers;
+            setServers();
+            break;
+        }
+        case chat::Envelope::kSubscribeServersResponse: {
+            const auto& response = env.subscribe_servers_response();
+            if(statusOk(response.status())) {
+                applyServerListDiff(response.diff(), !response.incremental());
+            }
+            break;
+        }
+        case chat::Envelope::kServerListDiff: {
+            const auto& diff = env.server_list_diff();
+            if(diff.epoch() != serverListEpoch || diff.from_version() > serverListVersion) {
+                // Missed a push or the aggregator restarted, catch up from what we have.
+                subscribeServers();
+            } else if(diff.version() > serverListVersion) {
+                applyServerListDiff(diff, false);
+            }
+            break;
+        }
+        case chat::Envelope::kServerDraining: {
+            const auto& hint = env.server_draining();
+            // The aggregator's pick first, otherwise any other server we know of.
+            std::string target = hint.alternative_host();
+            if(target.empty()) {
+                for(const auto& host : servers) {
+                    if(host != loopServer) {
+                        target = host;
+                        break;
+                    }
+                }
+            }
+            if(target.empty()) {
+                LOG_INFO << "Server is shutting down and no other server is known";
+                break;
+            }
+            LOG_INFO << "Server is shutting down, moving to " << target << " in " << hint.reconnect_delay_ms() << " ms";
+            drogon::app().getLoop()->runAfter(hint.reconnect_delay_ms() / 1000.0, [this, from = loopServer, target] {
+                // Unless the user went to another server meanwhile.
+                if(loopServer != from) {
+                    return;
+                }
+                if(target == loopServer) {
+                    // Upgraded in place, the new process is at the same address: reconnecting
+                    // resumes the session and rejoins the room, as after a lost connection.
+                    if(conn) {
+                        conn->forceClose();
+                    }
+                    return;
+                }
+                listener.onMoveToServer(target);
+            });
+            break;
+        }
+        case chat::Envelope::kServerBusy: {
+            // The connection is closed right after, the reconnect waits as long as asked.
+            retryAfterSeconds = env.server_busy().retry_after_ms() / 1000.0;
+            LOG_INFO << "Server is busy, retrying in " << env.server_busy().retry_after_ms() << " ms";
+            break;
+        }
+        case chat::Envelope::kGenericError: {
+            listener.onError("Server error: " + env.generic_error().status().message());
+            break;
+        }
+        case chat::Envelope::kSyncRoomResponse: {
+            handleSyncResponse(env.sync_room_response());
+            break;
+        }
+        case chat::Envelope::kGetMessagesResponse: {
+            auto& response = *env.mutable_get_messages_response();
+            unpackPage(response);
+            prependChunks(messageChunks, *response.mutable_message());
+            if(!statusOk(env.get_messages_response().status())) {
+                listener.onError("Failed to get messages!");
+            }
+            handleHistoryResponse(env.get_messages_response());
+            break;
+        }
+        case chat::Envelope::kGetMessagesAroundResponse: {
+            auto& response = *env.mutable_get_messages_around_response();
+            unpackPage(response);
+            std::vector<Message> messages;
+            if(statusOk(response.status())) {
+                messages.reserve(response.message_size());
+                for(const auto& message : response.message()) {
+                    messages.push_back(toMessage(message));
+                }
+                noteSeen(messages);
+            } else {
+                listener.onError("Failed to get messages: " + response.status().message());
+            }
+            listener.onMessagesAround(response.message_id(), std::move(messages), response.has_older(), response.has_newer());
+            break;
+        }
+        case chat::Envelope::kMarkRoomReadResponse: {
+            // Only the unread counts of the next login depend on it, not worth bothering the user.
+            if (!statusOk(env.mark_room_read_response().status())) {
+                LOG_WARN << "Failed to mark the room read: " << env.mark_room_read_response().status().message();
+            }
+            break;
+        }
+        case chat::Envelope::kSubscribeRoomsResponse: {
+            if (!statusOk(env.subscribe_rooms_response().status())) {
+                listener.onError("Failed to subscribe to the room list: " + env.subscribe_rooms_response().status().message());
+            }
+            break;
+        }
+        case chat::Envelope::kNewRoomCreated: {
+            const auto& response = env.new_room_created().room();
+            // Who created the room is in it, and goes there.
+            const bool joined = response.owner().user_id() == loopUserId;
+            listener.onRoomAdded(Room{response.room_id(), response.room_name(), joined});
+            if(joined) {
+                joinRoom(response.room_id());
+            }
+            break;
+        }
+        case chat::Envelope::kRenameRoomResponse: {
+            if (!statusOk(env.rename_room_response().status())) {
+                listener.onError("Failed to rename room: " + env.rename_room_response().status().message());
+            }
+            break;
+        }
+        case chat::Envelope::kNewRoomName: {
+            const auto& response = env.new_room_name();
+            listener.onRoomRenamed(response.room_id(), response.name());
+            break;
+        }
+        case chat::Envelope::kDeleteRoomResponse: {
+            if (statusOk(env.delete_room_response().status())) {
+                listener.onShowRooms();
+            } else {
+                listener.onError("Failed to delete room: " + env.delete_room_response().status().message());
+            }
+            break;
+        }
+        case chat::Envelope::kRoomDeleted: {
+            if(store && presenceRoomId == env.room_deleted().room_id()) {
+                store->Clear();
+                closeStore();
+            }
+            std::error_code ec;
+            std::filesystem::remove(MessageStore::PathFor(historyDir, loopServer, loopUserId, env.room_deleted().room_id()), ec);
+            listener.onRoomRemoved(env.room_deleted().room_id());
+            break;
+        }
+        case chat::Envelope::kGetRoomMembersResponse: {
+            const auto& response = env.get_room_members_response();
+            if (!statusOk(response.status())) {
+                listener.onError("Failed to list the room members: " + response.status().message());
+                break;
+            }
+            std::vector<User> members;
+            members.reserve(response.members().size());
+            for (const auto& user : response.members()) {
+                rememberUser(user);
+                members.push_back(toUser(user));
+            }
+            listener.onRoomMembers(response.room_id(), std::move(members), response.has_more());
+            break;
+        }
+        case chat::Envelope::kAssignRoleResponse: {
+            if (!statusOk(env.assign_role_response().status())) {
+                listener.onError("Failed to assign role: " + env.assign_role_response().status().message());
+            }
+            break;
+        }
+        case chat::Envelope::kUserRoleChanged: {
+            const auto& roleChange = env.user_role_changed();
+            listener.onUserRoleChanged(roleChange.user_id(), roleChange.new_role());
+            break;
+        }
+        case chat::Envelope::kDeleteMessageResponse: {
+            if (!statusOk(env.delete_message_response().status())) {
+                listener.onError("Failed to delete message: " + env.delete_message_response().status().message());
+            }
+            break;
+        }
+        case chat::Envelope::kDeleteUserMessagesResponse: {
+            if (!statusOk(env.delete_user_messages_response().status())) {
+                listener.onError("Failed to delete messages: " + env.delete_user_messages_response().status().message());
+            }
+            break;
+        }
+        case chat::Envelope::kMessageDeleted: {
+            const auto& deleted = env.message_deleted();
+            std::vector<int32_t> messageIds{deleted.message_id()};
+            messageIds.insert(messageIds.end(), deleted.message_ids().begin(), deleted.message_ids().end());
+            if(store) {
+                store->Erase(messageIds);
+            }
+            listener.onMessagesDeleted(messageIds);
+            break;
+        }
+        case chat::Envelope::kUserTypingStartResponse: {
+            if (!statusOk(env.user_typing_start_response().status())) {
+                listener.onError("Error when requesting \"User typing start\": " + env.user_typing_start_response().status().message());
+            }
+            break;
+        }
+        case chat::Envelope::kUserTypingStopResponse: {
+            if (!statusOk(env.user_typing_stop_response().status())) {
+                listener.onError("Error when requesting \"User typing stop\": " + env.user_typing_stop_response().status().message());
+            }
+            break;
+        }
+        case chat::Envelope::kUserStartedTyping: {
+            listener.onTyping(toUser(env.user_started_typing().user()), true);
+            break;
+        }
+        case chat::Envelope::kUserStoppedTyping: {
+            listener.onTyping(toUser(env.user_stopped_typing().user()), false);
+            break;
+        }
+        case chat::Envelope::kRoomTypingUsers: {
+            std::vector<User> users;
+            for (auto& user_info : *env.mutable_room_typing_users()->mutable_users()) {
+                // Before the join response, the next snapshot shows it.
+                if (resolveUser(user_info)) {
+                    users.push_back(toUser(user_info));
+                }
+            }
+            listener.onTypingUsers(env.room_typing_users().room_id(), std::move(users));
+            break;
+        }
+        case chat::Envelope::kBecomeMemberResponse: {
+            if (!statusOk(env.become_member_response().status())) {
+                listener.onError("Error when attempting to become a member: " + env.become_member_response().status().message());
+            } else {
+                listener.onBecameMember();
+            }
+            break;
+        }
+        case chat::Envelope::kChangeUsernameResponse: {
+            if (statusOk(env.change_username_response().status())) {
+                listener.onInfo("Username has been successfully changed!");
+            }
+            else {
+                listener.onError("Error when attempting to change username : " + env.change_username_response().status().message());
+            }
+            break;
+        }
+        case chat::Envelope::kUsernameChanged: {
+            if(auto it = roomUserNames.find(env.username_changed().user_id()); it != roomUserNames.end()) {
+                it->second = env.username_changed().new_username();
+            }
+            if(store) {
+                store->Rename(env.username_changed().user_id(), env.username_changed().new_username());
+            }
+            listener.onUsernameChanged(env.username_changed().user_id(), env.username_changed().new_username());
+            break;
+        }
+        case chat::Envelope::kGetMySaltResponse: {
+            if (statusOk(env.get_my_salt_response().status())) {
+                listener.onMySalt(env.get_my_salt_response().salt());
+            }
+            else {
+                listener.onError("Failed to get user data for password change.");
+                listener.onMySalt(std::nullopt);
+            }
+            break;
+        }
+        case chat::Envelope::kChangePasswordResponse: {
+            if (statusOk(env.change_password_response().status())) {
+                listener.onInfo("Password has been successfully changed!");
+            }
+            else {
+                listener.onError("Error when attempting to change password : " + env.change_password_response().status().message());
+            }
+            break;
+        }
+        default: {
+            listener.onError("Unknown message received from server!");
+            break;
+        }
+    }
+}
+
+void ChatSession::handleLogin(const chat::UserInfo& authenticated,
+                                  const google::protobuf::RepeatedPtrField<chat::RoomInfo>& rooms,
+                                  const std::string& resumeToken, uint64_t roomsHash, bool roomsUnchanged) {
+    if(!resumeToken.empty()) {
+        resumeTokens[loopServer] = resumeToken;
+    }
+    loopUserId = authenticated.user_id();
+    // The rooms panel follows every room, not only the one we're in.
+    chat::Envelope subscribe;
+    subscribe.mutable_subscribe_rooms_request()->set_subscribe(true);
+    sendEnvelope(subscribe);
+
+    std::vector<Room> roomList;
+    auto cached = roomLists.find(loopServer);
+    if(roomsUnchanged && cached != roomLists.end()) {
+        // The rooms read up since are not listed.
+        roomList = cached->second.rooms;
+        std::unordered_map<int32_t, int64_t> unread;
+        unread.reserve(rooms.size());
+        for(const auto& proto_room : rooms) {
+            unread.emplace(proto_room.room_id(), proto_room.unread_count());
+        }
+        for(auto& room : roomList) {
+            const auto it = unread.find(room.id);
+            room.unread = it != unread.end() ? it->second : 0;
+        }
+    } else {
+        roomList.reserve(rooms.size());
+        for (const auto& proto_room : rooms){
+            roomList.push_back(Room{proto_room.room_id(), proto_room.room_name(), proto_room.is_joined(), proto_room.unread_count()});
+        }
+    }
+    roomLists[loopServer] = CachedRoomList{roomsHash, roomList};
+    listener.onLoggedIn(User{authenticated.user_id(), authenticated.user_name(), chat::UserRights::REGULAR});
+    listener.onRooms(std::move(roomList));
+    // Back into the room we were in before the connection was lost, the chat shows once joined.
+    if(const int32_t roomId = std::exchange(restoreRoomId, 0)) {
+        listener.onRestoringRoom(roomId);
+        joinRoom(roomId);
+        return;
+    }
+    listener.onShowRooms();
+}
+
+void ChatSession::handlePresenceDelta(chat::RoomPresenceDelta delta) {
+    if (!presenceSynced || delta.room_id() != presenceRoomId) {
+        // Possibly for a room whose join response is still on its way.
+        earlyPresence.push_back(std::move(delta));
+        return;
+    }
+    // Older deltas are already reflected in the roster of the join response.
+    if (delta.seq() <= presenceSeq) {
+        return;
+    }
+    presenceSeq = delta.seq();
+    applyPresenceDelta(delta);
+}
+
+void ChatSession::rememberUser(const chat::UserInfo& user) {
+    if(!user.user_name().empty()) {
+        roomUserNames[user.user_id()] = user.user_name();
+    }
+}
+
+bool ChatSession::resolveUser(chat::UserInfo& user) const {
+    if(!user.user_name().empty()) {
+        return true;
+    }
+    auto it = roomUserNames.find(user.user_id());
+    if(it == roomUserNames.end()) {
+        return false;
+    }
+    user.set_user_name(it->second);
+    return true;
+}
+
+void ChatSession::applyPresenceDelta(chat::RoomPresenceDelta& delta) {
+    for (const auto& user : delta.joined()) {
+        rememberUser(user);
+    }
+    for (const auto& user : delta.new_members()) {
+        rememberUser(user);
+    }
+    for (auto& user : *delta.mutable_left()) {
+        resolveUser(user);
+    }
+    auto toUsers = [](const auto& infos) {
+        std::vector<User> users;
+        users.reserve(infos.size());
+        for (const auto& user : infos) {
+            users.push_back(toUser(user));
+        }
+        return users;
+    };
+    listener.onPresence(delta.room_id(), toUsers(delta.new_members()), toUsers(delta.joined()), toUsers(delta.left()));
+}
+
+// Room messages are handed to the UI at most once per frame, a burst costs one layout instead of one per message.
+static constexpr double MESSAGE_FLUSH_INTERVAL = 0.016;
+
+User ChatSession::toUser(const chat::UserInfo& info) {
+    return User{info.user_id(), info.user_name(), info.user_room_rights()};
+}
+
+Message ChatSession::toMessage(const chat::MessageInfo& mi) {
+    return Message{mi.from().user_name()
+        , mi.from().user_id()
+        , mi.message()
+        , mi.timestamp()
+        , mi.message_id()
+        , mi.seq()
+        , mi.client_key()};
+}
+
+void ChatSession::showRoomMessage(const chat::MessageInfo& mi) {
+    auto message = toMessage(mi);
+    if(store) {
+        // A skipped seq is a broadcast we missed, catching up from the store brings it and holds this one back meanwhile.
+        if(storeSynced && syncing == HistorySync::None && !store->Empty() && store->NewestSeq() > 0
+           && message.seq > store->NewestSeq() + 1) {
+            LOG_INFO << "Missed messages " << store->NewestSeq() + 1 << " to " << message.seq - 1 << ", catching up";
+            storeSynced = false;
+            sendSyncRequest(store->NewestTimestamp());
+        }
+        if(syncing != HistorySync::None) {
+            heldMessages.push_back(message);
+            // Shown after the missed messages the catch-up brings.
+            if(syncing == HistorySync::CatchUp) {
+                return;
+            }
+        } else if(storeSynced) {
+            store->Append({message});
+        }
+    }
+    pendingMessages.push_back(std::move(message));
+
+    if (!flushScheduled) {
+        flushScheduled = true;
+        drogon::app().getLoop()->runAfter(MESSAGE_FLUSH_INTERVAL, [this] { flushRoomMessages(); });
+    }
+}
+
+void ChatSession::flushRoomMessages() {
+    flushScheduled = false;
+    if (pendingMessages.empty()) {
+        return;
+    }
+    noteSeen(pendingMessages);
+    listener.onMessages(std::exchange(pendingMessages, {}), false);
+}
+
+// Delay before the read cursor follows the messages shown, a busy room moves it once per delay.
+static constexpr double MARK_READ_DELAY_SECONDS = 2;
+
+void ChatSession::noteSeen(const std::vector<Message>& messages) {
+    for(const auto& message : messages) {
+        seenSeq = std::max(seenSeq, message.seq);
+    }
+    if(seenSeq > markedSeq && !markReadArmed) {
+        markReadArmed = true;
+        drogon::app().getLoop()->runAfter(MARK_READ_DELAY_SECONDS, [this, roomId = storeRoomId] {
+            markReadArmed = false;
+            if(roomId == storeRoomId) {
+                sendMarkRead();
+            }
+        });
+    }
+}
+
+void ChatSession::sendMarkRead() {
+    if(!storeRoomId || seenSeq <= markedSeq || !conn || !conn->connected()) {
+        return;
+    }
+    chat::Envelope env;
+    auto* request = env.mutable_mark_room_read_request();
+    request->set_room_id(storeRoomId);
+    request->set_seq(seenSeq);
+    markedSeq = seenSeq;
+    sendEnvelope(env);
+}
+
+void ChatSession::openStore(int32_t roomId) {
+    closeStore();
+    store = std::make_unique<MessageStore>(MessageStore::PathFor(historyDir, loopServer, loopUserId, roomId));
+    storeRoomId = roomId;
+}
+
+void ChatSession::closeStore() {
+    // What was shown of the room we leave is read, without waiting for the delay.
+    sendMarkRead();
+    seenSeq = 0;
+    markedSeq = 0;
+    store.reset();
+    storeSynced = false;
+    storeSeqCursor = 0;
+    syncing = HistorySync::None;
+    heldMessages.clear();
+}
+
+// Serves a page from the local history where it has one, asks the server otherwise.
+void ChatSession::requestHistory(int32_t limit, int64_t offsetTs) {
+    if(store && limit > 0) {
+        // Synced while the room had no messages, there is nothing older to ask for.
+        if(storeSynced && store->Empty()) {
+            showMessageHistory({});
+            return;
+        }
+        if(auto page = store->Older(offsetTs, limit); !page.empty()) {
+            // The first page of a join: shown at once, while what changed since is fetched.
+            if(!storeSynced && syncing == HistorySync::None && offsetTs > store->NewestTimestamp()) {
+                sendSyncRequest(store->NewestTimestamp());
+            }
+            showMessageHistory(std::move(page));
+            return;
+        }
+    } else if(store && storeSynced && limit < 0) {
+        if(auto page = store->Newer(offsetTs, -limit); !page.empty()) {
+            showMessageHistory(std::move(page));
+            return;
+        }
+    }
+    // Nothing stored yet, the newest page becomes the stored history.
+    const bool initial = store && store->Empty() && !storeSynced && syncing == HistorySync::None && limit > 0;
+    sendHistoryRequest(limit, offsetTs, initial ? HistorySync::Initial : HistorySync::None);
+}
+
+void ChatSession::sendHistoryRequest(int32_t limit, int64_t offsetTs, HistorySync sync) {
+    if(!conn || !conn->connected()) {
+        listener.onError("Not connected to server!");
+        return;
+    }
+    // The view asking again for a page not sent yet gets it once.
+    if(sync == HistorySync::None && std::any_of(outbound.begin(), outbound.end(), [&](const chat::Envelope& queued) {
+           return queued.has_get_messages_request() && queued.get_messages_request().limit() == limit
+               && queued.get_messages_request().offset_ts() == offsetTs;
+       })) {
+        return;
+    }
+    chat::Envelope env;
+    auto* request = env.mutable_get_messages_request();
+    request->set_limit(limit);
+    request->set_offset_ts(offsetTs);
+    request->set_packed(packedHistory);
+    historyRequests.push_back(HistoryRequest{limit, offsetTs, sync});
+    if(sync != HistorySync::None) {
+        syncing = sync;
+    }
+    sendEnvelope(env);
+}
+
+void ChatSession::clearChunks() {
+    messageChunks.Clear();
+    roomChunks.Clear();
+}
+
+template <typename Response>
+static void unpackInPlace(Response& response) {
+    if(response.has_packed()) {
+        if(!common::unpackMessages(response.packed(), *response.mutable_message())) {
+            common::setStatus(response, chat::StatusCode::STATUS_FAILURE, "Malformed packed page");
+        }
+        response.clear_packed();
+    }
+}
+
+void ChatSession::unpackPage(chat::GetMessagesResponse& response) {
+    unpackInPlace(response);
+}
+
+void ChatSession::unpackPage(chat::GetMessagesAroundResponse& response) {
+    unpackInPlace(response);
+}
+
+void ChatSession::applyJoinHistory(chat::GetMessagesResponse& response) {
+    unpackPage(response);
+    if(response.status().code() != chat::StatusCode::STATUS_SUCCESS || !store || !store->Empty()) {
+        // The view asks for its first page as without it.
+        return;
+    }
+    // Newest first from the server, the store keeps it as if the view had asked for it.
+    std::vector<Message> chronological;
+    chronological.reserve(response.message_size());
+    for(auto it = response.message().rbegin(); it != response.message().rend(); ++it) {
+        chronological.push_back(toMessage(*it));
+    }
+    store->Reset(chronological);
+    storeSynced = true;
+}
+
+void ChatSession::handleHistoryResponse(const chat::GetMessagesResponse& response) {
+    HistoryRequest request;
+    if(!historyRequests.empty()) {
+        request = historyRequests.front();
+        historyRequests.pop_front();
+    }
+    const bool ok = response.status().code() == chat::StatusCode::STATUS_SUCCESS;
+
+    std::vector<Message> messages;
+    messages.reserve(response.message_size());
+    for(const auto& proto_message : response.message()) {
+        messages.push_back(toMessage(proto_message));
+    }
+
+    if(store && ok) {
+        if(request.sync == HistorySync::Initial) {
+            // Newest first from the server. The live messages held meanwhile follow it, minus those it already has.
+            std::vector<Message> chronological(messages.rbegin(), messages.rend());
+            for(auto& held : heldMessages) {
+                if(chronological.empty() || held.timestamp > chronological.back().timestamp) {
+                    chronological.push_back(std::move(held));
+                }
+            }
+            store->Reset(chronological);
+            storeSynced = true;
+        } else if(!messages.empty() && !store->Empty()) {
+            if(request.limit > 0 && request.offsetTs == store->OldestTimestamp()) {
+                store->Prepend(std::vector<Message>(messages.rbegin(), messages.rend()));
+            } else if(request.limit < 0 && request.offsetTs == store->NewestTimestamp()) {
+                store->Append(messages);
+            }
+        }
+    }
+    if(request.sync == HistorySync::Initial) {
+        syncing = HistorySync::None;
+        heldMessages.clear();
+    }
+    showMessageHistory(std::move(messages));
+}
+
+// Deletions made while the room was closed happened after its newest stored message, so
+// syncing from that message's timestamp brings them along with the messages missed. The
+// messages themselves are synced from its seq when it has one, which no message can fall behind.
+void ChatSession::sendSyncRequest(int64_t sinceCursor) {
+    if(!conn || !conn->connected()) {
+        return;
+    }
+    chat::Envelope env;
+    auto* request = env.mutable_sync_room_request();
+    request->set_room_id(storeRoomId);
+    request->set_since_cursor(sinceCursor);
+    if(store && !store->Empty() && store->NewestSeq() > 0) {
+        request->set_since_seq(storeSeqCursor > 0 ? storeSeqCursor : store->NewestSeq());
+    }
+    syncing = HistorySync::CatchUp;
+    sendEnvelope(env);
+}
+
+void ChatSession::handleSyncResponse(const chat::SyncRoomResponse& response) {
+    if(syncing != HistorySync::CatchUp) {
+        return;
+    }
+    syncing = HistorySync::None;
+    auto held = std::exchange(heldMessages, {});
+    if(!store) {
+        return;
+    }
+    if(response.status().code() != chat::StatusCode::STATUS_SUCCESS) {
+        // The stored history stays unsynced, the live messages are only shown.
+        for(auto& message : held) {
+            pendingMessages.push_back(std::move(message));
+        }
+        flushRoomMessages();
+        return;
+    }
+    // More than a page behind, reloading is cheaper than catching up.
+    if(response.has_more()) {
+        LOG_INFO << "Local history too far behind, reloading it";
+        storeSeqCursor = 0;
+        store->Clear();
+        listener.onHistoryReset();
+        return;
+    }
+    const std::vector<int32_t> deleted(response.deleted_message_ids().begin(), response.deleted_message_ids().end());
+    store->Erase(deleted);
+    listener.onMessagesDeleted(deleted);
+
+    std::vector<Message> messages;
+    messages.reserve(response.messages_size() + held.size());
+    for(const auto& proto_message : response.messages()) {
+        messages.push_back(toMessage(proto_message));
+    }
+    for(auto& message : held) {
+        if(messages.empty() || message.timestamp > messages.back().timestamp) {
+            messages.push_back(std::move(message));
+        }
+    }
+    // Messages the cursor was held back for come again, only the ones not stored yet are new,
+    // those that committed late among them go in their place.
+    auto added = store->Merge(messages);
+    storeSeqCursor = response.seq_cursor();
+    storeSynced = true;
+    for(auto& message : added) {
+        pendingMessages.push_back(std::move(message));
+    }
+    flushRoomMessages();
+}
+
+void ChatSession::showMessageHistory(std::vector<Message> messages) {
+    noteSeen(messages);
+    listener.onMessages(std::move(messages), true);
+}
+
+void ChatSession::applyServerListDiff(const chat::ServerListDiff& diff, bool replace) {
+    if(replace) {
+        // Keeps the order of the hosts still listed, it may come from a ranked GetServers.
+        std::erase_if(servers, [&diff](const std::string& host) {
+            return std::none_of(diff.added().begin(), diff.added().end(),
+                                [&host](const chat::ServerNodeInfo& server) { return server.host() == host; });
+        });
+    }
+    for(const auto& host : diff.removed()) {
+        std::erase(servers, host);
+    }
+    for(const auto& server : diff.added()) {
+        if(std::find(servers.begin(), servers.end(), server.host()) == servers.end()) {
+            servers.push_back(server.host());
+        }
+        if(server.has_load()) {
+            serverProbes[server.host()].load = server.load();
+        }
+    }
+    serverListEpoch = diff.epoch();
+    serverListVersion = diff.version();
+    setServers();
+}
+
+void ChatSession::setServers() {
+    // Forgets the servers no longer listed, unless a probe of one is still out.
+    std::erase_if(serverProbes, [this](const auto& entry) {
+        return !entry.second.inFlight && std::find(servers.begin(), servers.end(), entry.first) == servers.end();
+    });
+    rankServers();
+    probeServers();
+}
+
+// Round trips measured per server, the fastest counts. The first one also opens the connection.
+static constexpr int PROBE_ROUNDS = 3;
+static constexpr double PROBE_TIMEOUT_SECONDS = 2;
+// A measurement is used this long before the server is probed again.
+static constexpr auto PROBE_MAX_AGE = std::chrono::seconds(30);
+// A fully loaded server ranks like one this much further away.
+static constexpr double LOAD_PENALTY_MS = 100;
+
+// How long the aggregator holds a poll of GET /servers, and the wait before polling again after a failure.
+static constexpr int SERVER_POLL_WAIT_SECONDS = 30;
+static constexpr double SERVER_POLL_RETRY_SECONDS = 5;
+
+void ChatSession::pollServers(uint64_t generation, bool first) {
+    auto req = drogon::HttpRequest::newHttpRequest();
+    req->setPath("/servers");
+    if(!serverListEtag.empty()) {
+        req->addHeader("If-None-Match", serverListEtag);
+    }
+    if(!first) {
+        req->setParameter("wait", std::to_string(SERVER_POLL_WAIT_SECONDS));
+    }
+    serverListHttp->sendRequest(req, [this, generation, first](drogon::ReqResult result, const drogon::HttpResponsePtr& resp) {
+        if(generation != serverPollGeneration) {
+            return;
+        }
+        const bool ok = result == drogon::ReqResult::Ok && resp &&
+                        (resp->statusCode() == drogon::k200OK || resp->statusCode() == drogon::k304NotModified);
+        if(first && !ok) {
+            // An aggregator without GET /servers, the list comes over the WebSocket.
+            LOG_INFO << "No server list over HTTP, subscribing over the WebSocket";
+            serverListHttp.reset();
+            subscribeServers();
+            getServers();
+            return;
+        }
+        if(first) {
+            // Nothing else is asked of the aggregator, its socket is given back.
+            autoReconnect = false;
+            conn.reset();
+            client.reset();
+        }
+        if(!ok) {
+            drogon::app().getLoop()->runAfter(SERVER_POLL_RETRY_SECONDS, [this, generation] {
+                if(generation == serverPollGeneration) {
+                    pollServers(generation, false);
+                }
+            });
+            return;
+        }
+        if(resp->statusCode() == drogon::k200OK) {
+            if(const auto& json = resp->getJsonObject(); json && (*json)["servers"].isArray()) {
+                std::vector<std::string> listed;
+                for(const auto& server : (*json)["servers"]) {
+                    listed.push_back(server["host"].asString());
+                    if(server.isMember("load")) {
+                        serverProbes[listed.back()].load = server["load"].asFloat();
+                    }
+                }
+                servers = std::move(listed);
+                serverListEtag = resp->getHeader("ETag");
+                setServers();
+            }
+        } else if(first) {
+            // Unchanged since the list we kept from an earlier visit.
+            setServers();
+        }
+        pollServers(generation, false);
+    }, SERVER_POLL_WAIT_SECONDS + PROBE_TIMEOUT_SECONDS);
+}
+
+void ChatSession::probeServers() {
+    const auto now = std::chrono::steady_clock::now();
+    for(const auto& host : servers) {
+        auto& probe = serverProbes[host];
+        if(probe.inFlight || (probe.measuredAt && now - *probe.measuredAt < PROBE_MAX_AGE)) {
+            continue;
+        }
+        // The readiness check is served next to the WebSocket endpoint, and fails while starting or draining.
+        auto base = httpBase(host);
+        if(!base) {
+            probe.available = false;
+            probe.measuredAt = now;
+            continue;
+        }
+        probe.inFlight = true;
+        ++probesInFlight;
+        probeRound(host, drogon::HttpClient::newHttpClient(*base, drogon::app().getLoop()), 0, std::nullopt);
+    }
+}
+
+void ChatSession::probeRound(std::string host, drogon::HttpClientPtr http, int round, std::optional<double> best) {
+    auto req = drogon::HttpRequest::newHttpRequest();
+    req->setPath("/ready");
+    const auto sent = std::chrono::steady_clock::now();
+    auto* client = http.get();
+    client->sendRequest(req, [this, host = std::move(host), http = std::move(http), round, best, sent]
+                             (drogon::ReqResult result, const drogon::HttpResponsePtr& resp) mutable {
+        const auto now = std::chrono::steady_clock::now();
+        const bool ok = result == drogon::ReqResult::Ok && resp && resp->statusCode() == drogon::k200OK;
+        if(ok) {
+            const double rtt = std::chrono::duration<double, std::milli>(now - sent).count();
+            best = std::min(best.value_or(rtt), rtt);
+            if(round + 1 < PROBE_ROUNDS) {
+                probeRound(std::move(host), std::move(http), round + 1, best);
+                return;
+            }
+        }
+        auto& probe = serverProbes[host];
+        probe.inFlight = false;
+        probe.available = ok;
+        probe.rttMs = ok ? best : std::nullopt;
+        probe.measuredAt = now;
+        // One update once every server answered, not one per server.
+        if(--probesInFlight == 0) {
+            rankServers();
+        }
+    }, PROBE_TIMEOUT_SECONDS);
+}
+
+void ChatSession::rankServers() {
+    std::vector<ServerEntry> entries;
+    entries.reserve(servers.size());
+    for(const auto& host : servers) {
+        ServerEntry entry{.host = host};
+        if(auto it = serverProbes.find(host); it != serverProbes.end()) {
+            entry.rttMs = it->second.rttMs;
+            entry.load = it->second.load;
+            entry.available = it->second.available;
+        }
+        entries.push_back(std::move(entry));
+    }
+    // Available servers by round trip with a penalty for load, the unmeasured ones in the aggregator's order after them.
+    auto score = [](const ServerEntry& entry) {
+        return *entry.rttMs + static_cast<double>(std::clamp(entry.load.value_or(0.5f), 0.0f, 1.0f)) * LOAD_PENALTY_MS;
+    };
+    std::stable_sort(entries.begin(), entries.end(), [&score](const ServerEntry& a, const ServerEntry& b) {
+        if(a.available != b.available) {
+            return a.available;
+        }
+        if(a.rttMs.has_value() != b.rttMs.has_value()) {
+            return a.rttMs.has_value();
+        }
+        return a.rttMs && score(a) < score(b);
+    });
+    listener.onServers(std::move(entries));
+}
+
+} // namespace client::core
@@ -0,0 +1,100 @@
+#include <client/core/timestamp.h>
+
+#include <time.h>
+#include <unordered_map>
+
+namespace client::core {
+
+namespace {
+
+// Formats message timestamps relative to the current day. The day and year boundaries are
+// only recomputed when the day changes, and each minute is formatted once: a history page
+// is mostly messages sharing a handful of minutes.
+class TimestampFormatter {
+public:
+    std::string Format(int64_t timestamp) {
+        const time_t now = time(nullptr);
+        if (now < m_todayStart || now >= m_tomorrowStart) {
+            NewDay(now);
+        }
+
+        const time_t t = static_cast<time_t>(timestamp / 1000000LL);
+        // Floor division, timestamps before the epoch still map to their own minute.
+        const time_t minute = t / 60 - (t % 60 < 0 ? 1 : 0);
+        if (auto it = m_minutes.find(minute); it != m_minutes.end()) {
+            return it->second;
+        }
+        if (m_minutes.size() >= MAX_MINUTES) {
+            m_minutes.clear();
+        }
+
+        const char* format = "[%d.%m.%Y %H:%M]";
+        if (t >= m_todayStart && t < m_tomorrowStart) {
+            format = "[%H:%M]";
+        } else if (t >= m_yearStart && t < m_nextYearStart) {
+            format = "[%d.%m %H:%M]";
+        }
+        struct tm local_tm = ToLocal(t);
+        char buffer[32];
+        const size_t length = strftime(buffer, sizeof(buffer), format, &local_tm);
+        return m_minutes.emplace(minute, std::string(buffer, length)).first->second;
+    }
+
+private:
+    static struct tm ToLocal(time_t t) {
+        struct tm local_tm;
+        // Cross-platform local time conversion
+#if defined(_WIN32)
+        localtime_s(&local_tm, &t);
+#else
+        localtime_r(&t, &local_tm);
+#endif
+        return local_tm;
+    }
+
+    // mktime normalizes the fields, so day and year overflows and DST changes are handled for us.
+    void NewDay(time_t now) {
+        struct tm day = ToLocal(now);
+        day.tm_hour = 0;
+        day.tm_min = 0;
+        day.tm_sec = 0;
+        day.tm_isdst = -1;
+        struct tm next = day;
+        m_todayStart = mktime(&day);
+        ++next.tm_mday;
+        m_tomorrowStart = mktime(&next);
+
+        struct tm year = ToLocal(now);
+        year.tm_mon = 0;
+        year.tm_mday = 1;
+        year.tm_hour = 0;
+        year.tm_min = 0;
+        year.tm_sec = 0;
+        year.tm_isdst = -1;
+        struct tm nextYear = year;
+        m_yearStart = mktime(&year);
+        ++nextYear.tm_year;
+        m_nextYearStart = mktime(&nextYear);
+
+        // Which format a minute gets depends on the current day.
+        m_minutes.clear();
+    }
+
+    time_t m_todayStart = 0;
+    time_t m_tomorrowStart = 0;
+    time_t m_yearStart = 0;
+    time_t m_nextYearStart = 0;
+    std::unordered_map<time_t, std::string> m_minutes;
+
+    static constexpr size_t MAX_MINUTES = 4096;
+};
+
+} // namespace
+
+std::string formatMessageTimestamp(int64_t timestamp) {
+    // Shared by whichever threads format timestamps, each keeps its own cache.
+    thread_local TimestampFormatter formatter;
+    return formatter.Format(timestamp);
+}
+
+} // namespace client::core
@@ -1,23 +1,44 @@
 #pragma once
 
+#include <backend/messagelistmodel.h>
+#include <client/core/session.h>
 #include <QObject>
+#include <QStringList>
+#include <QVariantList>
 
 namespace qt {
 
 /**
  * Backend handles application logic and state management.
  * Exposes properties and slots to QML for UI interaction.
+ *
+ * The protocol is the client core's ChatSession, the one the wx client runs as well.
+ * Its events arrive on the network loop and are queued to the Qt thread from there.
  */
-class Backend : public QObject {
+class Backend : public QObject, private client::core::SessionListener {
     Q_OBJECT
     Q_PROPERTY(QString message READ message WRITE setMessage NOTIFY messageChanged)
+    Q_PROPERTY(qt::MessageListModel *messages READ messages CONSTANT)
+    Q_PROPERTY(QVariantList rooms READ rooms NOTIFY roomsChanged)
+    Q_PROPERTY(QStringList servers READ servers NOTIFY serversChanged)
 
 public:
+    // The screen the session needs shown.
+    enum class Screen { Initial, Servers, Auth, Rooms, Chat };
+    Q_ENUM(Screen)
+
     explicit Backend(QObject *parent = nullptr);
+    ~Backend() override;
 
     // Property accessors
     QString message() const;
     void setMessage(const QString &msg);
+    MessageListModel *messages() { return &m_messages; }
+    QVariantList rooms() const { return m_rooms; }
+    QStringList servers() const { return m_servers; }
+
+    // For the requests the slots below do not cover.
+    client::core::ChatSession &session() { return m_session; }
 
 public slots:
     /**
@@ -26,15 +47,72 @@ public slots:
      */
     void onButtonClicked();
 
+    void connectToServer(const QString &address);
+    void disconnectFromServer();
+    void joinRoom(int roomId);
+    void leaveRoom();
+    void sendMessage(const QString &text);
+
 signals:
     /**
      * Emitted when message property changes.
      * QML automatically updates bound text when this fires.
      */
     void messageChanged();
+    void roomsChanged();
+    void serversChanged();
+    void screenRequested(qt::Backend::Screen screen);
+    // The steps of logging in, see ChatSession::requestInitialRegister() and requestInitialAuth().
+    void registerContinue();
+    void authContinue(const QString &salt);
 
 private:
+    // Runs f on the Qt thread, dropped when the backend is gone by then.
+    template <typename F>
+    void post(F &&f);
+
+    void onError(const std::string &message) override;
+    void onInfo(const std::string &message) override;
+    void onShowInitial() override;
+    void onShowServers() override;
+    void onShowAuth() override;
+    void onShowRooms() override;
+    void onRegisterContinue() override;
+    void onAuthContinue(const std::string &salt) override;
+    void onLoggedIn(const client::core::User &self) override;
+    void onMySalt(const std::optional<std::string> &salt) override;
+    void onRooms(std::vector<client::core::Room> rooms) override;
+    void onRoomAdded(const client::core::Room &room) override;
+    void onRoomRenamed(int32_t roomId, const std::string &name) override;
+    void onRoomRemoved(int32_t roomId) override;
+    void onRestoringRoom(int32_t roomId) override;
+    void onBecameMember() override;
+    void onJoinedRoom(int32_t roomId, std::vector<client::core::User> members, std::vector<client::core::User> online, uint32_t memberCount) override;
+    void onRoomMembers(int32_t roomId, std::vector<client::core::User> members, bool more) override;
+    void onUserJoined(const client::core::User &user) override;
+    void onUserLeft(const client::core::User &user) override;
+    void onPresence(int32_t roomId, std::vector<client::core::User> newMembers, std::vector<client::core::User> joined,
+                    std::vector<client::core::User> left) override;
+    void onUserRoleChanged(int32_t userId, chat::UserRights role) override;
+    void onUsernameChanged(int32_t userId, const std::string &username) override;
+    void onTyping(const client::core::User &user, bool started) override;
+    void onTypingUsers(int32_t roomId, std::vector<client::core::User> users) override;
+    void onMessages(std::vector<client::core::Message> messages, bool history) override;
+    void onMessagesDeleted(const std::vector<int32_t> &messageIds) override;
+    void onMessageSent(const std::string &key, const client::core::Message &message) override;
+    void onMessageFailed(const std::string &key, const std::string &error) override;
+    void onMessagesAround(int32_t messageId, std::vector<client::core::Message> messages, bool hasOlder, bool hasNewer) override;
+    void onHistoryReset() override;
+    void onServers(std::vector<client::core::ServerEntry> servers) override;
+    void onMoveToServer(const std::string &host) override;
+
+    static QVariantMap toVariant(const client::core::Room &room);
+
     QString m_message;
+    MessageListModel m_messages;
+    QVariantList m_rooms;
+    QStringList m_servers;
+    client::core::ChatSession m_session;
 };
 
 }  // namespace qt
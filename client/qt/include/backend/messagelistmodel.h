@@ -0,0 +1,68 @@
+#pragma once
+
+#include <client/core/model.h>
+#include <QAbstractListModel>
+#include <deque>
+#include <vector>
+
+namespace qt {
+
+/**
+ * Messages of the joined room, oldest on top, for a QML ListView or a QListView.
+ *
+ * The views only ask for the rows they show, so text is converted to QString and times
+ * are formatted in data(), for the visible rows alone. Older history is paged in through
+ * fetchMore() as the view scrolls up, and the oldest rows are dropped again once more than
+ * MAX_ROWS are held, to be fetched anew from the local history when scrolled back to.
+ */
+class MessageListModel : public QAbstractListModel {
+    Q_OBJECT
+
+public:
+    enum Role {
+        UserNameRole = Qt::UserRole + 1,
+        UserIdRole,
+        TextRole,
+        TimestampRole,
+        TimeRole,
+        MessageIdRole,
+    };
+    Q_ENUM(Role)
+
+    explicit MessageListModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QHash<int, QByteArray> roleNames() const override;
+
+    bool canFetchMore(const QModelIndex &parent) const override;
+    void fetchMore(const QModelIndex &parent) override;
+
+    // Empties the model for a newly joined room, which then fetches its newest page.
+    void reset();
+    // Live messages, oldest first.
+    void appendLive(const std::vector<client::core::Message> &messages);
+    // A page of older history, newest first, the answer to olderRequested().
+    void addOlder(const std::vector<client::core::Message> &messages);
+    void removeMessages(const std::vector<int32_t> &messageIds);
+
+    static constexpr int PAGE_SIZE = 50;
+    static constexpr int MAX_ROWS = 2000;
+
+signals:
+    /**
+     * The view scrolled to the top of what is held.
+     * Asks for up to limit messages older than the given timestamp.
+     */
+    void olderRequested(int limit, qint64 before);
+
+private:
+    void trimOldest();
+
+    std::deque<client::core::Message> m_messages;
+    bool m_active = false;
+    bool m_loadingOlder = false;
+    bool m_olderExhausted = false;
+};
+
+}  // namespace qt
@@ -10,6 +10,9 @@ public:
     explicit ConnectWidget(QWidget *parent = nullptr);
     ~ConnectWidget();
 
+    // The WebSocket address entered, with the port from the spin box when one is set
+    QString address() const;
+
 signals:
     // Signal to notify the main window
     void connectClicked();
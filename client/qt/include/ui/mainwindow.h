@@ -1,6 +1,7 @@
 #pragma once
 
 #include <QMainWindow>
+#include <backend/backend.h>
 namespace Ui { class MainWindow; }
 class MainWindow : public QMainWindow {
     Q_OBJECT
@@ -9,4 +10,5 @@ public:
     ~MainWindow();
 private:
     Ui::MainWindow *ui;
+    qt::Backend m_backend;
 };
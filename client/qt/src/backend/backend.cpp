@@ -1,10 +1,21 @@
 #include <backend/backend.h>
+#include <QMetaObject>
+#include <QStandardPaths>
 
 namespace qt {
 
 Backend::Backend(QObject *parent)
-    : QObject(parent), m_message("Hello from Backend")
+    : QObject(parent), m_message("Hello from Backend"),
+      m_session(*this, QStandardPaths::writableLocation(QStandardPaths::AppDataLocation).toStdWString())
 {
+    connect(&m_messages, &MessageListModel::olderRequested, this, [this](int limit, qint64 before) {
+        m_session.getMessages(limit, before);
+    });
+}
+
+Backend::~Backend()
+{
+    m_session.stop();
 }
 
 QString Backend::message() const
@@ -26,4 +37,215 @@ void Backend::onButtonClicked()
     setMessage("Button clicked from QML!");
 }
 
+void Backend::connectToServer(const QString &address)
+{
+    m_session.start(address.toStdString());
+}
+
+void Backend::disconnectFromServer()
+{
+    m_session.stop();
+    emit screenRequested(Screen::Initial);
+}
+
+void Backend::joinRoom(int roomId)
+{
+    m_session.joinRoom(roomId);
+}
+
+void Backend::leaveRoom()
+{
+    m_session.leaveRoom();
+}
+
+void Backend::sendMessage(const QString &text)
+{
+    m_session.sendMessage(text.toStdString());
+}
+
+template <typename F>
+void Backend::post(F &&f)
+{
+    QMetaObject::invokeMethod(this, std::forward<F>(f), Qt::QueuedConnection);
+}
+
+QVariantMap Backend::toVariant(const client::core::Room &room)
+{
+    return {
+        {"id", room.id},
+        {"name", QString::fromStdString(room.name)},
+        {"member", room.member},
+        {"unread", static_cast<qint64>(room.unread)},
+    };
+}
+
+void Backend::onError(const std::string &message)
+{
+    post([this, msg = QString::fromStdString(message)] { setMessage(msg); });
+}
+
+void Backend::onInfo(const std::string &message)
+{
+    post([this, msg = QString::fromStdString(message)] { setMessage(msg); });
+}
+
+void Backend::onShowInitial()
+{
+    post([this] { emit screenRequested(Screen::Initial); });
+}
+
+void Backend::onShowServers()
+{
+    post([this] { emit screenRequested(Screen::Servers); });
+}
+
+void Backend::onShowAuth()
+{
+    post([this] { emit screenRequested(Screen::Auth); });
+}
+
+void Backend::onShowRooms()
+{
+    post([this] { emit screenRequested(Screen::Rooms); });
+}
+
+void Backend::onRegisterContinue()
+{
+    post([this] { emit registerContinue(); });
+}
+
+void Backend::onAuthContinue(const std::string &salt)
+{
+    post([this, salt = QString::fromStdString(salt)] { emit authContinue(salt); });
+}
+
+void Backend::onLoggedIn(const client::core::User &self)
+{
+    post([this, name = QString::fromStdString(self.name)] { setMessage(name); });
+}
+
+void Backend::onRooms(std::vector<client::core::Room> rooms)
+{
+    QVariantList list;
+    list.reserve(static_cast<qsizetype>(rooms.size()));
+    for (const auto &room : rooms) {
+        list.push_back(toVariant(room));
+    }
+    post([this, list = std::move(list)] {
+        m_rooms = list;
+        emit roomsChanged();
+    });
+}
+
+void Backend::onRoomAdded(const client::core::Room &room)
+{
+    post([this, room = toVariant(room)] {
+        m_rooms.push_back(room);
+        emit roomsChanged();
+    });
+}
+
+void Backend::onRoomRenamed(int32_t roomId, const std::string &name)
+{
+    post([this, roomId, name = QString::fromStdString(name)] {
+        for (auto &room : m_rooms) {
+            auto map = room.toMap();
+            if (map.value("id").toInt() == roomId) {
+                map["name"] = name;
+                room = map;
+            }
+        }
+        emit roomsChanged();
+    });
+}
+
+void Backend::onRoomRemoved(int32_t roomId)
+{
+    post([this, roomId] {
+        m_rooms.removeIf([roomId](const QVariant &room) { return room.toMap().value("id").toInt() == roomId; });
+        emit roomsChanged();
+    });
+}
+
+void Backend::onJoinedRoom(int32_t, std::vector<client::core::User>, std::vector<client::core::User>, uint32_t)
+{
+    // The view fetches the newest page once it shows the emptied model.
+    post([this] {
+        m_messages.reset();
+        emit screenRequested(Screen::Chat);
+    });
+}
+
+void Backend::onRoomMembers(int32_t, std::vector<client::core::User>, bool)
+{
+    // No member list in this client yet, it never asks for one.
+}
+
+void Backend::onMessages(std::vector<client::core::Message> messages, bool history)
+{
+    post([this, messages = std::move(messages), history] {
+        if (history) {
+            m_messages.addOlder(messages);
+        } else {
+            m_messages.appendLive(messages);
+        }
+    });
+}
+
+void Backend::onMessageSent(const std::string &, const client::core::Message &)
+{
+    // Shown once broadcast, with everything the server assigned.
+}
+
+void Backend::onMessageFailed(const std::string &, const std::string &error)
+{
+    post([this, msg = QString::fromStdString("Failed to send message! " + error)] { setMessage(msg); });
+}
+
+void Backend::onMessagesDeleted(const std::vector<int32_t> &messageIds)
+{
+    post([this, messageIds] { m_messages.removeMessages(messageIds); });
+}
+
+void Backend::onMessagesAround(int32_t, std::vector<client::core::Message>, bool, bool)
+{
+    // The list always continues from the newest messages, it never asks for a window elsewhere.
+}
+
+void Backend::onHistoryReset()
+{
+    post([this] { m_messages.reset(); });
+}
+
+void Backend::onServers(std::vector<client::core::ServerEntry> servers)
+{
+    QStringList hosts;
+    for (const auto &server : servers) {
+        if (server.available) {
+            hosts.push_back(QString::fromStdString(server.host));
+        }
+    }
+    post([this, hosts = std::move(hosts)] {
+        m_servers = hosts;
+        emit serversChanged();
+    });
+}
+
+void Backend::onMoveToServer(const std::string &host)
+{
+    post([this, host] { m_session.start(host); });
+}
+
+// Not shown by the Qt client yet, the session keeps them consistent regardless.
+void Backend::onMySalt(const std::optional<std::string> &) {}
+void Backend::onRestoringRoom(int32_t) {}
+void Backend::onBecameMember() {}
+void Backend::onUserJoined(const client::core::User &) {}
+void Backend::onUserLeft(const client::core::User &) {}
+void Backend::onPresence(int32_t, std::vector<client::core::User>, std::vector<client::core::User>, std::vector<client::core::User>) {}
+void Backend::onUserRoleChanged(int32_t, chat::UserRights) {}
+void Backend::onUsernameChanged(int32_t, const std::string &) {}
+void Backend::onTyping(const client::core::User &, bool) {}
+void Backend::onTypingUsers(int32_t, std::vector<client::core::User>) {}
+
 }  // namespace qt
@@ -0,0 +1,145 @@
+#include <backend/messagelistmodel.h>
+#include <client/core/timestamp.h>
+#include <algorithm>
+
+namespace qt {
+
+// Past every timestamp, the first page is the newest one.
+static constexpr qint64 NEWEST = 32517734834000000;
+
+MessageListModel::MessageListModel(QObject *parent)
+    : QAbstractListModel(parent)
+{
+}
+
+int MessageListModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : static_cast<int>(m_messages.size());
+}
+
+QVariant MessageListModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() < 0 || static_cast<size_t>(index.row()) >= m_messages.size()) {
+        return {};
+    }
+    const auto &message = m_messages[static_cast<size_t>(index.row())];
+    switch (role) {
+    case Qt::DisplayRole:
+    case TextRole:
+        return QString::fromStdString(message.text);
+    case UserNameRole:
+        return QString::fromStdString(message.user);
+    case UserIdRole:
+        return message.userId;
+    case TimestampRole:
+        return static_cast<qint64>(message.timestamp);
+    case TimeRole:
+        return QString::fromStdString(client::core::formatMessageTimestamp(message.timestamp));
+    case MessageIdRole:
+        return message.messageId;
+    default:
+        return {};
+    }
+}
+
+QHash<int, QByteArray> MessageListModel::roleNames() const
+{
+    return {
+        {UserNameRole, "user"},
+        {UserIdRole, "userId"},
+        {TextRole, "text"},
+        {TimestampRole, "timestamp"},
+        {TimeRole, "time"},
+        {MessageIdRole, "messageId"},
+    };
+}
+
+bool MessageListModel::canFetchMore(const QModelIndex &parent) const
+{
+    return !parent.isValid() && m_active && !m_loadingOlder && !m_olderExhausted;
+}
+
+void MessageListModel::fetchMore(const QModelIndex &parent)
+{
+    if (!canFetchMore(parent)) {
+        return;
+    }
+    m_loadingOlder = true;
+    emit olderRequested(PAGE_SIZE, m_messages.empty() ? NEWEST : m_messages.front().timestamp);
+}
+
+void MessageListModel::reset()
+{
+    beginResetModel();
+    m_messages.clear();
+    m_active = true;
+    m_loadingOlder = false;
+    m_olderExhausted = false;
+    endResetModel();
+}
+
+void MessageListModel::appendLive(const std::vector<client::core::Message> &messages)
+{
+    if (messages.empty()) {
+        return;
+    }
+    const int first = rowCount();
+    beginInsertRows(QModelIndex(), first, first + static_cast<int>(messages.size()) - 1);
+    m_messages.insert(m_messages.end(), messages.begin(), messages.end());
+    endInsertRows();
+    trimOldest();
+}
+
+void MessageListModel::addOlder(const std::vector<client::core::Message> &messages)
+{
+    if (!m_loadingOlder) {
+        // Asked for before the model was reset.
+        return;
+    }
+    m_loadingOlder = false;
+    // Live messages that came while the first page was on its way are in it too.
+    std::vector<client::core::Message> older;
+    for (const auto &message : messages) {
+        if (m_messages.empty() || message.timestamp < m_messages.front().timestamp) {
+            older.push_back(message);
+        }
+    }
+    m_olderExhausted = messages.empty();
+    if (older.empty()) {
+        return;
+    }
+    beginInsertRows(QModelIndex(), 0, static_cast<int>(older.size()) - 1);
+    m_messages.insert(m_messages.begin(), older.rbegin(), older.rend());
+    endInsertRows();
+}
+
+void MessageListModel::removeMessages(const std::vector<int32_t> &messageIds)
+{
+    for (int32_t messageId : messageIds) {
+        auto it = std::find_if(m_messages.begin(), m_messages.end(),
+                               [messageId](const auto &message) { return message.messageId == messageId; });
+        if (it == m_messages.end()) {
+            continue;
+        }
+        const int row = static_cast<int>(it - m_messages.begin());
+        beginRemoveRows(QModelIndex(), row, row);
+        m_messages.erase(it);
+        endRemoveRows();
+    }
+}
+
+void MessageListModel::trimOldest()
+{
+    // A page on its way continues from the oldest row, which must stay until it is in.
+    if (m_messages.size() <= static_cast<size_t>(MAX_ROWS) || m_loadingOlder) {
+        return;
+    }
+    const int excess = static_cast<int>(m_messages.size()) - MAX_ROWS;
+    beginRemoveRows(QModelIndex(), 0, excess - 1);
+    m_messages.erase(m_messages.begin(), m_messages.begin() + excess);
+    endRemoveRows();
+    // They are still in the history, scrolling up brings them back.
+    m_olderExhausted = false;
+}
+
+}  // namespace qt
@@ -1,9 +1,22 @@
 #include <ui/mainwindow.h>
 #include <QApplication>
+#include <drogon/HttpAppFramework.h>
+#include <thread>
 
 int main(int argc, char *argv[]) {
     QApplication a(argc, argv);
-    MainWindow w;
-    w.show();
-    return a.exec();
+
+    // The client core runs its connection on drogon's loop, in a background thread.
+    std::thread drogonThread([] { drogon::app().run(); });
+
+    int result = 0;
+    {
+        MainWindow w;
+        w.show();
+        result = a.exec();
+    }
+
+    drogon::app().quit();
+    drogonThread.join();
+    return result;
 }
@@ -1,5 +1,6 @@
 #include <ui/connectwidget.h>
 #include "ui_connectwidget.h"
+#include <QUrl>
 
 ConnectWidget::ConnectWidget(QWidget *parent) :
     QWidget(parent),
@@ -14,3 +15,10 @@ ConnectWidget::~ConnectWidget() {
     delete ui;
 }
 
+QString ConnectWidget::address() const {
+    QUrl url(ui->serverAddressLineEdit->text().trimmed());
+    if (ui->portSpinBox->value() > 0) {
+        url.setPort(ui->portSpinBox->value());
+    }
+    return url.toString();
+}
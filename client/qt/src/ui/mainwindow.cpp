@@ -9,16 +9,18 @@ MainWindow::MainWindow(QWidget *parent)
     // Start on the connect page (index 0)
     ui->stackedWidget->setCurrentIndex(0);
 
-    // Logic 1: When the connect page's button is clicked...
+    // Logic 1: When the connect page's button is clicked, connect to the address entered
     connect(ui->connectPage, &ConnectWidget::connectClicked, this, [this]() {
-        // ...switch the stacked widget to the login page (index 1)
-        ui->stackedWidget->setCurrentIndex(1);
+        m_backend.connectToServer(ui->connectPage->address());
     });
 
-    // Logic 2: When the login page's button is clicked...
-    connect(ui->loginPage, &LoginScreen::disconnectClicked, this, [this]() {
-        // ...switch the stacked widget back to the connect page (index 0)
-        ui->stackedWidget->setCurrentIndex(0);
+    // Logic 2: When the login page's button is clicked, drop the connection
+    connect(ui->loginPage, &LoginScreen::disconnectClicked, &m_backend, &qt::Backend::disconnectFromServer);
+
+    // Logic 3: Follow the screen the session asks for
+    connect(&m_backend, &qt::Backend::screenRequested, this, [this](qt::Backend::Screen screen) {
+        // Only the connect and login pages exist so far
+        ui->stackedWidget->setCurrentIndex(screen == qt::Backend::Screen::Initial ? 0 : 1);
     });
 }
 
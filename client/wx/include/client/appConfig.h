@@ -32,6 +32,9 @@ public:
     // Removes all occurrences of a server.
     void removeServer(const std::string& server);
 
+    // Directory holding the config file and the other per-user data, like the message history.
+    const wxString& GetDataDir() const;
+
 private:
     // Helper to initialize the path. Called from the constructor.
     void InitPath();
@@ -39,6 +42,7 @@ private:
     void ReadConfig();
 
     Json::Value m_root;
+    wxString m_dataDir;
     wxString m_configFilePath;
     wxSingleInstanceChecker* m_instanceChecker;
     bool m_isFirstInstance;
@@ -1,13 +1,13 @@
 #pragma once
 
 #include <wx/control.h>
-#include <wx/bitmap.h>
 #include <wx/stattext.h>
 
 namespace client {
 
 // This class behaves like a wxStaticText for layout and API purposes,
-// but is built on a reliable, paintable base.
+// but is built on a reliable, paintable base. Its lines are drawn from the
+// shared LineBitmapCache, so identical labels are only rasterized once.
 class CachedColorText : public wxControl {
 public:
     CachedColorText(wxWindow* parent, wxWindowID id, const wxString& label,
@@ -18,8 +18,6 @@ public:
     virtual wxString GetLabel() const override;
     virtual bool SetFont(const wxFont& font) override;
 
-    void InvalidateCache();
-    void InvalidateCacheAndRefresh();
     void InvalidateLayoutCaches();
 protected:
     virtual wxSize DoGetBestSize() const override;
@@ -28,13 +26,12 @@ private:
     void OnPaint(wxPaintEvent& event);
     void OnSize(wxSizeEvent& event);
     void OnSysColourChanged(wxSysColourChangedEvent& event);
-    void RenderToCache();
+    void DrawLabel(wxDC& dc);
     wxDouble GetLineHeight() const;
 
     bool m_stretchesToParentWidth;
 
     wxString m_label;
-    wxBitmap m_cache;
 
     mutable wxSize m_cachedBestSize;
     mutable double m_cachedLineHeight;
@@ -9,6 +9,8 @@ wxDECLARE_EVENT(wxEVT_ASSIGN_MODERATOR, wxCommandEvent);
 wxDECLARE_EVENT(wxEVT_UNASSIGN_MODERATOR, wxCommandEvent);
 wxDECLARE_EVENT(wxEVT_TRANSFER_OWNERSHIP, wxCommandEvent);
 wxDECLARE_EVENT(wxEVT_DELETE_MESSAGE, wxCommandEvent);
+wxDECLARE_EVENT(wxEVT_DELETE_USER_MESSAGES, wxCommandEvent);
+wxDECLARE_EVENT(wxEVT_REQUEST_MEMBERS, wxCommandEvent);
 
 class MainWidget;
 class UserListPanel;
@@ -35,8 +37,10 @@ public:
     const User& GetCurrentUser() const;
     void UserStartedTyping(const User& user);
     void UserStoppedTyping(const User& user);
+    void SetTypingUsers(const std::vector<User>& users);
     void UserJoin(const User& user);
     void UserLeft(const User& user);
+    void ApplyPresence(const std::vector<User>& newMembers, const std::vector<User>& joined, const std::vector<User>& left);
     void UpdateUsername(int32_t userId, const wxString& newUsername);
 
     UserListPanel* m_userListPanel = nullptr;
@@ -80,6 +84,8 @@ private:
     void OnUnassignModerator(wxCommandEvent& event);
     void OnTransferOwnership(wxCommandEvent& event);
     void OnDeleteMessage(wxCommandEvent& event);
+    void OnDeleteUserMessages(wxCommandEvent& event);
+    void OnRequestMembers(wxCommandEvent& event);
     void OnTypingTimer(wxTimerEvent& event);
     wxDECLARE_EVENT_TABLE();
 };
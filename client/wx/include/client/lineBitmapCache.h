@@ -0,0 +1,100 @@
+#pragma once
+
+#include <wx/bitmap.h>
+#include <wx/colour.h>
+#include <wx/font.h>
+#include <wx/string.h>
+#include <chrono>
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+
+namespace client {
+
+/**
+ * @class LineBitmapCache
+ * @brief Rasterized lines of text, shared by every widget that draws text.
+ *
+ * A line is drawn once per font and colour pair into its own bitmap, which is then only
+ * blitted. Lines are the output of the wrapping, so the wrap width is part of the text
+ * itself: the same message at the same width hits the same entries however often it is
+ * scrolled out of view and back. The least recently drawn lines are evicted once the
+ * bitmaps exceed MAX_BYTES, and TrimIdle() drops the lines no widget has drawn for
+ * IDLE_TIMEOUT, so the lines of rooms left long ago don't hold their peak for the rest of
+ * the session.
+ *
+ * The bitmaps are opaque, the background colour is part of the key. Entries of a previous
+ * colour scheme are never hit again and simply age out.
+ *
+ * Only used from the UI thread.
+ */
+class LineBitmapCache {
+public:
+    static LineBitmapCache& Get();
+
+    /**
+     * @brief Returns the bitmap of a single line of text, drawing it on a miss.
+     * @return An invalid bitmap for an empty line. The reference stays valid until the next call.
+     */
+    const wxBitmap& GetLine(const wxString& line, const wxFont& font, const wxColour& foreground, const wxColour& background);
+
+    /// @brief The counters of the cache since it was created, for the logs and the benchmarks.
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evicted = 0; // Over the budget or idle.
+        size_t entries = 0;
+        size_t bytes = 0;
+    };
+    Stats GetStats() const;
+
+    // Drops the lines not drawn within IDLE_TIMEOUT. Cheap, the oldest are at the back.
+    void TrimIdle();
+    void Clear();
+
+private:
+    LineBitmapCache() = default;
+    LineBitmapCache(const LineBitmapCache&) = delete;
+    LineBitmapCache& operator=(const LineBitmapCache&) = delete;
+
+    struct Key {
+        wxString line;
+        wxString font; // Native description of the font.
+        wxUint32 foreground;
+        wxUint32 background;
+
+        bool operator==(const Key&) const = default;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+
+    struct Entry {
+        Key key;
+        wxBitmap bitmap;
+        size_t bytes;
+        std::chrono::steady_clock::time_point drawn; // Last blitted.
+    };
+
+    wxBitmap Render(const wxString& line, const wxFont& font, const wxColour& foreground, const wxColour& background) const;
+    void Evict();
+    void PopOldest();
+
+    // Most recently drawn first.
+    std::list<Entry> m_entries;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+    size_t m_bytes = 0;
+    size_t m_hits = 0;
+    size_t m_misses = 0;
+    size_t m_evicted = 0;
+
+    // The description of the last font looked up, fonts change far less often than lines.
+    wxFont m_lastFont;
+    wxString m_lastFontDesc;
+
+    static const size_t MAX_BYTES = 32 * 1024 * 1024;
+    static constexpr std::chrono::minutes IDLE_TIMEOUT{5};
+};
+
+} // namespace client
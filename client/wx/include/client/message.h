@@ -1,15 +1,32 @@
 #pragma once
 
 #include <wx/wx.h>
+#include <memory>
+#include <string>
+#include <string_view>
 
 namespace client {
 
+// A username, one string shared by every message carrying it.
+using UserName = std::shared_ptr<const wxString>;
+
+// The names messages are attributed with. A name is converted from UTF-8 the first time it
+// is seen, later messages by the same author only take a reference. Callable from any thread.
+namespace UserNames {
+    UserName Intern(std::string_view utf8);
+    UserName Intern(const wxString& name);
+} // namespace UserNames
+
+// A message as the client keeps it, the text in UTF-8 as the server sent it. Buffered
+// messages stay like this, only the rows of MessageView convert the text and format the time.
 struct Message {
-    wxString user;
+    UserName user;
     int32_t userId;
-    wxString msg;
+    std::string msg; // UTF-8.
     int64_t timestamp;
     int32_t messageId;
+    int64_t seq = 0; // Number of the message in its room, 0 when unknown.
+    std::string clientKey; // Of a message this client sent, see ChatSession::sendMessage().
 };
 
 } // namespace client
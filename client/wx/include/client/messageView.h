@@ -2,63 +2,110 @@
 
 #include <wx/wx.h>
 #include <wx/vscroll.h>
+#include <wx/graphics.h>
 #include <client/message.h>
+#include <client/textUtil.h>
+#include <algorithm>
+#include <chrono>
 #include <deque>
+#include <string>
+#include <unordered_set>
 #include <vector>
 
 namespace client {
 
-template<typename T>
-class GenericCacher {
-private:
-    std::deque<T*> pool_;
+class ChatPanel;
 
+// Tops of a sequence of rows, kept as running sums so rows can be added or removed at
+// either end in constant time, and the row at a given y is found by binary search.
+// Positions are absolute, the first row is at Top(0) == 0 whatever was popped before it.
+class HeightIndex {
 public:
-    // Get an instance: return cached one if available, otherwise construct a new one
-    template<typename... Args>
-    T* get_instance(Args&&... args) {
-        if (!pool_.empty()) {
-            T* obj = std::move(pool_.front());
-            pool_.pop_front();
-            obj->Update(std::forward<Args>(args)...);
-            return obj;
-        } else {
-            T* obj = new T(std::forward<Args>(args)...);
-            return obj;
-        }
+    void PushBack(wxCoord height) {
+        m_starts.push_back(m_end);
+        m_end += height;
     }
 
-    // Return an instance back to the cacher
-    void return_instance(T*&& obj) {
-        obj->Hide();
-        pool_.emplace_back(std::move(obj));
+    void PushFront(wxCoord height) {
+        m_starts.push_front((m_starts.empty() ? m_end : m_starts.front()) - height);
     }
 
-    // Optional: Return an instance without moving (if you need to reuse it in-place)
-    void return_instance(const T*& obj) {
-        obj->Hide();
-        pool_.push_back(obj);
+    void PopBack() {
+        m_end = m_starts.back();
+        m_starts.pop_back();
     }
 
-    // Optional: Clear the pool
-    void clear() {
-        pool_.clear();
+    void PopFront() {
+        m_starts.pop_front();
     }
 
-    // Optional: Check if the pool is empty
-    bool empty() const {
-        return pool_.empty();
+    // Linear, the rows below move up.
+    void Erase(size_t index) {
+        const int64_t height = Bottom(index) - m_starts[index];
+        m_starts.erase(m_starts.begin() + index);
+        for(size_t i = index; i < m_starts.size(); ++i) {
+            m_starts[i] -= height;
+        }
+        m_end -= height;
     }
 
-    // Optional: Get current number of cached instances
-    size_t size() const {
-        return pool_.size();
+    // Replaces every row, for when all heights change at once.
+    template<typename Heights>
+    void Rebuild(const Heights& heights) {
+        Clear();
+        for(wxCoord height : heights) {
+            PushBack(height);
+        }
+    }
+
+    void Clear() {
+        m_starts.clear();
+        m_end = 0;
+    }
+
+    size_t Size() const { return m_starts.size(); }
+    wxCoord Top(size_t index) const { return static_cast<wxCoord>(m_starts[index] - Origin()); }
+    wxCoord Total() const { return static_cast<wxCoord>(m_end - Origin()); }
+
+    // Index of the row containing y, or Size() if y is outside every row.
+    size_t RowAt(wxCoord y) const {
+        if(y < 0 || y >= Total()) {
+            return Size();
+        }
+        // The last row starting at or above y.
+        auto it = std::upper_bound(m_starts.begin(), m_starts.end(), Origin() + y);
+        return static_cast<size_t>(it - m_starts.begin()) - 1;
     }
+
+private:
+    int64_t Origin() const { return m_starts.empty() ? m_end : m_starts.front(); }
+    int64_t Bottom(size_t index) const { return index + 1 < m_starts.size() ? m_starts[index + 1] : m_end; }
+
+    std::deque<int64_t> m_starts; // Start of every row.
+    int64_t m_end = 0;            // Bottom of the last row.
 };
 
-class ChatPanel;
-class MessageWidget;
+// Whether a row's message reached the server. A message sent from here is shown at once,
+// pending until the server confirms it and failed if it refused it.
+enum class Delivery { Sent, Pending, Failed };
+
+// One message of the view, together with its layout at the view's current width.
+// Unlike a buffered Message, its text and time are converted for display.
+struct MessageRow {
+    UserName user;
+    int32_t userId = 0;
+    int64_t timestamp = 0;
+    int32_t messageId = 0;
+    wxString time;              // The formatted timestamp.
+    TextUtil::WrappedText text; // The message text and its wrapping.
+    wxCoord height = 0;         // Height of the whole row, header included.
+    std::string clientKey;      // Of a message sent from here, until its broadcast came.
+    Delivery delivery = Delivery::Sent;
+};
 
+// Owner-drawn list of messages. There is no window per message: rows are plain data,
+// and only the ones intersecting the visible area are painted. Scroll units stay one
+// pixel each so scrolling is smooth, row offsets come from a prefix sum of the row heights.
 class MessageView : public wxVScrolledWindow {
 public:
     // Constructor no longer takes initialWrapWidth, it's set later.
@@ -70,11 +117,21 @@ public:
     void ReWrapAllMessages(int wrapWidth);
     void Clear();
     void JumpToPresent();
+    // Rebuilds the rows around a message of the room, from a search hit or a reply, and
+    // centers it. The view pages older and newer from there as it is scrolled.
+    void JumpToMessage(int32_t messageId);
+    void OnMessagesAround(int32_t messageId, const std::vector<Message>& messages, bool hasOlder, bool hasNewer);
     void DeleteMessageById(int32_t messageId);
     void UpdateUsername(int32_t userId, const wxString& newUsername);
+    // Shows a message being sent at the bottom, if the view is at the present. It is
+    // reconciled with its confirmation or its broadcast, whichever comes first.
+    void AddPending(const Message& message);
+    // Gives a pending message the id and timestamp the server assigned.
+    void ConfirmPending(const Message& message);
+    // Marks a pending message as not sent. False if it is not shown.
+    bool FailPending(const std::string& clientKey);
 
     void InvalidateCaches();
-    void UpdateWidgetPositions();
 protected:
     virtual void DoSetSize(int x, int y, int width, int height, int sizeFlags = wxSIZE_AUTO) override;
 
@@ -85,34 +142,98 @@ protected:
     }
 
 private:
-    void OnSize(wxSizeEvent& event);
     void OnPaint(wxPaintEvent& event);
-    void OnScroll(wxScrollWinEvent& event);
     void OnMouseWheel(wxMouseEvent& event);
+    void OnMouseMove(wxMouseEvent& event);
+    void OnMouseLeave(wxMouseEvent& event);
+    void OnRightClick(wxMouseEvent& event);
+    void OnSysColourChanged(wxSysColourChangedEvent& event);
     void OnScrolled();
-    void UpdateLayoutAndScroll(const std::vector<Message>& messages, bool isHistoryResponse);
-    
-    void AddMessageWidget(const Message& msg, bool prepend);
-    int TrimWidgets(bool fromTop);
-    void LoadOlderMessages();
-    void LoadNewerMessages();
-    wxCoord CalculateTotalHeight() const;
+    void UpdateLayoutAndScroll(const std::vector<Message>& messages, bool prepend, bool isHistoryResponse);
+
+    void AddRow(const Message& msg, bool prepend);
+    // Moves the rows beyond MAX_MESSAGES into the buffer on their side.
+    int TrimRows(bool fromTop);
+    void LoadOlderMessages(int count);
+    void LoadNewerMessages(int count);
+    // Turns buffered messages into rows while the visible area is near an end of the rows.
+    void FillFromBuffers();
+    // Asks for the next page on a side whose buffer holds less than WantedBuffer().
+    void Prefetch();
+    // Messages to keep buffered on a side: a page, plus what the current scrolling
+    // towards it would go through in PREFETCH_SECONDS.
+    size_t WantedBuffer(bool older) const;
+    void UpdateScrollVelocity();
+    // Pixels per second, positive downwards, zero once scrolling paused.
+    double ScrollVelocity() const;
     void UpdateSnapState(bool isSnapped);
     bool IsSnappedToBottom() const;
     void CheckAndUpdateSnapState();
 
+    // Wraps a row at the current width and updates its height.
+    void LayoutRow(MessageRow& row);
+    // Recomputes the fonts and line heights rows are laid out with.
+    void UpdateMetrics();
+    // Resizes the scrolled area to the height of all rows.
+    void UpdateUnitCount();
+    wxCoord CalculateTotalHeight() const;
+    // Index of the row at a content y coordinate, or m_rows.size() if there is none.
+    size_t RowAt(wxCoord y) const;
+    // Points m_hoveredRow at the row under the mouse, after the rows or the scroll position moved.
+    void UpdateHoveredRow();
+    void DrawRow(wxGraphicsContext* gc, wxDC& dc, const MessageRow& row, wxCoord top, wxCoord width, bool hovered) const;
+    // The row of a message sent from here, or nullptr.
+    MessageRow* FindOwnRow(const std::string& clientKey);
+    // Reconciles the broadcasts of the messages sent from here with their rows, and leaves the other messages.
+    std::vector<Message> ReconcileOwnMessages(const std::vector<Message>& messages);
+
     ChatPanel* m_chatPanelParent;
-    std::deque<MessageWidget*> m_messageWidgets;
-    GenericCacher<MessageWidget> m_widgetsPool;
+    std::deque<MessageRow> m_rows;
+    // Tops of m_rows, updated along with it.
+    HeightIndex m_heights;
+
+    // Layout metrics, see UpdateMetrics().
+    wxFont m_userFont;
+    wxFont m_timeFont;
+    wxDouble m_lineHeight = 0.0;
+    wxCoord m_headerHeight = 0;
+
+    wxBitmap m_backBuffer;
+    size_t m_hoveredRow;
 
     bool m_loadingOlder;
     bool m_loadingNewer;
+    // The message JumpToMessage() waits for the window of, 0 when none.
+    int32_t m_jumpTarget = 0;
+
+    // Decoded messages just beyond the rows, shown without waiting once scrolled to.
+    // The older one is newest first and the newer one oldest first, so both continue
+    // the rows from their front. Rows trimmed from the view go back into them.
+    std::deque<Message> m_olderBuffer;
+    std::deque<Message> m_newerBuffer;
+    // Keys of the rows sent from here whose broadcast did not come yet.
+    std::unordered_set<std::string> m_ownKeys;
+    // Whether the buffer on a side reaches the first message of the room, or the present.
+    bool m_olderExhausted = false;
+    bool m_newerExhausted = true;
+
+    double m_scrollVelocity = 0.0;
+    wxCoord m_lastScrollPos = 0;
+    std::chrono::steady_clock::time_point m_lastScrollTime;
     int m_lastKnownWrapWidth;
     bool m_lastKnownSnapState;
 
-    static const int MAX_MESSAGES = 100;
-    static const int CHUNK_SIZE = 25;
-    static const int LOAD_THRESHOLD_ROWS = 10;
+    static const int MAX_MESSAGES = 2000;
+    static constexpr int CHUNK_SIZE = 25;
+    static constexpr int MAX_PAGE_SIZE = 100;
+    // Messages asked for on each side of the one jumped to.
+    static constexpr int JUMP_CONTEXT = 2 * CHUNK_SIZE;
+    static constexpr size_t MAX_BUFFERED = 500;
+    // Rows are added from a buffer once the visible area is this close to their end.
+    static constexpr int LOAD_THRESHOLD_DIP = 500;
+    static constexpr double PREFETCH_SECONDS = 1.5;
+    // A pause this long between scroll events ends a fling.
+    static constexpr double SCROLL_IDLE_SECONDS = 0.5;
     const int SCROLL_STEP = 1;//FromDIP(10);
 };
 
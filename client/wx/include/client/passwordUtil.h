@@ -1,6 +1,8 @@
 #pragma once
 
 #include <string>
+#include <functional>
+#include <optional>
 #include <stdint.h>
 
 namespace client {
@@ -17,6 +19,18 @@ std::string hash_password(const std::string& password, const std::string& salt);
 
 std::string generate_salt();
 
+// Gets the hash, or nullopt and the reason hashing failed. Always called on the UI thread.
+using HashCallback = std::function<void(std::optional<std::string> hash, const std::string& error)>;
+
+// Runs hash_password on a background worker, so a login doesn't freeze the UI for the
+// duration of argon2. `done` is posted back with CallAfter.
+void hash_password_async(std::string password, std::string salt, HashCallback done);
+
+// Same as hash_password_async, but remembers the derived key per (server, user) for the
+// lifetime of the app: logging in again with the same password and salt doesn't rehash,
+// `done` is then called right away. Only call from the UI thread.
+void derive_key_async(const std::string& server, const std::string& user,
+                      std::string password, std::string salt, HashCallback done);
 
 } // namespace password
 
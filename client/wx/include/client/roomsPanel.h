@@ -2,6 +2,12 @@
 
 #include <wx/wx.h>
 #include <wx/notebook.h>
+#include <wx/srchctrl.h>
+#include <wx/vlbox.h>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
 
 namespace client {
 
@@ -11,9 +17,60 @@ struct Room : public wxClientData {
     int32_t room_id;
     wxString room_name;
     bool is_member;
+    int64_t unread = 0;
 
-    Room(int32_t id, const wxString& name, bool member)
-        : room_id(id), room_name(name), is_member(member) {}
+    Room(int32_t id, const wxString& name, bool member, int64_t unread_ = 0)
+        : room_id(id), room_name(name), is_member(member), unread(unread_) {}
+
+    // The name as listed, with the count of unread messages.
+    wxString Label() const { return unread > 0 ? wxString::Format("%s (%lld)", room_name, static_cast<long long>(unread)) : room_name; }
+};
+
+// The rooms of one page, sorted by name ignoring case, drawn only as far as they are visible.
+// Rooms are inserted and erased where they sort, and the filter narrows the rooms shown to
+// those whose name contains it. The rooms are owned by the panel.
+class RoomListView : public wxVListBox {
+public:
+    RoomListView(wxWindow* parent, wxWindowID id);
+
+    // Replaces the rooms, given in any order.
+    void SetRooms(const std::vector<Room*>& rooms);
+    // Inserts a room, returns its row or wxNOT_FOUND when the filter hides it.
+    int Insert(Room* room);
+    // Erases a room, call before its name changes.
+    void Erase(const Room* room);
+    // Redraws a room whose label changed but not its name.
+    void RefreshRoom(const Room* room);
+    // Shows only the rooms whose name contains `filter`, ignoring case.
+    void SetFilter(const wxString& filter);
+
+    // The row of a room, or wxNOT_FOUND when it is not shown.
+    int FindRow(const Room* room) const;
+    Room* GetSelectedRoom() const;
+
+protected:
+    virtual void OnDrawItem(wxDC& dc, const wxRect& rect, size_t n) const override;
+    virtual wxCoord OnMeasureItem(size_t n) const override;
+
+private:
+    struct Entry {
+        // The name in lower case, what the rooms are sorted and filtered by.
+        wxString key;
+        Room* room;
+    };
+
+    bool Matches(const Entry& entry) const;
+    // The rooms shown, all of them while there is no filter.
+    const std::vector<Entry>& Shown() const { return m_filter.empty() ? m_sorted : m_shown; }
+    // Sets the row count and keeps `selected` selected if it is still shown.
+    void RowsChanged(const Room* selected);
+    void OnDPIChanged(wxDPIChangedEvent& event);
+    void UpdateMetrics();
+
+    std::vector<Entry> m_sorted;
+    std::vector<Entry> m_shown;
+    wxString m_filter;
+    wxCoord m_rowHeight = 0;
 };
 
 class RoomsPanel : public wxPanel {
@@ -23,7 +80,10 @@ public:
     void AddRoom(Room* room);
     void RemoveRoom(int32_t room_id);
     void RenameRoom(int32_t room_id, const wxString& name);
+    void SetUnread(int32_t room_id, int64_t unread);
     std::optional<Room> GetSelectedRoom();
+    // Selects a listed room without joining it, e.g. the one rejoined after a reconnect.
+    void SelectRoom(int32_t room_id);
     void OnJoinRoom();
     void OnBecameMember();
 
@@ -34,11 +94,19 @@ private:
     void OnCreate(wxCommandEvent&);
     void OnLogout(wxCommandEvent&);
     void OnAccount(wxCommandEvent&);
+    void OnFilter(wxCommandEvent&);
+
+    // The page listing a room.
+    RoomListView* ListOf(const Room& room) const { return room.is_member ? m_myRoomsList : m_publicRoomsList; }
+    Room* FindRoom(int32_t room_id) const;
 
     MainWidget* mainWin;
+    // Every room listed, by ID. The pages only hold pointers to them.
+    std::unordered_map<int32_t, std::unique_ptr<Room>> m_rooms;
+    wxSearchCtrl* m_filter;
     wxNotebook* m_notebook;
-    wxListBox* m_myRoomsList;
-    wxListBox* m_publicRoomsList;
+    RoomListView* m_myRoomsList;
+    RoomListView* m_publicRoomsList;
     wxButton* m_joinButton;
     wxButton* m_createButton;
     wxButton* m_logoutButton;
@@ -1,16 +1,22 @@
 #pragma once
 
 #include <wx/wx.h>
+#include <client/core/model.h>
+#include <vector>
 
 namespace client {
 
 class MainWidget;
 
+// A server as listed to the user, with what the client measured and the server reported.
+using ServerEntry = core::ServerEntry;
+
 class ServersPanel : public wxPanel {
 public:
     ServersPanel(MainWidget* parent);
 
-    void SetServers(const std::vector<std::string>& servers);
+    // Lists the servers in the given order and preselects the first, unless the user picked one.
+    void SetServers(const std::vector<ServerEntry>& servers);
 private:
     // --- Event Handlers ---
     void OnConnect(wxCommandEvent& event);
@@ -26,6 +32,10 @@ private:
     wxListBox* m_listBox;
     wxButton* m_connectButton;
     wxButton* m_backButton;
+
+    // Hosts in the order of the list box rows, the rows also show RTT and load.
+    std::vector<std::string> m_hosts;
+    bool m_userSelected = false;
 };
 
 } // namespace client
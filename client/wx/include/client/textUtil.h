@@ -4,6 +4,7 @@
 #include <wx/font.h>
 #include <wx/window.h> // Required for wxClientDC in the implementation
 #include <wx/textctrl.h>
+#include <vector>
 
 namespace client {
 
@@ -11,8 +12,40 @@ namespace TextUtil {
     // Function to manually wrap text based on a given width and font.
     // 'targetWindow' is needed for the wxClientDC to measure text.
     // This minimalist version iterates character by character and will break words mid-way if needed.
+    // Glyph advances are cached per font, so only characters not seen before are measured.
     wxString WrapText(wxWindow* targetWindow, const wxString& text, int wrapWidth, const wxFont& font);
 
+    /**
+     * @brief A text kept together with its measurements and its last wrapping.
+     *
+     * The advances of the text are taken once per font, re-wrapping at another width only
+     * re-runs the line breaking over them, and wrapping at the same width, or at any width
+     * the unbroken lines still fit in, returns the previous result as it is.
+     * Wraps exactly like WrapText.
+     */
+    class WrappedText {
+    public:
+        // Replaces the text, dropping its measurements.
+        void SetText(const wxString& text);
+        const wxString& GetText() const { return m_text; }
+
+        // Returns the text wrapped at wrapWidth, the text itself on a non-positive width.
+        const wxString& Wrap(int wrapWidth, const wxFont& font);
+        // Returns the result of the last Wrap().
+        const wxString& GetWrapped() const { return m_wrapWidth > 0 ? m_wrapped : m_text; }
+
+    private:
+        wxString m_text;
+        wxFont m_font;                   // Font the advances were taken with.
+        std::vector<size_t> m_starts;    // Index of every code point in m_text, plus its length.
+        std::vector<wxDouble> m_advances; // Width of every code point, negative for newlines.
+
+        int m_wrapWidth = -1;            // Width m_wrapped was broken at.
+        wxString m_wrapped;
+        size_t m_softBreaks = 0;         // Breaks of m_wrapped that are not newlines.
+        wxDouble m_widestLine = 0.0;
+    };
+
     void LimitTextLength(wxTextCtrl* textEntry, size_t maxLength);
 
     /**
@@ -23,13 +56,13 @@ namespace TextUtil {
      * 2. On Windows (where wxString is UTF-16), it validates the string to ensure that
      *    every high surrogate is immediately followed by a low surrogate. If an invalid
      *    or "lone" surrogate is found, the function fails.
-     * 3. It checks that the resulting string contains at least one character from the
-     *    Basic Multilingual Plane (BMP), i.e., a code point U+0000 to U+FFFF.
+     * 3. It checks that the resulting string contains at least one letter or digit,
+     *    as the server does for user and room names (common::containsAlphanumeric).
      *
      * @param input The wxString to be sanitized.
      * @return The sanitized string if all checks pass. Returns an empty wxString if
      *         the input is empty after trimming, if the surrogate validation fails,
-     *         or if no BMP characters are found.
+     *         or if no letter or digit is found.
      */
     wxString SanitizeInput(const wxString& input);
 
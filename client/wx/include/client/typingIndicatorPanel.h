@@ -11,6 +11,7 @@ namespace client {
 
         void AddTypingUser(const wxString& username);
         void RemoveTypingUser(const wxString& username);
+        void SetTypingUsers(std::vector<wxString> usernames);
         void Clear();
 
     private:
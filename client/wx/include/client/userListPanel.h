@@ -1,10 +1,41 @@
 #pragma once
 
 #include <wx/wx.h>
+#include <wx/vscroll.h>
+#include <client/user.h>
+#include <functional>
+#include <optional>
+#include <unordered_map>
+#include <vector>
 
 namespace client {
 
-struct User;
+// Owner-drawn rows of the user list, one per entry of the sorted roster it is given.
+// Every row has the same height, so the visible rows are found without any layout.
+class UserListView : public wxVScrolledWindow {
+public:
+    UserListView(wxWindow* parent, const std::vector<const User*>& users);
+
+    // Call after the roster changed.
+    void RosterChanged();
+    // The user under a point of the window, or nullptr.
+    const User* UserAt(const wxPoint& pos) const;
+    // Called when a paint shows rows close to the end of the roster.
+    void SetNearEndHandler(std::function<void()> handler);
+
+protected:
+    virtual wxCoord OnGetRowHeight(size_t row) const override;
+
+private:
+    void OnPaint(wxPaintEvent& event);
+    void OnDPIChanged(wxDPIChangedEvent& event);
+    void UpdateMetrics();
+
+    const std::vector<const User*>& m_users;
+    std::function<void()> m_nearEnd;
+    wxCoord m_rowHeight = 0;
+    wxBitmap m_backBuffer;
+};
 
 class UserListPanel : public wxPanel {
 public:
@@ -13,16 +44,44 @@ public:
     void SetUserList(std::vector<User> users);
     void AddUser(const User& user);
     void RemoveUser(int32_t userId);
+    void ApplyPresence(const std::vector<User>& newMembers, const std::vector<User>& joined, const std::vector<User>& left);
     void Clear();
     void UpdateUserRole(int32_t userId, chat::UserRights newRole);
     void UpdateUsername(int32_t userId, const wxString& newUsername);
 
+    // How many members the room has, the roster only holds those paged in so far.
+    void SetMemberCount(uint32_t count);
+    // Pages the members absent from the roster in, as the list is scrolled towards its end.
+    void StartMemberPaging();
+    // A page of members, in the server's order. `more` when another page follows.
+    void AddMembers(const std::vector<User>& members, bool more);
+    // The last member paged in, where the next page starts.
+    const std::optional<User>& GetLastMember() const { return m_lastMember; }
+
 private:
     void OnUserRightClick(wxMouseEvent& event);
 
-    wxScrolledWindow* m_userContainer;
-    wxBoxSizer* m_userSizer;
-    std::vector<User> m_users;
+    // Adds a user not in the roster yet.
+    void Insert(const User& user);
+    // Changes a user in place and moves it to its new position. Returns false if the user isn't in the roster.
+    template<typename Change>
+    bool Update(int32_t userId, Change&& change);
+    void Erase(int32_t userId);
+    void SyncCurrentUser(const User& user);
+    void RequestMembers();
+    void UpdateHeader();
+
+    wxStaticText* m_header;
+    UserListView* m_userContainer;
+    // The roster, and the same users in display order. Map nodes are stable, so the order
+    // points into them and a user is found in it by binary search on its current sort key.
+    std::unordered_map<int32_t, User> m_users;
+    std::vector<const User*> m_order;
+
+    uint32_t m_memberCount = 0;
+    bool m_moreMembers = false;
+    bool m_loadingMembers = false;
+    std::optional<User> m_lastMember;
 };
 
 } // namespace client
@@ -1,76 +1,57 @@
 #pragma once
 
-#include <wx/string.h>
-#include <wx/datetime.h>
-#include <wx/longlong.h>
-#include <drogon/WebSocketClient.h>
-#include <optional>
+#include <client/core/session.h>
+#include <client/message.h>
 
 namespace client {
 
 class MainWidget;
-struct Room;
-struct Message;
-struct User;
 
-class WebSocketClient {
+// The chat session of the wx client: what the session reports is converted to wx types
+// here, on the network thread, and handed to the widgets on the UI thread.
+class WebSocketClient : private core::SessionListener, public core::ChatSession {
 public:
     explicit WebSocketClient(MainWidget* ui);
-
-    void start(const std::string& address);
-    void stop();
-    
-    void requestInitialRegister(const std::string& username);
-    void requestInitialAuth(const std::string& username);
-    void completeRegister(const std::string& hash, const std::string& salt);
-    void completeAuth(const std::string& hash, const std::optional<std::string>& password, const std::optional<std::string>& salt);
-    void createRoom(const std::string& roomName);
-    void joinRoom(int32_t room_id);
-    void leaveRoom();
-    void sendMessage(const std::string& message);
-    void getMessages(int32_t limit, int64_t offset_ts);
-    void logout();
-    void getServers();
-    void renameRoom(int32_t roomId, const std::string& newName);
-    void deleteRoom(int32_t roomId);
-    void assignRole(int32_t roomId, int32_t userId, chat::UserRights role);
-    void deleteMessage(int32_t messageId);
-    void sendTypingStart();
-    void sendTypingStop();
-    void becomeMember(int32_t roomId);
-    void changeUsername(const std::string& username);
-    void requestMySalt();
-    void changePassword(const std::string& old_hash, const std::string& new_hash, const std::string& new_salt);
-
-    static std::string formatMessageTimestamp(int64_t timestamp);
+    ~WebSocketClient() override;
 
 private:
-    void sendEnvelope(const chat::Envelope& env);
-    void handleMessage(const std::string& msg);
+    static Message toMessage(const core::Message& message);
+
+    void onError(const std::string& message) override;
+    void onInfo(const std::string& message) override;
+    void onShowInitial() override;
+    void onShowServers() override;
+    void onShowAuth() override;
+    void onShowRooms() override;
+    void onRegisterContinue() override;
+    void onAuthContinue(const std::string& salt) override;
+    void onLoggedIn(const core::User& self) override;
+    void onMySalt(const std::optional<std::string>& salt) override;
+    void onRooms(std::vector<core::Room> rooms) override;
+    void onRoomAdded(const core::Room& room) override;
+    void onRoomRenamed(int32_t roomId, const std::string& name) override;
+    void onRoomRemoved(int32_t roomId) override;
+    void onRestoringRoom(int32_t roomId) override;
+    void onBecameMember() override;
+    void onJoinedRoom(int32_t roomId, std::vector<core::User> members, std::vector<core::User> online, uint32_t memberCount) override;
+    void onRoomMembers(int32_t roomId, std::vector<core::User> members, bool more) override;
+    void onUserJoined(const core::User& user) override;
+    void onUserLeft(const core::User& user) override;
+    void onPresence(int32_t roomId, std::vector<core::User> newMembers, std::vector<core::User> joined, std::vector<core::User> left) override;
+    void onUserRoleChanged(int32_t userId, chat::UserRights role) override;
+    void onUsernameChanged(int32_t userId, const std::string& username) override;
+    void onTyping(const core::User& user, bool started) override;
+    void onTypingUsers(int32_t roomId, std::vector<core::User> users) override;
+    void onMessages(std::vector<core::Message> messages, bool history) override;
+    void onMessagesDeleted(const std::vector<int32_t>& messageIds) override;
+    void onMessageSent(const std::string& key, const core::Message& message) override;
+    void onMessageFailed(const std::string& key, const std::string& error) override;
+    void onMessagesAround(int32_t messageId, std::vector<core::Message> messages, bool hasOlder, bool hasNewer) override;
+    void onHistoryReset() override;
+    void onServers(std::vector<core::ServerEntry> servers) override;
+    void onMoveToServer(const std::string& host) override;
 
-    // UI helpers
-    void showError(const wxString& msg);
-    void showInfo(const wxString& msg);
-    void updateRoomsPanel(const std::vector<Room*>& rooms);
-    void showChat(std::vector<User> users);
-    void showRooms();
-    void showRoomMessage(const chat::MessageInfo& mi);
-    void showMessageHistory(const std::vector<Message>& messages);
-    void addUser(User user);
-    void removeUser(User user);
-    void showAuth();
-    void showServers();
-    void showInitial();
-    void SetServers(const std::vector<std::string> &servers);
-    void updateUserRole(int32_t userId, chat::UserRights newRole);
-    void removeMessageFromView(int32_t messageId);
-    void addRoom(Room* room);
-    void becameMember();
-    void updateUsername(int32_t userId, const std::string& username);
-    
     MainWidget* ui;
-    std::shared_ptr<drogon::WebSocketConnection> conn;
-    drogon::WebSocketClientPtr client;
 };
 
 } // namespace client
@@ -139,23 +139,32 @@ void AccountSettingsPanel::OnPasswordChangeContinue(const std::string& currentSa
         return;
     }
 
-    try {
-        std::string oldPasswordHash = password::hash_password(m_oldPassword.utf8_string(), currentSalt);
-
-        std::string newSalt = password::generate_salt();
-        std::string newPasswordHash = password::hash_password(m_newPassword.utf8_string(), newSalt);
-
-        mainWin->wsClient->changePassword(oldPasswordHash, newPasswordHash, newSalt);
-
-        m_oldPassword.clear();
-        m_newPassword.clear();
-    }
-    catch (const std::exception& ex) {
-        mainWin->ShowPopup(ex.what(), wxICON_ERROR);
-    }
-
-    m_changePasswordButton->Enable();
-    m_changeUsernameButton->Enable();
+    // Both hashes run on the worker, the buttons stay disabled until the request is sent.
+    const std::string server = mainWin->wsClient->server();
+    const std::string user = m_currentUsernameLabel->GetLabel().utf8_string();
+    std::string newPassword = m_newPassword.utf8_string();
+    password::derive_key_async(server, user, m_oldPassword.utf8_string(), currentSalt,
+        [this, server, user, newPassword = std::move(newPassword)](std::optional<std::string> oldHash, const std::string& error) mutable {
+            if (!oldHash) {
+                OnPasswordChangeFailed();
+                mainWin->ShowPopup(error, wxICON_ERROR);
+                return;
+            }
+            std::string newSalt = password::generate_salt();
+            password::derive_key_async(server, user, std::move(newPassword), newSalt,
+                [this, oldHash = std::move(*oldHash), newSalt](std::optional<std::string> newHash, const std::string& error) {
+                    if (newHash) {
+                        mainWin->wsClient->changePassword(oldHash, *newHash, newSalt);
+                    } else {
+                        mainWin->ShowPopup(error, wxICON_ERROR);
+                    }
+                    m_changePasswordButton->Enable();
+                    m_changeUsernameButton->Enable();
+                });
+        });
+
+    m_oldPassword.clear();
+    m_newPassword.clear();
 }
 
 void AccountSettingsPanel::OnPasswordChangeFailed() {
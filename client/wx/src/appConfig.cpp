@@ -76,6 +76,8 @@ void AppConfig::InitPath() {
         }
     }
 
+    m_dataDir = configDir;
+
     // 4. Now that the directory is guaranteed to exist, use wxFileName
     // to correctly and safely build the final file path.
     wxFileName finalPath(configDir, "config.json");
@@ -154,6 +156,10 @@ const Json::Value& AppConfig::getRoot() const {
     return m_root;
 }
 
+const wxString& AppConfig::GetDataDir() const {
+    return m_dataDir;
+}
+
 bool AppConfig::IsFirstInstance() const {
     return m_isFirstInstance;
 }
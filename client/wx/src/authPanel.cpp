@@ -99,29 +99,43 @@ void AuthPanel::OnInputLogin(wxCommandEvent& event) {
 }
 
 void AuthPanel::HandleRegisterContinue() {
-    try {
-        std::string salt = password::generate_salt();
-        std::string hash = password::hash_password(m_password.utf8_string(), salt);
-        mainWin->wsClient->completeRegister(hash, salt);
-    } catch (const std::exception& ex) {
-        mainWin->ShowPopup(ex.what(), wxICON_ERROR);
-    }
+    // Hashing takes a while, keep the form locked until the request is sent.
+    SetButtonsEnabled(false);
+    std::string salt = password::generate_salt();
+    password::derive_key_async(mainWin->wsClient->server(), m_usernameInput->GetValue().utf8_string(),
+        m_password.utf8_string(), salt,
+        [this, salt](std::optional<std::string> hash, const std::string& error) {
+            SetButtonsEnabled(true);
+            if (!hash) {
+                mainWin->ShowPopup(error, wxICON_ERROR);
+                return;
+            }
+            mainWin->wsClient->completeRegister(*hash, salt);
+        });
     m_password.clear();
 }
 
 void AuthPanel::HandleAuthContinue(const std::string &salt) {
-    try {
-        if (salt.empty()) {
-            std::string new_salt = password::generate_salt();
-            std::string hash = password::hash_password(m_password.utf8_string(), new_salt);
-            mainWin->wsClient->completeAuth(hash, m_password.utf8_string(), new_salt);
-        } else {
-            std::string hash = password::hash_password(m_password.utf8_string(), salt);
-            mainWin->wsClient->completeAuth(hash, std::nullopt, std::nullopt);
-        }
-    } catch (const std::exception& ex) {
-        mainWin->ShowPopup(ex.what(), wxICON_ERROR);
-    }
+    SetButtonsEnabled(false);
+    // Accounts created before salts were stored get one now, the server keeps the new hash.
+    const bool migrate = salt.empty();
+    std::string keySalt = migrate ? password::generate_salt() : salt;
+    std::optional<std::string> plain;
+    if (migrate) plain = m_password.utf8_string();
+    password::derive_key_async(mainWin->wsClient->server(), m_usernameInput->GetValue().utf8_string(),
+        m_password.utf8_string(), keySalt,
+        [this, keySalt, plain = std::move(plain)](std::optional<std::string> hash, const std::string& error) {
+            SetButtonsEnabled(true);
+            if (!hash) {
+                mainWin->ShowPopup(error, wxICON_ERROR);
+                return;
+            }
+            if (plain) {
+                mainWin->wsClient->completeAuth(*hash, plain, keySalt);
+            } else {
+                mainWin->wsClient->completeAuth(*hash, std::nullopt, std::nullopt);
+            }
+        });
     m_password.clear();
 }
 
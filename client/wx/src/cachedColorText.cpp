@@ -1,7 +1,9 @@
 #include <client/cachedColorText.h>
 #include <client/graphicsContextManager.h>
+#include <client/lineBitmapCache.h>
 
 #include <wx/graphics.h>
+#include <wx/dcbuffer.h>
 #include <wx/dcclient.h>
 #include <wx/dcmemory.h>
 #include <wx/tokenzr.h>
@@ -29,7 +31,7 @@ void CachedColorText::SetLabel(const wxString& label) {
     }
     m_label = label;
     InvalidateLayoutCaches();
-    InvalidateCache();
+    Refresh();
 }
 
 wxString CachedColorText::GetLabel() const {
@@ -40,20 +42,11 @@ bool CachedColorText::SetFont(const wxFont& font) {
     bool ret = wxControl::SetFont(font);
     if(ret) {
         InvalidateLayoutCaches();
-        InvalidateCache();
+        Refresh();
     }
     return ret;
 }
 
-void CachedColorText::InvalidateCache() {
-    m_cache = wxBitmap();
-}
-
-void CachedColorText::InvalidateCacheAndRefresh() {
-    m_cache = wxBitmap();
-    Refresh();
-}
-
 void CachedColorText::InvalidateLayoutCaches() {
     m_cachedLineHeight = -1.0;
     m_cachedBestSize.Set(wxDefaultCoord, wxDefaultCoord);
@@ -128,73 +121,41 @@ wxSize CachedColorText::DoGetBestSize() const {
     return m_cachedBestSize;
 }
 
-void CachedColorText::RenderToCache() {
-    wxSize size = GetClientSize();
-    if(size.x <= 0 || size.y <= 0) {
-        m_cache = wxBitmap();
-        return;
+void CachedColorText::DrawLabel(wxDC& dc) {
+    wxColour background = GetBackgroundColour();
+    if(wxWindow* parent = GetParent()) {
+        background = parent->GetBackgroundColour();
     }
+    dc.SetBackground(background);
+    dc.Clear();
 
-    m_cache.Create(size);
-    wxMemoryDC memDC(m_cache);
-
-    wxWindow* parent = GetParent();
-    if(parent) {
-        memDC.SetBackground(parent->GetBackgroundColour());
-    }
-    memDC.Clear();
-
-    GraphicsContextManager ctx(memDC);
-    wxGraphicsContext* gc = ctx.GetContext();
-
-    if(gc) {
-        gc->SetFont(GetFont(), GetForegroundColour());
-
-        if(m_stretchesToParentWidth) {
-            // The wxGraphicsContext implementation on macOS does not handle '\n' characters.
-            // To ensure consistent behavior on all platforms, we must manually parse the
-            // string and draw it line by line.
-            const wxDouble lineHeight = GetLineHeight();
-            wxStringTokenizer tokenizer(GetLabel(), "\n");
-            wxDouble y = 0.0;
-
-            while(tokenizer.HasMoreTokens()) {
-                wxString line = tokenizer.GetNextToken();
-                gc->DrawText(line, 0, y);
-                y += lineHeight;
+    auto& cache = LineBitmapCache::Get();
+    if(m_stretchesToParentWidth) {
+        // The wxGraphicsContext implementation on macOS does not handle '\n' characters.
+        // To ensure consistent behavior on all platforms, the string is drawn line by line.
+        const wxDouble lineHeight = GetLineHeight();
+        wxStringTokenizer tokenizer(GetLabel(), "\n");
+        wxDouble y = 0.0;
+
+        while(tokenizer.HasMoreTokens()) {
+            const wxBitmap& line = cache.GetLine(tokenizer.GetNextToken(), GetFont(), GetForegroundColour(), background);
+            if(line.IsOk()) {
+                dc.DrawBitmap(line, 0, static_cast<wxCoord>(y));
             }
-        } else {
-            gc->DrawText(GetLabel(), 0, 0);
-        }
-    } else {
-        // Fallback to wxDC if GraphicsContext fails (though this would lose color emoji support).
-        memDC.SetFont(GetFont());
-        memDC.SetTextForeground(GetForegroundColour());
-
-        if(m_stretchesToParentWidth) {
-            memDC.DrawLabel(GetLabel(), wxRect(0, 0, size.x, size.y));
-        } else {
-            memDC.DrawText(GetLabel(), 0, 0);
+            y += lineHeight;
         }
+    } else if(const wxBitmap& line = cache.GetLine(GetLabel(), GetFont(), GetForegroundColour(), background); line.IsOk()) {
+        dc.DrawBitmap(line, 0, 0);
     }
 }
 
 void CachedColorText::OnPaint([[maybe_unused]] wxPaintEvent& event) {
-    wxPaintDC dc{this};
-    if(!m_cache.IsOk()) {
-        RenderToCache();
-    }
-    if(m_cache.IsOk()) {
-        dc.DrawBitmap(m_cache, 0, 0);
-    }
+    // Buffered so the clear and the blits don't flicker.
+    wxAutoBufferedPaintDC dc{this};
+    DrawLabel(dc);
 }
 
 void CachedColorText::OnSize(wxSizeEvent& event) {
-    // Only invalidate if the size has actually changed.
-    if(m_cache.IsOk() && GetClientSize() != m_cache.GetSize()) {
-        InvalidateCache();
-    }
-
     // If the control's best size depends on the parent's width,
     // a size change implies that the parent may have been resized,
     // making our layout cache stale.
@@ -206,8 +167,8 @@ void CachedColorText::OnSize(wxSizeEvent& event) {
 }
 
 void CachedColorText::OnSysColourChanged(wxSysColourChangedEvent& event) {
-    // The system theme changed, so our colors are stale.
-    InvalidateCache();
+    // The system theme changed, the colours are part of the cache key so only a repaint is needed.
+    Refresh();
     event.Skip();
 }
 
@@ -1,6 +1,5 @@
 #include <client/chatPanel.h>
 #include <client/mainWidget.h>
-#include <client/messageWidget.h>
 #include <client/userListPanel.h>
 #include <client/wsClient.h>
 #include <client/message.h>
@@ -11,6 +10,7 @@
 #include <client/roomSettingsPanel.h>
 #include <client/user.h>
 #include <client/typingIndicatorPanel.h>
+#include <wx/numdlg.h>
 
 namespace client {
 
@@ -28,6 +28,8 @@ wxDEFINE_EVENT(wxEVT_ASSIGN_MODERATOR, wxCommandEvent);
 wxDEFINE_EVENT(wxEVT_UNASSIGN_MODERATOR, wxCommandEvent);
 wxDEFINE_EVENT(wxEVT_TRANSFER_OWNERSHIP, wxCommandEvent);
 wxDEFINE_EVENT(wxEVT_DELETE_MESSAGE, wxCommandEvent);
+wxDEFINE_EVENT(wxEVT_DELETE_USER_MESSAGES, wxCommandEvent);
+wxDEFINE_EVENT(wxEVT_REQUEST_MEMBERS, wxCommandEvent);
 
 wxBEGIN_EVENT_TABLE(ChatPanel, wxPanel)
     EVT_BUTTON(ID_SEND, ChatPanel::OnSend)
@@ -113,6 +115,8 @@ ChatPanel::ChatPanel(wxWindow* parent)
     Bind(wxEVT_UNASSIGN_MODERATOR, &ChatPanel::OnUnassignModerator, this);
     Bind(wxEVT_TRANSFER_OWNERSHIP, &ChatPanel::OnTransferOwnership, this);
     Bind(wxEVT_DELETE_MESSAGE, &ChatPanel::OnDeleteMessage, this);
+    Bind(wxEVT_DELETE_USER_MESSAGES, &ChatPanel::OnDeleteUserMessages, this);
+    Bind(wxEVT_REQUEST_MEMBERS, &ChatPanel::OnRequestMembers, this);
     Bind(wxEVT_TIMER, &ChatPanel::OnTypingTimer, this, ID_TYPING_TIMER);
 }
 
@@ -127,9 +131,9 @@ void ChatPanel::OnChatPanelSize(wxSizeEvent& event) {
     
     // Calculate the actual width available for text wrapping.
     // This involves subtracting all horizontal padding and margins between the messageContainer's
-    // client edge and the actual text content within wxStaticText.
-    // FromDIP(3) * 2: Left/right padding for MessageWidget itself in m_messageSizer.
-    // FromDIP(5) * 2: Left/right padding for m_messageStaticText inside MessageWidget's sizer.
+    // client edge and the actual text content of a message row.
+    // FromDIP(3) * 2: Left/right margin of a message row.
+    // FromDIP(5) * 2: Left/right padding of the text inside a message row.
     int calculatedWrapWidth = newClientWidth - (FromDIP(3) * 2) - (FromDIP(5) * 2);
 
     // Basic sanity check: ensure wrapWidth is positive.
@@ -164,7 +168,10 @@ void ChatPanel::OnSend(wxCommandEvent&) {
             m_isTyping = false;
             m_parent->wsClient->sendTypingStop();
         }
-        m_parent->wsClient->sendMessage(m_input_ctrl->GetValue().utf8_string());
+        // Shown right away, the server's broadcast or confirmation then fills in its id and time.
+        const wxString text = m_input_ctrl->GetValue();
+        const auto key = m_parent->wsClient->sendMessage(text.utf8_string());
+        m_messageView->AddPending(Message{UserNames::Intern(m_currentUser->username), m_currentUser->id, text.utf8_string(), 0, 0, 0, key});
         m_input_ctrl->Clear();
     }
 }
@@ -274,6 +281,16 @@ void ChatPanel::UserStoppedTyping(const User& user) {
 	m_typingIndicator->RemoveTypingUser(user.username);
 }
 
+void ChatPanel::SetTypingUsers(const std::vector<User>& users) {
+    std::vector<wxString> usernames;
+    for (const auto& user : users) {
+        if (user.id != m_currentUser->id) {
+            usernames.push_back(user.username);
+        }
+    }
+    m_typingIndicator->SetTypingUsers(std::move(usernames));
+}
+
 void ChatPanel::UserJoin(const User& user) {
     m_userListPanel->AddUser(user);
 }
@@ -283,6 +300,13 @@ void ChatPanel::UserLeft(const User& user) {
     UserStoppedTyping(user);
 }
 
+void ChatPanel::ApplyPresence(const std::vector<User>& newMembers, const std::vector<User>& joined, const std::vector<User>& left) {
+    m_userListPanel->ApplyPresence(newMembers, joined, left);
+    for (const auto& user : left) {
+        UserStoppedTyping(user);
+    }
+}
+
 void ChatPanel::UpdateUsername(int32_t userId, const wxString& newUsername) {
     if (m_userListPanel) {
         m_userListPanel->UpdateUsername(userId, newUsername);
@@ -316,6 +340,16 @@ void ChatPanel::OnAssignModerator(wxCommandEvent& event) {
     m_parent->wsClient->assignRole(roomId, userId, chat::UserRights::MODERATOR);
 }
 
+void ChatPanel::OnRequestMembers([[maybe_unused]] wxCommandEvent& event) {
+    if (!m_parent || !m_parent->wsClient) return;
+
+    std::optional<core::User> after;
+    if (const auto& last = m_userListPanel->GetLastMember()) {
+        after = core::User{last->id, last->username.utf8_string(), last->role};
+    }
+    m_parent->wsClient->getRoomMembers(GetRoomId(), "", after);
+}
+
 void ChatPanel::OnUnassignModerator(wxCommandEvent& event) {
     if (!m_parent || !m_parent->wsClient) return;
 
@@ -340,6 +374,18 @@ void ChatPanel::OnDeleteMessage(wxCommandEvent& event) {
     m_parent->wsClient->deleteMessage(messageId);
 }
 
+void ChatPanel::OnDeleteUserMessages(wxCommandEvent& event) {
+    if (!m_parent || !m_parent->wsClient) {
+        return;
+    }
+    const int32_t userId = event.GetInt();
+    const long count = wxGetNumberFromUser("Delete the most recent messages of " + event.GetString() + " in this room.",
+                                           "Messages:", "Delete Recent Messages", 50, 1, common::limits::MAX_DELETE_USER_MESSAGES, this);
+    if (count > 0) {
+        m_parent->wsClient->deleteUserMessages(userId, static_cast<int32_t>(count));
+    }
+}
+
 void ChatPanel::OnInputKeyDown(wxKeyEvent& event) {
     int keyCode = event.GetKeyCode();
 
@@ -0,0 +1,131 @@
+#include <client/lineBitmapCache.h>
+#include <client/graphicsContextManager.h>
+
+#include <wx/dcmemory.h>
+#include <wx/graphics.h>
+#include <wx/hashmap.h>
+#include <cmath>
+
+namespace client {
+
+LineBitmapCache& LineBitmapCache::Get() {
+    static LineBitmapCache cache;
+    return cache;
+}
+
+size_t LineBitmapCache::KeyHash::operator()(const Key& key) const {
+    size_t hash = wxStringHash{}(key.line);
+    hash = hash * 31 + wxStringHash{}(key.font);
+    hash = hash * 31 + key.foreground;
+    return hash * 31 + key.background;
+}
+
+const wxBitmap& LineBitmapCache::GetLine(const wxString& line, const wxFont& font, const wxColour& foreground, const wxColour& background) {
+    static const wxBitmap empty;
+    if(line.IsEmpty()) {
+        return empty;
+    }
+
+    if(!m_lastFont.IsSameAs(font)) {
+        m_lastFont = font;
+        m_lastFontDesc = font.GetNativeFontInfoDesc();
+    }
+    Key key{line, m_lastFontDesc, foreground.GetRGBA(), background.GetRGBA()};
+
+    const auto now = std::chrono::steady_clock::now();
+    if(auto it = m_index.find(key); it != m_index.end()) {
+        ++m_hits;
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        it->second->drawn = now;
+        return it->second->bitmap;
+    }
+
+    ++m_misses;
+    wxBitmap bitmap = Render(line, font, foreground, background);
+    const size_t bytes = bitmap.IsOk() ? static_cast<size_t>(bitmap.GetWidth()) * bitmap.GetHeight() * 4 : 0;
+    m_entries.push_front(Entry{key, std::move(bitmap), bytes, now});
+    m_index.emplace(std::move(key), m_entries.begin());
+    m_bytes += bytes;
+    Evict();
+    return m_entries.front().bitmap;
+}
+
+LineBitmapCache::Stats LineBitmapCache::GetStats() const {
+    return Stats{m_hits, m_misses, m_evicted, m_entries.size(), m_bytes};
+}
+
+void LineBitmapCache::TrimIdle() {
+    const auto cutoff = std::chrono::steady_clock::now() - IDLE_TIMEOUT;
+    const size_t before = m_entries.size();
+    while(!m_entries.empty() && m_entries.back().drawn < cutoff) {
+        PopOldest();
+    }
+    if(m_entries.size() != before) {
+        LOG_DEBUG << "Dropped " << before - m_entries.size() << " idle lines, " << m_entries.size()
+                  << " left in " << m_bytes << " bytes, " << m_hits << " hits, " << m_misses << " misses";
+    }
+}
+
+void LineBitmapCache::Clear() {
+    m_entries.clear();
+    m_index.clear();
+    m_bytes = 0;
+}
+
+void LineBitmapCache::Evict() {
+    // The entry just drawn is never evicted, even if it alone exceeds the budget.
+    while(m_bytes > MAX_BYTES && m_entries.size() > 1) {
+        PopOldest();
+    }
+}
+
+void LineBitmapCache::PopOldest() {
+    m_bytes -= m_entries.back().bytes;
+    m_index.erase(m_entries.back().key);
+    m_entries.pop_back();
+    ++m_evicted;
+}
+
+wxBitmap LineBitmapCache::Render(const wxString& line, const wxFont& font, const wxColour& foreground, const wxColour& background) const {
+    // Measure with the same kind of context the line is drawn with, so the bitmap fits the glyphs exactly.
+    wxDouble width = 0.0, height = 0.0;
+    {
+        wxMemoryDC dc;
+        wxBitmap tempBitmap(1, 1);
+        dc.SelectObject(tempBitmap);
+        GraphicsContextManager ctx(dc);
+        if(wxGraphicsContext* gc = ctx.GetContext()) {
+            gc->SetFont(font, foreground);
+            gc->GetTextExtent(line, &width, &height);
+        } else {
+            dc.SetFont(font);
+            const wxSize extent = dc.GetTextExtent(line);
+            width = extent.x;
+            height = extent.y;
+        }
+    }
+    if(width <= 0 || height <= 0) {
+        return wxBitmap();
+    }
+
+    wxBitmap bitmap(static_cast<int>(std::ceil(width)), static_cast<int>(std::ceil(height)));
+    wxMemoryDC dc(bitmap);
+    dc.SetBackground(background);
+    dc.Clear();
+    {
+        GraphicsContextManager ctx(dc);
+        if(wxGraphicsContext* gc = ctx.GetContext()) {
+            gc->SetFont(font, foreground);
+            gc->DrawText(line, 0, 0);
+        } else {
+            // Fallback to wxDC if GraphicsContext fails (though this would lose color emoji support).
+            dc.SetFont(font);
+            dc.SetTextForeground(foreground);
+            dc.DrawText(line, 0, 0);
+        }
+    }
+    dc.SelectObject(wxNullBitmap);
+    return bitmap;
+}
+
+} // namespace client
@@ -0,0 +1,44 @@
+#include <client/message.h>
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+namespace client {
+
+namespace {
+
+struct Table {
+    std::mutex mutex;
+    // Names no message holds any more expire and are dropped once the table doubled.
+    std::unordered_map<std::string, std::weak_ptr<const wxString>> names;
+    size_t pruneAt = 64;
+};
+
+Table& table() {
+    static Table inst;
+    return inst;
+}
+
+} // namespace
+
+UserName UserNames::Intern(std::string_view utf8) {
+    auto& t = table();
+    std::lock_guard lock(t.mutex);
+    auto [it, inserted] = t.names.try_emplace(std::string(utf8));
+    if(auto name = it->second.lock()) {
+        return name;
+    }
+    auto name = std::make_shared<const wxString>(wxString::FromUTF8(utf8.data(), utf8.size()));
+    it->second = name;
+    if(inserted && t.names.size() >= t.pruneAt) {
+        std::erase_if(t.names, [](const auto& entry) { return entry.second.expired(); });
+        t.pruneAt = std::max<size_t>(64, t.names.size() * 2);
+    }
+    return name;
+}
+
+UserName UserNames::Intern(const wxString& name) {
+    return Intern(name.utf8_string());
+}
+
+} // namespace client
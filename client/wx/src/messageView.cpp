@@ -1,44 +1,114 @@
 #include <client/messageView.h>
 #include <client/chatPanel.h>
 #include <client/mainWidget.h> // Include full definition for wsClient access
-#include <client/messageWidget.h>
+#include <client/graphicsContextManager.h>
+#include <client/lineBitmapCache.h>
 #include <client/wsClient.h>
-#include <wx/dcbuffer.h> // Include for wxAutoBufferedPaintDC
+#include <client/user.h>
+#include <client/core/timestamp.h>
+#include <wx/clipbrd.h>
+#include <wx/dcmemory.h>
+#include <wx/graphics.h>
+#include <wx/tokenzr.h>
+#include <algorithm>
+#include <cmath>
+#include <iterator>
 #include <numeric>
+#include <ranges>
 #include <limits>
 
 namespace client {
 
+enum {
+    ID_COPY = wxID_HIGHEST + 40,
+    ID_DELETE_MESSAGE
+};
+
+static constexpr size_t NO_ROW = std::numeric_limits<size_t>::max();
+
+// Rows trimmed from the view go back to how buffered messages are kept.
+static Message ToMessage(const MessageRow& row) {
+    return Message{row.user, row.userId, row.text.GetText().utf8_string(), row.timestamp, row.messageId};
+}
+
+// The time shown in a row's header, none while the server did not assign it.
+static wxString FormatTime(int64_t timestamp) {
+    return timestamp != 0 ? wxString::FromUTF8(core::formatMessageTimestamp(timestamp)) : wxString{};
+}
+
 MessageView::MessageView(ChatPanel* parent)
     : wxVScrolledWindow(parent, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxBORDER_NONE),
       m_chatPanelParent(parent),
+      m_hoveredRow(NO_ROW),
       m_loadingOlder(false),
       m_loadingNewer(false),
       m_lastKnownWrapWidth(-1),
       m_lastKnownSnapState(true)
 {
-    SetBackgroundStyle(wxBG_STYLE_ERASE);
-    SetDoubleBuffered(true);
-    Bind(wxEVT_SIZE, &MessageView::OnSize, this);
+    // Every pixel is painted from the back buffer, there is nothing to erase.
+    SetBackgroundStyle(wxBG_STYLE_PAINT);
+    Bind(wxEVT_PAINT, &MessageView::OnPaint, this);
     Bind(wxEVT_MOUSEWHEEL, &MessageView::OnMouseWheel, this);
+    Bind(wxEVT_MOTION, &MessageView::OnMouseMove, this);
+    Bind(wxEVT_LEAVE_WINDOW, &MessageView::OnMouseLeave, this);
+    Bind(wxEVT_RIGHT_DOWN, &MessageView::OnRightClick, this);
+    Bind(wxEVT_SYS_COLOUR_CHANGED, &MessageView::OnSysColourChanged, this);
 
-    for (int i = 0; i < MAX_MESSAGES + CHUNK_SIZE; ++i) {
-        m_widgetsPool.return_instance(new MessageWidget(this, Message{}, m_lastKnownWrapWidth));
-        wxYieldIfNeeded();
-    }
+    UpdateMetrics();
+    UpdateUnitCount();
 }
 
 void MessageView::Start() {
     Clear();
-    LoadOlderMessages();
+    LoadOlderMessages(CHUNK_SIZE);
 }
 
 void MessageView::InvalidateCaches() {
-    for(auto* widget : m_messageWidgets) {
-        if(widget->IsShown()) {
-            widget->InvalidateCaches();
-        }
-    }
+    Refresh();
+}
+
+void MessageView::UpdateMetrics() {
+    m_userFont = GetFont();
+    m_userFont.SetWeight(wxFONTWEIGHT_BOLD);
+    m_timeFont = GetFont();
+    m_timeFont.SetPointSize(m_timeFont.GetPointSize() - 1); // Make it slightly smaller
+
+    wxMemoryDC dc;
+    // A wxMemoryDC on some platforms requires a bitmap to be selected to have
+    // valid characteristics. A 1x1 bitmap is sufficient.
+    wxBitmap tempBitmap(1, 1);
+    dc.SelectObject(tempBitmap);
+
+    // The standard line height is the sum of the height above and below the
+    // baseline, plus any recommended inter-line spacing (leading).
+    const auto lineHeight = [&dc](const wxFont& font) -> wxDouble {
+        dc.SetFont(font);
+        wxFontMetrics metrics = dc.GetFontMetrics();
+        wxDouble height = metrics.ascent + metrics.descent + metrics.externalLeading;
+        // Fallback to a reasonable default if metrics are weird.
+        return height > 0 ? height : dc.GetCharHeight();
+    };
+    m_lineHeight = lineHeight(GetFont());
+    m_headerHeight = static_cast<wxCoord>(std::ceil((std::max)(lineHeight(m_userFont), lineHeight(m_timeFont))));
+}
+
+void MessageView::LayoutRow(MessageRow& row) {
+    const wxString& wrapped = row.text.Wrap(m_lastKnownWrapWidth - FromDIP(9), GetFont());
+    const size_t lines = wrapped.IsEmpty() ? 0 : wrapped.Freq('\n') + 1;
+    // Header, a 2px gap, then the text with 5px of padding around it.
+    row.height = m_headerHeight + FromDIP(2) + FromDIP(5) + static_cast<wxCoord>(std::ceil(lines * m_lineHeight)) + FromDIP(5);
+}
+
+void MessageView::UpdateUnitCount() {
+    SetUnitCount(CalculateTotalHeight());
+}
+
+wxCoord MessageView::CalculateTotalHeight() const {
+    return m_heights.Total();
+}
+
+size_t MessageView::RowAt(wxCoord y) const {
+    return m_heights.RowAt(y);
 }
 
 void MessageView::DoSetSize(int x, int y, int width, int height, int sizeFlags) {
@@ -64,22 +134,86 @@ void MessageView::DoSetSize(int x, int y, int width, int height, int sizeFlags)
     // ALWAYS apply the height adjustment. This is the final, authoritative scroll.
     int heightDifference = oldSize.y - newSize.y;
     ScrollToRow(oldScrollY + heightDifference);
-    UpdateWidgetPositions();
+    Refresh();
+    CheckAndUpdateSnapState();
 }
 
-void MessageView::OnSize(wxSizeEvent& event) {
-    event.Skip();
+void MessageView::OnScrolled() {
+    UpdateScrollVelocity();
+    UpdateHoveredRow();
+    CheckAndUpdateSnapState();
+    FillFromBuffers();
+    Prefetch();
 }
 
-void MessageView::OnScrolled() {
-    UpdateWidgetPositions();
-    if (m_loadingOlder || m_loadingNewer) return;
-    wxCoord firstVisiblePixel = GetVisibleRowsBegin();
-    wxCoord totalHeight = GetUnitCount();
-    wxCoord visibleHeight = GetClientSize().y;
-    const int pixelThreshold = FromDIP(500);
-    if (firstVisiblePixel <= pixelThreshold) LoadOlderMessages();
-    else if (firstVisiblePixel + visibleHeight >= totalHeight - pixelThreshold) LoadNewerMessages();
+void MessageView::UpdateScrollVelocity() {
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(now - m_lastScrollTime).count();
+    const wxCoord position = GetVisibleRowsBegin();
+    if(elapsed > SCROLL_IDLE_SECONDS) {
+        // The first event of a fling only gives its direction.
+        m_scrollVelocity = (position - m_lastScrollPos) / SCROLL_IDLE_SECONDS;
+    } else if(elapsed > 0.0) {
+        // Smoothed, wheel events come in uneven bursts.
+        m_scrollVelocity = 0.7 * m_scrollVelocity + 0.3 * (position - m_lastScrollPos) / elapsed;
+    }
+    m_lastScrollPos = position;
+    m_lastScrollTime = now;
+}
+
+double MessageView::ScrollVelocity() const {
+    const double idle = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_lastScrollTime).count();
+    return idle > SCROLL_IDLE_SECONDS ? 0.0 : m_scrollVelocity;
+}
+
+size_t MessageView::WantedBuffer(bool older) const {
+    const double towards = older ? -ScrollVelocity() : ScrollVelocity();
+    size_t wanted = CHUNK_SIZE;
+    if(towards > 0.0 && !m_rows.empty()) {
+        const double rowHeight = (std::max)(1.0, static_cast<double>(CalculateTotalHeight()) / m_rows.size());
+        wanted += static_cast<size_t>(std::ceil(towards * PREFETCH_SECONDS / rowHeight));
+    }
+    return (std::min)(wanted, MAX_BUFFERED);
+}
+
+void MessageView::Prefetch() {
+    // One page in flight at a time, the responses can't be told apart otherwise.
+    if(m_loadingOlder || m_loadingNewer || m_rows.empty()) {
+        return;
+    }
+    // The side scrolled towards goes first, older history when idle.
+    const bool upwards = ScrollVelocity() <= 0.0;
+    for(const bool older : {upwards, !upwards}) {
+        const size_t buffered = older ? m_olderBuffer.size() : m_newerBuffer.size();
+        const size_t wanted = WantedBuffer(older);
+        if((older ? m_olderExhausted : m_newerExhausted) || buffered >= wanted) {
+            continue;
+        }
+        const int count = std::clamp(static_cast<int>(wanted - buffered), CHUNK_SIZE, MAX_PAGE_SIZE);
+        if(older) {
+            LoadOlderMessages(count);
+        } else {
+            LoadNewerMessages(count);
+        }
+        return;
+    }
+}
+
+void MessageView::FillFromBuffers() {
+    const wxCoord threshold = FromDIP(LOAD_THRESHOLD_DIP);
+    const auto take = [](std::deque<Message>& buffer) {
+        const auto end = buffer.begin() + (std::min)(buffer.size(), static_cast<size_t>(CHUNK_SIZE));
+        std::vector<Message> page(std::make_move_iterator(buffer.begin()), std::make_move_iterator(end));
+        buffer.erase(buffer.begin(), end);
+        return page;
+    };
+    // A page at a time, the scroll position moves with every one added above.
+    while(!m_olderBuffer.empty() && (m_rows.empty() || GetVisibleRowsBegin() <= threshold)) {
+        UpdateLayoutAndScroll(take(m_olderBuffer), true, true);
+    }
+    while(!m_newerBuffer.empty() && GetVisibleRowsBegin() + GetClientSize().y >= GetUnitCount() - threshold) {
+        UpdateLayoutAndScroll(take(m_newerBuffer), false, true);
+    }
 }
 
 void MessageView::OnMouseWheel(wxMouseEvent& event) {
@@ -104,26 +238,206 @@ void MessageView::OnMouseWheel(wxMouseEvent& event) {
     }
 }
 
+void MessageView::UpdateHoveredRow() {
+    const wxPoint pos = ScreenToClient(wxGetMousePosition());
+    m_hoveredRow = GetClientRect().Contains(pos) ? RowAt(GetVisibleRowsBegin() + pos.y) : NO_ROW;
+}
+
+void MessageView::OnMouseMove(wxMouseEvent& event) {
+    const size_t row = RowAt(GetVisibleRowsBegin() + event.GetY());
+    if(row != m_hoveredRow) {
+        m_hoveredRow = row;
+        Refresh(false);
+    }
+    event.Skip();
+}
+
+void MessageView::OnMouseLeave(wxMouseEvent& event) {
+    if(m_hoveredRow != NO_ROW) {
+        m_hoveredRow = NO_ROW;
+        Refresh(false);
+    }
+    event.Skip();
+}
+
+void MessageView::OnSysColourChanged(wxSysColourChangedEvent& event) {
+    // The system theme changed, so the back buffer is stale.
+    Refresh();
+    event.Skip();
+}
+
+void MessageView::OnRightClick(wxMouseEvent& event) {
+    const size_t index = RowAt(GetVisibleRowsBegin() + event.GetY());
+    if(index >= m_rows.size()) {
+        event.Skip();
+        return;
+    }
+    // The rows may change while the menu is open, keep what the handlers need.
+    const wxString text = m_rows[index].text.GetText();
+    const int32_t messageId = m_rows[index].messageId;
+
+    const User& currentUser = m_chatPanelParent->GetCurrentUser();
+    // A message still being sent has no id to delete it by.
+    bool canDelete = (currentUser.role > chat::UserRights::REGULAR) && messageId != 0;
+
+    wxMenu menu;
+    menu.Append(ID_COPY, "Copy Message");
+
+    if (canDelete) {
+        menu.AppendSeparator();
+        menu.Append(ID_DELETE_MESSAGE, "Delete Message");
+    }
+
+    menu.Bind(wxEVT_MENU, [text](wxCommandEvent&) {
+        wxTheApp->CallAfter([msg = text]() mutable {
+            wxClipboardLocker locker;
+            if (!locker) {
+                return;
+            }
+            wxTheClipboard->SetData(new wxTextDataObject(msg));
+        });
+    }, ID_COPY);
+
+    if (canDelete) {
+        menu.Bind(wxEVT_MENU, [this, messageId](wxCommandEvent&) {
+            int response = wxMessageBox(
+                "Are you sure you want to permanently delete this message?",
+                "Confirm Deletion",
+                wxYES_NO | wxNO_DEFAULT | wxICON_WARNING,
+                this
+            );
+            if (response == wxYES) {
+                wxCommandEvent deleteEvent(wxEVT_DELETE_MESSAGE, GetId());
+                deleteEvent.SetEventObject(this);
+                deleteEvent.SetInt(messageId);
+                wxPostEvent(m_chatPanelParent, deleteEvent);
+            }
+        }, ID_DELETE_MESSAGE);
+    }
+
+    PopupMenu(&menu);
+    event.Skip();
+}
+
+void MessageView::OnPaint([[maybe_unused]] wxPaintEvent& event) {
+    wxPaintDC dc(this);
+    const wxSize size = GetClientSize();
+    if(size.x <= 0 || size.y <= 0) {
+        return;
+    }
+    if(!m_backBuffer.IsOk() || m_backBuffer.GetSize() != size) {
+        m_backBuffer.Create(size);
+    }
+
+    {
+        wxMemoryDC memDC(m_backBuffer);
+        memDC.SetBackground(wxSystemSettings::GetColour(wxSYS_COLOUR_WINDOW));
+        memDC.Clear();
+
+        // Only the rows intersecting the visible area are drawn.
+        GraphicsContextManager ctx(memDC);
+        const wxCoord scrollY = GetVisibleRowsBegin();
+        for(size_t i = RowAt(scrollY); i < m_rows.size() && m_heights.Top(i) < scrollY + size.y; ++i) {
+            DrawRow(ctx.GetContext(), memDC, m_rows[i], m_heights.Top(i) - scrollY, size.x, i == m_hoveredRow);
+        }
+    }
+
+    dc.DrawBitmap(m_backBuffer, 0, 0);
+}
+
+void MessageView::DrawRow(wxGraphicsContext* gc, wxDC& dc, const MessageRow& row, wxCoord top, wxCoord width, bool hovered) const {
+    const wxColour background = wxSystemSettings::GetColour(hovered ? wxSYS_COLOUR_BTNFACE : wxSYS_COLOUR_WINDOW);
+    if(hovered) {
+        const wxBrush face(background);
+        if(gc) {
+            gc->SetPen(*wxTRANSPARENT_PEN);
+            gc->SetBrush(face);
+            gc->DrawRectangle(0, top, width, row.height);
+        } else {
+            dc.SetPen(*wxTRANSPARENT_PEN);
+            dc.SetBrush(face);
+            dc.DrawRectangle(0, top, width, row.height);
+        }
+    }
+
+    // Lines are rasterized once in the shared cache and only blitted here.
+    auto& cache = LineBitmapCache::Get();
+    const auto drawBitmap = [gc, &dc](const wxBitmap& bitmap, wxDouble x, wxDouble y) {
+        if(!bitmap.IsOk()) {
+            return;
+        }
+        if(gc) {
+            gc->DrawBitmap(bitmap, x, y, bitmap.GetWidth(), bitmap.GetHeight());
+        } else {
+            dc.DrawBitmap(bitmap, static_cast<wxCoord>(x), static_cast<wxCoord>(y));
+        }
+    };
+
+    // Header line: the username on the left, the timestamp or the delivery state on the right.
+    static const wxString SENDING = "Sending...";
+    static const wxString NOT_SENT = "Not sent";
+    drawBitmap(cache.GetLine(*row.user, m_userFont, wxSystemSettings::GetColour(wxSYS_COLOUR_WINDOWTEXT), background), 0, top);
+    const wxBitmap& time = row.delivery == Delivery::Failed
+        ? cache.GetLine(NOT_SENT, m_timeFont, *wxRED, background)
+        : cache.GetLine(row.delivery == Delivery::Pending ? SENDING : row.time, m_timeFont, wxSystemSettings::GetColour(wxSYS_COLOUR_GRAYTEXT), background);
+    drawBitmap(time, width - FromDIP(5) - (time.IsOk() ? time.GetWidth() : 0), top);
+
+    // The wxGraphicsContext implementation on macOS does not handle '\n' characters,
+    // so the text is drawn line by line.
+    const wxString& wrapped = row.text.GetWrapped();
+    wxDouble y = top + m_headerHeight + FromDIP(2) + FromDIP(5);
+    wxStringTokenizer tokenizer(wrapped, "\n", wxTOKEN_RET_EMPTY_ALL);
+    while(tokenizer.HasMoreTokens()) {
+        drawBitmap(cache.GetLine(tokenizer.GetNextToken(), GetFont(), GetForegroundColour(), background), FromDIP(5), y);
+        y += m_lineHeight;
+    }
+}
+
 void MessageView::OnMessagesReceived(const std::vector<Message>& messages, bool isHistoryResponse) {
-    if (!messages.empty()) {
-        UpdateLayoutAndScroll(messages, isHistoryResponse);
+    if (!isHistoryResponse) {
+        const std::vector<Message> live = ReconcileOwnMessages(messages);
+        // Live messages only continue the rows once they reach the present, until then
+        // they come with the newer pages still to be fetched.
+        if (!m_newerExhausted || live.empty()) {
+            return;
+        }
+        if (m_newerBuffer.empty()) {
+            UpdateLayoutAndScroll(live, false, false);
+            return;
+        }
+        m_newerBuffer.insert(m_newerBuffer.end(), live.begin(), live.end());
+        FillFromBuffers();
+        return;
     }
-    m_loadingOlder = false;
-    m_loadingNewer = false;
+
+    if (m_loadingOlder) {
+        m_loadingOlder = false;
+        m_olderExhausted = messages.empty();
+        m_olderBuffer.insert(m_olderBuffer.end(), messages.begin(), messages.end());
+    } else if (m_loadingNewer) {
+        m_loadingNewer = false;
+        m_newerExhausted = messages.empty();
+        m_newerBuffer.insert(m_newerBuffer.end(), messages.begin(), messages.end());
+    } else {
+        // Asked for before the view was cleared.
+        return;
+    }
+    FillFromBuffers();
+    Prefetch();
 }
 
-void MessageView::UpdateLayoutAndScroll(const std::vector<Message>& messages, bool isHistoryResponse) {
+void MessageView::UpdateLayoutAndScroll(const std::vector<Message>& messages, bool prepend, bool isHistoryResponse) {
     int oldScrollY = GetVisibleRowsBegin();
-    bool wasEmpty = m_messageWidgets.empty();
+    bool wasEmpty = m_rows.empty();
 
-    if (m_loadingOlder) {
+    if (prepend) {
         int addedHeight = 0;
         for (const auto& msg : messages) {
-            AddMessageWidget(msg, true);
-            addedHeight += m_messageWidgets.front()->GetBestSize().y;
+            AddRow(msg, true);
+            addedHeight += m_rows.front().height;
         }
-        TrimWidgets(false);
-        SetUnitCount(CalculateTotalHeight());
+        TrimRows(false);
+        UpdateUnitCount();
         if(wasEmpty) {
             ScrollToRow(GetUnitCount() - GetClientSize().y);
         } else {
@@ -132,22 +446,22 @@ void MessageView::UpdateLayoutAndScroll(const std::vector<Message>& messages, bo
     } else {
         bool wasAtBottom = GetVisibleRowsBegin() + GetClientSize().y >= GetUnitCount() - 5;
         int removedHeight = 0;
-        
-        if(m_messageWidgets.size() + messages.size() > MAX_MESSAGES) {
-            auto numToRemove = m_messageWidgets.size() + messages.size() - MAX_MESSAGES;
+
+        if(m_rows.size() + messages.size() > MAX_MESSAGES) {
+            auto numToRemove = m_rows.size() + messages.size() - MAX_MESSAGES;
 
             for(std::size_t i = 0; i < numToRemove; ++i) {
-                if(i == m_messageWidgets.size()) {
+                if(i == m_rows.size()) {
                     break;
                 }
-                removedHeight += m_messageWidgets[i]->GetBestSize().y;
+                removedHeight += m_rows[i].height;
             }
         }
         for(const auto& msg : messages) {
-            AddMessageWidget(msg, false);
+            AddRow(msg, false);
         }
-        TrimWidgets(true);
-        SetUnitCount(CalculateTotalHeight());
+        TrimRows(true);
+        UpdateUnitCount();
         if(!isHistoryResponse && wasAtBottom) {
             ScrollToRow(GetUnitCount());
         } else {
@@ -156,33 +470,11 @@ void MessageView::UpdateLayoutAndScroll(const std::vector<Message>& messages, bo
         }
     }
 
-    UpdateWidgetPositions();
-}
-
-void MessageView::UpdateWidgetPositions() {
-    wxCoord scrollY = GetVisibleRowsBegin();
-    wxCoord clientHeight = GetClientSize().y;
-    wxCoord containerWidth = GetClientSize().x;
-    const wxCoord padding = FromDIP(100); 
-    wxCoord currentY = 0;
-    for (auto* widget : m_messageWidgets) {
-        wxCoord h = widget->GetBestSize().y;
-        auto wasHidden = !widget->IsShown();
-        if ((currentY + h) > (scrollY - padding) && (currentY < scrollY + clientHeight + padding)) {
-            wxCoord physicalY = currentY - scrollY;
-            widget->SetSize(0, physicalY, containerWidth, h);
-            if(wasHidden) {
-                widget->InvalidateCaches();
-                widget->Show();
-            }
-        } else {
-            if(!wasHidden) {
-                widget->Hide();
-            }
-        }
-        currentY += h;
-    }
+    // Rows added above move the content, not the user.
+    m_lastScrollPos += GetVisibleRowsBegin() - oldScrollY;
 
+    UpdateHoveredRow();
+    Refresh();
     CheckAndUpdateSnapState();
 }
 
@@ -190,88 +482,102 @@ void MessageView::ReWrapAllMessages(int wrapWidth) {
     if (wrapWidth <= 0 || m_lastKnownWrapWidth == wrapWidth) return;
     m_lastKnownWrapWidth = wrapWidth;
     wxCoord oldScrollY = GetVisibleRowsBegin();
-    for(auto* widget : m_messageWidgets) {
-        //if(widget->IsShown()) {
-            widget->SetWrappedMessage(m_lastKnownWrapWidth);
-        //}
+    for(auto& row : m_rows) {
+        LayoutRow(row);
     }
-    SetUnitCount(CalculateTotalHeight());
+    m_heights.Rebuild(m_rows | std::views::transform(&MessageRow::height));
+    UpdateUnitCount();
     ScrollToRow(oldScrollY);
-    UpdateWidgetPositions();
+    Refresh();
+    CheckAndUpdateSnapState();
 }
 
 void MessageView::Clear() {
-    for(auto& m : m_messageWidgets) {
-        m_widgetsPool.return_instance(std::move(m));
-    }
-    m_messageWidgets.clear();
-    SetUnitCount(0);
+    m_rows.clear();
+    m_heights.Clear();
+    UpdateUnitCount();
+    m_hoveredRow = NO_ROW;
     m_loadingOlder = false;
     m_loadingNewer = false;
+    m_jumpTarget = 0;
+    m_olderBuffer.clear();
+    m_newerBuffer.clear();
+    m_olderExhausted = false;
+    m_newerExhausted = true;
+    m_ownKeys.clear();
+    m_scrollVelocity = 0.0;
+    m_lastScrollPos = 0;
+    // The room is left or reloaded, the lines only it drew age out of the shared cache.
+    LineBitmapCache::Get().TrimIdle();
+    Refresh();
 }
 
 wxCoord MessageView::OnGetRowHeight([[maybe_unused]] size_t row) const {
     return 1;
 }
 
-void MessageView::AddMessageWidget(const Message& msg, bool prepend) {
-    
-    auto* msgWidget = m_widgetsPool.get_instance(this, msg, m_lastKnownWrapWidth);
+void MessageView::AddRow(const Message& msg, bool prepend) {
+    MessageRow& row = prepend ? m_rows.emplace_front() : m_rows.emplace_back();
+    row.user = msg.user;
+    row.userId = msg.userId;
+    row.timestamp = msg.timestamp;
+    row.messageId = msg.messageId;
+    row.time = FormatTime(msg.timestamp);
+    row.text.SetText(wxString::FromUTF8(msg.msg));
+    row.clientKey = msg.clientKey;
+    LayoutRow(row);
     if (prepend) {
-        m_messageWidgets.push_front(msgWidget);
+        m_heights.PushFront(row.height);
     } else {
-        m_messageWidgets.push_back(msgWidget);
+        m_heights.PushBack(row.height);
     }
 }
 
-int MessageView::TrimWidgets(bool fromTop) {
+int MessageView::TrimRows(bool fromTop) {
     int numRemoved = 0;
-    while (m_messageWidgets.size() > MAX_MESSAGES) {
-        MessageWidget* toDelete = nullptr;
+    while (m_rows.size() > MAX_MESSAGES) {
         if (fromTop) {
-            toDelete = m_messageWidgets.front();
-            m_messageWidgets.pop_front();
+            m_olderBuffer.push_front(ToMessage(m_rows.front()));
+            m_rows.pop_front();
+            m_heights.PopFront();
         } else {
-            toDelete = m_messageWidgets.back();
-            m_messageWidgets.pop_back();
-        }
-        if (toDelete) {
-            toDelete->Hide();
-            m_widgetsPool.return_instance(std::move(toDelete));
+            m_newerBuffer.push_front(ToMessage(m_rows.back()));
+            m_rows.pop_back();
+            m_heights.PopBack();
         }
         numRemoved++;
     }
-    return numRemoved;
-}
-
-wxCoord MessageView::CalculateTotalHeight() const {
-    wxCoord totalHeight = 0;
-    for(const auto* widget : m_messageWidgets) {
-        totalHeight += widget->GetBestSize().y;
+    // The far end of an overfull buffer is dropped and fetched again if scrolled to.
+    auto& buffer = fromTop ? m_olderBuffer : m_newerBuffer;
+    if (buffer.size() > MAX_BUFFERED) {
+        buffer.resize(MAX_BUFFERED);
+        (fromTop ? m_olderExhausted : m_newerExhausted) = false;
     }
-    return totalHeight;
+    return numRemoved;
 }
 
-void MessageView::LoadOlderMessages() {
+void MessageView::LoadOlderMessages(int count) {
     if(m_loadingOlder) {
         return;
     }
     m_loadingOlder = true;
-    const auto topTimestamp = m_messageWidgets.empty() ? 32517734834000000 : m_messageWidgets.front()->GetTimestampValue();
-    m_chatPanelParent->GetMainWidget()->wsClient->getMessages(CHUNK_SIZE, topTimestamp);
+    // Continues from the oldest message held, buffered or not.
+    const auto topTimestamp = !m_olderBuffer.empty() ? m_olderBuffer.back().timestamp
+        : m_rows.empty() ? 32517734834000000 : m_rows.front().timestamp;
+    m_chatPanelParent->GetMainWidget()->wsClient->getMessages(count, topTimestamp);
 }
 
-void MessageView::LoadNewerMessages() {
-    if(m_loadingNewer || m_messageWidgets.empty()) {
+void MessageView::LoadNewerMessages(int count) {
+    if(m_loadingNewer || m_rows.empty()) {
         return;
     }
     m_loadingNewer = true;
-    const auto bottomTimestamp = m_messageWidgets.back()->GetTimestampValue();
-    m_chatPanelParent->GetMainWidget()->wsClient->getMessages(-CHUNK_SIZE, bottomTimestamp);
+    const auto bottomTimestamp = !m_newerBuffer.empty() ? m_newerBuffer.back().timestamp : m_rows.back().timestamp;
+    m_chatPanelParent->GetMainWidget()->wsClient->getMessages(-count, bottomTimestamp);
 }
 
 bool MessageView::IsSnappedToBottom() const {
-    if(m_messageWidgets.empty()) {
+    if(m_rows.empty()) {
         return true;
     }
 
@@ -300,36 +606,151 @@ void MessageView::JumpToPresent() {
     Start();
 }
 
+void MessageView::JumpToMessage(int32_t messageId) {
+    Clear();
+    m_jumpTarget = messageId;
+    // Live messages wait for the newer pages, until the window shows whether it reaches the present.
+    m_newerExhausted = false;
+    m_chatPanelParent->GetMainWidget()->wsClient->getMessagesAround(messageId, JUMP_CONTEXT, JUMP_CONTEXT);
+}
+
+void MessageView::OnMessagesAround(int32_t messageId, const std::vector<Message>& messages, bool hasOlder, bool hasNewer) {
+    if(messageId != m_jumpTarget) {
+        // Asked for before the view was cleared or jumped elsewhere.
+        return;
+    }
+    m_jumpTarget = 0;
+    if(messages.empty()) {
+        // Not found, the view goes back to the present.
+        Start();
+        return;
+    }
+    for(const auto& message : messages) {
+        AddRow(message, false);
+    }
+    m_olderExhausted = !hasOlder;
+    m_newerExhausted = !hasNewer;
+    UpdateUnitCount();
+
+    // The message itself, or where it was, in the middle of the view.
+    size_t anchor = 0;
+    while(anchor + 1 < m_rows.size() && m_rows[anchor].messageId != messageId && m_rows[anchor + 1].messageId <= messageId) {
+        ++anchor;
+    }
+    const wxCoord top = m_heights.Top(anchor) - (GetClientSize().y - m_rows[anchor].height) / 2;
+    ScrollToRow((std::max)(0, top));
+    m_lastScrollPos = GetVisibleRowsBegin();
+
+    UpdateHoveredRow();
+    Refresh();
+    CheckAndUpdateSnapState();
+    Prefetch();
+}
+
 void MessageView::DeleteMessageById(int32_t messageId) {
-    auto it = std::find_if(m_messageWidgets.begin(), m_messageWidgets.end(),
-        [messageId](const MessageWidget* widget) {
-            return widget->GetMessageId() == messageId;
+    const auto deleted = [messageId](const Message& message) { return message.messageId == messageId; };
+    std::erase_if(m_olderBuffer, deleted);
+    std::erase_if(m_newerBuffer, deleted);
+
+    auto it = std::find_if(m_rows.begin(), m_rows.end(),
+        [messageId](const MessageRow& row) {
+            return row.messageId == messageId;
         });
 
-    if (it != m_messageWidgets.end()) {
-        MessageWidget* widgetToRemove = *it;
-        m_widgetsPool.return_instance(std::move(widgetToRemove));
-        m_messageWidgets.erase(it);
-        SetUnitCount(CalculateTotalHeight());
-        UpdateWidgetPositions();
+    if (it != m_rows.end()) {
+        m_heights.Erase(static_cast<size_t>(it - m_rows.begin()));
+        m_rows.erase(it);
+        UpdateUnitCount();
+        UpdateHoveredRow();
+        Refresh();
+        CheckAndUpdateSnapState();
     }
 }
 
 void MessageView::UpdateUsername(int32_t userId, const wxString& newUsername) {
-    for (auto message : m_messageWidgets) {
-        if (message->GetUserId() == userId) {
-            Message msg{
-                .user = newUsername,
-                .userId = userId,
-                .msg = message->GetMessageValue(),
-                .timestamp = message->GetTimestampValue(),
-                .messageId = message->GetMessageId(),
-            };
-            message->Update(this, msg, m_lastKnownWrapWidth);
+    const UserName name = UserNames::Intern(newUsername);
+    for (auto& row : m_rows) {
+        if (row.userId == userId) {
+            row.user = name;
+        }
+    }
+    for (auto* buffer : {&m_olderBuffer, &m_newerBuffer}) {
+        for (auto& message : *buffer) {
+            if (message.userId == userId) {
+                message.user = name;
+            }
         }
     }
-    UpdateWidgetPositions();
     Refresh();
 }
 
+void MessageView::AddPending(const Message& message) {
+    // Away from the present the rows do not continue with live messages, it shows once broadcast.
+    if (!m_newerExhausted || !m_newerBuffer.empty()) {
+        return;
+    }
+    UpdateLayoutAndScroll({message}, false, false);
+    m_rows.back().delivery = Delivery::Pending;
+    m_ownKeys.insert(message.clientKey);
+    // The sender wants to see what they sent, wherever they were scrolled to.
+    ScrollToRow(GetUnitCount());
+    Refresh();
+    CheckAndUpdateSnapState();
+}
+
+void MessageView::ConfirmPending(const Message& message) {
+    MessageRow* row = FindOwnRow(message.clientKey);
+    if (!row || row->delivery != Delivery::Pending) {
+        return;
+    }
+    row->messageId = message.messageId;
+    row->timestamp = message.timestamp;
+    row->time = FormatTime(message.timestamp);
+    row->delivery = Delivery::Sent;
+    Refresh();
+}
+
+bool MessageView::FailPending(const std::string& clientKey) {
+    MessageRow* row = FindOwnRow(clientKey);
+    if (!row) {
+        return false;
+    }
+    row->delivery = Delivery::Failed;
+    row->clientKey.clear();
+    m_ownKeys.erase(clientKey);
+    Refresh();
+    return true;
+}
+
+MessageRow* MessageView::FindOwnRow(const std::string& clientKey) {
+    if (clientKey.empty() || !m_ownKeys.contains(clientKey)) {
+        return nullptr;
+    }
+    // Rows of messages being sent are near the bottom.
+    auto it = std::find_if(m_rows.rbegin(), m_rows.rend(), [&clientKey](const MessageRow& row) { return row.clientKey == clientKey; });
+    return it != m_rows.rend() ? &*it : nullptr;
+}
+
+std::vector<Message> MessageView::ReconcileOwnMessages(const std::vector<Message>& messages) {
+    std::vector<Message> others;
+    others.reserve(messages.size());
+    for (const auto& message : messages) {
+        MessageRow* row = FindOwnRow(message.clientKey);
+        if (!row) {
+            // The keys of the other senders mean nothing here.
+            others.emplace_back(message).clientKey.clear();
+            continue;
+        }
+        // The row already shows it, it only takes the server's identity if not confirmed yet.
+        row->messageId = message.messageId;
+        row->timestamp = message.timestamp;
+        row->time = FormatTime(message.timestamp);
+        row->delivery = Delivery::Sent;
+        row->clientKey.clear();
+        m_ownKeys.erase(message.clientKey);
+        Refresh();
+    }
+    return others;
+}
+
 } // namespace client
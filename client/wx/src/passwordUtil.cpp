@@ -5,6 +5,13 @@
 #include <sstream>
 #include <iomanip>
 #include <random>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <wx/app.h>
+#include <drogon/utils/Utilities.h>
 
 namespace client {
 
@@ -53,6 +60,110 @@ std::string generate_salt() {
     return to_hex(salt_bytes.data(), salt_bytes.size());
 }
 
+// Single background thread running the hashes one after another. argon2 already
+// spreads one hash over `parallelism` threads, so more workers would only compete.
+class HashWorker {
+public:
+    static HashWorker& instance() {
+        static HashWorker worker;
+        return worker;
+    }
+
+    void post(std::function<void()> job) {
+        {
+            std::lock_guard lock(mutex);
+            jobs.push_back(std::move(job));
+        }
+        wake.notify_one();
+    }
+
+    ~HashWorker() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+            jobs.clear();
+        }
+        wake.notify_one();
+        if (thread.joinable()) thread.join();
+    }
+
+private:
+    HashWorker() : thread([this] { run(); }) {}
+    HashWorker(const HashWorker&) = delete;
+    HashWorker& operator=(const HashWorker&) = delete;
+
+    void run() {
+        std::unique_lock lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+            if (stopping) return;
+            auto job = std::move(jobs.front());
+            jobs.pop_front();
+            lock.unlock();
+            job();
+            lock.lock();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::function<void()>> jobs;
+    bool stopping = false;
+    std::thread thread;
+};
+
+void hash_password_async(std::string password, std::string salt, HashCallback done) {
+    HashWorker::instance().post([password = std::move(password), salt = std::move(salt), done = std::move(done)]() mutable {
+        std::optional<std::string> hash;
+        std::string error;
+        try {
+            hash = hash_password(password, salt);
+        } catch (const std::exception& ex) {
+            error = ex.what();
+        }
+        if (wxTheApp) {
+            wxTheApp->CallAfter([done = std::move(done), hash = std::move(hash), error = std::move(error)]() mutable {
+                done(std::move(hash), error);
+            });
+        }
+    });
+}
+
+// A remembered key and what it was derived from. The password itself is not kept,
+// only a digest of it under a per-process pepper, enough to tell it was retyped unchanged.
+struct DerivedKey {
+    std::string salt;
+    std::string fingerprint;
+    std::string hash;
+};
+
+// Touched only from the UI thread.
+static std::map<std::pair<std::string, std::string>, DerivedKey> derived_keys;
+
+static std::string fingerprint(const std::string& password, const std::string& salt) {
+    static const std::string pepper = generate_salt();
+    return drogon::utils::getSha256(pepper + salt + password);
+}
+
+void derive_key_async(const std::string& server, const std::string& user,
+                      std::string password, std::string salt, HashCallback done) {
+    auto key = std::make_pair(server, user);
+    auto print = fingerprint(password, salt);
+    if (auto it = derived_keys.find(key); it != derived_keys.end()
+        && it->second.salt == salt && it->second.fingerprint == print) {
+        done(it->second.hash, {});
+        return;
+    }
+
+    hash_password_async(std::move(password), salt,
+        [key = std::move(key), salt, print = std::move(print), done = std::move(done)](std::optional<std::string> hash, const std::string& error) {
+            if (hash) {
+                derived_keys[key] = DerivedKey{salt, print, *hash};
+            }
+            done(std::move(hash), error);
+        });
+}
+
 } // namespace password
 
 } // namespace client
@@ -6,16 +6,159 @@
 #include <client/accountSettings.h>
 #include <client/chatInterface.h>
 #include <client/chatPanel.h>
+#include <algorithm>
+#include <iterator>
+#include <tuple>
 
 namespace client {
 
+// What rooms are sorted and filtered by.
+static wxString KeyOf(const Room& room) {
+    return room.room_name.Lower();
+}
+
+// The first of the sorted `entries` not before the room with the key and ID.
+template <typename Entries>
+static auto LowerBound(Entries& entries, const wxString& key, int32_t roomId) {
+    return std::lower_bound(entries.begin(), entries.end(), std::tie(key, roomId), [](const auto& entry, const auto& value) {
+        return std::tie(entry.key, entry.room->room_id) < value;
+    });
+}
+
+RoomListView::RoomListView(wxWindow* parent, wxWindowID id)
+    : wxVListBox(parent, id) {
+    Bind(wxEVT_DPI_CHANGED, &RoomListView::OnDPIChanged, this);
+    UpdateMetrics();
+    SetItemCount(0);
+}
+
+void RoomListView::UpdateMetrics() {
+    m_rowHeight = GetCharHeight() + 2 * FromDIP(4);
+}
+
+void RoomListView::OnDPIChanged(wxDPIChangedEvent& event) {
+    UpdateMetrics();
+    RefreshAll();
+    event.Skip();
+}
+
+bool RoomListView::Matches(const Entry& entry) const {
+    return entry.key.find(m_filter) != wxString::npos;
+}
+
+void RoomListView::SetRooms(const std::vector<Room*>& rooms) {
+    m_sorted.clear();
+    m_sorted.reserve(rooms.size());
+    for (Room* room : rooms) {
+        m_sorted.push_back(Entry{KeyOf(*room), room});
+    }
+    std::sort(m_sorted.begin(), m_sorted.end(), [](const Entry& lhs, const Entry& rhs) {
+        return std::tie(lhs.key, lhs.room->room_id) < std::tie(rhs.key, rhs.room->room_id);
+    });
+    m_shown.clear();
+    if (!m_filter.empty()) {
+        std::copy_if(m_sorted.begin(), m_sorted.end(), std::back_inserter(m_shown), [this](const Entry& entry) { return Matches(entry); });
+    }
+    RowsChanged(nullptr);
+}
+
+int RoomListView::Insert(Room* room) {
+    const Room* selected = GetSelectedRoom();
+    Entry entry{KeyOf(*room), room};
+    if (!m_filter.empty() && Matches(entry)) {
+        m_shown.insert(LowerBound(m_shown, entry.key, room->room_id), entry);
+    }
+    const auto at = LowerBound(m_sorted, entry.key, room->room_id);
+    m_sorted.insert(at, std::move(entry));
+    RowsChanged(selected);
+    return FindRow(room);
+}
+
+void RoomListView::Erase(const Room* room) {
+    const Room* selected = GetSelectedRoom();
+    const wxString key = KeyOf(*room);
+    for (auto* entries : {&m_sorted, &m_shown}) {
+        const auto it = LowerBound(*entries, key, room->room_id);
+        if (it != entries->end() && it->room == room) {
+            entries->erase(it);
+        }
+    }
+    RowsChanged(selected == room ? nullptr : selected);
+}
+
+void RoomListView::RefreshRoom(const Room* room) {
+    const int row = FindRow(room);
+    if (row != wxNOT_FOUND) {
+        RefreshRow(row);
+    }
+}
+
+void RoomListView::SetFilter(const wxString& filter) {
+    const wxString lower = filter.Lower();
+    if (lower == m_filter) {
+        return;
+    }
+    const Room* selected = GetSelectedRoom();
+    // Typing narrows what is already shown, anything else filters every room again.
+    const bool narrows = !m_filter.empty() && lower.find(m_filter) != wxString::npos;
+    m_filter = lower;
+    if (m_filter.empty()) {
+        m_shown.clear();
+    } else if (narrows) {
+        std::erase_if(m_shown, [this](const Entry& entry) { return !Matches(entry); });
+    } else {
+        m_shown.clear();
+        std::copy_if(m_sorted.begin(), m_sorted.end(), std::back_inserter(m_shown), [this](const Entry& entry) { return Matches(entry); });
+    }
+    RowsChanged(selected);
+}
+
+int RoomListView::FindRow(const Room* room) const {
+    const auto& shown = Shown();
+    const auto it = LowerBound(shown, KeyOf(*room), room->room_id);
+    if (it == shown.end() || it->room != room) {
+        return wxNOT_FOUND;
+    }
+    return static_cast<int>(it - shown.begin());
+}
+
+Room* RoomListView::GetSelectedRoom() const {
+    const int sel = GetSelection();
+    if (sel == wxNOT_FOUND || static_cast<size_t>(sel) >= Shown().size()) {
+        return nullptr;
+    }
+    return Shown()[sel].room;
+}
+
+void RoomListView::RowsChanged(const Room* selected) {
+    SetItemCount(Shown().size());
+    SetSelection(selected ? FindRow(selected) : wxNOT_FOUND);
+    RefreshAll();
+}
+
+wxCoord RoomListView::OnMeasureItem([[maybe_unused]] size_t n) const {
+    return m_rowHeight;
+}
+
+void RoomListView::OnDrawItem(wxDC& dc, const wxRect& rect, size_t n) const {
+    const auto& shown = Shown();
+    if (n >= shown.size()) {
+        return;
+    }
+    const wxRect text = rect.Deflate(FromDIP(5), 0);
+    dc.SetFont(GetFont());
+    dc.SetTextForeground(IsSelected(n) ? wxSystemSettings::GetColour(wxSYS_COLOUR_HIGHLIGHTTEXT) : GetForegroundColour());
+    dc.DrawLabel(wxControl::Ellipsize(shown[n].room->Label(), dc, wxELLIPSIZE_END, text.width), text, wxALIGN_LEFT | wxALIGN_CENTER_VERTICAL);
+}
+
 enum {
     ID_LIST_MY_ROOMS = wxID_HIGHEST + 20,
     ID_LIST_PUBLIC_ROOMS,
     ID_JOIN,
     ID_CREATE,
     ID_LOGOUT,
-    ID_ACCOUNT
+    ID_ACCOUNT,
+    ID_FILTER
 };
 
 wxBEGIN_EVENT_TABLE(RoomsPanel, wxPanel)
@@ -26,12 +169,16 @@ wxBEGIN_EVENT_TABLE(RoomsPanel, wxPanel)
     EVT_LISTBOX_DCLICK(ID_LIST_MY_ROOMS, RoomsPanel::OnMyRoomSelected)
     EVT_LISTBOX(ID_LIST_PUBLIC_ROOMS, RoomsPanel::OnPublicRoomSelected)
     EVT_BUTTON(ID_ACCOUNT, RoomsPanel::OnAccount)
+    EVT_TEXT(ID_FILTER, RoomsPanel::OnFilter)
 wxEND_EVENT_TABLE()
 
 RoomsPanel::RoomsPanel(wxWindow* parent) : wxPanel(parent), mainWin(static_cast<MainWidget*>(parent->GetParent())) {
     auto* sizer = new wxBoxSizer(wxVERTICAL);
 
     // --- Create ALL widgets ---
+    m_filter = new wxSearchCtrl(this, ID_FILTER);
+    m_filter->SetDescriptiveText("Find a room");
+    m_filter->ShowCancelButton(true);
     m_notebook = new wxNotebook(this, wxID_ANY);
     m_createButton = new wxButton(this, ID_CREATE, "Create");
     m_logoutButton = new wxButton(this, ID_LOGOUT, "Logout");
@@ -40,14 +187,14 @@ RoomsPanel::RoomsPanel(wxWindow* parent) : wxPanel(parent), mainWin(static_cast<
     // --- Create notebook pages and their sizers ---
     auto* myRoomsPage = new wxPanel(m_notebook);
     auto* myRoomsSizer = new wxBoxSizer(wxVERTICAL);
-    m_myRoomsList = new wxListBox(myRoomsPage, ID_LIST_MY_ROOMS);
+    m_myRoomsList = new RoomListView(myRoomsPage, ID_LIST_MY_ROOMS);
     myRoomsSizer->Add(m_myRoomsList, 1, wxEXPAND | wxALL, FromDIP(5));
     myRoomsPage->SetSizer(myRoomsSizer);
     m_notebook->AddPage(myRoomsPage, "My rooms");
 
     auto* publicRoomsPage = new wxPanel(m_notebook);
     auto* publicRoomsSizer = new wxBoxSizer(wxVERTICAL);
-    m_publicRoomsList = new wxListBox(publicRoomsPage, ID_LIST_PUBLIC_ROOMS);
+    m_publicRoomsList = new RoomListView(publicRoomsPage, ID_LIST_PUBLIC_ROOMS);
     publicRoomsSizer->Add(m_publicRoomsList, 1, wxEXPAND | wxALL, FromDIP(5));
 
     m_joinButton = new wxButton(publicRoomsPage, ID_JOIN, "Join");
@@ -58,6 +205,7 @@ RoomsPanel::RoomsPanel(wxWindow* parent) : wxPanel(parent), mainWin(static_cast<
     m_notebook->AddPage(publicRoomsPage, "Public rooms");
 
     // --- Add items to the main sizer ---
+    sizer->Add(m_filter, 0, wxEXPAND | wxLEFT | wxRIGHT | wxTOP, FromDIP(5));
     sizer->Add(m_notebook, 1, wxEXPAND | wxALL, FromDIP(5));
     sizer->Add(m_createButton, 0, wxALIGN_CENTER | wxALL, FromDIP(5));
 
@@ -70,100 +218,106 @@ RoomsPanel::RoomsPanel(wxWindow* parent) : wxPanel(parent), mainWin(static_cast<
 
     SetSizer(sizer);
 
-    // Give the listbox temporary, logical content.
+    // The virtual list has no content to be measured by, so it is as wide as
+    // temporary, logical content would be.
     wxString placeholder("  My rooms  Public rooms  ");
-    m_myRoomsList->Append(placeholder);
+    m_myRoomsList->SetMinSize(wxSize(GetTextExtent(placeholder).x, -1));
 
-    // Now that the content has a size, ask the sizer to calculate the
-    // ideal size for the entire panel and apply it.
+    // Ask the sizer to calculate the ideal size for the entire panel and apply it.
     sizer->Fit(this);
 
     // Lock in this calculated size as the panel's minimum size.
     SetMinSize(GetSize());
+}
 
-    // Remove the temporary content. The minimum size is now correctly set.
-    m_myRoomsList->Clear();
+Room* RoomsPanel::FindRoom(int32_t room_id) const {
+    auto it = m_rooms.find(room_id);
+    return it == m_rooms.end() ? nullptr : it->second.get();
 }
 
 void RoomsPanel::UpdateRoomList(const std::vector<Room*>& rooms) {
-    m_myRoomsList->Clear();
-    m_publicRoomsList->Clear();
-    for (auto* room : rooms){
-        if (room->is_member) {
-            m_myRoomsList->Append(room->room_name, room);
-        }
-        else {
-            m_publicRoomsList->Append(room->room_name, room);
-        }
+    m_rooms.clear();
+    std::vector<Room*> myRooms;
+    std::vector<Room*> publicRooms;
+    for (auto* room : rooms) {
+        (room->is_member ? myRooms : publicRooms).push_back(room);
+        m_rooms[room->room_id].reset(room);
     }
+    m_myRoomsList->SetRooms(myRooms);
+    m_publicRoomsList->SetRooms(publicRooms);
+    m_joinButton->Disable();
 }
 
 void RoomsPanel::AddRoom(Room* room) {
+    if (auto it = m_rooms.find(room->room_id); it != m_rooms.end()) {
+        ListOf(*it->second)->Erase(it->second.get());
+    }
+    m_rooms[room->room_id].reset(room);
+    const int row = ListOf(*room)->Insert(room);
     if (room->is_member) {
-        int newIndex = m_myRoomsList->Append(room->room_name, room);
-        m_myRoomsList->SetSelection(newIndex);
         m_notebook->SetSelection(0);
-    }
-    else {
-        m_publicRoomsList->Append(room->room_name, room);
+        if (row != wxNOT_FOUND) {
+            m_myRoomsList->SetSelection(row);
+        }
     }
 }
 
 void RoomsPanel::RemoveRoom(int32_t room_id) {
-    for (unsigned int i = 0; i < m_myRoomsList->GetCount(); ++i) {
-        Room* roomData = dynamic_cast<Room*>(m_myRoomsList->GetClientObject(i));
-        if (roomData && roomData->room_id == room_id) {
-            m_myRoomsList->Delete(i);
-            return;
-        }
-    }
-    for (unsigned int i = 0; i < m_publicRoomsList->GetCount(); ++i) {
-        Room* roomData = dynamic_cast<Room*>(m_publicRoomsList->GetClientObject(i));
-        if (roomData && roomData->room_id == room_id) {
-            m_publicRoomsList->Delete(i);
-            return;
-        }
+    auto it = m_rooms.find(room_id);
+    if (it == m_rooms.end()) {
+        return;
     }
+    ListOf(*it->second)->Erase(it->second.get());
+    m_rooms.erase(it);
+    m_joinButton->Enable(m_publicRoomsList->GetSelection() != wxNOT_FOUND);
 }
 
 void RoomsPanel::RenameRoom(int32_t room_id, const wxString& name) {
-    for (unsigned int i = 0; i < m_myRoomsList->GetCount(); ++i) {
-        Room* roomData = dynamic_cast<Room*>(m_myRoomsList->GetClientObject(i));
-        if (roomData && roomData->room_id == room_id) {
-            roomData->room_name = name;
-            m_myRoomsList->SetString(i, name);
-            break;
-        }
+    Room* room = FindRoom(room_id);
+    if (!room) {
+        return;
     }
-    for (unsigned int i = 0; i < m_publicRoomsList->GetCount(); ++i) {
-        Room* roomData = dynamic_cast<Room*>(m_publicRoomsList->GetClientObject(i));
-        if (roomData && roomData->room_id == room_id) {
-            roomData->room_name = name;
-            m_publicRoomsList->SetString(i, name);
-            break;
-        }
+    RoomListView* list = ListOf(*room);
+    const bool selected = list->GetSelectedRoom() == room;
+    list->Erase(room);
+    room->room_name = name;
+    const int row = list->Insert(room);
+    if (selected && row != wxNOT_FOUND) {
+        list->SetSelection(row);
     }
 }
 
-std::optional<Room> RoomsPanel::GetSelectedRoom() {
-    wxListBox* activeList = nullptr;
-    if (m_notebook->GetSelection() == 0) {
-        activeList = m_myRoomsList;
-    }
-    else {
-        activeList = m_publicRoomsList;
+void RoomsPanel::SetUnread(int32_t room_id, int64_t unread) {
+    if (Room* room = FindRoom(room_id)) {
+        room->unread = unread;
+        ListOf(*room)->RefreshRoom(room);
     }
+}
 
-    int sel = activeList->GetSelection();
-    if(sel != wxNOT_FOUND) {
-        Room* roomData = dynamic_cast<Room*>(activeList->GetClientObject(sel));
-        if (roomData){
-            return *roomData;
-        }
+std::optional<Room> RoomsPanel::GetSelectedRoom() {
+    RoomListView* activeList = m_notebook->GetSelection() == 0 ? m_myRoomsList : m_publicRoomsList;
+    if (const Room* room = activeList->GetSelectedRoom()) {
+        return *room;
     }
     return std::nullopt;
 }
 
+void RoomsPanel::SelectRoom(int32_t room_id) {
+    Room* room = FindRoom(room_id);
+    if (!room) {
+        return;
+    }
+    RoomListView* list = ListOf(*room);
+    int row = list->FindRow(room);
+    if (row == wxNOT_FOUND) {
+        // Hidden by the filter, which would hide the room rejoined as well.
+        m_filter->Clear();
+        row = list->FindRow(room);
+    }
+    m_notebook->SetSelection(room->is_member ? 0 : 1);
+    list->SetSelection(row);
+}
+
 void RoomsPanel::OnJoinRoom() {
     auto selectedRoomOpt = GetSelectedRoom();
     if (!selectedRoomOpt.has_value()) {
@@ -184,20 +338,18 @@ void RoomsPanel::OnBecameMember() {
         return;
     }
 
-    Room selectedRoom = *selectedRoomOpt;
-
-    for (unsigned int i = 0; i < m_publicRoomsList->GetCount(); ++i) {
-        Room* publicRoomData = dynamic_cast<Room*>(m_publicRoomsList->GetClientObject(i));
-        Room* myNewRoom = new Room(*publicRoomData);
-        if (myNewRoom && myNewRoom->room_id == selectedRoom.room_id) {
-            m_publicRoomsList->Delete(i);
-
-            myNewRoom->is_member = true;
-            AddRoom(myNewRoom);
-
-            break;
-        }
+    Room* room = FindRoom(selectedRoomOpt->room_id);
+    if (!room || room->is_member) {
+        return;
     }
+    m_publicRoomsList->Erase(room);
+    room->is_member = true;
+    const int row = m_myRoomsList->Insert(room);
+    m_notebook->SetSelection(0);
+    if (row != wxNOT_FOUND) {
+        m_myRoomsList->SetSelection(row);
+    }
+    m_joinButton->Disable();
 }
 
 void RoomsPanel::OnMyRoomSelected(wxCommandEvent&) {
@@ -251,4 +403,11 @@ void RoomsPanel::OnAccount(wxCommandEvent&) {
     mainWin->ShowAccountSettings(true);
 }
 
+void RoomsPanel::OnFilter(wxCommandEvent&) {
+    const wxString filter = m_filter->GetValue();
+    m_myRoomsList->SetFilter(filter);
+    m_publicRoomsList->SetFilter(filter);
+    m_joinButton->Enable(m_publicRoomsList->GetSelection() != wxNOT_FOUND);
+}
+
 } // namespace client
@@ -1,6 +1,7 @@
 #include <client/serversPanel.h>
 #include <client/mainWidget.h>
 #include <client/wsClient.h>
+#include <algorithm>
 
 namespace client {
 
@@ -35,18 +36,19 @@ ServersPanel::ServersPanel(MainWidget* parent)
 
 void ServersPanel::OnConnect([[maybe_unused]] wxCommandEvent& event) {
     int selection = m_listBox->GetSelection();
-    if (selection != wxNOT_FOUND) {
-        wxString selectedItem = m_listBox->GetString(selection);
-        m_parent->wsClient->start(selectedItem.utf8_string());
+    if (selection != wxNOT_FOUND && static_cast<size_t>(selection) < m_hosts.size()) {
+        m_parent->wsClient->start(m_hosts[selection]);
     }
 }
 
 void ServersPanel::OnBack([[maybe_unused]] wxCommandEvent& event) {
+    m_userSelected = false;
     m_parent->ShowInitial();
 }
 
 void ServersPanel::OnListSelect([[maybe_unused]] wxCommandEvent& event) {
     // Whenever the selection changes, update the button states
+    m_userSelected = true;
     UpdateButtonsState();
 }
 
@@ -58,11 +60,43 @@ void ServersPanel::UpdateButtonsState() {
     m_connectButton->Enable(isItemSelected);
 }
 
-void ServersPanel::SetServers(const std::vector<std::string>& servers) {
+void ServersPanel::SetServers(const std::vector<ServerEntry>& servers) {
+    // Keeps the user's pick across re-rankings, otherwise the best ranked server is preselected.
+    std::string selected;
+    int selection = m_listBox->GetSelection();
+    if (m_userSelected && selection != wxNOT_FOUND && static_cast<size_t>(selection) < m_hosts.size()) {
+        selected = m_hosts[selection];
+    }
+
     m_listBox->Clear();
+    m_hosts.clear();
     for(const auto& server : servers) {
-        m_listBox->Append(wxString(server));
+        wxString label = wxString::FromUTF8(server.host);
+        if (!server.available) {
+            label += "  (unavailable)";
+        } else if (server.rttMs) {
+            label += wxString::Format("  (%.0f ms", *server.rttMs);
+            if (server.load) {
+                label += wxString::Format(", %.0f%% load", *server.load * 100.0);
+            }
+            label += ")";
+        }
+        m_listBox->Append(label);
+        m_hosts.push_back(server.host);
     }
+
+    if (!selected.empty()) {
+        auto it = std::find(m_hosts.begin(), m_hosts.end(), selected);
+        if (it != m_hosts.end()) {
+            m_listBox->SetSelection(static_cast<int>(it - m_hosts.begin()));
+        } else {
+            m_userSelected = false;
+        }
+    }
+    if (!m_userSelected && !servers.empty() && servers.front().available) {
+        m_listBox->SetSelection(0);
+    }
+    UpdateButtonsState();
 }
 
 } // namespace client
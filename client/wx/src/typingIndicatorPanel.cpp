@@ -41,6 +41,18 @@ namespace client {
         UpdateLabel();
     }
 
+    void TypingIndicatorPanel::SetTypingUsers(std::vector<wxString> usernames) {
+        m_typingUsers = std::move(usernames);
+
+        if (m_typingUsers.empty()) {
+            m_animationTimer.Stop();
+        }
+        else if (!m_animationTimer.IsRunning()) {
+            m_animationTimer.Start(600);
+        }
+        UpdateLabel();
+    }
+
     void TypingIndicatorPanel::Clear() {
         m_typingUsers.clear();
         m_animationTimer.Stop();
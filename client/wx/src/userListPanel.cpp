@@ -1,125 +1,318 @@
 #include <client/userListPanel.h>
-#include <client/userNameWidget.h>
 #include <client/chatPanel.h>
-#include <client/user.h>
+#include <client/lineBitmapCache.h>
+#include <wx/dcbuffer.h>
+#include <algorithm>
+#include <cmath>
 
 namespace client {
 
+// Display order: online first, then by role from the owner down, then by name.
+static bool DisplayOrder(const User* lhs, const User* rhs) {
+    return *rhs < *lhs;
+}
+
+static wxColour UserColour(const User& user) {
+    wxColour textColor;
+    switch (user.role) {
+        case chat::UserRights::OWNER:
+            textColor = *wxRED;
+            break;
+        case chat::UserRights::ADMIN:
+            textColor = *wxGREEN;
+            break;
+        case chat::UserRights::MODERATOR:
+            textColor = *wxBLUE;
+            break;
+        case chat::UserRights::REGULAR:
+        default:
+            textColor = wxSystemSettings::GetColour(wxSYS_COLOUR_WINDOWTEXT);
+            break;
+    }
+    if (user.count == 0) {
+        const unsigned char OFFLINE_ALPHA = 110;
+        textColor = wxColour(textColor.Red(), textColor.Green(), textColor.Blue(), OFFLINE_ALPHA);
+    }
+    return textColor;
+}
+
+UserListView::UserListView(wxWindow* parent, const std::vector<const User*>& users)
+    : wxVScrolledWindow(parent, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxVSCROLL | wxBORDER_NONE),
+      m_users(users) {
+    SetBackgroundStyle(wxBG_STYLE_PAINT);
+    SetBackgroundColour(wxSystemSettings::GetColour(wxSYS_COLOUR_WINDOW));
+    Bind(wxEVT_PAINT, &UserListView::OnPaint, this);
+    Bind(wxEVT_DPI_CHANGED, &UserListView::OnDPIChanged, this);
+    UpdateMetrics();
+    SetRowCount(0);
+}
+
+void UserListView::UpdateMetrics() {
+    wxMemoryDC dc;
+    wxBitmap tempBitmap(1, 1);
+    dc.SelectObject(tempBitmap);
+    dc.SetFont(GetFont());
+    const wxFontMetrics metrics = dc.GetFontMetrics();
+    wxDouble lineHeight = metrics.ascent + metrics.descent + metrics.externalLeading;
+    if (lineHeight <= 0) {
+        lineHeight = dc.GetCharHeight();
+    }
+    // The name with 5px of padding around it, and 2px between rows on each side.
+    m_rowHeight = static_cast<wxCoord>(std::ceil(lineHeight)) + 2 * FromDIP(5) + 2 * FromDIP(2);
+}
+
+void UserListView::OnDPIChanged(wxDPIChangedEvent& event) {
+    UpdateMetrics();
+    RefreshAll();
+    event.Skip();
+}
+
+void UserListView::RosterChanged() {
+    // Keeps the first visible row where it is, as far as the new count allows.
+    SetRowCount(m_users.size());
+    Refresh();
+}
+
+const User* UserListView::UserAt(const wxPoint& pos) const {
+    const int row = VirtualHitTest(pos.y);
+    if (row == wxNOT_FOUND || static_cast<size_t>(row) >= m_users.size()) {
+        return nullptr;
+    }
+    return m_users[row];
+}
+
+void UserListView::SetNearEndHandler(std::function<void()> handler) {
+    m_nearEnd = std::move(handler);
+}
+
+wxCoord UserListView::OnGetRowHeight([[maybe_unused]] size_t row) const {
+    return m_rowHeight;
+}
+
+void UserListView::OnPaint([[maybe_unused]] wxPaintEvent& event) {
+    wxAutoBufferedPaintDC dc(this);
+    const wxColour background = GetBackgroundColour();
+    dc.SetBackground(background);
+    dc.Clear();
+
+    auto& cache = LineBitmapCache::Get();
+    const size_t first = GetVisibleRowsBegin();
+    const size_t last = std::min(GetVisibleRowsEnd(), m_users.size());
+    for (size_t i = first; i < last; ++i) {
+        const User& user = *m_users[i];
+        const wxBitmap& name = cache.GetLine(user.username, GetFont(), UserColour(user), background);
+        if (name.IsOk()) {
+            const wxCoord top = static_cast<wxCoord>(i - first) * m_rowHeight;
+            dc.DrawBitmap(name, FromDIP(2) + FromDIP(5), top + FromDIP(2) + FromDIP(5));
+        }
+    }
+    // Within a screenful of the end, so the next page is there before it is scrolled to.
+    if (m_nearEnd && last + (last - first) >= m_users.size()) {
+        m_nearEnd();
+    }
+}
+
 UserListPanel::UserListPanel(wxWindow* parent)
     : wxPanel(parent, wxID_ANY) {
     SetBackgroundColour(wxSystemSettings::GetColour(wxSYS_COLOUR_WINDOW));
     
     auto* sizer = new wxBoxSizer(wxVERTICAL);
 
-    auto* header = new wxStaticText(this, wxID_ANY, "Users in room:");
-    header->SetForegroundColour(wxSystemSettings::GetColour(wxSYS_COLOUR_WINDOWTEXT));
-    sizer->Add(header, 0, wxALL, FromDIP(5));
+    m_header = new wxStaticText(this, wxID_ANY, "Users in room:");
+    m_header->SetForegroundColour(wxSystemSettings::GetColour(wxSYS_COLOUR_WINDOWTEXT));
+    sizer->Add(m_header, 0, wxALL, FromDIP(5));
 
-    m_userContainer = new wxScrolledWindow(this, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxVSCROLL);
-    m_userContainer->SetScrollRate(0, FromDIP(10));
-    m_userContainer->SetBackgroundColour(wxSystemSettings::GetColour(wxSYS_COLOUR_WINDOW));
-
-    m_userSizer = new wxBoxSizer(wxVERTICAL);
-    m_userContainer->SetSizer(m_userSizer);
+    m_userContainer = new UserListView(this, m_order);
+    m_userContainer->Bind(wxEVT_RIGHT_DOWN, &UserListPanel::OnUserRightClick, this);
+    m_userContainer->SetNearEndHandler([this] { RequestMembers(); });
 
     sizer->Add(m_userContainer, 1, wxEXPAND | wxLEFT | wxRIGHT | wxBOTTOM, FromDIP(5));
     SetSizer(sizer);
 }
 
-void UserListPanel::UpdateUserRole(int32_t userId, chat::UserRights newRole) {
-    std::for_each(m_users.begin(), m_users.end(), [userId, newRole](User& u) {
-        if(u.id == userId) {
-            u.role = newRole;
-        }
-    });
-
-    SetUserList(std::move(m_users));
+void UserListPanel::SyncCurrentUser(const User& user) {
+    auto* chatPanel = static_cast<ChatPanel*>(GetParent());
+    if (chatPanel->GetCurrentUser().id == user.id) {
+        chatPanel->SetCurrentUser(user);
+    }
 }
 
-void UserListPanel::UpdateUsername(int32_t userId, const wxString& newUsername) {
-    std::for_each(m_users.begin(), m_users.end(), [userId, newUsername](User& u) {
-        if (u.id == userId) {
-            u.username = newUsername;
-        }
-    });
-
-    SetUserList(std::move(m_users));
+void UserListPanel::Insert(const User& user) {
+    const User* stored = &m_users.emplace(user.id, user).first->second;
+    m_order.insert(std::lower_bound(m_order.begin(), m_order.end(), stored, DisplayOrder), stored);
+    SyncCurrentUser(*stored);
 }
 
-void UserListPanel::SetUserList(std::vector<User> users) {
-    m_userContainer->Freeze();
-
-    wxSizerItemList itemsToDestroy = m_userSizer->GetChildren();
-    for (wxSizerItem* item : itemsToDestroy) {
-        if (item->GetWindow()) {
-            item->GetWindow()->Destroy(); // Schedules deletion, modifies the original sizer's list
-        }
+template<typename Change>
+bool UserListPanel::Update(int32_t userId, Change&& change) {
+    auto it = m_users.find(userId);
+    if (it == m_users.end()) {
+        return false;
     }
-    m_userSizer->Clear(false); // Detach anything remaining
+    User& user = it->second;
+    // Found by its sort key before the change, then put back where its new key belongs.
+    m_order.erase(std::lower_bound(m_order.begin(), m_order.end(), &user, DisplayOrder));
+    change(user);
+    m_order.insert(std::lower_bound(m_order.begin(), m_order.end(), &user, DisplayOrder), &user);
+    SyncCurrentUser(user);
+    return true;
+}
 
-    // Sort the incoming user list by the User::operator<
-    std::sort(users.begin(), users.end(), [] (const User& lhs, const User& rhs) {
-        return !(lhs < rhs);
-    });
+void UserListPanel::Erase(int32_t userId) {
+    auto it = m_users.find(userId);
+    if (it == m_users.end()) {
+        return;
+    }
+    m_order.erase(std::lower_bound(m_order.begin(), m_order.end(), &it->second, DisplayOrder));
+    m_users.erase(it);
+}
 
-    m_users = std::move(users);
+void UserListPanel::UpdateUserRole(int32_t userId, chat::UserRights newRole) {
+    if (Update(userId, [newRole](User& u) { u.role = newRole; })) {
+        m_userContainer->RosterChanged();
+    }
+}
 
-    auto currUser = static_cast<ChatPanel*>(GetParent())->GetCurrentUser();
+void UserListPanel::UpdateUsername(int32_t userId, const wxString& newUsername) {
+    if (Update(userId, [&newUsername](User& u) { u.username = newUsername; })) {
+        m_userContainer->RosterChanged();
+    }
+}
 
-    for (const auto& user : m_users) {
-        if (currUser.id == user.id) {
-            static_cast<ChatPanel*>(GetParent())->SetCurrentUser(user);
+void UserListPanel::SetUserList(std::vector<User> users) {
+    m_order.clear();
+    m_users.clear();
+    m_users.reserve(users.size());
+    m_order.reserve(users.size());
+    for (auto& user : users) {
+        auto [it, inserted] = m_users.emplace(user.id, std::move(user));
+        if (inserted) {
+            m_order.push_back(&it->second);
+            SyncCurrentUser(it->second);
         }
-
-        auto* userWidget = new UserNameWidget(m_userContainer, user);
-        userWidget->Bind(wxEVT_RIGHT_DOWN, &UserListPanel::OnUserRightClick, this);
-        m_userSizer->Add(userWidget, 0, wxEXPAND | wxALL, FromDIP(2));
     }
+    std::sort(m_order.begin(), m_order.end(), DisplayOrder);
+
+    m_memberCount = static_cast<uint32_t>(m_users.size());
+    m_moreMembers = false;
+    m_loadingMembers = false;
+    m_lastMember.reset();
+    UpdateHeader();
 
-    m_userSizer->Layout();
-    m_userContainer->SetVirtualSize(m_userSizer->GetMinSize());
-    m_userContainer->Scroll(0, 0); // Scroll to top on full list update
-    m_userContainer->Thaw();
+    m_userContainer->RosterChanged();
+    m_userContainer->ScrollToRow(0); // Scroll to top on full list update
 }
 
 void UserListPanel::AddUser(const User& user) {
-    auto it = std::find_if(m_users.begin(), m_users.end(), [userId = user.id](const User& u) {
-		return u.id == userId; });
-    if (it != m_users.end()) {
-        ++it->count;
-    } else {
-		m_users.push_back(user);
+    if (!Update(user.id, [](User& u) { ++u.count; })) {
+        // Online, but not paged in yet.
+        User online = user;
+        online.count = 1;
+        Insert(online);
     }
-    SetUserList(std::move(m_users));
+    m_userContainer->RosterChanged();
 }
 
 void UserListPanel::RemoveUser(int userId) {
-    auto it = std::find_if(m_users.begin(), m_users.end(), [userId](const User& u) {
-        return u.id == userId; });
+    auto it = m_users.find(userId);
+    if (it == m_users.end()) {
+        return;
+    }
+    if (it->second.count > 0) {
+        Update(userId, [](User& u) { --u.count; });
+    } else {
+        Erase(userId);
+    }
+    m_userContainer->RosterChanged();
+}
 
-    if (it != m_users.end()) {
-        if (it->count > 0) {
-            --it->count;
+// Applies a whole presence delta with a single repaint of the list.
+void UserListPanel::ApplyPresence(const std::vector<User>& newMembers, const std::vector<User>& joined, const std::vector<User>& left) {
+    for (const auto& user : newMembers) {
+        ++m_memberCount;
+        if (!m_users.contains(user.id)) {
+            Insert(user);
+        }
+    }
+    for (const auto& user : left) {
+        auto it = m_users.find(user.id);
+        if (it == m_users.end()) {
+            continue;
+        }
+        if (it->second.count > 0) {
+            Update(user.id, [](User& u) { --u.count; });
         } else {
-            it = m_users.erase(it);
-		}
-        SetUserList(std::move(m_users));
+            Erase(user.id);
+        }
+    }
+    for (const auto& user : joined) {
+        if (!Update(user.id, [](User& u) { ++u.count; })) {
+            User online = user;
+            online.count = 1;
+            Insert(online);
+        }
     }
+    if (!newMembers.empty()) {
+        UpdateHeader();
+    }
+    m_userContainer->RosterChanged();
 }
 
 void UserListPanel::Clear() {
-    m_users.clear();
     SetUserList({});
 }
 
+void UserListPanel::SetMemberCount(uint32_t count) {
+    // Servers not paging the roster leave it out and send every member instead.
+    m_memberCount = std::max(count, static_cast<uint32_t>(m_users.size()));
+    UpdateHeader();
+}
+
+void UserListPanel::StartMemberPaging() {
+    m_moreMembers = true;
+    m_loadingMembers = false;
+    m_lastMember.reset();
+    RequestMembers();
+}
+
+void UserListPanel::AddMembers(const std::vector<User>& members, bool more) {
+    m_loadingMembers = false;
+    m_moreMembers = more;
+    if (!members.empty()) {
+        m_lastMember = members.back();
+    }
+    for (const auto& user : members) {
+        // Those online are in the roster already, with their connection count.
+        if (!m_users.contains(user.id)) {
+            Insert(user);
+        }
+    }
+    m_userContainer->RosterChanged();
+}
+
+void UserListPanel::RequestMembers() {
+    if (!m_moreMembers || m_loadingMembers) {
+        return;
+    }
+    m_loadingMembers = true;
+    wxCommandEvent event(wxEVT_REQUEST_MEMBERS, GetId());
+    event.SetEventObject(this);
+    ProcessEvent(event);
+}
+
+void UserListPanel::UpdateHeader() {
+    m_header->SetLabel(wxString::Format("Users in room: %u", m_memberCount));
+}
+
 void UserListPanel::OnUserRightClick(wxMouseEvent& event) {
     event.Skip();
 
-    auto* clickedWidget = dynamic_cast<UserNameWidget*>(event.GetEventObject());
-    if(!clickedWidget) {
+    const User* clickedUser = m_userContainer->UserAt(event.GetPosition());
+    if(!clickedUser) {
         return;
     }
-    const User& targetUser = clickedWidget->GetUser();
+    // A copy, the roster may change while the menu is open.
+    const User targetUser = *clickedUser;
 
     if(targetUser.role >= chat::UserRights::OWNER) {
         return;
@@ -157,6 +350,17 @@ void UserListPanel::OnUserRightClick(wxMouseEvent& event) {
         }
     }
 
+    if(currentUser.role >= chat::UserRights::MODERATOR) {
+        auto* item = menu.Append(wxID_ANY, "Delete Recent Messages...");
+        menu.Bind(wxEVT_MENU, [this, targetUser](wxCommandEvent&) {
+            wxCommandEvent newEvent(wxEVT_DELETE_USER_MESSAGES, GetId());
+            newEvent.SetEventObject(this);
+            newEvent.SetInt(targetUser.id);
+            newEvent.SetString(targetUser.username);
+            ProcessEvent(newEvent);
+        }, item->GetId());
+    }
+
     // OWNER transfer
     if(currentUser.role >= chat::UserRights::OWNER) {
         auto* item = menu.Append(wxID_ANY, "Transfer Ownership");
@@ -1,12 +1,34 @@
 #pragma once
 
 #include <drogon/drogon.h>
-#include <atomic>
+#include <common/utils/metrics.h>
+#include <common/utils/loop_monitor.h>
+#include <common/utils/tracing.h>
+#include <chrono>
 #include <coroutine>
 #include <memory>
+#include <mutex>
 
 namespace common {
 
+/**
+ * @struct LockState
+ * @brief A snapshot of who holds an `AwaitableGuarded` and who waits for it, see `AwaitableGuarded::lockState()`.
+ */
+struct LockState {
+    /// The number of shared holders, 0 when the lock is free or held uniquely.
+    int readers = 0;
+    /// Whether the lock is held uniquely.
+    bool writer = false;
+    size_t shared_waiters = 0;
+    size_t unique_waiters = 0;
+    /// How long the oldest waiter has been queued, zero without waiters.
+    std::chrono::steady_clock::duration longest_wait{};
+
+    /// @brief Whether the lock is held or waited for.
+    [[nodiscard]] bool busy() const noexcept { return readers > 0 || writer || shared_waiters > 0 || unique_waiters > 0; }
+};
+
 /**
  * @class AwaitableGuarded
  * @brief A template class that bundles a data object with an async mutex.
@@ -24,13 +46,45 @@ namespace common {
  * This design ensures that the data can never be accessed without first acquiring
  * the appropriate lock.
  *
+ * Contended acquisitions do not poll. Each waiter is appended to an intrusive FIFO
+ * list and suspended; releasing the lock hands ownership directly to the waiter at
+ * the head of the list (or to every consecutive reader at the head at once) and
+ * resumes it on the IO loop it was suspended on. New readers queue behind existing
+ * waiters, so a pending writer cannot be starved by a steady stream of readers.
+ *
+ * The time a contended acquisition spends queued is recorded in the
+ * `lock_wait_seconds` histogram, split by shared and unique requests, and as a
+ * `lock.wait` span of the request's trace when it is sampled.
+ *
  * @note This class must be created via the static `create()` factory method and stored in shared_ptr.
  */
 template <typename T>
 class AwaitableGuarded : public std::enable_shared_from_this<AwaitableGuarded<T>> {
 private:
-    /// @brief The atomic state of the mutex. (0=free, -1=unique, >0=shared count)
-    std::atomic<int> m_state{0};
+    /**
+     * @brief A suspended lock request, linked into the waiter list.
+     * @details Nodes live inside the awaitables, i.e. in the frames of the suspended coroutines,
+     * so queueing never allocates.
+     */
+    struct WaiterNode {
+        WaiterNode* next = nullptr;
+        std::coroutine_handle<> handle = nullptr;
+        size_t loop_index = 0;
+        bool exclusive = false;
+        std::chrono::steady_clock::time_point queued_at;
+        /// The trace of the suspended request, made current again on resumption.
+        TracePtr trace;
+    };
+
+    /// @brief Protects `m_state` and the waiter list. Only ever held for a few instructions.
+    mutable std::mutex m_mutex;
+
+    /// @brief The state of the lock. (0=free, -1=unique, >0=shared count)
+    int m_state = 0;
+
+    /// @brief The FIFO list of suspended waiters.
+    WaiterNode* m_head = nullptr;
+    WaiterNode* m_tail = nullptr;
 
     /// @brief The protected data
     T m_data;
@@ -61,13 +115,13 @@ public:
     public:
         ~SharedProxy() {
             if(m_guarded) {
-                m_guarded->m_state.fetch_sub(1, std::memory_order_release);
+                m_guarded->release(false);
             }
         }
 
         SharedProxy(const SharedProxy&) = delete;
         SharedProxy& operator=(const SharedProxy&) = delete;
-        SharedProxy(SharedProxy&&) noexcept = default;
+        SharedProxy(SharedProxy&& other) noexcept : m_guarded{std::move(other.m_guarded)} {}
         SharedProxy& operator=(SharedProxy&&) = delete;
 
         [[nodiscard]] const T* operator->() const noexcept { return &m_guarded->m_data; }
@@ -78,7 +132,7 @@ public:
         explicit SharedProxy(std::shared_ptr<AwaitableGuarded<T>> guarded) noexcept 
             : m_guarded{std::move(guarded)} {}
 
-        const std::shared_ptr<AwaitableGuarded<T>> m_guarded;
+        std::shared_ptr<AwaitableGuarded<T>> m_guarded;
     };
 
     /**
@@ -89,13 +143,13 @@ public:
     public:
         ~UniqueProxy() {
             if(m_guarded) {
-                m_guarded->m_state.store(0, std::memory_order_release);
+                m_guarded->release(true);
             }
         }
 
         UniqueProxy(const UniqueProxy&) = delete;
         UniqueProxy& operator=(const UniqueProxy&) = delete;
-        UniqueProxy(UniqueProxy&&) noexcept = default;
+        UniqueProxy(UniqueProxy&& other) noexcept : m_guarded{std::move(other.m_guarded)} {}
         UniqueProxy& operator=(UniqueProxy&&) = delete;
 
         [[nodiscard]] T* operator->() noexcept { return &m_guarded->m_data; }
@@ -106,88 +160,162 @@ public:
         explicit UniqueProxy(std::shared_ptr<AwaitableGuarded<T>> guarded) noexcept 
             : m_guarded{std::move(guarded)} {}
 
-        const std::shared_ptr<AwaitableGuarded<T>> m_guarded;
+        std::shared_ptr<AwaitableGuarded<T>> m_guarded;
     };
 
 private:
+    /**
+     * @brief Tries to take the lock without waiting.
+     * @note Must be called with `m_mutex` held. A reader only succeeds if nobody is queued,
+     *       so waiting writers keep their place.
+     */
+    [[nodiscard]] bool try_acquire_locked(bool exclusive) noexcept {
+        if(exclusive) {
+            if(m_state == 0) {
+                m_state = -1;
+                return true;
+            }
+            return false;
+        }
+        if(m_state >= 0 && m_head == nullptr) {
+            ++m_state;
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Releases one hold of the lock and hands it over to the next waiter(s), if any.
+     * @details A writer at the head of the list gets the lock alone, otherwise every
+     * consecutive reader at the head is granted it in one batch. Waiters are resumed
+     * outside of `m_mutex`, each on the IO loop it was suspended on.
+     */
+    void release(bool exclusive) noexcept {
+        WaiterNode* granted = nullptr;
+        {
+            std::lock_guard guard{m_mutex};
+            if(exclusive) {
+                m_state = 0;
+            } else {
+                --m_state;
+            }
+
+            if(m_state != 0 || m_head == nullptr) {
+                return;
+            }
+
+            granted = m_head;
+            if(granted->exclusive) {
+                m_head = granted->next;
+                granted->next = nullptr;
+                m_state = -1;
+            } else {
+                WaiterNode* last = granted;
+                m_state = 1;
+                while(last->next && !last->next->exclusive) {
+                    last = last->next;
+                    ++m_state;
+                }
+                m_head = last->next;
+                last->next = nullptr;
+            }
+            if(m_head == nullptr) {
+                m_tail = nullptr;
+            }
+        }
+
+        while(granted) {
+            // Read everything before resuming, the node lives in the frame being resumed.
+            WaiterNode* next = granted->next;
+            resume(granted->handle, granted->loop_index);
+            granted = next;
+        }
+    }
+
+    /// @brief Resumes a waiter on its IO loop, or inline if it was not suspended on one.
+    static void resume(std::coroutine_handle<> handle, size_t loop_index) noexcept {
+        if(loop_index < drogon::app().getThreadNum()) {
+            // Always post, even to the current loop, to keep the call stack shallow.
+            LoopMonitor::instance().queueInLoop(loop_index, [handle] { handle.resume(); });
+        } else {
+            handle.resume();
+        }
+    }
+
     /**
      * @brief A base template for lock awaitables to handle common async machinery.
-     * @tparam Derived The concrete awaitable class.
      * @tparam ProxyType The proxy type to be returned on resumption.
+     * @tparam Exclusive Whether the awaitable requests the unique lock.
      */
-    template <typename Derived, typename ProxyType>
+    template <typename ProxyType, bool Exclusive>
     class LockAwaitableBase {
     protected:
         std::shared_ptr<AwaitableGuarded<T>> guarded;
-        std::coroutine_handle<> handle_ = nullptr;
+        WaiterNode node_;
 
     public:
+        explicit LockAwaitableBase(std::shared_ptr<AwaitableGuarded<T>> g) noexcept
+            : guarded{std::move(g)} {}
+
         bool await_ready() noexcept {
-            return static_cast<Derived*>(this)->try_lock();
+            std::lock_guard guard{this->guarded->m_mutex};
+            return this->guarded->try_acquire_locked(Exclusive);
         }
 
-        void await_suspend(std::coroutine_handle<> h) noexcept {
-            handle_ = h;
-            drogon::app().getIOLoop(drogon::app().getCurrentThreadIndex())->queueInLoop([this] { 
-                spin(); 
-            });
+        bool await_suspend(std::coroutine_handle<> h) noexcept {
+            auto& g = *this->guarded;
+            std::lock_guard guard{g.m_mutex};
+            // The lock may have been released between await_ready and here.
+            if(g.try_acquire_locked(Exclusive)) {
+                return false;
+            }
+            node_.handle = h;
+            node_.exclusive = Exclusive;
+            node_.loop_index = drogon::app().getCurrentThreadIndex();
+            node_.queued_at = std::chrono::steady_clock::now();
+            node_.trace = currentTrace();
+            if(g.m_tail) {
+                g.m_tail->next = &node_;
+            } else {
+                g.m_head = &node_;
+            }
+            g.m_tail = &node_;
+            return true;
         }
 
+        /// @brief Ownership has already been transferred by the time the waiter resumes.
         ProxyType await_resume() noexcept {
-            return ProxyType{std::move(guarded)};
-        }
-
-    private:
-        void spin() {
-            if(static_cast<Derived*>(this)->try_lock()) {
-                // Post resumption to the event loop to keep the call stack shallow.
-                drogon::app().getIOLoop(drogon::app().getCurrentThreadIndex())->queueInLoop([h = handle_] { h.resume(); });
-            } else {
-                // Re-queue this task to try again later, this gurantees forward progress.
-                drogon::app().getIOLoop(drogon::app().getCurrentThreadIndex())->queueInLoop([this] {
-                    spin();
-                });
+            if(node_.handle) {
+                // Only set when the request was queued, uncontended acquisitions are not measured.
+                static auto& wait = MetricsRegistry::instance().histogram(
+                    "lock_wait_seconds", "Time contended AwaitableGuarded acquisitions spent queued.",
+                    Exclusive ? "mode=\"unique\"" : "mode=\"shared\"");
+                const auto now = std::chrono::steady_clock::now();
+                wait.observe(now - node_.queued_at);
+                if(node_.trace) {
+                    node_.trace->addSpan("lock.wait", node_.queued_at, now,
+                                         Trace::attribute("lock.mode", Exclusive ? "unique" : "shared"));
+                }
+                setCurrentTrace(std::move(node_.trace));
             }
+            return ProxyType{std::move(guarded)};
         }
     };
 
     /**
      * @brief An awaitable object for acquiring a shared lock.
      */
-    class SharedLockAwaitable : public LockAwaitableBase<SharedLockAwaitable, SharedProxy> {
+    class SharedLockAwaitable : public LockAwaitableBase<SharedProxy, false> {
     public:
-        explicit SharedLockAwaitable(std::shared_ptr<AwaitableGuarded<T>> g) {
-            this->guarded = std::move(g);
-        }
-
-    private:
-        friend class LockAwaitableBase<SharedLockAwaitable, SharedProxy>;
-
-        [[nodiscard]] bool try_lock() noexcept {
-            auto current = this->guarded->m_state.load(std::memory_order_acquire);
-            if(current >= 0) {
-                return this->guarded->m_state.compare_exchange_strong(current, current + 1, std::memory_order_acq_rel);
-            }
-            return false;
-        }
+        using LockAwaitableBase<SharedProxy, false>::LockAwaitableBase;
     };
 
     /**
      * @brief An awaitable object for acquiring a unique lock.
      */
-    class UniqueLockAwaitable : public LockAwaitableBase<UniqueLockAwaitable, UniqueProxy> {
+    class UniqueLockAwaitable : public LockAwaitableBase<UniqueProxy, true> {
     public:
-        explicit UniqueLockAwaitable(std::shared_ptr<AwaitableGuarded<T>> g) {
-            this->guarded = std::move(g);
-        }
-
-    private:
-        friend class LockAwaitableBase<UniqueLockAwaitable, UniqueProxy>;
-
-        [[nodiscard]] bool try_lock() noexcept {
-            int expected = 0;
-            return this->guarded->m_state.compare_exchange_strong(expected, -1, std::memory_order_acq_rel);
-        }
+        using LockAwaitableBase<UniqueProxy, true>::LockAwaitableBase;
     };
 
 public:
@@ -207,6 +335,25 @@ public:
         return UniqueLockAwaitable{this->shared_from_this()};
     }
 
+    /**
+     * @brief Reads the holders and the waiters of the lock, from any thread.
+     * @details Walks the waiter list under the internal mutex, so it costs one step per waiter;
+     * meant for diagnostics, not for deciding whether to lock.
+     */
+    [[nodiscard]] LockState lockState() const {
+        LockState state;
+        std::lock_guard guard{m_mutex};
+        state.readers = m_state > 0 ? m_state : 0;
+        state.writer = m_state < 0;
+        for(const auto* node = m_head; node; node = node->next) {
+            ++(node->exclusive ? state.unique_waiters : state.shared_waiters);
+        }
+        if(m_head) {
+            state.longest_wait = std::chrono::steady_clock::now() - m_head->queued_at;
+        }
+        return state;
+    }
+
     /**
      * @brief Verifies if this AwaitableGuarded object is the container for the given data reference.
      *
@@ -221,6 +368,18 @@ public:
         // Compare memory addresses to check if the provided data is the one we are guarding.
         return std::addressof(this->m_data) == std::addressof(a_data);
     }
+
+    /**
+     * @brief Reads the data without taking the lock.
+     *
+     * @details Only valid when the caller otherwise guarantees that no writer can run
+     * concurrently, e.g. because every writer is serialized with the caller on one thread.
+     *
+     * @return A const reference to the raw data object.
+     */
+    [[nodiscard]] const T& get_unsafe() const noexcept {
+        return m_data;
+    }
 };
 
 } // namespace common
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @file capture.h
+ * @brief The binary log format of recorded client traffic, written by the server and read by `chat_replay`.
+ *
+ * @details A capture starts with the 8 bytes of `MAGIC`, followed by records of three varints
+ * and the frame they announce:
+ *
+ * - the time the frame arrived, in microseconds since the capture started;
+ * - the connection it arrived on, numbered from 1 in the capture and unrelated to users or addresses;
+ * - the length of the frame, 0 marking that the connection closed;
+ * - the serialized `chat::Envelope`, sanitized by the server.
+ *
+ * Records are appended as they arrive on every IO loop, so they are in order per connection
+ * but only roughly across connections.
+ */
+
+namespace common::capture {
+
+/// @brief The first bytes of a capture file, the digit is the format version.
+inline constexpr std::string_view MAGIC = "SPCCAP1\n";
+
+/**
+ * @struct Record
+ * @brief One frame of a capture, or the close of its connection.
+ */
+struct Record {
+    uint64_t time_us = 0;
+    uint64_t connection = 0;
+    /// The serialized envelope, empty when the connection closed.
+    std::string frame;
+
+    bool closed() const noexcept { return frame.empty(); }
+};
+
+/// @brief Appends the encoding of a record to `out`, an empty frame records a close.
+void appendRecord(std::string& out, uint64_t time_us, uint64_t connection, std::string_view frame);
+
+/**
+ * @brief Reads a whole capture file.
+ * @param error Set to the reason when the file cannot be read.
+ * @return The records in file order, or empty on error. A record cut off at the end, as
+ * left by a server that stopped while writing, is ignored.
+ */
+std::optional<std::vector<Record>> readFile(const std::string& path, std::string& error);
+
+} // namespace common::capture
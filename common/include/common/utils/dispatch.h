@@ -0,0 +1,358 @@
+#pragma once
+
+#include <common/utils/metrics.h>
+#include <common/utils/utils.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @file dispatch.h
+ * @brief A table routing the payloads of a `chat::Envelope` to typed handlers, shared by the server and the aggregator.
+ */
+
+namespace common {
+
+/**
+ * @struct PayloadBinding
+ * @brief Ties a request type to its payload case and to the accessors of its request and response in an `Envelope`.
+ * @tparam Case The payload case of the request.
+ * @tparam Get The const accessor of the request, e.g. `&chat::Envelope::join_room_request`.
+ * @tparam Mutable The mutable accessor of the response, or `nullptr` for one-way messages, which get no answer.
+ */
+template <chat::Envelope::PayloadCase Case, auto Get, auto Mutable = nullptr>
+struct PayloadBinding {
+    static constexpr chat::Envelope::PayloadCase payload = Case;
+    static constexpr bool one_way = std::is_null_pointer_v<decltype(Mutable)>;
+
+    static decltype(auto) request(const chat::Envelope& env) { return std::invoke(Get, env); }
+
+    static auto* response(chat::Envelope& env) requires (!one_way) { return std::invoke(Mutable, env); }
+};
+
+/// @brief The `PayloadBinding` of a request type. Only the types specialized below can be routed.
+template <typename Request>
+struct PayloadTraits;
+
+// Client requests, answered by the server.
+template <> struct PayloadTraits<chat::InitialAuthRequest>
+    : PayloadBinding<chat::Envelope::kInitialAuthRequest, &chat::Envelope::initial_auth_request, &chat::Envelope::mutable_initial_auth_response> {};
+template <> struct PayloadTraits<chat::InitialRegisterRequest>
+    : PayloadBinding<chat::Envelope::kInitialRegisterRequest, &chat::Envelope::initial_register_request, &chat::Envelope::mutable_initial_register_response> {};
+template <> struct PayloadTraits<chat::AuthRequest>
+    : PayloadBinding<chat::Envelope::kAuthRequest, &chat::Envelope::auth_request, &chat::Envelope::mutable_auth_response> {};
+template <> struct PayloadTraits<chat::ResumeSessionRequest>
+    : PayloadBinding<chat::Envelope::kResumeSessionRequest, &chat::Envelope::resume_session_request, &chat::Envelope::mutable_resume_session_response> {};
+template <> struct PayloadTraits<chat::RegisterRequest>
+    : PayloadBinding<chat::Envelope::kRegisterRequest, &chat::Envelope::register_request, &chat::Envelope::mutable_register_response> {};
+template <> struct PayloadTraits<chat::SendMessageRequest>
+    : PayloadBinding<chat::Envelope::kSendMessageRequest, &chat::Envelope::send_message_request, &chat::Envelope::mutable_send_message_response> {};
+template <> struct PayloadTraits<chat::JoinRoomRequest>
+    : PayloadBinding<chat::Envelope::kJoinRoomRequest, &chat::Envelope::join_room_request, &chat::Envelope::mutable_join_room_response> {};
+template <> struct PayloadTraits<chat::LeaveRoomRequest>
+    : PayloadBinding<chat::Envelope::kLeaveRoomRequest, &chat::Envelope::leave_room_request, &chat::Envelope::mutable_leave_room_response> {};
+template <> struct PayloadTraits<chat::CreateRoomRequest>
+    : PayloadBinding<chat::Envelope::kCreateRoomRequest, &chat::Envelope::create_room_request, &chat::Envelope::mutable_create_room_response> {};
+template <> struct PayloadTraits<chat::GetMessagesRequest>
+    : PayloadBinding<chat::Envelope::kGetMessagesRequest, &chat::Envelope::get_messages_request, &chat::Envelope::mutable_get_messages_response> {};
+template <> struct PayloadTraits<chat::SyncRoomRequest>
+    : PayloadBinding<chat::Envelope::kSyncRoomRequest, &chat::Envelope::sync_room_request, &chat::Envelope::mutable_sync_room_response> {};
+template <> struct PayloadTraits<chat::MarkRoomReadRequest>
+    : PayloadBinding<chat::Envelope::kMarkRoomReadRequest, &chat::Envelope::mark_room_read_request, &chat::Envelope::mutable_mark_room_read_response> {};
+template <> struct PayloadTraits<chat::GetMessagesAroundRequest>
+    : PayloadBinding<chat::Envelope::kGetMessagesAroundRequest, &chat::Envelope::get_messages_around_request, &chat::Envelope::mutable_get_messages_around_response> {};
+template <> struct PayloadTraits<chat::SearchMessagesRequest>
+    : PayloadBinding<chat::Envelope::kSearchMessagesRequest, &chat::Envelope::search_messages_request, &chat::Envelope::mutable_search_messages_response> {};
+template <> struct PayloadTraits<chat::GetRoomMembersRequest>
+    : PayloadBinding<chat::Envelope::kGetRoomMembersRequest, &chat::Envelope::get_room_members_request, &chat::Envelope::mutable_get_room_members_response> {};
+template <> struct PayloadTraits<chat::LogoutRequest>
+    : PayloadBinding<chat::Envelope::kLogoutRequest, &chat::Envelope::logout_request, &chat::Envelope::mutable_logout_response> {};
+template <> struct PayloadTraits<chat::RenameRoomRequest>
+    : PayloadBinding<chat::Envelope::kRenameRoomRequest, &chat::Envelope::rename_room_request, &chat::Envelope::mutable_rename_room_response> {};
+template <> struct PayloadTraits<chat::DeleteRoomRequest>
+    : PayloadBinding<chat::Envelope::kDeleteRoomRequest, &chat::Envelope::delete_room_request, &chat::Envelope::mutable_delete_room_response> {};
+template <> struct PayloadTraits<chat::AssignRoleRequest>
+    : PayloadBinding<chat::Envelope::kAssignRoleRequest, &chat::Envelope::assign_role_request, &chat::Envelope::mutable_assign_role_response> {};
+template <> struct PayloadTraits<chat::DeleteMessageRequest>
+    : PayloadBinding<chat::Envelope::kDeleteMessageRequest, &chat::Envelope::delete_message_request, &chat::Envelope::mutable_delete_message_response> {};
+template <> struct PayloadTraits<chat::DeleteUserMessagesRequest>
+    : PayloadBinding<chat::Envelope::kDeleteUserMessagesRequest, &chat::Envelope::delete_user_messages_request, &chat::Envelope::mutable_delete_user_messages_response> {};
+template <> struct PayloadTraits<chat::SubscribeRoomsRequest>
+    : PayloadBinding<chat::Envelope::kSubscribeRoomsRequest, &chat::Envelope::subscribe_rooms_request, &chat::Envelope::mutable_subscribe_rooms_response> {};
+template <> struct PayloadTraits<chat::UserTypingStartRequest>
+    : PayloadBinding<chat::Envelope::kUserTypingStartRequest, &chat::Envelope::user_typing_start_request, &chat::Envelope::mutable_user_typing_start_response> {};
+template <> struct PayloadTraits<chat::UserTypingStopRequest>
+    : PayloadBinding<chat::Envelope::kUserTypingStopRequest, &chat::Envelope::user_typing_stop_request, &chat::Envelope::mutable_user_typing_stop_response> {};
+template <> struct PayloadTraits<chat::BecomeMemberRequest>
+    : PayloadBinding<chat::Envelope::kBecomeMemberRequest, &chat::Envelope::become_member_request, &chat::Envelope::mutable_become_member_response> {};
+template <> struct PayloadTraits<chat::ChangeUsernameRequest>
+    : PayloadBinding<chat::Envelope::kChangeUsernameRequest, &chat::Envelope::change_username_request, &chat::Envelope::mutable_change_username_response> {};
+template <> struct PayloadTraits<chat::GetMySaltRequest>
+    : PayloadBinding<chat::Envelope::kGetMySaltRequest, &chat::Envelope::get_my_salt_request, &chat::Envelope::mutable_get_my_salt_response> {};
+template <> struct PayloadTraits<chat::ChangePasswordRequest>
+    : PayloadBinding<chat::Envelope::kChangePasswordRequest, &chat::Envelope::change_password_request, &chat::Envelope::mutable_change_password_response> {};
+template <> struct PayloadTraits<chat::SetCompressionRequest>
+    : PayloadBinding<chat::Envelope::kSetCompressionRequest, &chat::Envelope::set_compression_request, &chat::Envelope::mutable_set_compression_response> {};
+template <> struct PayloadTraits<chat::BatchRequest>
+    : PayloadBinding<chat::Envelope::kBatchRequest, &chat::Envelope::batch_request, &chat::Envelope::mutable_batch_response> {};
+
+// Server requests and cluster traffic, handled by the aggregator.
+template <> struct PayloadTraits<chat::RegisterServerRequest>
+    : PayloadBinding<chat::Envelope::kRegisterServerRequest, &chat::Envelope::register_server_request, &chat::Envelope::mutable_register_server_response> {};
+template <> struct PayloadTraits<chat::GetServerNodesRequest>
+    : PayloadBinding<chat::Envelope::kGetServersRequest, &chat::Envelope::get_servers_request, &chat::Envelope::mutable_get_servers_response> {};
+template <> struct PayloadTraits<chat::SubscribeServersRequest>
+    : PayloadBinding<chat::Envelope::kSubscribeServersRequest, &chat::Envelope::subscribe_servers_request, &chat::Envelope::mutable_subscribe_servers_response> {};
+template <> struct PayloadTraits<chat::GetRoomServerRequest>
+    : PayloadBinding<chat::Envelope::kGetRoomServerRequest, &chat::Envelope::get_room_server_request, &chat::Envelope::mutable_get_room_server_response> {};
+template <> struct PayloadTraits<chat::ListRoomsRequest>
+    : PayloadBinding<chat::Envelope::kListRoomsRequest, &chat::Envelope::list_rooms_request, &chat::Envelope::mutable_list_rooms_response> {};
+template <> struct PayloadTraits<chat::ClusterSubscribe>
+    : PayloadBinding<chat::Envelope::kClusterSubscribe, &chat::Envelope::cluster_subscribe> {};
+template <> struct PayloadTraits<chat::ClusterUnsubscribe>
+    : PayloadBinding<chat::Envelope::kClusterUnsubscribe, &chat::Envelope::cluster_unsubscribe> {};
+template <> struct PayloadTraits<chat::ClusterPublish>
+    : PayloadBinding<chat::Envelope::kClusterPublish, &chat::Envelope::cluster_publish> {};
+template <> struct PayloadTraits<chat::ServerLoadReport>
+    : PayloadBinding<chat::Envelope::kServerLoadReport, &chat::Envelope::server_load_report> {};
+template <> struct PayloadTraits<chat::RoomLoadReport>
+    : PayloadBinding<chat::Envelope::kRoomLoadReport, &chat::Envelope::room_load_report> {};
+template <> struct PayloadTraits<chat::DrainServerRequest>
+    : PayloadBinding<chat::Envelope::kDrainServerRequest, &chat::Envelope::drain_server_request> {};
+template <> struct PayloadTraits<chat::RoomDirectoryUpdate>
+    : PayloadBinding<chat::Envelope::kRoomDirectoryUpdate, &chat::Envelope::room_directory_update> {};
+template <> struct PayloadTraits<chat::RegistryGossip>
+    : PayloadBinding<chat::Envelope::kRegistryGossip, &chat::Envelope::registry_gossip> {};
+template <> struct PayloadTraits<chat::PeerRelay>
+    : PayloadBinding<chat::Envelope::kPeerRelay, &chat::Envelope::peer_relay> {};
+
+/**
+ * @class Dispatcher
+ * @brief Routes requests to their handlers through a table indexed by payload case.
+ *
+ * @details Handlers are registered once, at startup, with `on<Request>()`. The request type picks
+ * the payload case and the response accessor through its `PayloadTraits`, so no per-case plumbing
+ * is written by hand. A handler is called with the `Context` of the request and the request itself,
+ * in one of these forms:
+ *
+ * - `Task<Response>(Context&, const Request&)`, the response is copied into the envelope;
+ * - `Task<>(Context&, const Request&, Response&)`, the response is filled in place;
+ * - `void(Context&, const Request&, Response&)`, an immediate handler that never suspends,
+ *   see `dispatchImmediately()`;
+ * - `Task<>(Context&, const Request&)` for one-way messages, which leave the envelope empty.
+ *
+ * Middleware registered with `use()` runs before every handler, in registration order, and may
+ * answer a request itself, e.g. to reject it, by filling the response and returning false.
+ *
+ * Every route records its latency into a histogram labelled with its name, unknown payloads
+ * are counted as "Other". Given an in-flight metric, every route also counts the requests it
+ * is running, exported as a gauge labelled the same way.
+ *
+ * @note Not thread-safe while handlers are being registered, read-only afterwards.
+ */
+template <typename Context>
+class Dispatcher {
+public:
+    /// @brief Runs before the handler. Returns false to stop the request, having filled the response.
+    using Middleware = std::function<bool(Context& ctx, const chat::Envelope& env, chat::Envelope& respEnv)>;
+
+    /**
+     * @param metric The name of the latency histogram, e.g. `chat_request_duration_seconds`.
+     * @param help Its description.
+     * @param in_flight_metric The name of the in-flight gauge, empty to not count requests in flight.
+     */
+    Dispatcher(std::string metric, std::string help, std::string in_flight_metric = {})
+        : m_metric(std::move(metric)), m_help(std::move(help)), m_in_flight_metric(std::move(in_flight_metric)),
+          m_other(&MetricsRegistry::instance().histogram(m_metric, m_help, "handler=\"Other\"")) {}
+
+    /// @brief Registers the handler of a request type, replacing any earlier one.
+    template <typename Request, typename Fn>
+    Dispatcher& on(const char* name, Fn fn);
+
+    /// @brief Appends a middleware, run before the handlers of every route.
+    Dispatcher& use(Middleware middleware) {
+        m_middleware.push_back(std::move(middleware));
+        return *this;
+    }
+
+    /// @brief The name a payload was registered with, or "Other".
+    [[nodiscard]] const char* name(chat::Envelope::PayloadCase payload) const noexcept {
+        const auto* route = find(payload);
+        return route ? route->name : "Other";
+    }
+
+    /// @brief Whether a payload is routed to an immediate handler.
+    [[nodiscard]] bool isImmediate(chat::Envelope::PayloadCase payload) const noexcept {
+        const auto* route = find(payload);
+        return route && route->immediate;
+    }
+
+    /// @brief Calls `fn(payload, name)` for every registered route, in payload case order.
+    template <typename Fn>
+    void forEachRoute(Fn&& fn) const {
+        for(size_t i = 0; i < m_routes.size(); ++i) {
+            if(m_routes[i].name) {
+                fn(static_cast<chat::Envelope::PayloadCase>(i), m_routes[i].name);
+            }
+        }
+    }
+
+    /**
+     * @brief Answers a request with its own response type carrying only a status, e.g. from a middleware.
+     * @details One-way messages and unknown payloads are left unanswered and answered with a generic error respectively.
+     */
+    void reject(chat::Envelope& respEnv, chat::Envelope::PayloadCase payload, chat::StatusCode code, const std::string& msg) const {
+        const auto* route = find(payload);
+        if(!route) {
+            respEnv = makeGenericErrorEnvelope(msg);
+        } else if(route->reject) {
+            route->reject(respEnv, code, msg);
+        }
+    }
+
+    /// @brief Runs the middleware and the immediate handler of a request. Requires `isImmediate()`.
+    void dispatchImmediately(Context& ctx, const chat::Envelope& env, chat::Envelope& respEnv) const {
+        const auto& route = *find(env.payload_case());
+        const auto started = std::chrono::steady_clock::now();
+        const InFlight in_flight{route};
+        if(admit(ctx, env, respEnv)) {
+            route.immediate(ctx, env, respEnv);
+        }
+        route.latency->observe(std::chrono::steady_clock::now() - started);
+    }
+
+    /// @brief Runs the middleware and the handler of a request, answering unknown payloads with an error.
+    drogon::Task<> dispatch(Context& ctx, const chat::Envelope& env, chat::Envelope& respEnv) const {
+        const auto* route = find(env.payload_case());
+        const auto started = std::chrono::steady_clock::now();
+        if(!route) {
+            respEnv = makeGenericErrorEnvelope("Unknown or empty payload");
+            m_other->observe(std::chrono::steady_clock::now() - started);
+            co_return;
+        }
+        const InFlight in_flight{*route};
+        if(admit(ctx, env, respEnv)) {
+            if(route->immediate) {
+                route->immediate(ctx, env, respEnv);
+            } else {
+                co_await route->run(ctx, env, respEnv);
+            }
+        }
+        route->latency->observe(std::chrono::steady_clock::now() - started);
+    }
+
+private:
+    struct Route {
+        const char* name = nullptr;
+        std::function<drogon::Task<>(Context&, const chat::Envelope&, chat::Envelope&)> run;
+        std::function<void(Context&, const chat::Envelope&, chat::Envelope&)> immediate;
+        /// Sets the status of the route's response, null for one-way messages.
+        void (*reject)(chat::Envelope&, chat::StatusCode, const std::string&) = nullptr;
+        Histogram* latency = nullptr;
+        /// The requests running on this route, null without an in-flight metric. Shared with its gauge.
+        std::shared_ptr<std::atomic<int64_t>> in_flight;
+    };
+
+    /// @brief Counts a request as in flight on its route for its lifetime, exceptions included.
+    class InFlight {
+    public:
+        explicit InFlight(const Route& route) noexcept : m_count(route.in_flight.get()) {
+            if(m_count) {
+                m_count->fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        ~InFlight() {
+            if(m_count) {
+                m_count->fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        InFlight(const InFlight&) = delete;
+        InFlight& operator=(const InFlight&) = delete;
+
+    private:
+        std::atomic<int64_t>* m_count;
+    };
+
+    const Route* find(chat::Envelope::PayloadCase payload) const noexcept {
+        const auto index = static_cast<size_t>(payload);
+        return index < m_routes.size() && m_routes[index].name ? &m_routes[index] : nullptr;
+    }
+
+    bool admit(Context& ctx, const chat::Envelope& env, chat::Envelope& respEnv) const {
+        for(const auto& middleware : m_middleware) {
+            if(!middleware(ctx, env, respEnv)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string m_metric;
+    std::string m_help;
+    std::string m_in_flight_metric;
+    Histogram* m_other;
+    /// Indexed by payload case, which are the small field numbers of the `Envelope` oneof.
+    std::vector<Route> m_routes;
+    std::vector<Middleware> m_middleware;
+};
+
+template <typename Context>
+template <typename Request, typename Fn>
+Dispatcher<Context>& Dispatcher<Context>::on(const char* name, Fn fn) {
+    using Traits = PayloadTraits<Request>;
+    const auto index = static_cast<size_t>(Traits::payload);
+    if(m_routes.size() <= index) {
+        m_routes.resize(index + 1);
+    }
+    auto& route = m_routes[index];
+    route = Route{};
+    route.name = name;
+    route.latency = &MetricsRegistry::instance().histogram(m_metric, m_help, "handler=\"" + std::string(name) + "\"");
+    if(!m_in_flight_metric.empty()) {
+        route.in_flight = std::make_shared<std::atomic<int64_t>>(0);
+        MetricsRegistry::instance().gauge(m_in_flight_metric, "Requests being handled right now, per handler.",
+            [count = route.in_flight] { return static_cast<double>(count->load(std::memory_order_relaxed)); },
+            "handler=\"" + std::string(name) + "\"");
+    }
+
+    if constexpr(Traits::one_way) {
+        static_assert(std::is_invocable_r_v<drogon::Task<>, Fn&, Context&, const Request&>, "One-way handlers return Task<>");
+        route.run = [fn = std::move(fn)](Context& ctx, const chat::Envelope& env, chat::Envelope&) -> drogon::Task<> {
+            co_await fn(ctx, Traits::request(env));
+        };
+    } else {
+        using Response = std::remove_pointer_t<decltype(Traits::response(std::declval<chat::Envelope&>()))>;
+        route.reject = [](chat::Envelope& respEnv, chat::StatusCode code, const std::string& msg) {
+            setStatus(*Traits::response(respEnv), code, msg);
+        };
+        constexpr bool in_place = std::is_invocable_v<Fn&, Context&, const Request&, Response&>;
+        constexpr bool immediate = [] {
+            if constexpr(in_place) {
+                return std::is_void_v<std::invoke_result_t<Fn&, Context&, const Request&, Response&>>;
+            }
+            return false;
+        }();
+        if constexpr(immediate) {
+            route.immediate = [fn = std::move(fn)](Context& ctx, const chat::Envelope& env, chat::Envelope& respEnv) {
+                fn(ctx, Traits::request(env), *Traits::response(respEnv));
+            };
+        } else if constexpr(in_place) {
+            route.run = [fn = std::move(fn)](Context& ctx, const chat::Envelope& env, chat::Envelope& respEnv) -> drogon::Task<> {
+                co_await fn(ctx, Traits::request(env), *Traits::response(respEnv));
+            };
+        } else {
+            static_assert(std::is_invocable_r_v<drogon::Task<Response>, Fn&, Context&, const Request&>,
+                          "Handlers return Task<Response>, or take the response by reference");
+            route.run = [fn = std::move(fn)](Context& ctx, const chat::Envelope& env, chat::Envelope& respEnv) -> drogon::Task<> {
+                *Traits::response(respEnv) = co_await fn(ctx, Traits::request(env));
+            };
+        }
+    }
+    return *this;
+}
+
+} // namespace common
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace common {
+
+/**
+ * @class FlatSet
+ * @brief A set kept as a sorted vector.
+ * @tparam T The element type.
+ * @tparam Compare The strict weak order the elements are sorted by.
+ *
+ * @details A node based set costs a heap node and a bucket per element, a few times the
+ * size of a small element, and scatters the elements over the heap. A `FlatSet` only
+ * costs the element and iterates over contiguous memory, at the price of inserts and
+ * erases linear in the size of the set. That suits the many small sets a server keeps
+ * per connection or per room, where lookups and iteration outnumber changes.
+ *
+ * Inserting or erasing invalidates the iterators, like for a vector.
+ */
+template <typename T, typename Compare = std::less<T>>
+class FlatSet {
+public:
+    using value_type = T;
+    using const_iterator = typename std::vector<T>::const_iterator;
+    using iterator = const_iterator;
+
+    const_iterator begin() const noexcept { return m_items.begin(); }
+    const_iterator end() const noexcept { return m_items.end(); }
+    size_t size() const noexcept { return m_items.size(); }
+    bool empty() const noexcept { return m_items.empty(); }
+    void reserve(size_t n) { m_items.reserve(n); }
+    void clear() noexcept { m_items.clear(); }
+
+    /// @brief Inserts `value` unless an equal element exists, like `std::set::insert`.
+    std::pair<const_iterator, bool> insert(T value) {
+        auto it = lower(value);
+        if(it != m_items.end() && !Compare{}(value, *it)) {
+            return {it, false};
+        }
+        return {m_items.insert(it, std::move(value)), true};
+    }
+
+    const_iterator find(const T& value) const {
+        auto it = lower(value);
+        return it != m_items.end() && !Compare{}(value, *it) ? it : m_items.end();
+    }
+
+    bool contains(const T& value) const { return find(value) != m_items.end(); }
+
+    /// @brief Erases the element equal to `value`, if any, and returns how many were erased.
+    size_t erase(const T& value) {
+        auto it = find(value);
+        if(it == m_items.end()) {
+            return 0;
+        }
+        m_items.erase(it);
+        return 1;
+    }
+
+    const_iterator erase(const_iterator it) { return m_items.erase(it); }
+
+private:
+    typename std::vector<T>::const_iterator lower(const T& value) const {
+        return std::lower_bound(m_items.begin(), m_items.end(), value, Compare{});
+    }
+
+    std::vector<T> m_items;
+};
+
+/**
+ * @class FlatMap
+ * @brief A map kept as a vector of pairs sorted by key, see `FlatSet`.
+ * @tparam K The key type.
+ * @tparam V The mapped type.
+ * @tparam Compare The strict weak order the keys are sorted by.
+ */
+template <typename K, typename V, typename Compare = std::less<K>>
+class FlatMap {
+public:
+    using value_type = std::pair<K, V>;
+    using iterator = typename std::vector<value_type>::iterator;
+    using const_iterator = typename std::vector<value_type>::const_iterator;
+
+    iterator begin() noexcept { return m_items.begin(); }
+    iterator end() noexcept { return m_items.end(); }
+    const_iterator begin() const noexcept { return m_items.begin(); }
+    const_iterator end() const noexcept { return m_items.end(); }
+    size_t size() const noexcept { return m_items.size(); }
+    bool empty() const noexcept { return m_items.empty(); }
+    void reserve(size_t n) { m_items.reserve(n); }
+
+    /// @brief Inserts `key` mapped to `value` unless the key exists, like `std::map::emplace`.
+    std::pair<iterator, bool> emplace(K key, V value) {
+        auto it = lower(key);
+        if(it != m_items.end() && !Compare{}(key, it->first)) {
+            return {it, false};
+        }
+        return {m_items.emplace(it, std::move(key), std::move(value)), true};
+    }
+
+    iterator find(const K& key) {
+        auto it = lower(key);
+        return it != m_items.end() && !Compare{}(key, it->first) ? it : m_items.end();
+    }
+
+    const_iterator find(const K& key) const {
+        return const_cast<FlatMap*>(this)->find(key);
+    }
+
+    bool contains(const K& key) const { return find(key) != m_items.end(); }
+
+    size_t erase(const K& key) {
+        auto it = find(key);
+        if(it == m_items.end()) {
+            return 0;
+        }
+        m_items.erase(it);
+        return 1;
+    }
+
+    iterator erase(const_iterator it) { return m_items.erase(it); }
+
+private:
+    iterator lower(const K& key) {
+        return std::lower_bound(m_items.begin(), m_items.end(), key,
+                                [](const value_type& item, const K& k) { return Compare{}(item.first, k); });
+    }
+
+    std::vector<value_type> m_items;
+};
+
+} // namespace common
@@ -7,6 +7,10 @@ namespace limits {
 	constexpr std::size_t MAX_USERNAME_LENGTH = 16;
 	constexpr std::size_t MAX_MESSAGE_LENGTH = 512;
 	constexpr std::size_t MAX_ROOMNAME_LENGTH = 32;
+	constexpr std::size_t MAX_SEARCH_QUERY_LENGTH = 256;
+	constexpr int MAX_DELETE_USER_MESSAGES = 500;
+	constexpr std::size_t MAX_CLIENT_KEY_LENGTH = 64;
+	constexpr int MAX_JOIN_HISTORY = 100;
 
 } // namespace limits
 
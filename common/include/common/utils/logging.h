@@ -0,0 +1,41 @@
+#pragma once
+
+#include <trantor/utils/Logger.h>
+
+/**
+ * @file logging.h
+ * @brief Compiles the log statements below a build-time level out of the binaries.
+ *
+ * @details trantor's `LOG_*` macros test the runtime level before the stream expression is
+ * evaluated, so a disabled statement formats nothing, and records are written to the log
+ * file by trantor's `AsyncFileLogger` thread, not the IO loop that logged them. What remains
+ * is the level test on every statement; in a release build trantor already compiles
+ * `LOG_TRACE` out.
+ *
+ * `CHAT_LOG_MIN_LEVEL`, set from the CMake cache variable of the same name, compiles out
+ * the levels below it as well: 0 keeps everything, 1 drops `LOG_TRACE`, 2 `LOG_DEBUG` too
+ * and 3 `LOG_INFO` too. The statements stay type-checked, their code is discarded. Warnings
+ * and errors are always kept.
+ */
+
+#ifdef CHAT_LOG_MIN_LEVEL
+
+#undef LOG_TRACE
+#define LOG_TRACE                                                                            \
+    if constexpr(CHAT_LOG_MIN_LEVEL <= 0)                                                    \
+        if(trantor::Logger::logLevel() <= trantor::Logger::kTrace)                           \
+            trantor::Logger(__FILE__, __LINE__, trantor::Logger::kTrace, __func__).stream()
+
+#undef LOG_DEBUG
+#define LOG_DEBUG                                                                            \
+    if constexpr(CHAT_LOG_MIN_LEVEL <= 1)                                                    \
+        if(trantor::Logger::logLevel() <= trantor::Logger::kDebug)                           \
+            trantor::Logger(__FILE__, __LINE__, trantor::Logger::kDebug, __func__).stream()
+
+#undef LOG_INFO
+#define LOG_INFO                                                                             \
+    if constexpr(CHAT_LOG_MIN_LEVEL <= 2)                                                    \
+        if(trantor::Logger::logLevel() <= trantor::Logger::kInfo)                            \
+            trantor::Logger(__FILE__, __LINE__).stream()
+
+#endif
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <drogon/drogon.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+/**
+ * @file loop_monitor.h
+ * @brief Per IO loop task queue depth and scheduling lag, exported as metrics.
+ */
+
+namespace common {
+
+/**
+ * @class LoopMonitor
+ * @brief A singleton measuring how backed up every IO loop is.
+ *
+ * @details Two figures are kept per loop:
+ * - the queue depth: tasks posted through `queueInLoop()` that have not run yet. Coroutine
+ *   resumptions (lock hand-offs, database completions, batched inserts) go through it,
+ *   so a burst of resumptions piling up on one loop shows here first. Tasks Drogon posts
+ *   on its own, such as socket writes from other threads, are not counted.
+ * - the scheduling lag: how long a probe posted every `sample_interval` waited before it ran.
+ *
+ * Both are exported as `event_loop_queue_depth{loop}` and `event_loop_lag_seconds{loop}`
+ * gauges, along with the deepest queue seen since the previous sample, and a warning is
+ * logged whenever a sample crosses the configured thresholds.
+ *
+ * @note Counting is a relaxed atomic increment and decrement per task, the wrapped task
+ * captures one more pointer than the original.
+ */
+class LoopMonitor {
+public:
+    /// @brief How often the loops are probed and when a sample is worth a warning.
+    struct Options {
+        std::chrono::milliseconds sample_interval{1000};
+        /// A zero threshold disables its warning.
+        std::chrono::milliseconds warn_lag{100};
+        size_t warn_queue_depth = 1000;
+    };
+
+    /**
+     * @brief Gets the singleton instance of the LoopMonitor.
+     * @return A reference to the single LoopMonitor instance.
+     */
+    static LoopMonitor& instance();
+
+    /**
+     * @brief Starts sampling every IO loop and registers the gauges.
+     * @note Must be called once, on the main loop, after the IO loops have been created.
+     * Tasks posted before that are run but not counted.
+     */
+    void start(const Options& options);
+
+    /// @brief Posts `fn` to a loop like `trantor::EventLoop::queueInLoop()`, counting it while it is queued.
+    template <typename F>
+    void queueInLoop(size_t loop_index, F&& fn) {
+        auto* loop = drogon::app().getIOLoop(loop_index);
+        if(loop_index >= m_loop_count.load(std::memory_order_acquire)) {
+            loop->queueInLoop(std::forward<F>(fn));
+            return;
+        }
+        LoopStats* stats = &m_loops[loop_index];
+        const auto depth = stats->depth.fetch_add(1, std::memory_order_relaxed) + 1;
+        auto peak = stats->peak_depth.load(std::memory_order_relaxed);
+        while(depth > peak && !stats->peak_depth.compare_exchange_weak(peak, depth, std::memory_order_relaxed)) {
+        }
+        loop->queueInLoop([stats, fn = std::forward<F>(fn)]() mutable {
+            stats->depth.fetch_sub(1, std::memory_order_relaxed);
+            fn();
+        });
+    }
+
+    /// @brief The worst scheduling lag among the loops, as of the latest completed probes.
+    std::chrono::microseconds maxLag() const noexcept;
+
+    /// @brief The tasks queued on a loop right now, 0 before `start()`.
+    int64_t queueDepth(size_t loop_index) const noexcept;
+
+    /// @brief The scheduling lag of a loop as of its latest completed probe, 0 before `start()`.
+    std::chrono::microseconds lag(size_t loop_index) const noexcept;
+
+private:
+    LoopMonitor() = default;
+    LoopMonitor(const LoopMonitor&) = delete;
+    LoopMonitor& operator=(const LoopMonitor&) = delete;
+
+    struct LoopStats {
+        std::atomic<int64_t> depth{0};
+        /// The deepest the queue got since the previous sample.
+        std::atomic<int64_t> peak_depth{0};
+        /// How long the latest probe waited, in microseconds.
+        std::atomic<int64_t> lag_us{0};
+        /// The peak depth of the previous sample, which the gauge reports.
+        std::atomic<int64_t> sampled_peak{0};
+    };
+
+    /// @brief Reads the figures of the previous interval and posts the next probes. Runs on the main loop.
+    void sample();
+
+    Options m_options;
+    std::unique_ptr<LoopStats[]> m_loops;
+    /// Published after `m_loops` is allocated, zero until `start()`.
+    std::atomic<size_t> m_loop_count{0};
+};
+
+} // namespace common
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+/**
+ * @file metrics.h
+ * @brief Process-wide counters, gauges and histograms, rendered in the Prometheus text format.
+ */
+
+namespace common {
+
+/**
+ * @class Counter
+ * @brief A monotonically increasing value, safe to bump from any thread.
+ */
+class Counter {
+public:
+    void inc(uint64_t n = 1) noexcept { m_value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const noexcept { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_value{0};
+};
+
+/**
+ * @class Histogram
+ * @brief Counts observations into fixed buckets, safe to observe from any thread.
+ * @details Bucket bounds are inclusive upper limits in ascending order, an implicit
+ * `+Inf` bucket catches the rest. Observing is a few relaxed atomic adds.
+ */
+class Histogram {
+public:
+    explicit Histogram(std::span<const double> bounds);
+
+    void observe(double value) noexcept;
+
+    /// @brief Observes a duration in seconds, the unit Prometheus expects.
+    void observe(std::chrono::steady_clock::duration elapsed) noexcept {
+        observe(std::chrono::duration<double>(elapsed).count());
+    }
+
+    /// @brief Appends the `_bucket`, `_sum` and `_count` series of this histogram to `out`.
+    void render(std::string& out, const std::string& name, const std::string& labels) const;
+
+private:
+    std::vector<double> m_bounds;
+    /// One slot per bound plus the `+Inf` one, not cumulative.
+    std::unique_ptr<std::atomic<uint64_t>[]> m_buckets;
+    std::atomic<double> m_sum{0};
+};
+
+/**
+ * @class MetricsRegistry
+ * @brief A thread-safe singleton owning every metric of the process.
+ *
+ * @details Metrics are grouped in families by name, a family holds one series per set of
+ * labels. Labels are passed preformatted, e.g. `handler="JoinRoom"`. Registration takes
+ * a mutex, so hot paths look a series up once and keep the returned reference, which
+ * stays valid for the lifetime of the process.
+ *
+ * Gauges are callbacks read at scrape time, which keeps their sources free of any
+ * bookkeeping on the hot path.
+ */
+class MetricsRegistry {
+public:
+    /**
+     * @brief Gets the singleton instance of the MetricsRegistry.
+     * @return A reference to the single MetricsRegistry instance.
+     */
+    static MetricsRegistry& instance();
+
+    /// @brief Bucket bounds for latencies, from half a millisecond to five seconds.
+    static std::span<const double> latencyBuckets() noexcept;
+
+    /// @brief Bucket bounds for sizes such as broadcast fan-outs, from 1 to 10'000.
+    static std::span<const double> sizeBuckets() noexcept;
+
+    /// @brief Returns the counter of a family and label set, creating it on first use.
+    Counter& counter(const std::string& name, const std::string& help, const std::string& labels = {});
+
+    /// @brief Returns the histogram of a family and label set, creating it with `bounds` on first use.
+    Histogram& histogram(const std::string& name, const std::string& help, const std::string& labels = {},
+                         std::span<const double> bounds = latencyBuckets());
+
+    /// @brief Registers a gauge read by calling `read` at every scrape. A second registration replaces the first.
+    void gauge(const std::string& name, const std::string& help, std::function<double()> read, const std::string& labels = {});
+
+    /// @brief The current values of a counter or gauge family by label set, empty for an unknown or histogram family.
+    std::map<std::string, double> read(const std::string& name) const;
+
+    /// @brief Renders every metric in the Prometheus text exposition format, version 0.0.4.
+    std::string render() const;
+
+private:
+    MetricsRegistry() = default;
+    MetricsRegistry(const MetricsRegistry&) = delete;
+    MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+    enum class Type { Counter, Gauge, Histogram };
+
+    /// @brief All series of one metric name, keyed by their labels.
+    struct Family {
+        Type type;
+        std::string help;
+        std::map<std::string, std::unique_ptr<Counter>> counters;
+        std::map<std::string, std::function<double()>> gauges;
+        std::map<std::string, std::unique_ptr<Histogram>> histograms;
+    };
+
+    /// @brief Returns the family of a name, creating it. Assumes `m_mutex` is held.
+    Family& family_unsafe(const std::string& name, const std::string& help, Type type);
+
+    mutable std::mutex m_mutex;
+    std::map<std::string, Family> m_families;
+};
+
+} // namespace common
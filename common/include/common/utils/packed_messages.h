@@ -0,0 +1,33 @@
+#pragma once
+
+#include <google/protobuf/repeated_ptr_field.h>
+
+/**
+ * @file packed_messages.h
+ * @brief Conversion of history pages to and from the columnar `PackedMessages` encoding.
+ */
+
+namespace chat {
+class MessageInfo;
+class PackedMessages;
+} // namespace chat
+
+namespace common {
+
+/**
+ * @brief Encodes a page of messages as `PackedMessages`, in the same order.
+ *
+ * @details A page is mostly the same few senders and close ids and timestamps. Each sender
+ * goes into the dictionary once, every other field becomes a varint of its difference to
+ * the previous message, and the texts are concatenated without a tag and length each.
+ */
+void packMessages(const google::protobuf::RepeatedPtrField<chat::MessageInfo>& messages, chat::PackedMessages& out);
+
+/**
+ * @brief Decodes `packed` into `out`, appending to it.
+ * @return false, leaving `out` as it was, if the columns disagree on the number of messages,
+ * a sender index is out of the dictionary or the text sizes do not add up to the blob.
+ */
+bool unpackMessages(const chat::PackedMessages& packed, google::protobuf::RepeatedPtrField<chat::MessageInfo>& out);
+
+} // namespace common
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <drogon/HttpResponse.h>
+#include <drogon/HttpRequest.h>
+#include <json/json.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+
+/**
+ * @file profiler.h
+ * @brief On-demand CPU profiles and heap snapshots of the running process, served to admins over HTTP.
+ */
+
+namespace common {
+
+/**
+ * @struct ProfilingOptions
+ * @brief The `profiling` section of `custom_config`, the `/debug/profile/...` endpoints.
+ */
+struct ProfilingOptions {
+    /// Off by default, a profile costs a signal and an unwind per sample while it runs.
+    bool enabled = false;
+    /// The bearer token of the aggregator's endpoints, which has no users to log in. Empty serves none there.
+    std::string token;
+    /// The longest CPU profile asked for with `seconds`.
+    std::chrono::seconds max_duration{60};
+    /// Samples per second of CPU time, an odd rate so it does not beat with periodic timers.
+    int frequency_hz = 99;
+
+    /// @brief Reads the options from the `profiling` object, absent keys keep their defaults.
+    static ProfilingOptions fromJson(const Json::Value& json);
+};
+
+/**
+ * @class Profiler
+ * @brief A sampling CPU profiler and heap snapshots, without a profiler linked in or attached.
+ *
+ * @details A CPU profile arms `ITIMER_PROF`, which sends `SIGPROF` to whichever thread is using the
+ * CPU, so the samples of each thread follow its CPU time. The handler walks the frame pointers of
+ * the interrupted thread, signal-safe where `backtrace()` is not, into a buffer allocated up front,
+ * the samples beyond it are dropped and counted. The build keeps frame pointers for it, a stack is cut
+ * short at the first frame of a library built without them.
+ * The profile comes in the legacy gperftools format, with `/proc/self/maps` appended, and is read
+ * against the binary by `pprof -http=: app_server cpu.prof`. The addresses resolve to the
+ * `.actor`/`.resume` functions of the coroutines as well, a resumed handler shows under the
+ * event loop that resumed it rather than under the request that started it.
+ *
+ * One CPU profile runs at a time.
+ */
+class Profiler {
+public:
+    static Profiler& instance();
+
+    /**
+     * @brief Samples the process for `duration` and hands the profile to `done` on the main loop.
+     * @return False without starting when a profile is running already.
+     */
+    bool startCpuProfile(std::chrono::milliseconds duration, int frequency_hz, std::function<void(std::string)> done);
+
+    /// @brief A heap snapshot and the content type it comes in.
+    struct HeapSnapshot {
+        std::string content_type;
+        std::string body;
+    };
+
+    /**
+     * @brief Dumps the heap profile of jemalloc when the process runs on it with `prof:true`,
+     * the `malloc_info` XML of glibc's arenas otherwise.
+     */
+    HeapSnapshot heapSnapshot() const;
+
+    /// @brief Samples dropped by the last profile because its buffer was full.
+    uint64_t droppedSamples() const noexcept { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    Profiler() = default;
+
+    /// @brief Disarms the timer and encodes the samples taken.
+    std::string stop(std::chrono::microseconds period);
+
+    std::atomic<bool> m_running{false};
+    std::atomic<uint64_t> m_dropped{0};
+};
+
+/**
+ * @brief Serves `GET /debug/profile/cpu?seconds=<n>` (`kind` "cpu") or `GET /debug/profile/heap` (`kind` "heap")
+ * to a caller already allowed to. Answers 409 while another CPU profile runs.
+ */
+void serveProfile(const ProfilingOptions& options, const drogon::HttpRequestPtr& req, const std::string& kind,
+                  std::function<void(const drogon::HttpResponsePtr&)> callback);
+
+} // namespace common
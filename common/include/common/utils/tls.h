@@ -0,0 +1,56 @@
+#pragma once
+
+#include <json/json.h>
+#include <string>
+#include <vector>
+
+/**
+ * @file tls.h
+ * @brief The TLS listener of the server and the aggregator, terminating TLS in the process itself.
+ */
+
+namespace common {
+
+/**
+ * @struct TlsOptions
+ * @brief The `tls` section of `custom_config`, a listener added next to those of `listeners`.
+ *
+ * @details Reconnect storms are what makes TLS expensive: every client shows up again within
+ * seconds and would pay a full handshake each. With session tickets a client presenting the
+ * ticket of its previous connection resumes with an abbreviated handshake, without the
+ * certificate exchange and key agreement. Tickets are sealed with keys local to the process,
+ * so they resume on the same process only.
+ *
+ * `ssl_conf` passes further OpenSSL `SSL_CONF_cmd` settings through as they are, such as
+ * `CipherString` or `Groups`.
+ */
+struct TlsOptions {
+    bool enabled = false;
+    std::string address = "0.0.0.0";
+    uint16_t port = 0;
+    /// PEM files of the certificate chain and its private key.
+    std::string cert;
+    std::string key;
+    /// The oldest protocol version accepted, as written by OpenSSL.
+    std::string min_protocol = "TLSv1.2";
+    /// Whether clients may resume their sessions with tickets.
+    bool session_tickets = true;
+    /**
+     * Asks OpenSSL for kernel TLS, record encryption done by the kernel on send. OpenSSL only
+     * offloads when it writes to the socket itself and the kernel has the `tls` module, it
+     * falls back to encrypting on its own otherwise.
+     */
+    bool ktls = false;
+    std::vector<std::pair<std::string, std::string>> ssl_conf;
+
+    /// @brief Reads the options from the `tls` object, absent keys keep their defaults.
+    static TlsOptions fromJson(const Json::Value& json);
+};
+
+/**
+ * @brief Adds the TLS listener, if enabled. Must be called before `drogon::app().run()`.
+ * @return False if the options are enabled but incomplete, nothing is added then.
+ */
+bool addTlsListener(const TlsOptions& options);
+
+} // namespace common
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * @file tracing.h
+ * @brief Sampled request traces, written as OpenTelemetry (OTLP/JSON) spans.
+ */
+
+namespace common {
+
+/**
+ * @class Trace
+ * @brief The spans recorded for one sampled request.
+ *
+ * @details A trace has a root span, started with the trace and ended when its last owner
+ * lets go of it, and any number of child spans recorded with `addSpan()` or `Span`. Once
+ * destroyed it is rendered as one OTLP/JSON `ResourceSpans` document and handed to `Tracer`.
+ *
+ * Child spans are all parented to the root span, this keeps recording free of any span stack
+ * that would have to follow coroutines across suspensions.
+ *
+ * @note Not thread-safe. A request's spans are recorded on its connection's IO loop only.
+ */
+class Trace {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit Trace(std::string name);
+    ~Trace();
+
+    Trace(const Trace&) = delete;
+    Trace& operator=(const Trace&) = delete;
+
+    /// @brief Renames the root span, e.g. once the request type is known.
+    void setName(std::string name) { m_name = std::move(name); }
+
+    /// @brief Adds an attribute to the root span.
+    void setAttribute(const std::string& key, const std::string& value);
+    void setAttribute(const std::string& key, int64_t value);
+
+    /// @brief Records a finished child span.
+    void addSpan(std::string name, Clock::time_point start, Clock::time_point end, std::string attributes = {});
+
+    /// @brief Renders a string attribute as an OTLP/JSON `KeyValue`, for the `attributes` of `addSpan()`.
+    static std::string attribute(const std::string& key, const std::string& value);
+    /// @brief Renders an integer attribute as an OTLP/JSON `KeyValue`, for the `attributes` of `addSpan()`.
+    static std::string attribute(const std::string& key, int64_t value);
+
+private:
+    struct SpanRecord {
+        std::string name;
+        uint64_t span_id;
+        Clock::time_point start;
+        Clock::time_point end;
+        /// Comma-separated OTLP/JSON `KeyValue` objects.
+        std::string attributes;
+    };
+
+    /// @brief Converts a steady clock reading to nanoseconds since the UNIX epoch.
+    int64_t unixNanos(Clock::time_point t) const;
+
+    std::string m_name;
+    uint64_t m_trace_id_high;
+    uint64_t m_trace_id_low;
+    uint64_t m_root_span_id;
+    Clock::time_point m_start;
+    int64_t m_start_unix_ns;
+    std::string m_attributes;
+    std::vector<SpanRecord> m_spans;
+};
+
+using TracePtr = std::shared_ptr<Trace>;
+
+/**
+ * @brief The trace of the request currently running on this thread, null when it is not sampled.
+ * @details Set when a request starts and restored by the awaitables that resume coroutines
+ * (`AwaitableGuarded`, `switch_to_io_loop`, `MessageBatcher`), which capture it on suspension.
+ * After any other suspension point it may belong to another request, spans are then lost or
+ * misattributed, never unsafe.
+ */
+const TracePtr& currentTrace() noexcept;
+
+/// @brief Replaces the trace of this thread, see `currentTrace()`.
+void setCurrentTrace(TracePtr trace) noexcept;
+
+/**
+ * @class Span
+ * @brief Records a child span of the current trace from construction to destruction.
+ * @details Costs one thread-local read when the request is not sampled.
+ */
+class Span {
+public:
+    explicit Span(const char* name) : Span(name, currentTrace()) {}
+
+    /// @brief Records a span of the given trace, for code that holds it outside of the request.
+    Span(const char* name, TracePtr trace) : m_trace{std::move(trace)}, m_name{name} {
+        if(m_trace) {
+            m_start = Trace::Clock::now();
+        }
+    }
+
+    ~Span() {
+        if(m_trace) {
+            m_trace->addSpan(m_name, m_start, Trace::Clock::now(), std::move(m_attributes));
+        }
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+    /// @brief Whether the span is recorded, so attributes are worth computing.
+    explicit operator bool() const noexcept { return m_trace != nullptr; }
+
+    void setAttribute(const std::string& key, int64_t value);
+    void setAttribute(const std::string& key, const std::string& value);
+
+private:
+    TracePtr m_trace;
+    const char* m_name;
+    Trace::Clock::time_point m_start;
+    std::string m_attributes;
+};
+
+/**
+ * @class Tracer
+ * @brief A singleton deciding which requests are traced and writing their traces out.
+ *
+ * @details Finished traces are buffered and appended to the output file once a second from
+ * the main loop, one OTLP/JSON document per line, as read by the OpenTelemetry Collector's
+ * `otlpjsonfile` receiver. Traces finished while the buffer is full are dropped.
+ */
+class Tracer {
+public:
+    struct Options {
+        /// The fraction of requests traced, 0 disables tracing.
+        double sample_rate = 0;
+        std::string output = "logs/traces.jsonl";
+        std::string service_name = "chat-server";
+    };
+
+    /**
+     * @brief Gets the singleton instance of the Tracer.
+     * @return A reference to the single Tracer instance.
+     */
+    static Tracer& instance();
+
+    /**
+     * @brief Opens the output and starts the periodic flush.
+     * @note Must be called once, on the main loop. Until then no request is sampled.
+     */
+    void start(const Options& options);
+
+    /// @brief Starts a trace for a request if it is sampled, returns null otherwise.
+    TracePtr sample(std::string name);
+
+    /// @brief Queues a rendered trace for the next flush. Thread-safe.
+    void submit(std::string document);
+
+    const std::string& serviceName() const noexcept { return m_options.service_name; }
+
+private:
+    Tracer() = default;
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    void flush();
+
+    /// @brief The most bytes of traces held between two flushes.
+    static constexpr size_t MAX_BUFFERED_BYTES = 4 * 1024 * 1024;
+
+    Options m_options;
+    /// @brief The sample rate scaled to the range of `uint64_t`, 0 until `start()`.
+    std::atomic<uint64_t> m_threshold{0};
+
+    std::mutex m_mutex;
+    std::string m_buffer;
+    uint64_t m_dropped = 0;
+    std::ofstream m_out;
+};
+
+} // namespace common
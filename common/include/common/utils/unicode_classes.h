@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string_view>
+
+/**
+ * @file unicode_classes.h
+ * @brief Locale-independent classification of code points, in constant time.
+ */
+
+namespace common {
+
+/**
+ * @brief Whether a code point is a letter or a digit (the L and N categories of Unicode).
+ *
+ * @details Looked up in a two-stage table built at compile time from the ranges of the
+ * Unicode database: the block of 256 code points selects one of the distinct 256-bit sets,
+ * the low byte selects the bit. Code points past U+10FFFF are neither.
+ */
+bool isAlphanumeric(char32_t code_point) noexcept;
+
+/**
+ * @brief Whether a text has at least one letter or digit, the rule for user and room names.
+ * @param utf8 Valid UTF-8, as checked by utf8Length() beforehand.
+ */
+bool containsAlphanumeric(std::string_view utf8) noexcept;
+
+} // namespace common
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+/**
+ * @file utf8_validate.h
+ * @brief UTF-8 validation and code point counting in one pass, without exceptions.
+ */
+
+namespace common {
+
+/**
+ * @brief Validates `text` as UTF-8 (RFC 3629) and counts its code points.
+ *
+ * @details Runs of ASCII are skipped 16 bytes at a time with SSE2 or NEON, 8 at a time
+ * elsewhere; only the multibyte sequences are decoded one by one. Overlong encodings,
+ * surrogates, code points past U+10FFFF and truncated sequences are invalid.
+ *
+ * Counting stops once it exceeds `stop_after`, so a text far over a limit is not scanned
+ * to its end, and its remainder is not validated. A text of more than 4 bytes per allowed
+ * code point is over the limit without being scanned at all.
+ *
+ * @param stop_after The count past which the scan may stop.
+ * @return The number of code points, a number above `stop_after` if it stopped early, or
+ * empty if the text is not valid UTF-8.
+ */
+std::optional<size_t> utf8Length(std::string_view text, size_t stop_after = SIZE_MAX) noexcept;
+
+} // namespace common
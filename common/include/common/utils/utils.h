@@ -15,8 +15,35 @@ void setStatus(Response& resp, chat::StatusCode code, const std::string& msg) {
     resp.mutable_status()->set_message(msg);
 }
 
+/// @brief An immutable, shareable wire encoding of a `chat::Envelope`.
+using SerializedEnvelope = std::shared_ptr<const std::string>;
+
 chat::Envelope makeGenericErrorEnvelope(const std::string& msg);
 void sendEnvelope(const drogon::WebSocketConnectionPtr& conn, const chat::Envelope& env);
+
+/**
+ * @brief Encodes an envelope once so the same bytes can be handed to many connections.
+ * @return The encoded buffer, or `nullptr` if serialization failed.
+ */
+SerializedEnvelope serializeEnvelope(const chat::Envelope& env);
+
+/**
+ * @brief Sends an already encoded envelope, produced by `serializeEnvelope`, to a connection.
+ * @note A null buffer is ignored; the caller is expected to have reported the serialization failure.
+ */
+void sendSerialized(const drogon::WebSocketConnectionPtr& conn, const SerializedEnvelope& bytes);
+
+/**
+ * @brief Wraps an encoded envelope into a `CompressedEnvelope` using the given codec.
+ * @return The encoded wrapper, or `bytes` itself when compression is off, fails or does not make it smaller.
+ */
+SerializedEnvelope compressEnvelope(const SerializedEnvelope& bytes, chat::Compression compression);
+
+/**
+ * @brief Restores the envelope carried by a `CompressedEnvelope`.
+ * @return The inner envelope, or an empty optional if it could not be decoded.
+ */
+std::optional<chat::Envelope> decompressEnvelope(const chat::CompressedEnvelope& compressed);
 std::string getEnvVar(const std::string& name);
 std::pair<std::string, std::string> splitUrl(const std::string& url);
 
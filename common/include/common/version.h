@@ -1,7 +1,7 @@
 namespace common {
 
 namespace version {
-    constexpr std::size_t PROTOCOL_VERSION = 7;
+    constexpr std::size_t PROTOCOL_VERSION = 41;
 }
 
 } // namespace common
@@ -2,6 +2,7 @@
 
 #include <common/proto/chat.pb.h>
 #include <drogon/drogon.h>
+#include <common/utils/logging.h>
 
 #include <vector>
 #include <string>
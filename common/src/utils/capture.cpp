@@ -0,0 +1,63 @@
+#include <common/utils/capture.h>
+#include <fstream>
+#include <iterator>
+
+namespace common::capture {
+
+static void appendVarint(std::string& out, uint64_t value) {
+    while(value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+/// @brief Reads a varint at `pos` and moves past it, false if the data ends first.
+static bool readVarint(std::string_view data, size_t& pos, uint64_t& value) {
+    value = 0;
+    for(int shift = 0; shift < 64 && pos < data.size(); shift += 7) {
+        const auto byte = static_cast<uint8_t>(data[pos++]);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if(!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void appendRecord(std::string& out, uint64_t time_us, uint64_t connection, std::string_view frame) {
+    appendVarint(out, time_us);
+    appendVarint(out, connection);
+    appendVarint(out, frame.size());
+    out.append(frame);
+}
+
+std::optional<std::vector<Record>> readFile(const std::string& path, std::string& error) {
+    std::ifstream in(path, std::ios::binary);
+    if(!in) {
+        error = "cannot open " + path;
+        return std::nullopt;
+    }
+    const std::string data{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    if(!std::string_view(data).starts_with(MAGIC)) {
+        error = path + " is not a capture";
+        return std::nullopt;
+    }
+
+    std::vector<Record> records;
+    size_t pos = MAGIC.size();
+    while(pos < data.size()) {
+        Record record;
+        uint64_t length = 0;
+        if(!readVarint(data, pos, record.time_us) || !readVarint(data, pos, record.connection) ||
+           !readVarint(data, pos, length) || length > data.size() - pos) {
+            break;
+        }
+        record.frame.assign(data, pos, length);
+        pos += length;
+        records.push_back(std::move(record));
+    }
+    return records;
+}
+
+} // namespace common::capture
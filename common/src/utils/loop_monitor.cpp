@@ -0,0 +1,82 @@
+#include <common/utils/loop_monitor.h>
+#include <common/utils/metrics.h>
+
+namespace common {
+
+LoopMonitor& LoopMonitor::instance() {
+    static LoopMonitor inst;
+    return inst;
+}
+
+void LoopMonitor::start(const Options& options) {
+    if(m_loop_count.load(std::memory_order_relaxed) != 0) {
+        return;
+    }
+    m_options = options;
+    const size_t loops = drogon::app().getThreadNum();
+    m_loops = std::make_unique<LoopStats[]>(loops);
+    m_loop_count.store(loops, std::memory_order_release);
+
+    auto& metrics = MetricsRegistry::instance();
+    for(size_t i = 0; i < loops; ++i) {
+        const std::string labels = "loop=\"" + std::to_string(i) + "\"";
+        LoopStats* stats = &m_loops[i];
+        metrics.gauge("event_loop_queue_depth", "Tasks posted to the IO loop that have not run yet.",
+                      [stats] { return static_cast<double>(stats->depth.load(std::memory_order_relaxed)); }, labels);
+        metrics.gauge("event_loop_queue_depth_peak", "The deepest the IO loop queue got during the previous sample interval.",
+                      [stats] { return static_cast<double>(stats->sampled_peak.load(std::memory_order_relaxed)); }, labels);
+        metrics.gauge("event_loop_lag_seconds", "How long the latest probe waited in the IO loop queue.",
+                      [stats] { return static_cast<double>(stats->lag_us.load(std::memory_order_relaxed)) / 1e6; }, labels);
+    }
+
+    const double interval = std::chrono::duration<double>(m_options.sample_interval).count();
+    drogon::app().getLoop()->runEvery(std::max(interval, 0.05), [this] { sample(); });
+    LOG_INFO << "Monitoring " << loops << " IO loop(s)";
+}
+
+void LoopMonitor::sample() {
+    const size_t loops = m_loop_count.load(std::memory_order_acquire);
+    const auto warn_lag_us = std::chrono::duration_cast<std::chrono::microseconds>(m_options.warn_lag).count();
+    const auto now = std::chrono::steady_clock::now();
+
+    for(size_t i = 0; i < loops; ++i) {
+        auto& stats = m_loops[i];
+        const auto peak = stats.peak_depth.exchange(stats.depth.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        stats.sampled_peak.store(peak, std::memory_order_relaxed);
+        const auto lag_us = stats.lag_us.load(std::memory_order_relaxed);
+
+        if(warn_lag_us > 0 && lag_us > warn_lag_us) {
+            LOG_WARN << "IO loop " << i << " is lagging: a probe waited " << lag_us / 1000 << " ms, "
+                     << stats.depth.load(std::memory_order_relaxed) << " task(s) queued";
+        } else if(m_options.warn_queue_depth > 0 && peak > static_cast<int64_t>(m_options.warn_queue_depth)) {
+            LOG_WARN << "IO loop " << i << " queue reached " << peak << " task(s)";
+        }
+
+        // A probe that has not run yet by the next sample leaves the previous lag in place,
+        // the stuck loop is then reported by its queue depth.
+        queueInLoop(i, [&stats, queued = now] {
+            const auto waited = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - queued);
+            stats.lag_us.store(waited.count(), std::memory_order_relaxed);
+        });
+    }
+}
+
+std::chrono::microseconds LoopMonitor::maxLag() const noexcept {
+    const size_t loops = m_loop_count.load(std::memory_order_acquire);
+    int64_t worst = 0;
+    for(size_t i = 0; i < loops; ++i) {
+        worst = std::max(worst, m_loops[i].lag_us.load(std::memory_order_relaxed));
+    }
+    return std::chrono::microseconds{worst};
+}
+
+int64_t LoopMonitor::queueDepth(size_t loop_index) const noexcept {
+    return loop_index < m_loop_count.load(std::memory_order_acquire) ? m_loops[loop_index].depth.load(std::memory_order_relaxed) : 0;
+}
+
+std::chrono::microseconds LoopMonitor::lag(size_t loop_index) const noexcept {
+    return std::chrono::microseconds{
+        loop_index < m_loop_count.load(std::memory_order_acquire) ? m_loops[loop_index].lag_us.load(std::memory_order_relaxed) : 0};
+}
+
+} // namespace common
@@ -0,0 +1,142 @@
+#include <common/utils/metrics.h>
+#include <algorithm>
+#include <charconv>
+#include <trantor/utils/Logger.h>
+
+namespace common {
+
+static constexpr double LATENCY_BUCKETS[] = {
+    0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5
+};
+
+static constexpr double SIZE_BUCKETS[] = {
+    1, 2, 5, 10, 25, 50, 100, 250, 500, 1'000, 2'500, 5'000, 10'000
+};
+
+// Joins a series' own labels with an extra one, such as the `le` of a bucket.
+static std::string labelSet(const std::string& labels, const std::string& extra = {}) {
+    if(labels.empty() && extra.empty()) {
+        return {};
+    }
+    if(labels.empty() || extra.empty()) {
+        return "{" + labels + extra + "}";
+    }
+    return "{" + labels + "," + extra + "}";
+}
+
+// Shortest round-tripping form, as Prometheus parses any float syntax.
+static std::string formatNumber(double value) {
+    char buf[32];
+    const auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+    return ec == std::errc{} ? std::string(buf, end) : std::string("NaN");
+}
+
+Histogram::Histogram(std::span<const double> bounds)
+    : m_bounds(bounds.begin(), bounds.end())
+    , m_buckets(std::make_unique<std::atomic<uint64_t>[]>(m_bounds.size() + 1)) {
+}
+
+void Histogram::observe(double value) noexcept {
+    const auto bucket = std::lower_bound(m_bounds.begin(), m_bounds.end(), value) - m_bounds.begin();
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+void Histogram::render(std::string& out, const std::string& name, const std::string& labels) const {
+    // Buckets are read one by one while others observe, a scrape may be off by the observations in flight.
+    uint64_t cumulative = 0;
+    for(size_t i = 0; i < m_bounds.size(); ++i) {
+        cumulative += m_buckets[i].load(std::memory_order_relaxed);
+        out += name + "_bucket" + labelSet(labels, "le=\"" + formatNumber(m_bounds[i]) + "\"") + " " + std::to_string(cumulative) + "\n";
+    }
+    cumulative += m_buckets[m_bounds.size()].load(std::memory_order_relaxed);
+    out += name + "_bucket" + labelSet(labels, "le=\"+Inf\"") + " " + std::to_string(cumulative) + "\n";
+    out += name + "_sum" + labelSet(labels) + " " + formatNumber(m_sum.load(std::memory_order_relaxed)) + "\n";
+    out += name + "_count" + labelSet(labels) + " " + std::to_string(cumulative) + "\n";
+}
+
+MetricsRegistry& MetricsRegistry::instance() {
+    static MetricsRegistry inst;
+    return inst;
+}
+
+std::span<const double> MetricsRegistry::latencyBuckets() noexcept {
+    return LATENCY_BUCKETS;
+}
+
+std::span<const double> MetricsRegistry::sizeBuckets() noexcept {
+    return SIZE_BUCKETS;
+}
+
+MetricsRegistry::Family& MetricsRegistry::family_unsafe(const std::string& name, const std::string& help, Type type) {
+    auto [it, added] = m_families.try_emplace(name);
+    if(added) {
+        it->second.type = type;
+        it->second.help = help;
+    } else if(it->second.type != type) {
+        LOG_ERROR << "Metric " << name << " registered again with another type";
+    }
+    return it->second;
+}
+
+Counter& MetricsRegistry::counter(const std::string& name, const std::string& help, const std::string& labels) {
+    std::lock_guard lock(m_mutex);
+    auto& series = family_unsafe(name, help, Type::Counter).counters[labels];
+    if(!series) {
+        series = std::make_unique<Counter>();
+    }
+    return *series;
+}
+
+Histogram& MetricsRegistry::histogram(const std::string& name, const std::string& help, const std::string& labels,
+                                      std::span<const double> bounds) {
+    std::lock_guard lock(m_mutex);
+    auto& series = family_unsafe(name, help, Type::Histogram).histograms[labels];
+    if(!series) {
+        series = std::make_unique<Histogram>(bounds);
+    }
+    return *series;
+}
+
+void MetricsRegistry::gauge(const std::string& name, const std::string& help, std::function<double()> read, const std::string& labels) {
+    std::lock_guard lock(m_mutex);
+    family_unsafe(name, help, Type::Gauge).gauges[labels] = std::move(read);
+}
+
+std::map<std::string, double> MetricsRegistry::read(const std::string& name) const {
+    std::map<std::string, double> values;
+    std::lock_guard lock(m_mutex);
+    const auto it = m_families.find(name);
+    if(it == m_families.end()) {
+        return values;
+    }
+    for(const auto& [labels, counter] : it->second.counters) {
+        values.emplace(labels, static_cast<double>(counter->value()));
+    }
+    for(const auto& [labels, read] : it->second.gauges) {
+        values.emplace(labels, read());
+    }
+    return values;
+}
+
+std::string MetricsRegistry::render() const {
+    std::string out;
+    std::lock_guard lock(m_mutex);
+    for(const auto& [name, family] : m_families) {
+        const char* type = family.type == Type::Counter ? "counter" : family.type == Type::Gauge ? "gauge" : "histogram";
+        out += "# HELP " + name + " " + family.help + "\n";
+        out += "# TYPE " + name + " " + type + "\n";
+        for(const auto& [labels, counter] : family.counters) {
+            out += name + labelSet(labels) + " " + std::to_string(counter->value()) + "\n";
+        }
+        for(const auto& [labels, read] : family.gauges) {
+            out += name + labelSet(labels) + " " + formatNumber(read()) + "\n";
+        }
+        for(const auto& [labels, histogram] : family.histograms) {
+            histogram->render(out, name, labels);
+        }
+    }
+    return out;
+}
+
+} // namespace common
@@ -0,0 +1,82 @@
+#include <common/utils/packed_messages.h>
+#include <unordered_map>
+
+namespace common {
+
+void packMessages(const google::protobuf::RepeatedPtrField<chat::MessageInfo>& messages, chat::PackedMessages& out) {
+    out.Clear();
+    const int count = messages.size();
+    out.mutable_user_index()->Reserve(count);
+    out.mutable_message_id_delta()->Reserve(count);
+    out.mutable_seq_delta()->Reserve(count);
+    out.mutable_timestamp_delta()->Reserve(count);
+    out.mutable_text_sizes()->Reserve(count);
+
+    size_t text_bytes = 0;
+    for(const auto& message : messages) {
+        text_bytes += message.message().size();
+    }
+    auto& texts = *out.mutable_texts();
+    texts.reserve(text_bytes);
+
+    std::unordered_map<int32_t, uint32_t> user_index;
+    int32_t last_id = 0;
+    int64_t last_seq = 0;
+    int64_t last_timestamp = 0;
+    for(const auto& message : messages) {
+        const auto [it, added] = user_index.try_emplace(message.from().user_id(), static_cast<uint32_t>(out.users_size()));
+        if(added) {
+            *out.add_users() = message.from();
+        }
+        out.add_user_index(it->second);
+        // Wrapping, like the decoding, so any two ids have a difference.
+        out.add_message_id_delta(static_cast<int32_t>(static_cast<uint32_t>(message.message_id()) - static_cast<uint32_t>(last_id)));
+        out.add_seq_delta(message.seq() - last_seq);
+        out.add_timestamp_delta(message.timestamp() - last_timestamp);
+        out.add_text_sizes(static_cast<uint32_t>(message.message().size()));
+        texts += message.message();
+        last_id = message.message_id();
+        last_seq = message.seq();
+        last_timestamp = message.timestamp();
+    }
+}
+
+bool unpackMessages(const chat::PackedMessages& packed, google::protobuf::RepeatedPtrField<chat::MessageInfo>& out) {
+    const int count = packed.user_index_size();
+    if(packed.message_id_delta_size() != count || packed.seq_delta_size() != count
+        || packed.timestamp_delta_size() != count || packed.text_sizes_size() != count) {
+        return false;
+    }
+    uint64_t text_bytes = 0;
+    for(int i = 0; i < count; ++i) {
+        if(packed.user_index(i) >= static_cast<uint32_t>(packed.users_size())) {
+            return false;
+        }
+        text_bytes += packed.text_sizes(i);
+    }
+    if(text_bytes != packed.texts().size()) {
+        return false;
+    }
+
+    out.Reserve(out.size() + count);
+    const std::string_view texts = packed.texts();
+    size_t text_offset = 0;
+    int32_t id = 0;
+    int64_t seq = 0;
+    int64_t timestamp = 0;
+    for(int i = 0; i < count; ++i) {
+        id = static_cast<int32_t>(static_cast<uint32_t>(id) + static_cast<uint32_t>(packed.message_id_delta(i)));
+        seq += packed.seq_delta(i);
+        timestamp += packed.timestamp_delta(i);
+        auto* message = out.Add();
+        *message->mutable_from() = packed.users(static_cast<int>(packed.user_index(i)));
+        message->set_message(std::string(texts.substr(text_offset, packed.text_sizes(i))));
+        message->set_timestamp(timestamp);
+        message->set_message_id(id);
+        message->set_seq(seq);
+        text_offset += packed.text_sizes(i);
+    }
+    return true;
+}
+
+} // namespace common
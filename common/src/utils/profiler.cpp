@@ -0,0 +1,318 @@
+#include <common/utils/profiler.h>
+#include <drogon/drogon.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <cerrno>
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <thread>
+
+// Present only when jemalloc replaces malloc.
+extern "C" int mallctl(const char* name, void* oldp, size_t* oldlenp, void* newp, size_t newlen) __attribute__((weak));
+
+namespace common {
+
+namespace {
+
+constexpr int MAX_DEPTH = 40;
+// A frame pointer further than this above the interrupted stack pointer is taken for garbage.
+constexpr uintptr_t MAX_STACK_SPAN = 8 << 20;
+constexpr uintptr_t PAGE_SHIFT = 12;
+// A minute at 99 Hz on five busy cores, about 10 MiB.
+constexpr size_t MAX_SAMPLES = 32768;
+
+struct Sample {
+    uint32_t depth;
+    void* pcs[MAX_DEPTH];
+};
+
+// Allocated by the first profile and never freed, nor is the handler ever uninstalled:
+// a signal delivered after the timer was disarmed still finds both.
+Sample* g_samples = nullptr;
+std::atomic<size_t> g_next{0};
+std::atomic<uint64_t> g_dropped{0};
+std::atomic<bool> g_sampling{false};
+// Handlers running right now, the samples are read once none is.
+std::atomic<int> g_in_handler{0};
+// A nonblocking pipe the handler writes a frame record to before reading it: write() fails with
+// EFAULT on an unmapped address where a load would crash the process. Drained right after.
+int g_probe[2] = {-1, -1};
+
+bool readable(uintptr_t address, size_t size) {
+    if(write(g_probe[1], reinterpret_cast<const void*>(address), size) != static_cast<ssize_t>(size)) {
+        return false;
+    }
+    char drain[64];
+    while(read(g_probe[0], drain, sizeof(drain)) > 0) {
+    }
+    return true;
+}
+
+// The program counter, stack pointer and frame pointer of the interrupted thread.
+struct Registers {
+    uintptr_t pc;
+    uintptr_t sp;
+    uintptr_t fp;
+};
+
+bool interrupted(const void* context, Registers& regs) {
+#if defined(__x86_64__)
+    const auto& mc = static_cast<const ucontext_t*>(context)->uc_mcontext;
+    regs = {static_cast<uintptr_t>(mc.gregs[REG_RIP]), static_cast<uintptr_t>(mc.gregs[REG_RSP]), static_cast<uintptr_t>(mc.gregs[REG_RBP])};
+    return true;
+#elif defined(__aarch64__)
+    const auto& mc = static_cast<const ucontext_t*>(context)->uc_mcontext;
+    regs = {mc.pc, mc.sp, mc.regs[29]};
+    return true;
+#else
+    (void)context;
+    (void)regs;
+    return false;
+#endif
+}
+
+// Follows the chain of frame records, the caller's frame pointer and the return address, from the
+// interrupted frame. Only signal-safe calls, unlike backtrace(). Stops at the first record that is
+// not above the previous one within MAX_STACK_SPAN of the stack pointer, or that cannot be read:
+// code built without frame pointers keeps other values in that register.
+uint32_t walkFrames(const Registers& regs, void** pcs) {
+    uint32_t depth = 0;
+    pcs[depth++] = reinterpret_cast<void*>(regs.pc);
+    uintptr_t fp = regs.fp;
+    uintptr_t checked_page = 0;
+    while(depth < MAX_DEPTH) {
+        if(fp < regs.sp || fp - regs.sp > MAX_STACK_SPAN || fp % alignof(uintptr_t) != 0) {
+            break;
+        }
+        // Frames share pages, a page is probed once.
+        const uintptr_t first_page = fp >> PAGE_SHIFT;
+        const uintptr_t last_page = (fp + 2 * sizeof(uintptr_t) - 1) >> PAGE_SHIFT;
+        if(first_page != checked_page || last_page != checked_page) {
+            if(!readable(fp, 2 * sizeof(uintptr_t))) {
+                break;
+            }
+            checked_page = last_page;
+        }
+        const auto* record = reinterpret_cast<const uintptr_t*>(fp);
+        if(record[1] == 0) {
+            break;
+        }
+        pcs[depth++] = reinterpret_cast<void*>(record[1]);
+        if(record[0] <= fp) {
+            break;
+        }
+        fp = record[0];
+    }
+    return depth;
+}
+
+void onProfilingSignal(int, siginfo_t*, void* context) {
+    const int saved_errno = errno;
+    g_in_handler.fetch_add(1, std::memory_order_acq_rel);
+    if(g_sampling.load(std::memory_order_acquire)) {
+        const size_t index = g_next.fetch_add(1, std::memory_order_relaxed);
+        if(index < MAX_SAMPLES) {
+            auto& sample = g_samples[index];
+            Registers regs;
+            sample.depth = interrupted(context, regs) ? walkFrames(regs, sample.pcs) : 0;
+        } else {
+            g_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    g_in_handler.fetch_sub(1, std::memory_order_acq_rel);
+    errno = saved_errno;
+}
+
+} // namespace
+
+ProfilingOptions ProfilingOptions::fromJson(const Json::Value& json) {
+    ProfilingOptions options;
+    if(!json.isObject()) {
+        return options;
+    }
+    options.enabled = json.get("enabled", options.enabled).asBool();
+    options.token = json.get("token", options.token).asString();
+    options.max_duration = std::chrono::seconds{json.get("max_seconds", static_cast<Json::Int64>(options.max_duration.count())).asInt64()};
+    options.frequency_hz = json.get("frequency_hz", options.frequency_hz).asInt();
+    return options;
+}
+
+Profiler& Profiler::instance() {
+    static Profiler inst;
+    return inst;
+}
+
+bool Profiler::startCpuProfile(std::chrono::milliseconds duration, int frequency_hz, std::function<void(std::string)> done) {
+    if(m_running.exchange(true, std::memory_order_acq_rel)) {
+        return false;
+    }
+    if(!g_samples) {
+        g_samples = new Sample[MAX_SAMPLES];
+        if(pipe2(g_probe, O_NONBLOCK | O_CLOEXEC) != 0) {
+            LOG_WARN << "Cannot create the pipe of the stack walk, the CPU profile only has the sampled functions";
+        }
+        struct sigaction action{};
+        action.sa_sigaction = onProfilingSignal;
+        action.sa_flags = SA_RESTART | SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGPROF, &action, nullptr);
+    }
+    g_next.store(0, std::memory_order_relaxed);
+    g_dropped.store(0, std::memory_order_relaxed);
+    g_sampling.store(true, std::memory_order_release);
+
+    const std::chrono::microseconds period{1'000'000 / std::clamp(frequency_hz, 1, 1000)};
+    itimerval timer{};
+    timer.it_interval.tv_usec = static_cast<suseconds_t>(period.count());
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    LOG_INFO << "CPU profile started for " << duration.count() << " ms at " << 1'000'000 / period.count() << " Hz";
+
+    drogon::app().getLoop()->runAfter(std::chrono::duration<double>(duration).count(), [this, period, done = std::move(done)] {
+        done(stop(period));
+    });
+    return true;
+}
+
+std::string Profiler::stop(std::chrono::microseconds period) {
+    itimerval off{};
+    setitimer(ITIMER_PROF, &off, nullptr);
+    g_sampling.store(false, std::memory_order_release);
+    while(g_in_handler.load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+
+    const size_t taken = std::min(g_next.load(std::memory_order_relaxed), MAX_SAMPLES);
+    std::map<std::vector<uintptr_t>, uintptr_t> stacks;
+    for(size_t i = 0; i < taken; ++i) {
+        const auto& sample = g_samples[i];
+        if(sample.depth > 0) {
+            const auto* pcs = reinterpret_cast<const uintptr_t*>(sample.pcs);
+            ++stacks[std::vector<uintptr_t>(pcs, pcs + sample.depth)];
+        }
+    }
+
+    // The legacy binary format of gperftools: a header, the stacks with their counts, a trailer, the mappings.
+    std::string profile;
+    const auto word = [&profile](uintptr_t value) {
+        profile.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    word(0);
+    word(3);
+    word(0);
+    word(static_cast<uintptr_t>(period.count()));
+    word(0);
+    for(const auto& [pcs, count] : stacks) {
+        word(count);
+        word(pcs.size());
+        for(const auto pc : pcs) {
+            word(pc);
+        }
+    }
+    word(0);
+    word(1);
+    word(0);
+    std::ifstream maps("/proc/self/maps");
+    profile.append(std::istreambuf_iterator<char>(maps), std::istreambuf_iterator<char>());
+
+    m_dropped.store(g_dropped.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    LOG_INFO << "CPU profile done, " << taken << " samples in " << stacks.size() << " stacks, " << droppedSamples() << " dropped";
+    m_running.store(false, std::memory_order_release);
+    return profile;
+}
+
+Profiler::HeapSnapshot Profiler::heapSnapshot() const {
+    if(mallctl) {
+        bool prof = false;
+        size_t size = sizeof(prof);
+        if(mallctl("opt.prof", &prof, &size, nullptr, 0) == 0 && prof) {
+            // In a directory of our own, a predictable name in the shared temporary directory could be taken by anyone.
+            auto dir_template = (std::filesystem::temp_directory_path() / "chat-heap-XXXXXX").string();
+            if(mkdtemp(dir_template.data())) {
+                const std::filesystem::path dir(dir_template);
+                const auto path_string = (dir / "heap.prof").string();
+                const char* name = path_string.c_str();
+                const bool dumped = mallctl("prof.dump", nullptr, nullptr, &name, sizeof(name)) == 0;
+                std::optional<HeapSnapshot> snapshot;
+                if(dumped) {
+                    std::ifstream file(path_string, std::ios::binary);
+                    snapshot = HeapSnapshot{"application/octet-stream", std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>())};
+                }
+                std::error_code ignored;
+                std::filesystem::remove_all(dir, ignored);
+                if(snapshot) {
+                    return std::move(*snapshot);
+                }
+            }
+            LOG_WARN << "jemalloc did not dump its heap profile, falling back to malloc_info";
+        }
+    }
+    char* buffer = nullptr;
+    size_t length = 0;
+    if(FILE* stream = open_memstream(&buffer, &length)) {
+        malloc_info(0, stream);
+        fclose(stream);
+    }
+    HeapSnapshot snapshot{"application/xml", buffer ? std::string(buffer, length) : std::string()};
+    free(buffer);
+    return snapshot;
+}
+
+static drogon::HttpResponsePtr attachment(std::string body, const std::string& content_type, const std::string& filename) {
+    auto resp = drogon::HttpResponse::newHttpResponse();
+    resp->setStatusCode(drogon::k200OK);
+    resp->setContentTypeCodeAndCustomString(drogon::CT_CUSTOM, content_type);
+    resp->addHeader("Content-Disposition", "attachment; filename=\"" + filename + "\"");
+    resp->setBody(std::move(body));
+    return resp;
+}
+
+static drogon::HttpResponsePtr profileError(drogon::HttpStatusCode code, const std::string& body) {
+    auto resp = drogon::HttpResponse::newHttpResponse();
+    resp->setStatusCode(code);
+    resp->setContentTypeCode(drogon::CT_TEXT_PLAIN);
+    resp->setBody(body);
+    return resp;
+}
+
+void serveProfile(const ProfilingOptions& options, const drogon::HttpRequestPtr& req, const std::string& kind,
+                  std::function<void(const drogon::HttpResponsePtr&)> callback) {
+    if(kind == "heap") {
+        auto snapshot = Profiler::instance().heapSnapshot();
+        const bool xml = snapshot.content_type == "application/xml";
+        callback(attachment(std::move(snapshot.body), snapshot.content_type, xml ? "heap.xml" : "heap.prof"));
+        return;
+    }
+    if(kind != "cpu") {
+        callback(profileError(drogon::k404NotFound, "Not found"));
+        return;
+    }
+    int64_t seconds = 30;
+    if(const auto& param = req->getParameter("seconds"); !param.empty()) {
+        const auto [end, ec] = std::from_chars(param.data(), param.data() + param.size(), seconds);
+        if(ec != std::errc{} || end != param.data() + param.size() || seconds <= 0) {
+            callback(profileError(drogon::k400BadRequest, "seconds must be a positive integer"));
+            return;
+        }
+    }
+    const auto duration = std::min(std::chrono::seconds{seconds}, options.max_duration);
+    const bool started = Profiler::instance().startCpuProfile(duration, options.frequency_hz, [callback](std::string profile) {
+        auto resp = attachment(std::move(profile), "application/octet-stream", "cpu.prof");
+        resp->addHeader("X-Dropped-Samples", std::to_string(Profiler::instance().droppedSamples()));
+        callback(resp);
+    });
+    if(!started) {
+        callback(profileError(drogon::k409Conflict, "A CPU profile is running already"));
+    }
+}
+
+} // namespace common
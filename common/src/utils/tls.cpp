@@ -0,0 +1,55 @@
+#include <common/utils/tls.h>
+#include <drogon/drogon.h>
+
+namespace common {
+
+TlsOptions TlsOptions::fromJson(const Json::Value& json) {
+    TlsOptions options;
+    if(!json.isObject()) {
+        return options;
+    }
+    options.enabled = json.get("enabled", options.enabled).asBool();
+    options.address = json.get("address", options.address).asString();
+    options.port = static_cast<uint16_t>(json.get("port", options.port).asUInt());
+    options.cert = json.get("cert", options.cert).asString();
+    options.key = json.get("key", options.key).asString();
+    options.min_protocol = json.get("min_protocol", options.min_protocol).asString();
+    options.session_tickets = json.get("session_tickets", options.session_tickets).asBool();
+    options.ktls = json.get("ktls", options.ktls).asBool();
+    const auto& conf = json["ssl_conf"];
+    if(conf.isObject()) {
+        for(const auto& name : conf.getMemberNames()) {
+            options.ssl_conf.emplace_back(name, conf[name].asString());
+        }
+    }
+    return options;
+}
+
+bool addTlsListener(const TlsOptions& options) {
+    if(!options.enabled) {
+        return true;
+    }
+    if(options.port == 0 || options.cert.empty() || options.key.empty()) {
+        LOG_ERROR << "The TLS listener needs a port, a certificate and a key, not listening with TLS";
+        return false;
+    }
+
+    // Options takes a comma separated list, a second Options command would be applied on top of the first.
+    std::string flags = options.session_tickets ? "SessionTicket" : "-SessionTicket";
+    if(options.ktls) {
+        flags += ",KTLS";
+    }
+    std::vector<std::pair<std::string, std::string>> commands{
+        {"MinProtocol", options.min_protocol},
+        {"Options", flags},
+    };
+    commands.insert(commands.end(), options.ssl_conf.begin(), options.ssl_conf.end());
+
+    drogon::app().addListener(options.address, options.port, true, options.cert, options.key, false, commands);
+    LOG_INFO << "Listening with TLS on " << options.address << ':' << options.port
+             << (options.session_tickets ? ", resuming with session tickets" : "")
+             << (options.ktls ? ", kernel TLS requested" : "");
+    return true;
+}
+
+} // namespace common
@@ -0,0 +1,198 @@
+#include <common/utils/tracing.h>
+#include <drogon/drogon.h>
+#include <random>
+
+namespace common {
+
+static thread_local TracePtr t_current;
+
+static uint64_t randomId() {
+    static thread_local std::mt19937_64 rng{std::random_device{}()};
+    uint64_t id = 0;
+    while(id == 0) { // All-zero IDs are invalid in OpenTelemetry.
+        id = rng();
+    }
+    return id;
+}
+
+static std::string hex(uint64_t value) {
+    static constexpr char DIGITS[] = "0123456789abcdef";
+    std::string out(16, '0');
+    for(int i = 15; i >= 0; --i, value >>= 4) {
+        out[i] = DIGITS[value & 0xf];
+    }
+    return out;
+}
+
+// Span names and attributes come from code, escaping quotes and backslashes is enough.
+static std::string jsonString(const std::string& value) {
+    std::string out = "\"";
+    for(char c : value) {
+        if(c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+const TracePtr& currentTrace() noexcept {
+    return t_current;
+}
+
+void setCurrentTrace(TracePtr trace) noexcept {
+    t_current = std::move(trace);
+}
+
+Trace::Trace(std::string name)
+    : m_name(std::move(name))
+    , m_trace_id_high(randomId())
+    , m_trace_id_low(randomId())
+    , m_root_span_id(randomId())
+    , m_start(Clock::now())
+    , m_start_unix_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count()) {
+}
+
+int64_t Trace::unixNanos(Clock::time_point t) const {
+    return m_start_unix_ns + std::chrono::duration_cast<std::chrono::nanoseconds>(t - m_start).count();
+}
+
+std::string Trace::attribute(const std::string& key, const std::string& value) {
+    return "{\"key\":" + jsonString(key) + ",\"value\":{\"stringValue\":" + jsonString(value) + "}}";
+}
+
+std::string Trace::attribute(const std::string& key, int64_t value) {
+    // OTLP/JSON encodes 64-bit integers as strings.
+    return "{\"key\":" + jsonString(key) + ",\"value\":{\"intValue\":\"" + std::to_string(value) + "\"}}";
+}
+
+static void appendAttribute(std::string& attributes, std::string attribute) {
+    if(!attributes.empty()) {
+        attributes += ',';
+    }
+    attributes += attribute;
+}
+
+void Trace::setAttribute(const std::string& key, const std::string& value) {
+    appendAttribute(m_attributes, attribute(key, value));
+}
+
+void Trace::setAttribute(const std::string& key, int64_t value) {
+    appendAttribute(m_attributes, attribute(key, value));
+}
+
+void Trace::addSpan(std::string name, Clock::time_point start, Clock::time_point end, std::string attributes) {
+    m_spans.push_back(SpanRecord{
+        .name = std::move(name),
+        .span_id = randomId(),
+        .start = start,
+        .end = end,
+        .attributes = std::move(attributes),
+    });
+}
+
+Trace::~Trace() {
+    const auto end = Clock::now();
+    const std::string trace_id = hex(m_trace_id_high) + hex(m_trace_id_low);
+    const std::string root_id = hex(m_root_span_id);
+
+    // kind 2 is SPAN_KIND_SERVER for the request, 1 is SPAN_KIND_INTERNAL for its parts.
+    const auto span = [&](const std::string& name, const std::string& span_id, const std::string* parent, int kind,
+                          Clock::time_point start, Clock::time_point finish, const std::string& attributes) {
+        std::string out = "{\"traceId\":\"" + trace_id + "\",\"spanId\":\"" + span_id + "\"";
+        if(parent) {
+            out += ",\"parentSpanId\":\"" + *parent + "\"";
+        }
+        out += ",\"name\":" + jsonString(name) + ",\"kind\":" + std::to_string(kind);
+        out += ",\"startTimeUnixNano\":\"" + std::to_string(unixNanos(start)) + "\"";
+        out += ",\"endTimeUnixNano\":\"" + std::to_string(unixNanos(finish)) + "\"";
+        out += ",\"attributes\":[" + attributes + "]}";
+        return out;
+    };
+
+    std::string doc = "{\"resourceSpans\":[{\"resource\":{\"attributes\":["
+        + attribute("service.name", Tracer::instance().serviceName())
+        + "]},\"scopeSpans\":[{\"scope\":{\"name\":\"chat\"},\"spans\":[";
+    doc += span(m_name, root_id, nullptr, 2, m_start, end, m_attributes);
+    for(const auto& child : m_spans) {
+        doc += ',';
+        doc += span(child.name, hex(child.span_id), &root_id, 1, child.start, child.end, child.attributes);
+    }
+    doc += "]}]}]}\n";
+    Tracer::instance().submit(std::move(doc));
+}
+
+void Span::setAttribute(const std::string& key, int64_t value) {
+    if(m_trace) {
+        appendAttribute(m_attributes, Trace::attribute(key, value));
+    }
+}
+
+void Span::setAttribute(const std::string& key, const std::string& value) {
+    if(m_trace) {
+        appendAttribute(m_attributes, Trace::attribute(key, value));
+    }
+}
+
+Tracer& Tracer::instance() {
+    static Tracer inst;
+    return inst;
+}
+
+void Tracer::start(const Options& options) {
+    if(options.sample_rate <= 0) {
+        LOG_INFO << "Request tracing disabled";
+        return;
+    }
+    m_options = options;
+    m_out.open(m_options.output, std::ios::app);
+    if(!m_out) {
+        LOG_ERROR << "Cannot open trace output " << m_options.output << ", request tracing disabled";
+        return;
+    }
+    const double rate = std::min(m_options.sample_rate, 1.0);
+    m_threshold.store(rate >= 1.0 ? UINT64_MAX : static_cast<uint64_t>(rate * static_cast<double>(UINT64_MAX)),
+                      std::memory_order_release);
+    drogon::app().getLoop()->runEvery(1.0, [this] { flush(); });
+    LOG_INFO << "Tracing " << rate * 100 << "% of requests to " << m_options.output;
+}
+
+TracePtr Tracer::sample(std::string name) {
+    const auto threshold = m_threshold.load(std::memory_order_relaxed);
+    if(threshold == 0) {
+        return nullptr;
+    }
+    static thread_local std::mt19937_64 rng{std::random_device{}()};
+    if(threshold != UINT64_MAX && rng() >= threshold) {
+        return nullptr;
+    }
+    return std::make_shared<Trace>(std::move(name));
+}
+
+void Tracer::submit(std::string document) {
+    std::lock_guard lock(m_mutex);
+    if(m_buffer.size() + document.size() > MAX_BUFFERED_BYTES) {
+        ++m_dropped;
+        return;
+    }
+    m_buffer += document;
+}
+
+void Tracer::flush() {
+    std::string pending;
+    uint64_t dropped = 0;
+    {
+        std::lock_guard lock(m_mutex);
+        pending.swap(m_buffer);
+        std::swap(dropped, m_dropped);
+    }
+    if(dropped > 0) {
+        LOG_WARN << "Dropped " << dropped << " trace(s), the output cannot keep up";
+    }
+    if(!pending.empty()) {
+        m_out << pending;
+        m_out.flush();
+    }
+}
+
+} // namespace common
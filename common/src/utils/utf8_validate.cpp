@@ -0,0 +1,109 @@
+#include <common/utils/utf8_validate.h>
+#include <bit>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define COMMON_UTF8_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define COMMON_UTF8_NEON 1
+#endif
+
+namespace common {
+
+/// @brief The number of ASCII bytes `p` starts with.
+static size_t asciiPrefix(const unsigned char* p, const unsigned char* end) noexcept {
+    const auto* start = p;
+#if defined(COMMON_UTF8_SSE2)
+    for(; end - p >= 16; p += 16) {
+        const auto high = static_cast<unsigned>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))));
+        if(high != 0) {
+            return static_cast<size_t>(p - start) + static_cast<size_t>(std::countr_zero(high));
+        }
+    }
+#elif defined(COMMON_UTF8_NEON)
+    for(; end - p >= 16; p += 16) {
+        if(vmaxvq_u8(vld1q_u8(p)) >= 0x80) {
+            break;
+        }
+    }
+#else
+    if constexpr(std::endian::native == std::endian::little) {
+        for(; end - p >= 8; p += 8) {
+            uint64_t word;
+            std::memcpy(&word, p, sizeof(word));
+            if(const auto high = word & 0x8080808080808080ull) {
+                return static_cast<size_t>(p - start) + static_cast<size_t>(std::countr_zero(high) / 8);
+            }
+        }
+    }
+#endif
+    while(p < end && *p < 0x80) {
+        ++p;
+    }
+    return static_cast<size_t>(p - start);
+}
+
+static bool continuation(unsigned char byte) noexcept {
+    return (byte & 0xC0) == 0x80;
+}
+
+/// @brief Decodes the multibyte sequence at `p`, returning the byte after it, or null if it is invalid.
+static const unsigned char* multibyte(const unsigned char* p, const unsigned char* end) noexcept {
+    const auto lead = p[0];
+    const auto left = end - p;
+    if(lead < 0xC2) {
+        // A continuation byte without a lead, or an overlong 2-byte form.
+        return nullptr;
+    }
+    if(lead < 0xE0) {
+        return left >= 2 && continuation(p[1]) ? p + 2 : nullptr;
+    }
+    if(lead < 0xF0) {
+        if(left < 3 || !continuation(p[2])) {
+            return nullptr;
+        }
+        // E0 would be overlong below A0, ED a surrogate from A0.
+        const unsigned char low = lead == 0xE0 ? 0xA0 : 0x80;
+        const unsigned char high = lead == 0xED ? 0x9F : 0xBF;
+        return p[1] >= low && p[1] <= high ? p + 3 : nullptr;
+    }
+    if(lead < 0xF5) {
+        if(left < 4 || !continuation(p[2]) || !continuation(p[3])) {
+            return nullptr;
+        }
+        // F0 would be overlong below 90, F4 past U+10FFFF from 90.
+        const unsigned char low = lead == 0xF0 ? 0x90 : 0x80;
+        const unsigned char high = lead == 0xF4 ? 0x8F : 0xBF;
+        return p[1] >= low && p[1] <= high ? p + 4 : nullptr;
+    }
+    return nullptr;
+}
+
+std::optional<size_t> utf8Length(std::string_view text, size_t stop_after) noexcept {
+    if(stop_after < text.size() / 4) {
+        return stop_after + 1;
+    }
+    const auto* p = reinterpret_cast<const unsigned char*>(text.data());
+    const auto* end = p + text.size();
+    size_t count = 0;
+    while(p < end) {
+        const auto ascii = asciiPrefix(p, end);
+        p += ascii;
+        count += ascii;
+        if(p == end || count > stop_after) {
+            break;
+        }
+        p = multibyte(p, end);
+        if(!p) {
+            return std::nullopt;
+        }
+        if(++count > stop_after) {
+            return count;
+        }
+    }
+    return count;
+}
+
+} // namespace common
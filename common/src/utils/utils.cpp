@@ -1,5 +1,6 @@
 #include <cstdlib>
 #include <common/utils/utils.h>
+#include <drogon/utils/Utilities.h>
 
 namespace common {
 
@@ -23,6 +24,53 @@ void sendEnvelope(const drogon::WebSocketConnectionPtr& conn, const chat::Envelo
     }
 }
 
+SerializedEnvelope serializeEnvelope(const chat::Envelope& env) {
+    auto out = std::make_shared<std::string>();
+    if(!env.SerializeToString(out.get())) {
+        LOG_ERROR << "Failed to serialize envelope with payload case " << env.payload_case();
+        return nullptr;
+    }
+    return out;
+}
+
+void sendSerialized(const drogon::WebSocketConnectionPtr& conn, const SerializedEnvelope& bytes) {
+    if(!bytes) {
+        return;
+    }
+    if(conn && conn->connected()) {
+        conn->send(bytes->data(), bytes->size(), drogon::WebSocketMessageType::Binary);
+    } else {
+        LOG_WARN << "WS connection closed before broadcast could be sent";
+    }
+}
+
+SerializedEnvelope compressEnvelope(const SerializedEnvelope& bytes, chat::Compression compression) {
+    if(!bytes || compression != chat::COMPRESSION_GZIP) {
+        return bytes;
+    }
+    auto packed = drogon::utils::gzipCompress(bytes->data(), bytes->size());
+    if(packed.empty() || packed.size() >= bytes->size()) {
+        return bytes;
+    }
+    chat::Envelope env;
+    env.mutable_compressed_envelope()->set_compression(compression);
+    env.mutable_compressed_envelope()->set_data(std::move(packed));
+    auto wrapped = serializeEnvelope(env);
+    return wrapped ? wrapped : bytes;
+}
+
+std::optional<chat::Envelope> decompressEnvelope(const chat::CompressedEnvelope& compressed) {
+    if(compressed.compression() != chat::COMPRESSION_GZIP) {
+        return std::nullopt;
+    }
+    const auto raw = drogon::utils::gzipDecompress(compressed.data().data(), compressed.data().size());
+    chat::Envelope env;
+    if(raw.empty() || !env.ParseFromString(raw)) {
+        return std::nullopt;
+    }
+    return env;
+}
+
 #ifdef _MSC_VER
 #pragma warning(push)
 #pragma warning(disable : 4996)
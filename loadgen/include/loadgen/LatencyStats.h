@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+/**
+ * @file LatencyStats.h
+ * @brief Defines the per message type throughput and latency bookkeeping of a load run.
+ */
+
+namespace loadgen {
+
+/// @brief The requests a simulated client sends, each has its own latency series.
+enum class Op : size_t {
+    InitialRegister,
+    Register,
+    InitialAuth,
+    Auth,
+    SubscribeRooms,
+    CreateRoom,
+    JoinRoom,
+    SendMessage,
+    TypingStart,
+    TypingStop,
+    GetMessages,
+    Count
+};
+
+/// @brief The name of a request type in reports, e.g. "SendMessage".
+const char* opName(Op op) noexcept;
+
+/**
+ * @class LatencyStats
+ * @brief Request round-trip latencies per message type, safe to record from any thread.
+ *
+ * @details Latencies are counted in logarithmic buckets 1% wide, from one microsecond to
+ * several minutes, so percentiles are accurate to about 1% without keeping every sample.
+ * Recording is a few relaxed atomic adds.
+ */
+class LatencyStats {
+public:
+    void record(Op op, std::chrono::steady_clock::duration latency, bool ok) noexcept;
+
+    /// @brief Counts a message the server pushed without a request, e.g. another user's chat message.
+    void recordEvent() noexcept { m_events.fetch_add(1, std::memory_order_relaxed); }
+
+    /// @brief Counts a client that got through authentication and joined its first room.
+    void recordSession() noexcept { m_sessions.fetch_add(1, std::memory_order_relaxed); }
+
+    /// @brief Counts a connection that could not be set up or was lost.
+    void recordConnectionFailure() noexcept { m_connection_failures.fetch_add(1, std::memory_order_relaxed); }
+
+    uint64_t completed() const noexcept;
+    uint64_t errors() const noexcept;
+    uint64_t events() const noexcept { return m_events.load(std::memory_order_relaxed); }
+
+    /// @brief Renders the table of counts, throughput and p50/p99/p999 per message type.
+    std::string report(std::chrono::steady_clock::duration elapsed) const;
+
+private:
+    /// 1.01^2000 microseconds is about 7 minutes, anything slower lands in the last bucket.
+    static constexpr size_t BUCKETS = 2000;
+
+    struct Series {
+        std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> errors{0};
+        std::atomic<uint64_t> max_us{0};
+    };
+
+    /// @brief The latency below which a share `q` of the series' samples fall, in microseconds.
+    static double quantile(const Series& series, uint64_t count, double q);
+
+    std::array<Series, static_cast<size_t>(Op::Count)> m_series;
+    std::atomic<uint64_t> m_events{0};
+    std::atomic<uint64_t> m_connection_failures{0};
+    std::atomic<uint64_t> m_sessions{0};
+};
+
+} // namespace loadgen
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <chrono>
+#include <optional>
+#include <string>
+
+/**
+ * @file Options.h
+ * @brief Defines the command line options of the load generator.
+ */
+
+namespace loadgen {
+
+/**
+ * @struct ActionMix
+ * @brief The relative weights of the actions a running client picks from.
+ */
+struct ActionMix {
+    unsigned send = 60;
+    unsigned typing = 20;
+    unsigned history = 15;
+    unsigned join = 5;
+
+    unsigned total() const noexcept { return send + typing + history + join; }
+};
+
+/**
+ * @struct Options
+ * @brief Everything a load run is configured with.
+ */
+struct Options {
+    /// The server's WebSocket endpoint.
+    std::string url = "ws://127.0.0.1:8849/ws";
+    /// The number of simulated clients, each on its own connection and account.
+    size_t clients = 100;
+    /// How long clients keep connecting, they are spread evenly over it.
+    std::chrono::seconds ramp_up{10};
+    /// How long the run lasts in total, ramp-up included.
+    std::chrono::seconds duration{60};
+    /// The average number of actions per second of one client, spaced exponentially.
+    double rate = 1.0;
+    /// The number of rooms clients are spread over, created by the first client when missing.
+    size_t rooms = 10;
+    /// The number of IO threads the clients are spread over.
+    size_t threads = 4;
+    /// Usernames are `<prefix>-<index>`, a rerun with the same prefix logs into the same accounts.
+    std::string prefix = "loadgen";
+    /// The length of the messages sent.
+    size_t message_bytes = 64;
+    /// The page size of history requests.
+    int32_t history_limit = 50;
+    ActionMix mix;
+    /// Set by `--help`, the usage was printed and the program exits successfully.
+    bool help = false;
+
+    /**
+     * @brief Parses `--key=value` arguments, printing the usage on error or `--help`.
+     * @return The options, or empty if the arguments are invalid.
+     */
+    static std::optional<Options> fromArgs(int argc, char** argv);
+};
+
+} // namespace loadgen
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <drogon/WebSocketClient.h>
+#include <common/utils/capture.h>
+#include <loadgen/ReplayOptions.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @file ReplayClient.h
+ * @brief Defines the connections of the traffic replay, see `chat_replay`.
+ */
+
+namespace loadgen {
+
+/// @brief Captured room IDs to the IDs of the rooms standing in for them on the test node.
+using RoomMap = std::unordered_map<int32_t, int32_t>;
+
+/**
+ * @struct ReplayStats
+ * @brief Counters of a replay run, safe to update from any thread.
+ */
+struct ReplayStats {
+    /// Frames sent as captured, after their rooms were mapped.
+    std::atomic<uint64_t> sent{0};
+    /// Frames left out, see `ReplayClient`.
+    std::atomic<uint64_t> skipped{0};
+    /// Frames sent more than `LATE_AFTER` behind their schedule.
+    std::atomic<uint64_t> late{0};
+    /// Frames the server sent back, responses and events alike.
+    std::atomic<uint64_t> received{0};
+    /// `GenericError`s among them.
+    std::atomic<uint64_t> errors{0};
+    /// Connections that could not be set up or were lost.
+    std::atomic<uint64_t> connection_failures{0};
+
+    static constexpr std::chrono::milliseconds LATE_AFTER{100};
+
+    /// @brief Renders the totals and rates over `elapsed`.
+    std::string report(std::chrono::steady_clock::duration elapsed) const;
+};
+
+/**
+ * @class ReplaySession
+ * @brief A connection that logs into its own account, the common part of the replay's connections.
+ *
+ * @details Captures hold no logins, so every connection registers `<prefix>-<name>` (a rerun
+ * finds it registered and moves on) and authenticates with a fixed hash, like the load
+ * generator's clients. `onLoggedIn()` gets the rooms listed on login, chunks included.
+ *
+ * @note A session lives on one IO loop, all of its methods must be called there.
+ */
+class ReplaySession : public std::enable_shared_from_this<ReplaySession> {
+public:
+    virtual ~ReplaySession() = default;
+
+    /// @brief Connects and logs in.
+    void start();
+
+    /// @brief Closes the connection, `onClosed()` is not called.
+    void stop();
+
+protected:
+    ReplaySession(const std::string& name, const ReplayOptions& options, ReplayStats& stats, trantor::EventLoop* loop);
+
+    void send(const chat::Envelope& env);
+
+    virtual void onLoggedIn(const std::vector<chat::RoomInfo>& rooms) = 0;
+    /// @brief A frame the server sent after the login.
+    virtual void onFrame(const chat::Envelope& env) = 0;
+    /// @brief The session could not log in or lost its connection.
+    virtual void onClosed() = 0;
+
+    const ReplayOptions& m_options;
+    ReplayStats& m_stats;
+    trantor::EventLoop* m_loop;
+    bool m_stopped = false;
+
+private:
+    void onMessage(const std::string& bytes);
+    void sendAuth();
+    void fail();
+
+    std::string m_username;
+    std::string m_hash;
+    drogon::WebSocketClientPtr m_client;
+    drogon::WebSocketConnectionPtr m_conn;
+    bool m_logged_in = false;
+    std::vector<chat::RoomInfo> m_login_rooms;
+};
+
+/**
+ * @class RoomSetup
+ * @brief Finds or creates a room on the test node for every room the capture refers to.
+ *
+ * @details A captured room `n` is played by `<prefix>-room-<n>`, created when missing. The
+ * session subscribes to the room directory to learn the IDs of the rooms it creates, and
+ * calls `done` once every room is known.
+ */
+class RoomSetup : public ReplaySession {
+public:
+    RoomSetup(std::unordered_set<int32_t> captured, const ReplayOptions& options, ReplayStats& stats, trantor::EventLoop* loop,
+              std::function<void(RoomMap)> done);
+
+    /// @brief Hands over the rooms found so far, once. Called when the setup takes too long.
+    void finish();
+
+private:
+    void onLoggedIn(const std::vector<chat::RoomInfo>& rooms) override;
+    void onFrame(const chat::Envelope& env) override;
+    void onClosed() override { finish(); }
+
+    /// @brief Maps a listed room if it stands in for a captured one.
+    void add(const chat::RoomInfo& room);
+
+    std::unordered_set<int32_t> m_captured;
+    std::unordered_map<std::string, int32_t> m_by_name;
+    RoomMap m_rooms;
+    std::function<void(RoomMap)> m_done;
+};
+
+/**
+ * @class ReplayClient
+ * @brief Sends the frames of one captured connection at their captured times, scaled by `ReplayOptions::speed`.
+ *
+ * @details The client logs in `ReplayOptions::login_lead_seconds` ahead of its first frame, and
+ * closes where the captured connection closed. Frames due while it is still logging in are
+ * sent as soon as it is done, counted as late.
+ *
+ * Room IDs are rewritten through the `RoomMap` and roster versions are cleared. Frames that
+ * cannot mean the same on the test node are skipped: those naming an unmapped room, those
+ * naming users or messages, room deletions, which would take the replay's rooms away, and
+ * logouts, which would end the session the rest of the frames rely on.
+ */
+class ReplayClient : public ReplaySession {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    ReplayClient(uint64_t connection, std::vector<common::capture::Record> records, const ReplayOptions& options, ReplayStats& stats,
+                 trantor::EventLoop* loop);
+
+    /**
+     * @brief Logs in ahead of the first frame and replays the connection.
+     * @param origin When the first frame of the capture is replayed.
+     * @param first_us The capture time of that frame.
+     * @param done Called once the connection has played out or failed.
+     */
+    void play(Clock::time_point origin, uint64_t first_us, const RoomMap& rooms, std::function<void()> done);
+
+private:
+    void onLoggedIn(const std::vector<chat::RoomInfo>& rooms) override;
+    void onFrame(const chat::Envelope& env) override;
+    void onClosed() override { finish(); }
+
+    Clock::time_point due(const common::capture::Record& record) const;
+    void scheduleNext();
+    void sendDue();
+    void finish();
+
+    uint64_t m_connection;
+    std::vector<common::capture::Record> m_records;
+    size_t m_next = 0;
+    Clock::time_point m_origin;
+    uint64_t m_first_us = 0;
+    const RoomMap* m_rooms = nullptr;
+    std::function<void()> m_done;
+};
+
+/**
+ * @brief Rewrites the room IDs of a captured request for the test node.
+ * @return Whether the request is replayed, see `ReplayClient`.
+ */
+bool mapRequest(chat::Envelope& request, const RoomMap& rooms);
+
+/// @brief Adds the rooms a captured request refers to.
+void collectRooms(const chat::Envelope& request, std::unordered_set<int32_t>& rooms);
+
+} // namespace loadgen
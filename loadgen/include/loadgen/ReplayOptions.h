@@ -0,0 +1,40 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+/**
+ * @file ReplayOptions.h
+ * @brief Defines the command line options of the traffic replay.
+ */
+
+namespace loadgen {
+
+/**
+ * @struct ReplayOptions
+ * @brief Everything a replay run is configured with.
+ */
+struct ReplayOptions {
+    /// The capture recorded by a server, see `CaptureConfig`.
+    std::string capture;
+    /// The WebSocket endpoint of the test node.
+    std::string url = "ws://127.0.0.1:8849/ws";
+    /// How much faster than recorded the frames are sent, 1 keeps the captured pace.
+    double speed = 1.0;
+    /// The number of IO threads the connections are spread over.
+    size_t threads = 4;
+    /// Usernames are `<prefix>-<connection>`, rooms `<prefix>-room-<captured room id>`.
+    std::string prefix = "replay";
+    /// How long before its first frame a connection starts logging in, in captured time.
+    double login_lead_seconds = 2.0;
+    /// Set by `--help`, the usage was printed and the program exits successfully.
+    bool help = false;
+
+    /**
+     * @brief Parses `--key=value` arguments, printing the usage on error or `--help`.
+     * @return The options, or empty if the arguments are invalid.
+     */
+    static std::optional<ReplayOptions> fromArgs(int argc, char** argv);
+};
+
+} // namespace loadgen
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <drogon/WebSocketClient.h>
+#include <loadgen/LatencyStats.h>
+#include <loadgen/Options.h>
+#include <deque>
+#include <random>
+#include <vector>
+
+/**
+ * @file SimulatedClient.h
+ * @brief Defines one simulated chat user of the load generator.
+ */
+
+namespace loadgen {
+
+/**
+ * @class SimulatedClient
+ * @brief A chat user on its own connection, driven through a scripted session.
+ *
+ * @details After connecting, the client registers its account (a rerun finds it already
+ * registered and moves on), authenticates, and joins one of the first `Options::rooms`
+ * rooms the server lists, spread by client index. The first client creates the rooms
+ * that are missing. From then on it performs actions picked by `Options::mix` at
+ * exponentially spaced intervals averaging `Options::rate` per second: sending a
+ * message, typing for a moment, reading a page of history or moving to another room.
+ *
+ * Responses are matched to requests in order, which the server guarantees per connection.
+ * Every round trip is recorded in the shared `LatencyStats`, everything else the server
+ * pushes is counted as an event.
+ *
+ * @note A client lives on one IO loop, all of its methods must be called there.
+ */
+class SimulatedClient : public std::enable_shared_from_this<SimulatedClient> {
+public:
+    SimulatedClient(size_t index, const Options& options, LatencyStats& stats, trantor::EventLoop* loop);
+
+    /// @brief Connects and starts the session.
+    void start();
+
+    /// @brief Stops issuing actions and closes the connection.
+    void stop();
+
+private:
+    enum class State { Connecting, Registering, Authenticating, Joining, Running, Stopped };
+
+    struct PendingRequest {
+        Op op;
+        std::chrono::steady_clock::time_point sent;
+    };
+
+    void onMessage(const std::string& bytes);
+    void onResponse(Op op, const chat::Envelope& response, bool ok);
+
+    void send(Op op, const chat::Envelope& request);
+    void sendAuth();
+    void ensureRooms();
+    void joinRoom(int32_t room_id);
+
+    void scheduleAction();
+    void runAction();
+
+    size_t m_index;
+    const Options& m_options;
+    LatencyStats& m_stats;
+    trantor::EventLoop* m_loop;
+    std::string m_username;
+    std::string m_hash;
+
+    drogon::WebSocketClientPtr m_client;
+    drogon::WebSocketConnectionPtr m_conn;
+    State m_state = State::Connecting;
+    std::deque<PendingRequest> m_pending;
+
+    /// @brief The IDs of the rooms the server listed, in the order listed.
+    std::vector<int32_t> m_rooms;
+    bool m_typing = false;
+    std::minstd_rand m_rng;
+};
+
+} // namespace loadgen
@@ -0,0 +1,103 @@
+#include <loadgen/LatencyStats.h>
+#include <cmath>
+#include <cstdio>
+
+namespace loadgen {
+
+static const double LOG_GROWTH = std::log(1.01);
+
+const char* opName(Op op) noexcept {
+    switch(op) {
+        case Op::InitialRegister: return "InitialRegister";
+        case Op::Register: return "Register";
+        case Op::InitialAuth: return "InitialAuth";
+        case Op::Auth: return "Auth";
+        case Op::SubscribeRooms: return "SubscribeRooms";
+        case Op::CreateRoom: return "CreateRoom";
+        case Op::JoinRoom: return "JoinRoom";
+        case Op::SendMessage: return "SendMessage";
+        case Op::TypingStart: return "UserTypingStart";
+        case Op::TypingStop: return "UserTypingStop";
+        case Op::GetMessages: return "GetMessages";
+        case Op::Count: break;
+    }
+    return "Unknown";
+}
+
+void LatencyStats::record(Op op, std::chrono::steady_clock::duration latency, bool ok) noexcept {
+    auto& series = m_series[static_cast<size_t>(op)];
+    const auto us = static_cast<uint64_t>(std::max<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(latency).count(), 1));
+    const auto bucket = std::min(static_cast<size_t>(std::log(static_cast<double>(us)) / LOG_GROWTH), BUCKETS - 1);
+
+    series.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    series.count.fetch_add(1, std::memory_order_relaxed);
+    if(!ok) {
+        series.errors.fetch_add(1, std::memory_order_relaxed);
+    }
+    auto seen = series.max_us.load(std::memory_order_relaxed);
+    while(us > seen && !series.max_us.compare_exchange_weak(seen, us, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyStats::completed() const noexcept {
+    uint64_t total = 0;
+    for(const auto& series : m_series) {
+        total += series.count.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t LatencyStats::errors() const noexcept {
+    uint64_t total = 0;
+    for(const auto& series : m_series) {
+        total += series.errors.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+double LatencyStats::quantile(const Series& series, uint64_t count, double q) {
+    const auto rank = static_cast<uint64_t>(std::ceil(q * static_cast<double>(count)));
+    uint64_t seen = 0;
+    for(size_t i = 0; i < BUCKETS; ++i) {
+        seen += series.buckets[i].load(std::memory_order_relaxed);
+        if(seen >= rank) {
+            // The upper bound of the bucket, i.e. at most 1% above the true value.
+            return std::exp(static_cast<double>(i + 1) * LOG_GROWTH);
+        }
+    }
+    return static_cast<double>(series.max_us.load(std::memory_order_relaxed));
+}
+
+std::string LatencyStats::report(std::chrono::steady_clock::duration elapsed) const {
+    const double seconds = std::max(std::chrono::duration<double>(elapsed).count(), 1e-9);
+    std::string out;
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-16s %10s %8s %10s %10s %10s %10s %10s\n",
+                  "type", "count", "errors", "per sec", "p50 ms", "p99 ms", "p999 ms", "max ms");
+    out += line;
+    for(size_t i = 0; i < m_series.size(); ++i) {
+        const auto& series = m_series[i];
+        const auto count = series.count.load(std::memory_order_relaxed);
+        if(count == 0) {
+            continue;
+        }
+        std::snprintf(line, sizeof(line), "%-16s %10llu %8llu %10.1f %10.2f %10.2f %10.2f %10.2f\n",
+                      opName(static_cast<Op>(i)),
+                      static_cast<unsigned long long>(count),
+                      static_cast<unsigned long long>(series.errors.load(std::memory_order_relaxed)),
+                      static_cast<double>(count) / seconds,
+                      quantile(series, count, 0.5) / 1000,
+                      quantile(series, count, 0.99) / 1000,
+                      quantile(series, count, 0.999) / 1000,
+                      static_cast<double>(series.max_us.load(std::memory_order_relaxed)) / 1000);
+        out += line;
+    }
+    std::snprintf(line, sizeof(line), "sessions: %llu, pushed events: %llu (%.1f per sec), connection failures: %llu\n",
+                  static_cast<unsigned long long>(m_sessions.load(std::memory_order_relaxed)),
+                  static_cast<unsigned long long>(events()), static_cast<double>(events()) / seconds,
+                  static_cast<unsigned long long>(m_connection_failures.load(std::memory_order_relaxed)));
+    out += line;
+    return out;
+}
+
+} // namespace loadgen
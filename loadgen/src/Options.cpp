@@ -0,0 +1,116 @@
+#include <loadgen/Options.h>
+#include <charconv>
+#include <iostream>
+#include <string_view>
+
+namespace loadgen {
+
+static void printUsage(const char* program, std::ostream& out) {
+    const Options defaults;
+    out << "Usage: " << program << " [--key=value]...\n"
+        << "  --url=URL            WebSocket endpoint of the server (" << defaults.url << ")\n"
+        << "  --clients=N          simulated clients (" << defaults.clients << ")\n"
+        << "  --ramp-up=SECONDS    time over which clients connect (" << defaults.ramp_up.count() << ")\n"
+        << "  --duration=SECONDS   total run time, ramp-up included (" << defaults.duration.count() << ")\n"
+        << "  --rate=R             actions per second per client (" << defaults.rate << ")\n"
+        << "  --rooms=N            rooms the clients are spread over (" << defaults.rooms << ")\n"
+        << "  --threads=N          IO threads (" << defaults.threads << ")\n"
+        << "  --prefix=NAME        username prefix (" << defaults.prefix << ")\n"
+        << "  --message-bytes=N    length of sent messages (" << defaults.message_bytes << ")\n"
+        << "  --history-limit=N    page size of history requests (" << defaults.history_limit << ")\n"
+        << "  --mix=send:W,typing:W,history:W,join:W\n"
+        << "                       action weights (send:" << defaults.mix.send << ",typing:" << defaults.mix.typing
+        << ",history:" << defaults.mix.history << ",join:" << defaults.mix.join << ")\n";
+}
+
+template <typename T>
+static bool parseNumber(std::string_view text, T& out) {
+    const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), out);
+    return ec == std::errc{} && end == text.data() + text.size();
+}
+
+static bool parseMix(std::string_view text, ActionMix& mix) {
+    ActionMix parsed{0, 0, 0, 0};
+    while(!text.empty()) {
+        const auto comma = text.find(',');
+        const auto item = text.substr(0, comma);
+        text = comma == std::string_view::npos ? std::string_view{} : text.substr(comma + 1);
+
+        const auto colon = item.find(':');
+        if(colon == std::string_view::npos) {
+            return false;
+        }
+        const auto name = item.substr(0, colon);
+        unsigned* weight = name == "send" ? &parsed.send
+                         : name == "typing" ? &parsed.typing
+                         : name == "history" ? &parsed.history
+                         : name == "join" ? &parsed.join
+                         : nullptr;
+        if(!weight || !parseNumber(item.substr(colon + 1), *weight)) {
+            return false;
+        }
+    }
+    if(parsed.total() == 0) {
+        return false;
+    }
+    mix = parsed;
+    return true;
+}
+
+std::optional<Options> Options::fromArgs(int argc, char** argv) {
+    Options opts;
+    for(int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        const auto eq = arg.find('=');
+        const auto key = arg.substr(0, eq);
+        const auto value = eq == std::string_view::npos ? std::string_view{} : arg.substr(eq + 1);
+
+        int64_t seconds = 0;
+        bool ok = true;
+        if(key == "--help") {
+            printUsage(argv[0], std::cout);
+            opts.help = true;
+            return opts;
+        } else if(key == "--url") {
+            opts.url = value;
+        } else if(key == "--clients") {
+            ok = parseNumber(value, opts.clients);
+        } else if(key == "--ramp-up") {
+            ok = parseNumber(value, seconds);
+            opts.ramp_up = std::chrono::seconds{seconds};
+        } else if(key == "--duration") {
+            ok = parseNumber(value, seconds);
+            opts.duration = std::chrono::seconds{seconds};
+        } else if(key == "--rate") {
+            ok = parseNumber(value, opts.rate) && opts.rate > 0;
+        } else if(key == "--rooms") {
+            ok = parseNumber(value, opts.rooms) && opts.rooms > 0;
+        } else if(key == "--threads") {
+            ok = parseNumber(value, opts.threads) && opts.threads > 0;
+        } else if(key == "--prefix") {
+            opts.prefix = value;
+            ok = !opts.prefix.empty();
+        } else if(key == "--message-bytes") {
+            ok = parseNumber(value, opts.message_bytes) && opts.message_bytes > 0;
+        } else if(key == "--history-limit") {
+            ok = parseNumber(value, opts.history_limit);
+        } else if(key == "--mix") {
+            ok = parseMix(value, opts.mix);
+        } else {
+            ok = false;
+        }
+
+        if(!ok) {
+            std::cerr << "Invalid argument: " << arg << "\n";
+            printUsage(argv[0], std::cerr);
+            return std::nullopt;
+        }
+    }
+    if(opts.duration < opts.ramp_up) {
+        std::cerr << "--duration must not be shorter than --ramp-up\n";
+        return std::nullopt;
+    }
+    return opts;
+}
+
+} // namespace loadgen
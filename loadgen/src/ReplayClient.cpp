@@ -0,0 +1,379 @@
+#include <loadgen/ReplayClient.h>
+#include <common/utils/utils.h>
+#include <sstream>
+
+namespace loadgen {
+
+std::string ReplayStats::report(std::chrono::steady_clock::duration elapsed) const {
+    const double seconds = std::max(std::chrono::duration<double>(elapsed).count(), 1e-9);
+    const auto rate = [seconds](uint64_t count) { return static_cast<double>(count) / seconds; };
+    std::ostringstream out;
+    out << "sent=" << sent << " (" << rate(sent) << "/s)"
+        << " late=" << late
+        << " skipped=" << skipped
+        << " received=" << received << " (" << rate(received) << "/s)"
+        << " errors=" << errors
+        << " connection_failures=" << connection_failures << "\n";
+    return out.str();
+}
+
+ReplaySession::ReplaySession(const std::string& name, const ReplayOptions& options, ReplayStats& stats, trantor::EventLoop* loop)
+    : m_options(options)
+    , m_stats(stats)
+    , m_loop(loop)
+    , m_username(options.prefix + "-" + name)
+    // The server only compares the stored hash, so a fixed one per user stands in for argon2.
+    , m_hash("replay-hash-" + m_username) {
+}
+
+void ReplaySession::start() {
+    auto [server, path] = common::splitUrl(m_options.url);
+    m_client = drogon::WebSocketClient::newWebSocketClient(server, m_loop);
+    auto req = drogon::HttpRequest::newHttpRequest();
+    req->setPath(path);
+
+    std::weak_ptr<ReplaySession> weak = weak_from_this();
+    m_client->setMessageHandler([weak](const std::string& msg, const drogon::WebSocketClientPtr&, const drogon::WebSocketMessageType& type) {
+        if(auto self = weak.lock(); self && type == drogon::WebSocketMessageType::Binary) {
+            self->onMessage(msg);
+        }
+    });
+    m_client->setConnectionClosedHandler([weak](const drogon::WebSocketClientPtr&) {
+        if(auto self = weak.lock(); self && !self->m_stopped) {
+            self->fail();
+        }
+    });
+    m_client->connectToServer(req, [weak](drogon::ReqResult r, const drogon::HttpResponsePtr&, const drogon::WebSocketClientPtr& client) {
+        auto self = weak.lock();
+        if(!self || self->m_stopped) {
+            return;
+        }
+        if(r != drogon::ReqResult::Ok) {
+            self->fail();
+            return;
+        }
+        self->m_conn = client->getConnection();
+        chat::Envelope env;
+        env.mutable_initial_register_request()->set_username(self->m_username);
+        self->send(env);
+    });
+}
+
+void ReplaySession::stop() {
+    m_stopped = true;
+    if(m_conn) {
+        m_conn->forceClose();
+    }
+    if(m_client) {
+        m_client->stop();
+    }
+}
+
+void ReplaySession::fail() {
+    if(m_stopped) {
+        return;
+    }
+    m_stats.connection_failures.fetch_add(1, std::memory_order_relaxed);
+    stop();
+    onClosed();
+}
+
+void ReplaySession::send(const chat::Envelope& env) {
+    if(m_conn && m_conn->connected()) {
+        common::sendEnvelope(m_conn, env);
+    }
+}
+
+void ReplaySession::sendAuth() {
+    chat::Envelope env;
+    env.mutable_initial_auth_request()->set_username(m_username);
+    send(env);
+}
+
+void ReplaySession::onMessage(const std::string& bytes) {
+    chat::Envelope env;
+    if(m_stopped || !env.ParseFromString(bytes)) {
+        return;
+    }
+    if(m_logged_in) {
+        m_stats.received.fetch_add(1, std::memory_order_relaxed);
+        if(env.has_generic_error()) {
+            m_stats.errors.fetch_add(1, std::memory_order_relaxed);
+        }
+        onFrame(env);
+        return;
+    }
+
+    const auto ok = [](const auto& resp) { return resp.status().code() == chat::STATUS_SUCCESS; };
+    if(env.has_initial_register_response()) {
+        if(ok(env.initial_register_response())) {
+            chat::Envelope next;
+            next.mutable_register_request()->set_salt("replay");
+            next.mutable_register_request()->set_hash(m_hash);
+            send(next);
+        } else {
+            // Registered by an earlier run.
+            sendAuth();
+        }
+    } else if(env.has_register_response()) {
+        sendAuth();
+    } else if(env.has_initial_auth_response()) {
+        if(!ok(env.initial_auth_response())) {
+            fail();
+            return;
+        }
+        chat::Envelope next;
+        next.mutable_auth_request()->set_hash(m_hash);
+        send(next);
+    } else if(env.has_room_list_chunk()) {
+        const auto& rooms = env.room_list_chunk().rooms();
+        m_login_rooms.insert(m_login_rooms.end(), rooms.begin(), rooms.end());
+    } else if(env.has_auth_response()) {
+        if(!ok(env.auth_response())) {
+            fail();
+            return;
+        }
+        const auto& rooms = env.auth_response().rooms();
+        m_login_rooms.insert(m_login_rooms.end(), rooms.begin(), rooms.end());
+        m_logged_in = true;
+        onLoggedIn(std::exchange(m_login_rooms, {}));
+    } else if(env.has_generic_error()) {
+        fail();
+    }
+}
+
+static std::string roomName(const ReplayOptions& options, int32_t captured) {
+    return options.prefix + "-room-" + std::to_string(captured);
+}
+
+RoomSetup::RoomSetup(std::unordered_set<int32_t> captured, const ReplayOptions& options, ReplayStats& stats, trantor::EventLoop* loop,
+                     std::function<void(RoomMap)> done)
+    : ReplaySession("setup", options, stats, loop)
+    , m_captured(std::move(captured))
+    , m_done(std::move(done)) {
+    for(const auto id : m_captured) {
+        m_by_name.emplace(roomName(options, id), id);
+    }
+}
+
+void RoomSetup::finish() {
+    if(m_done) {
+        std::exchange(m_done, nullptr)(std::move(m_rooms));
+        stop();
+    }
+}
+
+void RoomSetup::add(const chat::RoomInfo& room) {
+    if(auto it = m_by_name.find(room.room_name()); it != m_by_name.end()) {
+        m_rooms.emplace(it->second, room.room_id());
+    }
+    if(m_rooms.size() == m_captured.size()) {
+        finish();
+    }
+}
+
+void RoomSetup::onLoggedIn(const std::vector<chat::RoomInfo>& rooms) {
+    for(const auto& room : rooms) {
+        add(room);
+    }
+    if(!m_done) {
+        return;
+    }
+    // The rooms created below are only announced to directory subscribers.
+    chat::Envelope subscribe;
+    subscribe.mutable_subscribe_rooms_request()->set_subscribe(true);
+    send(subscribe);
+    for(const auto id : m_captured) {
+        if(!m_rooms.contains(id)) {
+            chat::Envelope env;
+            env.mutable_create_room_request()->set_room_name(roomName(m_options, id));
+            send(env);
+        }
+    }
+}
+
+void RoomSetup::onFrame(const chat::Envelope& env) {
+    if(env.has_new_room_created()) {
+        add(env.new_room_created().room());
+    }
+}
+
+/// @brief Rewrites a room ID in place, false when the room has no stand-in.
+static bool mapRoom(int32_t room_id, const RoomMap& rooms, const std::function<void(int32_t)>& set) {
+    const auto it = rooms.find(room_id);
+    if(it == rooms.end()) {
+        return false;
+    }
+    set(it->second);
+    return true;
+}
+
+bool mapRequest(chat::Envelope& request, const RoomMap& rooms) {
+    switch(request.payload_case()) {
+        case chat::Envelope::kJoinRoomRequest: {
+            auto& req = *request.mutable_join_room_request();
+            // The roster the captured client held is not the test node's.
+            req.clear_presence_epoch();
+            req.clear_presence_seq();
+            return mapRoom(req.room_id(), rooms, [&](int32_t id) { req.set_room_id(id); });
+        }
+        case chat::Envelope::kRenameRoomRequest: {
+            auto& req = *request.mutable_rename_room_request();
+            return mapRoom(req.room_id(), rooms, [&](int32_t id) { req.set_room_id(id); });
+        }
+        case chat::Envelope::kSearchMessagesRequest: {
+            auto& req = *request.mutable_search_messages_request();
+            return req.room_id() == 0 || mapRoom(req.room_id(), rooms, [&](int32_t id) { req.set_room_id(id); });
+        }
+        case chat::Envelope::kSyncRoomRequest: {
+            auto& req = *request.mutable_sync_room_request();
+            return mapRoom(req.room_id(), rooms, [&](int32_t id) { req.set_room_id(id); });
+        }
+        case chat::Envelope::kMarkRoomReadRequest: {
+            auto& req = *request.mutable_mark_room_read_request();
+            return mapRoom(req.room_id(), rooms, [&](int32_t id) { req.set_room_id(id); });
+        }
+        case chat::Envelope::kBecomeMemberRequest: {
+            auto& req = *request.mutable_become_member_request();
+            return mapRoom(req.room_id(), rooms, [&](int32_t id) { req.set_room_id(id); });
+        }
+        case chat::Envelope::kGetRoomServerRequest: {
+            auto& req = *request.mutable_get_room_server_request();
+            return mapRoom(req.room_id(), rooms, [&](int32_t id) { req.set_room_id(id); });
+        }
+        case chat::Envelope::kBatchRequest: {
+            auto& requests = *request.mutable_batch_request()->mutable_requests();
+            google::protobuf::RepeatedPtrField<chat::Envelope> kept;
+            for(auto& nested : requests) {
+                if(mapRequest(nested, rooms)) {
+                    *kept.Add() = std::move(nested);
+                }
+            }
+            requests.Swap(&kept);
+            return !requests.empty();
+        }
+        case chat::Envelope::kDeleteRoomRequest:
+        case chat::Envelope::kAssignRoleRequest:
+        case chat::Envelope::kDeleteMessageRequest:
+        case chat::Envelope::kDeleteUserMessagesRequest:
+        case chat::Envelope::kGetMessagesAroundRequest:
+        case chat::Envelope::kLogoutRequest:
+            return false;
+        default:
+            return true;
+    }
+}
+
+void collectRooms(const chat::Envelope& request, std::unordered_set<int32_t>& rooms) {
+    switch(request.payload_case()) {
+        case chat::Envelope::kJoinRoomRequest: rooms.insert(request.join_room_request().room_id()); break;
+        case chat::Envelope::kRenameRoomRequest: rooms.insert(request.rename_room_request().room_id()); break;
+        case chat::Envelope::kSyncRoomRequest: rooms.insert(request.sync_room_request().room_id()); break;
+        case chat::Envelope::kMarkRoomReadRequest: rooms.insert(request.mark_room_read_request().room_id()); break;
+        case chat::Envelope::kBecomeMemberRequest: rooms.insert(request.become_member_request().room_id()); break;
+        case chat::Envelope::kGetRoomServerRequest: rooms.insert(request.get_room_server_request().room_id()); break;
+        case chat::Envelope::kSearchMessagesRequest:
+            if(request.search_messages_request().room_id() != 0) {
+                rooms.insert(request.search_messages_request().room_id());
+            }
+            break;
+        case chat::Envelope::kBatchRequest:
+            for(const auto& nested : request.batch_request().requests()) {
+                collectRooms(nested, rooms);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+ReplayClient::ReplayClient(uint64_t connection, std::vector<common::capture::Record> records, const ReplayOptions& options,
+                           ReplayStats& stats, trantor::EventLoop* loop)
+    : ReplaySession(std::to_string(connection), options, stats, loop)
+    , m_connection(connection)
+    , m_records(std::move(records)) {
+}
+
+ReplayClient::Clock::time_point ReplayClient::due(const common::capture::Record& record) const {
+    const double captured = static_cast<double>(record.time_us - std::min(record.time_us, m_first_us));
+    return m_origin + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::micro>(captured / m_options.speed));
+}
+
+void ReplayClient::play(Clock::time_point origin, uint64_t first_us, const RoomMap& rooms, std::function<void()> done) {
+    m_origin = origin;
+    m_first_us = first_us;
+    m_rooms = &rooms;
+    m_done = std::move(done);
+    if(m_records.empty()) {
+        finish();
+        return;
+    }
+    const auto lead = std::chrono::duration<double>(m_options.login_lead_seconds / m_options.speed);
+    const auto login_at = due(m_records.front()) - std::chrono::duration_cast<Clock::duration>(lead);
+    const auto delay = std::max(std::chrono::duration<double>(login_at - Clock::now()).count(), 0.0);
+    std::weak_ptr<ReplaySession> weak = weak_from_this();
+    m_loop->runAfter(delay, [weak] {
+        if(auto self = weak.lock()) {
+            self->start();
+        }
+    });
+}
+
+void ReplayClient::onLoggedIn(const std::vector<chat::RoomInfo>&) {
+    scheduleNext();
+}
+
+void ReplayClient::onFrame(const chat::Envelope&) {
+    // Responses and events are only counted, the frames go out on the captured schedule regardless.
+}
+
+void ReplayClient::scheduleNext() {
+    if(m_stopped) {
+        return;
+    }
+    if(m_next >= m_records.size()) {
+        // The capture ended before the connection closed.
+        finish();
+        return;
+    }
+    const auto delay = std::max(std::chrono::duration<double>(due(m_records[m_next]) - Clock::now()).count(), 0.0);
+    std::weak_ptr<ReplaySession> weak = weak_from_this();
+    m_loop->runAfter(delay, [weak] {
+        if(auto self = std::static_pointer_cast<ReplayClient>(weak.lock())) {
+            self->sendDue();
+        }
+    });
+}
+
+void ReplayClient::sendDue() {
+    const auto now = Clock::now();
+    while(!m_stopped && m_next < m_records.size() && due(m_records[m_next]) <= now) {
+        const auto& record = m_records[m_next++];
+        if(record.closed()) {
+            finish();
+            return;
+        }
+        chat::Envelope env;
+        if(!env.ParseFromString(record.frame) || !mapRequest(env, *m_rooms)) {
+            m_stats.skipped.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        if(now - due(record) > ReplayStats::LATE_AFTER) {
+            m_stats.late.fetch_add(1, std::memory_order_relaxed);
+        }
+        send(env);
+        m_stats.sent.fetch_add(1, std::memory_order_relaxed);
+    }
+    scheduleNext();
+}
+
+void ReplayClient::finish() {
+    if(!m_stopped) {
+        stop();
+    }
+    if(m_done) {
+        std::exchange(m_done, nullptr)();
+    }
+}
+
+} // namespace loadgen
@@ -0,0 +1,73 @@
+#include <loadgen/ReplayOptions.h>
+#include <charconv>
+#include <iostream>
+#include <string_view>
+
+namespace loadgen {
+
+static void printUsage(const char* program, std::ostream& out) {
+    const ReplayOptions defaults;
+    out << "Usage: " << program << " --capture=FILE [--key=value]...\n"
+        << "  --capture=FILE       traffic captured by a server\n"
+        << "  --url=URL            WebSocket endpoint of the test node (" << defaults.url << ")\n"
+        << "  --speed=X            replay speed, 1 is the captured pace (" << defaults.speed << ")\n"
+        << "  --threads=N          IO threads (" << defaults.threads << ")\n"
+        << "  --prefix=NAME        username and room name prefix (" << defaults.prefix << ")\n"
+        << "  --login-lead=SECONDS how early connections log in before their first frame ("
+        << defaults.login_lead_seconds << ")\n";
+}
+
+template <typename T>
+static bool parseNumber(std::string_view text, T& out) {
+    const auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), out);
+    return ec == std::errc{} && end == text.data() + text.size();
+}
+
+std::optional<ReplayOptions> ReplayOptions::fromArgs(int argc, char** argv) {
+    ReplayOptions opts;
+    for(int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        const auto eq = arg.find('=');
+        const auto key = arg.substr(0, eq);
+        const auto value = eq == std::string_view::npos ? std::string_view{} : arg.substr(eq + 1);
+
+        if(key == "--help") {
+            printUsage(argv[0], std::cout);
+            opts.help = true;
+            return opts;
+        }
+
+        bool ok = true;
+        if(key == "--capture") {
+            opts.capture = value;
+            ok = !opts.capture.empty();
+        } else if(key == "--url") {
+            opts.url = value;
+        } else if(key == "--speed") {
+            ok = parseNumber(value, opts.speed) && opts.speed > 0;
+        } else if(key == "--threads") {
+            ok = parseNumber(value, opts.threads) && opts.threads > 0;
+        } else if(key == "--prefix") {
+            opts.prefix = value;
+            ok = !opts.prefix.empty();
+        } else if(key == "--login-lead") {
+            ok = parseNumber(value, opts.login_lead_seconds) && opts.login_lead_seconds >= 0;
+        } else {
+            ok = false;
+        }
+
+        if(!ok) {
+            std::cerr << "Invalid argument: " << arg << "\n";
+            printUsage(argv[0], std::cerr);
+            return std::nullopt;
+        }
+    }
+    if(opts.capture.empty()) {
+        std::cerr << "--capture is required\n";
+        printUsage(argv[0], std::cerr);
+        return std::nullopt;
+    }
+    return opts;
+}
+
+} // namespace loadgen
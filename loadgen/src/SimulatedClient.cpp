@@ -0,0 +1,290 @@
+#include <loadgen/SimulatedClient.h>
+#include <common/utils/utils.h>
+#include <algorithm>
+
+namespace loadgen {
+
+/// @brief The envelope case that answers a request type.
+static chat::Envelope::PayloadCase responseCase(Op op) noexcept {
+    switch(op) {
+        case Op::InitialRegister: return chat::Envelope::kInitialRegisterResponse;
+        case Op::Register: return chat::Envelope::kRegisterResponse;
+        case Op::InitialAuth: return chat::Envelope::kInitialAuthResponse;
+        case Op::Auth: return chat::Envelope::kAuthResponse;
+        case Op::SubscribeRooms: return chat::Envelope::kSubscribeRoomsResponse;
+        case Op::CreateRoom: return chat::Envelope::kCreateRoomResponse;
+        case Op::JoinRoom: return chat::Envelope::kJoinRoomResponse;
+        case Op::SendMessage: return chat::Envelope::kSendMessageResponse;
+        case Op::TypingStart: return chat::Envelope::kUserTypingStartResponse;
+        case Op::TypingStop: return chat::Envelope::kUserTypingStopResponse;
+        case Op::GetMessages: return chat::Envelope::kGetMessagesResponse;
+        case Op::Count: break;
+    }
+    return chat::Envelope::PAYLOAD_NOT_SET;
+}
+
+/// @brief Whether a response reports success, a generic error never does.
+static bool succeeded(const chat::Envelope& env) noexcept {
+    const auto ok = [](const auto& resp) { return resp.status().code() == chat::STATUS_SUCCESS; };
+    switch(env.payload_case()) {
+        case chat::Envelope::kInitialRegisterResponse: return ok(env.initial_register_response());
+        case chat::Envelope::kRegisterResponse: return ok(env.register_response());
+        case chat::Envelope::kInitialAuthResponse: return ok(env.initial_auth_response());
+        case chat::Envelope::kAuthResponse: return ok(env.auth_response());
+        case chat::Envelope::kSubscribeRoomsResponse: return ok(env.subscribe_rooms_response());
+        case chat::Envelope::kCreateRoomResponse: return ok(env.create_room_response());
+        case chat::Envelope::kJoinRoomResponse: return ok(env.join_room_response());
+        case chat::Envelope::kSendMessageResponse: return ok(env.send_message_response());
+        case chat::Envelope::kUserTypingStartResponse: return ok(env.user_typing_start_response());
+        case chat::Envelope::kUserTypingStopResponse: return ok(env.user_typing_stop_response());
+        case chat::Envelope::kGetMessagesResponse: return ok(env.get_messages_response());
+        default: return false;
+    }
+}
+
+static std::string roomName(const Options& options, size_t i) {
+    return options.prefix + "-room-" + std::to_string(i);
+}
+
+SimulatedClient::SimulatedClient(size_t index, const Options& options, LatencyStats& stats, trantor::EventLoop* loop)
+    : m_index(index)
+    , m_options(options)
+    , m_stats(stats)
+    , m_loop(loop)
+    , m_username(options.prefix + "-" + std::to_string(index))
+    // The server only compares the stored hash, so a fixed one per user stands in for argon2.
+    , m_hash("loadgen-hash-" + m_username)
+    , m_rng(static_cast<std::minstd_rand::result_type>(index + 1)) {
+}
+
+void SimulatedClient::start() {
+    auto [server, path] = common::splitUrl(m_options.url);
+    m_client = drogon::WebSocketClient::newWebSocketClient(server, m_loop);
+    auto req = drogon::HttpRequest::newHttpRequest();
+    req->setPath(path);
+
+    std::weak_ptr<SimulatedClient> weak = weak_from_this();
+    m_client->setMessageHandler([weak](const std::string& msg, const drogon::WebSocketClientPtr&, const drogon::WebSocketMessageType& type) {
+        if(auto self = weak.lock(); self && type == drogon::WebSocketMessageType::Binary) {
+            self->onMessage(msg);
+        }
+    });
+    m_client->setConnectionClosedHandler([weak](const drogon::WebSocketClientPtr&) {
+        if(auto self = weak.lock(); self && self->m_state != State::Stopped) {
+            self->m_stats.recordConnectionFailure();
+            self->m_state = State::Stopped;
+        }
+    });
+    m_client->connectToServer(req, [weak](drogon::ReqResult r, const drogon::HttpResponsePtr&, const drogon::WebSocketClientPtr& client) {
+        auto self = weak.lock();
+        if(!self) {
+            return;
+        }
+        if(r != drogon::ReqResult::Ok) {
+            self->m_stats.recordConnectionFailure();
+            self->m_state = State::Stopped;
+            return;
+        }
+        self->m_conn = client->getConnection();
+        // The ServerHello arrives first, the session starts right away regardless.
+        self->m_state = State::Registering;
+        chat::Envelope env;
+        env.mutable_initial_register_request()->set_username(self->m_username);
+        self->send(Op::InitialRegister, env);
+    });
+}
+
+void SimulatedClient::stop() {
+    m_state = State::Stopped;
+    if(m_conn) {
+        m_conn->forceClose();
+    }
+    if(m_client) {
+        m_client->stop();
+    }
+}
+
+void SimulatedClient::send(Op op, const chat::Envelope& request) {
+    if(!m_conn || !m_conn->connected()) {
+        return;
+    }
+    m_pending.push_back(PendingRequest{op, std::chrono::steady_clock::now()});
+    common::sendEnvelope(m_conn, request);
+}
+
+void SimulatedClient::onMessage(const std::string& bytes) {
+    chat::Envelope env;
+    if(!env.ParseFromString(bytes)) {
+        return;
+    }
+    if(!m_pending.empty()) {
+        const auto expected = responseCase(m_pending.front().op);
+        if(env.payload_case() == expected || env.payload_case() == chat::Envelope::kGenericError) {
+            const auto request = m_pending.front();
+            m_pending.pop_front();
+            const bool ok = succeeded(env);
+            m_stats.record(request.op, std::chrono::steady_clock::now() - request.sent, ok);
+            onResponse(request.op, env, ok);
+            return;
+        }
+    }
+
+    if(env.has_new_room_created()) {
+        m_rooms.push_back(env.new_room_created().room().room_id());
+        if(m_state == State::Joining && m_pending.empty()) {
+            joinRoom(m_rooms[m_index % std::min(m_rooms.size(), m_options.rooms)]);
+        }
+    }
+    if(!env.has_server_hello()) {
+        m_stats.recordEvent();
+    }
+}
+
+void SimulatedClient::onResponse(Op op, const chat::Envelope& response, bool ok) {
+    if(m_state == State::Stopped) {
+        return;
+    }
+    switch(op) {
+        case Op::InitialRegister:
+            if(ok) {
+                chat::Envelope env;
+                env.mutable_register_request()->set_salt("loadgen");
+                env.mutable_register_request()->set_hash(m_hash);
+                send(Op::Register, env);
+            } else {
+                // Registered by an earlier run.
+                sendAuth();
+            }
+            break;
+        case Op::Register:
+            sendAuth();
+            break;
+        case Op::InitialAuth:
+            if(ok) {
+                chat::Envelope env;
+                env.mutable_auth_request()->set_hash(m_hash);
+                send(Op::Auth, env);
+            } else {
+                stop();
+            }
+            break;
+        case Op::Auth:
+            if(!ok) {
+                stop();
+                break;
+            }
+            m_state = State::Joining;
+            for(const auto& room : response.auth_response().rooms()) {
+                m_rooms.push_back(room.room_id());
+            }
+            if(m_index != 0 && m_rooms.empty()) {
+                // The rooms are still to be created, only directory subscribers hear about them.
+                chat::Envelope env;
+                env.mutable_subscribe_rooms_request()->set_subscribe(true);
+                send(Op::SubscribeRooms, env);
+            }
+            ensureRooms();
+            break;
+        case Op::JoinRoom:
+            if(m_state == State::Joining) {
+                if(!ok) {
+                    stop();
+                    break;
+                }
+                m_state = State::Running;
+                m_stats.recordSession();
+                scheduleAction();
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void SimulatedClient::sendAuth() {
+    m_state = State::Authenticating;
+    chat::Envelope env;
+    env.mutable_initial_auth_request()->set_username(m_username);
+    send(Op::InitialAuth, env);
+}
+
+void SimulatedClient::ensureRooms() {
+    if(m_index == 0) {
+        for(size_t i = m_rooms.size(); i < m_options.rooms; ++i) {
+            chat::Envelope env;
+            env.mutable_create_room_request()->set_room_name(roomName(m_options, i));
+            send(Op::CreateRoom, env);
+        }
+    }
+    // Otherwise the join waits for the first NewRoomCreated.
+    if(!m_rooms.empty()) {
+        joinRoom(m_rooms[m_index % std::min(m_rooms.size(), m_options.rooms)]);
+    }
+}
+
+void SimulatedClient::joinRoom(int32_t room_id) {
+    chat::Envelope env;
+    env.mutable_join_room_request()->set_room_id(room_id);
+    send(Op::JoinRoom, env);
+}
+
+void SimulatedClient::scheduleAction() {
+    std::exponential_distribution<double> gap(m_options.rate);
+    std::weak_ptr<SimulatedClient> weak = weak_from_this();
+    m_loop->runAfter(gap(m_rng), [weak] {
+        if(auto self = weak.lock(); self && self->m_state == State::Running) {
+            self->runAction();
+            self->scheduleAction();
+        }
+    });
+}
+
+void SimulatedClient::runAction() {
+    const auto& mix = m_options.mix;
+    auto pick = std::uniform_int_distribution<unsigned>(0, mix.total() - 1)(m_rng);
+    chat::Envelope env;
+
+    if(pick < mix.send) {
+        std::string text(m_options.message_bytes, 'x');
+        const auto tag = m_username + " ";
+        std::copy_n(tag.begin(), std::min(tag.size(), text.size()), text.begin());
+        env.mutable_send_message_request()->set_message(std::move(text));
+        send(Op::SendMessage, env);
+        return;
+    }
+    pick -= mix.send;
+
+    if(pick < mix.typing) {
+        if(m_typing) {
+            return;
+        }
+        m_typing = true;
+        env.mutable_user_typing_start_request();
+        send(Op::TypingStart, env);
+        std::weak_ptr<SimulatedClient> weak = weak_from_this();
+        m_loop->runAfter(1.5, [weak] {
+            if(auto self = weak.lock(); self && self->m_state == State::Running) {
+                self->m_typing = false;
+                chat::Envelope stop;
+                stop.mutable_user_typing_stop_request();
+                self->send(Op::TypingStop, stop);
+            }
+        });
+        return;
+    }
+    pick -= mix.typing;
+
+    if(pick < mix.history) {
+        env.mutable_get_messages_request()->set_limit(m_options.history_limit);
+        env.mutable_get_messages_request()->set_offset_ts(std::numeric_limits<int64_t>::max());
+        send(Op::GetMessages, env);
+        return;
+    }
+
+    const auto rooms = std::min(m_rooms.size(), m_options.rooms);
+    if(rooms > 0) {
+        joinRoom(m_rooms[std::uniform_int_distribution<size_t>(0, rooms - 1)(m_rng)]);
+    }
+}
+
+} // namespace loadgen
@@ -0,0 +1,61 @@
+#include <drogon/drogon.h>
+#include <loadgen/Options.h>
+#include <loadgen/LatencyStats.h>
+#include <loadgen/SimulatedClient.h>
+#include <iostream>
+
+int main(int argc, char** argv) {
+    auto parsed = loadgen::Options::fromArgs(argc, argv);
+    if(!parsed) {
+        return 1;
+    }
+    if(parsed->help) {
+        return 0;
+    }
+    const auto options = *parsed;
+    loadgen::LatencyStats stats;
+    std::vector<std::shared_ptr<loadgen::SimulatedClient>> clients;
+    clients.reserve(options.clients);
+
+    drogon::app().setLogLevel(trantor::Logger::kWarn);
+    drogon::app().setThreadNum(options.threads);
+
+    const auto started = std::chrono::steady_clock::now();
+    drogon::app().registerBeginningAdvice([&] {
+        auto* main_loop = drogon::app().getLoop();
+        const double ramp = std::chrono::duration<double>(options.ramp_up).count();
+        for(size_t i = 0; i < options.clients; ++i) {
+            auto* loop = drogon::app().getIOLoop(i % options.threads);
+            auto client = std::make_shared<loadgen::SimulatedClient>(i, options, stats, loop);
+            clients.push_back(client);
+            // The first client goes alone, so the rooms it creates exist before the others join.
+            const double delay = options.clients > 1 ? ramp * static_cast<double>(i) / static_cast<double>(options.clients) : 0;
+            loop->runAfter(delay, [client] { client->start(); });
+        }
+
+        main_loop->runEvery(1.0, [&, last_completed = uint64_t{0}, last_events = uint64_t{0}]() mutable {
+            const auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - started);
+            const auto completed = stats.completed();
+            const auto events = stats.events();
+            std::cout << "t=" << elapsed.count() << "s"
+                      << " requests/s=" << completed - last_completed
+                      << " events/s=" << events - last_events
+                      << " errors=" << stats.errors() << std::endl;
+            last_completed = completed;
+            last_events = events;
+        });
+
+        main_loop->runAfter(std::chrono::duration<double>(options.duration).count(), [&] {
+            for(size_t i = 0; i < clients.size(); ++i) {
+                // Clients are confined to their loops, so is stopping them.
+                drogon::app().getIOLoop(i % options.threads)->runInLoop([client = clients[i]] { client->stop(); });
+            }
+            std::cout << "\n" << options.clients << " client(s) against " << options.url << "\n"
+                      << stats.report(std::chrono::steady_clock::now() - started) << std::flush;
+            drogon::app().getLoop()->runAfter(0.5, [] { drogon::app().quit(); });
+        });
+    });
+
+    drogon::app().run();
+    return 0;
+}
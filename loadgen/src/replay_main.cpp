@@ -0,0 +1,120 @@
+#include <drogon/drogon.h>
+#include <loadgen/ReplayClient.h>
+#include <loadgen/ReplayOptions.h>
+#include <algorithm>
+#include <iostream>
+#include <map>
+
+/// How long the rooms may take to be set up before the replay starts with the ones found.
+static constexpr double ROOM_SETUP_TIMEOUT_SECONDS = 30;
+
+int main(int argc, char** argv) {
+    auto parsed = loadgen::ReplayOptions::fromArgs(argc, argv);
+    if(!parsed) {
+        return 1;
+    }
+    if(parsed->help) {
+        return 0;
+    }
+    const auto options = *parsed;
+
+    std::string error;
+    auto records = common::capture::readFile(options.capture, error);
+    if(!records) {
+        std::cerr << "Cannot read the capture: " << error << "\n";
+        return 1;
+    }
+    if(records->empty()) {
+        std::cerr << "The capture is empty\n";
+        return 1;
+    }
+    // Records are only roughly in order across connections, see capture.h.
+    std::stable_sort(records->begin(), records->end(), [](const auto& a, const auto& b) { return a.time_us < b.time_us; });
+    const auto first_us = records->front().time_us;
+    const auto captured = std::chrono::microseconds{records->back().time_us - first_us};
+
+    std::unordered_set<int32_t> rooms;
+    std::map<uint64_t, std::vector<common::capture::Record>> connections;
+    for(auto& record : *records) {
+        if(!record.closed()) {
+            chat::Envelope env;
+            if(env.ParseFromString(record.frame)) {
+                loadgen::collectRooms(env, rooms);
+            }
+        }
+        connections[record.connection].push_back(std::move(record));
+    }
+    records.reset();
+    std::cout << connections.size() << " connection(s) and " << rooms.size() << " room(s) over "
+              << std::chrono::duration<double>(captured).count() << " s of traffic, replayed at " << options.speed << "x\n";
+
+    loadgen::ReplayStats stats;
+    loadgen::RoomMap room_map;
+    std::vector<std::shared_ptr<loadgen::ReplayClient>> clients;
+    std::shared_ptr<loadgen::RoomSetup> setup;
+    size_t remaining = connections.size();
+    std::chrono::steady_clock::time_point started;
+
+    drogon::app().setLogLevel(trantor::Logger::kWarn);
+    drogon::app().setThreadNum(options.threads);
+
+    // Runs on the main loop once the rooms are known.
+    const auto replay = [&](loadgen::RoomMap mapped) {
+        room_map = std::move(mapped);
+        if(room_map.size() < rooms.size()) {
+            std::cerr << "Only " << room_map.size() << " of " << rooms.size() << " room(s) are set up, frames for the others are skipped\n";
+        }
+        auto* main_loop = drogon::app().getLoop();
+        started = std::chrono::steady_clock::now();
+        // Everyone logs in ahead of the first frame, so the replay starts one login lead from now.
+        const auto origin = started + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(options.login_lead_seconds / options.speed));
+        size_t i = 0;
+        for(auto& [connection, frames] : connections) {
+            auto* loop = drogon::app().getIOLoop(i++ % options.threads);
+            auto client = std::make_shared<loadgen::ReplayClient>(connection, std::move(frames), options, stats, loop);
+            clients.push_back(client);
+            loop->runInLoop([&, client, origin, main_loop] {
+                client->play(origin, first_us, room_map, [&, main_loop] {
+                    main_loop->queueInLoop([&] {
+                        if(--remaining == 0) {
+                            std::cout << "\n" << clients.size() << " connection(s) replayed against " << options.url << "\n"
+                                      << stats.report(std::chrono::steady_clock::now() - started) << std::flush;
+                            drogon::app().getLoop()->runAfter(0.5, [] { drogon::app().quit(); });
+                        }
+                    });
+                });
+            });
+        }
+
+        main_loop->runEvery(1.0, [&, last_sent = uint64_t{0}, last_received = uint64_t{0}]() mutable {
+            const auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - started);
+            const auto sent = stats.sent.load();
+            const auto received = stats.received.load();
+            std::cout << "t=" << elapsed.count() << "s"
+                      << " sent/s=" << sent - last_sent
+                      << " received/s=" << received - last_received
+                      << " late=" << stats.late.load()
+                      << " errors=" << stats.errors.load() << std::endl;
+            last_sent = sent;
+            last_received = received;
+        });
+    };
+
+    drogon::app().registerBeginningAdvice([&] {
+        auto* main_loop = drogon::app().getLoop();
+        if(rooms.empty()) {
+            replay({});
+            return;
+        }
+        auto* loop = drogon::app().getIOLoop(0);
+        setup = std::make_shared<loadgen::RoomSetup>(rooms, options, stats, loop, [&, main_loop](loadgen::RoomMap mapped) {
+            main_loop->queueInLoop([&, mapped = std::move(mapped)]() mutable { replay(std::move(mapped)); });
+        });
+        loop->runInLoop([&] { setup->start(); });
+        loop->runAfter(ROOM_SETUP_TIMEOUT_SECONDS, [&] { setup->finish(); });
+    });
+
+    drogon::app().run();
+    return 0;
+}
@@ -0,0 +1,10 @@
+-- Deleted messages, so clients syncing a room learn about deletions they were not online for.
+CREATE TABLE IF NOT EXISTS message_tombstones (
+    message_id INTEGER PRIMARY KEY,
+    room_id INTEGER NOT NULL REFERENCES rooms(room_id) ON DELETE CASCADE,
+    deleted_at BIGINT NOT NULL DEFAULT (EXTRACT(EPOCH FROM NOW()) * 1000000)::bigint
+);
+
+-- SyncRoom reads the tombstones of one room after a cursor.
+CREATE INDEX IF NOT EXISTS idx_message_tombstones_room_time
+ON message_tombstones (room_id, deleted_at);
@@ -0,0 +1,37 @@
+-- Range partitions of messages by created_at, one per month, see MessagePartitions.
+-- Retention then detaches whole partitions instead of deleting rows, and history pages
+-- only touch the partitions of the times they ask for.
+
+-- The existing table becomes the first partition as it is, its rows are not copied.
+-- Its index names are taken over by the partitioned table.
+ALTER TABLE messages RENAME TO messages_unpartitioned;
+
+ALTER TABLE messages_unpartitioned RENAME CONSTRAINT messages_pkey TO messages_unpartitioned_pkey;
+
+ALTER INDEX idx_messages_room_id_desc_time RENAME TO messages_unpartitioned_room_id_created_at_idx;
+
+-- Range partitions do not take rows without a key.
+UPDATE messages_unpartitioned SET created_at = 0 WHERE created_at IS NULL;
+
+ALTER TABLE messages_unpartitioned ALTER COLUMN created_at SET NOT NULL;
+
+-- The primary key of a partitioned table has to include the partition key. Message ids
+-- still come from the one sequence, so they stay unique across partitions.
+CREATE TABLE messages (
+    message_id INTEGER NOT NULL DEFAULT nextval('messages_message_id_seq'),
+    room_id INTEGER NOT NULL REFERENCES rooms(room_id) ON DELETE CASCADE,
+    user_id INTEGER NOT NULL REFERENCES users(user_id) ON DELETE CASCADE,
+    message_text TEXT NOT NULL,
+    created_at BIGINT NOT NULL DEFAULT (EXTRACT(EPOCH FROM NOW()) * 1000000)::bigint,
+    PRIMARY KEY (message_id, created_at)
+) PARTITION BY RANGE (created_at);
+
+-- Keeps pg_get_serial_sequence('messages', 'message_id') working for MessageIdAllocator.
+ALTER SEQUENCE messages_message_id_seq OWNED BY messages.message_id;
+
+CREATE INDEX idx_messages_room_id_desc_time ON messages (room_id, created_at DESC);
+
+-- Everything up to the end of the current month (UTC), the server creates the monthly
+-- partitions from there on. Attaching scans the table once to validate the bound.
+ALTER TABLE messages ATTACH PARTITION messages_unpartitioned
+FOR VALUES FROM (MINVALUE) TO ((EXTRACT(EPOCH FROM date_trunc('month', NOW() AT TIME ZONE 'UTC') + INTERVAL '1 month') * 1000000)::bigint);
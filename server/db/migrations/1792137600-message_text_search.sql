@@ -0,0 +1,5 @@
+-- Full-text search of messages for SearchMessages. An expression index rather than a stored
+-- tsvector column, so existing partitions are not rewritten. The 'simple' configuration
+-- does no stemming, chat is written in every language.
+CREATE INDEX IF NOT EXISTS idx_messages_text_search
+ON messages USING GIN (to_tsvector('simple', message_text));
@@ -0,0 +1,3 @@
+-- Deleted messages keep their row, marked with the time of the deletion. Reads skip them.
+-- Nullable without a default, so adding it does not rewrite the partitions.
+ALTER TABLE messages ADD COLUMN IF NOT EXISTS deleted_at BIGINT;
@@ -0,0 +1,37 @@
+-- Numbers the messages of each room, see MessageInfo.seq. rooms.last_seq is the last
+-- number taken, the trigger below takes the next one for every message inserted without.
+ALTER TABLE rooms ADD COLUMN IF NOT EXISTS last_seq BIGINT NOT NULL DEFAULT 0;
+
+-- Nullable without a default, so adding it does not rewrite the partitions.
+ALTER TABLE messages ADD COLUMN IF NOT EXISTS seq BIGINT;
+
+-- The existing messages are numbered in timestamp order. The partition key is matched too,
+-- so each row is updated through its own partition.
+UPDATE messages m SET seq = numbered.seq
+FROM (
+    SELECT message_id, created_at, ROW_NUMBER() OVER (PARTITION BY room_id ORDER BY created_at, message_id) AS seq
+    FROM messages
+) numbered
+WHERE m.message_id = numbered.message_id AND m.created_at = numbered.created_at;
+
+UPDATE rooms r SET last_seq = COALESCE((SELECT MAX(m.seq) FROM messages m WHERE m.room_id = r.room_id), 0);
+
+-- Taking a number locks the room's row until the inserting transaction ends, so the
+-- messages of a room commit in seq order and a reader never sees seq n + 1 before n.
+-- Messages inserted with a seq reserved in advance keep it.
+CREATE OR REPLACE FUNCTION messages_assign_seq() RETURNS trigger AS $$
+BEGIN
+    IF NEW.seq IS NULL THEN
+        UPDATE rooms SET last_seq = last_seq + 1 WHERE room_id = NEW.room_id RETURNING last_seq INTO NEW.seq;
+    END IF;
+    RETURN NEW;
+END;
+$$ LANGUAGE plpgsql;
+
+DROP TRIGGER IF EXISTS messages_assign_seq ON messages;
+
+CREATE TRIGGER messages_assign_seq BEFORE INSERT ON messages
+FOR EACH ROW EXECUTE FUNCTION messages_assign_seq();
+
+-- History pages and syncs by seq.
+CREATE INDEX IF NOT EXISTS idx_messages_room_seq ON messages (room_id, seq);
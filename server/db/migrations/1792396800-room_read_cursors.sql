@@ -0,0 +1,15 @@
+-- The newest message each user has read per room. The unread count of a room is its
+-- last_seq minus that, so sending a message updates every member's count for free.
+CREATE TABLE IF NOT EXISTS room_read_cursors (
+    user_id INTEGER NOT NULL REFERENCES users(user_id) ON DELETE CASCADE,
+    room_id INTEGER NOT NULL REFERENCES rooms(room_id) ON DELETE CASCADE,
+    last_read_seq BIGINT NOT NULL DEFAULT 0,
+    PRIMARY KEY (user_id, room_id)
+);
+
+-- Members start with everything read, rather than with the whole history unread.
+INSERT INTO room_read_cursors (user_id, room_id, last_read_seq)
+SELECT rm.user_id, rm.room_id, r.last_seq
+FROM room_membership rm JOIN rooms r ON r.room_id = rm.room_id
+WHERE rm.membership_status = 'JOINED'
+ON CONFLICT (user_id, room_id) DO NOTHING;
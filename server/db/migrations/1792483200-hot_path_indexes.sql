@@ -0,0 +1,12 @@
+-- The primary keys of the membership tables lead with user_id, so everything looking a room's
+-- members up (the roster of a join, the member list and count, the room directory) and the
+-- cascades of a room deletion read the whole table. These lead with room_id instead.
+CREATE INDEX IF NOT EXISTS idx_room_membership_room_status ON room_membership (room_id, membership_status);
+
+CREATE INDEX IF NOT EXISTS idx_user_room_data_room ON user_room_data (room_id);
+
+CREATE INDEX IF NOT EXISTS idx_room_read_cursors_room ON room_read_cursors (room_id);
+
+-- The newest live messages of a user in a room, deleted in bulk by a moderator. Without it
+-- the room's whole history is walked on idx_messages_room_id_desc_time to filter the user's.
+CREATE INDEX IF NOT EXISTS idx_messages_room_user_time ON messages (room_id, user_id, created_at DESC) WHERE deleted_at IS NULL;
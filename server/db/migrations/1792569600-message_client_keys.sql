@@ -0,0 +1,14 @@
+-- The client keys of recently sent messages, claimed before the message is inserted so a
+-- retry arriving on any server finds the original. A unique index on messages itself would
+-- have to include the partition key, which a retry does not know. Rows past the dedupe
+-- window are purged by the servers.
+CREATE TABLE IF NOT EXISTS message_client_keys (
+    user_id INTEGER NOT NULL REFERENCES users(user_id) ON DELETE CASCADE,
+    client_key TEXT NOT NULL,
+    message_id INTEGER NOT NULL,
+    created_at BIGINT NOT NULL,
+    seq BIGINT NOT NULL,
+    PRIMARY KEY (user_id, client_key)
+);
+
+CREATE INDEX IF NOT EXISTS idx_message_client_keys_created ON message_client_keys (created_at);
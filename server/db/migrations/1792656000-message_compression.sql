@@ -0,0 +1,15 @@
+-- Message bodies compressed with zstd, see MessageCompression. A compressed row keeps its body
+-- in message_body, compressed with the dictionary of dictionary_id, and has message_text NULL,
+-- so full-text search only sees the rows still stored as text. The dictionaries are never
+-- deleted while a row refers to them.
+CREATE TABLE IF NOT EXISTS message_dictionaries (
+    dictionary_id SERIAL PRIMARY KEY,
+    dictionary BYTEA NOT NULL,
+    created_at BIGINT NOT NULL DEFAULT (EXTRACT(EPOCH FROM NOW()) * 1000000)::bigint
+);
+
+ALTER TABLE messages ADD COLUMN IF NOT EXISTS message_body BYTEA;
+
+ALTER TABLE messages ADD COLUMN IF NOT EXISTS dictionary_id INTEGER REFERENCES message_dictionaries(dictionary_id);
+
+ALTER TABLE messages ALTER COLUMN message_text DROP NOT NULL;
@@ -0,0 +1,27 @@
+-- The seqs reserved for messages broadcast before they are inserted, see Repository::reserveMessageSeq.
+-- Such a message may commit after one with a higher seq, or never. A sync does not move its cursor
+-- past the lowest seq still reserved, so a message committing late is not skipped. The insert of
+-- the message removes the row in its transaction, a failed one removes it through
+-- Repository::releaseMessageSeq. The row of a server that crashed in between is ignored once it is
+-- older than the reservation timeout.
+CREATE TABLE IF NOT EXISTS reserved_message_seqs (
+    room_id INTEGER NOT NULL,
+    seq BIGINT NOT NULL,
+    reserved_at TIMESTAMPTZ NOT NULL DEFAULT now(),
+    PRIMARY KEY (room_id, seq)
+);
+
+-- Taking a number locks the room's row until the inserting transaction ends, so the
+-- messages of a room commit in seq order and a reader never sees seq n + 1 before n.
+-- A message inserted with a reserved seq keeps it and settles its reservation. While the
+-- insert is in progress it holds the reservation's row, so a release waits for its outcome.
+CREATE OR REPLACE FUNCTION messages_assign_seq() RETURNS trigger AS $$
+BEGIN
+    IF NEW.seq IS NULL THEN
+        UPDATE rooms SET last_seq = last_seq + 1 WHERE room_id = NEW.room_id RETURNING last_seq INTO NEW.seq;
+    ELSE
+        DELETE FROM reserved_message_seqs WHERE room_id = NEW.room_id AND seq = NEW.seq;
+    END IF;
+    RETURN NEW;
+END;
+$$ LANGUAGE plpgsql;
@@ -0,0 +1,6 @@
+-- A message that takes its identity from the insert claims its key before it has one. The key
+-- holds no message until MessageKeys::settle records the identity once the insert committed.
+-- A claim whose message is not stored by then is taken over by a retry, see MessageKeys::claim.
+ALTER TABLE message_client_keys ALTER COLUMN message_id DROP NOT NULL;
+
+ALTER TABLE message_client_keys ALTER COLUMN seq DROP NOT NULL;
@@ -1,5 +1,9 @@
 #pragma once
 #include <string>
+#include <mutex>
+#include <chrono>
+#include <random>
+#include <vector>
 #include <drogon/WebSocketClient.h>
 #include <common/utils/utils.h>
 
@@ -20,79 +24,170 @@ namespace server {
  * the aggregator by sending its publicly accessible host address. This allows
  * the aggregator to maintain a list of active server nodes.
  *
- * The implementation includes basic connection logic and handlers for the
- * connection lifecycle events, such as a successful connection or a closure.
+ * The same link carries the cluster bus: the server subscribes to the rooms it has
+ * local members in, publishes room events for the other servers, and hands the
+ * events published by them to `ClusterRoomService::deliverRemote()`. Subscriptions
+ * are remembered, so they are sent again whenever the link is (re)established.
+ *
+ * It also reports how many local connections each room has, which the aggregator uses
+ * to keep routing a room's members to the server that already holds most of them,
+ * and periodically sends the server's overall load, so new clients are steered toward
+ * the servers with the most spare capacity.
+ *
+ * The aggregator also keeps the global room directory clients page through, fed by the
+ * servers: room creations, renames, deletions and new members are sent as they happen,
+ * and the full directory is loaded from the database and sent whenever the aggregator
+ * asks for it on registration, or when changes were lost while the link was down.
+ *
+ * A lost link is re-established with jittered exponential backoff, see
+ * `cluster.reconnect_min_ms` and `cluster.reconnect_max_ms`. The periodic load report
+ * doubles as the heartbeat the aggregator uses to evict servers that went silent.
+ *
+ * The address may list several aggregators sharing their registrations, separated by
+ * commas. The server registers to one of them, picked at random, and moves on to the
+ * next one whenever the link is lost or cannot be established.
  *
  * @note The aggregator address is typically provided via an environment
  * variable. If the address is empty, the client will not attempt to connect.
+ *
+ * @note This class is implemented as a singleton, accessible via the `instance()`
+ * static method. All public methods are thread-safe.
  */
 class WsClient {
 public:
+    /**
+     * @brief Gets the singleton instance of the WsClient.
+     * @return A reference to the single WsClient instance.
+     */
+    static WsClient& instance();
+
     /**
      * @brief Initiates the WebSocket connection to the aggregator service.
      *
      * @details This method parses the provided address, creates a new Drogon
      * WebSocket client, and attempts to connect. If the connection is
      * successful, it sends a `RegisterServerRequest` message containing this
-     * server's own publicly accessible address. It also sets up placeholder
-     * handlers for incoming messages and connection closure events.
+     * server's own publicly accessible address, followed by the current room
+     * subscriptions.
      *
      * If the provided address is empty, the connection attempt is skipped, and a
      * trace log is generated.
      *
      * @param address The full WebSocket URL of the aggregator service
-     *                (e.g., "ws://aggregator:8080/register").
+     *                (e.g., "ws://aggregator:8080/register"), or several separated by commas.
+     */
+    void start(const std::string& address);
+
+    /// @brief Whether this server is part of a cluster, i.e. `start()` was given an address.
+    bool clustered() const;
+
+    /// @brief Asks the aggregator for the events of a room published by the other servers.
+    void subscribe(int32_t room_id);
+
+    /// @brief Stops receiving the events of a room.
+    void unsubscribe(int32_t room_id);
+
+    /**
+     * @brief Publishes an encoded envelope to the other servers.
+     * @param room_id The room whose subscribers receive it, or empty for every server.
+     * @param bytes The envelope, as produced by `common::serializeEnvelope`.
+     * @param audience_room_ids For a global event, the rooms it is meant for, see `ClusterPublish`.
+     * @note Dropped while the link is down, the other servers miss it.
+     */
+    void publish(std::optional<int32_t> room_id, const common::SerializedEnvelope& bytes,
+                 const std::vector<int32_t>& audience_room_ids = {});
+
+    /**
+     * @brief Records the number of local connections in a room for the next load report.
+     * @details Changes are coalesced for `cluster.load_report_interval`, only the latest count of a room is sent.
+     */
+    void reportRoomLoad(int32_t room_id, uint32_t connections);
+
+    /// @brief Sends a server load report now rather than at the next tick, e.g. once the server turned ready.
+    void reportLoad();
+
+    /**
+     * @brief Tells the aggregator this server is draining and asks for the other servers.
+     * @param on_servers Called with the ranked servers once the aggregator answers, from the link's
+     *        thread. Right away with none when not clustered, never if the link is down.
+     */
+    void drain(std::function<void(std::vector<chat::ServerNodeInfo>)> on_servers);
+
+    /**
+     * @brief Closes the link to the aggregator for good, for a process handing its host over to its successor.
+     * @details The successor registers the same host, a reconnect from this process would take it back.
      */
-    void start(const std::string& address) {
-        if(address.empty()) {
-            LOG_INFO << "Not starting connection to aggregator";
-            return;
-        }
-
-        LOG_INFO << "Starting connection to aggregator: " << address;
-        // TODO: Replace with ada-url parser
-        auto [server, path] = common::splitUrl(address);
-
-        client = drogon::WebSocketClient::newWebSocketClient(server);
-        auto req = drogon::HttpRequest::newHttpRequest();
-        req->setPath(path);
-
-        // TODO: Implement message handling logic from the aggregator.
-        client->setMessageHandler([this](const std::string&,
-                                          const drogon::WebSocketClientPtr&,
-                                          const drogon::WebSocketMessageType&) {
-        });
-
-        // TODO: Implement reconnection logic or other cleanup.
-        client->setConnectionClosedHandler([this](const drogon::WebSocketClientPtr&) {
-        });
-
-        LOG_INFO << "Connecting to WebSocket at " << server;
-        client->connectToServer(
-            req,
-            [this](drogon::ReqResult r,
-                   const drogon::HttpResponsePtr&,
-                   const drogon::WebSocketClientPtr& wsPtr) {
-                if (r != drogon::ReqResult::Ok) {
-                    conn.reset();
-                    LOG_ERROR << "Failed to connect to aggregator service.";
-                    return;
-                }
-                conn = wsPtr->getConnection();
-
-                chat::Envelope env;
-                auto host = common::getEnvVar("SERVER_HOST") + "/ws";
-                LOG_INFO << "Sending host to aggregator: " << host;
-                env.mutable_register_server_request()->set_host(host);
-                common::sendEnvelope(conn, env);
-            });
-    }
+    void detach();
+
+    /**
+     * @brief Sends a change of rooms to the aggregator's room directory.
+     * @details Held back while a snapshot is being loaded, so it is not overwritten by it. While the
+     * link is down the change is dropped and a fresh snapshot is sent on the next registration instead.
+     */
+    void updateRoomDirectory(const chat::RoomDirectoryUpdate& update);
 
 private:
+    WsClient() = default;
+    WsClient(const WsClient&) = delete;
+    WsClient& operator=(const WsClient&) = delete;
+
+    /// @brief Opens a new connection to the aggregator. Assumes `m_mutex` is held.
+    void connect_unsafe();
+
+    /// @brief Arms the next connection attempt after a backoff, unless one is armed already. Assumes `m_mutex` is held.
+    void scheduleReconnect_unsafe();
+
+    /// @brief Handles one frame sent by the aggregator.
+    void handleMessage(const std::string& msg);
+
+    /// @brief Sends an envelope to the aggregator, if connected. Assumes `m_mutex` is held.
+    void send_unsafe(const chat::Envelope& env);
+
+    /// @brief Loads every room from the database and sends it as a directory snapshot, then the changes held back meanwhile.
+    void sendRoomDirectorySnapshot();
+
+    /// @brief Sends the room counts that changed since the last report.
+    void flushRoomLoad();
+
+    /**
+     * @brief Measures the server's load since the previous call, the loop lag is read from `common::LoopMonitor`.
+     * @note Only called on the main loop, the sampling state below is not locked.
+     */
+    chat::Envelope sampleServerLoad();
+
+    mutable std::mutex m_mutex;
     /// @brief The active WebSocket connection to the aggregator, once established.
     std::shared_ptr<drogon::WebSocketConnection> conn;
     /// @brief The Drogon WebSocket client instance used to manage the connection.
     drogon::WebSocketClientPtr client;
+    /// @brief The aggregators' addresses, split as accepted by `newWebSocketClient()` and `setPath()`.
+    std::vector<std::pair<std::string, std::string>> m_aggregators;
+    /// @brief The aggregator currently or next connected to.
+    size_t m_aggregator = 0;
+    /// @brief Failed attempts since the last successful connection, drives the backoff.
+    uint32_t m_reconnect_attempt = 0;
+    bool m_reconnect_armed = false;
+    /// @brief Set by `detach()`, no connection is opened anymore.
+    bool m_detached = false;
+    std::minstd_rand m_rng{std::random_device{}()};
+    /// @brief The rooms this server is subscribed to.
+    std::unordered_set<int32_t> m_rooms;
+    /// @brief Room ID to its local connection count, sent in full after every (re)connect.
+    std::unordered_map<int32_t, uint32_t> m_room_load;
+    /// @brief The counts not yet reported, 0 for rooms this server no longer has members in.
+    std::unordered_map<int32_t, uint32_t> m_pending_load;
+    bool m_load_flush_armed = false;
+    /// @brief Directory changes were lost, or a snapshot failed to load, the next registration sends a snapshot.
+    bool m_directory_stale = false;
+    /// @brief A snapshot is being loaded, the changes made meanwhile are held in `m_directory_pending`.
+    bool m_directory_loading = false;
+    std::vector<chat::Envelope> m_directory_pending;
+    /// @brief Waiting for the server list asked for by `drain()`.
+    std::function<void(std::vector<chat::ServerNodeInfo>)> m_on_servers;
+
+    /// @brief The process CPU time and wall time of the previous sample.
+    std::chrono::microseconds m_last_cpu_time{0};
+    std::chrono::steady_clock::time_point m_last_sample;
 };
 
 } // namespace server
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+
+/**
+ * @file CacheWarmup.h
+ * @brief Defines the startup step loading the busiest rooms into the caches before clients arrive.
+ */
+
+namespace server {
+
+/**
+ * @class CacheWarmup
+ * @brief A singleton warming `RoomDataCache` and `MessageHistoryCache` at startup, and the readiness flag it sets.
+ *
+ * @details A restarted server starts with empty caches, so the first joins after a rolling
+ * restart all miss them at once: every room gets its metadata and history tail read from
+ * the database in the same few seconds. `run()` loads the rooms with the most recent
+ * messages instead, up to `WarmupConfig::rooms` of them, before the server reports itself
+ * ready. The `UsernameFilter` is loaded then too, whether or not the rooms are.
+ *
+ * Until then `ready()` is false: WebSocket connections are refused, `/ready` answers 503
+ * and the aggregator is told this server is full, so clients go elsewhere meanwhile.
+ */
+class CacheWarmup {
+public:
+    /**
+     * @brief Gets the singleton instance of the CacheWarmup.
+     * @return A reference to the single CacheWarmup instance.
+     */
+    static CacheWarmup& instance();
+
+    /// @brief Loads the caches, then sets `ready()`. It is set even if loading fails, the caches then fill lazily.
+    drogon::Task<> run();
+
+    /// @brief Whether the server accepts clients.
+    bool ready() const noexcept { return m_ready.load(std::memory_order_acquire); }
+
+private:
+    CacheWarmup() = default;
+    CacheWarmup(const CacheWarmup&) = delete;
+    CacheWarmup& operator=(const CacheWarmup&) = delete;
+
+    /// @brief Loads the metadata and history tails of the most recently active rooms.
+    drogon::Task<size_t> warmRooms(const drogon::orm::DbClientPtr& db, size_t rooms);
+
+    std::atomic<bool> m_ready{false};
+};
+
+} // namespace server
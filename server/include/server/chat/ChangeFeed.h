@@ -0,0 +1,103 @@
+#pragma once
+
+#include <server/db/MessageBatcher.h>
+#include <server/utils/server_config.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/**
+ * @file ChangeFeed.h
+ * @brief Defines the feed of chat events for analytics and moderation tooling.
+ */
+
+namespace server {
+
+/**
+ * @class ChangeFeedSink
+ * @brief Where the batches of the feed go, see `ChangeFeedConfig::sink`.
+ */
+class ChangeFeedSink {
+public:
+    virtual ~ChangeFeedSink() = default;
+
+    /**
+     * @brief Delivers a batch of NDJSON lines, one event each.
+     * @param done Called with true once the batch is stored, false to have the same batch written again.
+     * @note Called on the main loop, with at most one batch outstanding.
+     */
+    virtual void write(const std::string& batch, uint64_t first_seq, std::function<void(bool)> done) = 0;
+};
+
+/**
+ * @class ChangeFeed
+ * @brief A thread-safe singleton emitting chat events as they succeed, so consumers need not poll the tables.
+ *
+ * @details The handlers report the messages sent and deleted, the joins and leaves of rooms,
+ * the memberships and the role changes once they succeeded. Every event is one line of JSON with
+ * the `epoch` of this process, a `seq` growing by one per event, its `type` and its fields.
+ *
+ * Events are buffered and handed to the sink every `ChangeFeedConfig::flush_interval`, up to
+ * `max_batch_events` at a time, from the main loop. A batch is outstanding until the sink stored
+ * it and is written again when it failed, so delivery is at least once and consumers dedupe
+ * by `epoch` and `seq`. While the sink is slow or down events queue up to `max_buffered_events`,
+ * beyond which they are dropped and counted, handlers never wait for the feed.
+ */
+class ChangeFeed {
+public:
+    /**
+     * @brief Gets the singleton instance of the ChangeFeed.
+     * @return A reference to the single ChangeFeed instance.
+     */
+    static ChangeFeed& instance();
+
+    /**
+     * @brief Creates the sink and starts the periodic flush, when enabled.
+     * @note Must be called once, on the main loop. Until then nothing is emitted.
+     */
+    void start(const ChangeFeedConfig& config);
+
+    /// @brief Whether events are being emitted.
+    bool enabled() const noexcept { return m_enabled.load(std::memory_order_acquire); }
+
+    void messageSent(int32_t room_id, int32_t user_id, const StoredMessage& message, const std::string& text);
+    /// @brief Messages soft deleted by a moderator, one event for all of them.
+    void messagesDeleted(int32_t room_id, int32_t by_user_id, const std::vector<int32_t>& message_ids);
+    void memberJoined(int32_t room_id, int32_t user_id, bool new_member);
+    /// @param reason "leave", "switch", "logout" or "disconnect".
+    void memberLeft(int32_t room_id, int32_t user_id, std::string_view reason);
+    void membershipChanged(int32_t room_id, int32_t user_id, chat::MembershipStatus status);
+    void roleChanged(int32_t room_id, int32_t user_id, chat::UserRights rights, int32_t by_user_id);
+
+private:
+    ChangeFeed() = default;
+    ChangeFeed(const ChangeFeed&) = delete;
+    ChangeFeed& operator=(const ChangeFeed&) = delete;
+
+    /// @brief Queues an event of a type, `fields` being the rest of its JSON object after a comma.
+    void emit(std::string_view type, const std::string& fields);
+    void flush();
+
+    std::atomic<bool> m_enabled{false};
+    ChangeFeedConfig m_config;
+    std::unique_ptr<ChangeFeedSink> m_sink;
+    /// Microseconds since epoch at start, tells the events of this process from those of the previous one.
+    int64_t m_epoch = 0;
+
+    std::mutex m_mutex;
+    /// The sequence number and the line of each event not yet batched.
+    std::deque<std::pair<uint64_t, std::string>> m_pending;
+    uint64_t m_next_seq = 1;
+    uint64_t m_dropped = 0;
+
+    // Only touched on the main loop.
+    std::string m_batch;
+    uint64_t m_batch_first_seq = 0;
+    size_t m_batch_events = 0;
+    bool m_in_flight = false;
+};
+
+} // namespace server
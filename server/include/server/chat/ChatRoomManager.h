@@ -1,7 +1,15 @@
 #pragma once
 
 #include <drogon/WebSocketConnection.h>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <mutex>
 #include <server/chat/WsData.h>
+#include <server/chat/ConnectionContext.h>
+#include <server/chat/IChatRoomService.h>
+#include <common/utils/utils.h>
+#include <common/utils/flat_set.h>
 
 /**
  * @file ChatRoomManager.h
@@ -10,6 +18,8 @@
 
 namespace server {
 
+class Tenant;
+
 /**
  * @class ChatRoomManager
  * @brief A thread-safe singleton managing the server's in-memory, real-time state.
@@ -20,8 +30,50 @@ namespace server {
  * messages to specific rooms or to all connected users.
  *
  * All public methods are asynchronous and thread-safe, returning a `drogon::Task`
- * that must be `co_await`ed. Access to the internal data structures is
- * protected by an asynchronous shared mutex.
+ * that must be `co_await`ed. The user and room maps are split into `SHARD_COUNT`
+ * shards keyed by ID, each protected by its own asynchronous shared mutex, so
+ * operations on unrelated rooms or users never contend. At most one shard lock
+ * is held at any time, which rules out lock-order deadlocks between shards.
+ *
+ * Connections are pinned to Drogon IO loops, so every loop also keeps a private
+ * replica of the memberships of its own connections. A broadcast is dispatched
+ * as one task per loop with members, so each socket is written by its own loop
+ * and cross-thread wakeups scale with the number of loops, not of recipients.
+ *
+ * A room with at least `hot_rooms.member_threshold` local connections is hot: its
+ * broadcasts are always queued, never written inline under the shard lock, and each
+ * loop writes them `hot_rooms.chunk_size` connections at a time, queueing the rest
+ * behind the work already waiting, so the other rooms of the loop are not held up by
+ * one large broadcast. The broadcasts of a hot room go out one after the other on
+ * each loop, so its members still receive them in order.
+ *
+ * The broadcasts to the rooms of a `Tenant` limiting them are charged to its budget,
+ * see `TenantQuotas`. Once it is spent they take the chunked path too, each chunk
+ * waiting for the budget to refill, and the droppable ones are dropped.
+ *
+ * Joins and leaves are not broadcast one by one. They are recorded per room and
+ * flushed once per `presence.window_ms` as a single `RoomPresenceDelta`, in which
+ * a join and a leave of the same user cancel out. Each room numbers its deltas,
+ * and the roster handed to a joining connection is the one of the last delta sent,
+ * so the deltas that follow apply on top of it exactly once.
+ *
+ * Every room keeps that roster (user, name, rights and connection count) up to
+ * date as deltas are sent, so handing it out is a copy under the shard lock
+ * instead of a lock of each member's data. The last `presence.history` deltas
+ * are kept as well, a client still holding an older roster of the room only
+ * receives the deltas it missed.
+ *
+ * Events about a room itself (creation, renaming, deletion) only go to the
+ * connections subscribed to the room directory and to the room's members, and a
+ * rename of a user only to the rooms that can see them, see `sendToDirectory()`
+ * and `renameUser()`. `sendToAll()` is left for what every connection must hear.
+ *
+ * Everything here is local to this server. When it is part of a cluster, the
+ * manager subscribes to the aggregator for the rooms it has members in, so the
+ * events published by the other servers reach them, see `ClusterRoomService`.
+ *
+ * @note Membership changes must be issued from the IO loop that owns the
+ * connection, which `WsRequestProcessor` and the close handler guarantee.
  *
  * @note This class is implemented as a singleton, accessible via the `instance()`
  * static method.
@@ -58,18 +110,22 @@ public:
     drogon::Task<void> unregisterConnection(const drogon::WebSocketConnectionPtr& conn, const WsData& locked_data);
 
     /**
-     * @brief Adds an existing connection to a specific chat room.
-     * @param room_id The ID of the room to join.
+     * @brief Adds an existing connection to the room set in its data.
+     *
+     * @details The join is announced to the room with the next presence delta.
+     *
      * @param conn The user's WebSocket connection pointer.
+     * @param locked_data A reference to the connection's WsData, assumed to be
+     *        locked by the caller, holding the user and the room to join.
+     * @param new_member Whether the user just became a member of the room.
      * @return A drogon::Task<void> to be awaited.
      */
-    drogon::Task<void> addConnectionToRoom(int32_t room_id, const drogon::WebSocketConnectionPtr& conn);
+    drogon::Task<void> addConnectionToRoom(const drogon::WebSocketConnectionPtr& conn, const WsData& locked_data, bool new_member);
 
     /**
      * @brief Removes a connection from its current chat room.
      *
-     * @details This method broadcasts a "user left" notification to the room
-     * before removing the connection from the room's membership list.
+     * @details The departure is announced to the room with the next presence delta.
      *
      * @param conn The WebSocket connection leaving the room.
      * @param locked_data A reference to the connection's WsData, assumed to be
@@ -79,15 +135,28 @@ public:
     drogon::Task<void> removeConnectionFromRoom(const drogon::WebSocketConnectionPtr& conn, const WsData& locked_data);
 
     /**
-     * @brief Asynchronously retrieves a list of all users currently in a room.
+     * @brief Asynchronously retrieves the roster of the users currently in a room.
      * @param room_id The ID of the room to query.
-     * @param locked_data A reference to the calling connection's locked
-     *        WsData. This is a crucial optimization to prevent deadlocking when
-     *        the caller is a member of the room it is querying.
-     * @return A drogon::Task resolving to a std::vector of UserInfo objects.
+     * @param known The roster version the caller already holds, if any. When it
+     *        belongs to the room's current epoch and the deltas since are still
+     *        kept, the result is incremental.
+     * @return A drogon::Task resolving to the room's roster as of its last presence delta.
      */
-    drogon::Task<std::vector<chat::UserInfo>> getUsersInRoom(
-        int32_t room_id, const WsData& locked_data) const;
+    drogon::Task<RoomRoster> getUsersInRoom(
+        int32_t room_id, std::optional<RosterVersion> known = std::nullopt) const;
+
+    /**
+     * @brief Updates the name of a user in the rosters and pending deltas of every room, and tells who can see them.
+     * @details `notice` goes to the local connections in the rooms the user is present in,
+     * in `room_ids`, and to the user's own connections, each of them receiving it once.
+     * @param user_id The ID of the renamed user.
+     * @param new_name The new name.
+     * @param room_ids The rooms the user is a member of.
+     * @param notice The encoded `UsernameChanged`.
+     * @return A drogon::Task<void> to be awaited.
+     */
+    drogon::Task<void> renameUser(int32_t user_id, const std::string& new_name,
+                                  const std::vector<int32_t>& room_ids, const common::SerializedEnvelope& notice);
     
     /**
      * @brief Sends a Protobuf message to all users in a specific room.
@@ -97,17 +166,56 @@ public:
      */
     drogon::Task<void> sendToRoom(int32_t room_id, const chat::Envelope& message) const;
 
+    /**
+     * @brief Sends an already encoded envelope to all users in a specific room.
+     * @param room_id The target room's ID.
+     * @param bytes The envelope, as produced by `common::serializeEnvelope`.
+     * @param droppable Whether the frame may be discarded under backpressure.
+     * @return A drogon::Task<void> to be awaited.
+     */
+    drogon::Task<void> sendToRoom(int32_t room_id, const common::SerializedEnvelope& bytes, bool droppable) const;
+
     /**
      * @brief Sends a Protobuf message to all authenticated users on the server.
      * @param message The Protobuf Envelope to send.
      * @return A drogon::Task<void> to be awaited.
      */
     drogon::Task<void> sendToAll(const chat::Envelope& message) const;
+
+    /**
+     * @brief Sends an already encoded envelope to all authenticated users on the server.
+     * @param bytes The envelope, as produced by `common::serializeEnvelope`.
+     * @param droppable Whether the frame may be discarded under backpressure.
+     */
+    void sendToAll(const common::SerializedEnvelope& bytes, bool droppable) const;
+
+    /**
+     * @brief Runs `fn` for every authenticated connection on the server, on the IO loop owning it.
+     * @details For messages that differ per connection, `sendToAll()` is cheaper for the others.
+     */
+    void forEachConnection(std::function<void(const drogon::WebSocketConnectionPtr&)> fn) const;
+
+    /**
+     * @brief Subscribes an authenticated connection to the room directory, or unsubscribes it.
+     * @note Must be called from the IO loop that owns the connection.
+     */
+    void subscribeDirectory(const drogon::WebSocketConnectionPtr& conn, bool subscribe);
+
+    /**
+     * @brief Sends an event about a room to the directory subscribers and to the room's members.
+     * @param room_id The room the event is about.
+     * @param message The Protobuf Envelope to send.
+     * @return A drogon::Task<void> to be awaited.
+     */
+    drogon::Task<void> sendToDirectory(int32_t room_id, const chat::Envelope& message) const;
+
+    /// @brief Sends an already encoded event like the overload above.
+    void sendToDirectory(int32_t room_id, const common::SerializedEnvelope& bytes, bool droppable) const;
     
     /**
      * @brief Handles the server-side cleanup when a room is deleted.
-     * @details This function removes the room from the internal state and broadcasts
-     * a `RoomDeleted` notification to all connected clients.
+     * @details This function sends a `RoomDeleted` notification to the directory
+     * subscribers and the room's members, then removes the room from the internal state.
      * @param room_id The ID of the room that was deleted.
      * @return A drogon::Task<void> to be awaited.
      */
@@ -122,32 +230,232 @@ public:
      * @return A drogon::Task<void> to be awaited.
      */
     drogon::Task<void> updateUserRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights, WsData& locked_data);
-    
+
+    /**
+     * @brief Applies a rights change made on another server to the local connections and rosters.
+     * @details Same as `updateUserRoomRights()`, for a caller that holds no connection's data.
+     * @return A drogon::Task<void> to be awaited.
+     */
+    drogon::Task<void> applyRemoteRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights);
+
+    /// @brief The number of authenticated connections on this server.
+    uint32_t connectionCount() const noexcept;
+
+    /// @brief The number of rooms with at least one local member.
+    uint32_t roomCount() const noexcept;
+
+    /// @brief One connection as seen by `inspectLoops()`.
+    struct ConnectionInspection {
+        /// 0 while the connection is not authenticated.
+        int32_t user_id = 0;
+        std::string peer;
+        ConnectionContext::Stats stats;
+        /// The lock of the connection's `WsData`.
+        common::LockState lock;
+    };
+
+    /// @brief What the replica of one IO loop holds, see `inspectLoops()`.
+    struct LoopInspection {
+        size_t loop_index = 0;
+        size_t connections = 0;
+        /// Room ID to the number of the loop's connections in it.
+        std::vector<std::pair<int32_t, size_t>> rooms;
+        /// The loop's connections with the largest send backlog, then the longest pipeline, busiest first.
+        std::vector<ConnectionInspection> busiest;
+        /// Hot room broadcasts still being written.
+        size_t hot_broadcasts = 0;
+    };
+
+    /**
+     * @brief Takes a snapshot of every IO loop's replica, on the loops themselves, for `GET /introspection`.
+     * @param busiest How many connections each loop reports in `LoopInspection::busiest`.
+     * @param done Called once with every loop's snapshot in loop order, on the loop that finished last.
+     */
+    void inspectLoops(size_t busiest, std::function<void(std::vector<LoopInspection>)> done) const;
+
+    /// @brief The states of the locks of the user shards, in shard order. Callable from any thread.
+    std::vector<common::LockState> userShardLocks() const;
+
+    /// @brief The states of the locks of the room shards, in shard order. Callable from any thread.
+    std::vector<common::LockState> roomShardLocks() const;
+
 private:
-    ChatRoomManager() : m_manager_mutex{common::AwaitableGuarded<int>::create(0)} {}
+    /// @brief The number of independently locked shards for each of the user and room maps.
+    static constexpr size_t SHARD_COUNT = 32;
+
+    /// @brief A set of all the connections of a loop, as stored in the per-loop replicas.
+    using ConnectionSet = std::unordered_set<drogon::WebSocketConnectionPtr>;
+
+    /**
+     * @brief The connections of a room on one loop, as stored in the per-loop replicas.
+     * @details Flat, most rooms have few members and a node per member would cost more than the member.
+     */
+    using MemberSet = common::FlatSet<drogon::WebSocketConnectionPtr>;
+
+    /// @brief Connections mapped to the index of the IO loop that owns them, flat like `MemberSet`.
+    using ConnectionLoops = common::FlatMap<drogon::WebSocketConnectionPtr, size_t>;
+
+    /// @brief The presence change of one user since the room's last delta.
+    struct PendingPresence {
+        chat::UserInfo user;
+        /// Connections joined minus connections left.
+        int32_t connections = 0;
+        bool new_member = false;
+    };
+
+    /// @brief One user of a room roster.
+    struct RosterEntry {
+        chat::UserInfo user;
+        uint32_t connections = 0;
+    };
+
+    /// @brief The members of one room, along with how many of them live on each IO loop.
+    struct RoomMembers {
+        ConnectionLoops conns;
+        std::vector<uint32_t> per_loop_count;
+        /// User ID to the roster as of the last delta broadcast.
+        std::unordered_map<int32_t, RosterEntry> roster;
+        /// User ID to the changes not yet broadcast.
+        std::unordered_map<int32_t, PendingPresence> pending_presence;
+        /// Tells this room's delta sequence apart from the one of an earlier instance of the room.
+        uint64_t presence_epoch = 0;
+        /// The sequence number of the last delta broadcast to the room.
+        uint64_t presence_seq = 0;
+        /// The most recent deltas, oldest first.
+        std::deque<chat::RoomPresenceDelta> presence_log;
+    };
+
+    /// @brief One stripe of the user map: user ID to their active WebSocket connections.
+    struct UserShard {
+        std::unordered_map<int32_t, ConnectionLoops> user_id_to_conns;
+    };
+
+    /// @brief One stripe of the room map: room ID to the WebSocket connections currently in that room.
+    struct RoomShard {
+        std::unordered_map<int32_t, RoomMembers> room_to_conns;
+    };
+
+    /// @brief A broadcast to a hot room being written by one loop, a chunk at a time.
+    struct HotBroadcast {
+        /// The room's connections on the loop when the broadcast was queued.
+        std::vector<drogon::WebSocketConnectionPtr> targets;
+        /// The index of the first target not written to yet.
+        size_t next = 0;
+        common::SerializedEnvelope bytes;
+        bool droppable = false;
+        /// The frame for the connections asking for user references, null when it is `bytes`.
+        common::SerializedEnvelope compact;
+        /// The tenant each chunk is charged to, its budget pacing the chunks. Null when charged up front or not at all.
+        Tenant* tenant = nullptr;
+    };
+
+    /**
+     * @brief The membership as seen by a single IO loop.
+     * @details Each replica only holds connections owned by its loop and is only
+     * read or written on that loop, so it needs no locking. Broadcasts post one
+     * task per loop that has members and each task writes to its local sockets.
+     */
+    struct LoopReplica {
+        std::unordered_map<int32_t, MemberSet> room_to_conns;
+        ConnectionSet authenticated_conns;
+        /// The authenticated connections subscribed to the room directory.
+        ConnectionSet directory_conns;
+        /// Room ID to the hot room broadcasts in progress on this loop, the one being written first.
+        std::unordered_map<int32_t, std::deque<HotBroadcast>> hot_broadcasts;
+    };
+
+    using UserShardGuarded = common::AwaitableGuarded<UserShard>;
+    using RoomShardGuarded = common::AwaitableGuarded<RoomShard>;
+
+    ChatRoomManager();
     ChatRoomManager(const ChatRoomManager&) = delete;
     ChatRoomManager& operator=(const ChatRoomManager&) = delete;
 
+    /// @brief Returns the shard owning the given user ID.
+    UserShardGuarded& userShard(int32_t user_id) const;
+
+    /// @brief Returns the shard owning the given room ID.
+    RoomShardGuarded& roomShard(int32_t room_id) const;
+
+    /// @brief Returns the index of the IO loop the caller is running on.
+    size_t currentLoopIndex() const;
+
+    /**
+     * @brief Runs `fn` against the replica of the given loop, on that loop.
+     * @note Runs inline when the caller is already on that loop.
+     */
+    void withReplica(size_t loop_index, std::function<void(LoopReplica&)> fn) const;
+
     /**
      * @brief Sends a message to a room without acquiring a lock.
-     * @note This is an internal helper and assumes the caller holds a lock on `m_manager_mutex`.
+     * @note This is an internal helper and assumes the caller holds a lock on the shard passed in.
      */
-    void sendToRoom_unsafe(int32_t room_id, const chat::Envelope& message) const;
-    
+    void sendToRoom_unsafe(const RoomShard& shard, int32_t room_id, const chat::Envelope& message) const;
+
     /**
-     * @brief Sends a message to all users without acquiring a lock.
-     * @note This is an internal helper and assumes the caller holds a lock on `m_manager_mutex`.
+     * @brief Sends an encoded envelope to a room. Assumes the caller holds a lock on the shard passed in.
+     * @param compact The same event referring to known users by id, for the connections with `WsData::user_refs`. Null to send `bytes` to all.
      */
-    void sendToAll_unsafe(const chat::Envelope& message) const;
+    void sendToRoom_unsafe(const RoomShard& shard, int32_t room_id, const common::SerializedEnvelope& bytes, bool droppable,
+                           const common::SerializedEnvelope& compact = nullptr) const;
 
-    /// @brief An asynchronous mutex protecting all internal data structures.
-    mutable std::shared_ptr<common::AwaitableGuarded<int>> m_manager_mutex;
+    /// @brief Queues a broadcast to a hot room on the given loop, written by `writeHotChunk()`.
+    void queueHotBroadcast(size_t loop_index, int32_t room_id, const common::SerializedEnvelope& bytes, bool droppable,
+                           const common::SerializedEnvelope& compact, Tenant* tenant) const;
 
-    /// @brief Maps a user's ID to the set of their active WebSocket connections.
-    std::unordered_map<int32_t, std::unordered_set<drogon::WebSocketConnectionPtr>> m_user_id_to_conns;
-    
-    /// @brief Maps a room's ID to the set of WebSocket connections currently in that room.
-    std::unordered_map<int32_t, std::unordered_set<drogon::WebSocketConnectionPtr>> m_room_to_conns;
+    /// @brief Adds a broadcast to the queue of a room on the given loop and starts it when it is first. Runs on the loop.
+    void pushHotBroadcast(size_t loop_index, int32_t room_id, const common::SerializedEnvelope& bytes, bool droppable,
+                          const common::SerializedEnvelope& compact, Tenant* tenant) const;
+
+    /// @brief Writes the next chunk of the current broadcast to a hot room, and queues the one after. Runs on the loop.
+    void writeHotChunk(size_t loop_index, int32_t room_id) const;
+
+    /**
+     * @brief Updates the rights of a user in a room on all of their local connections and broadcasts the change.
+     * @param locked_data The calling connection's locked data, updated in place, or null.
+     */
+    drogon::Task<void> updateRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights, WsData* locked_data);
+
+    /// @brief Called when a room gains its first local member. Assumes the room's shard is held exclusively.
+    void roomOpened_unsafe(int32_t room_id);
+
+    /// @brief Called when a room loses its last local member. Assumes the room's shard is held exclusively.
+    void roomClosed_unsafe(int32_t room_id);
+
+    /**
+     * @brief Records a join (positive `connections`) or a leave (negative) for the next delta of a room.
+     * @note Assumes the caller holds an exclusive lock on the room's shard.
+     */
+    void recordPresence_unsafe(RoomMembers& members, const chat::UserInfo& user, int32_t connections, bool new_member);
+
+    /// @brief Arms the presence window of a room, unless a flush already covers it.
+    void schedulePresenceFlush(int32_t room_id);
+
+    /// @brief Broadcasts and clears the pending presence changes of every scheduled room.
+    void flushPresence();
+
+    /// @brief Broadcasts and clears the pending presence changes of one room.
+    drogon::Task<void> broadcastPresence(int32_t room_id);
+
+    /// @brief The user map stripes, indexed by `userShard()`.
+    std::array<std::shared_ptr<UserShardGuarded>, SHARD_COUNT> m_user_shards;
+
+    /// @brief The room map stripes, indexed by `roomShard()`.
+    std::array<std::shared_ptr<RoomShardGuarded>, SHARD_COUNT> m_room_shards;
+
+    /// @brief One membership replica per IO loop, indexed by the loop index.
+    mutable std::vector<LoopReplica> m_loop_replicas;
+
+    /// @brief Guards the presence flush schedule below.
+    std::mutex m_presence_mutex;
+    /// @brief The rooms with presence changes waiting for the next flush.
+    std::unordered_set<int32_t> m_presence_dirty;
+    /// @brief Whether a flush is already scheduled on the timer loop.
+    bool m_presence_flush_armed = false;
+
+    /// @brief Load figures for the aggregator, updated under the shard locks but readable without them.
+    std::atomic<uint32_t> m_connection_count{0};
+    std::atomic<uint32_t> m_room_count{0};
 };
 
 } // namespace server
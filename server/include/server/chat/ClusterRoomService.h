@@ -0,0 +1,75 @@
+#pragma once
+
+#include <server/chat/DrogonRoomService.h>
+#include <common/utils/utils.h>
+
+/**
+ * @file ClusterRoomService.h
+ * @brief Defines the room service that also relays room events to the other servers of the cluster.
+ */
+
+namespace server {
+
+/**
+ * @class ClusterRoomService
+ * @brief A `DrogonRoomService` that publishes every room event on the aggregator bus.
+ *
+ * @details The handlers broadcast through `IChatRoomService`, so this is the single place
+ * where events leave the server: each event is delivered to the local members first, then
+ * published through `WsClient` so the servers holding the other members of the room deliver
+ * it to theirs. Room-scoped events only reach the servers subscribed to the room, global ones
+ * (directory events, user renames) reach every server, which routes them to its own audience.
+ *
+ * Directory events and new members also go to the aggregator's room directory, see
+ * `WsClient::updateRoomDirectory()`.
+ *
+ * `deliverRemote()` is the receiving side. Besides forwarding the event to the local members,
+ * it applies the side effects the originating handler performed on its own server, such as
+ * invalidating `RoomDataCache` or extending `MessageHistoryCache`.
+ *
+ * Final, so the handlers instantiated for it, see `ChatRoomService`, call it without virtual dispatch.
+ *
+ * @note Presence and typing indicators are not relayed, each server keeps its own rosters
+ * and sequence numbers for the members connected to it.
+ */
+class ClusterRoomService final : public DrogonRoomService {
+public:
+    using DrogonRoomService::DrogonRoomService;
+
+    /** @see IChatRoomService::sendToRoom */
+    drogon::Task<void> sendToRoom(int32_t room_id, const chat::Envelope& message) const override;
+
+    /** @see IChatRoomService::sendToAll */
+    drogon::Task<void> sendToAll(const chat::Envelope& message) const override;
+
+    /** @see IChatRoomService::sendToDirectory */
+    drogon::Task<void> sendToDirectory(int32_t room_id, const chat::Envelope& message) const override;
+
+    /** @see IChatRoomService::joinRoom */
+    drogon::Task<void> joinRoom(const WsData& locked_data, bool new_member) override;
+
+    /** @see IChatRoomService::renameUser */
+    drogon::Task<void> renameUser(int32_t user_id, const std::string& new_name, const std::vector<int32_t>& room_ids) override;
+
+    /** @see IChatRoomService::onRoomDeleted */
+    drogon::Task<void> onRoomDeleted(int32_t room_id) override;
+
+    /** @see IChatRoomService::updateUserRoomRights */
+    drogon::Task<void> updateUserRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights, WsData& locked_data) override;
+
+    /**
+     * @brief Applies and delivers an event published by another server.
+     * @details Returns immediately, the delivery runs as its own task.
+     * @param publish The event as relayed by the aggregator.
+     */
+    static void deliverRemote(const chat::ClusterPublish& publish);
+
+private:
+    /// @brief Delivers a room-scoped event to the local members of the room.
+    static drogon::Task<void> deliverToRoom(int32_t room_id, chat::Envelope env, common::SerializedEnvelope bytes);
+
+    /// @brief Delivers a global event to the local connections it is meant for.
+    static drogon::Task<void> deliverToAll(chat::Envelope env, common::SerializedEnvelope bytes, std::vector<int32_t> audience_room_ids);
+};
+
+} // namespace server
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <variant>
+
+/**
+ * @file ConnectionAdmission.h
+ * @brief Defines the admission control of new WebSocket connections.
+ */
+
+namespace server {
+
+/**
+ * @class ConnectionAdmission
+ * @brief A singleton deciding whether a new WebSocket connection is accepted, and holding the slots of those that were.
+ *
+ * @details After an outage every client reconnects in the same few seconds. Accepted all
+ * at once, their logins contend for the database together and most of them time out,
+ * after which they all retry. Past any of the `AdmissionConfig` limits a connection is
+ * refused right away instead:
+ *
+ * - more new connections per second than `accepts_per_sec`, with bursts of `accept_burst`;
+ * - more than `max_unauthenticated` connections open but not logged in yet;
+ * - more than `max_connections` connections open at all.
+ *
+ * The client is told to come back after `retry_after` plus a random part of `retry_spread`,
+ * so the next wave is spread out. Those admitted then log in at a pace the server keeps up with.
+ */
+class ConnectionAdmission {
+public:
+    /**
+     * @class Ticket
+     * @brief The slots held by an admitted connection, released when it is destroyed.
+     * @details Held in the connection's `WsData`. The slot among the connections not logged in
+     * is released by `authenticated()`, or with the ticket for a connection that never logged in.
+     */
+    class Ticket {
+    public:
+        Ticket() = default;
+        Ticket(Ticket&& other) noexcept;
+        Ticket& operator=(Ticket&& other) noexcept;
+        ~Ticket();
+
+        /// @brief Releases the slot among the connections not logged in, once.
+        void authenticated() noexcept;
+
+        /// @brief Whether the connection has not logged in yet.
+        [[nodiscard]] bool unauthenticated() const noexcept { return m_unauthenticated.load(std::memory_order_acquire); }
+
+    private:
+        friend class ConnectionAdmission;
+        explicit Ticket(bool held) noexcept : m_held{held}, m_unauthenticated{held} {}
+
+        void release() noexcept;
+
+        bool m_held = false;
+        std::atomic<bool> m_unauthenticated{false};
+    };
+
+    /// @brief The delay a refused client is asked to wait before connecting again.
+    using RetryAfter = std::chrono::milliseconds;
+
+    /**
+     * @brief Gets the singleton instance of the ConnectionAdmission.
+     * @return A reference to the single ConnectionAdmission instance.
+     */
+    static ConnectionAdmission& instance();
+
+    /// @brief Admits a new connection, or tells how long its client should wait. Callable from any thread.
+    std::variant<Ticket, RetryAfter> admit();
+
+private:
+    ConnectionAdmission();
+    ConnectionAdmission(const ConnectionAdmission&) = delete;
+    ConnectionAdmission& operator=(const ConnectionAdmission&) = delete;
+
+    /// @brief Takes an accept token, refilled at `accepts_per_sec`. False when none is left.
+    bool takeAcceptToken();
+
+    /// @brief The configured delay with its random part.
+    RetryAfter retryAfter() const;
+
+    std::atomic<size_t> m_connections{0};
+    std::atomic<size_t> m_unauthenticated{0};
+
+    std::mutex m_mutex;
+    double m_tokens;
+    std::chrono::steady_clock::time_point m_refilled = std::chrono::steady_clock::now();
+};
+
+} // namespace server
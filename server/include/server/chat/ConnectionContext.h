@@ -0,0 +1,225 @@
+#pragma once
+
+#include <server/chat/WsData.h>
+#include <common/utils/utils.h>
+
+/**
+ * @file ConnectionContext.h
+ * @brief Defines the per-connection state stored in a WebSocket connection's context.
+ */
+
+namespace server {
+
+/**
+ * @class ConnectionContext
+ * @brief Owns a connection's `WsData` and the pipeline of work that runs on its behalf.
+ *
+ * @details Every request of a connection, and every change another connection makes to
+ * its `WsData`, is posted to this pipeline as a job. Jobs start in the order they were
+ * posted, on the IO loop that owns the connection:
+ *
+ * - An exclusive job runs alone, after every earlier job has finished. All writers of
+ *   the `WsData` are exclusive, so a job that only reads it may do so through
+ *   `WsDataGuarded::get_unsafe()`.
+ * - Consecutive concurrent jobs run side by side, at most `PipelineConfig::depth` at a time.
+ *   They must neither modify the `WsData` nor depend on the order of their side effects.
+ *
+ * Requests posted through `postRequest()` have their responses delivered in request order,
+ * however their execution interleaves. Writers still take the unique lock, since other
+ * connections read the data under a shared lock.
+ *
+ * Outgoing frames take one of two lanes. Live events and control frames are written right
+ * away through `sendToConnection()`. Responses go through `queueResponse()`, which writes them
+ * in order but only while their own estimated backlog is small, so a large history page
+ * leaves the connection a slice at a time and the live events produced meanwhile are written
+ * between its slices instead of behind all of it.
+ *
+ * @note Must be created on the IO loop of its connection and stored in a shared_ptr.
+ */
+class ConnectionContext : public std::enable_shared_from_this<ConnectionContext> {
+public:
+    /// @brief A unit of work without a response. The job object stays alive until the task it returned completes.
+    using Job = std::function<drogon::Task<>()>;
+
+    /// @brief A response to a client request, possibly aliasing the `RequestArena` it was built on.
+    using Response = std::shared_ptr<const chat::Envelope>;
+
+    /**
+     * @struct Request
+     * @brief A client request and how to deliver its response.
+     */
+    struct Request {
+        /// Produces the response. Kept alive until the task it returned completes.
+        std::function<drogon::Task<Response>()> run;
+        /// Delivers the response, called in request order on the connection's loop.
+        std::function<void(const chat::Envelope&)> reply;
+        /// Whether the request may run alongside other concurrent jobs.
+        bool concurrent = false;
+    };
+
+    /**
+     * @struct Stats
+     * @brief A snapshot of the connection's pipeline and send backlog, for `GET /introspection`.
+     */
+    struct Stats {
+        size_t queued_jobs = 0;
+        /// Requests queued, not started yet.
+        size_t queued_requests = 0;
+        size_t in_flight = 0;
+        /// Responses done but waiting for an earlier one to be delivered first.
+        size_t undelivered = 0;
+        /// The estimated send backlog as of now, see `admitOutbound()`.
+        size_t out_backlog_bytes = 0;
+        /// Response frames held back behind the live lane, and their size.
+        size_t queued_responses = 0;
+        size_t queued_response_bytes = 0;
+        /// How long the backlog has been above the high watermark, zero when it is not.
+        std::chrono::steady_clock::duration over_high_for{};
+    };
+
+    /// @brief Creates the context for a connection owned by the current IO loop, holding its admission slots.
+    explicit ConnectionContext(ConnectionAdmission::Ticket admission = {});
+
+    /// @brief The state of the connection.
+    [[nodiscard]] const WsDataPtr& data() const noexcept { return m_data; }
+
+    /// @brief The latest published view of the state, readable from any thread without the lock, see `WsDataViewCell`.
+    [[nodiscard]] std::shared_ptr<const WsDataView> view() const { return m_view->load(); }
+
+    /// @brief The number of the connection in the traffic capture, 0 when it opened while not recording.
+    [[nodiscard]] uint64_t captureId() const noexcept { return m_capture_id; }
+
+    /**
+     * @brief Queues an exclusive job. Callable from any thread.
+     * @details Jobs posted after `close()` are dropped.
+     */
+    void post(Job job);
+
+    /**
+     * @brief Whether no job is queued or running and every response has been delivered.
+     * @details A request answered synchronously while idle is in order and runs as if it were
+     * an exclusive job, so it may skip the pipeline. Must be called on the connection's own IO loop.
+     */
+    [[nodiscard]] bool idle() const noexcept { return !m_closed && m_jobs.empty() && m_in_flight == 0; }
+
+    /**
+     * @brief Queues a client request. Must be called on the connection's own IO loop.
+     * @details When `PipelineConfig::max_queued` requests are already waiting, the request
+     * is not run and is answered with an error instead, still in order.
+     */
+    void postRequest(Request request);
+
+    /**
+     * @brief Accounts an outgoing frame against the connection's estimated send backlog.
+     *
+     * @details Drogon does not expose how much of a connection's output is still buffered,
+     * so the backlog is estimated: every frame adds its size, and the backlog drains at
+     * `OutboundConfig::min_drain_bytes_per_sec`, the slowest rate a healthy client is
+     * expected to read at. Above the high watermark droppable frames are discarded; a
+     * connection that does not get back below the low watermark within
+     * `OutboundConfig::evict_after` is closed as a slow consumer.
+     *
+     * Must be called on the connection's own IO loop.
+     *
+     * @param conn The connection the frame is for.
+     * @param bytes The size of the frame.
+     * @param droppable Whether the frame may be discarded under backpressure, see `isDroppable()`.
+     * @return Whether the frame should be sent.
+     */
+    bool admitOutbound(const drogon::WebSocketConnectionPtr& conn, size_t bytes, bool droppable);
+
+    /**
+     * @brief Writes a response frame, or queues it behind the ones still held back.
+     *
+     * @details Frames are written in the order they are queued while the estimated backlog of
+     * responses is below `OutboundConfig::response_window_bytes`, which drains at
+     * `OutboundConfig::response_drain_bytes_per_sec`. The rest are written from a timer as the
+     * estimate drains. Every frame written is also accounted by `admitOutbound()`.
+     *
+     * Must be called on the connection's own IO loop.
+     */
+    void queueResponse(const drogon::WebSocketConnectionPtr& conn, common::SerializedEnvelope bytes);
+
+    /// @brief Records that the client sent something, a pong included. Must be called on the connection's own IO loop.
+    void touch() noexcept { m_last_activity = std::chrono::steady_clock::now(); }
+
+    /// @brief When the client last sent something, see `IdleReaper`. Must be called on the connection's own IO loop.
+    [[nodiscard]] std::chrono::steady_clock::time_point lastActivity() const noexcept { return m_last_activity; }
+
+    /// @brief Reads the pipeline and the backlog. Must be called on the connection's own IO loop.
+    [[nodiscard]] Stats stats() const;
+
+    /// @brief Whether an event is cheap to lose, such as typing indicators and join notices.
+    static bool isDroppable(const chat::Envelope& env) noexcept;
+
+    /**
+     * @brief Drops every job that has not started yet and queues `last` as the final exclusive job.
+     * @details Must be called on the connection's own IO loop. Responses not yet delivered are discarded.
+     */
+    void close(Job last);
+
+private:
+    /// @brief A queued job with its scheduling class.
+    struct Entry {
+        Job run;
+        bool concurrent = false;
+    };
+
+    /// @brief Appends an entry and starts whatever may start. Must run on the connection's loop.
+    void push(Entry entry);
+
+    /// @brief Starts queued entries while the scheduling rules allow it.
+    void pump();
+
+    /// @brief Runs one started entry, then lets the next ones start.
+    drogon::Task<> run(Entry entry);
+
+    /// @brief Runs one request and hands its response over for ordered delivery.
+    drogon::Task<> runRequest(Request request, uint64_t seq);
+
+    /// @brief Records a response and delivers every response that is next in order.
+    void complete(uint64_t seq, std::function<void(const chat::Envelope&)> reply, Response response);
+
+    /// @brief Writes the queued response frames the window allows, and arms the timer for the rest.
+    void pumpResponses(const drogon::WebSocketConnectionPtr& conn);
+
+    WsDataPtr m_data;
+    std::shared_ptr<const WsDataViewCell> m_view;
+    size_t m_loop_index;
+    uint64_t m_capture_id;
+    // The members below are only touched on the connection's loop.
+    std::deque<Entry> m_jobs;
+    size_t m_queued_requests = 0;
+    size_t m_in_flight = 0;
+    bool m_exclusive_running = false;
+    bool m_pumping = false;
+    bool m_closed = false;
+    uint64_t m_next_seq = 0;
+    uint64_t m_next_reply = 0;
+    std::map<uint64_t, std::pair<std::function<void(const chat::Envelope&)>, Response>> m_done;
+    // Outbound accounting, see admitOutbound().
+    double m_out_backlog = 0;
+    std::chrono::steady_clock::time_point m_out_updated = std::chrono::steady_clock::now();
+    std::optional<std::chrono::steady_clock::time_point> m_over_high_since;
+    // The response lane, see queueResponse().
+    std::deque<common::SerializedEnvelope> m_responses;
+    size_t m_queued_response_bytes = 0;
+    double m_response_backlog = 0;
+    std::chrono::steady_clock::time_point m_response_updated = std::chrono::steady_clock::now();
+    bool m_response_timer_armed = false;
+    std::chrono::steady_clock::time_point m_last_activity = std::chrono::steady_clock::now();
+};
+
+/**
+ * @brief Sends a pre-serialized frame to a connection, subject to its backpressure accounting.
+ * @details Must be called on the connection's own IO loop. See `ConnectionContext::admitOutbound()`.
+ */
+void sendToConnection(const drogon::WebSocketConnectionPtr& conn, const common::SerializedEnvelope& bytes, bool droppable = false);
+
+/**
+ * @brief Sends a frame of a response to a connection on its response lane, behind the live events.
+ * @details Must be called on the connection's own IO loop. See `ConnectionContext::queueResponse()`.
+ */
+void sendResponseToConnection(const drogon::WebSocketConnectionPtr& conn, common::SerializedEnvelope bytes);
+
+} // namespace server
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <server/chat/IChatRoomService.h>
+#include <server/chat/ChatRoomManager.h>
+#include <server/chat/TypingAggregator.h>
 #include <drogon/WebSocketConnection.h>
 
 /**
@@ -22,6 +24,10 @@ namespace server {
  * This design allows the core business logic to depend on the `IChatRoomService`
  * abstraction, while this class handles the specific task of communicating with
  * the ChatRoomManager singleton, making the system more modular and testable.
+ *
+ * The plain forwards are defined here and hand the manager's task back rather than
+ * awaiting it in a frame of their own, so a handler instantiated for the final
+ * `ClusterRoomService` calls straight into the manager.
  */
 class DrogonRoomService : public IChatRoomService {
 public:
@@ -29,35 +35,73 @@ public:
      * @brief Constructs a new room service for a specific connection.
      * @param conn The WebSocket connection that this service instance will manage.
      */
-    explicit DrogonRoomService(const drogon::WebSocketConnectionPtr& conn);
+    explicit DrogonRoomService(const drogon::WebSocketConnectionPtr& conn) : m_conn(conn) {}
 
     /** @see IChatRoomService::login */
     drogon::Task<void> login(const WsData& locked_data) override;
 
     /** @see IChatRoomService::logout */
-    drogon::Task<void> logout(const WsData& locked_data) override;
+    drogon::Task<void> logout(const WsData& locked_data) override {
+        return ChatRoomManager::instance().unregisterConnection(m_conn, locked_data);
+    }
 
     /** @see IChatRoomService::joinRoom */
-    drogon::Task<void> joinRoom(const WsData& locked_data) override;
+    drogon::Task<void> joinRoom(const WsData& locked_data, bool new_member) override;
 
     /** @see IChatRoomService::leaveCurrentRoom */
-    drogon::Task<void> leaveCurrentRoom(const WsData& locked_data) override;
+    drogon::Task<void> leaveCurrentRoom(const WsData& locked_data) override {
+        return ChatRoomManager::instance().removeConnectionFromRoom(m_conn, locked_data);
+    }
 
     /** @see IChatRoomService::getUsersInRoom */
-    drogon::Task<std::vector<chat::UserInfo>> getUsersInRoom(
-        int32_t room_id, const WsData& locked_data) const override;
+    drogon::Task<RoomRoster> getUsersInRoom(
+        int32_t room_id, std::optional<RosterVersion> known) const override {
+        return ChatRoomManager::instance().getUsersInRoom(room_id, known);
+    }
 
     /** @see IChatRoomService::sendToRoom */
-    drogon::Task<void> sendToRoom(int32_t room_id, const chat::Envelope& message) const override;
+    drogon::Task<void> sendToRoom(int32_t room_id, const chat::Envelope& message) const override {
+        return ChatRoomManager::instance().sendToRoom(room_id, message);
+    }
 
     /** @see IChatRoomService::sendToAll */
-    drogon::Task<void> sendToAll(const chat::Envelope& message) const override;
+    drogon::Task<void> sendToAll(const chat::Envelope& message) const override {
+        return ChatRoomManager::instance().sendToAll(message);
+    }
+
+    /** @see IChatRoomService::sendToDirectory */
+    drogon::Task<void> sendToDirectory(int32_t room_id, const chat::Envelope& message) const override {
+        return ChatRoomManager::instance().sendToDirectory(room_id, message);
+    }
+
+    /** @see IChatRoomService::subscribeDirectory */
+    void subscribeDirectory(const WsData& locked_data, bool subscribe) override {
+        if(locked_data.user) {
+            ChatRoomManager::instance().subscribeDirectory(m_conn, subscribe);
+        }
+    }
 
     /** @see IChatRoomService::onRoomDeleted */
-    drogon::Task<void> onRoomDeleted(int32_t room_id) override;
+    drogon::Task<void> onRoomDeleted(int32_t room_id) override {
+        return ChatRoomManager::instance().onRoomDeleted(room_id);
+    }
 
     /** @see IChatRoomService::updateUserRoomRights */
-    drogon::Task<void> updateUserRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights, WsData& locked_data) override;
+    drogon::Task<void> updateUserRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights, WsData& locked_data) override {
+        return ChatRoomManager::instance().updateUserRoomRights(userId, roomId, newRights, locked_data);
+    }
+
+    /** @see IChatRoomService::renameUser */
+    drogon::Task<void> renameUser(int32_t user_id, const std::string& new_name, const std::vector<int32_t>& room_ids) override;
+
+    /** @see IChatRoomService::setTyping */
+    void setTyping(int32_t room_id, const chat::UserInfo& user, bool typing) override {
+        TypingAggregator::instance().setTyping(room_id, user, typing);
+    }
+
+protected:
+    /// @brief The `UsernameChanged` telling about a rename.
+    static chat::Envelope usernameChanged(int32_t user_id, const std::string& new_name);
 
 private:
     /// @brief The specific WebSocket connection this service instance operates on.
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <drogon/drogon.h>
+#include <atomic>
+
+/**
+ * @file HistoryExport.h
+ * @brief Defines the export of a room's whole history over HTTP.
+ */
+
+namespace server {
+
+/**
+ * @class HistoryExport
+ * @brief A singleton streaming the history of a room to a moderator, a page at a time.
+ *
+ * @details Pulling a whole room through `GetMessagesRequest` takes one WebSocket round
+ * trip per page, queued with the user's chat traffic. `GET /rooms/{id}/export` streams
+ * it in one chunked HTTP response instead, see `HttpController::exportHistory()`:
+ *
+ * - the messages are read in seq order, `HistoryExportConfig::page_size` per query, by
+ *   keyset from the last seq sent, so no query holds more than a page;
+ * - each page is encoded and sent before the next one is read, as NDJSON or as
+ *   `MessageInfo`s each prefixed with its varint length;
+ * - compressed, each page is its own gzip member. A gzip file may hold several, `gunzip`
+ *   reads it as one;
+ * - the export stops at the room's last seq when it started, given in `X-Export-Last-Seq`,
+ *   so a client can tell a complete export from one cut short.
+ *
+ * At most `HistoryExportConfig::max_concurrent` exports run at once, from the read client.
+ */
+class HistoryExport {
+public:
+    /// @brief How the messages are encoded.
+    enum class Format { Ndjson, Protobuf };
+
+    /**
+     * @brief Gets the singleton instance of the HistoryExport.
+     * @return A reference to the single HistoryExport instance.
+     */
+    static HistoryExport& instance();
+
+    /// @brief One of the exports that may run at once, given back when the last reference to it goes.
+    class Slot {
+    public:
+        ~Slot();
+    };
+
+    /// @brief Takes one of the export slots, or returns null if all are taken.
+    std::shared_ptr<Slot> tryAcquire();
+
+    /**
+     * @brief Streams the messages of a room up to `last_seq`.
+     * @param slot The slot taken for the export, held until the last page is sent.
+     * @param stream The stream of the response, closed once the last page is sent.
+     */
+    drogon::Task<> stream(std::shared_ptr<Slot> slot, drogon::ResponseStreamPtr stream, int32_t room_id, int64_t last_seq,
+                          Format format, bool gzip);
+
+private:
+    HistoryExport() = default;
+    HistoryExport(const HistoryExport&) = delete;
+    HistoryExport& operator=(const HistoryExport&) = delete;
+
+    std::atomic<size_t> m_running{0};
+};
+
+} // namespace server
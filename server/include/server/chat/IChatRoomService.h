@@ -9,6 +9,32 @@
 
 namespace server {
 
+/**
+ * @struct RosterVersion
+ * @brief A point of a room's presence sequence, as held by a client.
+ */
+struct RosterVersion {
+    uint64_t epoch = 0;
+    uint64_t seq = 0;
+};
+
+/**
+ * @struct RoomRoster
+ * @brief The connections currently in a room, as of one point of the room's presence sequence.
+ */
+struct RoomRoster {
+    /// One entry per connection, a user with several connections appears several times.
+    std::vector<chat::UserInfo> users;
+    /// Identifies the room's presence sequence, it changes when the room empties.
+    uint64_t presence_epoch = 0;
+    /// The last presence delta reflected in the roster, the room receives the later ones.
+    uint64_t presence_seq = 0;
+    /// Whether `users` is left empty and `missed` updates the roster the caller already holds.
+    bool incremental = false;
+    /// The deltas after the caller's known version, oldest first.
+    std::vector<chat::RoomPresenceDelta> missed;
+};
+
 /**
  * @class IChatRoomService
  * @brief An abstract interface for real-time chat state and broadcast operations.
@@ -46,9 +72,10 @@ public:
     /**
      * @brief Handles the state change when a user joins a room.
      * @param locked_data The user's locked WsData, containing the target room info.
+     * @param new_member Whether the user just became a member of the room.
      * @return A drogon::Task<void> to be awaited.
      */
-    virtual drogon::Task<void> joinRoom(const WsData& locked_data) = 0;
+    virtual drogon::Task<void> joinRoom(const WsData& locked_data, bool new_member) = 0;
 
     /**
      * @brief Handles the state change when a user leaves their current room.
@@ -58,15 +85,14 @@ public:
     virtual drogon::Task<void> leaveCurrentRoom(const WsData& locked_data) = 0;
 
     /**
-     * @brief Asynchronously retrieves a list of all users currently in a room.
+     * @brief Asynchronously retrieves the roster of the users currently in a room.
      * @param room_id The ID of the room to query.
-     * @param locked_data A reference to the calling connection's locked
-     *        WsData. This is a crucial optimization to prevent deadlocking when
-     *        the caller is a member of the room it is querying.
-     * @return A drogon::Task resolving to a std::vector of UserInfo objects.
+     * @param known The roster version the caller already holds, if any. When the
+     *        missed deltas are still available, only those are returned.
+     * @return A drogon::Task resolving to the room's roster.
      */
-    virtual drogon::Task<std::vector<chat::UserInfo>> getUsersInRoom(
-        int32_t room_id, const WsData& locked_data) const = 0;
+    virtual drogon::Task<RoomRoster> getUsersInRoom(
+        int32_t room_id, std::optional<RosterVersion> known) const = 0;
     
     /*
      * @brief Sends a Protobuf message to all users in a specific room.
@@ -82,6 +108,21 @@ public:
      * @return A drogon::Task<void> to be awaited.
      */
     virtual drogon::Task<void> sendToAll(const chat::Envelope& message) const = 0;
+
+    /**
+     * @brief Sends an event about a room to the connections subscribed to the room directory and to its members.
+     * @param room_id The room the event is about.
+     * @param message The Protobuf Envelope to send.
+     * @return A drogon::Task<void> to be awaited.
+     */
+    virtual drogon::Task<void> sendToDirectory(int32_t room_id, const chat::Envelope& message) const = 0;
+
+    /**
+     * @brief Subscribes this connection to the room directory, or unsubscribes it.
+     * @param locked_data The connection's data, assumed to be locked by the caller.
+     * @param subscribe Whether to subscribe.
+     */
+    virtual void subscribeDirectory(const WsData& locked_data, bool subscribe) = 0;
     
     /**
      * @brief Handles the server-side state cleanup when a room is deleted.
@@ -99,6 +140,35 @@ public:
      * @return A drogon::Task<void> to be awaited.
      */
     virtual drogon::Task<void> updateUserRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights, WsData& locked_data) = 0;
+
+    /**
+     * @brief Updates the name of a user in the rosters of the rooms they are in and sends the `UsernameChanged`.
+     * @details It reaches the user's own connections and the members of the rooms the user is
+     * present in or listed in `room_ids`, nobody else.
+     * @param user_id The ID of the renamed user.
+     * @param new_name The new name.
+     * @param room_ids The rooms the user is a member of.
+     * @return A drogon::Task<void> to be awaited.
+     */
+    virtual drogon::Task<void> renameUser(int32_t user_id, const std::string& new_name, const std::vector<int32_t>& room_ids) = 0;
+
+    /**
+     * @brief Records that a user started or stopped typing in a room.
+     * @details The room is told about it in coalesced, periodic updates rather than right away.
+     * @param room_id The room the user is typing in.
+     * @param user The user, as shown to the other members.
+     * @param typing Whether the user is typing.
+     */
+    virtual void setTyping(int32_t room_id, const chat::UserInfo& user, bool typing) = 0;
 };
 
+/**
+ * @brief A room service `MessageHandlers` can be instantiated for.
+ * @details Production instantiates the handlers for the final `ClusterRoomService`, whose calls
+ * are bound at compile time and inline into `ChatRoomManager`. Instantiated for `IChatRoomService`
+ * itself, they take any implementation through the interface, such as a mock or a benchmark's.
+ */
+template<typename T>
+concept ChatRoomService = std::derived_from<T, IChatRoomService>;
+
 } // namespace server
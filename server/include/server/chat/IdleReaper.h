@@ -0,0 +1,56 @@
+#pragma once
+
+#include <server/utils/timer_wheel.h>
+#include <drogon/WebSocketConnection.h>
+
+/**
+ * @file IdleReaper.h
+ * @brief Defines the heartbeat of the WebSocket connections and the closing of the dead ones.
+ */
+
+namespace server {
+
+/**
+ * @class IdleReaper
+ * @brief A singleton pinging quiet connections and closing those that stopped answering.
+ *
+ * @details A client that vanished without closing, a phone that lost its network, leaves a
+ * half-open connection behind. It stays registered in its rooms and every broadcast still
+ * writes to it, until TCP gives up hours later.
+ *
+ * Each IO loop keeps its connections in a `TimerWheel` ticking once a second. Anything the
+ * client sends, a pong included, counts as activity and only moves a timestamp in its
+ * `ConnectionContext`. When a connection comes up in the wheel the reaper looks at how long
+ * it has been quiet:
+ *
+ * - under `HeartbeatConfig::ping_interval`, it comes up again once that much has passed;
+ * - past it, it is sent a WebSocket ping, which a live client answers on its own;
+ * - past `HeartbeatConfig::idle_timeout`, it is closed, and leaves its rooms like any
+ *   other connection that closed.
+ */
+class IdleReaper {
+public:
+    /**
+     * @brief Gets the singleton instance of the IdleReaper.
+     * @return A reference to the single IdleReaper instance.
+     */
+    static IdleReaper& instance();
+
+    /// @brief Starts watching a connection with a `ConnectionContext`. Must be called on its IO loop.
+    void watch(const drogon::WebSocketConnectionPtr& conn);
+
+private:
+    using Wheel = TimerWheel<std::weak_ptr<drogon::WebSocketConnection>>;
+
+    IdleReaper() = default;
+    IdleReaper(const IdleReaper&) = delete;
+    IdleReaper& operator=(const IdleReaper&) = delete;
+
+    /// @brief The wheel of the current IO loop, ticking from its first use.
+    Wheel& loopWheel();
+
+    /// @brief Pings, closes or reschedules a connection that came up in the wheel.
+    void check(Wheel& wheel, const std::weak_ptr<drogon::WebSocketConnection>& weak);
+};
+
+} // namespace server
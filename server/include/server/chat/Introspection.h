@@ -0,0 +1,42 @@
+#pragma once
+
+#include <drogon/drogon.h>
+#include <server/utils/server_config.h>
+
+/**
+ * @file Introspection.h
+ * @brief Defines the snapshot of the server's live state served to global admins.
+ */
+
+namespace server {
+
+/**
+ * @class Introspection
+ * @brief Collects what to look at first during an incident, as one JSON document.
+ *
+ * @details `GET /introspection`, see `HttpController::introspect()`, answers with:
+ *
+ * - `connections` and `room_count`: the authenticated connections and the rooms with local members;
+ * - `rooms`: the `IntrospectionConfig::top_rooms` rooms with the most local connections,
+ *   each with its count and the number of loops it spans;
+ * - `connections_by_backlog`: the `IntrospectionConfig::top_connections` connections with the largest
+ *   estimated send backlog, then the longest request pipeline, with the lock state of their
+ *   `WsData`;
+ * - `loops`: the connections, rooms, hot broadcasts, task queue depth and lag of every IO loop;
+ * - `locks`: the user and room shards of `ChatRoomManager` whose lock is held or waited for;
+ * - `handlers_in_flight`: the requests each handler is running, from `chat_requests_in_flight`.
+ *
+ * Each loop reports its own connections and rooms from its replica, on the loop, so nothing
+ * is locked but the short internal mutex of each lock read. The figures of different loops are
+ * taken a few microseconds apart and need not add up exactly.
+ */
+class Introspection {
+public:
+    /**
+     * @brief Takes the snapshot.
+     * @param done Called once with the document, on one of the IO loops.
+     */
+    static void collect(const IntrospectionConfig& config, std::function<void(Json::Value)> done);
+};
+
+} // namespace server
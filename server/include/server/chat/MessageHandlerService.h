@@ -1,6 +1,7 @@
 #pragma once
 
 #include <server/chat/WsData.h>
+#include <common/utils/dispatch.h>
 
 /**
  * @file MessageHandlerService.h
@@ -10,7 +11,17 @@
 namespace server {
 
 class MessageHandlers;
-class IChatRoomService;
+class ClusterRoomService;
+
+/**
+ * @struct HandlerContext
+ * @brief What a handler is given besides its request, see `common::Dispatcher`.
+ */
+struct HandlerContext {
+    const WsDataPtr& wsData;
+    /// The concrete service, so the handlers reach `ChatRoomManager` without virtual calls.
+    ClusterRoomService& room_service;
+};
 
 /**
  * @class MessageHandlerService
@@ -23,8 +34,14 @@ class IChatRoomService;
  *
  * It holds an instance of `MessageHandlers` (containing the business logic) and
  * orchestrates the flow of data, passing the connection state (`WsDataGuarded`), the
- * request payload, and the necessary service dependencies (like `IChatRoomService`)
- * to the handler methods.
+ * request payload, and the necessary service dependencies (the `ClusterRoomService`
+ * of the connection) to the handler methods, which are instantiated for it.
+ *
+ * Routing goes through a `common::Dispatcher` table filled once in the constructor,
+ * which also times every handler and runs the middleware registered with `use()`.
+ *
+ * A request of a room in a `Tenant` group takes one of the group's slots while it runs,
+ * and is answered with `STATUS_RATE_LIMITED` when they are all taken, see `TenantQuotas`.
  */
 class MessageHandlerService {
 public:
@@ -38,23 +55,70 @@ public:
     /**
      * @brief Processes an incoming message by routing it to the correct handler.
      *
-     * @details This method inspects the `payload_case()` of the `env` parameter
-     * to determine the request type. It then `co_await`s the corresponding
-     * handler method from the `m_handlers` member, passing along all necessary
-     * context and dependencies.
+     * @details This method looks the `payload_case()` of the `env` parameter up in
+     * the dispatch table and `co_await`s the handler registered for it, passing
+     * along all necessary context and dependencies.
      *
      * @param wsData The thread-safe, guarded context for the client connection.
      * @param env The incoming request encapsulated in a Protobuf `Envelope`.
      * @param room_service A reference to the chat room service, used for any
      *        real-time state changes or broadcasts.
-     * @return A drogon::Task that resolves to a response `Envelope`, ready to
-     *         be sent back to the client.
+     * @param respEnv The response `Envelope` to fill, ready to be sent back to the
+     *        client once the task completes. Usually on the request's `RequestArena`.
+     */
+    drogon::Task<> processMessage(const WsDataPtr& wsData, const chat::Envelope& env, ClusterRoomService& room_service,
+                                  chat::Envelope& respEnv) const;
+
+    /**
+     * @brief Tells whether a request is handled synchronously, without a coroutine frame.
+     * @details True for handlers that only read the connection's state and never await,
+     * such as the typing indicators. They go through `processImmediately()`.
+     */
+    bool isImmediate(const chat::Envelope& env) const noexcept;
+
+    /**
+     * @brief Handles a request for which `isImmediate()` holds, filling `respEnv` before returning.
+     * @details Reads `wsData` without the lock, so it must run as an exclusive job of the
+     * connection, or while its `ConnectionContext` is idle.
      */
-    drogon::Task<chat::Envelope> processMessage(const WsDataPtr& wsData, const chat::Envelope& env, IChatRoomService& room_service) const;
+    void processImmediately(const WsDataPtr& wsData, const chat::Envelope& env, ClusterRoomService& room_service, chat::Envelope& respEnv) const;
+
+    /// @brief The name of a request type in metrics and traces, e.g. "JoinRoom", or "Other" for unnamed types.
+    const char* requestName(chat::Envelope::PayloadCase payload) const noexcept;
+
+    /// @brief Adds a middleware run before every handler, see `common::Dispatcher::use()`.
+    void use(common::Dispatcher<HandlerContext>::Middleware middleware) { m_dispatcher.use(std::move(middleware)); }
+
+    /**
+     * @brief Tells whether a request may run alongside other requests of the same connection.
+     * @details True only for pure reads, which neither change the connection's state nor
+     * have side effects whose order the client could observe. A batch is when all of its
+     * requests are.
+     */
+    static bool canRunConcurrently(const chat::Envelope& env) noexcept;
 
 private:
+    /**
+     * @brief Runs the requests of a batch and collects their responses, in request order.
+     * @details Requests that change state run one after the other, in order. Consecutive
+     * requests that `canRunConcurrently()` are started together and awaited as a group.
+     * Nested batches are rejected. The responses are built in place in `resp`.
+     */
+    drogon::Task<> processBatch(const WsDataPtr& wsData, const chat::BatchRequest& req, ClusterRoomService& room_service,
+                                chat::BatchResponse& resp) const;
+
+    /// @brief Fills the dispatch table with the handlers of every request type.
+    void registerHandlers();
+
+    /// @brief Installs the `RateLimiter` middleware, unless `RateLimitConfig::enabled` is off.
+    void registerRateLimits();
+
+    /// @brief Installs the middleware shedding `DbBreakerConfig::shed` while `DbCircuitBreaker` is open.
+    void registerLoadShedding();
+
     /// @brief The owned instance containing the business logic implementations for each message type.
     std::unique_ptr<MessageHandlers> m_handlers;
+    common::Dispatcher<HandlerContext> m_dispatcher;
 };
 
 } // namespace server
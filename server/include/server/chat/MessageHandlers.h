@@ -2,6 +2,12 @@
 
 #include <drogon/orm/DbClient.h>
 #include <server/chat/WsData.h>
+#include <server/chat/IChatRoomService.h>
+#include <server/chat/RoomDataCache.h>
+#include <server/chat/MessageHistoryCache.h>
+#include <server/db/MessageBatcher.h>
+#include <server/db/MessageIdAllocator.h>
+#include <server/db/DbPoolScaler.h>
 #include <server/utils/scoped_coro_transaction.h>
 
 /**
@@ -9,17 +15,8 @@
  * @brief Defines the class containing all core business logic for chat operations.
  */
 
-// Forward declaration for Drogon model to avoid including the full model header.
-namespace drogon_model {
-namespace drogon_test {
-    class Rooms;
-}
-}
-
 namespace server {
 
-class IChatRoomService;
-
 /**
  * @class MessageHandlers
  * @brief Contains the implementations of all core business logic for chat operations.
@@ -30,21 +27,30 @@ class IChatRoomService;
  *
  * - Validating incoming data (e.g., checking for empty fields, valid UTF-8).
  * - Interacting with the database via the Drogon ORM for data persistence.
- * - Calling the `IChatRoomService` to perform real-time actions like
+ * - Calling the room service to perform real-time actions like
  *   broadcasting messages or updating room membership.
  * - Modifying the connection's state (`WsData`).
  * - Constructing and returning the appropriate response message.
  *
  * All handlers are asynchronous and return a `drogon::Task`, designed to be
  * called from a coroutine context.
+ *
+ * Handlers that only read the connection's state take a plain `const WsData&`
+ * instead of locking it, see `ConnectionContext`.
+ *
+ * The handlers reaching the room service are templates over its type, instantiated in
+ * `MessageHandlers.cpp` for `ClusterRoomService` and for `IChatRoomService`, see `ChatRoomService`.
  */
 class MessageHandlers {
 public:
     /**
-     * @brief Constructs the handlers with a database client.
-     * @param dbClient A shared pointer to the Drogon database client, used for all ORM operations.
+     * @brief Constructs the handlers with their database clients.
+     * @param dbClient A shared pointer to the Drogon database client on the primary, used for all writes.
+     * @param readDbClient The client for read-only handlers, possibly a replica. Defaults to `dbClient`.
+     * @details With `DatabaseConfig::fast_write_client` or `fast_read_client` set, the handlers use
+     * the fast client of their IO loop instead, see `loopWriteDbClient()`.
      */
-    explicit MessageHandlers(drogon::orm::DbClientPtr dbClient);
+    explicit MessageHandlers(drogon::orm::DbClientPtr dbClient, drogon::orm::DbClientPtr readDbClient = nullptr);
 
     /** @brief Handles the first step of user authentication (salt retrieval). */
     drogon::Task<chat::InitialAuthResponse> handleAuthInitial(const WsDataPtr& wsDataGuarded, const chat::InitialAuthRequest& req) const;
@@ -53,59 +59,122 @@ public:
     drogon::Task<chat::InitialRegisterResponse> handleRegisterInitial(const WsDataPtr& wsDataGuarded, const chat::InitialRegisterRequest& req) const;
     
     /** @brief Handles the final step of user authentication (hash verification). */
-    drogon::Task<chat::AuthResponse> handleAuth(const WsDataPtr& wsDataGuarded, const chat::AuthRequest& req, IChatRoomService& room_service) const;
+    template<ChatRoomService RoomService>
+    drogon::Task<chat::AuthResponse> handleAuth(const WsDataPtr& wsDataGuarded, const chat::AuthRequest& req, RoomService& room_service) const;
+    
+    /** @brief Handles a login with a resumption token, checked in `SessionTokens` instead of the database. */
+    template<ChatRoomService RoomService>
+    drogon::Task<chat::ResumeSessionResponse> handleResumeSession(const WsDataPtr& wsDataGuarded, const chat::ResumeSessionRequest& req, RoomService& room_service) const;
     
     /** @brief Handles the final step of user registration (storing user credentials). */
     drogon::Task<chat::RegisterResponse> handleRegister(const WsDataPtr& wsDataGuarded, const chat::RegisterRequest& req) const;
     
     /** @brief Handles a request to send a message to the user's current room. */
-    drogon::Task<chat::SendMessageResponse> handleSendMessage(const WsDataPtr& wsDataGuarded, const chat::SendMessageRequest& req, IChatRoomService& room_service) const;
+    template<ChatRoomService RoomService>
+    drogon::Task<chat::SendMessageResponse> handleSendMessage(const WsData& wsData, const chat::SendMessageRequest& req, RoomService& room_service) const;
     
-    /** @brief Handles a request for a user to join a chat room. */
-    drogon::Task<chat::JoinRoomResponse> handleJoinRoom(const WsDataPtr& wsDataGuarded, const chat::JoinRoomRequest& req, IChatRoomService& room_service) const;
+    /** @brief Handles a request for a user to join a chat room, with the history page it may ask for. */
+    template<ChatRoomService RoomService>
+    drogon::Task<chat::JoinRoomResponse> handleJoinRoom(const WsDataPtr& wsDataGuarded, const chat::JoinRoomRequest& req, RoomService& room_service) const;
     
     /** @brief Handles a request for a user to leave their current chat room. */
-    drogon::Task<chat::LeaveRoomResponse> handleLeaveRoom(const WsDataPtr& wsDataGuarded, const chat::LeaveRoomRequest&, IChatRoomService& room_service) const;
+    template<ChatRoomService RoomService>
+    drogon::Task<chat::LeaveRoomResponse> handleLeaveRoom(const WsDataPtr& wsDataGuarded, const chat::LeaveRoomRequest&, RoomService& room_service) const;
     
     /** @brief Handles a request from a user to create a new chat room. */
-    drogon::Task<chat::CreateRoomResponse> handleCreateRoom(const WsDataPtr& wsDataGuarded, const chat::CreateRoomRequest& req, IChatRoomService& room_service) const;
+    template<ChatRoomService RoomService>
+    drogon::Task<chat::CreateRoomResponse> handleCreateRoom(const WsDataPtr& wsDataGuarded, const chat::CreateRoomRequest& req, RoomService& room_service) const;
     
-    /** @brief Handles a request to retrieve a batch of historical messages from the user's current room. */
-    drogon::Task<chat::GetMessagesResponse> handleGetMessages(const WsDataPtr& wsDataGuarded, const chat::GetMessagesRequest& req) const;
+    /**
+     * @brief Handles a request to retrieve a batch of historical messages from the user's current room.
+     * @details Fills `resp` in place, so a page lands directly on the arena of the response, if any.
+     */
+    drogon::Task<> handleGetMessages(const WsData& wsData, const chat::GetMessagesRequest& req, chat::GetMessagesResponse& resp) const;
+
+    /**
+     * @brief Handles a request for the messages around one of the user's current room, so a client jumps to it in one round trip.
+     * @details Read in one query by seq on either side of the message, see `Repository::findMessagesAround()`.
+     */
+    drogon::Task<> handleGetMessagesAround(const WsData& wsData, const chat::GetMessagesAroundRequest& req, chat::GetMessagesAroundResponse& resp) const;
+
+    /**
+     * @brief Handles a request for the messages sent and deleted in the current room after a cursor.
+     * @details Both are read up to a page each, the cursor then stops where the shorter of the
+     * two ran out so neither skips anything, and `has_more` asks the client to continue from it.
+     * With a `since_seq` the messages are read by seq instead, and each list has a cursor of its own.
+     */
+    drogon::Task<> handleSyncRoom(const WsData& wsData, const chat::SyncRoomRequest& req, chat::SyncRoomResponse& resp) const;
+
+    /**
+     * @brief Handles a request moving the user's read cursor of a room forward.
+     * @details The cursor is capped at the room's last seq, so a client cannot mark messages
+     * read ahead of time. Any room can be marked, the cursor only concerns the user.
+     */
+    drogon::Task<> handleMarkRoomRead(const WsData& wsData, const chat::MarkRoomReadRequest& req, chat::MarkRoomReadResponse& resp) const;
+
+    /**
+     * @brief Handles a request for a page of the members of the user's current room, see `GetRoomMembersRequest`.
+     * @details It is read one member past the page to tell whether more follow.
+     */
+    drogon::Task<> handleGetRoomMembers(const WsData& wsData, const chat::GetRoomMembersRequest& req, chat::GetRoomMembersResponse& resp) const;
+
+    /**
+     * @brief Handles a full-text search of the messages of the rooms the user can see.
+     * @details A page of hits, newest first. It is read one hit past the page to tell whether more follow.
+     */
+    drogon::Task<> handleSearchMessages(const WsData& wsData, const chat::SearchMessagesRequest& req, chat::SearchMessagesResponse& resp) const;
     
     /** @brief Handles a user's request to log out. */
-    drogon::Task<chat::LogoutResponse> handleLogoutUser(const WsDataPtr& wsDataGuarded, IChatRoomService& room_service) const;
+    template<ChatRoomService RoomService>
+    drogon::Task<chat::LogoutResponse> handleLogoutUser(const WsDataPtr& wsDataGuarded, RoomService& room_service) const;
 
     /** @brief Handles a request to rename an existing room. */
-    drogon::Task<chat::RenameRoomResponse> handleRenameRoom(const WsDataPtr& wsDataGuarded, const chat::RenameRoomRequest& req, IChatRoomService& room_service);
+    template<ChatRoomService RoomService>
+    drogon::Task<chat::RenameRoomResponse> handleRenameRoom(const WsDataPtr& wsDataGuarded, const chat::RenameRoomRequest& req, RoomService& room_service);
 
     /** @brief Handles a request to delete an existing room and all its messages. */
-    drogon::Task<chat::DeleteRoomResponse> handleDeleteRoom(const WsDataPtr& wsDataGuarded, const chat::DeleteRoomRequest& req, IChatRoomService& room_service);
+    template<ChatRoomService RoomService>
+    drogon::Task<chat::DeleteRoomResponse> handleDeleteRoom(const WsDataPtr& wsDataGuarded, const chat::DeleteRoomRequest& req, RoomService& room_service);
     
     /** @brief Handles a request to assign a new role to a user in a specific room. */
-    drogon::Task<chat::AssignRoleResponse> handleAssignRole(const WsDataPtr&, const chat::AssignRoleRequest&, IChatRoomService&);
+    template<ChatRoomService RoomService>
+    drogon::Task<chat::AssignRoleResponse> handleAssignRole(const WsDataPtr&, const chat::AssignRoleRequest&, RoomService&);
 
     /** @brief Handles a request to delete message from current room. */
-    drogon::Task<chat::DeleteMessageResponse> handleDeleteMessage(const WsDataPtr&, const chat::DeleteMessageRequest&, IChatRoomService&);
+    template<ChatRoomService RoomService>
+    drogon::Task<chat::DeleteMessageResponse> handleDeleteMessage(const WsDataPtr&, const chat::DeleteMessageRequest&, RoomService&);
+
+    /** @brief Handles a moderator's request to delete the newest messages of a user in the current room. */
+    template<ChatRoomService RoomService>
+    drogon::Task<chat::DeleteUserMessagesResponse> handleDeleteUserMessages(const WsDataPtr&, const chat::DeleteUserMessagesRequest&, RoomService&);
 
-	/** @brief Handles a request to start typing in the current room. */
-	drogon::Task<chat::UserTypingStartResponse> handleUserTypingStart(const WsDataPtr& wsDataGuarded, IChatRoomService& room_service) const;
+	/** @brief Handles a request to (un)subscribe to the room directory. Never suspends, so it is a plain call. */
+	template<ChatRoomService RoomService>
+	void handleSubscribeRooms(const WsData& wsData, const chat::SubscribeRoomsRequest& req, RoomService& room_service, chat::SubscribeRoomsResponse& resp) const;
 
-	/** @brief Handles a request to stop typing in the current room. */
-	drogon::Task<chat::UserTypingStopResponse> handleUserTypingStop(const WsDataPtr& wsDataGuarded, IChatRoomService& room_service) const;
+	/** @brief Handles a request to start typing in the current room. Never suspends, so it is a plain call. */
+	template<ChatRoomService RoomService>
+	void handleUserTypingStart(const WsData& wsData, RoomService& room_service, chat::UserTypingStartResponse& resp) const;
+
+	/** @brief Handles a request to stop typing in the current room. Never suspends, so it is a plain call. */
+	template<ChatRoomService RoomService>
+	void handleUserTypingStop(const WsData& wsData, RoomService& room_service, chat::UserTypingStopResponse& resp) const;
 
     drogon::Task<chat::BecomeMemberResponse> handleBecomeMember(const WsDataPtr& wsDataGuarded, const chat::BecomeMemberRequest& req);
 
     /** @brief Handles a request to change username. */
-    drogon::Task<chat::ChangeUsernameResponse> handleChangeUsername(const WsDataPtr& wsDataGuarded, const chat::ChangeUsernameRequest& req, IChatRoomService& room_service);
+    template<ChatRoomService RoomService>
+    drogon::Task<chat::ChangeUsernameResponse> handleChangeUsername(const WsDataPtr& wsDataGuarded, const chat::ChangeUsernameRequest& req, RoomService& room_service);
 
     /** @brief Handles a request to get salt when changing password. */
-    drogon::Task<chat::GetMySaltResponse> handleGetSalt(const WsDataPtr& wsDataGuarded);
+    drogon::Task<chat::GetMySaltResponse> handleGetSalt(const WsData& wsData);
 
     /** @brief Handles a request to change password. */
     drogon::Task<chat::ChangePasswordResponse> handleChangePassword(const WsDataPtr& wsDataGuarded, const chat::ChangePasswordRequest& req);
 
-private:
+    /** @brief Handles a request to compress the larger responses of the connection. */
+    drogon::Task<chat::SetCompressionResponse> handleSetCompression(const WsDataPtr& wsDataGuarded, const chat::SetCompressionRequest& req) const;
+
     /**
      * @brief Validates a string for valid UTF-8 encoding and maximum length.
      * @param textToValidate The string to check.
@@ -113,8 +182,17 @@ private:
      * @param fieldName The name of the field being validated (for error messages).
      * @return An optional string containing an error message if validation fails, or std::nullopt on success.
      */
-    std::optional<std::string> validateUtf8String(const std::string_view& textToValidate, size_t maxLength, const std::string_view& fieldName) const;
+    static std::optional<std::string> validateUtf8String(const std::string_view& textToValidate, size_t maxLength, const std::string_view& fieldName);
 
+    /**
+     * @brief Validates a user or room name: valid UTF-8 within maxLength, with at least one letter or digit.
+     * @details The same rule as the client's TextUtil::SanitizeInput(), so a name made only of
+     * spaces, punctuation or emoji is turned down whichever client sent it.
+     * @return An optional string containing an error message if validation fails, or std::nullopt on success.
+     */
+    static std::optional<std::string> validateName(const std::string_view& name, size_t maxLength, const std::string_view& fieldName);
+
+private:
     /**
      * @brief Determines a user's rights (e.g., ADMIN, OWNER) for a specific room.
      * @param db DbClientPtr
@@ -129,13 +207,26 @@ private:
      * @param db DbClientPtr
      * @param user_id The ID of the user.
      * @param room_id The ID of the room.
-     * @param room A pre-fetched room model object.
+     * @param room A pre-fetched room.
      * @return A task resolving to an optional UserRights enum.
      */
-    drogon::Task<std::optional<chat::UserRights>> getUserRights(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id, const drogon_model::drogon_test::Rooms& room) const;
+    drogon::Task<std::optional<chat::UserRights>> getUserRights(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id, const CachedRoom& room) const;
+
+    /**
+     * @brief Checks whether a user is a global admin.
+     * @note Served from `RoomDataCache` unless `db` is a transaction.
+     */
+    drogon::Task<bool> isGlobalAdmin(const drogon::orm::DbClientPtr& db, int32_t user_id) const;
 
     /**
-     * @brief Helper to query the `user_room_roles` table for an explicit role assignment.
+     * @brief Fetches a room through `RoomDataCache`, falling back to the database.
+     * @return The room, or std::nullopt if it does not exist.
+     */
+    drogon::Task<std::optional<CachedRoom>> findRoom(int32_t room_id) const;
+
+    /**
+     * @brief Helper to query the `user_room_data` table for an explicit role assignment.
+     * @note Served from `RoomDataCache` unless `db` is a transaction.
      * @param db DbClientPtr
      * @param user_id The ID of the user.
      * @param room_id The ID of the room.
@@ -143,6 +234,27 @@ private:
      */
     drogon::Task<std::optional<chat::UserRights>> findStoredUserRole(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id) const;
 
+    /**
+     * @brief Persists a new chat message, through `MessageBatcher` when batching is enabled.
+     * @param stored Receives the assigned message ID, timestamp and seq on success, or holds them already when `reserved` is set.
+     * @param reserved Whether `stored` carries an ID and seq reserved through `reserveMessageSeq` and
+     * `MessageIdAllocator` that must be written as is. The seq is released when the insert fails.
+     * @return std::nullopt on success, or an error message.
+     */
+    drogon::Task<ScopedTransactionResult> persistMessage(int32_t room_id, int32_t user_id, const std::string& text, StoredMessage& stored, bool reserved = false) const;
+
+    /// @brief The insert of `persistMessage`, without the release of a reserved seq.
+    drogon::Task<ScopedTransactionResult> insertMessage(int32_t room_id, int32_t user_id, const std::string& text, StoredMessage& stored, bool reserved) const;
+
+    /// @brief The part of `handleSyncRoom` for requests with a `since_seq`, once they are checked.
+    drogon::Task<> syncRoomBySeq(const chat::SyncRoomRequest& req, chat::SyncRoomResponse& resp) const;
+
+    /// @brief Reserves the seq of a message broadcast before it is persisted. nullopt if the database or the room failed.
+    drogon::Task<std::optional<int64_t>> reserveMessageSeq(int32_t room_id) const;
+
+    /// @brief Releases a reserved seq whose message is not inserted, logging a failure.
+    drogon::Task<> releaseMessageSeq(int32_t room_id, int64_t seq) const;
+
     /** @brief Updates or creates a user's role entry in the UserRoomData table within a transaction. */
     static drogon::Task<ScopedTransactionResult> updateUserRoleInDb(const std::shared_ptr<drogon::orm::Transaction>& tx, int32_t userId, int32_t roomId, chat::UserRights newRole);
 
@@ -150,8 +262,25 @@ private:
     static drogon::Task<ScopedTransactionResult> setUserMembershipStatus(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id, chat::MembershipStatus status);
 
 
+    /// @brief The client for the next write on the current IO loop.
+    drogon::orm::DbClientPtr writeDb() const {
+        return m_fast_writes ? loopWriteDbClient() : m_write_pool ? m_write_pool->pick() : m_dbClient;
+    }
+    /// @brief The client for the next read on the current IO loop.
+    drogon::orm::DbClientPtr readDb() const {
+        return m_fast_reads ? loopReadDbClient() : m_read_pool ? m_read_pool->pick() : m_readDbClient;
+    }
+
     /// @brief The shared database client for all ORM operations.
     drogon::orm::DbClientPtr m_dbClient;
+    /// @brief The client used by read-only handlers, which tolerate replication lag.
+    drogon::orm::DbClientPtr m_readDbClient;
+    /// @brief The pools the clients above are picked from while `DbPoolConfig` resizes them, or null.
+    ElasticDbPool* m_write_pool;
+    ElasticDbPool* m_read_pool;
+    /// @brief Whether the fast clients of the IO loops stand in for the clients above.
+    bool m_fast_writes;
+    bool m_fast_reads;
 };
 
 } // namespace server
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <server/db/MessageBatcher.h>
+#include <cstddef>
+
+/**
+ * @file MessageHistoryCache.h
+ * @brief Defines the in-memory tail of recent messages per room, serving the latest history pages.
+ */
+
+namespace server {
+
+/**
+ * @class MessageHistoryCache
+ * @brief A thread-safe singleton holding the most recent messages of each active room.
+ *
+ * @details Every client joining a room asks for the same latest page, so the tail of
+ * each room is kept as a ring of at most `HistoryCacheConfig::messages_per_room` entries,
+ * ordered by seq. A room's ring holds every message from its oldest entry onward,
+ * so any page that falls entirely within it can be answered without the database.
+ * Requests reaching further back than the ring are left to the caller.
+ *
+ * A ring is loaded lazily by `fill()` and then kept current by the handlers that send and
+ * delete messages. To avoid installing a tail read before a concurrent change, a caller
+ * takes `version()` before querying and passes it to `fill()`, which then discards stale data.
+ */
+class MessageHistoryCache {
+public:
+    /**
+     * @brief Gets the singleton instance of the MessageHistoryCache.
+     * @return A reference to the single MessageHistoryCache instance.
+     */
+    static MessageHistoryCache& instance();
+
+    /// @brief Whether the tail of a room is currently cached.
+    bool contains(int32_t room_id) const;
+
+    /**
+     * @brief Answers a history page from the cache, with the same semantics as `GetMessagesRequest`.
+     * @param limit A positive value returns up to `limit` messages older than `offset`, newest first;
+     * a negative value returns up to `-limit` messages newer than `offset`, oldest first.
+     * @param offset A timestamp or, keyed by `HistoryKey::Seq`, a seq.
+     * @param out Receives the page, copied straight into its arena if it has one. Left untouched on a miss.
+     * @return Whether the cache could answer the page completely.
+     */
+    bool find(int32_t room_id, int32_t limit, int64_t offset, google::protobuf::RepeatedPtrField<chat::MessageInfo>& out,
+              HistoryKey key = HistoryKey::Timestamp) const;
+
+    /// @brief Returns the change counter of a room, to be passed back to `fill()`.
+    uint64_t version(int32_t room_id) const;
+
+    /**
+     * @brief Installs the tail of a room read from the database.
+     * @param newest_first The most recent messages of the room, by seq and newest first.
+     * @param has_all Whether these are all the messages of the room.
+     * @param observed_version The value of `version()` taken before the query.
+     */
+    void fill(int32_t room_id, std::vector<chat::MessageInfo> newest_first, bool has_all, uint64_t observed_version);
+
+    /// @brief Adds a message that was just sent to a room.
+    void append(int32_t room_id, const chat::MessageInfo& message);
+
+    /// @brief Removes a deleted or retracted message.
+    void remove(int32_t room_id, int32_t message_id);
+
+    /// @brief Drops the tail of a deleted room.
+    void dropRoom(int32_t room_id);
+
+    /// @brief Updates the author name of every cached message of a user.
+    void renameUser(int32_t user_id, const std::string& new_name);
+
+private:
+    MessageHistoryCache() = default;
+    MessageHistoryCache(const MessageHistoryCache&) = delete;
+    MessageHistoryCache& operator=(const MessageHistoryCache&) = delete;
+
+    /// @brief The upper bound of cached rooms. A full cache is simply cleared, it will refill lazily.
+    static constexpr size_t MAX_ROOMS = 10'000;
+
+    /// @brief The cached tail of one room, oldest first.
+    struct RoomTail {
+        std::deque<chat::MessageInfo> messages;
+        /// Whether the room has no messages older than the ones cached.
+        bool has_all = false;
+    };
+
+    /// @brief Marks a room as changed, failing fills that started before. Assumes `m_mutex` is held exclusively.
+    void bump_unsafe(int32_t room_id);
+
+    /// @brief The current version of a room. Assumes `m_mutex` is held.
+    uint64_t version_unsafe(int32_t room_id) const;
+
+    mutable std::shared_mutex m_mutex;
+    std::unordered_map<int32_t, RoomTail> m_rooms;
+    std::unordered_map<int32_t, uint64_t> m_versions;
+    /// @brief Bumped by changes spanning every room, such as a user rename.
+    uint64_t m_global_version = 0;
+};
+
+} // namespace server
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <server/db/MessageBatcher.h>
+#include <mutex>
+
+/**
+ * @file MessageKeys.h
+ * @brief Defines the deduplication of retried messages by their client key.
+ */
+
+namespace server {
+
+/**
+ * @class MessageKeys
+ * @brief A thread-safe singleton remembering the messages sent with a `client_key`, so a retry returns the original.
+ *
+ * @details A client that timed out on a `SendMessageRequest` sends it again with the same key.
+ * The key is looked up in memory first, which answers a retry on the same server without a
+ * round trip. Otherwise `claim()` records the key with the identity reserved for the new
+ * message in `message_client_keys`, whose primary key makes sure only one of the attempts
+ * wins, on whichever server they arrive.
+ *
+ * Keys are remembered for `MessageDeliveryConfig::dedupe_window`, in memory and in the table.
+ *
+ * @note A claim is made before the message is persisted. A message whose identity is reserved
+ * up front is claimed with it, one taking its identity from the insert claims the key pending
+ * and `settle()`s it afterwards. A message that fails to persist is released so it can be sent
+ * again. A retry finding a holder that was never stored is asked to retry, once the claim is a
+ * minute old its server is taken to have died and the retry takes the key over.
+ */
+class MessageKeys {
+public:
+    /**
+     * @brief Gets the singleton instance of the MessageKeys.
+     * @return A reference to the single MessageKeys instance.
+     */
+    static MessageKeys& instance();
+
+    /// @brief The message a user sent with a key, if this server still remembers it.
+    std::optional<StoredMessage> find(int32_t user_id, const std::string& key);
+
+    /**
+     * @brief Claims a key for a message with the identity reserved for it.
+     * @param stored The reserved identity, or one with only `created_at` set to claim the key pending.
+     * @return The original message if the key was claimed before and it was stored, nullopt if this message now holds it.
+     * @throws drogon::orm::DrogonDbException on database errors.
+     * @throws std::runtime_error if the key is held by an attempt committed too late to be read back or still being stored, the client retries again.
+     */
+    drogon::Task<std::optional<StoredMessage>> claim(const drogon::orm::DbClientPtr& db, int32_t user_id, const std::string& key, const StoredMessage& stored);
+
+    /**
+     * @brief Records the identity of a message whose key was claimed pending, once it is persisted.
+     * @param claimed_at The `created_at` the key was claimed with.
+     * @details Errors are logged, a retry then sees a message that was never stored and sends it again once the claim is stale.
+     */
+    drogon::Task<> settle(const drogon::orm::DbClientPtr& db, int32_t user_id, const std::string& key, int64_t claimed_at, const StoredMessage& stored);
+
+    /// @brief Releases a key whose message failed to persist. Errors are logged, the key then stays until the window ends.
+    drogon::Task<> release(const drogon::orm::DbClientPtr& db, int32_t user_id, const std::string& key);
+
+private:
+    MessageKeys() = default;
+    MessageKeys(const MessageKeys&) = delete;
+    MessageKeys& operator=(const MessageKeys&) = delete;
+
+    struct Entry {
+        StoredMessage message;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    /// @brief Remembers a key in memory.
+    void remember(int32_t user_id, const std::string& key, const StoredMessage& message);
+
+    /// @brief Arms the periodic sweep on first use.
+    void ensureTimer();
+
+    /// @brief Drops the expired keys from memory and purges those of the table.
+    void sweep();
+
+    std::mutex m_mutex;
+    /// Keyed by the user ID and the key, see `entryKey`.
+    std::unordered_map<std::string, Entry> m_entries;
+    std::once_flag m_timer_started;
+};
+
+} // namespace server
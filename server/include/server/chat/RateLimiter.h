@@ -0,0 +1,100 @@
+#pragma once
+
+#include <server/utils/server_config.h>
+#include <common/utils/metrics.h>
+#include <mutex>
+
+/**
+ * @file RateLimiter.h
+ * @brief Defines the token bucket rate limits applied to client requests.
+ */
+
+namespace server {
+
+/**
+ * @class TokenBucket
+ * @brief Holds up to `burst` tokens, refilled at `rate` per second. Each request takes one.
+ * @note Not thread-safe, `RateLimiter` guards its buckets.
+ */
+class TokenBucket {
+public:
+    /// @brief Takes a token if one is left. A fresh bucket starts full.
+    bool take(const RateLimit& limit, std::chrono::steady_clock::time_point now) noexcept;
+
+    /// @brief Whether the bucket has refilled completely, in which case it is no different from a fresh one.
+    bool full(const RateLimit& limit, std::chrono::steady_clock::time_point now) const noexcept;
+
+private:
+    double m_tokens = -1;
+    std::chrono::steady_clock::time_point m_updated;
+};
+
+/**
+ * @class RateLimiter
+ * @brief A thread-safe singleton enforcing `RateLimitConfig` per connection and per user.
+ *
+ * @details A request is admitted if both the bucket of its connection and, once authenticated,
+ * the bucket of its user have a token for its request type. Installed as a middleware of
+ * `MessageHandlerService`, so a rejected request never reaches its handler and is answered
+ * with `STATUS_RATE_LIMITED` in its usual response type. Requests inside a batch count one by one.
+ *
+ * Buckets that have refilled completely are swept periodically, a connection's buckets are
+ * also dropped by `forget()` when it closes.
+ */
+class RateLimiter {
+public:
+    /**
+     * @brief Gets the singleton instance of the RateLimiter.
+     * @return A reference to the single RateLimiter instance.
+     */
+    static RateLimiter& instance();
+
+    /**
+     * @brief Sets the limits of a request type. Called once per route at startup.
+     * @param payload The payload case of the request.
+     * @param name The handler name the limits are configured under.
+     */
+    void configure(chat::Envelope::PayloadCase payload, const std::string& name, const RateLimitConfig& cfg);
+
+    /**
+     * @brief Takes a token for a request from the buckets of its connection and user.
+     * @param connection_id Identifies the connection, its `WsData::connection_id`.
+     * @param user_id The authenticated user, if any.
+     * @return Whether the request may run.
+     */
+    bool admit(uint64_t connection_id, std::optional<int32_t> user_id, chat::Envelope::PayloadCase payload);
+
+    /// @brief Drops the buckets of a closed connection.
+    void forget(uint64_t connection_id);
+
+private:
+    RateLimiter() = default;
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    /// @brief The limits of one request type.
+    struct Rule {
+        RateLimit connection;
+        RateLimit user;
+        common::Counter* rejected = nullptr;
+    };
+
+    /// @brief Buckets of one connection or user, keyed by payload case.
+    using Buckets = std::unordered_map<int, TokenBucket>;
+
+    /// @brief Arms the periodic sweep on first use.
+    void ensureTimer();
+
+    /// @brief Drops the buckets that have refilled.
+    void sweep();
+
+    /// Indexed by payload case, written only at startup.
+    std::vector<Rule> m_rules;
+    std::mutex m_mutex;
+    /// By connection id, a new connection may get the address of a closed one's `WsData`.
+    std::unordered_map<uint64_t, Buckets> m_connections;
+    std::unordered_map<int32_t, Buckets> m_users;
+    std::once_flag m_timer_started;
+};
+
+} // namespace server
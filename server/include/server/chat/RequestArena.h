@@ -0,0 +1,57 @@
+#pragma once
+
+#include <google/protobuf/arena.h>
+#include <memory>
+
+/**
+ * @file RequestArena.h
+ * @brief Defines the protobuf arena a client request and its response are allocated on.
+ */
+
+namespace server {
+
+/**
+ * @struct RequestArena
+ * @brief Owns the request and response envelopes of one client request and everything they allocate.
+ *
+ * @details The request is parsed into `request` and the handler fills `response` in place,
+ * so every string, `UserInfo` and `MessageInfo` of the exchange comes from the arena's
+ * blocks and is released in one go when the last reference to it is dropped. A history
+ * page of a hundred messages is then a single free instead of several hundred.
+ *
+ * Handlers that still return their response by value have it copied into `response`,
+ * which is cheap for a status and a few scalars.
+ *
+ * @note Assigning a message from another arena, or from the heap, copies instead of
+ * moving. Messages meant for `response` are best built through its `mutable_*()` and
+ * `add_*()` accessors.
+ */
+struct RequestArena {
+    RequestArena()
+        : arena(options()),
+          request(google::protobuf::Arena::Create<chat::Envelope>(&arena)),
+          response(google::protobuf::Arena::Create<chat::Envelope>(&arena)) {}
+
+    RequestArena(const RequestArena&) = delete;
+    RequestArena& operator=(const RequestArena&) = delete;
+
+    /// @brief The response of an exchange, keeping the whole arena alive for as long as it is referenced.
+    static std::shared_ptr<const chat::Envelope> responseOf(const std::shared_ptr<RequestArena>& exchange) {
+        return {exchange, exchange->response};
+    }
+
+    google::protobuf::Arena arena;
+    chat::Envelope* request;
+    chat::Envelope* response;
+
+private:
+    /// Most exchanges fit in the first block, large history pages grow it up to 64 KiB at a time.
+    static google::protobuf::ArenaOptions options() {
+        google::protobuf::ArenaOptions opts;
+        opts.start_block_size = 1024;
+        opts.max_block_size = 64 * 1024;
+        return opts;
+    }
+};
+
+} // namespace server
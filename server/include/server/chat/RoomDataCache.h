@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * @file RoomDataCache.h
+ * @brief Defines the process-wide cache of rarely changing room and rights data.
+ */
+
+namespace server {
+
+/**
+ * @struct CachedRoom
+ * @brief The subset of a `rooms` row the handlers need for access and rights checks.
+ */
+struct CachedRoom {
+    /// The unique identifier of the room.
+    int32_t id;
+    /// The current display name of the room.
+    std::string name;
+    /// The owner of the room, if any.
+    std::optional<int32_t> owner_id;
+    /// Whether the room can only be joined by invited members.
+    bool is_private = false;
+};
+
+/**
+ * @class RoomDataCache
+ * @brief A thread-safe singleton caching room metadata, memberships, moderator flags and admin flags.
+ *
+ * @details Rooms, owners and per-room roles change rarely compared to how often they
+ * are read on joins, sends and role checks. This cache is populated lazily by the
+ * handlers and invalidated by the handlers that modify the underlying tables.
+ *
+ * Lookups of per-(room, user) data return a nested optional: an empty outer optional
+ * means "not cached", while an empty inner optional is a cached negative result
+ * (e.g. the user has no membership row).
+ *
+ * To avoid re-populating the cache with a value read before a concurrent write, a
+ * caller takes `generation()` before querying the database and passes it to the
+ * `put*` method. If any invalidation happened in between, the value is discarded.
+ *
+ * @note The cache is local to this process. Writes made by the other servers on the same
+ * database are evicted through `CacheInvalidation`, writes made outside the handlers are not.
+ */
+class RoomDataCache {
+public:
+    /// @brief A cache lookup result, empty when the key is not cached.
+    template <typename T>
+    using Lookup = std::optional<T>;
+
+    /**
+     * @brief Gets the singleton instance of the RoomDataCache.
+     * @return A reference to the single RoomDataCache instance.
+     */
+    static RoomDataCache& instance();
+
+    /// @brief Returns the current invalidation generation, to be passed back to the `put*` methods.
+    uint64_t generation() const;
+
+    Lookup<CachedRoom> getRoom(int32_t room_id) const;
+    void putRoom(const CachedRoom& room, uint64_t observed_generation);
+
+    Lookup<std::optional<chat::MembershipStatus>> getMembership(int32_t room_id, int32_t user_id) const;
+    void putMembership(int32_t room_id, int32_t user_id, std::optional<chat::MembershipStatus> status, uint64_t observed_generation);
+
+    Lookup<std::optional<chat::UserRights>> getStoredRole(int32_t room_id, int32_t user_id) const;
+    void putStoredRole(int32_t room_id, int32_t user_id, std::optional<chat::UserRights> role, uint64_t observed_generation);
+
+    Lookup<bool> getIsAdmin(int32_t user_id) const;
+    void putIsAdmin(int32_t user_id, bool is_admin, uint64_t observed_generation);
+
+    /**
+     * @brief Drops everything cached about a room: its metadata and all of its per-user entries.
+     * @details Used after a room is deleted, renamed or changes owner.
+     */
+    void invalidateRoom(int32_t room_id);
+
+    /// @brief Drops the cached membership and stored role of one user in one room.
+    void invalidateRoomUser(int32_t room_id, int32_t user_id);
+
+private:
+    RoomDataCache() = default;
+    RoomDataCache(const RoomDataCache&) = delete;
+    RoomDataCache& operator=(const RoomDataCache&) = delete;
+
+    /// @brief The upper bound of entries per map. A full map is simply cleared, it will refill lazily.
+    static constexpr size_t MAX_ENTRIES = 100'000;
+
+    /// @brief Everything cached about one user in one room.
+    struct RoomUserData {
+        Lookup<std::optional<chat::MembershipStatus>> membership;
+        Lookup<std::optional<chat::UserRights>> stored_role;
+    };
+
+    /// @brief Whether a `put` taken at `observed_generation` is still allowed. Assumes `m_mutex` is held.
+    bool isCurrent_unsafe(uint64_t observed_generation) const noexcept;
+
+    /// @brief Returns the (possibly new) entry for a user in a room. Assumes `m_mutex` is held exclusively.
+    RoomUserData& roomUser_unsafe(int32_t room_id, int32_t user_id);
+
+    /// @brief Looks up the entry for a user in a room. Assumes `m_mutex` is held.
+    const RoomUserData* findRoomUser_unsafe(int32_t room_id, int32_t user_id) const;
+
+    mutable std::shared_mutex m_mutex;
+    uint64_t m_generation = 0;
+
+    std::unordered_map<int32_t, CachedRoom> m_rooms;
+    /// @brief Room ID to user ID to the per-user data, so a whole room can be dropped at once.
+    std::unordered_map<int32_t, std::unordered_map<int32_t, RoomUserData>> m_room_users;
+    size_t m_room_user_entries = 0;
+    std::unordered_map<int32_t, bool> m_admins;
+};
+
+} // namespace server
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/**
+ * @file ServerDrain.h
+ * @brief Defines the graceful shutdown moving the clients to the other servers over time.
+ */
+
+namespace server {
+
+/**
+ * @class ServerDrain
+ * @brief A singleton driving the shutdown of the server on SIGTERM, and the draining flag it sets.
+ *
+ * @details Stopping a server outright drops all of its connections at once, and their clients
+ * all log in again elsewhere in the same few seconds. A drain spreads that out instead:
+ *
+ * - the aggregator stops listing the server and placing rooms on it;
+ * - new WebSocket connections are refused and `/ready` answers 503;
+ * - every client gets a `ServerDraining` with one of the other servers, picked by spare
+ *   capacity, and a reconnect delay drawn within `DrainConfig::spread`;
+ * - the server stops once its clients are gone, or after `DrainConfig::timeout`.
+ *
+ * A second SIGTERM stops the server right away.
+ *
+ * An upgrade in place drains the same way, except that the clients are sent to this server's
+ * own address, which the successor shares, see `startUpgrade()`.
+ */
+class ServerDrain {
+public:
+    /**
+     * @brief Gets the singleton instance of the ServerDrain.
+     * @return A reference to the single ServerDrain instance.
+     */
+    static ServerDrain& instance();
+
+    /// @brief Starts draining, or stops the server if it is draining already. Called on the main loop.
+    void start();
+
+    /**
+     * @brief Starts draining for the process that took over this one's host, see `UpgradeHandoff`. Called on the main loop.
+     * @details The aggregator is left to the successor, and the clients are sent back to this
+     * server's own address after their delay, where the successor takes them.
+     */
+    void startUpgrade();
+
+    /// @brief Whether the server is shutting down and takes no new clients.
+    bool draining() const noexcept { return m_draining.load(std::memory_order_acquire); }
+
+    /// @brief Whether it is shutting down for a successor on the same address, clients connecting should just retry.
+    bool upgrading() const noexcept { return m_upgrading.load(std::memory_order_acquire); }
+
+private:
+    ServerDrain() = default;
+    ServerDrain(const ServerDrain&) = delete;
+    ServerDrain& operator=(const ServerDrain&) = delete;
+
+    /// @brief Tells every client where to go and when, once. The hosts come ranked by the aggregator.
+    void notifyClients(std::vector<chat::ServerNodeInfo> servers);
+
+    /// @brief Arms the deadline and the periodic check, once draining started.
+    void armDeadline();
+
+    /// @brief Stops the server once the clients are gone or the timeout passed.
+    void checkDone();
+
+    std::atomic<bool> m_draining{false};
+    std::atomic<bool> m_upgrading{false};
+    std::once_flag m_notified;
+    std::chrono::steady_clock::time_point m_deadline;
+};
+
+} // namespace server
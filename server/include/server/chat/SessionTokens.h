@@ -0,0 +1,101 @@
+#pragma once
+
+#include <server/chat/WsData.h>
+#include <mutex>
+
+/**
+ * @file SessionTokens.h
+ * @brief Defines the store of the resumption tokens handed out on login.
+ */
+
+namespace server {
+
+/**
+ * @class SessionTokens
+ * @brief A thread-safe singleton mapping resumption tokens to the user they log in.
+ *
+ * @details A successful `AuthRequest` issues a token, and a `ResumeSessionRequest`
+ * presenting it logs the user in again in one round trip: the token is checked here,
+ * without the salt exchange and without a `users` lookup. Each token is redeemed once,
+ * the resumed session gets the next one. Unused tokens expire after `SessionConfig::ttl`.
+ *
+ * Tokens are revoked on logout, and all tokens of a user when their password changes.
+ * A session keeps the user's `SharedUserName`, so it resumes under the user's current name.
+ *
+ * @note The store is local to this process. A client resuming on another server, or
+ * after a restart, is refused and falls back to the full authentication. An upgrade in
+ * place hands the tokens over to the new process, see `UpgradeHandoff`.
+ */
+class SessionTokens {
+public:
+    /**
+     * @brief Gets the singleton instance of the SessionTokens.
+     * @return A reference to the single SessionTokens instance.
+     */
+    static SessionTokens& instance();
+
+    /**
+     * @brief Issues a token logging in `user`.
+     * @return The token, or an empty string if tokens are disabled or the store is full.
+     */
+    std::string issue(const User& user);
+
+    /**
+     * @brief Consumes a token.
+     * @return The user it was issued for, or nullopt if it is unknown, used or expired.
+     */
+    std::optional<User> redeem(const std::string& token);
+
+    /**
+     * @brief Looks a token up without consuming it, for the HTTP endpoints that authenticate every request.
+     * @return The user it was issued for, or nullopt if it is unknown or expired.
+     */
+    std::optional<User> find(const std::string& token);
+
+    /// @brief Drops a token, e.g. the one of a session that logged out.
+    void revoke(const std::string& token);
+
+    /// @brief Drops every token of a user.
+    void revokeUser(int32_t user_id);
+
+    /**
+     * @struct Handed
+     * @brief A live token with the user it logs in and the time it has left, see `UpgradeHandoff`.
+     */
+    struct Handed {
+        std::string token;
+        User user;
+        std::chrono::milliseconds ttl;
+    };
+
+    /// @brief Copies every live token, for the process taking over from this one.
+    std::vector<Handed> handOver();
+
+    /// @brief Takes over a token issued by the process this one replaced.
+    void adopt(Handed handed);
+
+private:
+    SessionTokens() = default;
+    SessionTokens(const SessionTokens&) = delete;
+    SessionTokens& operator=(const SessionTokens&) = delete;
+
+    struct Session {
+        User user;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    /// @brief Arms the periodic sweep on first use.
+    void ensureTimer();
+
+    /// @brief Drops the expired tokens.
+    void sweep();
+
+    /// @brief Drops the expired tokens. Assumes `m_mutex` is held.
+    void sweep_unsafe(std::chrono::steady_clock::time_point now);
+
+    std::mutex m_mutex;
+    std::unordered_map<std::string, Session> m_sessions;
+    std::once_flag m_timer_started;
+};
+
+} // namespace server
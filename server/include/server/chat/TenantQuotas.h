@@ -0,0 +1,138 @@
+#pragma once
+
+#include <common/utils/metrics.h>
+#include <server/utils/server_config.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+/**
+ * @file TenantQuotas.h
+ * @brief Defines the quotas that keep one community of a shared server from starving the others.
+ */
+
+namespace server {
+
+/**
+ * @class Tenant
+ * @brief The usage of one `TenantConfig` group against its quotas. Thread-safe.
+ */
+class Tenant {
+public:
+    explicit Tenant(TenantConfig config);
+
+    const TenantConfig& config() const noexcept { return m_config; }
+
+    /// @brief Takes a slot among the requests in flight, false when they are all taken.
+    bool tryEnterRequest() noexcept;
+    void leaveRequest() noexcept;
+
+    /// @brief Whether the database operations of the group are limited.
+    bool limitsDb() const noexcept { return m_config.max_db_in_flight > 0; }
+
+    /**
+     * @brief Takes a slot among the database operations in flight, or queues `start` for when one is released.
+     * @return True when the slot was taken, `start` is then not called.
+     */
+    bool acquireDb(std::function<void()> start);
+
+    /// @brief Gives a slot back, starting the oldest operation waiting for one right here, on the caller's thread.
+    void releaseDb();
+
+    /// @brief Whether the bytes broadcast to the group's rooms are limited.
+    bool limitsBroadcasts() const noexcept { return m_config.broadcast_bytes_per_second > 0; }
+
+    /// @brief Whether the group broadcast more than its budget, its broadcasts are then paced.
+    bool overBroadcastBudget();
+
+    /**
+     * @brief Takes `bytes` from the broadcast budget, going into debt if needed.
+     * @return How long until the debt is paid off, zero when there is none.
+     */
+    std::chrono::steady_clock::duration chargeBroadcast(size_t bytes);
+
+    /// @brief Counts a request rejected, a droppable broadcast dropped or a database operation delayed.
+    void countRejected() noexcept { m_rejected->inc(); }
+    void countDropped() noexcept { m_dropped->inc(); }
+    void countDbDelayed() noexcept { m_db_delayed->inc(); }
+
+private:
+    /// @brief Refills the budget up to now. Assumes `m_budget_mutex` is held.
+    void refill_unsafe(std::chrono::steady_clock::time_point now);
+
+    const TenantConfig m_config;
+    std::atomic<size_t> m_in_flight{0};
+
+    std::mutex m_db_mutex;
+    size_t m_db_in_flight = 0;
+    std::deque<std::function<void()>> m_db_waiting;
+
+    std::mutex m_budget_mutex;
+    /// Bytes left, negative while in debt.
+    double m_budget = 0;
+    std::chrono::steady_clock::time_point m_budget_updated;
+
+    common::Counter* m_rejected;
+    common::Counter* m_dropped;
+    common::Counter* m_db_delayed;
+};
+
+/**
+ * @class TenantQuotas
+ * @brief A singleton mapping rooms to the `Tenant` of their group, from `TenantsConfig`.
+ *
+ * @details Several communities hosted on one server share its IO loops, its database pool
+ * and its sockets. Each group of rooms may be given quotas of its own, so a noisy community
+ * only slows down itself:
+ *
+ * - `MessageHandlerService` counts the requests in flight per group, by the room of the
+ *   connection or the room joined, and rejects those beyond `max_in_flight`;
+ * - `switch_to_io_loop` counts the database operations of those requests and holds back
+ *   those beyond `max_db_in_flight` until one completes, so the group never has more of the
+ *   shared pool's connections busy than that;
+ * - `ChatRoomManager` charges every broadcast to a group's room, its size times the members
+ *   written to, to a byte budget. Once it is spent, droppable events such as typing are
+ *   dropped and the others paced, written in chunks as the budget refills.
+ *
+ * The request being handled on a thread is tagged with its group, see `currentTenant()`.
+ * Groups are created at startup and live until exit, so a `Tenant*` never dangles.
+ */
+class TenantQuotas {
+public:
+    static TenantQuotas& instance();
+
+    /// @brief The group of a room, null for the rooms of no group or when quotas are disabled.
+    Tenant* tenantOf(int32_t room_id) const noexcept;
+
+    /// @brief Whether any group is configured.
+    bool enabled() const noexcept { return !m_ranges.empty(); }
+
+private:
+    TenantQuotas();
+    TenantQuotas(const TenantQuotas&) = delete;
+    TenantQuotas& operator=(const TenantQuotas&) = delete;
+
+    std::vector<std::unique_ptr<Tenant>> m_tenants;
+    /// The room ranges of every group, by their first room, for a binary search.
+    struct Range {
+        int32_t first;
+        int32_t last;
+        Tenant* tenant;
+    };
+    std::vector<Range> m_ranges;
+};
+
+/**
+ * @brief The group of the request running on this thread, null outside of the groups' requests.
+ * @details Set by `MessageHandlerService` for the request it runs and restored by `switch_to_io_loop`
+ * after each database operation, which clears it while suspended. After any other suspension point it
+ * may be stale, the operations are then counted against another group or none, never unsafe.
+ */
+Tenant* currentTenant() noexcept;
+
+/// @brief Replaces the group of this thread, see `currentTenant()`.
+void setCurrentTenant(Tenant* tenant) noexcept;
+
+} // namespace server
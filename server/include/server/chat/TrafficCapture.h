@@ -0,0 +1,91 @@
+#pragma once
+
+#include <server/utils/server_config.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+/**
+ * @file TrafficCapture.h
+ * @brief Defines the recording of client traffic replayed by `chat_replay`.
+ */
+
+namespace server {
+
+/**
+ * @class TrafficCapture
+ * @brief A singleton recording the frames clients send, in the format of `common/utils/capture.h`.
+ *
+ * @details Synthetic load misses the bursts of real traffic, a capture keeps their shape for
+ * `chat_replay` to play against a test node: when each frame arrived, on which connection
+ * and what it asked for. It is sanitized on the way in, see `sanitize()`, and connections
+ * are numbered in the order they opened.
+ *
+ * Frames are buffered and appended to `CaptureConfig::output` once a second from the main
+ * loop, like traces. Frames arriving while the buffer is full are dropped, and the capture
+ * ends once the file reaches `CaptureConfig::max_bytes`.
+ */
+class TrafficCapture {
+public:
+    /**
+     * @brief Gets the singleton instance of the TrafficCapture.
+     * @return A reference to the single TrafficCapture instance.
+     */
+    static TrafficCapture& instance();
+
+    /**
+     * @brief Opens the output and starts the periodic flush, when enabled.
+     * @note Must be called once, on the main loop. Until then nothing is recorded.
+     */
+    void start(const CaptureConfig& config);
+
+    /// @brief Whether frames are being recorded.
+    bool recording() const noexcept { return m_recording.load(std::memory_order_relaxed); }
+
+    /// @brief Numbers a new connection for the capture, 0 while not recording. Thread-safe.
+    uint64_t openConnection() noexcept;
+
+    /// @brief Records a frame a connection sent, unless it is dropped by `sanitize()`. Thread-safe.
+    void record(uint64_t connection, const chat::Envelope& request);
+
+    /// @brief Records that a connection closed. Thread-safe.
+    void recordClose(uint64_t connection);
+
+    /**
+     * @brief Strips what a capture must not keep from a request.
+     * @details Logins, registrations, password and username changes are dropped whole, with
+     * the requests of servers. The texts of messages, room names, search queries and the name
+     * prefixes and cursors of the member and room lists are replaced by filler of the same length,
+     * so the load they cause stays about the same. Only the requests listed as carrying no user text
+     * are recorded as they are, one of a type not listed is dropped.
+     * @return Whether the request is recorded at all.
+     */
+    static bool sanitize(chat::Envelope& request);
+
+private:
+    TrafficCapture() = default;
+    TrafficCapture(const TrafficCapture&) = delete;
+    TrafficCapture& operator=(const TrafficCapture&) = delete;
+
+    void append(uint64_t connection, std::string_view frame);
+    void flush();
+
+    /// @brief The most bytes of records held between two flushes.
+    static constexpr size_t MAX_BUFFERED_BYTES = 16 * 1024 * 1024;
+
+    std::atomic<bool> m_recording{false};
+    std::atomic<uint64_t> m_next_connection{1};
+    std::chrono::steady_clock::time_point m_started;
+    size_t m_max_bytes = 0;
+
+    std::mutex m_mutex;
+    std::string m_buffer;
+    uint64_t m_dropped = 0;
+    // Only touched by flush(), on the main loop.
+    size_t m_written = 0;
+    std::ofstream m_out;
+};
+
+} // namespace server
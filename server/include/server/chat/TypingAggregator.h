@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * @file TypingAggregator.h
+ * @brief Defines the per-room aggregation of typing indicators.
+ */
+
+namespace server {
+
+/**
+ * @class TypingAggregator
+ * @brief A thread-safe singleton coalescing typing start/stop events into periodic per-room snapshots.
+ *
+ * @details Instead of relaying every start and stop event, the aggregator only records
+ * who is typing in each room. Every `TypingConfig::interval`, each room whose set of
+ * typing users changed since its last update receives a single `RoomTypingUsers`
+ * snapshot through `ChatRoomManager::sendToRoom`. Repeated starts of a user who is
+ * already typing, and a start and stop within the same interval, cost nothing on the wire.
+ */
+class TypingAggregator {
+public:
+    /**
+     * @brief Gets the singleton instance of the TypingAggregator.
+     * @return A reference to the single TypingAggregator instance.
+     */
+    static TypingAggregator& instance();
+
+    /**
+     * @brief Records that a user started or stopped typing in a room.
+     * @param room_id The room the user is typing in.
+     * @param user The user, as shown to the other members.
+     * @param typing Whether the user is typing.
+     */
+    void setTyping(int32_t room_id, const chat::UserInfo& user, bool typing);
+
+    /// @brief Forgets a user who left a room.
+    void removeUser(int32_t room_id, int32_t user_id);
+
+    /// @brief Forgets everything about a deleted room, without sending an update.
+    void dropRoom(int32_t room_id);
+
+private:
+    TypingAggregator() = default;
+    TypingAggregator(const TypingAggregator&) = delete;
+    TypingAggregator& operator=(const TypingAggregator&) = delete;
+
+    /// @brief The typing state of one room.
+    struct RoomTyping {
+        /// User ID to the user info, ordered so snapshots are stable.
+        std::map<int32_t, chat::UserInfo> users;
+        /// The users of the last snapshot sent to the room, serialized, empty for none.
+        std::string last_sent;
+    };
+
+    /// @brief Arms the periodic flush on first use.
+    void ensureTimer();
+
+    /// @brief Sends a snapshot to every room whose typing users changed.
+    void flush();
+
+    std::mutex m_mutex;
+    std::unordered_map<int32_t, RoomTyping> m_rooms;
+    std::unordered_set<int32_t> m_dirty;
+    std::once_flag m_timer_started;
+};
+
+} // namespace server
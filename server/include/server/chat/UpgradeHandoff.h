@@ -0,0 +1,64 @@
+#pragma once
+
+#include <server/utils/server_config.h>
+#include <functional>
+#include <thread>
+
+/**
+ * @file UpgradeHandoff.h
+ * @brief Defines the handover from a running server process to the one upgrading it in place.
+ */
+
+namespace server {
+
+/**
+ * @class UpgradeHandoff
+ * @brief A singleton handing the sessions of this process over to its successor on the same host.
+ *
+ * @details Restarting a server to deploy a new binary drops every client at once, and each of
+ * them then logs in, joins and reloads its history again. With `UpgradeConfig::enabled` the new
+ * binary is started next to the running one instead:
+ *
+ * - both processes bind the listening port with `SO_REUSEPORT`, so it never stops accepting;
+ * - once warmed up, the new process connects to the old one over `UpgradeConfig::socket_path`
+ *   and receives the live resumption tokens, see `SessionTokens::handOver()`;
+ * - the old process leaves the aggregator to the new one and drains, see `ServerDrain::startUpgrade()`:
+ *   its clients reconnect to the same address over `DrainConfig::spread`, are turned to the new
+ *   process, and resume their session and their room without logging in;
+ * - the new process then waits on the socket for the next upgrade.
+ *
+ * The WebSocket connections themselves are not passed over: drogon owns their sockets and has
+ * no way to adopt one mid-stream, so each client reconnects once, with a resumption instead of
+ * a login, at a time drawn within the spread.
+ *
+ * @note POSIX only, elsewhere the server starts without taking over.
+ */
+class UpgradeHandoff {
+public:
+    /**
+     * @brief Gets the singleton instance of the UpgradeHandoff.
+     * @return A reference to the single UpgradeHandoff instance.
+     */
+    static UpgradeHandoff& instance();
+
+    /**
+     * @brief Takes over from the process on the socket, if any, then waits there for a successor.
+     * @param taken_over Called on the main loop once the predecessor handed over or none answered.
+     */
+    void start(const UpgradeConfig& cfg, std::function<void()> taken_over);
+
+private:
+    UpgradeHandoff() = default;
+    UpgradeHandoff(const UpgradeHandoff&) = delete;
+    UpgradeHandoff& operator=(const UpgradeHandoff&) = delete;
+
+    /// @brief Receives the predecessor's sessions. False if no process listens on the socket.
+    bool takeOver(const std::string& path);
+
+    /// @brief Waits for a successor and hands the sessions over to it, once.
+    void serve(const std::string& path, std::stop_token stop);
+
+    std::jthread m_thread;
+};
+
+} // namespace server
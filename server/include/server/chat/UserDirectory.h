@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @file UserDirectory.h
+ * @brief Defines the directory of the names of the users logged in on this server.
+ */
+
+namespace server {
+
+/**
+ * @class SharedUserName
+ * @brief The name of a user, one instance shared by all of the user's connections and sessions on this server.
+ * @details Reads and renames may come from any thread. A reader gets the name as of the
+ * read and keeps it alive for as long as it holds it.
+ */
+class SharedUserName {
+public:
+    explicit SharedUserName(std::string name)
+        : m_name(std::make_shared<const std::string>(std::move(name))) {}
+
+    /// @brief The current name.
+    std::shared_ptr<const std::string> get() const { return m_name.load(std::memory_order_acquire); }
+
+    /// @brief Replaces the name for every holder.
+    void set(std::string name) { m_name.store(std::make_shared<const std::string>(std::move(name)), std::memory_order_release); }
+
+private:
+    std::atomic<std::shared_ptr<const std::string>> m_name;
+};
+
+/**
+ * @class UserDirectory
+ * @brief A thread-safe singleton handing out one `SharedUserName` per logged in user.
+ *
+ * @details Every connection used to carry its own copy of its user's name, and a rename
+ * only reached the connection it was made on. The connections and resumable sessions of
+ * a user now reference the same name, so it is stored once per user however many clients
+ * they have, and a rename, local or from another server, reaches all of them at once.
+ *
+ * The directory only holds weak references, an entry goes away with the last connection
+ * or session of its user.
+ */
+class UserDirectory {
+public:
+    /**
+     * @brief Gets the singleton instance of the UserDirectory.
+     * @return A reference to the single UserDirectory instance.
+     */
+    static UserDirectory& instance();
+
+    /**
+     * @brief Returns the shared name of a user.
+     * @details The name already held by the user's other connections is returned if there
+     * is one, and updated if it differs from `name`, the latest read from the database.
+     */
+    std::shared_ptr<SharedUserName> acquire(int32_t user_id, const std::string& name);
+
+    /// @brief Renames a user for all of their connections and sessions on this server, if any.
+    void rename(int32_t user_id, const std::string& name);
+
+    /// @brief The number of users with a shared name.
+    size_t size() const;
+
+private:
+    UserDirectory();
+    UserDirectory(const UserDirectory&) = delete;
+    UserDirectory& operator=(const UserDirectory&) = delete;
+
+    /// @brief Drops the entry of a user whose name is no longer referenced.
+    void release(int32_t user_id);
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<int32_t, std::weak_ptr<SharedUserName>> m_names;
+};
+
+} // namespace server
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <drogon/orm/DbClient.h>
+#include <atomic>
+#include <memory>
+#include <string_view>
+
+/**
+ * @file UsernameFilter.h
+ * @brief Defines the Bloom filter of the usernames in use.
+ */
+
+namespace server {
+
+/**
+ * @class UsernameFilter
+ * @brief A thread-safe singleton telling the usernames that are certainly free without querying `users`.
+ *
+ * @details Registration attempts and username changes look their name up first, and
+ * registration bots make that a hot path. The filter holds every username in use, so a
+ * name it does not contain is free and needs no query. A name it contains may still be
+ * free, about `UsernameFilterConfig::false_positive_rate` of them, and is looked up.
+ *
+ * It is loaded from `users` at startup by `CacheWarmup` and every name registered or
+ * taken on this server is added. Names are never removed, a renamed user's old name
+ * just stays a possible match. Until loaded, every name is a possible match.
+ *
+ * @note Names taken on other servers after the filter was loaded are not in it. The
+ * unique index on `users.username` still rejects them when the row is written.
+ */
+class UsernameFilter {
+public:
+    /**
+     * @brief Gets the singleton instance of the UsernameFilter.
+     * @return A reference to the single UsernameFilter instance.
+     */
+    static UsernameFilter& instance();
+
+    /**
+     * @brief Adds every username of `users`, a page at a time.
+     * @return A task resolving to the number of names added.
+     */
+    drogon::Task<size_t> load(const drogon::orm::DbClientPtr& db);
+
+    /// @brief Adds a username that is now in use.
+    void add(std::string_view username) noexcept;
+
+    /// @brief Whether the username may be in use, false only if it certainly is free.
+    bool mayExist(std::string_view username) const noexcept;
+
+private:
+    UsernameFilter();
+    UsernameFilter(const UsernameFilter&) = delete;
+    UsernameFilter& operator=(const UsernameFilter&) = delete;
+
+    /// @brief The two hashes each bit index of a name is derived from.
+    std::pair<uint64_t, uint64_t> hashes(std::string_view username) const noexcept;
+
+    bool m_enabled = false;
+    size_t m_bit_count = 0;
+    size_t m_hash_count = 0;
+    std::unique_ptr<std::atomic<uint64_t>[]> m_words;
+    std::atomic<bool> m_loaded{false};
+};
+
+} // namespace server
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <common/utils/AwaitableGuarded.h>
+#include <server/chat/UserDirectory.h>
+#include <server/chat/ConnectionAdmission.h>
+#include <atomic>
 /**
  * @file WsData.h
  * @brief Defines the stateful data structures associated with a WebSocket connection.
@@ -30,8 +33,11 @@ enum class USER_STATUS {
 struct User {
     /// The unique identifier for the user, corresponding to the primary key in the `users` database table.
     int32_t id;
-    /// The user's chosen display name.
-    std::string name;
+    /// The user's chosen display name, shared with the user's other connections, see `UserDirectory`.
+    std::shared_ptr<SharedUserName> shared_name;
+
+    /// @brief The current display name.
+    std::shared_ptr<const std::string> name() const { return shared_name->get(); }
 };
 
 /**
@@ -45,6 +51,52 @@ struct CurrentRoom {
     chat::UserRights rights;
 };
 
+/**
+ * @struct WsDataView
+ * @brief An immutable copy of the fields of a `WsData` that other connections read.
+ */
+struct WsDataView {
+    /// Grows with every publication, a reader holding an older view knows it was replaced.
+    uint64_t version = 0;
+    std::optional<User> user;
+    std::optional<CurrentRoom> room;
+};
+
+/**
+ * @class WsDataViewCell
+ * @brief Holds the latest `WsDataView` of a connection, swapped atomically so it is read without any lock.
+ *
+ * @details Other connections load the view instead of taking the `WsDataGuarded` lock of each
+ * peer one after the other, so e.g. a change of rights can pick the connections it concerns in a
+ * tight loop, without suspending and without the care a lock already held by the caller needs.
+ * The owner of the `WsData` publishes a new view under its unique lock after every change of
+ * the user or the room. A join publishes the room before reading the rights in it, so a view
+ * may name a room the connection is only about to be in: readers take it as a hint and whoever
+ * changes the data checks it again under the lock.
+ */
+class WsDataViewCell {
+public:
+    /// @brief The latest view, never null.
+    [[nodiscard]] std::shared_ptr<const WsDataView> load() const {
+        return m_view.load(std::memory_order_acquire);
+    }
+
+    /// @brief Replaces the view with one of `user` and `room`. Only called by writers of the data, which are serialized.
+    void publish(const std::optional<User>& user, const std::optional<CurrentRoom>& room) {
+        const auto version = m_view.load(std::memory_order_relaxed)->version + 1;
+        m_view.store(std::make_shared<const WsDataView>(WsDataView{ version, user, room }), std::memory_order_release);
+    }
+
+private:
+    std::atomic<std::shared_ptr<const WsDataView>> m_view{ std::make_shared<const WsDataView>() };
+};
+
+/// @brief A number for a new connection, never reused within the process unlike the address of its `WsData`.
+inline uint64_t nextConnectionId() noexcept {
+    static std::atomic<uint64_t> next{0};
+    return next.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
 /**
  * @struct WsData
  * @brief A container for all state information associated with a single WebSocket connection.
@@ -55,12 +107,30 @@ struct CurrentRoom {
  * everything from the user's authentication status to their current room membership.
  */
 struct WsData {
+    /// @brief Identifies the connection in per-connection state kept outside of it, see `nextConnectionId()`.
+    uint64_t connection_id = nextConnectionId();
     /// @brief Holds the authenticated user's information. Contains a value only if `status` is `Authenticated`.
     std::optional<User> user;
     /// @brief Holds details about the room the user has joined. Contains a value only if the user is in a room.
     std::optional<CurrentRoom> room;
     /// @brief The current authentication state of the connection.
     USER_STATUS status = USER_STATUS::Unauthenticated;
+    /// @brief The codec negotiated with `SetCompressionRequest`, applied to the larger responses.
+    chat::Compression compression = chat::COMPRESSION_NONE;
+    /// @brief Whether the room broadcasts sent here refer to known users by id, see `SetCompressionRequest.user_refs`.
+    bool user_refs = false;
+    /// @brief The resumption token last issued to this session, revoked on logout. See `SessionTokens`.
+    std::string resume_token;
+    /// @brief The connection's slots in the admission control, its login releases one of them.
+    ConnectionAdmission::Ticket admission;
+    /**
+     * @brief The lock-free view of `user` and `room` for other connections, see `WsDataViewCell`.
+     * @note Set at construction and never reassigned, so the pointer itself may be read without the lock.
+     */
+    std::shared_ptr<WsDataViewCell> view = std::make_shared<WsDataViewCell>();
+
+    /// @brief Publishes the current `user` and `room` to `view`, called after changing either of them.
+    void publishView() const { view->publish(user, room); }
 };
 
 /// @brief A type alias for `WsData` protected by a `common::Guarded` wrapper for thread-safe access.
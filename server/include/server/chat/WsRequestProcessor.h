@@ -1,6 +1,9 @@
 #pragma once
 
 #include <drogon/WebSocketConnection.h>
+#include <server/chat/WsData.h>
+#include <server/chat/ConnectionContext.h>
+#include <common/utils/tracing.h>
 
 /**
  * @file WsRequestProcessor.h
@@ -10,6 +13,7 @@
 namespace server {
 
 class MessageHandlerService;
+struct RequestArena;
 
 /**
  * @class WsRequestProcessor
@@ -17,10 +21,18 @@ class MessageHandlerService;
  *
  * @details This class is responsible for the first steps of message processing.
  * Its primary function is to take the raw binary data received from a WebSocket
- * connection, attempt to parse it into a Protobuf `Envelope`, and then pass
+ * connection, attempt to parse it into a Protobuf `Envelope` allocated on a per-request
+ * `RequestArena`, and then pass
 *  the parsed message to the `MessageHandlerService` for routing to the
  * appropriate business logic.
  *
+ * A sampled request gets a `common::Trace`, spanning from arrival to the reply being sent,
+ * with the parse, queueing, lock waits, database awaits, broadcasts and the reply as spans.
+ *
+ * A history page or a room list longer than `ChunkedResponseConfig::items_per_chunk` is
+ * sent as `MessagesChunk` or `RoomListChunk` frames followed by the response holding the
+ * remaining items, each frame serialized only once the one before it has been sent.
+ *
  * It serves as a thin layer that decouples the network transport details (managed
  * by `WsController`) from the message-dispatching logic (`MessageHandlerService`).
  */
@@ -35,22 +47,43 @@ public:
     ~WsRequestProcessor();
 
     /**
-     * @brief Asynchronously handles a new incoming raw message from a connection.
+     * @brief Queues a new incoming raw message from a connection for processing.
+     *
+     * @details The message is parsed right away and queued as a request of the connection's
+     * `ConnectionContext`, which runs it through `processRequest()` and sends the responses
+     * back in arrival order. A malformed message is answered with a generic error, in order too.
+     * Requests that never suspend are answered right away when nothing is queued before them.
+     *
+     * @param conn The WebSocket connection from which the message originated.
+     * @param bytes The raw frame. It is parsed before this returns, so it need not outlive the call.
+     */
+    void handleIncomingMessage(const drogon::WebSocketConnectionPtr& conn, std::string_view bytes) const;
+private:
+    /**
+     * @brief Handles a request for which `MessageHandlerService::isImmediate()` holds and sends its reply.
+     * @details Used while the connection's `ConnectionContext` is idle, the request then needs
+     * neither a pipeline entry nor any coroutine frame.
+     */
+    void answerImmediately(const drogon::WebSocketConnectionPtr& conn, const WsDataPtr& wsData, RequestArena& exchange,
+                           const common::TracePtr& trace) const;
+
+    /**
+     * @brief Asynchronously handles one parsed request from a connection.
      *
-     * @details This method is the main entry point for this class. It performs the following steps:
-     * 1. Attempts to parse the raw `bytes` into a `chat::Envelope`.
-     * 2. If parsing fails, sends a generic error back to the client.
-     * 3. If parsing succeeds, it creates a `DrogonRoomService` instance for the connection.
-     * 4. It then calls the `MessageHandlerService` to process the message,
-     *    `co_await`s the response, and sends the response back to the client.
-     * 5. Includes critical error handling and a check to ensure coroutine execution
-     *    resumes on the correct thread.
+     * @details This method creates a `ClusterRoomService` on the stack for the connection and
+     * calls the `MessageHandlerService` to fill the response in place, on the exchange's
+     * arena. It includes critical error handling and a check to ensure coroutine
+     * execution resumes on the correct thread.
      *
      * @param conn The WebSocket connection from which the message originated.
-     * @param bytes The raw message content as a `std::string`.
-     * @return A `drogon::Task<>` that represents the entire processing operation.
+     * @param wsData The state of the connection.
+     * @param exchange The arena holding the parsed request and the response to fill.
+     * @param trace The request's trace, current while the request runs, or null when it is not sampled.
+     * @return A task resolving to the response to send back to the client, sharing the exchange's ownership.
      */
-    drogon::Task<> handleIncomingMessage(drogon::WebSocketConnectionPtr conn, std::string bytes) const;
+    drogon::Task<ConnectionContext::Response> processRequest(drogon::WebSocketConnectionPtr conn, WsDataPtr wsData,
+                                                             std::shared_ptr<RequestArena> exchange, common::TracePtr trace) const;
+
 private:
     /// @brief The owned instance of the message dispatcher service.
     std::unique_ptr<MessageHandlerService> m_dispatcher;
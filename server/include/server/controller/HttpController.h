@@ -38,11 +38,96 @@ public:
      * @param callback The function to call to send the HTTP response.
      */
     void healthCheck(const HttpRequestPtr& req, std::function<void(const HttpResponsePtr&)>&& callback) const;
+
+    /**
+     * @brief Handles a request to the /ready endpoint.
+     *
+     * @details Responds `503 Service Unavailable` while the server is still warming up
+     * its caches and refusing WebSocket connections, see `CacheWarmup`, and `200 OK`
+     * afterwards. Meant for readiness probes, unlike /health which only tells that
+     * the process is alive.
+     *
+     * @param req The incoming HTTP request pointer.
+     * @param callback The function to call to send the HTTP response.
+     */
+    void readinessCheck(const HttpRequestPtr& req, std::function<void(const HttpResponsePtr&)>&& callback) const;
+
+    /**
+     * @brief Handles a request to the /metrics endpoint.
+     *
+     * @details Responds with every metric of `common::MetricsRegistry` in the
+     * Prometheus text exposition format: per-handler request latencies, broadcast
+     * fan-outs, database and lock wait latencies, and connection counts.
+     *
+     * @param req The incoming HTTP request pointer.
+     * @param callback The function to call to send the HTTP response.
+     */
+    void metrics(const HttpRequestPtr& req, std::function<void(const HttpResponsePtr&)>&& callback) const;
     
+    /**
+     * @brief Handles a request to the /rooms/{room_id}/export endpoint.
+     *
+     * @details Streams the whole history of a room, see `HistoryExport`, to a user who
+     * may moderate it. The user logs in with the resumption token of their session, sent
+     * as `Authorization: Bearer <token>`. The query parameters pick the encoding:
+     *
+     * - `format=ndjson` (the default) or `format=protobuf`;
+     * - `compress=gzip` (the default) or `compress=none`.
+     *
+     * Answers 401 without a valid token, 403 when the room is not one the user moderates,
+     * and 429 when `HistoryExportConfig::max_concurrent` exports are running already.
+     *
+     * @param req The incoming HTTP request pointer.
+     * @param room_id The room to export.
+     * @return A task resolving to the streamed response, or to the error.
+     */
+    drogon::Task<HttpResponsePtr> exportHistory(HttpRequestPtr req, int32_t room_id) const;
+
+    /**
+     * @brief Handles a request to the /introspection endpoint.
+     *
+     * @details Responds with a JSON snapshot of the server's live state, see `Introspection`:
+     * the largest rooms, the connections with the largest send backlog, the IO loops, the
+     * contended shard locks and the requests in flight per handler. Only for global admins,
+     * who log in with the resumption token of their session as `Authorization: Bearer <token>`.
+     *
+     * Answers 401 without a valid token and 403 when the user is not a global admin.
+     *
+     * @param req The incoming HTTP request pointer.
+     * @param callback The function to call to send the HTTP response.
+     */
+    void introspect(const HttpRequestPtr& req, std::function<void(const HttpResponsePtr&)>&& callback) const;
+
+    /**
+     * @brief Handles a request to the /debug/profile/{kind} endpoint.
+     *
+     * @details Serves a CPU profile of the next `seconds` (`kind` "cpu") or a heap snapshot
+     * (`kind` "heap") of the running process, see `common::Profiler`. Only for global admins,
+     * as /introspection, and only with `profiling.enabled`.
+     *
+     * Answers 401 without a valid token, 403 when the user is not a global admin and 409 while
+     * another CPU profile runs.
+     *
+     * @param req The incoming HTTP request pointer.
+     * @param callback The function to call to send the HTTP response.
+     * @param kind "cpu" or "heap".
+     */
+    void profile(const HttpRequestPtr& req, std::function<void(const HttpResponsePtr&)>&& callback, const std::string& kind) const;
+
     // --- Drogon's Macro-based Method and Path Mapping ---
     METHOD_LIST_BEGIN
         /// Maps the GET /health URL path to the healthCheck method.
         ADD_METHOD_TO(HttpController::healthCheck, "/health", Get);
+        /// Maps the GET /ready URL path to the readinessCheck method.
+        ADD_METHOD_TO(HttpController::readinessCheck, "/ready", Get);
+        /// Maps the GET /metrics URL path to the metrics method.
+        ADD_METHOD_TO(HttpController::metrics, "/metrics", Get);
+        /// Maps the GET /rooms/{room_id}/export URL path to the exportHistory method.
+        ADD_METHOD_TO(HttpController::exportHistory, "/rooms/{1}/export", Get);
+        /// Maps the GET /introspection URL path to the introspect method.
+        ADD_METHOD_TO(HttpController::introspect, "/introspection", Get);
+        /// Maps the GET /debug/profile/{kind} URL path to the profile method.
+        ADD_METHOD_TO(HttpController::profile, "/debug/profile/{1}", Get);
     METHOD_LIST_END    
 };
 
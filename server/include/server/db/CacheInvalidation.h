@@ -0,0 +1,66 @@
+#pragma once
+
+#include <drogon/orm/DbClient.h>
+#include <drogon/orm/DbListener.h>
+#include <mutex>
+
+/**
+ * @file CacheInvalidation.h
+ * @brief Defines the exchange of `RoomDataCache` invalidations between the servers sharing the database.
+ */
+
+namespace server {
+
+/**
+ * @class CacheInvalidation
+ * @brief A singleton publishing `RoomDataCache` invalidations with PostgreSQL `NOTIFY` and applying those of the other servers.
+ *
+ * @details The handlers writing rooms, rights and memberships queue a notification on the
+ * transaction doing the write. PostgreSQL delivers it only once that transaction commits, so
+ * a server evicting on it cannot read the old row back, and drops it on rollback.
+ *
+ * `start()` listens on the channel over a dedicated connection and evicts exactly the entries
+ * named by each notification: a whole room, or one user in a room. The server's own
+ * notifications are recognized by their origin and skipped, the handler already invalidated.
+ *
+ * Unlike the cluster bus this does not depend on the aggregator and reaches every server on
+ * the database, subscribed to the room or not.
+ *
+ * @note Notifications sent while the listening connection is down are lost, the evictions
+ * they carried are missed until the entries change again.
+ */
+class CacheInvalidation {
+public:
+    /**
+     * @brief Gets the singleton instance of the CacheInvalidation.
+     * @return A reference to the single CacheInvalidation instance.
+     */
+    static CacheInvalidation& instance();
+
+    /// @brief Starts listening for the other servers' invalidations, unless `cluster.cache_notify` is off.
+    void start();
+
+    /// @brief Queues the eviction of everything cached about a room on `db`, delivered when it commits.
+    drogon::Task<> notifyRoom(const drogon::orm::DbClientPtr& db, int32_t room_id) const;
+
+    /// @brief Queues the eviction of the membership and stored role of one user in one room.
+    drogon::Task<> notifyRoomUser(const drogon::orm::DbClientPtr& db, int32_t room_id, int32_t user_id) const;
+
+private:
+    CacheInvalidation();
+    CacheInvalidation(const CacheInvalidation&) = delete;
+    CacheInvalidation& operator=(const CacheInvalidation&) = delete;
+
+    /// @brief Sends a payload on the channel, if enabled.
+    drogon::Task<> notify(const drogon::orm::DbClientPtr& db, std::string payload) const;
+
+    /// @brief Applies a notification, `<origin> room <room_id>` or `<origin> room_user <room_id> <user_id>`.
+    void apply(std::string_view payload) const;
+
+    /// @brief Tells this process's notifications apart from the other servers'.
+    std::string m_origin;
+    std::once_flag m_started;
+    drogon::orm::DbListenerPtr m_listener;
+};
+
+} // namespace server
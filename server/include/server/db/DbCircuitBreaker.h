@@ -0,0 +1,80 @@
+#pragma once
+
+#include <server/utils/server_config.h>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <mutex>
+#include <vector>
+
+/**
+ * @file DbCircuitBreaker.h
+ * @brief Defines the circuit breaker tracking the health of the database.
+ */
+
+namespace server {
+
+/**
+ * @class DbCircuitBreaker
+ * @brief A thread-safe singleton judging the database from the outcome of recent queries.
+ *
+ * @details Every operation awaited through `switch_to_io_loop` reports its latency and
+ * whether it failed with a timeout or a lost connection. Errors the database answered
+ * with, a violated constraint for instance, say nothing about its health and count as
+ * successes. Outcomes are kept in one-second buckets over `DbBreakerConfig::window`.
+ *
+ * The breaker opens when enough of the window failed or was slow, then requests that can
+ * do without the database, history and search, are answered with `STATUS_UNAVAILABLE`
+ * instead of queueing behind the struggling queries. Logins, messages and membership
+ * changes still go through and keep reporting, so the window is judged again after
+ * `DbBreakerConfig::open_for` from fresh outcomes. An empty window closes the breaker,
+ * the requests let through then act as the probe.
+ */
+class DbCircuitBreaker {
+public:
+    /**
+     * @brief Gets the singleton instance of the DbCircuitBreaker.
+     * @return A reference to the single DbCircuitBreaker instance.
+     */
+    static DbCircuitBreaker& instance();
+
+    /**
+     * @brief Records the outcome of one query.
+     * @param latency The time from issuing the query to its completion.
+     * @param error The exception the query failed with, if any.
+     */
+    void record(std::chrono::steady_clock::duration latency, const std::exception_ptr& error) noexcept;
+
+    /// @brief Whether non-critical requests may query the database, false while the breaker is open.
+    bool allow() noexcept;
+
+    /// @brief Whether the breaker is open, without judging the window again.
+    bool open() const noexcept { return m_open.load(std::memory_order_relaxed); }
+
+private:
+    DbCircuitBreaker();
+    DbCircuitBreaker(const DbCircuitBreaker&) = delete;
+    DbCircuitBreaker& operator=(const DbCircuitBreaker&) = delete;
+
+    /// @brief The outcomes of the queries completed within one second.
+    struct Bucket {
+        int64_t second = -1;
+        uint32_t total = 0;
+        uint32_t failed = 0;
+        uint32_t slow = 0;
+    };
+
+    /// @brief Whether a query failed because of the database rather than the query itself.
+    static bool isOutage(const std::exception_ptr& error) noexcept;
+
+    /// @brief Opens or closes the breaker from the buckets of the window. Called with `m_mutex` held.
+    void judge(std::chrono::steady_clock::time_point now);
+
+    const DbBreakerConfig m_cfg;
+    std::mutex m_mutex;
+    std::vector<Bucket> m_buckets;
+    std::chrono::steady_clock::time_point m_open_until{};
+    std::atomic<bool> m_open{false};
+};
+
+} // namespace server
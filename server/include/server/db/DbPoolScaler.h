@@ -0,0 +1,123 @@
+#pragma once
+
+#include <server/utils/server_config.h>
+#include <drogon/orm/DbClient.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+/**
+ * @file DbPoolScaler.h
+ * @brief Defines the shared DB clients that grow and shrink with their load.
+ */
+
+namespace server {
+
+/**
+ * @class ElasticDbPool
+ * @brief A `db_clients` entry together with the clients added to it under load. Thread-safe.
+ *
+ * @details A drogon client keeps the connections it was created with, so a pool grows by
+ * extra clients of `DbPoolConfig::step` connections to the same database and shrinks by
+ * dropping the last one added. `pick()` hands out the first client with a free connection,
+ * the configured one before those added, so the last one added is the first to go idle.
+ */
+class ElasticDbPool {
+public:
+    ElasticDbPool(std::string name, drogon::orm::DbClientPtr base);
+
+    /// @brief A client of the pool for the next operation, the configured one while the pool did not grow.
+    drogon::orm::DbClientPtr pick() const;
+
+    const std::string& name() const noexcept { return m_name; }
+
+    /// @brief The connections added to the pool under load, on top of its `connection_number`.
+    size_t addedConnections() const noexcept { return m_added.load(std::memory_order_relaxed); }
+
+private:
+    friend class DbPoolScaler;
+
+    /// @brief Whether no client of the pool has a free connection right now.
+    bool busy() const;
+
+    /// @brief Whether the configured client has no free connection right now.
+    bool baseBusy() const;
+
+    /// @brief Adds a client of `step` connections to the same database. Main loop only.
+    void grow(size_t step, std::chrono::milliseconds timeout);
+
+    /// @brief Removes the last client added, kept alive for `retire_after`. Main loop only.
+    void shrink(size_t step, std::chrono::seconds retire_after);
+
+    /// @brief Replaces the clients `pick()` chooses from.
+    void publish(std::vector<drogon::orm::DbClientPtr> members, size_t added);
+
+    const std::string m_name;
+    /// Swapped as a whole, readers keep the members they loaded for as long as they use them.
+    std::atomic<std::shared_ptr<const std::vector<drogon::orm::DbClientPtr>>> m_members;
+    std::atomic<size_t> m_added{0};
+    mutable std::atomic<size_t> m_next{0};
+
+    // Only touched on the main loop, set by `DbPoolScaler::start()`.
+    std::string m_conn_info;
+    size_t m_samples = 0;
+    size_t m_busy_samples = 0;
+    size_t m_base_busy_samples = 0;
+    size_t m_idle_windows = 0;
+    std::atomic<double> m_busy_ratio{0};
+    std::vector<std::pair<drogon::orm::DbClientPtr, std::chrono::steady_clock::time_point>> m_retiring;
+};
+
+/**
+ * @class DbPoolScaler
+ * @brief A singleton sizing the pools of `DatabaseConfig::write_client` and `read_client` to their load.
+ *
+ * @details Every `DbPoolConfig::sample_interval` each pool is looked at for a free connection.
+ * Once per `window`, a pool without one in at least `grow_busy_ratio` of the samples grows by
+ * `step` connections, up to `max_added_connections` on top of its own. One whose configured
+ * client had a free connection at every sample for `shrink_idle_windows` windows in a row,
+ * so that the connections added went unneeded, shrinks by a step. The connections added, the
+ * busy fraction, the operations in flight and their mean time over the last window, waiting
+ * for a connection included, are exported.
+ *
+ * The fast clients of the IO loops are left alone, drogon only creates those at startup.
+ */
+class DbPoolScaler {
+public:
+    static DbPoolScaler& instance();
+
+    /**
+     * @brief The pool a client was configured as, null when it is not resized.
+     * @details Called by whoever holds on to the client, to pick from the pool for each operation instead.
+     */
+    ElasticDbPool* poolOf(const drogon::orm::DbClientPtr& client);
+
+    /**
+     * @brief Takes the connection settings of the configured clients and starts sampling.
+     * @note Called once, on the main loop, once the clients are created.
+     */
+    void start();
+
+    /// @brief Records the time an operation took, for the mean of the window. Callable from any thread.
+    void record(std::chrono::steady_clock::duration elapsed) noexcept {
+        m_operations.fetch_add(1, std::memory_order_relaxed);
+        m_operation_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), std::memory_order_relaxed);
+    }
+
+private:
+    DbPoolScaler() = default;
+    DbPoolScaler(const DbPoolScaler&) = delete;
+    DbPoolScaler& operator=(const DbPoolScaler&) = delete;
+
+    /// @brief Grows or shrinks the pools from the samples of the window.
+    void judge();
+
+    DbPoolConfig m_cfg;
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<ElasticDbPool>> m_pools;
+    std::atomic<uint64_t> m_operations{0};
+    std::atomic<uint64_t> m_operation_ns{0};
+    std::atomic<double> m_mean_latency{0};
+};
+
+} // namespace server
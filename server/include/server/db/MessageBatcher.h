@@ -0,0 +1,150 @@
+#pragma once
+
+#include <drogon/orm/DbClient.h>
+#include <server/db/DbPoolScaler.h>
+#include <coroutine>
+#include <common/utils/tracing.h>
+
+/**
+ * @file MessageBatcher.h
+ * @brief Defines the write-behind stage that persists chat messages in multi-row inserts.
+ */
+
+namespace server {
+
+/**
+ * @struct StoredMessage
+ * @brief The server assigned identity of a persisted message.
+ */
+struct StoredMessage {
+    /// The primary key assigned by the database.
+    int32_t message_id;
+    /// The creation time in microseconds since epoch, as stored in `messages.created_at`.
+    int64_t created_at;
+    /// The number of the message within its room, as stored in `messages.seq`.
+    int64_t seq;
+};
+
+/**
+ * @brief What a history page is ordered and paged by.
+ * @details Timestamps can collide across servers and commit slightly out of order, seqs
+ * are exact. Pages by timestamp remain for clients that only know timestamps.
+ */
+enum class HistoryKey {
+    Timestamp,
+    Seq,
+};
+
+/**
+ * @brief Returns a creation timestamp for a new message, in microseconds since epoch.
+ * @details Timestamps are strictly increasing within the process, so messages persisted
+ * in the same statement never share a `created_at`, which history pagination relies on.
+ */
+int64_t nextMessageTimestamp();
+
+/**
+ * @class MessageBatcher
+ * @brief A singleton grouping message inserts that arrive within a short window into one statement.
+ *
+ * @details Each IO loop collects its own pending inserts, so enqueuing needs no locking.
+ * The first message of a batch arms a timer of `MessageBatchingConfig::window`; the batch
+ * is flushed when the timer fires or as soon as it reaches `max_batch_size`. A flush is a
+ * single `INSERT ... VALUES (...), (...) RETURNING` statement, and every waiting coroutine
+ * is resumed on its own loop with the ID assigned to its row.
+ *
+ * Messages with a reserved ID and messages without one are written in separate
+ * statements, each resolving its waiters the way its IDs were assigned.
+ *
+ * @note A failed statement fails every message of its batch.
+ */
+class MessageBatcher {
+public:
+    /**
+     * @brief Gets the singleton instance of the MessageBatcher.
+     * @return A reference to the single MessageBatcher instance.
+     */
+    static MessageBatcher& instance();
+
+private:
+    struct Pending {
+        int32_t room_id;
+        int32_t user_id;
+        std::string text;
+        int64_t created_at;
+        std::optional<int32_t> message_id;
+        std::optional<int64_t> seq;
+        std::coroutine_handle<> handle;
+        size_t loop_index;
+        std::optional<StoredMessage> result;
+        /// The trace of the suspended request, made current again on resumption.
+        common::TracePtr trace;
+        std::chrono::steady_clock::time_point queued_at;
+    };
+
+    /**
+     * @brief The awaitable returned by `insert()`. Owns the pending entry for the lifetime of the wait.
+     */
+    class InsertAwaitable {
+    public:
+        InsertAwaitable(MessageBatcher& batcher, Pending pending)
+            : m_batcher{batcher}, m_pending{std::move(pending)} {}
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h);
+        std::optional<StoredMessage> await_resume() noexcept {
+            if(m_pending.trace) {
+                m_pending.trace->addSpan("db.batch_insert", m_pending.queued_at, std::chrono::steady_clock::now());
+            }
+            common::setCurrentTrace(std::move(m_pending.trace));
+            return std::move(m_pending.result);
+        }
+
+    private:
+        MessageBatcher& m_batcher;
+        Pending m_pending;
+    };
+
+public:
+    /**
+     * @brief Queues a message for insertion and waits for its batch to be written.
+     * @param room_id The room the message is posted to.
+     * @param user_id The author of the message.
+     * @param text The message body.
+     * @param created_at The creation timestamp, usually from `nextMessageTimestamp()`.
+     * @param message_id An ID reserved in advance through `MessageIdAllocator`, or std::nullopt to let the database assign one.
+     * @param seq The seq reserved along with `message_id` through `Repository::reserveMessageSeq`.
+     * @return An awaitable resolving to the stored identity, or std::nullopt if the batch failed.
+     */
+    [[nodiscard]] InsertAwaitable insert(int32_t room_id, int32_t user_id, std::string text, int64_t created_at,
+                                         std::optional<int32_t> message_id = std::nullopt, std::optional<int64_t> seq = std::nullopt);
+
+private:
+    /// @brief The pending inserts of one IO loop, only touched on that loop.
+    struct LoopQueue {
+        std::vector<Pending*> pending;
+        bool flush_armed = false;
+    };
+
+    MessageBatcher();
+    MessageBatcher(const MessageBatcher&) = delete;
+    MessageBatcher& operator=(const MessageBatcher&) = delete;
+
+    /// @brief Adds an entry to the queue of its loop. Must run on that loop.
+    void enqueue(Pending* pending);
+
+    /// @brief Writes out everything queued on a loop. Must run on that loop.
+    void flush(size_t loop_index);
+
+    /// @brief Sends one batch as a single statement. Either every entry has a reserved ID and seq or none has.
+    void execute(std::vector<Pending*> entries, bool explicit_ids);
+
+    /// @brief Stores results and resumes every waiter of a finished batch on its own loop.
+    static void complete(std::vector<Pending*>& batch, const drogon::orm::Result* result, bool explicit_ids);
+
+    drogon::orm::DbClientPtr m_dbClient;
+    /// @brief The pool each statement picks its client from while `DbPoolConfig` resizes it, or null.
+    ElasticDbPool* m_pool;
+    std::vector<LoopQueue> m_queues;
+};
+
+} // namespace server
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <drogon/orm/DbClient.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+/**
+ * @file MessageCompression.h
+ * @brief Defines the compression of message bodies at rest in `messages`.
+ */
+
+struct ZSTD_CDict_s;
+struct ZSTD_DDict_s;
+
+namespace server {
+
+/**
+ * @class MessageCompression
+ * @brief A singleton compressing message bodies with zstd dictionaries trained on the deployment's own messages.
+ *
+ * @details Chat messages are too short for zstd to find much to reuse within one, a
+ * dictionary trained on recent messages gives it the common words and phrases up front.
+ * Dictionaries are stored in `message_dictionaries` and never change, a compressed row
+ * records the one it was compressed with in `dictionary_id`, so a newer dictionary only
+ * applies to the rows compressed after it.
+ *
+ * With `MessageCompressionConfig::enabled` a background job trains the first dictionary
+ * once there are enough messages and compresses, a batch per run, the messages older than
+ * `recompress_after`. Its progress is kept in memory, several servers doing it just repeat
+ * each other's work, so it is enabled on one. With `compress_on_write` new messages are
+ * stored compressed right away as well.
+ *
+ * Every server reads compressed rows: the queries of the history pages return both columns,
+ * `prepare()` fetches the dictionaries the rows refer to and `text()` gives the body back.
+ * Full-text search only sees the messages still stored as text, its index is on `message_text`.
+ */
+class MessageCompression {
+public:
+    /**
+     * @brief Gets the singleton instance of the MessageCompression.
+     * @return A reference to the single MessageCompression instance.
+     */
+    static MessageCompression& instance();
+
+    /// @brief A body as sent to the `message_text`, `message_body` and `dictionary_id` columns, exactly one of the first two set.
+    struct StoredBody {
+        std::optional<std::string> text;
+        std::optional<std::vector<char>> body;
+        std::optional<int32_t> dictionary_id;
+    };
+
+    /// @brief The columns of a new message, compressed when `compress_on_write` is set and that makes it smaller.
+    StoredBody encodeForWrite(std::string text) const;
+
+    /**
+     * @brief Fetches the dictionaries that rows of `messages` were compressed with and that are not known yet.
+     * @note Awaited before `text()` is called on the rows.
+     */
+    drogon::Task<> prepare(const drogon::orm::DbClientPtr& db, const drogon::orm::Result& rows);
+
+    /**
+     * @brief The body of a row with the `message_text`, `message_body` and `dictionary_id` columns.
+     * @throws std::runtime_error When the body cannot be decompressed.
+     */
+    std::string text(const drogon::orm::Row& row) const;
+
+    /// @brief Starts the background job when enabled, or the refresh of the dictionary for `compress_on_write`.
+    void start();
+
+private:
+    MessageCompression();
+    MessageCompression(const MessageCompression&) = delete;
+    MessageCompression& operator=(const MessageCompression&) = delete;
+
+    /// @brief The dictionary new bodies are compressed with, the newest.
+    struct Encoder {
+        int32_t dictionary_id;
+        std::shared_ptr<ZSTD_CDict_s> dictionary;
+    };
+    using Decoders = std::map<int32_t, std::shared_ptr<ZSTD_DDict_s>>;
+
+    /// @brief `text` compressed with the dictionary of `encoder`, nullopt when it is too short or does not get smaller.
+    static std::optional<std::vector<char>> compress(const Encoder& encoder, std::string_view text);
+
+    /// @brief Fetches the dictionaries newer than the newest known.
+    drogon::Task<> loadNewer(const drogon::orm::DbClientPtr& db);
+
+    /// @brief One run of the job: the dictionary refreshed, trained when there is none, and a batch compressed.
+    drogon::Task<> run();
+
+    /// @brief Samples recent messages and trains a dictionary on the main loop, then stores it.
+    drogon::Task<> train();
+
+    /// @brief Compresses the old messages of the next batch of ids.
+    drogon::Task<> recompressBatch();
+
+    drogon::orm::DbClientPtr m_dbClient;
+    /// Swapped as a whole, readers keep the ones they loaded.
+    std::atomic<std::shared_ptr<const Decoders>> m_decoders;
+    std::atomic<std::shared_ptr<const Encoder>> m_encoder;
+    /// Serializes the swaps of `m_decoders` and `m_encoder`.
+    std::mutex m_load_mutex;
+
+    std::once_flag m_timer_started;
+    /// Set while a run or a training is in progress, a slow one is not overlapped by the next run.
+    std::atomic<bool> m_running{false};
+    std::atomic<bool> m_training{false};
+    // Only touched by the runs, which do not overlap.
+    std::chrono::steady_clock::time_point m_next_training;
+    int32_t m_cursor = 0;
+};
+
+} // namespace server
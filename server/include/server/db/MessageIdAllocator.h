@@ -0,0 +1,48 @@
+#pragma once
+
+#include <drogon/orm/DbClient.h>
+
+/**
+ * @file MessageIdAllocator.h
+ * @brief Defines the allocator handing out message IDs ahead of their insertion.
+ */
+
+namespace server {
+
+/**
+ * @class MessageIdAllocator
+ * @brief A thread-safe singleton reserving blocks of `messages.message_id` values from the database sequence.
+ *
+ * @details Optimistic delivery broadcasts a message before it is persisted, so its ID must
+ * be known up front. IDs are drawn from the same sequence the `SERIAL` column uses, a block
+ * at a time, so they never collide with rows inserted without an explicit ID. IDs of
+ * messages that fail to persist are simply skipped, the sequence already tolerates gaps.
+ */
+class MessageIdAllocator {
+public:
+    /**
+     * @brief Gets the singleton instance of the MessageIdAllocator.
+     * @return A reference to the single MessageIdAllocator instance.
+     */
+    static MessageIdAllocator& instance();
+
+    /**
+     * @brief Returns the next reserved ID, fetching a new block from the database if needed.
+     * @return A task resolving to the ID, or std::nullopt if the sequence could not be reached.
+     */
+    drogon::Task<std::optional<int32_t>> next();
+
+private:
+    MessageIdAllocator();
+    MessageIdAllocator(const MessageIdAllocator&) = delete;
+    MessageIdAllocator& operator=(const MessageIdAllocator&) = delete;
+
+    /// @brief Pops an ID from the reserve, if any is left.
+    std::optional<int32_t> tryTake();
+
+    drogon::orm::DbClientPtr m_dbClient;
+    std::mutex m_mutex;
+    std::deque<int32_t> m_reserved;
+};
+
+} // namespace server
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <drogon/orm/DbClient.h>
+#include <atomic>
+#include <mutex>
+
+/**
+ * @file MessagePartitions.h
+ * @brief Defines the job keeping the monthly partitions of `messages` in place.
+ */
+
+namespace server {
+
+/**
+ * @class MessagePartitions
+ * @brief A singleton creating the coming partitions of `messages` and retiring the expired ones.
+ *
+ * @details `messages` is range partitioned by `created_at`, one partition per calendar
+ * month (UTC) named `messages_pYYYYMM`. There is no default partition, so the partition
+ * of the current month must exist before messages are sent in it: every run creates the
+ * partitions up to `MessagePartitionConfig::months_ahead` months ahead.
+ *
+ * With a retention set, partitions entirely older than it are detached, which is a
+ * catalog change rather than a delete and leaves nothing to vacuum. Detached partitions
+ * are kept as standalone tables for archiving unless `keep_detached` is off.
+ *
+ * Every server runs the job. Creation is serialized by an advisory lock, a detach another
+ * server already did just fails and is retried on the next run.
+ */
+class MessagePartitions {
+public:
+    /**
+     * @brief Gets the singleton instance of the MessagePartitions.
+     * @return A reference to the single MessagePartitions instance.
+     */
+    static MessagePartitions& instance();
+
+    /// @brief Runs the job now and then every `MessagePartitionConfig::interval`, unless disabled.
+    void start();
+
+    /// @brief Creates the missing partitions and detaches the expired ones, once.
+    drogon::Task<> maintain();
+
+private:
+    MessagePartitions();
+    MessagePartitions(const MessagePartitions&) = delete;
+    MessagePartitions& operator=(const MessagePartitions&) = delete;
+
+    /// @brief A partition of `messages` and its range of `created_at`, `to` excluded.
+    struct Partition {
+        std::string name;
+        int64_t from;
+        int64_t to;
+    };
+
+    drogon::Task<std::vector<Partition>> listPartitions();
+
+    /// @brief Creates the partitions of the current month and the next ones that no partition covers yet.
+    drogon::Task<> createUpcoming(const std::vector<Partition>& partitions);
+
+    /// @brief Detaches, and drops unless they are kept, the partitions ending before the retention.
+    drogon::Task<> retireExpired(const std::vector<Partition>& partitions);
+
+    drogon::orm::DbClientPtr m_dbClient;
+    std::once_flag m_timer_started;
+    /// Set while a run is in progress, a slow run is not overlapped by the next one.
+    std::atomic<bool> m_running{false};
+};
+
+} // namespace server
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <drogon/orm/DbClient.h>
+#include <server/db/MessageBatcher.h>
+#include <server/models/Users.h>
+
+/**
+ * @file Repository.h
+ * @brief Defines the fixed queries used on the server's hot paths.
+ */
+
+namespace server {
+
+/**
+ * @class Repository
+ * @brief The hot queries of the handlers, each declared once as constant SQL.
+ *
+ * @details `CoroMapper` renders its SQL from a `Criteria` on every call. These queries
+ * are instead kept as fixed, parameterized statements run through `execSqlCoro`, which
+ * lets the PostgreSQL client prepare each of them once per connection and reuse the plan.
+ *
+ * Every method accepts any `DbClient`, including a transaction, and must be awaited on an
+ * IO loop like the rest of the database calls. Database errors propagate as
+ * `drogon::orm::DrogonDbException`.
+ */
+class Repository {
+public:
+    /// @brief Looks up a user by their unique name.
+    static drogon::Task<std::optional<drogon_model::drogon_test::Users>> findUserByName(const drogon::orm::DbClientPtr& db, const std::string& username);
+
+    /// @brief Looks up a user by ID.
+    static drogon::Task<std::optional<drogon_model::drogon_test::Users>> findUserById(const drogon::orm::DbClientPtr& db, int32_t user_id);
+
+    /// @brief Returns the membership status of a user in a room, if they have a membership row.
+    static drogon::Task<std::optional<chat::MembershipStatus>> findMembershipStatus(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id);
+
+    /// @brief Returns the rooms a user has joined.
+    static drogon::Task<std::vector<int32_t>> findJoinedRoomIds(const drogon::orm::DbClientPtr& db, int32_t user_id);
+
+    /// @brief Every member of a room with their effective rights, `ADMIN`, `OWNER` or `MODERATOR` in a `rights` column, NULL for regular members.
+    static drogon::Task<drogon::orm::Result> findRoomRoster(const drogon::orm::DbClientPtr& db, int32_t room_id);
+
+    /// @brief The member count of a room, as one row with a `members` column, so it takes the roster's place in a join.
+    static drogon::Task<drogon::orm::Result> countRoomMembers(const drogon::orm::DbClientPtr& db, int32_t room_id);
+
+    /**
+     * @brief Appends the room list of a login to `out`, with the membership and unread count of the user.
+     * @param joined_only Leaves out the rooms the user has not joined, a clustered client pages through them with `ListRoomsRequest`.
+     */
+    static drogon::Task<> loadRoomList(const drogon::orm::DbClientPtr& db, int32_t user_id, bool joined_only, google::protobuf::RepeatedPtrField<chat::RoomInfo>& out);
+
+    /// @brief Appends every room with its number of joined members to `out`, the snapshot of the aggregator's room directory.
+    static drogon::Task<> loadRoomDirectory(const drogon::orm::DbClientPtr& db, google::protobuf::RepeatedPtrField<chat::RoomDirectoryEntry>& out);
+
+    /**
+     * @brief Reads a history page, with the same semantics as `GetMessagesRequest`.
+     * @param offset The `offset_ts` or, keyed by `HistoryKey::Seq`, the `offset_seq` of the request.
+     * @return The messages with their authors, newest first for a positive limit and oldest first otherwise.
+     */
+    static drogon::Task<std::vector<chat::MessageInfo>> findMessagesPage(const drogon::orm::DbClientPtr& db, int32_t room_id, int32_t limit, int64_t offset,
+                                                                         HistoryKey key = HistoryKey::Timestamp);
+
+    /// @brief Reads a history page like the overload above, appending it to `out` and so onto its arena, if any.
+    static drogon::Task<> findMessagesPage(const drogon::orm::DbClientPtr& db, int32_t room_id, int32_t limit, int64_t offset,
+                                           google::protobuf::RepeatedPtrField<chat::MessageInfo>& out, HistoryKey key = HistoryKey::Timestamp);
+
+    /// @brief What `findMessagesAround()` found besides the messages.
+    struct MessageWindow {
+        /// False when the room has no message with the id.
+        bool found = false;
+        bool has_older = false;
+        bool has_newer = false;
+    };
+
+    /**
+     * @brief Appends the messages around one to `out` in one query, with the semantics of `GetMessagesAroundRequest`.
+     * @details Oldest first, up to `before` older than the message, the message itself unless it was deleted,
+     * and up to `after` newer, each side read one message further to tell whether the room goes on.
+     */
+    static drogon::Task<MessageWindow> findMessagesAround(const drogon::orm::DbClientPtr& db, int32_t room_id, int32_t message_id, int32_t before,
+                                                         int32_t after, google::protobuf::RepeatedPtrField<chat::MessageInfo>& out);
+
+    /**
+     * @brief Appends a page of the members of a room to `out`, highest rights first, then by name.
+     * @param prefix Only the members whose name starts with it, case-insensitively.
+     * @param after The last member of the previous page, as sent to the client, or null for the first page.
+     * @details The rights are the effective ones, as in the roster of a join, unset for regular members.
+     */
+    static drogon::Task<> findRoomMembers(const drogon::orm::DbClientPtr& db, int32_t room_id, std::string_view prefix, const chat::UserInfo* after,
+                                          int32_t limit, google::protobuf::RepeatedPtrField<chat::UserInfo>& out);
+
+    /**
+     * @brief Full-text searches the messages older than `before_ts` in the rooms `user_id` can see, newest first.
+     * @param room_id Restricts the search to one room, 0 searches all of them.
+     * @details `query` is parsed like a web search. The hits are appended to `out`, at most `limit` of them.
+     */
+    static drogon::Task<> searchMessages(const drogon::orm::DbClientPtr& db, int32_t user_id, const std::string& query, int32_t room_id,
+                                         int64_t before_ts, int32_t limit, google::protobuf::RepeatedPtrField<chat::SearchHit>& out);
+
+    /**
+     * @brief Reads the deletions of a room in `(since, until]`, oldest first.
+     * @return The ids of the deleted messages with their deletion timestamps, at most `limit` of them.
+     */
+    static drogon::Task<std::vector<std::pair<int32_t, int64_t>>> findTombstones(const drogon::orm::DbClientPtr& db, int32_t room_id, int64_t since, int64_t until, int32_t limit);
+
+    /**
+     * @brief Marks a message of a room deleted and records its tombstone, in one statement.
+     * @return False if the room has no such message, or it was already deleted.
+     */
+    static drogon::Task<bool> softDeleteMessage(const drogon::orm::DbClientPtr& db, int32_t message_id, int32_t room_id);
+
+    /**
+     * @brief Deletes the newest `count` messages a user left in a room, like `softDeleteMessage`.
+     * @return The ids of the messages deleted, in no particular order.
+     */
+    static drogon::Task<std::vector<int32_t>> softDeleteUserMessages(const drogon::orm::DbClientPtr& db, int32_t room_id, int32_t user_id, int32_t count);
+
+    /// @brief Moves a user's read cursor of a room up to `seq`, capped at the room's last seq. Never moves it back.
+    static drogon::Task<> markRoomRead(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id, int64_t seq);
+
+    /**
+     * @brief The last seq of a room, if the user may moderate it.
+     * @return The seq, or nullopt if the room does not exist or the user is neither an admin, its owner nor one of its moderators.
+     */
+    static drogon::Task<std::optional<int64_t>> findModeratedLastSeq(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id);
+
+    /// @brief Inserts a message, letting the database assign its ID and timestamp.
+    static drogon::Task<StoredMessage> insertMessage(const drogon::orm::DbClientPtr& db, int32_t room_id, int32_t user_id, const std::string& text);
+
+    /// @brief Inserts a message with an ID, timestamp and seq assigned in advance.
+    static drogon::Task<void> insertMessage(const drogon::orm::DbClientPtr& db, const StoredMessage& stored, int32_t room_id, int32_t user_id, const std::string& text);
+
+    /**
+     * @brief Takes the next seq of a room for a message inserted later, see `insertMessage`.
+     * @details Unlike the seq the insert itself takes, a reserved one does not hold the room
+     * until the message commits: the message may commit after one with a higher seq, or never.
+     * The seq stays reserved until the insert or `releaseMessageSeq`, and `findSettledSeq`
+     * stays below it meanwhile.
+     * @return The seq, or nullopt if the room does not exist.
+     */
+    static drogon::Task<std::optional<int64_t>> reserveMessageSeq(const drogon::orm::DbClientPtr& db, int32_t room_id);
+
+    /// @brief Gives up a reserved seq whose message will not be inserted, it is left unused.
+    static drogon::Task<void> releaseMessageSeq(const drogon::orm::DbClientPtr& db, int32_t room_id, int64_t seq);
+
+    /**
+     * @brief The highest seq of a room below which every message has committed or never will.
+     * @details Read before the messages of a sync, a cursor up to it skips no message committing late.
+     * @return The seq, or nullopt if the room does not exist.
+     */
+    static drogon::Task<std::optional<int64_t>> findSettledSeq(const drogon::orm::DbClientPtr& db, int32_t room_id);
+
+    /**
+     * @brief Explains every query above with sequential scans disabled and reports those still planned with one.
+     * @details With `enable_seqscan` off the planner only picks a sequential scan when no index
+     * can serve the query, so an empty table is as good as a seeded one. Nothing is executed.
+     * @return `<query>: <relation>` for each sequential scan found, empty if every query uses an index.
+     */
+    static drogon::Task<std::vector<std::string>> findSequentialScans(const drogon::orm::DbClientPtr& db);
+
+private:
+    Repository() = delete;
+};
+
+} // namespace server
@@ -1,8 +1,47 @@
 #pragma once
 
+#include <string>
+#include <string_view>
+#include <vector>
+
 namespace server {
 
+/// @brief Strips leading and trailing whitespace.
+inline std::string trim(std::string_view str) {
+    using namespace std::literals;
+    auto start = str.find_first_not_of(" \t\n\r\f\v"sv);
+    if(start == std::string_view::npos) {
+        return "";
+    }
+    auto end = str.find_last_not_of(" \t\n\r\f\v"sv);
+    return std::string(str.substr(start, end - start + 1));
+}
+
+/**
+ * @brief Splits a migration script into its trimmed statements.
+ * @details Statements end at a `;` outside of string literals, quoted identifiers, dollar-quoted
+ * bodies and comments, so functions and `DO` blocks stay whole. Comments before a statement are
+ * kept with it, chunks holding nothing but comments are dropped.
+ */
+std::vector<std::string> splitSqlStatements(std::string_view script);
+
+/**
+ * @brief Whether a migration script asks to run outside of a transaction.
+ * @details Set by a `-- migrate:no-transaction` line among the comments the file starts with,
+ * for statements like `CREATE INDEX CONCURRENTLY` that refuse to run in one. Each statement then
+ * commits on its own: a failure leaves the earlier ones applied and the file is run again in full
+ * on the next start, so such files must be re-runnable (`IF NOT EXISTS`, and dropping an index a
+ * failed concurrent build left invalid before building it again).
+ */
+bool isNonTransactional(std::string_view script);
+
 //–– Coroutine to apply migrations –––––––––––––––––––––––––––––––––––––––––
+/**
+ * @brief Applies `main.sql` to an empty database, then the migration files not applied yet.
+ * @details Every server calls it at boot. An advisory lock lets one of them migrate while the
+ * others wait, they then find everything applied. The lock is held by a transaction of its own,
+ * so the client needs at least two connections.
+ */
 drogon::Task<bool> MigrateDatabase(drogon::orm::DbClientPtr db);
 
 } // namespace server
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <drogon/utils/coroutine.h>
+#include <coroutine>
+#include <cstddef>
+
+/**
+ * @file coro_frame_pool.h
+ * @brief Per-thread pooling of the coroutine frames of `drogon::Task`.
+ *
+ * @details Every request runs through several `drogon::Task` coroutines, each allocating its
+ * frame on the first call and freeing it when done, from whichever IO or database thread it
+ * ended on. This header makes every `drogon::Task` coroutine compiled after it take its frame
+ * from `frame_pool` instead, through a `std::coroutine_traits` specialization selecting
+ * `pooled_promise`. It is part of the server's precompiled header so no translation unit sees
+ * a different promise type for the same coroutine.
+ */
+
+namespace server {
+
+namespace frame_pool {
+
+/**
+ * @brief Allocates a coroutine frame of `size` bytes from the calling thread's pool.
+ * @details Sizes are rounded up to classes of `GRANULE` bytes, frames over `MAX_POOLED` bytes and
+ * those of an empty class come from the global allocator.
+ */
+void* allocate(std::size_t size);
+
+/**
+ * @brief Returns a frame of `size` bytes to the calling thread's pool.
+ * @details Any thread takes any frame of its class, the one freeing it need not be the one that
+ * allocated it. A class already holding `MAX_CACHED` frames hands it to the global allocator.
+ */
+void deallocate(void* ptr, std::size_t size) noexcept;
+
+/// @brief The size classes are multiples of this.
+inline constexpr std::size_t GRANULE = 64;
+/// @brief Larger frames are not pooled.
+inline constexpr std::size_t MAX_POOLED = 4096;
+/// @brief Frames kept per size class and thread.
+inline constexpr std::size_t MAX_CACHED = 512;
+
+} // namespace frame_pool
+
+/**
+ * @brief A coroutine promise allocating its frame from `frame_pool`, otherwise `Promise` itself.
+ *
+ * @details `Promise` knows its coroutine by `std::coroutine_handle<Promise>`, which this
+ * promise, its only base and of the same alignment, shares the address of. Only the final
+ * awaiter is given a handle by the compiler, so it is the one wrapped to convert it.
+ */
+template <typename Promise>
+struct pooled_promise : Promise {
+    using Promise::Promise;
+
+    static void* operator new(std::size_t size) {
+        return frame_pool::allocate(size);
+    }
+
+    static void operator delete(void* ptr, std::size_t size) noexcept {
+        frame_pool::deallocate(ptr, size);
+    }
+
+    auto final_suspend() noexcept {
+        using inner_awaiter = decltype(std::declval<Promise&>().final_suspend());
+        struct awaiter {
+            inner_awaiter inner;
+
+            bool await_ready() noexcept {
+                return inner.await_ready();
+            }
+
+            auto await_suspend(std::coroutine_handle<pooled_promise> handle) noexcept {
+                return inner.await_suspend(std::coroutine_handle<Promise>::from_promise(handle.promise()));
+            }
+
+            void await_resume() noexcept {
+                inner.await_resume();
+            }
+        };
+        return awaiter{Promise::final_suspend()};
+    }
+};
+
+} // namespace server
+
+template <typename T, typename... Args>
+struct std::coroutine_traits<drogon::Task<T>, Args...> {
+    using promise_type = server::pooled_promise<typename drogon::Task<T>::promise_type>;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <server/utils/server_config.h>
+
+/**
+ * @file cpu_pinning.h
+ * @brief The thread-per-core mode: every IO loop on a CPU of its own, everything else off them.
+ *
+ * @details Left to the scheduler, IO loops migrate between cores and share them with the
+ * threads of the shared DB clients, which costs cache warmth and shows in the tail latency.
+ * With `CpuPinningConfig::enabled`:
+ *
+ * - the main thread is restricted to the shared CPUs before the application starts, so the
+ *   threads it starts (DB clients, timers) inherit them;
+ * - each IO loop is then pinned to its own CPU. Unless given explicitly the CPUs are taken
+ *   node by node, so neighbouring loops share a NUMA node, and the shared CPUs are the ones
+ *   left over, or all allowed ones when none are;
+ * - with `reuse_port` every IO loop gets a listener of its own and the kernel spreads the
+ *   connections over them, instead of one loop accepting them all.
+ *
+ * The fast DB clients run on the IO loops and follow them. Only Linux is supported, elsewhere
+ * the mode logs a warning and does nothing.
+ */
+
+namespace server {
+
+/**
+ * @brief Plans the CPUs, restricts the calling thread to the shared ones and sets up `SO_REUSEPORT`.
+ * @note Must be called on the main thread after the config is loaded and before `drogon::app().run()`.
+ */
+void prepareCpuPinning(const CpuPinningConfig& config);
+
+/**
+ * @brief Pins every IO loop to its planned CPU and logs the mapping.
+ * @note Must be called once the loops run, e.g. from a beginning advice.
+ */
+void pinIoLoops(const CpuPinningConfig& config);
+
+} // namespace server
@@ -2,6 +2,7 @@
 
 #include <common/utils/utils.h>
 #include <server/utils/switch_to_io_loop.h>
+#include <server/utils/server_config.h>
 
 /**
  * @file scoped_coro_transaction.h
@@ -14,7 +15,7 @@ namespace server {
 /// A filled optional contains a string with the error message.
 using ScopedTransactionResult =
     std::optional<std::string>;
-/// @brief The function type for a lambda to be executed within a transaction.
+/// @brief The function type for a lambda to be executed within a transaction, where one has to be stored.
 /// It receives the transaction object and must return a Task resolving to a ScopedTransactionResult.
 using ScopedTransactionFunc =
     std::function<drogon::Task<ScopedTransactionResult>(
@@ -49,77 +50,178 @@ namespace detail {
 
         void await_suspend(std::coroutine_handle<> handle) noexcept {
             m_h = handle;
-            LOG_TRACE << "Installing commit callback";
             m_tx->setCommitCallback([this](bool ok) {
-                LOG_TRACE << "Commit callback fired: " << (ok ? "success" : "failure");
                 setValue(ok);
                 m_h.resume();
             });
-            LOG_TRACE << "Releasing transaction reference to allow destructor/commit";
+            // Dropping the last reference commits the transaction.
             m_tx.reset();
         }
     };
 } // namespace detail
 
+/**
+ * @enum IsolationLevel
+ * @brief The isolation level a transaction runs at, see `TransactionOptions`.
+ */
+enum class IsolationLevel {
+    /// The server's `default_transaction_isolation`, read committed unless configured otherwise.
+    Default,
+    ReadCommitted,
+    RepeatableRead,
+    Serializable
+};
+
+/**
+ * @struct TransactionOptions
+ * @brief How `WithTransaction` opens its transaction and what it does when it fails.
+ */
+struct TransactionOptions {
+    IsolationLevel isolation = IsolationLevel::Default;
+    /// Whether the transaction only reads. PostgreSQL then skips the bookkeeping of writes, and
+    /// a read replica can serve it.
+    bool read_only = false;
+    /// With `Serializable` and `read_only`: waits for a snapshot that can never fail to serialize.
+    bool deferrable = false;
+    /// How many times the whole transaction is run again after a serialization failure or a
+    /// deadlock, SQLSTATE 40001 and 40P01. The lambda must then be safe to run more than once.
+    uint32_t retries = 0;
+    /// The client the transaction runs on, `loopWriteDbClient()` when unset.
+    drogon::orm::DbClientPtr db = nullptr;
+};
+
+namespace detail {
+    /// @brief The `SET TRANSACTION` statement giving the transaction its modes, empty when it keeps the defaults.
+    inline std::string transactionModes(const TransactionOptions& options) {
+        std::string modes;
+        switch(options.isolation) {
+            case IsolationLevel::Default:
+                break;
+            case IsolationLevel::ReadCommitted:
+                modes += " ISOLATION LEVEL READ COMMITTED";
+                break;
+            case IsolationLevel::RepeatableRead:
+                modes += " ISOLATION LEVEL REPEATABLE READ";
+                break;
+            case IsolationLevel::Serializable:
+                modes += " ISOLATION LEVEL SERIALIZABLE";
+                break;
+        }
+        if(options.read_only) {
+            modes += " READ ONLY";
+            if(options.deferrable) {
+                modes += " DEFERRABLE";
+            }
+        }
+        return modes.empty() ? modes : "SET TRANSACTION" + modes;
+    }
+
+    /// @brief Whether a failure goes away by running the transaction again: a serialization failure or a deadlock.
+    inline bool isRetriable(const drogon::orm::DrogonDbException& e) {
+        const auto* sql = dynamic_cast<const drogon::orm::SqlError*>(&e);
+        return sql && (sql->sqlState() == "40001" || sql->sqlState() == "40P01");
+    }
+
+    /**
+     * @brief Runs `userLambda` in one transaction opened as `options` say.
+     * @param retriable Set when the transaction failed in a way running it again may fix.
+     * @note This is an internal helper for WithTransaction and should not be used directly.
+     */
+    template <typename Fn>
+    drogon::Task<ScopedTransactionResult> runTransaction(const TransactionOptions& options, Fn& userLambda, bool& retriable) {
+        std::shared_ptr<drogon::orm::Transaction> tx;
+        retriable = false;
+
+        try {
+            auto db = options.db ? options.db : loopWriteDbClient();
+            if(!db) {
+                LOG_ERROR << "DB client not available";
+                co_return "Internal: DB client unavailable";
+            }
+
+            tx = co_await switch_to_io_loop(db->newTransactionCoro());
+            LOG_TRACE << "Transaction started";
+
+            if(const auto modes = transactionModes(options); !modes.empty()) {
+                co_await switch_to_io_loop(tx->execSqlCoro(modes));
+            }
+
+            if(auto err = co_await userLambda(tx)) {
+                LOG_DEBUG << "User lambda returned error, rolling back";
+                tx->rollback();
+                co_return err;
+            }
+
+            // A commit that failed is not retried, drogon does not tell why it did.
+            if(!co_await switch_to_io_loop(CommitAwaiter{std::move(tx)})) {
+                LOG_ERROR << "Commit failed via callback";
+                co_return "Transaction commit failed";
+            }
+
+            LOG_TRACE << "Transaction committed successfully";
+        } catch(const drogon::orm::DrogonDbException &e) {
+            retriable = isRetriable(e);
+            if(retriable) {
+                LOG_DEBUG << "Transaction failed to serialize: " << e.base().what();
+            } else {
+                LOG_ERROR << "DrogonDbException: " << e.base().what();
+            }
+            if(tx) {
+                tx->rollback();
+            }
+            co_return std::string("DB exception: ") + e.base().what();
+        } catch(const std::exception &e) {
+            LOG_ERROR << "std::exception during transaction: " << e.what();
+            if(tx) {
+                tx->rollback();
+            }
+            co_return std::string("Unexpected error: ") + e.what();
+        }
+
+        co_return std::nullopt;
+    }
+} // namespace detail
+
 /**
  * @brief A high-level wrapper that executes a lambda within a database transaction.
  *
  * @details This function abstracts away the complexity of manual transaction
  * management in a coroutine-based environment. It handles starting the
- * transaction, executing the user's logic, and correctly committing or rolling
- * back based on the outcome.
+ * transaction on the client `options` name, giving it its modes, executing the
+ * user's logic, and correctly committing or rolling back based on the outcome.
  *
  * The user provides a lambda containing their database operations.
  * - If the lambda returns an empty `std::optional`, the transaction is committed.
  * - If the lambda returns an optional with an error string, the transaction is rolled back, and the error is propagated.
  * - If the commit itself fails, an error is returned.
  * - Any exceptions thrown during the process are caught, the transaction is rolled back, and an error is returned.
+ *   Serialization failures and deadlocks escaping the lambda run it again, up to `TransactionOptions::retries` times.
+ *
+ * The lambda is taken as it is, without a `std::function` around it, and lives in the
+ * coroutine frame until the transaction is done.
  *
+ * @param options The modes of the transaction, its client and retries.
  * @param userLambda The function to execute. It receives the transaction
  *        object and must return a `drogon::Task<ScopedTransactionResult>`.
  * @return A `drogon::Task` that resolves to `std::nullopt` on success, or a
  *         string error message on failure.
  */
-inline drogon::Task<ScopedTransactionResult> WithTransaction(ScopedTransactionFunc userLambda) {
-    std::shared_ptr<drogon::orm::Transaction> tx;
-
-    try {
-        auto db = drogon::app().getDbClient();
-        if(!db) {
-            LOG_ERROR << "DB client not available";
-            co_return "Internal: DB client unavailable";
+template <typename Fn>
+drogon::Task<ScopedTransactionResult> WithTransaction(TransactionOptions options, Fn userLambda) {
+    for(uint32_t attempt = 0;; ++attempt) {
+        bool retriable = false;
+        auto result = co_await detail::runTransaction(options, userLambda, retriable);
+        if(!retriable || attempt >= options.retries) {
+            co_return result;
         }
-
-        tx = co_await switch_to_io_loop(db->newTransactionCoro());
-        LOG_TRACE << "Transaction started";
-
-        if(auto err = co_await userLambda(tx)) {
-            LOG_DEBUG << "User lambda returned error, rolling back";
-            tx->rollback();
-            co_return err;
-        }
-
-        if(!co_await switch_to_io_loop(detail::CommitAwaiter{std::move(tx)})) {
-            LOG_ERROR << "Commit failed via callback";
-            co_return "Transaction commit failed";
-        }
-
-        LOG_TRACE << "Transaction committed successfully";
-    } catch(const drogon::orm::DrogonDbException &e) {
-        LOG_ERROR << "DrogonDbException: " << e.base().what();
-        if(tx) {
-            tx->rollback();
-        }
-        co_return std::string("DB exception: ") + e.base().what();
-    } catch(const std::exception &e) {
-        LOG_ERROR << "std::exception during transaction: " << e.what();
-        if(tx) {
-            tx->rollback();
-        }
-        co_return std::string("Unexpected error: ") + e.what();
+        LOG_DEBUG << "Running the transaction again, attempt " << attempt + 2;
     }
+}
 
-    co_return std::nullopt;
+/// @brief Executes a lambda within a default read-write transaction on the write client, see the overload above.
+template <typename Fn>
+drogon::Task<ScopedTransactionResult> WithTransaction(Fn userLambda) {
+    return WithTransaction(TransactionOptions{}, std::move(userLambda));
 }
 
 } // namespace server
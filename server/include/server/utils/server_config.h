@@ -0,0 +1,1036 @@
+#pragma once
+
+#include <json/json.h>
+#include <common/utils/tls.h>
+#include <common/utils/profiler.h>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @file server_config.h
+ * @brief Typed access to the server specific `custom_config` section of `config.json`.
+ */
+
+namespace server {
+
+/**
+ * @struct MessageBatchingConfig
+ * @brief Settings of the write-behind stage that groups message inserts into multi-row statements.
+ */
+struct MessageBatchingConfig {
+    /// Whether `handleSendMessage` persists through the batcher instead of one transaction per message.
+    bool enabled = false;
+    /// How long the first message of a batch may wait for others to join it.
+    std::chrono::milliseconds window{5};
+    /// A batch is flushed immediately once it holds this many messages.
+    size_t max_batch_size = 256;
+};
+
+/**
+ * @struct MessageDeliveryConfig
+ * @brief Settings controlling when a sent message is broadcast relative to its persistence.
+ */
+struct MessageDeliveryConfig {
+    /// When set, a message is broadcast before it is committed and retracted if persisting it fails.
+    bool optimistic = false;
+    /// How many message IDs are reserved from the sequence per round trip in optimistic mode.
+    int64_t id_block_size = 100;
+    /// How long a `client_key` is remembered, a retry of the message within it is not sent again, see `MessageKeys`.
+    std::chrono::milliseconds dedupe_window{300000};
+};
+
+/**
+ * @struct HistoryCacheConfig
+ * @brief Settings of the in-memory tail of recent messages per room.
+ */
+struct HistoryCacheConfig {
+    /// When set, latest and near-tail history pages are served from memory.
+    bool enabled = true;
+    /// How many of the most recent messages are kept per room.
+    size_t messages_per_room = 200;
+};
+
+/**
+ * @struct WarmupConfig
+ * @brief Settings of the cache loading before the server reports itself ready, see `CacheWarmup`.
+ */
+struct WarmupConfig {
+    /// Whether the caches are loaded at startup, otherwise the server is ready right after migrating.
+    bool enabled = true;
+    /// How many of the most recently active rooms get their metadata and history tail loaded.
+    size_t rooms = 200;
+};
+
+/**
+ * @struct MessagePartitionConfig
+ * @brief Settings of the monthly partitions of `messages`, see `MessagePartitions`.
+ */
+struct MessagePartitionConfig {
+    /// Whether this server creates the coming partitions and retires the expired ones.
+    bool enabled = true;
+    /// How often the partitions are checked.
+    std::chrono::seconds interval{3600};
+    /// How many months past the current one get their partition ahead of time.
+    int months_ahead = 2;
+    /// How long messages stay in `messages`, older whole months are detached. 0 keeps every message.
+    std::chrono::days retention{0};
+    /// Whether detached partitions are kept as standalone tables for archiving, instead of dropped.
+    bool keep_detached = true;
+};
+
+/**
+ * @struct MessageCompressionConfig
+ * @brief Settings of the compression of stored message bodies, see `MessageCompression`.
+ */
+struct MessageCompressionConfig {
+    /// Whether this server trains a dictionary and recompresses old messages. Compressed rows are read either way.
+    bool enabled = false;
+    /// Whether new messages are stored compressed right away, instead of once they are `recompress_after` old.
+    bool compress_on_write = false;
+    /// Bodies shorter than this are stored as text, a frame would not pay for itself.
+    size_t min_bytes = 64;
+    /// The zstd level, 1 to 19.
+    int level = 3;
+    /// The size of the dictionary trained.
+    size_t dictionary_bytes = 112640;
+    /// The recent messages the dictionary is trained on.
+    size_t train_samples = 20000;
+    /// How old a message gets before the background job compresses it.
+    std::chrono::days recompress_after{30};
+    /// The message ids looked at per run of the job.
+    size_t batch_size = 500;
+    /// How often the job runs.
+    std::chrono::seconds interval{10};
+};
+
+/**
+ * @struct DatabaseConfig
+ * @brief Names of the `db_clients` entries used for writes and for read-only queries.
+ */
+struct DatabaseConfig {
+    /// The client on the primary, used by transactions and every write.
+    std::string write_client = "default";
+    /// The client read-only handlers use, typically pointing at a replica pool.
+    std::string read_client = "default";
+    /**
+     * A fast client (`"is_fast": true`) on the same database as `write_client`, empty for none.
+     * Its connections belong to the IO loops, so the handlers' queries and transactions are sent
+     * and answered on the loop of their connection instead of going through a shared client's threads.
+     */
+    std::string fast_write_client;
+    /// The fast client for `read_client`, empty for none. Without it reads use `fast_write_client` when both clients are the same.
+    std::string fast_read_client;
+    /// Whether startup fails when a hot query is planned with a sequential scan, see `Repository::findSequentialScans`.
+    bool verify_plans = false;
+
+    /**
+     * @brief The client names above that no entry of the top-level `db_clients` array has, empty when all exist.
+     * @details Checked once the config is loaded, `drogon::app().getDbClient()` asserts on an unknown name.
+     */
+    std::vector<std::string> missingClients(const Json::Value& db_clients) const {
+        std::vector<std::string> missing;
+        for(const auto* name : {&write_client, &read_client, &fast_write_client, &fast_read_client}) {
+            if(name->empty() || std::ranges::find(missing, *name) != missing.end()) {
+                continue;
+            }
+            const bool found = std::ranges::any_of(db_clients, [name](const Json::Value& client) {
+                return client.get("name", "default").asString() == *name;
+            });
+            if(!found) {
+                missing.push_back(*name);
+            }
+        }
+        return missing;
+    }
+};
+
+/**
+ * @struct DbBreakerConfig
+ * @brief Settings of the circuit breaker shedding non-critical requests while the database struggles, see `DbCircuitBreaker`.
+ */
+struct DbBreakerConfig {
+    /// Whether requests are shed at all, the health figures are kept either way.
+    bool enabled = true;
+    /// How far back the query outcomes are looked at.
+    std::chrono::seconds window{10};
+    /// The fewest queries in the window for it to be judged, below that the breaker stays closed.
+    size_t min_queries = 20;
+    /// The fraction of queries failing with a timeout or a lost connection that opens the breaker.
+    double error_ratio = 0.5;
+    /// A query taking at least this long counts as slow.
+    std::chrono::milliseconds slow_query{1000};
+    /// The fraction of slow queries that opens the breaker.
+    double slow_ratio = 0.5;
+    /// How long the breaker stays open before the window is judged again.
+    std::chrono::seconds open_for{5};
+    /// The handlers answered with `STATUS_UNAVAILABLE` while it is open, by name as in the rate limits.
+    std::vector<std::string> shed{"SyncRoom", "SearchMessages"};
+};
+
+/**
+ * @struct DbPoolConfig
+ * @brief Settings of the shared DB clients grown and shrunk with their load, see `DbPoolScaler`.
+ * @details The `connection_number` of a client in `db_clients` is the least it keeps,
+ * the connections added under load come on top of it.
+ */
+struct DbPoolConfig {
+    /// Whether the pools of `write_client` and `read_client` are resized at all.
+    bool enabled = false;
+    /// The most connections added to a pool on top of its own.
+    size_t max_added_connections = 16;
+    /// The connections added or removed at a time.
+    size_t step = 2;
+    /// How often the pools are looked at for a free connection.
+    std::chrono::milliseconds sample_interval{100};
+    /// How often the samples are judged.
+    std::chrono::seconds window{5};
+    /// The fraction of samples without a free connection that grows a pool by a step.
+    double grow_busy_ratio = 0.5;
+    /// The windows in a row with a free connection at every sample that shrink a pool by a step.
+    size_t shrink_idle_windows = 12;
+    /// How long the connections removed are kept for the queries still running on them.
+    std::chrono::seconds retire_after{30};
+    /// The `timeout` of the clients added, which drogon does not tell of the configured ones. 0 for none.
+    std::chrono::milliseconds query_timeout{5000};
+};
+
+/**
+ * @struct PipelineConfig
+ * @brief Limits of the per-connection request pipeline, see `ConnectionContext`.
+ */
+struct PipelineConfig {
+    /// How many concurrent requests of one connection may run at the same time.
+    size_t depth = 8;
+    /// How many requests of one connection may wait before new ones are rejected.
+    size_t max_queued = 256;
+    /// How many requests one `BatchRequest` may carry.
+    size_t max_batch = 32;
+};
+
+/**
+ * @struct OutboundConfig
+ * @brief Backpressure limits of a connection's outgoing frames, see `ConnectionContext::admitOutbound()`.
+ */
+struct OutboundConfig {
+    /// The estimated backlog above which droppable events are discarded.
+    size_t high_watermark_bytes = 1024 * 1024;
+    /// The estimated backlog a connection must get back below to leave the overloaded state.
+    size_t low_watermark_bytes = 256 * 1024;
+    /// The slowest read rate a healthy client is expected to sustain.
+    size_t min_drain_bytes_per_sec = 256 * 1024;
+    /// How long a connection may stay overloaded before it is closed.
+    std::chrono::milliseconds evict_after{10'000};
+    /// The estimated backlog of responses above which further response frames wait behind the live events, 0 to never hold them.
+    size_t response_window_bytes = 64 * 1024;
+    /// The read rate the response backlog is assumed to drain at.
+    size_t response_drain_bytes_per_sec = 4 * 1024 * 1024;
+};
+
+/**
+ * @struct TypingConfig
+ * @brief Settings of the per-room typing indicator aggregation, see `TypingAggregator`.
+ */
+struct TypingConfig {
+    /// How often each room receives at most one typing snapshot.
+    std::chrono::milliseconds interval{500};
+};
+
+/**
+ * @struct PresenceConfig
+ * @brief Settings of the per-room join/leave coalescing in `ChatRoomManager`.
+ */
+struct PresenceConfig {
+    /// How long presence changes of a room are collected before one delta is broadcast.
+    std::chrono::milliseconds window{100};
+    /// How many recent deltas each room keeps to bring a returning client's roster up to date.
+    size_t history = 64;
+};
+
+/**
+ * @struct HotRoomConfig
+ * @brief Settings of the chunked fan-out of the rooms with many local members, see `ChatRoomManager`.
+ */
+struct HotRoomConfig {
+    /// Rooms with at least this many local connections are written a chunk at a time.
+    size_t member_threshold = 1000;
+    /// How many connections each loop writes a hot room's broadcast to before yielding.
+    size_t chunk_size = 256;
+};
+
+/**
+ * @struct CompressionConfig
+ * @brief Settings of the response compression clients can opt into.
+ */
+struct CompressionConfig {
+    /// Whether gzip is offered in `ServerHello`.
+    bool enabled = true;
+    /// Responses smaller than this are always sent as they are.
+    size_t min_bytes = 1024;
+    /// Whether `ServerHello` offers history pages as `PackedMessages`.
+    bool packed_history = true;
+    /// Whether `ServerHello` offers live events referring to known users by id, see `SetCompressionRequest.user_refs`.
+    bool user_refs = true;
+};
+
+/**
+ * @struct ChunkedResponseConfig
+ * @brief Settings of the splitting of large history pages and room lists, see `WsRequestProcessor`.
+ */
+struct ChunkedResponseConfig {
+    /// Whether large responses are sent as a sequence of chunks.
+    bool enabled = true;
+    /// The most messages or rooms each frame carries.
+    size_t items_per_chunk = 100;
+    /// The most bytes of messages or rooms each frame carries, an item larger than that gets a frame of its own.
+    size_t max_chunk_bytes = 32 * 1024;
+};
+
+/**
+ * @struct ClusterConfig
+ * @brief Settings of the room event exchange with the other servers, through the aggregator.
+ */
+struct ClusterConfig {
+    /// Whether room events are published to the other servers when an aggregator is configured.
+    bool fanout = true;
+    /// How long per-room connection count changes are collected before one report is sent to the aggregator.
+    std::chrono::milliseconds load_report_interval{1000};
+    /// How often the server's health and capacity figures are sent to the aggregator.
+    std::chrono::milliseconds server_load_interval{5000};
+    /// The number of connections at which this server counts as full.
+    uint32_t max_connections = 10'000;
+    /// The IO loop scheduling delay at which this server counts as full.
+    std::chrono::milliseconds max_loop_lag{50};
+    /// The first delay before reconnecting to the aggregator, doubled after every failed attempt.
+    std::chrono::milliseconds reconnect_min{500};
+    /// The longest delay between two reconnection attempts.
+    std::chrono::milliseconds reconnect_max{30'000};
+    /// Whether `RoomDataCache` invalidations are exchanged with the servers sharing the database, see `CacheInvalidation`.
+    bool cache_notify = true;
+};
+
+/**
+ * @struct LoopMonitorConfig
+ * @brief Settings of the IO loop queue depth and lag sampling, see `common::LoopMonitor`.
+ */
+struct LoopMonitorConfig {
+    /// How often every IO loop is probed.
+    std::chrono::milliseconds sample_interval{1000};
+    /// The probe delay above which a warning is logged, 0 disables it.
+    std::chrono::milliseconds warn_lag{100};
+    /// The queue depth above which a warning is logged, 0 disables it.
+    size_t warn_queue_depth = 1000;
+};
+
+/**
+ * @struct TracingConfig
+ * @brief Settings of the sampled request traces, see `common::Tracer`.
+ */
+struct TracingConfig {
+    /// The fraction of requests traced, 0 disables tracing.
+    double sample_rate = 0;
+    /// The file the traces are appended to, one OTLP/JSON document per line.
+    std::string output = "logs/traces.jsonl";
+};
+
+/**
+ * @struct RateLimit
+ * @brief A token bucket: `rate` requests per second on average, in bursts of up to `burst`.
+ * @details A rate of 0 leaves the requests unlimited.
+ */
+struct RateLimit {
+    double rate = 0;
+    double burst = 0;
+};
+
+/**
+ * @struct RateLimitConfig
+ * @brief Settings of the request rate limits, see `RateLimiter`.
+ * @details Limits are keyed by handler name, as in the `handler` label of `chat_request_duration_seconds`.
+ */
+struct RateLimitConfig {
+    /// Whether requests are rate limited at all.
+    bool enabled = true;
+    /// The limits of each connection.
+    std::unordered_map<std::string, RateLimit> per_connection{
+        {"SendMessage", {10, 20}},
+        {"GetMessages", {20, 40}},
+    };
+    /// The limits of each user, shared by all of their connections to this server.
+    std::unordered_map<std::string, RateLimit> per_user{
+        {"SendMessage", {20, 40}},
+        {"GetMessages", {40, 80}},
+    };
+};
+
+/**
+ * @struct SessionConfig
+ * @brief Settings of the resumption tokens handed out on login, see `SessionTokens`.
+ */
+struct SessionConfig {
+    /// Whether `AuthResponse` carries a token `ResumeSessionRequest` accepts.
+    bool enabled = true;
+    /// How long an unused token stays valid.
+    std::chrono::seconds ttl{3600};
+    /// How many tokens are kept at most, logins beyond that get none until some expire.
+    size_t max_sessions = 100'000;
+};
+
+/**
+ * @struct UsernameFilterConfig
+ * @brief Settings of the Bloom filter answering username availability without a query, see `UsernameFilter`.
+ */
+struct UsernameFilterConfig {
+    /// Whether free usernames are recognised in memory, otherwise every check queries `users`.
+    bool enabled = true;
+    /// How many usernames the filter is sized for, it gets less precise past that.
+    size_t expected_users = 1'000'000;
+    /// The fraction of free usernames still looked up in the database at `expected_users`.
+    double false_positive_rate = 0.01;
+};
+
+/**
+ * @struct DrainConfig
+ * @brief Settings of the graceful shutdown on SIGTERM, see `ServerDrain`.
+ */
+struct DrainConfig {
+    /// The clients are told to reconnect at a random point within this long, spreading their logins.
+    std::chrono::milliseconds spread{60'000};
+    /// How long the server waits for its clients to leave before it stops anyway.
+    std::chrono::milliseconds timeout{90'000};
+};
+
+/**
+ * @struct AdmissionConfig
+ * @brief Settings of the admission of new WebSocket connections, see `ConnectionAdmission`.
+ */
+struct AdmissionConfig {
+    /// Connections open at most at a time, 0 for no limit.
+    size_t max_connections = 0;
+    /// Connections open but not logged in yet at most at a time, 0 for no limit.
+    size_t max_unauthenticated = 2000;
+    /// New connections accepted per second on average, 0 for no limit.
+    double accepts_per_sec = 500;
+    /// New connections accepted at once after a quiet period, above `accepts_per_sec`.
+    size_t accept_burst = 1000;
+    /// Connections not logged in within this long are closed, 0 to keep them.
+    std::chrono::milliseconds auth_timeout{30'000};
+    /// Refused clients are told to retry after this, plus a random part of `retry_spread`.
+    std::chrono::milliseconds retry_after{2'000};
+    std::chrono::milliseconds retry_spread{8'000};
+};
+
+/**
+ * @struct UpgradeConfig
+ * @brief Settings of the upgrade of a server in place, see `UpgradeHandoff`.
+ */
+struct UpgradeConfig {
+    /// Whether the listening port is shared with a successor and the sessions handed over to it.
+    bool enabled = false;
+    /// The Unix socket the running process waits for its successor on.
+    std::string socket_path = "upgrade.sock";
+    /// Clients connecting to the old process while it hands over are told to retry after this.
+    std::chrono::milliseconds retry_after{500};
+};
+
+/**
+ * @struct HeartbeatConfig
+ * @brief Settings of the heartbeat of the WebSocket connections, see `IdleReaper`.
+ */
+struct HeartbeatConfig {
+    /// Connections quiet for this long are pinged, 0 to turn the heartbeat off.
+    std::chrono::milliseconds ping_interval{30'000};
+    /// Connections quiet for this long are closed as dead, 0 to only ping them.
+    std::chrono::milliseconds idle_timeout{90'000};
+};
+
+/**
+ * @struct HistoryExportConfig
+ * @brief Settings of the room history export over HTTP, see `HistoryExport`.
+ */
+struct HistoryExportConfig {
+    /// Whether `GET /rooms/{id}/export` is served.
+    bool enabled = true;
+    /// Messages read per query, and per gzip member when compressed.
+    size_t page_size = 1000;
+    /// How many exports may run at once on this server, the next ones are answered 429.
+    size_t max_concurrent = 2;
+};
+
+/**
+ * @struct CaptureConfig
+ * @brief Settings of the recording of client traffic for `chat_replay`, see `TrafficCapture`.
+ */
+struct CaptureConfig {
+    /// Whether inbound frames are recorded.
+    bool enabled = false;
+    /// The file the capture is written to, replaced on every start.
+    std::string output = "logs/traffic.spcap";
+    /// The capture stops once the file is this large.
+    size_t max_bytes = 1024 * 1024 * 1024;
+};
+
+/**
+ * @struct ChangeFeedConfig
+ * @brief Settings of the feed of chat events for downstream consumers, see `ChangeFeed`.
+ */
+struct ChangeFeedConfig {
+    /// Whether events are emitted at all.
+    bool enabled = false;
+    /// "file" appends to segment files in `directory`, "http" posts each batch to `url`.
+    std::string sink = "file";
+    std::string directory = "logs/feed";
+    /// A segment is closed and the next one started once it is this large.
+    size_t segment_bytes = 64 * 1024 * 1024;
+    /// Receives `POST`s of `application/x-ndjson` batches, a broker's HTTP ingest for instance.
+    std::string url;
+    /// How often the buffered events are handed to the sink.
+    std::chrono::milliseconds flush_interval{200};
+    /// The most events per batch.
+    size_t max_batch_events = 1000;
+    /// The most events waiting while the sink is slow or down, the newer ones are dropped.
+    size_t max_buffered_events = 100'000;
+    /// Whether sent messages carry their text, which moderation needs and analytics may not.
+    bool include_text = true;
+};
+
+/**
+ * @struct CpuPinningConfig
+ * @brief Settings of the thread-per-core mode, see `cpu_pinning.h`.
+ */
+struct CpuPinningConfig {
+    /// Whether each IO loop is pinned to a CPU of its own, and the other threads kept off them.
+    bool enabled = false;
+    /// The CPUs of the IO loops in loop order, empty to pick them node by node from the allowed ones.
+    std::vector<int> io_cpus;
+    /// The CPUs of the main loop, the shared DB clients and every other thread, empty for those left over.
+    std::vector<int> shared_cpus;
+    /// Whether every IO loop accepts on a listener of its own through `SO_REUSEPORT`.
+    bool reuse_port = true;
+};
+
+/**
+ * @struct IntrospectionConfig
+ * @brief Settings of the live state endpoint for global admins, `GET /introspection`.
+ */
+struct IntrospectionConfig {
+    /// Whether `GET /introspection` is served.
+    bool enabled = true;
+    /// How many of the largest rooms are listed.
+    size_t top_rooms = 20;
+    /// How many of the connections with the largest backlog are listed.
+    size_t top_connections = 20;
+};
+
+/**
+ * @struct TenantConfig
+ * @brief A group of rooms hosting one community, and what it may use of the server, see `TenantQuotas`.
+ * @details Every limit is shared by all the rooms of the group, 0 leaves it unlimited.
+ */
+struct TenantConfig {
+    std::string name;
+    /// Inclusive ranges of room IDs, a single ID being a range of one.
+    std::vector<std::pair<int32_t, int32_t>> rooms;
+    /// Requests of the group's rooms being handled at once, those beyond are answered with `STATUS_RATE_LIMITED`.
+    size_t max_in_flight = 0;
+    /// Database operations of those requests in flight at once, those beyond wait for one to complete.
+    size_t max_db_in_flight = 0;
+    /// Bytes per second written to the members of the group's rooms, in bursts of up to `broadcast_burst_bytes`.
+    double broadcast_bytes_per_second = 0;
+    double broadcast_burst_bytes = 0;
+};
+
+/**
+ * @struct TenantsConfig
+ * @brief Settings of the per-community quotas, see `TenantQuotas`.
+ * @details The rooms of no group share the server without any quota.
+ */
+struct TenantsConfig {
+    bool enabled = false;
+    std::vector<TenantConfig> groups;
+};
+
+/**
+ * @struct ServerConfig
+ * @brief All server tunables read from the `custom_config` object of `config.json`.
+ * @details Every key is optional, missing keys keep the defaults above.
+ */
+struct ServerConfig {
+    MessageBatchingConfig message_batching;
+    MessageDeliveryConfig message_delivery;
+    HistoryCacheConfig history_cache;
+    WarmupConfig warmup;
+    MessagePartitionConfig message_partitions;
+    MessageCompressionConfig message_compression;
+    DatabaseConfig database;
+    DbBreakerConfig db_breaker;
+    DbPoolConfig db_pool;
+    PipelineConfig pipeline;
+    OutboundConfig outbound;
+    TypingConfig typing;
+    PresenceConfig presence;
+    HotRoomConfig hot_rooms;
+    CompressionConfig compression;
+    ChunkedResponseConfig chunked_responses;
+    ClusterConfig cluster;
+    LoopMonitorConfig loop_monitor;
+    TracingConfig tracing;
+    RateLimitConfig rate_limits;
+    SessionConfig sessions;
+    UsernameFilterConfig username_filter;
+    DrainConfig drain;
+    AdmissionConfig admission;
+    HeartbeatConfig heartbeat;
+    UpgradeConfig upgrade;
+    HistoryExportConfig history_export;
+    CaptureConfig capture;
+    ChangeFeedConfig change_feed;
+    CpuPinningConfig cpu_pinning;
+    IntrospectionConfig introspection;
+    TenantsConfig tenants;
+    common::TlsOptions tls;
+    common::ProfilingOptions profiling;
+
+    /// @brief Builds the configuration from a `custom_config` JSON object.
+    static ServerConfig fromJson(const Json::Value& json) {
+        ServerConfig cfg;
+
+        const auto& batching = json["message_batching"];
+        if(batching.isObject()) {
+            cfg.message_batching.enabled = batching.get("enabled", cfg.message_batching.enabled).asBool();
+            cfg.message_batching.window = std::chrono::milliseconds{
+                batching.get("window_ms", static_cast<Json::Int64>(cfg.message_batching.window.count())).asInt64()};
+            cfg.message_batching.max_batch_size =
+                batching.get("max_batch_size", static_cast<Json::UInt64>(cfg.message_batching.max_batch_size)).asUInt64();
+        }
+
+        const auto& delivery = json["message_delivery"];
+        if(delivery.isObject()) {
+            cfg.message_delivery.optimistic = delivery.get("optimistic", cfg.message_delivery.optimistic).asBool();
+            cfg.message_delivery.id_block_size =
+                delivery.get("id_block_size", static_cast<Json::Int64>(cfg.message_delivery.id_block_size)).asInt64();
+            cfg.message_delivery.dedupe_window = std::chrono::milliseconds{
+                delivery.get("dedupe_window_ms", static_cast<Json::Int64>(cfg.message_delivery.dedupe_window.count())).asInt64()};
+        }
+
+        const auto& history = json["history_cache"];
+        if(history.isObject()) {
+            cfg.history_cache.enabled = history.get("enabled", cfg.history_cache.enabled).asBool();
+            cfg.history_cache.messages_per_room =
+                history.get("messages_per_room", static_cast<Json::UInt64>(cfg.history_cache.messages_per_room)).asUInt64();
+        }
+
+        const auto& warmup = json["warmup"];
+        if(warmup.isObject()) {
+            cfg.warmup.enabled = warmup.get("enabled", cfg.warmup.enabled).asBool();
+            cfg.warmup.rooms = warmup.get("rooms", static_cast<Json::UInt64>(cfg.warmup.rooms)).asUInt64();
+        }
+
+        const auto& partitions = json["message_partitions"];
+        if(partitions.isObject()) {
+            cfg.message_partitions.enabled = partitions.get("enabled", cfg.message_partitions.enabled).asBool();
+            cfg.message_partitions.interval = std::chrono::seconds{
+                partitions.get("interval_seconds", static_cast<Json::Int64>(cfg.message_partitions.interval.count())).asInt64()};
+            cfg.message_partitions.months_ahead = partitions.get("months_ahead", cfg.message_partitions.months_ahead).asInt();
+            cfg.message_partitions.retention = std::chrono::days{
+                partitions.get("retention_days", static_cast<Json::Int64>(cfg.message_partitions.retention.count())).asInt64()};
+            cfg.message_partitions.keep_detached = partitions.get("keep_detached", cfg.message_partitions.keep_detached).asBool();
+        }
+
+        const auto& message_compression = json["message_compression"];
+        if(message_compression.isObject()) {
+            cfg.message_compression.enabled = message_compression.get("enabled", cfg.message_compression.enabled).asBool();
+            cfg.message_compression.compress_on_write =
+                message_compression.get("compress_on_write", cfg.message_compression.compress_on_write).asBool();
+            cfg.message_compression.min_bytes =
+                message_compression.get("min_bytes", static_cast<Json::UInt64>(cfg.message_compression.min_bytes)).asUInt64();
+            cfg.message_compression.level = message_compression.get("level", cfg.message_compression.level).asInt();
+            cfg.message_compression.dictionary_bytes =
+                message_compression.get("dictionary_bytes", static_cast<Json::UInt64>(cfg.message_compression.dictionary_bytes)).asUInt64();
+            cfg.message_compression.train_samples =
+                message_compression.get("train_samples", static_cast<Json::UInt64>(cfg.message_compression.train_samples)).asUInt64();
+            cfg.message_compression.recompress_after = std::chrono::days{
+                message_compression.get("recompress_after_days", static_cast<Json::Int64>(cfg.message_compression.recompress_after.count())).asInt64()};
+            cfg.message_compression.batch_size =
+                message_compression.get("batch_size", static_cast<Json::UInt64>(cfg.message_compression.batch_size)).asUInt64();
+            cfg.message_compression.interval = std::chrono::seconds{
+                message_compression.get("interval_seconds", static_cast<Json::Int64>(cfg.message_compression.interval.count())).asInt64()};
+        }
+
+        const auto& database = json["database"];
+        if(database.isObject()) {
+            cfg.database.write_client = database.get("write_client", cfg.database.write_client).asString();
+            cfg.database.read_client = database.get("read_client", cfg.database.read_client).asString();
+            cfg.database.fast_write_client = database.get("fast_write_client", cfg.database.fast_write_client).asString();
+            cfg.database.fast_read_client = database.get("fast_read_client", cfg.database.fast_read_client).asString();
+            cfg.database.verify_plans = database.get("verify_plans", cfg.database.verify_plans).asBool();
+        }
+
+        const auto& db_pool = json["db_pool"];
+        if(db_pool.isObject()) {
+            cfg.db_pool.enabled = db_pool.get("enabled", cfg.db_pool.enabled).asBool();
+            cfg.db_pool.max_added_connections =
+                db_pool.get("max_added_connections", static_cast<Json::UInt64>(cfg.db_pool.max_added_connections)).asUInt64();
+            cfg.db_pool.step = std::max<size_t>(db_pool.get("step", static_cast<Json::UInt64>(cfg.db_pool.step)).asUInt64(), 1);
+            cfg.db_pool.sample_interval = std::chrono::milliseconds{
+                db_pool.get("sample_interval_ms", static_cast<Json::Int64>(cfg.db_pool.sample_interval.count())).asInt64()};
+            cfg.db_pool.window = std::chrono::seconds{
+                db_pool.get("window_seconds", static_cast<Json::Int64>(cfg.db_pool.window.count())).asInt64()};
+            cfg.db_pool.grow_busy_ratio = db_pool.get("grow_busy_ratio", cfg.db_pool.grow_busy_ratio).asDouble();
+            cfg.db_pool.shrink_idle_windows =
+                db_pool.get("shrink_idle_windows", static_cast<Json::UInt64>(cfg.db_pool.shrink_idle_windows)).asUInt64();
+            cfg.db_pool.retire_after = std::chrono::seconds{
+                db_pool.get("retire_after_seconds", static_cast<Json::Int64>(cfg.db_pool.retire_after.count())).asInt64()};
+            cfg.db_pool.query_timeout = std::chrono::milliseconds{
+                db_pool.get("query_timeout_ms", static_cast<Json::Int64>(cfg.db_pool.query_timeout.count())).asInt64()};
+        }
+
+        const auto& breaker = json["db_breaker"];
+        if(breaker.isObject()) {
+            cfg.db_breaker.enabled = breaker.get("enabled", cfg.db_breaker.enabled).asBool();
+            cfg.db_breaker.window = std::chrono::seconds{
+                breaker.get("window_seconds", static_cast<Json::Int64>(cfg.db_breaker.window.count())).asInt64()};
+            cfg.db_breaker.min_queries = breaker.get("min_queries", static_cast<Json::UInt64>(cfg.db_breaker.min_queries)).asUInt64();
+            cfg.db_breaker.error_ratio = breaker.get("error_ratio", cfg.db_breaker.error_ratio).asDouble();
+            cfg.db_breaker.slow_query = std::chrono::milliseconds{
+                breaker.get("slow_query_ms", static_cast<Json::Int64>(cfg.db_breaker.slow_query.count())).asInt64()};
+            cfg.db_breaker.slow_ratio = breaker.get("slow_ratio", cfg.db_breaker.slow_ratio).asDouble();
+            cfg.db_breaker.open_for = std::chrono::seconds{
+                breaker.get("open_seconds", static_cast<Json::Int64>(cfg.db_breaker.open_for.count())).asInt64()};
+            if(breaker["shed"].isArray()) {
+                cfg.db_breaker.shed.clear();
+                for(const auto& name : breaker["shed"]) {
+                    cfg.db_breaker.shed.push_back(name.asString());
+                }
+            }
+        }
+
+        const auto& pipeline = json["pipeline"];
+        if(pipeline.isObject()) {
+            cfg.pipeline.depth = pipeline.get("depth", static_cast<Json::UInt64>(cfg.pipeline.depth)).asUInt64();
+            cfg.pipeline.max_queued = pipeline.get("max_queued", static_cast<Json::UInt64>(cfg.pipeline.max_queued)).asUInt64();
+            cfg.pipeline.max_batch = pipeline.get("max_batch", static_cast<Json::UInt64>(cfg.pipeline.max_batch)).asUInt64();
+        }
+
+        const auto& outbound = json["outbound"];
+        if(outbound.isObject()) {
+            cfg.outbound.high_watermark_bytes =
+                outbound.get("high_watermark_bytes", static_cast<Json::UInt64>(cfg.outbound.high_watermark_bytes)).asUInt64();
+            cfg.outbound.low_watermark_bytes =
+                outbound.get("low_watermark_bytes", static_cast<Json::UInt64>(cfg.outbound.low_watermark_bytes)).asUInt64();
+            cfg.outbound.min_drain_bytes_per_sec =
+                outbound.get("min_drain_bytes_per_sec", static_cast<Json::UInt64>(cfg.outbound.min_drain_bytes_per_sec)).asUInt64();
+            cfg.outbound.evict_after = std::chrono::milliseconds{
+                outbound.get("evict_after_ms", static_cast<Json::Int64>(cfg.outbound.evict_after.count())).asInt64()};
+            cfg.outbound.response_window_bytes =
+                outbound.get("response_window_bytes", static_cast<Json::UInt64>(cfg.outbound.response_window_bytes)).asUInt64();
+            cfg.outbound.response_drain_bytes_per_sec =
+                outbound.get("response_drain_bytes_per_sec", static_cast<Json::UInt64>(cfg.outbound.response_drain_bytes_per_sec)).asUInt64();
+        }
+
+        const auto& typing = json["typing"];
+        if(typing.isObject()) {
+            cfg.typing.interval = std::chrono::milliseconds{
+                typing.get("interval_ms", static_cast<Json::Int64>(cfg.typing.interval.count())).asInt64()};
+        }
+
+        const auto& presence = json["presence"];
+        if(presence.isObject()) {
+            cfg.presence.window = std::chrono::milliseconds{
+                presence.get("window_ms", static_cast<Json::Int64>(cfg.presence.window.count())).asInt64()};
+            cfg.presence.history = presence.get("history", static_cast<Json::UInt64>(cfg.presence.history)).asUInt64();
+        }
+
+        const auto& hot_rooms = json["hot_rooms"];
+        if(hot_rooms.isObject()) {
+            cfg.hot_rooms.member_threshold =
+                hot_rooms.get("member_threshold", static_cast<Json::UInt64>(cfg.hot_rooms.member_threshold)).asUInt64();
+            cfg.hot_rooms.chunk_size = std::max<size_t>(
+                hot_rooms.get("chunk_size", static_cast<Json::UInt64>(cfg.hot_rooms.chunk_size)).asUInt64(), 1);
+        }
+
+        const auto& compression = json["compression"];
+        if(compression.isObject()) {
+            cfg.compression.enabled = compression.get("enabled", cfg.compression.enabled).asBool();
+            cfg.compression.min_bytes =
+                compression.get("min_bytes", static_cast<Json::UInt64>(cfg.compression.min_bytes)).asUInt64();
+            cfg.compression.packed_history = compression.get("packed_history", cfg.compression.packed_history).asBool();
+            cfg.compression.user_refs = compression.get("user_refs", cfg.compression.user_refs).asBool();
+        }
+
+        const auto& chunked = json["chunked_responses"];
+        if(chunked.isObject()) {
+            cfg.chunked_responses.enabled = chunked.get("enabled", cfg.chunked_responses.enabled).asBool();
+            cfg.chunked_responses.items_per_chunk = std::max<size_t>(
+                chunked.get("items_per_chunk", static_cast<Json::UInt64>(cfg.chunked_responses.items_per_chunk)).asUInt64(), 1);
+            cfg.chunked_responses.max_chunk_bytes =
+                chunked.get("max_chunk_bytes", static_cast<Json::UInt64>(cfg.chunked_responses.max_chunk_bytes)).asUInt64();
+        }
+
+        const auto& cluster = json["cluster"];
+        if(cluster.isObject()) {
+            cfg.cluster.fanout = cluster.get("fanout", cfg.cluster.fanout).asBool();
+            cfg.cluster.load_report_interval = std::chrono::milliseconds{
+                cluster.get("load_report_interval_ms", static_cast<Json::Int64>(cfg.cluster.load_report_interval.count())).asInt64()};
+            cfg.cluster.server_load_interval = std::chrono::milliseconds{
+                cluster.get("server_load_interval_ms", static_cast<Json::Int64>(cfg.cluster.server_load_interval.count())).asInt64()};
+            cfg.cluster.max_connections = cluster.get("max_connections", cfg.cluster.max_connections).asUInt();
+            cfg.cluster.max_loop_lag = std::chrono::milliseconds{
+                cluster.get("max_loop_lag_ms", static_cast<Json::Int64>(cfg.cluster.max_loop_lag.count())).asInt64()};
+            cfg.cluster.reconnect_min = std::chrono::milliseconds{
+                cluster.get("reconnect_min_ms", static_cast<Json::Int64>(cfg.cluster.reconnect_min.count())).asInt64()};
+            cfg.cluster.reconnect_max = std::chrono::milliseconds{
+                cluster.get("reconnect_max_ms", static_cast<Json::Int64>(cfg.cluster.reconnect_max.count())).asInt64()};
+            cfg.cluster.cache_notify = cluster.get("cache_notify", cfg.cluster.cache_notify).asBool();
+        }
+
+        const auto& loop_monitor = json["loop_monitor"];
+        if(loop_monitor.isObject()) {
+            cfg.loop_monitor.sample_interval = std::chrono::milliseconds{
+                loop_monitor.get("sample_interval_ms", static_cast<Json::Int64>(cfg.loop_monitor.sample_interval.count())).asInt64()};
+            cfg.loop_monitor.warn_lag = std::chrono::milliseconds{
+                loop_monitor.get("warn_lag_ms", static_cast<Json::Int64>(cfg.loop_monitor.warn_lag.count())).asInt64()};
+            cfg.loop_monitor.warn_queue_depth =
+                loop_monitor.get("warn_queue_depth", static_cast<Json::UInt64>(cfg.loop_monitor.warn_queue_depth)).asUInt64();
+        }
+
+        const auto& tracing = json["tracing"];
+        if(tracing.isObject()) {
+            cfg.tracing.sample_rate = tracing.get("sample_rate", cfg.tracing.sample_rate).asDouble();
+            cfg.tracing.output = tracing.get("output", cfg.tracing.output).asString();
+        }
+
+        const auto& rate_limits = json["rate_limits"];
+        if(rate_limits.isObject()) {
+            cfg.rate_limits.enabled = rate_limits.get("enabled", cfg.rate_limits.enabled).asBool();
+            // Listed handlers override the defaults one by one, the others keep theirs.
+            const auto readLimits = [](const Json::Value& limits, std::unordered_map<std::string, RateLimit>& out) {
+                if(!limits.isObject()) {
+                    return;
+                }
+                for(const auto& handler : limits.getMemberNames()) {
+                    auto& limit = out[handler];
+                    limit.rate = limits[handler].get("rate", limit.rate).asDouble();
+                    limit.burst = limits[handler].get("burst", limit.burst).asDouble();
+                }
+            };
+            readLimits(rate_limits["connection"], cfg.rate_limits.per_connection);
+            readLimits(rate_limits["user"], cfg.rate_limits.per_user);
+        }
+
+        const auto& sessions = json["sessions"];
+        if(sessions.isObject()) {
+            cfg.sessions.enabled = sessions.get("enabled", cfg.sessions.enabled).asBool();
+            cfg.sessions.ttl = std::chrono::seconds{
+                sessions.get("ttl_seconds", static_cast<Json::Int64>(cfg.sessions.ttl.count())).asInt64()};
+            cfg.sessions.max_sessions =
+                sessions.get("max_sessions", static_cast<Json::UInt64>(cfg.sessions.max_sessions)).asUInt64();
+        }
+
+        const auto& username_filter = json["username_filter"];
+        if(username_filter.isObject()) {
+            cfg.username_filter.enabled = username_filter.get("enabled", cfg.username_filter.enabled).asBool();
+            cfg.username_filter.expected_users =
+                username_filter.get("expected_users", static_cast<Json::UInt64>(cfg.username_filter.expected_users)).asUInt64();
+            cfg.username_filter.false_positive_rate =
+                username_filter.get("false_positive_rate", cfg.username_filter.false_positive_rate).asDouble();
+        }
+
+        const auto& drain = json["drain"];
+        if(drain.isObject()) {
+            cfg.drain.spread = std::chrono::milliseconds{
+                drain.get("spread_ms", static_cast<Json::Int64>(cfg.drain.spread.count())).asInt64()};
+            cfg.drain.timeout = std::chrono::milliseconds{
+                drain.get("timeout_ms", static_cast<Json::Int64>(cfg.drain.timeout.count())).asInt64()};
+        }
+
+        const auto& admission = json["admission"];
+        if(admission.isObject()) {
+            cfg.admission.max_connections =
+                admission.get("max_connections", static_cast<Json::UInt64>(cfg.admission.max_connections)).asUInt64();
+            cfg.admission.max_unauthenticated =
+                admission.get("max_unauthenticated", static_cast<Json::UInt64>(cfg.admission.max_unauthenticated)).asUInt64();
+            cfg.admission.accepts_per_sec = admission.get("accepts_per_sec", cfg.admission.accepts_per_sec).asDouble();
+            cfg.admission.accept_burst = std::max<size_t>(
+                admission.get("accept_burst", static_cast<Json::UInt64>(cfg.admission.accept_burst)).asUInt64(), 1);
+            cfg.admission.auth_timeout = std::chrono::milliseconds{
+                admission.get("auth_timeout_ms", static_cast<Json::Int64>(cfg.admission.auth_timeout.count())).asInt64()};
+            cfg.admission.retry_after = std::chrono::milliseconds{
+                admission.get("retry_after_ms", static_cast<Json::Int64>(cfg.admission.retry_after.count())).asInt64()};
+            cfg.admission.retry_spread = std::chrono::milliseconds{
+                admission.get("retry_spread_ms", static_cast<Json::Int64>(cfg.admission.retry_spread.count())).asInt64()};
+        }
+
+        const auto& heartbeat = json["heartbeat"];
+        if(heartbeat.isObject()) {
+            cfg.heartbeat.ping_interval = std::chrono::milliseconds{
+                heartbeat.get("ping_interval_ms", static_cast<Json::Int64>(cfg.heartbeat.ping_interval.count())).asInt64()};
+            cfg.heartbeat.idle_timeout = std::chrono::milliseconds{
+                heartbeat.get("idle_timeout_ms", static_cast<Json::Int64>(cfg.heartbeat.idle_timeout.count())).asInt64()};
+        }
+
+        const auto& upgrade = json["upgrade"];
+        if(upgrade.isObject()) {
+            cfg.upgrade.enabled = upgrade.get("enabled", cfg.upgrade.enabled).asBool();
+            cfg.upgrade.socket_path = upgrade.get("socket_path", cfg.upgrade.socket_path).asString();
+            cfg.upgrade.retry_after = std::chrono::milliseconds{
+                upgrade.get("retry_after_ms", static_cast<Json::Int64>(cfg.upgrade.retry_after.count())).asInt64()};
+        }
+
+        const auto& history_export = json["history_export"];
+        if(history_export.isObject()) {
+            cfg.history_export.enabled = history_export.get("enabled", cfg.history_export.enabled).asBool();
+            cfg.history_export.page_size = std::max<size_t>(
+                history_export.get("page_size", static_cast<Json::UInt64>(cfg.history_export.page_size)).asUInt64(), 1);
+            cfg.history_export.max_concurrent =
+                history_export.get("max_concurrent", static_cast<Json::UInt64>(cfg.history_export.max_concurrent)).asUInt64();
+        }
+
+        const auto& capture = json["capture"];
+        if(capture.isObject()) {
+            cfg.capture.enabled = capture.get("enabled", cfg.capture.enabled).asBool();
+            cfg.capture.output = capture.get("output", cfg.capture.output).asString();
+            cfg.capture.max_bytes = capture.get("max_bytes", static_cast<Json::UInt64>(cfg.capture.max_bytes)).asUInt64();
+        }
+
+        const auto& change_feed = json["change_feed"];
+        if(change_feed.isObject()) {
+            cfg.change_feed.enabled = change_feed.get("enabled", cfg.change_feed.enabled).asBool();
+            cfg.change_feed.sink = change_feed.get("sink", cfg.change_feed.sink).asString();
+            cfg.change_feed.directory = change_feed.get("directory", cfg.change_feed.directory).asString();
+            cfg.change_feed.segment_bytes =
+                change_feed.get("segment_bytes", static_cast<Json::UInt64>(cfg.change_feed.segment_bytes)).asUInt64();
+            cfg.change_feed.url = change_feed.get("url", cfg.change_feed.url).asString();
+            cfg.change_feed.flush_interval = std::chrono::milliseconds{
+                change_feed.get("flush_interval_ms", static_cast<Json::Int64>(cfg.change_feed.flush_interval.count())).asInt64()};
+            cfg.change_feed.max_batch_events =
+                change_feed.get("max_batch_events", static_cast<Json::UInt64>(cfg.change_feed.max_batch_events)).asUInt64();
+            cfg.change_feed.max_buffered_events =
+                change_feed.get("max_buffered_events", static_cast<Json::UInt64>(cfg.change_feed.max_buffered_events)).asUInt64();
+            cfg.change_feed.include_text = change_feed.get("include_text", cfg.change_feed.include_text).asBool();
+        }
+
+        const auto& cpu_pinning = json["cpu_pinning"];
+        if(cpu_pinning.isObject()) {
+            cfg.cpu_pinning.enabled = cpu_pinning.get("enabled", cfg.cpu_pinning.enabled).asBool();
+            cfg.cpu_pinning.reuse_port = cpu_pinning.get("reuse_port", cfg.cpu_pinning.reuse_port).asBool();
+            const auto readCpus = [](const Json::Value& list, std::vector<int>& out) {
+                if(list.isArray()) {
+                    out.clear();
+                    for(const auto& cpu : list) {
+                        out.push_back(cpu.asInt());
+                    }
+                }
+            };
+            readCpus(cpu_pinning["io_cpus"], cfg.cpu_pinning.io_cpus);
+            readCpus(cpu_pinning["shared_cpus"], cfg.cpu_pinning.shared_cpus);
+        }
+
+        const auto& introspection = json["introspection"];
+        if(introspection.isObject()) {
+            cfg.introspection.enabled = introspection.get("enabled", cfg.introspection.enabled).asBool();
+            cfg.introspection.top_rooms =
+                introspection.get("top_rooms", static_cast<Json::UInt64>(cfg.introspection.top_rooms)).asUInt64();
+            cfg.introspection.top_connections =
+                introspection.get("top_connections", static_cast<Json::UInt64>(cfg.introspection.top_connections)).asUInt64();
+        }
+
+        const auto& tenants = json["tenants"];
+        if(tenants.isObject()) {
+            cfg.tenants.enabled = tenants.get("enabled", cfg.tenants.enabled).asBool();
+            for(const auto& group : tenants["groups"]) {
+                TenantConfig tenant;
+                tenant.name = group.get("name", "tenant" + std::to_string(cfg.tenants.groups.size())).asString();
+                // [from, to] or a single room ID.
+                for(const auto& range : group["rooms"]) {
+                    if(range.isArray() && range.size() == 2) {
+                        tenant.rooms.emplace_back(range[0].asInt(), range[1].asInt());
+                    } else if(range.isIntegral()) {
+                        tenant.rooms.emplace_back(range.asInt(), range.asInt());
+                    }
+                }
+                tenant.max_in_flight = group.get("max_in_flight", static_cast<Json::UInt64>(tenant.max_in_flight)).asUInt64();
+                tenant.max_db_in_flight = group.get("max_db_in_flight", static_cast<Json::UInt64>(tenant.max_db_in_flight)).asUInt64();
+                tenant.broadcast_bytes_per_second = group.get("broadcast_bytes_per_second", tenant.broadcast_bytes_per_second).asDouble();
+                tenant.broadcast_burst_bytes = group.get("broadcast_burst_bytes", tenant.broadcast_burst_bytes).asDouble();
+                cfg.tenants.groups.push_back(std::move(tenant));
+            }
+        }
+
+        cfg.tls = common::TlsOptions::fromJson(json["tls"]);
+        cfg.profiling = common::ProfilingOptions::fromJson(json["profiling"]);
+
+        return cfg;
+    }
+};
+
+/**
+ * @brief Returns the server configuration, parsed once from `drogon::app().getCustomConfig()`.
+ * @note Must not be called before `config.json` has been loaded.
+ */
+inline const ServerConfig& serverConfig() {
+    static const ServerConfig cfg = ServerConfig::fromJson(drogon::app().getCustomConfig());
+    return cfg;
+}
+
+/**
+ * @brief Returns the database client for writes and transactions, `DatabaseConfig::write_client`.
+ * @return The client, or nullptr if no client of that name is configured.
+ */
+inline drogon::orm::DbClientPtr writeDbClient() {
+    return drogon::app().getDbClient(serverConfig().database.write_client);
+}
+
+/**
+ * @brief Returns the database client for read-only queries, `DatabaseConfig::read_client`.
+ * @details The name is known to exist, see `DatabaseConfig::missingClients`.
+ * Reads through it may lag behind the primary when it points at a replica.
+ */
+inline drogon::orm::DbClientPtr readDbClient() {
+    return drogon::app().getDbClient(serverConfig().database.read_client);
+}
+
+/**
+ * @brief Returns the fast client of the current IO loop, or null outside of the IO loops or without one.
+ * @param name The name of an `is_fast` entry of `db_clients`, empty for none.
+ */
+inline drogon::orm::DbClientPtr currentLoopDbClient(const std::string& name) {
+    auto& app = drogon::app();
+    if(name.empty() || app.getCurrentThreadIndex() >= app.getThreadNum()) {
+        return nullptr;
+    }
+    return app.getFastDbClient(name);
+}
+
+/**
+ * @brief Returns the write client for the current thread: the IO loop's own fast client when
+ * `DatabaseConfig::fast_write_client` is set, `writeDbClient()` otherwise.
+ * @details Looked up once per thread. Must only be used on the thread it was returned on.
+ */
+inline const drogon::orm::DbClientPtr& loopWriteDbClient() {
+    thread_local const drogon::orm::DbClientPtr client = [] {
+        auto fast = currentLoopDbClient(serverConfig().database.fast_write_client);
+        return fast ? fast : writeDbClient();
+    }();
+    return client;
+}
+
+/**
+ * @brief Returns the read client for the current thread, like `loopWriteDbClient()` for `readDbClient()`.
+ * @details Uses `DatabaseConfig::fast_read_client`, or the fast write client when reads go to the primary anyway.
+ */
+inline const drogon::orm::DbClientPtr& loopReadDbClient() {
+    thread_local const drogon::orm::DbClientPtr client = [] {
+        const auto& cfg = serverConfig().database;
+        const auto& fast_name = cfg.fast_read_client.empty() && cfg.read_client == cfg.write_client
+            ? cfg.fast_write_client : cfg.fast_read_client;
+        auto fast = currentLoopDbClient(fast_name);
+        return fast ? fast : readDbClient();
+    }();
+    return client;
+}
+
+} // namespace server
@@ -1,6 +1,14 @@
 #pragma once
 
+#include <atomic>
 #include <coroutine>
+#include <server/chat/TenantQuotas.h>
+#include <server/db/DbCircuitBreaker.h>
+#include <server/db/DbPoolScaler.h>
+#include <server/utils/coro_frame_pool.h>
+#include <common/utils/metrics.h>
+#include <common/utils/loop_monitor.h>
+#include <common/utils/tracing.h>
 
 namespace server {
 
@@ -16,6 +24,9 @@ struct fire_and_forget_task {
         static std::suspend_never initial_suspend() noexcept { return {}; }
         static std::suspend_never final_suspend() noexcept { return {}; }
         static void return_void() noexcept {}
+        // One per awaited query, from the same pool as the frames of the Tasks awaiting them.
+        static void* operator new(std::size_t size) { return frame_pool::allocate(size); }
+        static void operator delete(void* ptr, std::size_t size) noexcept { frame_pool::deallocate(ptr, size); }
         static void unhandled_exception() noexcept {
             // A production application should consider logging this event,
             // as an unhandled exception in a fire-and-forget task
@@ -24,6 +35,31 @@ struct fire_and_forget_task {
     };
 };
 
+/// @brief The histogram of the operations awaited through `switch_to_io_loop`, mostly database queries.
+inline common::Histogram& dbQueryLatency() {
+    static auto& histogram = common::MetricsRegistry::instance().histogram(
+        "db_query_duration_seconds", "Time from issuing an operation awaited through switch_to_io_loop to its completion.");
+    return histogram;
+}
+
+/**
+ * @brief Counts the operations awaited through `switch_to_io_loop` and the rounds they were issued in.
+ * @details A round is a stretch of time with at least one operation in flight, so operations issued
+ * concurrently, as by `when_all`, share one round while operations awaited one after another take a
+ * round each. The counts are process-wide and only tell the cost of one request while it runs alone.
+ */
+struct DbOperationCounters {
+    std::atomic<uint64_t> operations{0};
+    std::atomic<uint64_t> rounds{0};
+    std::atomic<int64_t> in_flight{0};
+};
+
+/// @brief The counters of all operations awaited through `switch_to_io_loop`.
+inline DbOperationCounters& dbOperationCounters() {
+    static DbOperationCounters counters;
+    return counters;
+}
+
 /**
  * @brief An awaitable wrapper that ensures a coroutine resumes on a Drogon IO Loop.
  *
@@ -34,6 +70,18 @@ struct fire_and_forget_task {
  * Drogon IO thread, preventing thread pool starvation and ensuring code
  * continues execution in the expected context.
  *
+ * An operation that completes on the IO loop it was awaited on, as the queries
+ * of fast database clients do (see `loopWriteDbClient()`), resumes the coroutine
+ * right there, without a trip through the loop's queue.
+ *
+ * The time until the operation completes, excluding the hop back to the IO
+ * loop, is recorded in `dbQueryLatency()` and, with its outcome, reported to
+ * `DbCircuitBreaker`. Every operation is counted in `dbOperationCounters()`.
+ *
+ * The operations of a request of a `Tenant` limiting them wait for one of its
+ * slots before they are issued, and the request's tenant is current again on
+ * resumption, see `currentTenant()`.
+ *
  * @tparam AwaiterType The type of the awaiter object to be wrapped. This must
  *         be a type that provides the awaiter interface (`await_ready`,
  *         `await_suspend`, `await_resume`).
@@ -75,6 +123,21 @@ public:
                 std::variant<std::monostate, std::exception_ptr, ResultType>
             > m_result;
 
+            /// The trace of the suspended request, made current again on resumption with a `db.query` span.
+            common::TracePtr m_trace = nullptr;
+            std::chrono::steady_clock::time_point m_suspended_at{};
+            /// The tenant of the suspended request, made current again on resumption.
+            Tenant* m_tenant = nullptr;
+
+            /// Whether it was awaited on an IO loop, so an operation completing on that loop may resume it inline.
+            /// Awaited anywhere else, as by `sync_wait` on the main loop, the resumption is always queued.
+            bool m_resume_inline = false;
+
+            /// Whether `await_suspend` is still running or returned, or the operation completed on the
+            /// original loop. Decides who resumes an operation completing there, see `await_suspend`.
+            enum : uint8_t { SUSPENDING, SUSPENDED, COMPLETED };
+            std::atomic<uint8_t> m_state{SUSPENDING};
+
             /**
              * @brief Always returns false to force suspension for the thread switch.
              */
@@ -88,6 +151,11 @@ public:
              * @throws The exception from the operation if it failed.
              */
             ResultType await_resume() {
+                if(m_trace) {
+                    m_trace->addSpan("db.query", m_suspended_at, std::chrono::steady_clock::now());
+                }
+                common::setCurrentTrace(std::move(m_trace));
+                setCurrentTenant(m_tenant);
                 if(std::holds_alternative<std::exception_ptr>(m_result)) {
                     std::rethrow_exception(std::get<std::exception_ptr>(m_result));
                 }
@@ -102,13 +170,23 @@ public:
 
             /**
              * @brief The core logic of the wrapper, executed upon suspension.
+             * @return False when the operation already completed on this loop, so the coroutine
+             *         goes on without being suspended, rather than being resumed from in here.
              */
-            void await_suspend(std::coroutine_handle<> handle) {
+            bool await_suspend(std::coroutine_handle<> handle) {
                 // On the original IO thread: capture the current context.
                 m_original_thread_index = drogon::app().getCurrentThreadIndex();
-                if(m_original_thread_index >= drogon::app().getThreadNum()) {
+                m_resume_inline = m_original_thread_index < drogon::app().getThreadNum();
+                if(!m_resume_inline) {
                     m_original_thread_index = 0; // Fallback to the first IO thread.
                 }
+                m_trace = common::currentTrace();
+                if(m_trace) {
+                    m_suspended_at = std::chrono::steady_clock::now();
+                }
+                // The thread goes on with other work until the request resumes.
+                m_tenant = currentTenant();
+                setCurrentTenant(nullptr);
 
                 // Launch a fire-and-forget lambda-coroutine to perform the actual work.
                 // It is safe to pass `this` because the `awaiter` object lives
@@ -116,6 +194,7 @@ public:
                 // even tho this is captureless lambda and simply calling it as-is **should** be fine
                 // lets get it's pointer with + to avoid any notion of potential ub
                 auto lambda = +[](awaiter* self, std::coroutine_handle<> handle) -> fire_and_forget_task {
+                    const auto started = std::chrono::steady_clock::now();
                     try {
                         // This co_await runs and completes on the background (e.g., DB) thread.
                         if constexpr(std::is_void_v<ResultType>) {
@@ -127,14 +206,51 @@ public:
                         // On failure, store the exception.
                         self->m_result.template emplace<std::exception_ptr>(std::current_exception());
                     }
+                    const auto elapsed = std::chrono::steady_clock::now() - started;
+                    dbQueryLatency().observe(elapsed);
+                    DbPoolScaler::instance().record(elapsed);
+                    dbOperationCounters().in_flight.fetch_sub(1, std::memory_order_relaxed);
+                    DbCircuitBreaker::instance().record(elapsed, std::holds_alternative<std::exception_ptr>(self->m_result)
+                        ? std::get<std::exception_ptr>(self->m_result) : std::exception_ptr{});
+                    if(self->m_tenant && self->m_tenant->limitsDb()) {
+                        self->m_tenant->releaseDb();
+                    }
 
-                    // From the background thread, post the resumption back to the original IO thread.
-                    drogon::app().getIOLoop(self->m_original_thread_index)->queueInLoop([handle]() {
+                    if(!self->m_resume_inline || drogon::app().getCurrentThreadIndex() != self->m_original_thread_index) {
+                        // From the background thread, post the resumption back to the original IO thread.
+                        // Off an IO loop the fallback loop is not the suspending thread, it may resume the
+                        // coroutine before await_suspend returns, which then no longer touches the awaiter.
+                        common::LoopMonitor::instance().queueInLoop(self->m_original_thread_index, [handle]() {
+                            handle.resume();
+                        });
+                    } else if(self->m_state.exchange(COMPLETED, std::memory_order_acq_rel) == SUSPENDED) {
+                        // Already on the original IO thread, after await_suspend returned.
                         handle.resume();
-                    });
+                    }
                 };
 
-                lambda(this, handle);
+                const auto start = [](awaiter* self, std::coroutine_handle<> handle, decltype(lambda) run) {
+                    auto& counters = dbOperationCounters();
+                    counters.operations.fetch_add(1, std::memory_order_relaxed);
+                    if(counters.in_flight.fetch_add(1, std::memory_order_relaxed) == 0) {
+                        counters.rounds.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    run(self, handle);
+                };
+                // Read before the operation starts, the awaiter may be gone once it did when not resumed inline.
+                auto* tenant = m_tenant;
+                const bool resume_inline = m_resume_inline;
+                if(tenant && tenant->limitsDb()
+                   && !tenant->acquireDb([this, handle, lambda, start] { start(this, handle, lambda); })) {
+                    // Started by the operation of the tenant that releases a slot, on its thread.
+                    tenant->countDbDelayed();
+                } else {
+                    start(this, handle, lambda);
+                }
+                if(!resume_inline) {
+                    return true;
+                }
+                return m_state.exchange(SUSPENDED, std::memory_order_acq_rel) != COMPLETED;
             }
         };
 
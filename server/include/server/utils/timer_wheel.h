@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * @file timer_wheel.h
+ * @brief Defines a hierarchical timing wheel for large numbers of coarse timeouts.
+ */
+
+namespace server {
+
+/**
+ * @class TimerWheel
+ * @brief Two levels of `SLOTS` buckets holding values that expire a number of ticks from now.
+ *
+ * @details The inner wheel has a bucket per tick for the ticks of the current round, the
+ * outer one a bucket per round of `SLOTS` ticks. Scheduling appends to one bucket, and each
+ * tick expires one inner bucket; every `SLOTS` ticks the outer bucket of the round that starts
+ * is spread over the inner wheel. Both are O(1) per value, however many are scheduled.
+ *
+ * There is no cancellation. An owner whose deadline moved checks on expiry whether the value
+ * is really due, and schedules it again for the rest of the wait if not, so a deadline pushed
+ * back on every event costs nothing until it comes up.
+ *
+ * @note Not thread safe, meant to be owned by one IO loop.
+ */
+template <typename T, size_t SLOTS = 64>
+class TimerWheel {
+public:
+    /// The longest delay, in ticks. Longer ones are cut to it.
+    static constexpr uint64_t MAX_DELAY = SLOTS * (SLOTS - 1);
+
+    /// @brief Schedules `value` to expire `delay` ticks from now, at least one.
+    void schedule(uint64_t delay, T value) {
+        delay = std::clamp<uint64_t>(delay, 1, MAX_DELAY);
+        const uint64_t expiry = m_now + delay;
+        if(delay < SLOTS) {
+            m_inner[expiry % SLOTS].push_back(std::move(value));
+        } else {
+            m_outer[(expiry / SLOTS) % SLOTS].emplace_back(expiry, std::move(value));
+        }
+        ++m_size;
+    }
+
+    /// @brief Moves one tick forward, calling `expire(T&)` for every value due. It may schedule again.
+    template <typename F>
+    void advance(F&& expire) {
+        ++m_now;
+        if(m_now % SLOTS == 0) {
+            cascade();
+        }
+        auto due = std::exchange(m_inner[m_now % SLOTS], {});
+        m_size -= due.size();
+        for(auto& value : due) {
+            expire(value);
+        }
+    }
+
+    /// @brief The number of values scheduled.
+    [[nodiscard]] size_t size() const noexcept { return m_size; }
+
+private:
+    /// @brief Spreads the outer bucket of the round starting now over the inner wheel.
+    void cascade() {
+        auto& bucket = m_outer[(m_now / SLOTS) % SLOTS];
+        std::vector<std::pair<uint64_t, T>> later;
+        for(auto& [expiry, value] : bucket) {
+            if(expiry < m_now + SLOTS) {
+                m_inner[expiry % SLOTS].push_back(std::move(value));
+            } else {
+                later.emplace_back(expiry, std::move(value));
+            }
+        }
+        bucket = std::move(later);
+    }
+
+    uint64_t m_now = 0;
+    size_t m_size = 0;
+    std::array<std::vector<T>, SLOTS> m_inner;
+    std::array<std::vector<std::pair<uint64_t, T>>, SLOTS> m_outer;
+};
+
+} // namespace server
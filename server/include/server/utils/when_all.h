@@ -0,0 +1,324 @@
+#pragma once
+
+#include <drogon/drogon.h>
+#include <drogon/utils/coroutine.h>
+#include <server/utils/switch_to_io_loop.h>
+#include <array>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace server {
+
+namespace detail {
+
+/// @brief What `when_all` yields for a `drogon::Task<T>`, `std::monostate` standing in for void.
+template <typename T>
+using when_all_value_t = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+/// @brief Runs one task of a `when_all` to completion and reports to the awaiter.
+template <size_t I, typename T, typename Awaiter>
+fire_and_forget_task when_all_run(drogon::Task<T> task, Awaiter* self) {
+    try {
+        if constexpr(std::is_void_v<T>) {
+            co_await std::move(task);
+            std::get<I>(self->m_results).emplace();
+        } else {
+            std::get<I>(self->m_results).emplace(co_await std::move(task));
+        }
+    } catch(...) {
+        self->m_errors[I] = std::current_exception();
+    }
+    self->arrive();
+}
+
+/// @brief Runs one task of a variable-length `when_all` to completion and reports to the awaiter.
+template <typename T, typename Awaiter>
+fire_and_forget_task when_all_run_at(drogon::Task<T> task, Awaiter* self, size_t index) {
+    try {
+        if constexpr(std::is_void_v<T>) {
+            co_await std::move(task);
+            self->m_results[index].emplace();
+        } else {
+            self->m_results[index].emplace(co_await std::move(task));
+        }
+    } catch(...) {
+        self->m_errors[index] = std::current_exception();
+    }
+    self->arrive();
+}
+
+/// @brief Resumes a coroutine on the IO loop it suspended on, inline when already there.
+inline void resume_on(size_t thread_index, std::coroutine_handle<> handle) {
+    if(drogon::app().getCurrentThreadIndex() == thread_index) {
+        handle.resume();
+    } else {
+        common::LoopMonitor::instance().queueInLoop(thread_index, [handle] { handle.resume(); });
+    }
+}
+
+/// @brief The IO loop the caller runs on, the first one outside of them like `switch_to_io_loop`.
+inline size_t current_io_loop() {
+    const size_t index = drogon::app().getCurrentThreadIndex();
+    return index < drogon::app().getThreadNum() ? index : 0;
+}
+
+} // namespace detail
+
+/**
+ * @brief Awaits several independent `drogon::Task`s at once, see `when_all()`.
+ * @tparam Ts The result types of the tasks.
+ */
+template <typename... Ts>
+class when_all_awaiter {
+public:
+    explicit when_all_awaiter(drogon::Task<Ts>... tasks) noexcept
+        : m_tasks(std::move(tasks)...) {}
+
+    bool await_ready() const noexcept {
+        return sizeof...(Ts) == 0;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        m_waiter = handle;
+        m_thread_index = detail::current_io_loop();
+        start(std::index_sequence_for<Ts...>{});
+        // The extra count held while starting, so a task finishing early cannot resume us inside this call.
+        return m_pending.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+
+    /// @throws The exception of the first task that failed, in argument order, once all of them are done.
+    std::tuple<detail::when_all_value_t<Ts>...> await_resume() {
+        for(const auto& error : m_errors) {
+            if(error) {
+                std::rethrow_exception(error);
+            }
+        }
+        return std::apply([](auto&... results) {
+            return std::tuple<detail::when_all_value_t<Ts>...>(std::move(*results)...);
+        }, m_results);
+    }
+
+private:
+    template <size_t I, typename T, typename Awaiter>
+    friend fire_and_forget_task detail::when_all_run(drogon::Task<T>, Awaiter*);
+
+    template <size_t... Is>
+    void start(std::index_sequence<Is...>) {
+        (detail::when_all_run<Is>(std::move(std::get<Is>(m_tasks)), this), ...);
+    }
+
+    /// @brief Called by every task once done, the last one resumes the awaiting coroutine on its IO loop.
+    void arrive() {
+        if(m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            detail::resume_on(m_thread_index, m_waiter);
+        }
+    }
+
+    std::tuple<drogon::Task<Ts>...> m_tasks;
+    std::tuple<std::optional<detail::when_all_value_t<Ts>>...> m_results;
+    std::array<std::exception_ptr, sizeof...(Ts)> m_errors{};
+    std::atomic<size_t> m_pending{sizeof...(Ts) + 1};
+    std::coroutine_handle<> m_waiter;
+    size_t m_thread_index = 0;
+};
+
+/**
+ * @brief Runs independent tasks concurrently and resumes once all of them are done.
+ *
+ * @details Each awaited query costs a whole round trip to the database, so handlers that
+ * need several results that do not depend on each other should await them together:
+ *
+ * @code
+ *   auto [room, status] = co_await when_all(findRoom(room_id),
+ *                                           Repository::findMembershipStatus(db, user_id, room_id));
+ * @endcode
+ *
+ * All the tasks are started before the caller suspends. On a `DbClient` they go out on
+ * as many pooled connections. On a transaction they share its connection, where the
+ * PostgreSQL driver pipelines them when libpq supports it (drogon's batch mode), and
+ * otherwise runs them back to back without waiting on the caller in between.
+ *
+ * The caller resumes on the IO loop it suspended on, like with `switch_to_io_loop`. The
+ * tasks must not depend on each other's side effects, `when_any()` is there for racing them. A failing task does not cancel the
+ * others: its exception is rethrown once every task has finished, since they may still
+ * refer to the caller's frame.
+ *
+ * @return The results in argument order, `std::monostate` for a `drogon::Task<void>`.
+ */
+template <typename... Ts>
+auto when_all(drogon::Task<Ts>... tasks) {
+    return when_all_awaiter<Ts...>(std::move(tasks)...);
+}
+
+/**
+ * @brief Awaits every task of a list at once, see the `when_all()` overload taking a vector.
+ * @tparam T The result type of the tasks.
+ */
+template <typename T>
+class when_all_range_awaiter {
+public:
+    explicit when_all_range_awaiter(std::vector<drogon::Task<T>> tasks)
+        : m_tasks(std::move(tasks)),
+          m_results(m_tasks.size()),
+          m_errors(m_tasks.size()),
+          m_pending(m_tasks.size() + 1) {}
+
+    bool await_ready() const noexcept {
+        return m_tasks.empty();
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        m_waiter = handle;
+        m_thread_index = detail::current_io_loop();
+        for(size_t i = 0; i < m_tasks.size(); ++i) {
+            detail::when_all_run_at(std::move(m_tasks[i]), this, i);
+        }
+        return m_pending.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+
+    /// @throws The exception of the first task that failed, in list order, once all of them are done.
+    std::vector<detail::when_all_value_t<T>> await_resume() {
+        for(const auto& error : m_errors) {
+            if(error) {
+                std::rethrow_exception(error);
+            }
+        }
+        std::vector<detail::when_all_value_t<T>> results;
+        results.reserve(m_results.size());
+        for(auto& result : m_results) {
+            results.push_back(std::move(*result));
+        }
+        return results;
+    }
+
+private:
+    template <typename U, typename Awaiter>
+    friend fire_and_forget_task detail::when_all_run_at(drogon::Task<U>, Awaiter*, size_t);
+
+    void arrive() {
+        if(m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            detail::resume_on(m_thread_index, m_waiter);
+        }
+    }
+
+    std::vector<drogon::Task<T>> m_tasks;
+    std::vector<std::optional<detail::when_all_value_t<T>>> m_results;
+    std::vector<std::exception_ptr> m_errors;
+    std::atomic<size_t> m_pending;
+    std::coroutine_handle<> m_waiter;
+    size_t m_thread_index = 0;
+};
+
+/**
+ * @brief Runs a list of independent tasks concurrently, like the variadic `when_all()`.
+ * @details For fan-outs whose size is only known at run time. Bound the list when it
+ * comes from data, every task holds a database connection while it runs.
+ * @return The results in list order.
+ */
+template <typename T>
+auto when_all(std::vector<drogon::Task<T>> tasks) {
+    return when_all_range_awaiter<T>(std::move(tasks));
+}
+
+/**
+ * @brief Awaits the first of a list of tasks to finish, see `when_any()`.
+ * @tparam T The result type of the tasks.
+ */
+template <typename T>
+class when_any_awaiter {
+public:
+    explicit when_any_awaiter(std::vector<drogon::Task<T>> tasks)
+        : m_tasks(std::move(tasks)),
+          m_state(std::make_shared<State>()) {}
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        if(m_tasks.empty()) {
+            m_state->error = std::make_exception_ptr(std::invalid_argument("when_any of no tasks"));
+            return false;
+        }
+        m_state->waiter = handle;
+        m_state->thread_index = detail::current_io_loop();
+        for(size_t i = 0; i < m_tasks.size(); ++i) {
+            run(std::move(m_tasks[i]), m_state, i);
+        }
+        return m_state->gate.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+
+    /// @throws The exception of the first task to finish, if it failed.
+    std::pair<size_t, detail::when_all_value_t<T>> await_resume() {
+        if(m_state->error) {
+            std::rethrow_exception(m_state->error);
+        }
+        return std::move(*m_state->result);
+    }
+
+private:
+    /// @brief Shared with the tasks, the ones that lose keep it until they finish.
+    struct State {
+        std::atomic<bool> decided{false};
+        /// The winner and the caller both pass it, the last of the two resumes the caller.
+        std::atomic<int> gate{2};
+        std::optional<std::pair<size_t, detail::when_all_value_t<T>>> result;
+        std::exception_ptr error;
+        std::coroutine_handle<> waiter;
+        size_t thread_index = 0;
+    };
+
+    static fire_and_forget_task run(drogon::Task<T> task, std::shared_ptr<State> state, size_t index) {
+        std::optional<detail::when_all_value_t<T>> value;
+        std::exception_ptr error;
+        try {
+            if constexpr(std::is_void_v<T>) {
+                co_await std::move(task);
+                value.emplace();
+            } else {
+                value.emplace(co_await std::move(task));
+            }
+        } catch(...) {
+            error = std::current_exception();
+        }
+        if(state->decided.exchange(true, std::memory_order_acq_rel)) {
+            co_return;
+        }
+        if(error) {
+            state->error = std::move(error);
+        } else {
+            state->result.emplace(index, std::move(*value));
+        }
+        if(state->gate.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            detail::resume_on(state->thread_index, state->waiter);
+        }
+    }
+
+    std::vector<drogon::Task<T>> m_tasks;
+    std::shared_ptr<State> m_state;
+};
+
+/**
+ * @brief Runs a list of tasks concurrently and resumes as soon as the first one finishes.
+ *
+ * @details The caller resumes on the IO loop it suspended on, with the index of the task
+ * that finished first and its result, or its exception. The other tasks are not cancelled,
+ * they run to completion and their results are dropped. Unlike with `when_all()` the caller
+ * may be gone by then, so the tasks must own everything they use: capture by value, never
+ * refer to the caller's locals.
+ *
+ * @throws std::invalid_argument When given no tasks.
+ */
+template <typename T>
+auto when_any(std::vector<drogon::Task<T>> tasks) {
+    return when_any_awaiter<T>(std::move(tasks));
+}
+
+} // namespace server
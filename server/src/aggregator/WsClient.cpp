@@ -0,0 +1,431 @@
+#include <server/aggregator/WsClient.h>
+#include <server/chat/ClusterRoomService.h>
+#include <server/chat/ChatRoomManager.h>
+#include <server/chat/CacheWarmup.h>
+#include <server/chat/ServerDrain.h>
+#include <server/db/Repository.h>
+#include <server/utils/server_config.h>
+#include <common/utils/loop_monitor.h>
+#include <sys/resource.h>
+#include <thread>
+#include <random>
+#include <sstream>
+
+namespace server {
+
+WsClient& WsClient::instance() {
+    static WsClient inst;
+    return inst;
+}
+
+void WsClient::start(const std::string& address) {
+    if(address.empty()) {
+        LOG_INFO << "Not starting connection to aggregator";
+        return;
+    }
+
+    LOG_INFO << "Starting connection to aggregator: " << address;
+    std::lock_guard lock(m_mutex);
+    std::stringstream list(address);
+    std::string url;
+    while(std::getline(list, url, ',')) {
+        if(url.empty()) {
+            continue;
+        }
+        // TODO: Replace with ada-url parser
+        m_aggregators.push_back(common::splitUrl(url));
+    }
+    if(m_aggregators.empty()) {
+        LOG_INFO << "Not starting connection to aggregator";
+        return;
+    }
+    // A random first pick, so the servers of a cluster spread over its aggregators.
+    m_aggregator = std::uniform_int_distribution<size_t>(0, m_aggregators.size() - 1)(m_rng);
+
+    // Doubles as the heartbeat, the aggregator evicts this server when the reports stop.
+    const double interval = std::chrono::duration<double>(serverConfig().cluster.server_load_interval).count();
+    drogon::app().getLoop()->runEvery(std::max(interval, 0.1), [this] {
+        auto report = sampleServerLoad();
+        std::lock_guard lock(m_mutex);
+        send_unsafe(report);
+    });
+
+    connect_unsafe();
+}
+
+void WsClient::connect_unsafe() {
+    if(m_detached) {
+        return;
+    }
+    const auto& [server, path] = m_aggregators[m_aggregator];
+    // A fresh client per attempt, callbacks of an abandoned one are recognized and ignored.
+    client = drogon::WebSocketClient::newWebSocketClient(server);
+    auto req = drogon::HttpRequest::newHttpRequest();
+    req->setPath(path);
+
+    client->setMessageHandler([this](const std::string& msg,
+                                      const drogon::WebSocketClientPtr&,
+                                      const drogon::WebSocketMessageType& type) {
+        if(type == drogon::WebSocketMessageType::Binary) {
+            handleMessage(msg);
+        }
+    });
+
+    client->setConnectionClosedHandler([this](const drogon::WebSocketClientPtr& wsPtr) {
+        std::lock_guard lock(m_mutex);
+        if(wsPtr != client) {
+            return;
+        }
+        LOG_WARN << "Connection to aggregator closed, cluster events are not exchanged until it is back";
+        conn.reset();
+        scheduleReconnect_unsafe();
+    });
+
+    LOG_INFO << "Connecting to WebSocket at " << server;
+    client->connectToServer(
+        req,
+        [this](drogon::ReqResult r,
+               const drogon::HttpResponsePtr&,
+               const drogon::WebSocketClientPtr& wsPtr) {
+            std::lock_guard lock(m_mutex);
+            if(wsPtr != client) {
+                return;
+            }
+            if (r != drogon::ReqResult::Ok) {
+                conn.reset();
+                LOG_ERROR << "Failed to connect to aggregator service.";
+                scheduleReconnect_unsafe();
+                return;
+            }
+            conn = wsPtr->getConnection();
+            m_reconnect_attempt = 0;
+
+            chat::Envelope env;
+            auto host = common::getEnvVar("SERVER_HOST") + "/ws";
+            LOG_INFO << "Sending host to aggregator: " << host;
+            auto* registration = env.mutable_register_server_request();
+            registration->set_host(host);
+            registration->set_heartbeat_interval_ms(static_cast<uint32_t>(serverConfig().cluster.server_load_interval.count()));
+            send_unsafe(env);
+            // Right away, so the aggregator does not have to rank this server blindly until the first tick.
+            send_unsafe(sampleServerLoad());
+
+            if(!m_rooms.empty()) {
+                chat::Envelope subscribe;
+                subscribe.mutable_cluster_subscribe()->mutable_room_ids()->Add(m_rooms.begin(), m_rooms.end());
+                send_unsafe(subscribe);
+            }
+            if(!m_room_load.empty()) {
+                chat::Envelope report;
+                for(const auto& [room_id, connections] : m_room_load) {
+                    auto* room = report.mutable_room_load_report()->add_rooms();
+                    room->set_room_id(room_id);
+                    room->set_connections(connections);
+                }
+                send_unsafe(report);
+            }
+            m_pending_load.clear();
+        });
+}
+
+void WsClient::scheduleReconnect_unsafe() {
+    if(m_reconnect_armed) {
+        return;
+    }
+    m_reconnect_armed = true;
+    // The next aggregator takes over, its peers learn from it that this server moved.
+    m_aggregator = (m_aggregator + 1) % m_aggregators.size();
+
+    // Exponential backoff with jitter in [delay / 2, delay], so servers that lost the aggregator
+    // together do not all come back in the same instant.
+    const auto& cfg = serverConfig().cluster;
+    const auto min_delay = std::max<int64_t>(cfg.reconnect_min.count(), 1);
+    const auto max_delay = std::max<int64_t>(cfg.reconnect_max.count(), min_delay);
+    const auto shift = std::min<uint32_t>(m_reconnect_attempt, 30);
+    const auto delay = std::min<int64_t>(max_delay, min_delay << shift);
+    std::uniform_int_distribution<int64_t> jitter(delay / 2, delay);
+    const auto wait = std::chrono::milliseconds{jitter(m_rng)};
+    ++m_reconnect_attempt;
+
+    LOG_INFO << "Reconnecting to aggregator in " << wait.count() << " ms (attempt " << m_reconnect_attempt << ")";
+    drogon::app().getLoop()->runAfter(std::chrono::duration<double>(wait).count(), [this] {
+        std::lock_guard lock(m_mutex);
+        m_reconnect_armed = false;
+        connect_unsafe();
+    });
+}
+
+bool WsClient::clustered() const {
+    std::lock_guard lock(m_mutex);
+    return client != nullptr;
+}
+
+void WsClient::subscribe(int32_t room_id) {
+    std::lock_guard lock(m_mutex);
+    if(!client || !m_rooms.insert(room_id).second) {
+        return;
+    }
+    chat::Envelope env;
+    env.mutable_cluster_subscribe()->add_room_ids(room_id);
+    send_unsafe(env);
+}
+
+void WsClient::unsubscribe(int32_t room_id) {
+    std::lock_guard lock(m_mutex);
+    if(!client || m_rooms.erase(room_id) == 0) {
+        return;
+    }
+    chat::Envelope env;
+    env.mutable_cluster_unsubscribe()->add_room_ids(room_id);
+    send_unsafe(env);
+}
+
+void WsClient::publish(std::optional<int32_t> room_id, const common::SerializedEnvelope& bytes,
+                       const std::vector<int32_t>& audience_room_ids) {
+    if(!bytes || !serverConfig().cluster.fanout) {
+        return;
+    }
+    std::lock_guard lock(m_mutex);
+    if(!conn) {
+        return;
+    }
+    chat::Envelope env;
+    auto* publish = env.mutable_cluster_publish();
+    if(room_id) {
+        publish->set_room_id(*room_id);
+    }
+    publish->set_envelope(*bytes);
+    publish->mutable_audience_room_ids()->Add(audience_room_ids.begin(), audience_room_ids.end());
+    send_unsafe(env);
+}
+
+void WsClient::reportRoomLoad(int32_t room_id, uint32_t connections) {
+    std::lock_guard lock(m_mutex);
+    if(!client) {
+        return;
+    }
+    if(connections > 0) {
+        m_room_load[room_id] = connections;
+    } else {
+        m_room_load.erase(room_id);
+    }
+    m_pending_load[room_id] = connections;
+    if(m_load_flush_armed) {
+        return;
+    }
+    m_load_flush_armed = true;
+    const double interval = std::chrono::duration<double>(serverConfig().cluster.load_report_interval).count();
+    drogon::app().getLoop()->runAfter(std::max(interval, 0.0), [this] { flushRoomLoad(); });
+}
+
+void WsClient::flushRoomLoad() {
+    std::lock_guard lock(m_mutex);
+    m_load_flush_armed = false;
+    if(m_pending_load.empty()) {
+        return;
+    }
+    chat::Envelope env;
+    auto* report = env.mutable_room_load_report();
+    for(const auto& [room_id, connections] : m_pending_load) {
+        auto* room = report->add_rooms();
+        room->set_room_id(room_id);
+        room->set_connections(connections);
+    }
+    m_pending_load.clear();
+    // Lost if the link is down, the full counts are sent again on reconnect.
+    send_unsafe(env);
+}
+
+// User plus system CPU time of the whole process.
+static std::chrono::microseconds processCpuTime() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    const auto toMicros = [](const timeval& tv) {
+        return std::chrono::seconds{tv.tv_sec} + std::chrono::microseconds{tv.tv_usec};
+    };
+    return toMicros(usage.ru_utime) + toMicros(usage.ru_stime);
+}
+
+chat::Envelope WsClient::sampleServerLoad() {
+    const auto& cfg = serverConfig().cluster;
+    const auto now = std::chrono::steady_clock::now();
+    const auto cpu_time = processCpuTime();
+
+    float cpu = 0;
+    if(m_last_sample.time_since_epoch().count() != 0 && now > m_last_sample) {
+        const auto wall = std::chrono::duration_cast<std::chrono::microseconds>(now - m_last_sample);
+        const auto cores = std::max(std::thread::hardware_concurrency(), 1u);
+        cpu = static_cast<float>((cpu_time - m_last_cpu_time).count()) / static_cast<float>(wall.count() * cores);
+    }
+    m_last_cpu_time = cpu_time;
+    m_last_sample = now;
+
+    const auto lag_us = static_cast<uint32_t>(std::min<int64_t>(common::LoopMonitor::instance().maxLag().count(), UINT32_MAX));
+
+    const auto& manager = ChatRoomManager::instance();
+    chat::Envelope env;
+    auto* report = env.mutable_server_load_report();
+    report->set_connections(manager.connectionCount());
+    report->set_rooms(manager.roomCount());
+    report->set_loop_lag_us(lag_us);
+    report->set_cpu(cpu);
+    report->set_max_connections(cfg.max_connections);
+
+    float load = cpu;
+    if(cfg.max_connections > 0) {
+        load = std::max(load, static_cast<float>(report->connections()) / static_cast<float>(cfg.max_connections));
+    }
+    if(cfg.max_loop_lag.count() > 0) {
+        const auto max_lag_us = std::chrono::duration_cast<std::chrono::microseconds>(cfg.max_loop_lag).count();
+        load = std::max(load, static_cast<float>(lag_us) / static_cast<float>(max_lag_us));
+    }
+    // A server still warming up or shutting down takes no clients.
+    if(!CacheWarmup::instance().ready() || ServerDrain::instance().draining()) {
+        load = std::max(load, 1.0f);
+    }
+    report->set_load(load);
+    return env;
+}
+
+void WsClient::reportLoad() {
+    drogon::app().getLoop()->queueInLoop([this] {
+        auto report = sampleServerLoad();
+        std::lock_guard lock(m_mutex);
+        send_unsafe(report);
+    });
+}
+
+void WsClient::drain(std::function<void(std::vector<chat::ServerNodeInfo>)> on_servers) {
+    {
+        std::lock_guard lock(m_mutex);
+        if(client) {
+            m_on_servers = std::move(on_servers);
+            chat::Envelope env;
+            env.mutable_drain_server_request();
+            send_unsafe(env);
+            chat::Envelope request;
+            request.mutable_get_servers_request()->set_ranked(true);
+            send_unsafe(request);
+            return;
+        }
+    }
+    on_servers({});
+}
+
+void WsClient::detach() {
+    std::lock_guard lock(m_mutex);
+    m_detached = true;
+    conn.reset();
+    if(client) {
+        client->stop();
+        client.reset();
+    }
+    LOG_INFO << "Left the aggregator to the process taking over";
+}
+
+void WsClient::updateRoomDirectory(const chat::RoomDirectoryUpdate& update) {
+    std::lock_guard lock(m_mutex);
+    if(!client) {
+        return;
+    }
+    chat::Envelope env;
+    *env.mutable_room_directory_update() = update;
+    if(m_directory_loading) {
+        m_directory_pending.push_back(std::move(env));
+        return;
+    }
+    if(!conn || !conn->connected()) {
+        m_directory_stale = true;
+        return;
+    }
+    send_unsafe(env);
+}
+
+void WsClient::sendRoomDirectorySnapshot() {
+    {
+        std::lock_guard lock(m_mutex);
+        if(m_directory_loading) {
+            return;
+        }
+        m_directory_loading = true;
+        m_directory_stale = false;
+    }
+    drogon::async_run([this]() -> drogon::Task<void> {
+        chat::Envelope env;
+        auto* snapshot = env.mutable_room_directory_update();
+        snapshot->set_snapshot(true);
+        bool loaded = true;
+        try {
+            co_await Repository::loadRoomDirectory(readDbClient(), *snapshot->mutable_upserted());
+        } catch(const drogon::orm::DrogonDbException& e) {
+            LOG_ERROR << "Failed to load the room directory for the aggregator: " << e.base().what();
+            loaded = false;
+        }
+
+        std::lock_guard lock(m_mutex);
+        m_directory_loading = false;
+        if(!loaded || !conn || !conn->connected()) {
+            // Retried on the next registration, the changes held back are part of the next snapshot.
+            m_directory_stale = true;
+            m_directory_pending.clear();
+            co_return;
+        }
+        LOG_INFO << "Sending " << snapshot->upserted_size() << " rooms to the aggregator's room directory";
+        send_unsafe(env);
+        for(const auto& pending : m_directory_pending) {
+            send_unsafe(pending);
+        }
+        m_directory_pending.clear();
+    });
+}
+
+void WsClient::handleMessage(const std::string& msg) {
+    chat::Envelope env;
+    if(!env.ParseFromString(msg)) {
+        LOG_ERROR << "Malformed message from aggregator";
+        return;
+    }
+    switch(env.payload_case()) {
+        case chat::Envelope::kClusterPublish: {
+            ClusterRoomService::deliverRemote(env.cluster_publish());
+            break;
+        }
+        case chat::Envelope::kGetServersResponse: {
+            std::function<void(std::vector<chat::ServerNodeInfo>)> on_servers;
+            {
+                std::lock_guard lock(m_mutex);
+                on_servers = std::exchange(m_on_servers, nullptr);
+            }
+            if(on_servers) {
+                const auto& servers = env.get_servers_response().servers();
+                on_servers({servers.begin(), servers.end()});
+            }
+            break;
+        }
+        case chat::Envelope::kRegisterServerResponse: {
+            if(env.register_server_response().status().code() != chat::STATUS_SUCCESS) {
+                LOG_ERROR << "Aggregator refused the registration of this server";
+                break;
+            }
+            bool stale;
+            {
+                std::lock_guard lock(m_mutex);
+                stale = m_directory_stale;
+            }
+            if(env.register_server_response().room_directory_wanted() || stale) {
+                sendRoomDirectorySnapshot();
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void WsClient::send_unsafe(const chat::Envelope& env) {
+    if(conn && conn->connected()) {
+        common::sendEnvelope(conn, env);
+    }
+}
+
+} // namespace server
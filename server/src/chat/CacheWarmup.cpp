@@ -0,0 +1,103 @@
+#include <server/chat/CacheWarmup.h>
+#include <server/chat/MessageHistoryCache.h>
+#include <server/chat/RoomDataCache.h>
+#include <server/chat/UsernameFilter.h>
+#include <server/db/Repository.h>
+#include <server/utils/server_config.h>
+#include <server/utils/switch_to_io_loop.h>
+#include <server/utils/when_all.h>
+
+namespace server {
+
+namespace sql {
+
+// One index probe per room for its newest message, the rooms are far fewer than the messages.
+static const std::string RECENT_ROOMS =
+    "SELECT r.room_id, r.room_name, r.owner_id, r.is_private "
+    "FROM rooms r CROSS JOIN LATERAL ("
+        "SELECT m.created_at FROM messages m WHERE m.room_id = r.room_id "
+        "ORDER BY m.created_at DESC LIMIT 1"
+    ") newest "
+    "ORDER BY newest.created_at DESC LIMIT $1";
+
+} // namespace sql
+
+/// Rooms whose history is read at the same time.
+static constexpr size_t WARM_CONCURRENCY = 4;
+
+CacheWarmup& CacheWarmup::instance() {
+    static CacheWarmup inst;
+    return inst;
+}
+
+drogon::Task<> CacheWarmup::run() {
+    const auto& cfg = serverConfig().warmup;
+    if(cfg.enabled && cfg.rooms > 0) {
+        const auto started = std::chrono::steady_clock::now();
+        try {
+            // The primary, like the lazy fills: a lagging replica would leave gaps in the tails.
+            const auto warmed = co_await warmRooms(writeDbClient(), cfg.rooms);
+            const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+            LOG_INFO << "Warmed the caches with " << warmed << " rooms in " << elapsed.count() << " ms";
+        } catch(const drogon::orm::DrogonDbException& e) {
+            LOG_ERROR << "Cache warmup failed, the caches fill lazily: " << e.base().what();
+        }
+    }
+    if(serverConfig().username_filter.enabled) {
+        try {
+            const auto names = co_await UsernameFilter::instance().load(writeDbClient());
+            LOG_INFO << "Loaded " << names << " usernames into the availability filter";
+        } catch(const drogon::orm::DrogonDbException& e) {
+            LOG_ERROR << "Loading the username filter failed, every name is looked up: " << e.base().what();
+        }
+    }
+    m_ready.store(true, std::memory_order_release);
+    LOG_INFO << "Server ready";
+}
+
+drogon::Task<size_t> CacheWarmup::warmRooms(const drogon::orm::DbClientPtr& db, size_t rooms) {
+    auto& room_cache = RoomDataCache::instance();
+    const auto generation = room_cache.generation();
+    auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql::RECENT_ROOMS, static_cast<int64_t>(rooms)));
+
+    std::vector<int32_t> room_ids;
+    room_ids.reserve(rows.size());
+    for(const auto& row : rows) {
+        CachedRoom room{
+            .id = row["room_id"].as<int32_t>(),
+            .name = row["room_name"].as<std::string>(),
+            .owner_id = row["owner_id"].isNull() ? std::nullopt : std::optional<int32_t>{row["owner_id"].as<int32_t>()},
+            .is_private = row["is_private"].as<bool>(),
+        };
+        room_ids.push_back(room.id);
+        room_cache.putRoom(room, generation);
+    }
+
+    if(!serverConfig().history_cache.enabled) {
+        co_return room_ids.size();
+    }
+    auto& history = MessageHistoryCache::instance();
+    const auto capacity = std::max<size_t>(serverConfig().history_cache.messages_per_room, 1);
+    const auto fill = [](drogon::orm::DbClientPtr db, int32_t room_id, size_t capacity) -> drogon::Task<> {
+        auto& history = MessageHistoryCache::instance();
+        const auto version = history.version(room_id);
+        auto tail = co_await Repository::findMessagesPage(db, room_id, static_cast<int32_t>(capacity), std::numeric_limits<int64_t>::max(), HistoryKey::Seq);
+        const bool has_all = tail.size() < capacity;
+        history.fill(room_id, std::move(tail), has_all, version);
+    };
+    // A few rooms at a time, on as many pooled connections, leaving the rest of the pool alone.
+    std::vector<drogon::Task<>> batch;
+    for(const int32_t room_id : room_ids) {
+        if(!history.contains(room_id)) {
+            batch.push_back(fill(db, room_id, capacity));
+        }
+        if(batch.size() == WARM_CONCURRENCY) {
+            co_await when_all(std::move(batch));
+            batch.clear();
+        }
+    }
+    co_await when_all(std::move(batch));
+    co_return room_ids.size();
+}
+
+} // namespace server
@@ -0,0 +1,256 @@
+#include <server/chat/ChangeFeed.h>
+#include <common/utils/metrics.h>
+#include <common/utils/utils.h>
+#include <drogon/HttpClient.h>
+#include <filesystem>
+#include <fstream>
+
+namespace server {
+
+/// @brief The events stored by the sink.
+static common::Counter& feedEvents() {
+    static auto& counter = common::MetricsRegistry::instance().counter(
+        "chat_change_feed_events_total", "Chat events stored by the change feed's sink.");
+    return counter;
+}
+
+/// @brief The events dropped because too many were waiting for the sink.
+static common::Counter& feedDropped() {
+    static auto& counter = common::MetricsRegistry::instance().counter(
+        "chat_change_feed_dropped_total", "Chat events dropped while the change feed's sink could not keep up.");
+    return counter;
+}
+
+/// @brief The batches the sink failed to store, each is written again.
+static common::Counter& feedFailures() {
+    static auto& counter = common::MetricsRegistry::instance().counter(
+        "chat_change_feed_write_failures_total", "Batches the change feed's sink failed to store.");
+    return counter;
+}
+
+/**
+ * @brief Appends the batches to files of about `segment_bytes`, named by the epoch and the first seq they hold.
+ * @details The names sort in the order of the events, a consumer reads a segment once the next one exists.
+ */
+class FileSegmentSink : public ChangeFeedSink {
+public:
+    FileSegmentSink(std::filesystem::path directory, size_t segment_bytes, int64_t epoch)
+        : m_directory(std::move(directory)), m_segment_bytes(segment_bytes), m_epoch(epoch) {}
+
+    void write(const std::string& batch, uint64_t first_seq, std::function<void(bool)> done) override {
+        if(!m_out.is_open() || m_written >= m_segment_bytes) {
+            open(first_seq);
+        }
+        m_out << batch;
+        m_out.flush();
+        if(!m_out) {
+            LOG_ERROR << "Cannot write the change feed segment in " << m_directory;
+            m_out.close();
+            done(false);
+            return;
+        }
+        m_written += batch.size();
+        done(true);
+    }
+
+private:
+    void open(uint64_t first_seq) {
+        m_out.close();
+        m_out.clear();
+        std::error_code ec;
+        std::filesystem::create_directories(m_directory, ec);
+        char name[64];
+        std::snprintf(name, sizeof(name), "feed-%016lld-%012llu.ndjson", static_cast<long long>(m_epoch), static_cast<unsigned long long>(first_seq));
+        m_out.open(m_directory / name, std::ios::binary | std::ios::app);
+        m_written = 0;
+    }
+
+    const std::filesystem::path m_directory;
+    const size_t m_segment_bytes;
+    const int64_t m_epoch;
+    std::ofstream m_out;
+    size_t m_written = 0;
+};
+
+/// @brief Posts every batch to a URL, a 2xx answer stores it.
+class HttpSink : public ChangeFeedSink {
+public:
+    explicit HttpSink(const std::string& url) {
+        auto [server, path] = common::splitUrl(url);
+        // On the main loop, so its callbacks come back where the feed is flushed.
+        m_client = drogon::HttpClient::newHttpClient(server, drogon::app().getLoop());
+        m_path = std::move(path);
+    }
+
+    void write(const std::string& batch, uint64_t first_seq, std::function<void(bool)> done) override {
+        auto req = drogon::HttpRequest::newHttpRequest();
+        req->setMethod(drogon::Post);
+        req->setPath(m_path);
+        req->setCustomContentTypeString("application/x-ndjson");
+        req->addHeader("X-Feed-First-Seq", std::to_string(first_seq));
+        req->setBody(batch);
+        m_client->sendRequest(req, [done = std::move(done)](drogon::ReqResult result, const drogon::HttpResponsePtr& resp) {
+            const bool stored = result == drogon::ReqResult::Ok && resp && resp->statusCode() >= 200 && resp->statusCode() < 300;
+            if(!stored) {
+                LOG_WARN << "The change feed endpoint did not take a batch, "
+                         << (resp ? "status " + std::to_string(resp->statusCode()) : "no response");
+            }
+            done(stored);
+        }, REQUEST_TIMEOUT);
+    }
+
+private:
+    static constexpr double REQUEST_TIMEOUT = 10.0;
+
+    drogon::HttpClientPtr m_client;
+    std::string m_path;
+};
+
+ChangeFeed& ChangeFeed::instance() {
+    static ChangeFeed inst;
+    return inst;
+}
+
+void ChangeFeed::start(const ChangeFeedConfig& config) {
+    if(!config.enabled) {
+        return;
+    }
+    m_config = config;
+    m_config.max_batch_events = std::max<size_t>(m_config.max_batch_events, 1);
+    m_epoch = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    if(config.sink == "http") {
+        if(config.url.empty()) {
+            LOG_ERROR << "The http change feed sink needs a url, change feed disabled";
+            return;
+        }
+        m_sink = std::make_unique<HttpSink>(config.url);
+    } else if(config.sink == "file") {
+        m_sink = std::make_unique<FileSegmentSink>(config.directory, config.segment_bytes, m_epoch);
+    } else {
+        LOG_ERROR << "Unknown change feed sink '" << config.sink << "', change feed disabled";
+        return;
+    }
+    m_enabled.store(true, std::memory_order_release);
+    drogon::app().getLoop()->runEvery(std::chrono::duration<double>(m_config.flush_interval).count(), [this] { flush(); });
+    LOG_INFO << "Emitting the change feed to the " << config.sink << " sink, epoch " << m_epoch;
+}
+
+static std::string timestampField() {
+    const auto now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    return ",\"ts\":" + std::to_string(now);
+}
+
+void ChangeFeed::emit(std::string_view type, const std::string& fields) {
+    std::string line = ",\"type\":\"";
+    line += type;
+    line += '"';
+    line += timestampField();
+    line += fields;
+    line += "}\n";
+
+    std::lock_guard lock(m_mutex);
+    if(m_pending.size() >= m_config.max_buffered_events) {
+        ++m_dropped;
+        feedDropped().inc();
+        return;
+    }
+    const uint64_t seq = m_next_seq++;
+    m_pending.emplace_back(seq, "{\"epoch\":" + std::to_string(m_epoch) + ",\"seq\":" + std::to_string(seq) + line);
+}
+
+void ChangeFeed::messageSent(int32_t room_id, int32_t user_id, const StoredMessage& message, const std::string& text) {
+    if(!enabled()) {
+        return;
+    }
+    std::string fields = ",\"room_id\":" + std::to_string(room_id) + ",\"user_id\":" + std::to_string(user_id)
+        + ",\"message_id\":" + std::to_string(message.message_id) + ",\"room_seq\":" + std::to_string(message.seq)
+        + ",\"created_at\":" + std::to_string(message.created_at);
+    if(m_config.include_text) {
+        fields += ",\"text\":" + Json::valueToQuotedString(text.c_str());
+    }
+    emit("message_sent", fields);
+}
+
+void ChangeFeed::messagesDeleted(int32_t room_id, int32_t by_user_id, const std::vector<int32_t>& message_ids) {
+    if(!enabled() || message_ids.empty()) {
+        return;
+    }
+    std::string ids;
+    for(const auto id : message_ids) {
+        ids += (ids.empty() ? "" : ",") + std::to_string(id);
+    }
+    emit("messages_deleted", ",\"room_id\":" + std::to_string(room_id) + ",\"by_user_id\":" + std::to_string(by_user_id)
+        + ",\"message_ids\":[" + ids + "]");
+}
+
+void ChangeFeed::memberJoined(int32_t room_id, int32_t user_id, bool new_member) {
+    if(!enabled()) {
+        return;
+    }
+    emit("member_joined", ",\"room_id\":" + std::to_string(room_id) + ",\"user_id\":" + std::to_string(user_id)
+        + ",\"new_member\":" + (new_member ? "true" : "false"));
+}
+
+void ChangeFeed::memberLeft(int32_t room_id, int32_t user_id, std::string_view reason) {
+    if(!enabled()) {
+        return;
+    }
+    emit("member_left", ",\"room_id\":" + std::to_string(room_id) + ",\"user_id\":" + std::to_string(user_id)
+        + ",\"reason\":\"" + std::string(reason) + "\"");
+}
+
+void ChangeFeed::membershipChanged(int32_t room_id, int32_t user_id, chat::MembershipStatus status) {
+    if(!enabled()) {
+        return;
+    }
+    emit("membership_changed", ",\"room_id\":" + std::to_string(room_id) + ",\"user_id\":" + std::to_string(user_id)
+        + ",\"status\":\"" + chat::MembershipStatus_Name(status) + "\"");
+}
+
+void ChangeFeed::roleChanged(int32_t room_id, int32_t user_id, chat::UserRights rights, int32_t by_user_id) {
+    if(!enabled()) {
+        return;
+    }
+    emit("role_changed", ",\"room_id\":" + std::to_string(room_id) + ",\"user_id\":" + std::to_string(user_id)
+        + ",\"role\":\"" + chat::UserRights_Name(rights) + "\",\"by_user_id\":" + std::to_string(by_user_id));
+}
+
+void ChangeFeed::flush() {
+    if(m_in_flight) {
+        return;
+    }
+    uint64_t dropped = 0;
+    // A batch that failed is written again as it was, new events wait for the next one.
+    if(m_batch_events == 0) {
+        std::lock_guard lock(m_mutex);
+        std::swap(dropped, m_dropped);
+        const size_t count = std::min(m_pending.size(), m_config.max_batch_events);
+        if(count > 0) {
+            m_batch_first_seq = m_pending.front().first;
+        }
+        for(size_t i = 0; i < count; ++i) {
+            m_batch += m_pending.front().second;
+            m_pending.pop_front();
+        }
+        m_batch_events = count;
+    }
+    if(dropped > 0) {
+        LOG_WARN << "Dropped " << dropped << " change feed event(s), the sink cannot keep up";
+    }
+    if(m_batch_events == 0) {
+        return;
+    }
+    m_in_flight = true;
+    m_sink->write(m_batch, m_batch_first_seq, [this](bool stored) {
+        m_in_flight = false;
+        if(!stored) {
+            feedFailures().inc();
+            return;
+        }
+        feedEvents().inc(m_batch_events);
+        m_batch.clear();
+        m_batch_events = 0;
+    });
+}
+
+} // namespace server
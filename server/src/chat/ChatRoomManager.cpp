@@ -1,6 +1,15 @@
 #include <server/chat/ChatRoomManager.h>
+#include <server/chat/TenantQuotas.h>
 #include <common/utils/utils.h>
 #include <server/chat/WsData.h>
+#include <server/chat/ConnectionContext.h>
+#include <server/chat/TypingAggregator.h>
+#include <server/chat/MessageHistoryCache.h>
+#include <server/aggregator/WsClient.h>
+#include <server/utils/server_config.h>
+#include <common/utils/metrics.h>
+#include <common/utils/tracing.h>
+#include <algorithm>
 
 namespace server {
 
@@ -9,13 +18,59 @@ ChatRoomManager& ChatRoomManager::instance() {
     return inst;
 }
 
+ChatRoomManager::ChatRoomManager() {
+    for(auto& shard : m_user_shards) {
+        shard = UserShardGuarded::create();
+    }
+    for(auto& shard : m_room_shards) {
+        shard = RoomShardGuarded::create();
+    }
+    m_loop_replicas.resize(std::max<size_t>(drogon::app().getThreadNum(), 1));
+
+    auto& metrics = common::MetricsRegistry::instance();
+    metrics.gauge("chat_connections", "Authenticated connections on this server.", [this] { return static_cast<double>(connectionCount()); });
+    metrics.gauge("chat_rooms", "Rooms with at least one local member.", [this] { return static_cast<double>(roomCount()); });
+}
+
+/// @brief The number of connections each broadcast is written to, split by room and global broadcasts.
+static common::Histogram& broadcastFanout(bool global) {
+    static auto& room = common::MetricsRegistry::instance().histogram(
+        "chat_broadcast_fanout", "Local connections a broadcast was written to.", "scope=\"room\"", common::MetricsRegistry::sizeBuckets());
+    static auto& all = common::MetricsRegistry::instance().histogram(
+        "chat_broadcast_fanout", "Local connections a broadcast was written to.", "scope=\"all\"", common::MetricsRegistry::sizeBuckets());
+    return global ? all : room;
+}
+
+ChatRoomManager::UserShardGuarded& ChatRoomManager::userShard(int32_t user_id) const {
+    return *m_user_shards[static_cast<uint32_t>(user_id) % SHARD_COUNT];
+}
+
+ChatRoomManager::RoomShardGuarded& ChatRoomManager::roomShard(int32_t room_id) const {
+    return *m_room_shards[static_cast<uint32_t>(room_id) % SHARD_COUNT];
+}
+
+size_t ChatRoomManager::currentLoopIndex() const {
+    auto idx = drogon::app().getCurrentThreadIndex();
+    if(idx >= m_loop_replicas.size()) {
+        LOG_WARN << "ChatRoomManager used outside of an IO loop, falling back to loop 0";
+        return 0;
+    }
+    return idx;
+}
+
+void ChatRoomManager::withReplica(size_t loop_index, std::function<void(LoopReplica&)> fn) const {
+    drogon::app().getIOLoop(loop_index)->runInLoop([this, loop_index, fn = std::move(fn)] {
+        fn(m_loop_replicas[loop_index]);
+    });
+}
+
 // Helper function to create UserInfo from WsData.
 // This is synchronous because it operates on already-locked data.
 static chat::UserInfo makeUserInfo(const WsData& data) {
     chat::UserInfo ui;
     if(data.user) {
         ui.set_user_id(data.user->id);
-        ui.set_user_name(data.user->name);
+        ui.set_user_name(*data.user->name());
         if(data.room) {
             ui.set_user_room_rights(data.room->rights);
         }
@@ -23,65 +78,124 @@ static chat::UserInfo makeUserInfo(const WsData& data) {
     return ui;
 }
 
-drogon::Task<std::vector<chat::UserInfo>> ChatRoomManager::getUsersInRoom(
-    int32_t room_id, const WsData& locked_data) const {
-    auto manager_lock = co_await m_manager_mutex->lock_shared();
+// Epochs start from the clock, so they do not repeat across restarts of the server.
+static uint64_t nextPresenceEpoch() {
+    static std::atomic<uint64_t> next{static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count())};
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
 
-    auto it = m_room_to_conns.find(room_id);
-    if(it == m_room_to_conns.end()) {
-        co_return {};
+drogon::Task<RoomRoster> ChatRoomManager::getUsersInRoom(
+    int32_t room_id, std::optional<RosterVersion> known) const {
+    RoomRoster roster;
+    auto shard = co_await roomShard(room_id).lock_shared();
+    auto it = shard->room_to_conns.find(room_id);
+    if(it == shard->room_to_conns.end()) {
+        co_return roster;
     }
+    const auto& members = it->second;
+    roster.presence_epoch = members.presence_epoch;
+    roster.presence_seq = members.presence_seq;
 
-    std::vector<chat::UserInfo> user_list;
-    user_list.reserve(it->second.size());
-
-    for(const auto& conn : it->second) {
-        auto peer_guarded = conn->getContext<WsDataGuarded>();
+    if(known && known->epoch == members.presence_epoch && known->seq <= members.presence_seq) {
+        const uint64_t oldest = members.presence_log.empty() ? members.presence_seq + 1 : members.presence_log.front().seq();
+        if(known->seq + 1 >= oldest) {
+            roster.incremental = true;
+            for(const auto& delta : members.presence_log) {
+                if(delta.seq() > known->seq) {
+                    roster.missed.push_back(delta);
+                }
+            }
+            co_return roster;
+        }
+    }
 
-        if(peer_guarded->isHolding(locked_data)) {
-            user_list.push_back(makeUserInfo(locked_data));
-        } else {
-            auto peer_proxy = co_await peer_guarded->lock_shared();
-            user_list.push_back(makeUserInfo(*peer_proxy));
+    roster.users.reserve(members.conns.size());
+    for(const auto& [user_id, entry] : members.roster) {
+        for(uint32_t n = 0; n < entry.connections; ++n) {
+            roster.users.push_back(entry.user);
         }
     }
-    co_return user_list;
+    co_return roster;
 }
 
 drogon::Task<void> ChatRoomManager::registerConnection(int32_t user_id, const drogon::WebSocketConnectionPtr& conn) {
-    auto lock = co_await m_manager_mutex->lock_unique();
-    m_user_id_to_conns[user_id].insert(conn);
+    const auto loop_index = currentLoopIndex();
+    {
+        auto shard = co_await userShard(user_id).lock_unique();
+        if(shard->user_id_to_conns[user_id].emplace(conn, loop_index).second) {
+            m_connection_count.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    withReplica(loop_index, [conn](LoopReplica& replica) {
+        replica.authenticated_conns.insert(conn);
+    });
 }
 
-drogon::Task<void> ChatRoomManager::addConnectionToRoom(int32_t room_id, const drogon::WebSocketConnectionPtr& conn) {
-    auto lock = co_await m_manager_mutex->lock_unique();
-    m_room_to_conns[room_id].insert(conn);
+drogon::Task<void> ChatRoomManager::addConnectionToRoom(const drogon::WebSocketConnectionPtr& conn, const WsData& locked_data, bool new_member) {
+    if(!locked_data.user || !locked_data.room) {
+        co_return;
+    }
+    const int32_t room_id = locked_data.room->id;
+    const auto loop_index = currentLoopIndex();
+    {
+        auto shard = co_await roomShard(room_id).lock_unique();
+        auto& members = shard->room_to_conns[room_id];
+        if(members.per_loop_count.empty()) {
+            members.per_loop_count.resize(m_loop_replicas.size(), 0);
+            members.presence_epoch = nextPresenceEpoch();
+            roomOpened_unsafe(room_id);
+        }
+        if(members.conns.emplace(conn, loop_index).second) {
+            ++members.per_loop_count[loop_index];
+            recordPresence_unsafe(members, makeUserInfo(locked_data), 1, new_member);
+            WsClient::instance().reportRoomLoad(room_id, static_cast<uint32_t>(members.conns.size()));
+        }
+        // Inside the lock, so the delta announcing this join also reaches this connection.
+        withReplica(loop_index, [room_id, conn](LoopReplica& replica) {
+            replica.room_to_conns[room_id].insert(conn);
+        });
+    }
+    schedulePresenceFlush(room_id);
 }
 
-drogon::Task<void> ChatRoomManager::removeConnectionFromRoom(const drogon::WebSocketConnectionPtr& conn, const WsData& locked_data) {    
+drogon::Task<void> ChatRoomManager::removeConnectionFromRoom(const drogon::WebSocketConnectionPtr& conn, const WsData& locked_data) {
     if(locked_data.user && locked_data.room) {
         int32_t room_id = locked_data.room->id;
 
-        chat::Envelope user_left_msg;
-        auto* user_info = user_left_msg.mutable_user_left()->mutable_user();
-        user_info->set_user_id(locked_data.user->id);
-        user_info->set_user_name(locked_data.user->name);
-        user_info->set_user_room_rights(locked_data.room->rights);
-
-        auto lock = co_await m_manager_mutex->lock_unique();
-        sendToRoom_unsafe(room_id, user_left_msg);
+        TypingAggregator::instance().removeUser(room_id, locked_data.user->id);
 
-        if(auto it = m_room_to_conns.find(room_id); it != m_room_to_conns.end()) {
-            it->second.erase(conn);
-            if(it->second.empty()) {
-                m_room_to_conns.erase(it);
+        auto shard = co_await roomShard(room_id).lock_unique();
+        if(auto it = shard->room_to_conns.find(room_id); it != shard->room_to_conns.end()) {
+            auto& members = it->second;
+            if(auto member = members.conns.find(conn); member != members.conns.end()) {
+                const auto loop_index = member->second;
+                --members.per_loop_count[loop_index];
+                members.conns.erase(member);
+                recordPresence_unsafe(members, makeUserInfo(locked_data), -1, false);
+                withReplica(loop_index, [room_id, conn](LoopReplica& replica) {
+                    if(auto room = replica.room_to_conns.find(room_id); room != replica.room_to_conns.end()) {
+                        room->second.erase(conn);
+                        if(room->second.empty()) {
+                            replica.room_to_conns.erase(room);
+                        }
+                    }
+                });
+            }
+            if(members.conns.empty()) {
+                // Nobody is left to tell, the pending presence goes with the room.
+                shard->room_to_conns.erase(it);
+                roomClosed_unsafe(room_id);
+            } else {
+                WsClient::instance().reportRoomLoad(room_id, static_cast<uint32_t>(members.conns.size()));
+                schedulePresenceFlush(room_id);
             }
         }
     }
 }
 
 drogon::Task<void> ChatRoomManager::unregisterConnection(const drogon::WebSocketConnectionPtr& conn, const WsData& locked_data) {
-    // FIXME this locks twice rn
+    // The room and user maps live in different shards, they are locked one after the other, never together.
 
     // First, handle the room departure logic if the user was in a room.
     if(locked_data.room) {
@@ -90,79 +204,603 @@ drogon::Task<void> ChatRoomManager::unregisterConnection(const drogon::WebSocket
 
     // Then, perform the final user cleanup.
     if(locked_data.user) {
-        auto lock = co_await m_manager_mutex->lock_unique();
-        if(auto it = m_user_id_to_conns.find(locked_data.user->id); it != m_user_id_to_conns.end()) {
-            it->second.erase(conn);
+        auto shard = co_await userShard(locked_data.user->id).lock_unique();
+        if(auto it = shard->user_id_to_conns.find(locked_data.user->id); it != shard->user_id_to_conns.end()) {
+            if(auto member = it->second.find(conn); member != it->second.end()) {
+                withReplica(member->second, [conn](LoopReplica& replica) {
+                    replica.authenticated_conns.erase(conn);
+                    replica.directory_conns.erase(conn);
+                });
+                it->second.erase(member);
+                m_connection_count.fetch_sub(1, std::memory_order_relaxed);
+            }
             if(it->second.empty()) {
-                m_user_id_to_conns.erase(it);
+                shard->user_id_to_conns.erase(it);
             }
         }
     }
 }
 
 drogon::Task<void> ChatRoomManager::onRoomDeleted(int32_t room_id) {
-    auto lock = co_await m_manager_mutex->lock_unique();
-    if(auto it = m_room_to_conns.find(room_id); it != m_room_to_conns.end()) {
-        m_room_to_conns.erase(it);
-    }
-
+    // Sent first, the members' replicas still list them. The removal below is queued behind it on every loop.
     chat::Envelope room_deleted_msg;
     room_deleted_msg.mutable_room_deleted()->set_room_id(room_id);
-    sendToAll_unsafe(room_deleted_msg);
+    co_await sendToDirectory(room_id, room_deleted_msg);
+
+    {
+        auto shard = co_await roomShard(room_id).lock_unique();
+        if(auto it = shard->room_to_conns.find(room_id); it != shard->room_to_conns.end()) {
+            for(size_t loop_index = 0; loop_index < it->second.per_loop_count.size(); ++loop_index) {
+                if(it->second.per_loop_count[loop_index] > 0) {
+                    withReplica(loop_index, [room_id](LoopReplica& replica) {
+                        replica.room_to_conns.erase(room_id);
+                    });
+                }
+            }
+            shard->room_to_conns.erase(it);
+            roomClosed_unsafe(room_id);
+        }
+    }
+    TypingAggregator::instance().dropRoom(room_id);
 }
 
 drogon::Task<void> ChatRoomManager::updateUserRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights, WsData& locked_data) {
-    auto lock = co_await m_manager_mutex->lock_shared();
+    co_await updateRoomRights(userId, roomId, newRights, &locked_data);
+}
 
-    auto it = m_user_id_to_conns.find(userId);
+drogon::Task<void> ChatRoomManager::applyRemoteRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights) {
+    co_await updateRoomRights(userId, roomId, newRights, nullptr);
+}
 
-    if (it != m_user_id_to_conns.end()) {
-        for (const auto& conn : it->second) {
-            auto peer_guarded = conn->getContext<WsDataGuarded>();
+drogon::Task<void> ChatRoomManager::updateRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights, WsData* locked_data) {
+    std::vector<drogon::WebSocketConnectionPtr> user_conns;
+    {
+        auto shard = co_await userShard(userId).lock_shared();
+        if(auto it = shard->user_id_to_conns.find(userId); it != shard->user_id_to_conns.end()) {
+            user_conns.reserve(it->second.size());
+            for(const auto& [conn, loop_index] : it->second) {
+                user_conns.push_back(conn);
+            }
+        }
+    }
 
-            if (peer_guarded->isHolding(locked_data)) {
-                if (locked_data.room && locked_data.room->id == roomId) {
-                    locked_data.room->rights = newRights;
-                }
-            } else {
-                auto peer_proxy = co_await peer_guarded->lock_unique();
-                if (peer_proxy->room && peer_proxy->room->id == roomId) {
-                    peer_proxy->room->rights = newRights;
-                }
+    for(const auto& conn : user_conns) {
+        auto peer_ctx = conn->getContext<ConnectionContext>();
+        if(!peer_ctx) {
+            continue;
+        }
+
+        if(locked_data && peer_ctx->data()->isHolding(*locked_data)) {
+            if(locked_data->room && locked_data->room->id == roomId) {
+                locked_data->room->rights = newRights;
+                locked_data->publishView();
             }
+            continue;
+        }
+        // Picked by their view without locking them, a connection elsewhere gets no job. A join
+        // publishes its room before reading the rights, one that missed the change is seen here.
+        if(const auto view = peer_ctx->view(); !view->room || view->room->id != roomId) {
+            continue;
         }
+        // Other connections change their own data, as a job of their request queue.
+        peer_ctx->post([peer_guarded = peer_ctx->data(), roomId, newRights]() -> drogon::Task<> {
+            auto peer_proxy = co_await peer_guarded->lock_unique();
+            if(peer_proxy->room && peer_proxy->room->id == roomId) {
+                peer_proxy->room->rights = newRights;
+                peer_proxy->publishView();
+            }
+        });
     }
 
     chat::Envelope env;
     env.mutable_user_role_changed()->set_user_id(userId);
     env.mutable_user_role_changed()->set_new_role(newRights);
-    sendToRoom_unsafe(roomId, env);
+
+    auto shard = co_await roomShard(roomId).lock_unique();
+    // A join still waiting for its delta must not announce the old rights after this change.
+    if(auto it = shard->room_to_conns.find(roomId); it != shard->room_to_conns.end()) {
+        if(auto entry = it->second.roster.find(userId); entry != it->second.roster.end()) {
+            entry->second.user.set_user_room_rights(newRights);
+        }
+        if(auto change = it->second.pending_presence.find(userId); change != it->second.pending_presence.end()) {
+            change->second.user.set_user_room_rights(newRights);
+        }
+    }
+    sendToRoom_unsafe(*shard, roomId, env);
 }
 
 drogon::Task<void> ChatRoomManager::sendToRoom(int32_t room_id, const chat::Envelope& message) const {
-    auto lock = co_await m_manager_mutex->lock_shared();
-    sendToRoom_unsafe(room_id, message);
+    auto shard = co_await roomShard(room_id).lock_shared();
+    sendToRoom_unsafe(*shard, room_id, message);
+}
+
+drogon::Task<void> ChatRoomManager::sendToRoom(int32_t room_id, const common::SerializedEnvelope& bytes, bool droppable) const {
+    auto shard = co_await roomShard(room_id).lock_shared();
+    sendToRoom_unsafe(*shard, room_id, bytes, droppable);
+}
+
+/**
+ * @brief A copy of a live event without the names of the users in `roster`, or nullopt when it names none of them.
+ * @details The roster holds the users whose join was broadcast, every connection of the room has their names
+ * from its JoinRoomResponse or from that delta. The left users of a delta were in it before the delta, which
+ * already took them out, and its joined users are the ones it names.
+ */
+static std::optional<chat::Envelope> withUserRefs(const chat::Envelope& env, const auto& roster) {
+    if(!env.has_room_message() && !env.has_room_typing_users() && !(env.has_room_presence_delta() && env.room_presence_delta().left_size() > 0)) {
+        return std::nullopt;
+    }
+    std::optional<chat::Envelope> compact;
+    const auto strip = [&](const chat::UserInfo& user, auto&& mutable_user, bool known) {
+        if(!user.user_name().empty() && (known || roster.contains(user.user_id()))) {
+            if(!compact) {
+                compact = env;
+            }
+            mutable_user(*compact)->clear_user_name();
+        }
+    };
+    if(env.has_room_message()) {
+        strip(env.room_message().message().from(), [](chat::Envelope& e) { return e.mutable_room_message()->mutable_message()->mutable_from(); }, false);
+    } else if(env.has_room_typing_users()) {
+        const auto& users = env.room_typing_users().users();
+        for(int i = 0; i < users.size(); ++i) {
+            strip(users[i], [i](chat::Envelope& e) { return e.mutable_room_typing_users()->mutable_users(i); }, false);
+        }
+    } else {
+        const auto& left = env.room_presence_delta().left();
+        for(int i = 0; i < left.size(); ++i) {
+            strip(left[i], [i](chat::Envelope& e) { return e.mutable_room_presence_delta()->mutable_left(i); }, true);
+        }
+    }
+    return compact;
+}
+
+void ChatRoomManager::sendToRoom_unsafe(const RoomShard& shard, int32_t room_id, const chat::Envelope& message) const {
+    if(auto it = shard.room_to_conns.find(room_id); it != shard.room_to_conns.end()) {
+        // Encode once, every member receives the same buffer, or one of two when some refer to users by id.
+        common::SerializedEnvelope compact;
+        if(serverConfig().compression.user_refs) {
+            if(auto refs = withUserRefs(message, it->second.roster)) {
+                compact = common::serializeEnvelope(*refs);
+            }
+        }
+        sendToRoom_unsafe(shard, room_id, common::serializeEnvelope(message), ConnectionContext::isDroppable(message), compact);
+    }
+}
+
+/// @brief `compact` for the connections that asked for user references and when there is one, `bytes` otherwise.
+static const common::SerializedEnvelope& frameFor(const drogon::WebSocketConnectionPtr& conn, const common::SerializedEnvelope& bytes,
+                                                  const common::SerializedEnvelope& compact) {
+    if(compact) {
+        // On the connection's loop, where its WsData is only changed by its own jobs.
+        if(const auto ctx = conn->getContext<ConnectionContext>(); ctx && ctx->data()->get_unsafe().user_refs) {
+            return compact;
+        }
+    }
+    return bytes;
+}
+
+void ChatRoomManager::sendToRoom_unsafe(const RoomShard& shard, int32_t room_id, const common::SerializedEnvelope& bytes, bool droppable,
+                                        const common::SerializedEnvelope& compact) const {
+    if(!bytes) {
+        return;
+    }
+    if(auto it = shard.room_to_conns.find(room_id); it != shard.room_to_conns.end()) {
+        // Past its budget, a tenant's broadcasts are paced through the chunked path and its droppable ones dropped.
+        Tenant* paced = nullptr;
+        auto* tenant = TenantQuotas::instance().tenantOf(room_id);
+        if(tenant && tenant->limitsBroadcasts()) {
+            if(tenant->overBroadcastBudget()) {
+                if(droppable) {
+                    tenant->countDropped();
+                    return;
+                }
+                paced = tenant;
+            }
+        } else {
+            tenant = nullptr;
+        }
+        broadcastFanout(false).observe(static_cast<double>(it->second.conns.size()));
+        common::Span span("broadcast");
+        span.setAttribute("broadcast.fanout", static_cast<int64_t>(it->second.conns.size()));
+        // One task per loop with members, each loop writes to its own sockets.
+        const auto& per_loop_count = it->second.per_loop_count;
+        const bool hot = it->second.conns.size() >= serverConfig().hot_rooms.member_threshold;
+        if(tenant && !hot && !paced) {
+            tenant->chargeBroadcast(bytes->size() * it->second.conns.size());
+        }
+        for(size_t loop_index = 0; loop_index < per_loop_count.size(); ++loop_index) {
+            if(per_loop_count[loop_index] == 0) {
+                continue;
+            }
+            if(hot || paced) {
+                queueHotBroadcast(loop_index, room_id, bytes, droppable, compact, tenant);
+                continue;
+            }
+            withReplica(loop_index, [this, loop_index, room_id, bytes, droppable, compact](LoopReplica& replica) {
+                if(replica.hot_broadcasts.contains(room_id)) {
+                    // Behind the ones of the room still being written, so its members receive them in order.
+                    pushHotBroadcast(loop_index, room_id, bytes, droppable, compact, nullptr);
+                    return;
+                }
+                if(auto room = replica.room_to_conns.find(room_id); room != replica.room_to_conns.end()) {
+                    for(const auto& conn : room->second) {
+                        sendToConnection(conn, frameFor(conn, bytes, compact), droppable);
+                    }
+                }
+            });
+        }
+    }
+}
+
+/// @brief The broadcasts written in chunks because of the size of their room.
+static common::Counter& hotBroadcasts() {
+    static auto& counter = common::MetricsRegistry::instance().counter(
+        "chat_hot_broadcasts_total", "Room broadcasts written in chunks because of the size of the room.");
+    return counter;
+}
+
+void ChatRoomManager::queueHotBroadcast(size_t loop_index, int32_t room_id, const common::SerializedEnvelope& bytes, bool droppable,
+                                        const common::SerializedEnvelope& compact, Tenant* tenant) const {
+    // Queued even on the caller's own loop, so the shard lock is not held while writing.
+    drogon::app().getIOLoop(loop_index)->queueInLoop([this, loop_index, room_id, bytes, droppable, compact, tenant] {
+        pushHotBroadcast(loop_index, room_id, bytes, droppable, compact, tenant);
+    });
 }
 
-void ChatRoomManager::sendToRoom_unsafe(int32_t room_id, const chat::Envelope& message) const {
-    if(auto it = m_room_to_conns.find(room_id); it != m_room_to_conns.end()) {
-        const auto& connections_in_room = it->second;
-        for(const auto& conn : connections_in_room) {
-            common::sendEnvelope(conn, message);
+void ChatRoomManager::pushHotBroadcast(size_t loop_index, int32_t room_id, const common::SerializedEnvelope& bytes, bool droppable,
+                                       const common::SerializedEnvelope& compact, Tenant* tenant) const {
+    auto& replica = m_loop_replicas[loop_index];
+    auto room = replica.room_to_conns.find(room_id);
+    if(room == replica.room_to_conns.end()) {
+        return;
+    }
+    hotBroadcasts().inc();
+    auto& queue = replica.hot_broadcasts[room_id];
+    queue.push_back({{room->second.begin(), room->second.end()}, 0, bytes, droppable, compact, tenant});
+    if(queue.size() == 1) {
+        writeHotChunk(loop_index, room_id);
+    }
+}
+
+void ChatRoomManager::writeHotChunk(size_t loop_index, int32_t room_id) const {
+    auto& replica = m_loop_replicas[loop_index];
+    auto it = replica.hot_broadcasts.find(room_id);
+    if(it == replica.hot_broadcasts.end()) {
+        return;
+    }
+    auto& queue = it->second;
+    auto& current = queue.front();
+    const size_t end = std::min(current.targets.size(), current.next + serverConfig().hot_rooms.chunk_size);
+    size_t written = 0;
+    for(; current.next < end; ++current.next) {
+        const auto& target = current.targets[current.next];
+        const auto& frame = frameFor(target, current.bytes, current.compact);
+        written += frame->size();
+        sendToConnection(target, frame, current.droppable);
+    }
+    // The chunks of a tenant over its budget wait for it to refill.
+    const auto wait = current.tenant ? current.tenant->chargeBroadcast(written) : std::chrono::steady_clock::duration::zero();
+    if(current.next == current.targets.size()) {
+        queue.pop_front();
+        if(queue.empty()) {
+            replica.hot_broadcasts.erase(it);
+            return;
+        }
+    }
+    if(wait > std::chrono::steady_clock::duration::zero()) {
+        drogon::app().getIOLoop(loop_index)->runAfter(std::chrono::duration<double>(wait).count(),
+            [this, loop_index, room_id] { writeHotChunk(loop_index, room_id); });
+        return;
+    }
+    // Behind the tasks already queued on the loop, the broadcasts of the other rooms among them.
+    drogon::app().getIOLoop(loop_index)->queueInLoop([this, loop_index, room_id] { writeHotChunk(loop_index, room_id); });
+}
+
+void ChatRoomManager::roomOpened_unsafe(int32_t room_id) {
+    m_room_count.fetch_add(1, std::memory_order_relaxed);
+    WsClient::instance().subscribe(room_id);
+}
+
+void ChatRoomManager::roomClosed_unsafe(int32_t room_id) {
+    m_room_count.fetch_sub(1, std::memory_order_relaxed);
+    auto& bus = WsClient::instance();
+    if(bus.clustered()) {
+        // Without local members the room's events from other servers stop arriving, so its history tail would go stale.
+        MessageHistoryCache::instance().dropRoom(room_id);
+    }
+    bus.unsubscribe(room_id);
+    bus.reportRoomLoad(room_id, 0);
+}
+
+uint32_t ChatRoomManager::connectionCount() const noexcept {
+    return m_connection_count.load(std::memory_order_relaxed);
+}
+
+uint32_t ChatRoomManager::roomCount() const noexcept {
+    return m_room_count.load(std::memory_order_relaxed);
+}
+
+void ChatRoomManager::inspectLoops(size_t busiest, std::function<void(std::vector<LoopInspection>)> done) const {
+    struct Pending {
+        std::mutex mutex;
+        std::vector<LoopInspection> loops;
+        size_t remaining = 0;
+        std::function<void(std::vector<LoopInspection>)> done;
+    };
+    auto pending = std::make_shared<Pending>();
+    pending->loops.resize(m_loop_replicas.size());
+    pending->remaining = m_loop_replicas.size();
+    pending->done = std::move(done);
+
+    for(size_t loop_index = 0; loop_index < m_loop_replicas.size(); ++loop_index) {
+        withReplica(loop_index, [pending, loop_index, busiest](LoopReplica& replica) {
+            LoopInspection loop;
+            loop.loop_index = loop_index;
+            loop.connections = replica.authenticated_conns.size();
+            loop.rooms.reserve(replica.room_to_conns.size());
+            for(const auto& [room_id, members] : replica.room_to_conns) {
+                loop.rooms.emplace_back(room_id, members.size());
+            }
+            for(const auto& [room_id, broadcasts] : replica.hot_broadcasts) {
+                loop.hot_broadcasts += broadcasts.size();
+            }
+
+            for(const auto& conn : replica.authenticated_conns) {
+                const auto ctx = conn->getContext<ConnectionContext>();
+                if(!ctx) {
+                    continue;
+                }
+                const auto view = ctx->view();
+                loop.busiest.push_back(ConnectionInspection{
+                    .user_id = view->user ? view->user->id : 0,
+                    .peer = conn->peerAddr().toIpPort(),
+                    .stats = ctx->stats(),
+                    .lock = ctx->data()->lockState(),
+                });
+            }
+            const auto busier = [](const ConnectionInspection& a, const ConnectionInspection& b) {
+                if(a.stats.out_backlog_bytes != b.stats.out_backlog_bytes) {
+                    return a.stats.out_backlog_bytes > b.stats.out_backlog_bytes;
+                }
+                return a.stats.queued_requests + a.stats.in_flight > b.stats.queued_requests + b.stats.in_flight;
+            };
+            const auto keep = std::min(busiest, loop.busiest.size());
+            std::partial_sort(loop.busiest.begin(), loop.busiest.begin() + static_cast<std::ptrdiff_t>(keep), loop.busiest.end(), busier);
+            loop.busiest.resize(keep);
+
+            std::unique_lock lock{pending->mutex};
+            pending->loops[loop_index] = std::move(loop);
+            if(--pending->remaining == 0) {
+                lock.unlock();
+                pending->done(std::move(pending->loops));
+            }
+        });
+    }
+}
+
+std::vector<common::LockState> ChatRoomManager::userShardLocks() const {
+    std::vector<common::LockState> locks;
+    locks.reserve(m_user_shards.size());
+    for(const auto& shard : m_user_shards) {
+        locks.push_back(shard->lockState());
+    }
+    return locks;
+}
+
+std::vector<common::LockState> ChatRoomManager::roomShardLocks() const {
+    std::vector<common::LockState> locks;
+    locks.reserve(m_room_shards.size());
+    for(const auto& shard : m_room_shards) {
+        locks.push_back(shard->lockState());
+    }
+    return locks;
+}
+
+drogon::Task<void> ChatRoomManager::renameUser(int32_t user_id, const std::string& new_name,
+                                              const std::vector<int32_t>& room_ids, const common::SerializedEnvelope& notice) {
+    auto rooms = std::make_shared<std::unordered_set<int32_t>>(room_ids.begin(), room_ids.end());
+    // Rooms are not indexed by user, a rename is rare enough to visit every shard, one at a time.
+    for(const auto& room_shard : m_room_shards) {
+        auto shard = co_await room_shard->lock_unique();
+        for(auto& [room_id, members] : shard->room_to_conns) {
+            bool present = false;
+            if(auto entry = members.roster.find(user_id); entry != members.roster.end()) {
+                entry->second.user.set_user_name(new_name);
+                present = true;
+            }
+            if(auto change = members.pending_presence.find(user_id); change != members.pending_presence.end()) {
+                change->second.user.set_user_name(new_name);
+                present = true;
+            }
+            if(present) {
+                rooms->insert(room_id);
+            }
+        }
+    }
+    if(!notice) {
+        co_return;
+    }
+
+    auto own_conns = std::make_shared<ConnectionLoops>();
+    {
+        auto shard = co_await userShard(user_id).lock_shared();
+        if(auto it = shard->user_id_to_conns.find(user_id); it != shard->user_id_to_conns.end()) {
+            *own_conns = it->second;
+        }
+    }
+    for(size_t loop_index = 0; loop_index < m_loop_replicas.size(); ++loop_index) {
+        withReplica(loop_index, [loop_index, rooms, own_conns, notice](LoopReplica& replica) {
+            const auto in_rooms = [&](const drogon::WebSocketConnectionPtr& conn) {
+                return std::any_of(rooms->begin(), rooms->end(), [&](int32_t room_id) {
+                    auto room = replica.room_to_conns.find(room_id);
+                    return room != replica.room_to_conns.end() && room->second.contains(conn);
+                });
+            };
+            for(int32_t room_id : *rooms) {
+                if(auto room = replica.room_to_conns.find(room_id); room != replica.room_to_conns.end()) {
+                    for(const auto& conn : room->second) {
+                        sendToConnection(conn, notice, false);
+                    }
+                }
+            }
+            // The user's connections outside of those rooms, in the lobby or elsewhere.
+            for(const auto& [conn, conn_loop] : *own_conns) {
+                if(conn_loop == loop_index && !in_rooms(conn)) {
+                    sendToConnection(conn, notice, false);
+                }
+            }
+        });
+    }
+}
+
+void ChatRoomManager::recordPresence_unsafe(RoomMembers& members, const chat::UserInfo& user, int32_t connections, bool new_member) {
+    auto& change = members.pending_presence[user.user_id()];
+    change.user = user;
+    change.connections += connections;
+    change.new_member = change.new_member || new_member;
+    // A join and a leave within the same window leave nothing to tell.
+    if(change.connections == 0 && !change.new_member) {
+        members.pending_presence.erase(user.user_id());
+    }
+}
+
+void ChatRoomManager::schedulePresenceFlush(int32_t room_id) {
+    std::lock_guard lock(m_presence_mutex);
+    m_presence_dirty.insert(room_id);
+    if(m_presence_flush_armed) {
+        return;
+    }
+    m_presence_flush_armed = true;
+    const double window = std::chrono::duration<double>(serverConfig().presence.window).count();
+    drogon::app().getIOLoop(0)->runAfter(std::max(window, 0.0), [this] { flushPresence(); });
+}
+
+void ChatRoomManager::flushPresence() {
+    std::unordered_set<int32_t> rooms;
+    {
+        std::lock_guard lock(m_presence_mutex);
+        rooms.swap(m_presence_dirty);
+        m_presence_flush_armed = false;
+    }
+    drogon::async_run([this, rooms = std::move(rooms)]() -> drogon::Task<> {
+        for(int32_t room_id : rooms) {
+            co_await broadcastPresence(room_id);
         }
+    });
+}
+
+drogon::Task<void> ChatRoomManager::broadcastPresence(int32_t room_id) {
+    auto shard = co_await roomShard(room_id).lock_unique();
+    auto it = shard->room_to_conns.find(room_id);
+    if(it == shard->room_to_conns.end() || it->second.pending_presence.empty()) {
+        co_return;
     }
+    auto& members = it->second;
+
+    chat::Envelope env;
+    auto* delta = env.mutable_room_presence_delta();
+    delta->set_room_id(room_id);
+    delta->set_seq(++members.presence_seq);
+    for(const auto& [user_id, change] : members.pending_presence) {
+        if(change.new_member) {
+            *delta->add_new_members() = change.user;
+        }
+        for(int32_t n = change.connections; n > 0; --n) {
+            *delta->add_joined() = change.user;
+        }
+        for(int32_t n = change.connections; n < 0; ++n) {
+            *delta->add_left() = change.user;
+        }
+
+        // The roster moves forward together with the sequence number.
+        auto& entry = members.roster[user_id];
+        const int64_t connections = static_cast<int64_t>(entry.connections) + change.connections;
+        if(connections <= 0) {
+            members.roster.erase(user_id);
+        } else {
+            if(change.connections > 0) {
+                entry.user = change.user;
+            }
+            entry.connections = static_cast<uint32_t>(connections);
+        }
+    }
+    members.pending_presence.clear();
+
+    members.presence_log.push_back(*delta);
+    while(members.presence_log.size() > serverConfig().presence.history) {
+        members.presence_log.pop_front();
+    }
+
+    // Sent under the exclusive lock, so no roster can be taken between the sequence bump and the send.
+    sendToRoom_unsafe(*shard, room_id, env);
 }
 
 drogon::Task<void> ChatRoomManager::sendToAll(const chat::Envelope& message) const {
-    auto lock = co_await m_manager_mutex->lock_shared();
-    sendToAll_unsafe(message);
+    sendToAll(common::serializeEnvelope(message), ConnectionContext::isDroppable(message));
+    co_return;
+}
+
+void ChatRoomManager::sendToAll(const common::SerializedEnvelope& bytes, bool droppable) const {
+    if(!bytes) {
+        return;
+    }
+    broadcastFanout(true).observe(static_cast<double>(connectionCount()));
+    common::Span span("broadcast");
+    span.setAttribute("broadcast.fanout", static_cast<int64_t>(connectionCount()));
+    // Every loop fans out to its own authenticated connections, no shard lock is needed.
+    for(size_t loop_index = 0; loop_index < m_loop_replicas.size(); ++loop_index) {
+        withReplica(loop_index, [bytes, droppable](LoopReplica& replica) {
+            for(const auto& conn : replica.authenticated_conns) {
+                sendToConnection(conn, bytes, droppable);
+            }
+        });
+    }
 }
 
-void ChatRoomManager::sendToAll_unsafe(const chat::Envelope& message) const {
-    for(const auto& [user_id, conns] : m_user_id_to_conns) {
-        for(const auto& conn : conns) {
-            common::sendEnvelope(conn, message);
+void ChatRoomManager::forEachConnection(std::function<void(const drogon::WebSocketConnectionPtr&)> fn) const {
+    for(size_t loop_index = 0; loop_index < m_loop_replicas.size(); ++loop_index) {
+        withReplica(loop_index, [fn](LoopReplica& replica) {
+            for(const auto& conn : replica.authenticated_conns) {
+                fn(conn);
+            }
+        });
+    }
+}
+
+void ChatRoomManager::subscribeDirectory(const drogon::WebSocketConnectionPtr& conn, bool subscribe) {
+    withReplica(currentLoopIndex(), [conn, subscribe](LoopReplica& replica) {
+        if(subscribe && replica.authenticated_conns.contains(conn)) {
+            replica.directory_conns.insert(conn);
+        } else {
+            replica.directory_conns.erase(conn);
         }
+    });
+}
+
+drogon::Task<void> ChatRoomManager::sendToDirectory(int32_t room_id, const chat::Envelope& message) const {
+    sendToDirectory(room_id, common::serializeEnvelope(message), ConnectionContext::isDroppable(message));
+    co_return;
+}
+
+void ChatRoomManager::sendToDirectory(int32_t room_id, const common::SerializedEnvelope& bytes, bool droppable) const {
+    if(!bytes) {
+        return;
+    }
+    common::Span span("broadcast");
+    for(size_t loop_index = 0; loop_index < m_loop_replicas.size(); ++loop_index) {
+        withReplica(loop_index, [room_id, bytes, droppable](LoopReplica& replica) {
+            for(const auto& conn : replica.directory_conns) {
+                sendToConnection(conn, bytes, droppable);
+            }
+            // The members who did not subscribe still learn about their own room.
+            if(auto room = replica.room_to_conns.find(room_id); room != replica.room_to_conns.end()) {
+                for(const auto& conn : room->second) {
+                    if(!replica.directory_conns.contains(conn)) {
+                        sendToConnection(conn, bytes, droppable);
+                    }
+                }
+            }
+        });
     }
 }
 
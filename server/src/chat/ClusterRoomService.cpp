@@ -0,0 +1,152 @@
+#include <server/chat/ClusterRoomService.h>
+#include <server/chat/ChatRoomManager.h>
+#include <server/chat/ConnectionContext.h>
+#include <server/chat/MessageHistoryCache.h>
+#include <server/chat/RoomDataCache.h>
+#include <server/chat/UserDirectory.h>
+#include <server/aggregator/WsClient.h>
+
+namespace server {
+
+drogon::Task<void> ClusterRoomService::sendToRoom(int32_t room_id, const chat::Envelope& message) const {
+    co_await DrogonRoomService::sendToRoom(room_id, message);
+    WsClient::instance().publish(room_id, common::serializeEnvelope(message));
+}
+
+drogon::Task<void> ClusterRoomService::sendToAll(const chat::Envelope& message) const {
+    co_await DrogonRoomService::sendToAll(message);
+    WsClient::instance().publish(std::nullopt, common::serializeEnvelope(message));
+}
+
+drogon::Task<void> ClusterRoomService::sendToDirectory(int32_t room_id, const chat::Envelope& message) const {
+    co_await DrogonRoomService::sendToDirectory(room_id, message);
+    WsClient::instance().publish(std::nullopt, common::serializeEnvelope(message));
+
+    chat::RoomDirectoryUpdate update;
+    if(message.has_new_room_created()) {
+        auto* entry = update.add_upserted();
+        entry->set_room_id(message.new_room_created().room().room_id());
+        entry->set_room_name(message.new_room_created().room().room_name());
+        // The owner is its first member.
+        entry->set_member_count(1);
+    } else if(message.has_new_room_name()) {
+        auto* entry = update.add_upserted();
+        entry->set_room_id(message.new_room_name().room_id());
+        entry->set_room_name(message.new_room_name().name());
+    } else {
+        co_return;
+    }
+    WsClient::instance().updateRoomDirectory(update);
+}
+
+drogon::Task<void> ClusterRoomService::joinRoom(const WsData& locked_data, bool new_member) {
+    co_await DrogonRoomService::joinRoom(locked_data, new_member);
+    if(new_member && locked_data.room) {
+        chat::RoomDirectoryUpdate update;
+        update.add_joined(locked_data.room->id);
+        WsClient::instance().updateRoomDirectory(update);
+    }
+}
+
+drogon::Task<void> ClusterRoomService::renameUser(int32_t user_id, const std::string& new_name, const std::vector<int32_t>& room_ids) {
+    co_await DrogonRoomService::renameUser(user_id, new_name, room_ids);
+    WsClient::instance().publish(std::nullopt, common::serializeEnvelope(usernameChanged(user_id, new_name)), room_ids);
+}
+
+drogon::Task<void> ClusterRoomService::onRoomDeleted(int32_t room_id) {
+    co_await DrogonRoomService::onRoomDeleted(room_id);
+    chat::Envelope env;
+    env.mutable_room_deleted()->set_room_id(room_id);
+    WsClient::instance().publish(std::nullopt, common::serializeEnvelope(env));
+
+    chat::RoomDirectoryUpdate update;
+    update.add_removed(room_id);
+    WsClient::instance().updateRoomDirectory(update);
+}
+
+drogon::Task<void> ClusterRoomService::updateUserRoomRights(int32_t userId, int32_t roomId, chat::UserRights newRights, WsData& locked_data) {
+    co_await DrogonRoomService::updateUserRoomRights(userId, roomId, newRights, locked_data);
+    chat::Envelope env;
+    env.mutable_user_role_changed()->set_user_id(userId);
+    env.mutable_user_role_changed()->set_new_role(newRights);
+    WsClient::instance().publish(roomId, common::serializeEnvelope(env));
+}
+
+void ClusterRoomService::deliverRemote(const chat::ClusterPublish& publish) {
+    chat::Envelope env;
+    if(!env.ParseFromString(publish.envelope())) {
+        LOG_ERROR << "Malformed envelope relayed by the aggregator";
+        return;
+    }
+    // The frame is forwarded as received, no need to encode it again.
+    auto bytes = std::make_shared<const std::string>(publish.envelope());
+    if(publish.has_room_id()) {
+        drogon::async_run([room_id = publish.room_id(), env = std::move(env), bytes = std::move(bytes)]() mutable -> drogon::Task<void> {
+            co_await deliverToRoom(room_id, std::move(env), std::move(bytes));
+        });
+    } else {
+        std::vector<int32_t> audience(publish.audience_room_ids().begin(), publish.audience_room_ids().end());
+        drogon::async_run([env = std::move(env), bytes = std::move(bytes), audience = std::move(audience)]() mutable -> drogon::Task<void> {
+            co_await deliverToAll(std::move(env), std::move(bytes), std::move(audience));
+        });
+    }
+}
+
+drogon::Task<void> ClusterRoomService::deliverToRoom(int32_t room_id, chat::Envelope env, common::SerializedEnvelope bytes) {
+    auto& manager = ChatRoomManager::instance();
+    switch(env.payload_case()) {
+        case chat::Envelope::kRoomMessage:
+            MessageHistoryCache::instance().append(room_id, env.room_message().message());
+            break;
+        case chat::Envelope::kMessageDeleted:
+            MessageHistoryCache::instance().remove(room_id, env.message_deleted().message_id());
+            for(int32_t message_id : env.message_deleted().message_ids()) {
+                MessageHistoryCache::instance().remove(room_id, message_id);
+            }
+            break;
+        case chat::Envelope::kUserRoleChanged: {
+            // The rights held by the local members' sessions must follow, which also notifies the room.
+            const auto& changed = env.user_role_changed();
+            RoomDataCache::instance().invalidateRoom(room_id);
+            co_await manager.applyRemoteRoomRights(changed.user_id(), room_id, changed.new_role());
+            co_return;
+        }
+        default:
+            break;
+    }
+    co_await manager.sendToRoom(room_id, bytes, ConnectionContext::isDroppable(env));
+}
+
+drogon::Task<void> ClusterRoomService::deliverToAll(chat::Envelope env, common::SerializedEnvelope bytes, std::vector<int32_t> audience_room_ids) {
+    auto& manager = ChatRoomManager::instance();
+    switch(env.payload_case()) {
+        case chat::Envelope::kRoomDeleted: {
+            // Evicts the local members and notifies the directory, like the originating server did.
+            const auto room_id = env.room_deleted().room_id();
+            RoomDataCache::instance().invalidateRoom(room_id);
+            MessageHistoryCache::instance().dropRoom(room_id);
+            co_await manager.onRoomDeleted(room_id);
+            co_return;
+        }
+        case chat::Envelope::kNewRoomCreated:
+            manager.sendToDirectory(env.new_room_created().room().room_id(), bytes, ConnectionContext::isDroppable(env));
+            co_return;
+        case chat::Envelope::kNewRoomName:
+            RoomDataCache::instance().invalidateRoom(env.new_room_name().room_id());
+            manager.sendToDirectory(env.new_room_name().room_id(), bytes, ConnectionContext::isDroppable(env));
+            co_return;
+        case chat::Envelope::kUsernameChanged: {
+            // The rooms the user is present in here are found locally, the memberships come with the event.
+            const auto& changed = env.username_changed();
+            UserDirectory::instance().rename(changed.user_id(), changed.new_username());
+            MessageHistoryCache::instance().renameUser(changed.user_id(), changed.new_username());
+            co_await manager.renameUser(changed.user_id(), changed.new_username(), audience_room_ids, bytes);
+            co_return;
+        }
+        default:
+            break;
+    }
+    manager.sendToAll(bytes, ConnectionContext::isDroppable(env));
+}
+
+} // namespace server
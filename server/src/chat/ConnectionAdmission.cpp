@@ -0,0 +1,116 @@
+#include <server/chat/ConnectionAdmission.h>
+#include <server/utils/server_config.h>
+#include <common/utils/metrics.h>
+#include <random>
+
+namespace server {
+
+ConnectionAdmission& ConnectionAdmission::instance() {
+    static ConnectionAdmission inst;
+    return inst;
+}
+
+ConnectionAdmission::ConnectionAdmission()
+    : m_tokens{static_cast<double>(serverConfig().admission.accept_burst)} {
+    auto& metrics = common::MetricsRegistry::instance();
+    metrics.gauge("chat_connections_open", "WebSocket connections admitted and still open.",
+        [this] { return static_cast<double>(m_connections.load(std::memory_order_relaxed)); });
+    metrics.gauge("chat_connections_unauthenticated", "WebSocket connections open but not logged in yet.",
+        [this] { return static_cast<double>(m_unauthenticated.load(std::memory_order_relaxed)); });
+}
+
+/// @brief The counter of the connections refused for a reason.
+static common::Counter& refused(const char* reason) {
+    return common::MetricsRegistry::instance().counter(
+        "chat_connections_refused_total", "WebSocket connections refused by the admission control, per limit hit.",
+        std::string("reason=\"") + reason + "\"");
+}
+
+std::variant<ConnectionAdmission::Ticket, ConnectionAdmission::RetryAfter> ConnectionAdmission::admit() {
+    static auto& over_rate = refused("accept_rate");
+    static auto& over_unauthenticated = refused("unauthenticated");
+    static auto& over_connections = refused("connections");
+    const auto& cfg = serverConfig().admission;
+
+    // Counted first and given back when refused, so concurrent admissions cannot all slip under a limit.
+    const auto connections = m_connections.fetch_add(1, std::memory_order_acq_rel) + 1;
+    if(cfg.max_connections > 0 && connections > cfg.max_connections) {
+        m_connections.fetch_sub(1, std::memory_order_acq_rel);
+        over_connections.inc();
+        return retryAfter();
+    }
+    const auto unauthenticated = m_unauthenticated.fetch_add(1, std::memory_order_acq_rel) + 1;
+    if(cfg.max_unauthenticated > 0 && unauthenticated > cfg.max_unauthenticated) {
+        m_unauthenticated.fetch_sub(1, std::memory_order_acq_rel);
+        m_connections.fetch_sub(1, std::memory_order_acq_rel);
+        over_unauthenticated.inc();
+        return retryAfter();
+    }
+    if(!takeAcceptToken()) {
+        m_unauthenticated.fetch_sub(1, std::memory_order_acq_rel);
+        m_connections.fetch_sub(1, std::memory_order_acq_rel);
+        over_rate.inc();
+        return retryAfter();
+    }
+    return Ticket{true};
+}
+
+bool ConnectionAdmission::takeAcceptToken() {
+    const auto& cfg = serverConfig().admission;
+    if(cfg.accepts_per_sec <= 0) {
+        return true;
+    }
+    std::lock_guard lock(m_mutex);
+    const auto now = std::chrono::steady_clock::now();
+    const std::chrono::duration<double> elapsed = now - m_refilled;
+    m_refilled = now;
+    m_tokens = std::min(static_cast<double>(cfg.accept_burst), m_tokens + elapsed.count() * cfg.accepts_per_sec);
+    if(m_tokens < 1) {
+        return false;
+    }
+    m_tokens -= 1;
+    return true;
+}
+
+ConnectionAdmission::RetryAfter ConnectionAdmission::retryAfter() const {
+    const auto& cfg = serverConfig().admission;
+    if(cfg.retry_spread.count() <= 0) {
+        return cfg.retry_after;
+    }
+    thread_local std::minstd_rand rng{std::random_device{}()};
+    return cfg.retry_after + RetryAfter{std::uniform_int_distribution<int64_t>(0, cfg.retry_spread.count())(rng)};
+}
+
+ConnectionAdmission::Ticket::Ticket(Ticket&& other) noexcept
+    : m_held{std::exchange(other.m_held, false)},
+      m_unauthenticated{other.m_unauthenticated.exchange(false, std::memory_order_acq_rel)} {}
+
+ConnectionAdmission::Ticket& ConnectionAdmission::Ticket::operator=(Ticket&& other) noexcept {
+    if(this != &other) {
+        release();
+        m_held = std::exchange(other.m_held, false);
+        m_unauthenticated.store(other.m_unauthenticated.exchange(false, std::memory_order_acq_rel), std::memory_order_release);
+    }
+    return *this;
+}
+
+ConnectionAdmission::Ticket::~Ticket() {
+    release();
+}
+
+void ConnectionAdmission::Ticket::authenticated() noexcept {
+    if(m_unauthenticated.exchange(false, std::memory_order_acq_rel)) {
+        ConnectionAdmission::instance().m_unauthenticated.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+
+void ConnectionAdmission::Ticket::release() noexcept {
+    if(!m_held) {
+        return;
+    }
+    authenticated();
+    m_held = false;
+    ConnectionAdmission::instance().m_connections.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+} // namespace server
@@ -0,0 +1,256 @@
+#include <server/chat/ConnectionContext.h>
+#include <server/chat/TrafficCapture.h>
+#include <server/utils/server_config.h>
+#include <common/utils/utils.h>
+
+namespace server {
+
+ConnectionContext::ConnectionContext(ConnectionAdmission::Ticket admission)
+    : m_data{WsDataGuarded::create([&] {
+          WsData data;
+          data.admission = std::move(admission);
+          return data;
+      }())},
+      m_view{m_data->get_unsafe().view},
+      m_loop_index{drogon::app().getCurrentThreadIndex()},
+      m_capture_id{TrafficCapture::instance().openConnection()} {
+    if(m_loop_index >= drogon::app().getThreadNum()) {
+        LOG_WARN << "ConnectionContext created outside of an IO loop, falling back to loop 0";
+        m_loop_index = 0;
+    }
+}
+
+void ConnectionContext::post(Job job) {
+    drogon::app().getIOLoop(m_loop_index)->runInLoop([self = shared_from_this(), job = std::move(job)]() mutable {
+        if(!self->m_closed) {
+            self->push(Entry{.run = std::move(job), .concurrent = false});
+        }
+    });
+}
+
+void ConnectionContext::postRequest(Request request) {
+    if(m_closed) {
+        return;
+    }
+    const auto seq = m_next_seq++;
+
+    if(m_queued_requests >= std::max<size_t>(serverConfig().pipeline.max_queued, 1)) {
+        LOG_WARN << "Request pipeline full, rejecting request";
+        complete(seq, std::move(request.reply), std::make_shared<const chat::Envelope>(common::makeGenericErrorEnvelope("Too many pending requests.")));
+        return;
+    }
+
+    ++m_queued_requests;
+    const bool concurrent = request.concurrent;
+    // The request is moved into the coroutine frame of runRequest, not kept by the lambda.
+    push(Entry{
+        .run = [this, request = std::move(request), seq]() mutable {
+            return runRequest(std::move(request), seq);
+        },
+        .concurrent = concurrent,
+    });
+}
+
+void ConnectionContext::close(Job last) {
+    m_closed = true;
+    m_jobs.clear();
+    m_done.clear();
+    m_responses.clear();
+    m_queued_response_bytes = 0;
+    push(Entry{.run = std::move(last), .concurrent = false});
+}
+
+void ConnectionContext::push(Entry entry) {
+    m_jobs.push_back(std::move(entry));
+    pump();
+}
+
+void ConnectionContext::pump() {
+    // A job finishing synchronously calls back into pump(), the outer loop picks up from there.
+    if(m_pumping) {
+        return;
+    }
+    m_pumping = true;
+    const auto depth = std::max<size_t>(serverConfig().pipeline.depth, 1);
+    while(!m_jobs.empty() && !m_exclusive_running) {
+        const bool concurrent = m_jobs.front().concurrent;
+        if(concurrent ? m_in_flight >= depth : m_in_flight > 0) {
+            break;
+        }
+        auto entry = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        ++m_in_flight;
+        m_exclusive_running = !concurrent;
+        drogon::async_run([self = shared_from_this(), entry = std::move(entry)]() mutable {
+            return self->run(std::move(entry));
+        });
+    }
+    m_pumping = false;
+}
+
+drogon::Task<> ConnectionContext::run(Entry entry) {
+    // Keeps the context alive should the connection drop it while a job runs.
+    auto self = shared_from_this();
+    try {
+        co_await entry.run();
+    } catch(const std::exception& e) {
+        LOG_ERROR << "Connection job failed: " << e.what();
+    }
+    --m_in_flight;
+    if(!entry.concurrent) {
+        m_exclusive_running = false;
+    }
+    pump();
+}
+
+drogon::Task<> ConnectionContext::runRequest(Request request, uint64_t seq) {
+    --m_queued_requests;
+    Response response;
+    try {
+        response = co_await request.run();
+    } catch(const std::exception& e) {
+        LOG_ERROR << "Request failed: " << e.what();
+        response = std::make_shared<const chat::Envelope>(common::makeGenericErrorEnvelope("Critical server error during message handling."));
+    }
+    complete(seq, std::move(request.reply), std::move(response));
+}
+
+ConnectionContext::Stats ConnectionContext::stats() const {
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(now - m_out_updated).count();
+    const double drained = elapsed * static_cast<double>(serverConfig().outbound.min_drain_bytes_per_sec);
+    return Stats{
+        .queued_jobs = m_jobs.size(),
+        .queued_requests = m_queued_requests,
+        .in_flight = m_in_flight,
+        .undelivered = m_done.size(),
+        .out_backlog_bytes = static_cast<size_t>(std::max(0.0, m_out_backlog - drained)),
+        .queued_responses = m_responses.size(),
+        .queued_response_bytes = m_queued_response_bytes,
+        .over_high_for = m_over_high_since ? now - *m_over_high_since : std::chrono::steady_clock::duration{},
+    };
+}
+
+bool ConnectionContext::isDroppable(const chat::Envelope& env) noexcept {
+    switch(env.payload_case()) {
+        case chat::Envelope::kUserStartedTyping:
+        case chat::Envelope::kUserStoppedTyping:
+        case chat::Envelope::kRoomTypingUsers:
+        case chat::Envelope::kUserJoined:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool ConnectionContext::admitOutbound(const drogon::WebSocketConnectionPtr& conn, size_t bytes, bool droppable) {
+    const auto& cfg = serverConfig().outbound;
+    const auto now = std::chrono::steady_clock::now();
+
+    const double elapsed = std::chrono::duration<double>(now - m_out_updated).count();
+    m_out_backlog = std::max(0.0, m_out_backlog - elapsed * static_cast<double>(cfg.min_drain_bytes_per_sec));
+    m_out_updated = now;
+
+    if(m_over_high_since && m_out_backlog <= static_cast<double>(cfg.low_watermark_bytes)) {
+        m_over_high_since.reset();
+    }
+    if(!m_over_high_since && m_out_backlog >= static_cast<double>(cfg.high_watermark_bytes)) {
+        m_over_high_since = now;
+    }
+
+    if(m_over_high_since) {
+        if(now - *m_over_high_since >= cfg.evict_after) {
+            LOG_WARN << "Closing slow consumer " << conn->peerAddr().toIpPort()
+                     << ", estimated backlog " << static_cast<size_t>(m_out_backlog) << " bytes";
+            m_over_high_since.reset();
+            m_out_backlog = 0;
+            conn->forceClose();
+            return false;
+        }
+        if(droppable) {
+            return false;
+        }
+    }
+
+    m_out_backlog += static_cast<double>(bytes);
+    return true;
+}
+
+void ConnectionContext::queueResponse(const drogon::WebSocketConnectionPtr& conn, common::SerializedEnvelope bytes) {
+    if(!bytes || m_closed) {
+        return;
+    }
+    m_queued_response_bytes += bytes->size();
+    m_responses.push_back(std::move(bytes));
+    pumpResponses(conn);
+}
+
+void ConnectionContext::pumpResponses(const drogon::WebSocketConnectionPtr& conn) {
+    const auto& cfg = serverConfig().outbound;
+    const auto now = std::chrono::steady_clock::now();
+    const double rate = static_cast<double>(std::max<size_t>(cfg.response_drain_bytes_per_sec, 1));
+    const double window = static_cast<double>(cfg.response_window_bytes);
+
+    const double elapsed = std::chrono::duration<double>(now - m_response_updated).count();
+    m_response_backlog = std::max(0.0, m_response_backlog - elapsed * rate);
+    m_response_updated = now;
+
+    // The first frame goes out even when it alone is larger than the window, a window of 0 holds nothing back.
+    while(!m_responses.empty() && (cfg.response_window_bytes == 0 || m_response_backlog < window)) {
+        auto bytes = std::move(m_responses.front());
+        m_responses.pop_front();
+        m_queued_response_bytes -= bytes->size();
+        m_response_backlog += static_cast<double>(bytes->size());
+        if(admitOutbound(conn, bytes->size(), false)) {
+            common::sendSerialized(conn, bytes);
+        }
+    }
+    if(m_responses.empty() || m_response_timer_armed) {
+        return;
+    }
+
+    m_response_timer_armed = true;
+    const double wait = (m_response_backlog - window) / rate;
+    drogon::app().getIOLoop(m_loop_index)->runAfter(std::max(wait, 0.001), [weak_self = weak_from_this(), weak_conn = std::weak_ptr(conn)] {
+        auto self = weak_self.lock();
+        if(!self) {
+            return;
+        }
+        self->m_response_timer_armed = false;
+        if(auto conn = weak_conn.lock(); conn && conn->connected()) {
+            self->pumpResponses(conn);
+        }
+    });
+}
+
+void sendResponseToConnection(const drogon::WebSocketConnectionPtr& conn, common::SerializedEnvelope bytes) {
+    if(auto ctx = conn->getContext<ConnectionContext>()) {
+        ctx->queueResponse(conn, std::move(bytes));
+    } else {
+        sendToConnection(conn, bytes);
+    }
+}
+
+void sendToConnection(const drogon::WebSocketConnectionPtr& conn, const common::SerializedEnvelope& bytes, bool droppable) {
+    if(!bytes) {
+        return;
+    }
+    if(auto ctx = conn->getContext<ConnectionContext>(); ctx && !ctx->admitOutbound(conn, bytes->size(), droppable)) {
+        return;
+    }
+    common::sendSerialized(conn, bytes);
+}
+
+void ConnectionContext::complete(uint64_t seq, std::function<void(const chat::Envelope&)> reply, Response response) {
+    if(m_closed) {
+        return;
+    }
+    m_done.emplace(seq, std::make_pair(std::move(reply), std::move(response)));
+    while(!m_done.empty() && m_done.begin()->first == m_next_reply) {
+        auto node = m_done.extract(m_done.begin());
+        ++m_next_reply;
+        node.mapped().first(*node.mapped().second);
+    }
+}
+
+} // namespace server
@@ -0,0 +1,102 @@
+#include <server/chat/HistoryExport.h>
+#include <server/db/Repository.h>
+#include <server/utils/server_config.h>
+#include <common/utils/metrics.h>
+#include <json/writer.h>
+
+namespace server {
+
+/// @brief The messages written by exports.
+static common::Counter& exportedMessages() {
+    static auto& counter = common::MetricsRegistry::instance().counter(
+        "chat_history_export_messages_total", "Messages written by history exports.");
+    return counter;
+}
+
+static void appendVarint(std::string& out, uint64_t value) {
+    while(value >= 0x80) {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+/// @brief One line per message, the strings escaped by jsoncpp.
+static void appendNdjson(std::string& out, const chat::MessageInfo& message) {
+    out += "{\"message_id\":" + std::to_string(message.message_id());
+    out += ",\"seq\":" + std::to_string(message.seq());
+    out += ",\"timestamp\":" + std::to_string(message.timestamp());
+    out += ",\"user_id\":" + std::to_string(message.from().user_id());
+    out += ",\"user_name\":" + Json::valueToQuotedString(message.from().user_name().c_str());
+    out += ",\"message\":" + Json::valueToQuotedString(message.message().c_str());
+    out += "}\n";
+}
+
+static void appendProtobuf(std::string& out, const chat::MessageInfo& message) {
+    appendVarint(out, message.ByteSizeLong());
+    message.AppendToString(&out);
+}
+
+HistoryExport& HistoryExport::instance() {
+    static HistoryExport inst;
+    return inst;
+}
+
+HistoryExport::Slot::~Slot() {
+    HistoryExport::instance().m_running.fetch_sub(1, std::memory_order_relaxed);
+}
+
+std::shared_ptr<HistoryExport::Slot> HistoryExport::tryAcquire() {
+    const auto limit = serverConfig().history_export.max_concurrent;
+    auto running = m_running.load(std::memory_order_relaxed);
+    do {
+        if(running >= limit) {
+            return nullptr;
+        }
+    } while(!m_running.compare_exchange_weak(running, running + 1, std::memory_order_relaxed));
+    return std::make_shared<Slot>();
+}
+
+drogon::Task<> HistoryExport::stream(std::shared_ptr<Slot> slot, drogon::ResponseStreamPtr stream, int32_t room_id, int64_t last_seq, Format format, bool gzip) {
+    const auto page_size = static_cast<int32_t>(std::min<size_t>(serverConfig().history_export.page_size, INT32_MAX));
+    auto db = readDbClient();
+    int64_t after = 0;
+    try {
+        while(after < last_seq) {
+            google::protobuf::RepeatedPtrField<chat::MessageInfo> page;
+            // A negative limit pages forward from the seq.
+            co_await Repository::findMessagesPage(db, room_id, -page_size, after, page, HistoryKey::Seq);
+
+            std::string bytes;
+            for(const auto& message : page) {
+                if(message.seq() > last_seq) {
+                    break;
+                }
+                if(format == Format::Ndjson) {
+                    appendNdjson(bytes, message);
+                } else {
+                    appendProtobuf(bytes, message);
+                }
+                exportedMessages().inc();
+            }
+            if(!bytes.empty()) {
+                if(gzip) {
+                    bytes = drogon::utils::gzipCompress(bytes.data(), bytes.size());
+                }
+                if(!stream->send(bytes)) {
+                    LOG_DEBUG << "History export of room " << room_id << " stopped, the client went away";
+                    break;
+                }
+            }
+            if(page.size() < page_size) {
+                break;
+            }
+            after = page[page.size() - 1].seq();
+        }
+    } catch(const std::exception& e) {
+        LOG_ERROR << "History export of room " << room_id << " failed after seq " << after << ": " << e.what();
+    }
+    stream->close();
+}
+
+} // namespace server
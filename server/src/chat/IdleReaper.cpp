@@ -0,0 +1,78 @@
+#include <server/chat/IdleReaper.h>
+#include <server/chat/ConnectionContext.h>
+#include <server/utils/server_config.h>
+#include <common/utils/metrics.h>
+
+namespace server {
+
+/// @brief The resolution of the heartbeat, deadlines are rounded up to it.
+static constexpr auto TICK = std::chrono::seconds{1};
+
+/// @brief A wait in ticks, rounded up.
+static uint64_t ticks(std::chrono::steady_clock::duration wait) {
+    return static_cast<uint64_t>(std::chrono::ceil<std::chrono::seconds>(wait) / TICK);
+}
+
+IdleReaper& IdleReaper::instance() {
+    static IdleReaper inst;
+    return inst;
+}
+
+IdleReaper::Wheel& IdleReaper::loopWheel() {
+    thread_local Wheel wheel;
+    thread_local bool ticking = false;
+    if(!ticking) {
+        ticking = true;
+        trantor::EventLoop::getEventLoopOfCurrentThread()->runEvery(std::chrono::duration<double>(TICK), [this] {
+            wheel.advance([this](const auto& weak) { check(wheel, weak); });
+        });
+    }
+    return wheel;
+}
+
+void IdleReaper::watch(const drogon::WebSocketConnectionPtr& conn) {
+    const auto& cfg = serverConfig().heartbeat;
+    if(cfg.ping_interval.count() <= 0) {
+        return;
+    }
+    loopWheel().schedule(ticks(cfg.ping_interval), conn);
+}
+
+void IdleReaper::check(Wheel& wheel, const std::weak_ptr<drogon::WebSocketConnection>& weak) {
+    static auto& pings = common::MetricsRegistry::instance().counter(
+        "chat_heartbeat_pings_total", "WebSocket pings sent to connections quiet for a ping interval.");
+    static auto& reaped = common::MetricsRegistry::instance().counter(
+        "chat_idle_connections_reaped_total", "Connections closed for not answering the heartbeat.");
+
+    const auto conn = weak.lock();
+    if(!conn || !conn->connected()) {
+        return;
+    }
+    const auto ctx = conn->getContext<ConnectionContext>();
+    if(!ctx) {
+        return;
+    }
+    const auto& cfg = serverConfig().heartbeat;
+    const auto ping_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(cfg.ping_interval);
+    const auto idle_timeout = std::chrono::duration_cast<std::chrono::steady_clock::duration>(cfg.idle_timeout);
+    const auto idle = std::chrono::steady_clock::now() - ctx->lastActivity();
+
+    if(idle_timeout.count() > 0 && idle >= idle_timeout) {
+        LOG_DEBUG << "Closing " << conn->peerAddr().toIpPort() << ", silent for "
+                  << std::chrono::duration_cast<std::chrono::seconds>(idle).count() << " s";
+        reaped.inc();
+        // The close handler unregisters it from its rooms.
+        conn->forceClose();
+        return;
+    }
+    if(idle < ping_interval) {
+        wheel.schedule(ticks(ping_interval - idle), weak);
+        return;
+    }
+    conn->send(std::string_view{}, drogon::WebSocketMessageType::Ping);
+    pings.inc();
+    const auto next = idle_timeout.count() > 0 ? std::min(ping_interval, idle_timeout - idle) : ping_interval;
+    wheel.schedule(ticks(next), weak);
+}
+
+} // namespace server
@@ -0,0 +1,152 @@
+#include <server/chat/Introspection.h>
+#include <server/chat/ChatRoomManager.h>
+#include <common/utils/loop_monitor.h>
+#include <common/utils/metrics.h>
+#include <algorithm>
+
+namespace server {
+
+static double milliseconds(std::chrono::steady_clock::duration elapsed) {
+    return std::chrono::duration<double, std::milli>(elapsed).count();
+}
+
+static Json::Value renderLock(const common::LockState& lock) {
+    Json::Value out;
+    out["readers"] = lock.readers;
+    out["writer"] = lock.writer;
+    out["shared_waiters"] = static_cast<Json::UInt64>(lock.shared_waiters);
+    out["unique_waiters"] = static_cast<Json::UInt64>(lock.unique_waiters);
+    out["longest_wait_ms"] = milliseconds(lock.longest_wait);
+    return out;
+}
+
+static Json::Value renderBusyLocks(const std::vector<common::LockState>& locks) {
+    Json::Value out(Json::arrayValue);
+    for(size_t shard = 0; shard < locks.size(); ++shard) {
+        if(locks[shard].busy()) {
+            auto entry = renderLock(locks[shard]);
+            entry["shard"] = static_cast<Json::UInt64>(shard);
+            out.append(std::move(entry));
+        }
+    }
+    return out;
+}
+
+static Json::Value renderRooms(const std::vector<ChatRoomManager::LoopInspection>& loops, size_t top) {
+    struct Room {
+        int32_t id = 0;
+        size_t connections = 0;
+        size_t loops = 0;
+    };
+    std::unordered_map<int32_t, Room> by_id;
+    for(const auto& loop : loops) {
+        for(const auto& [room_id, connections] : loop.rooms) {
+            auto& room = by_id[room_id];
+            room.id = room_id;
+            room.connections += connections;
+            ++room.loops;
+        }
+    }
+    std::vector<Room> rooms;
+    rooms.reserve(by_id.size());
+    for(const auto& [id, room] : by_id) {
+        rooms.push_back(room);
+    }
+    const auto keep = std::min(top, rooms.size());
+    std::partial_sort(rooms.begin(), rooms.begin() + static_cast<std::ptrdiff_t>(keep), rooms.end(),
+                      [](const Room& a, const Room& b) { return a.connections > b.connections; });
+
+    Json::Value out(Json::arrayValue);
+    for(size_t i = 0; i < keep; ++i) {
+        Json::Value room;
+        room["room_id"] = rooms[i].id;
+        room["connections"] = static_cast<Json::UInt64>(rooms[i].connections);
+        room["loops"] = static_cast<Json::UInt64>(rooms[i].loops);
+        out.append(std::move(room));
+    }
+    return out;
+}
+
+static Json::Value renderConnections(const std::vector<ChatRoomManager::LoopInspection>& loops, size_t top) {
+    std::vector<std::pair<size_t, const ChatRoomManager::ConnectionInspection*>> all;
+    for(const auto& loop : loops) {
+        for(const auto& conn : loop.busiest) {
+            all.emplace_back(loop.loop_index, &conn);
+        }
+    }
+    // The same order as each loop's own list, see ChatRoomManager::inspectLoops().
+    std::sort(all.begin(), all.end(), [](const auto& a, const auto& b) {
+        const auto& x = a.second->stats;
+        const auto& y = b.second->stats;
+        if(x.out_backlog_bytes != y.out_backlog_bytes) {
+            return x.out_backlog_bytes > y.out_backlog_bytes;
+        }
+        return x.queued_requests + x.in_flight > y.queued_requests + y.in_flight;
+    });
+    all.resize(std::min(top, all.size()));
+
+    Json::Value out(Json::arrayValue);
+    for(const auto& [loop_index, conn] : all) {
+        Json::Value entry;
+        entry["user_id"] = conn->user_id;
+        entry["peer"] = conn->peer;
+        entry["loop"] = static_cast<Json::UInt64>(loop_index);
+        entry["backlog_bytes"] = static_cast<Json::UInt64>(conn->stats.out_backlog_bytes);
+        entry["over_high_watermark_ms"] = milliseconds(conn->stats.over_high_for);
+        entry["queued_jobs"] = static_cast<Json::UInt64>(conn->stats.queued_jobs);
+        entry["queued_requests"] = static_cast<Json::UInt64>(conn->stats.queued_requests);
+        entry["in_flight"] = static_cast<Json::UInt64>(conn->stats.in_flight);
+        entry["undelivered"] = static_cast<Json::UInt64>(conn->stats.undelivered);
+        entry["queued_responses"] = static_cast<Json::UInt64>(conn->stats.queued_responses);
+        entry["queued_response_bytes"] = static_cast<Json::UInt64>(conn->stats.queued_response_bytes);
+        entry["lock"] = renderLock(conn->lock);
+        out.append(std::move(entry));
+    }
+    return out;
+}
+
+static Json::Value renderLoops(const std::vector<ChatRoomManager::LoopInspection>& loops) {
+    const auto& monitor = common::LoopMonitor::instance();
+    Json::Value out(Json::arrayValue);
+    for(const auto& loop : loops) {
+        Json::Value entry;
+        entry["loop"] = static_cast<Json::UInt64>(loop.loop_index);
+        entry["connections"] = static_cast<Json::UInt64>(loop.connections);
+        entry["rooms"] = static_cast<Json::UInt64>(loop.rooms.size());
+        entry["hot_broadcasts"] = static_cast<Json::UInt64>(loop.hot_broadcasts);
+        entry["queue_depth"] = static_cast<Json::Int64>(monitor.queueDepth(loop.loop_index));
+        entry["lag_ms"] = milliseconds(monitor.lag(loop.loop_index));
+        out.append(std::move(entry));
+    }
+    return out;
+}
+
+static Json::Value renderHandlersInFlight() {
+    static const std::string prefix = "handler=\"";
+    Json::Value out(Json::objectValue);
+    for(const auto& [labels, count] : common::MetricsRegistry::instance().read("chat_requests_in_flight")) {
+        if(count > 0 && labels.starts_with(prefix) && labels.ends_with('"')) {
+            out[labels.substr(prefix.size(), labels.size() - prefix.size() - 1)] = static_cast<Json::Int64>(count);
+        }
+    }
+    return out;
+}
+
+void Introspection::collect(const IntrospectionConfig& config, std::function<void(Json::Value)> done) {
+    auto& rooms = ChatRoomManager::instance();
+    rooms.inspectLoops(config.top_connections, [config, done = std::move(done)](std::vector<ChatRoomManager::LoopInspection> loops) {
+        auto& rooms = ChatRoomManager::instance();
+        Json::Value out;
+        out["connections"] = rooms.connectionCount();
+        out["room_count"] = rooms.roomCount();
+        out["rooms"] = renderRooms(loops, config.top_rooms);
+        out["connections_by_backlog"] = renderConnections(loops, config.top_connections);
+        out["loops"] = renderLoops(loops);
+        out["locks"]["user_shards"] = renderBusyLocks(rooms.userShardLocks());
+        out["locks"]["room_shards"] = renderBusyLocks(rooms.roomShardLocks());
+        out["handlers_in_flight"] = renderHandlersInFlight();
+        done(std::move(out));
+    });
+}
+
+} // namespace server
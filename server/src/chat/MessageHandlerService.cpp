@@ -1,103 +1,314 @@
 #include <server/chat/MessageHandlerService.h>
 #include <server/chat/MessageHandlers.h>
+#include <server/chat/ClusterRoomService.h>
+#include <server/chat/RateLimiter.h>
+#include <server/chat/TenantQuotas.h>
+#include <server/db/DbCircuitBreaker.h>
+#include <server/utils/server_config.h>
 #include <common/utils/utils.h>
 
 namespace server {
 
 MessageHandlerService::MessageHandlerService(std::unique_ptr<MessageHandlers> handlers)
-    : m_handlers(std::move(handlers)) {}
+    : m_handlers(std::move(handlers)),
+      m_dispatcher("chat_request_duration_seconds", "Time spent in MessageHandlerService::processMessage, per handler.",
+                   "chat_requests_in_flight") {
+    registerHandlers();
+    registerRateLimits();
+    registerLoadShedding();
+}
 
 MessageHandlerService::~MessageHandlerService() = default;
 
-drogon::Task<chat::Envelope> MessageHandlerService::processMessage(const WsDataPtr& wsData, const chat::Envelope& env, IChatRoomService& room_service) const {
-    chat::Envelope respEnv;
+bool MessageHandlerService::canRunConcurrently(const chat::Envelope& env) noexcept {
     switch(env.payload_case()) {
-        case chat::Envelope::kInitialAuthRequest: {
-            *respEnv.mutable_initial_auth_response() = co_await m_handlers->handleAuthInitial(wsData, env.initial_auth_request());
-            break;
-        }
-        case chat::Envelope::kInitialRegisterRequest: {
-            *respEnv.mutable_initial_register_response() = co_await m_handlers->handleRegisterInitial(wsData, env.initial_register_request());
-            break;
-        }
-        case chat::Envelope::kAuthRequest: {
-            *respEnv.mutable_auth_response() = co_await m_handlers->handleAuth(wsData, env.auth_request(), room_service);
-            break;
-        }
-        case chat::Envelope::kRegisterRequest: {
-            *respEnv.mutable_register_response() = co_await m_handlers->handleRegister(wsData, env.register_request());
-            break;
-        }
-        case chat::Envelope::kSendMessageRequest: {
-            *respEnv.mutable_send_message_response() = co_await m_handlers->handleSendMessage(wsData, env.send_message_request(), room_service);
-            break;
-        }
-        case chat::Envelope::kJoinRoomRequest: {
-            *respEnv.mutable_join_room_response() = co_await m_handlers->handleJoinRoom(wsData, env.join_room_request(), room_service);
-            break;
-        }
-        case chat::Envelope::kLeaveRoomRequest: {
-            *respEnv.mutable_leave_room_response() = co_await m_handlers->handleLeaveRoom(wsData, env.leave_room_request(), room_service);
-            break;
-        }
-        case chat::Envelope::kCreateRoomRequest: {
-            *respEnv.mutable_create_room_response() = co_await m_handlers->handleCreateRoom(wsData, env.create_room_request(), room_service);
-            break;
-        }
-        case chat::Envelope::kGetMessagesRequest: {
-            *respEnv.mutable_get_messages_response() = co_await m_handlers->handleGetMessages(wsData, env.get_messages_request());
-            break;
-        }
-        case chat::Envelope::kLogoutRequest: {
-            *respEnv.mutable_logout_response() = co_await m_handlers->handleLogoutUser(wsData, room_service);
-            break;
-        }
-        case chat::Envelope::kRenameRoomRequest: {
-            *respEnv.mutable_rename_room_response() = co_await m_handlers->MessageHandlers::handleRenameRoom(wsData, env.rename_room_request(), room_service);
-            break;
-        }
-        case chat::Envelope::kDeleteRoomRequest: {
-            *respEnv.mutable_delete_room_response() = co_await m_handlers->MessageHandlers::handleDeleteRoom(wsData, env.delete_room_request(), room_service);
-            break;
+        case chat::Envelope::kGetMessagesRequest:
+        case chat::Envelope::kGetMessagesAroundRequest:
+        case chat::Envelope::kSyncRoomRequest:
+        case chat::Envelope::kSearchMessagesRequest:
+        case chat::Envelope::kGetRoomMembersRequest:
+        case chat::Envelope::kMarkRoomReadRequest:
+        case chat::Envelope::kGetMySaltRequest:
+            return true;
+        case chat::Envelope::kBatchRequest:
+            return std::all_of(env.batch_request().requests().begin(), env.batch_request().requests().end(),
+                [](const chat::Envelope& request) { return !request.has_batch_request() && canRunConcurrently(request); });
+        default:
+            return false;
+    }
+}
+
+/// @brief Counts the running requests of a concurrent group of a batch. Only touched on the connection's loop.
+struct BatchGroup {
+    size_t pending = 0;
+    std::coroutine_handle<> waiter;
+};
+
+/// @brief Suspends the batch until every request of its current group has finished.
+struct BatchGroupAwaitable {
+    std::shared_ptr<BatchGroup> group;
+
+    bool await_ready() const noexcept { return group->pending == 0; }
+    void await_suspend(std::coroutine_handle<> handle) noexcept { group->waiter = handle; }
+    void await_resume() const noexcept {}
+};
+
+drogon::Task<> MessageHandlerService::processBatch(const WsDataPtr& wsData, const chat::BatchRequest& req, ClusterRoomService& room_service,
+                                                  chat::BatchResponse& resp) const {
+    const auto& requests = req.requests();
+    if(static_cast<size_t>(requests.size()) > serverConfig().pipeline.max_batch) {
+        common::setStatus(resp, chat::STATUS_FAILURE, "Too many requests in one batch.");
+        co_return;
+    }
+
+    // Every slot is added up front, the requests run in a group fill theirs through stable pointers.
+    auto& responses = *resp.mutable_responses();
+    responses.Reserve(requests.size());
+    for(int i = 0; i < requests.size(); ++i) {
+        responses.Add();
+    }
+    const auto isGroupable = [](const chat::Envelope& request) {
+        return !request.has_batch_request() && canRunConcurrently(request);
+    };
+
+    for(int i = 0; i < requests.size();) {
+        if(requests[i].has_batch_request()) {
+            responses[i] = common::makeGenericErrorEnvelope("Batches cannot be nested.");
+            ++i;
+            continue;
         }
-        case chat::Envelope::kAssignRoleRequest: {
-            *respEnv.mutable_assign_role_response() = co_await m_handlers->handleAssignRole(wsData, env.assign_role_request(), room_service);
-            break;
+        if(!isGroupable(requests[i])) {
+            co_await processMessage(wsData, requests[i], room_service, responses[i]);
+            ++i;
+            continue;
         }
-        case chat::Envelope::kDeleteMessageRequest: {
-            *respEnv.mutable_delete_message_response() = co_await m_handlers->handleDeleteMessage(wsData, env.delete_message_request(), room_service);
-            break;
+
+        // Independent reads start right away and interleave on this loop, the batch resumes after the last one.
+        auto group = std::make_shared<BatchGroup>();
+        for(; i < requests.size() && isGroupable(requests[i]); ++i) {
+            ++group->pending;
+            drogon::async_run([this, &wsData, &request = requests[i], &room_service, &out = responses[i], group]() -> drogon::Task<> {
+                try {
+                    co_await processMessage(wsData, request, room_service, out);
+                } catch(const std::exception& e) {
+                    LOG_ERROR << "Batched request failed: " << e.what();
+                    out = common::makeGenericErrorEnvelope("Critical server error during message handling.");
+                }
+                if(--group->pending == 0 && group->waiter) {
+                    group->waiter.resume();
+                }
+            });
         }
-        case chat::Envelope::kUserTypingStartRequest: {
-            *respEnv.mutable_user_typing_start_response() = co_await m_handlers->handleUserTypingStart(wsData, room_service);
-            break;
+        co_await BatchGroupAwaitable{group};
+    }
+
+    common::setStatus(resp, chat::STATUS_SUCCESS);
+}
+
+const char* MessageHandlerService::requestName(chat::Envelope::PayloadCase payload) const noexcept {
+    return m_dispatcher.name(payload);
+}
+
+bool MessageHandlerService::isImmediate(const chat::Envelope& env) const noexcept {
+    return m_dispatcher.isImmediate(env.payload_case());
+}
+
+void MessageHandlerService::processImmediately(const WsDataPtr& wsData, const chat::Envelope& env, ClusterRoomService& room_service,
+                                               chat::Envelope& respEnv) const {
+    HandlerContext ctx{wsData, room_service};
+    m_dispatcher.dispatchImmediately(ctx, env, respEnv);
+}
+
+/// @brief The tenant a request counts against: the one of the room it joins, or of the connection's room.
+static Tenant* tenantOfRequest(const WsData& wsData, const chat::Envelope& env) {
+    auto& quotas = TenantQuotas::instance();
+    if(!quotas.enabled()) {
+        return nullptr;
+    }
+    if(env.has_join_room_request()) {
+        return quotas.tenantOf(env.join_room_request().room_id());
+    }
+    return wsData.room ? quotas.tenantOf(wsData.room->id) : nullptr;
+}
+
+/// @brief Holds a request's slot among those of its tenant in flight, and makes the tenant current while it runs.
+class TenantSlot {
+public:
+    explicit TenantSlot(Tenant* tenant) noexcept : m_tenant(tenant) {
+        setCurrentTenant(tenant);
+    }
+    ~TenantSlot() {
+        setCurrentTenant(nullptr);
+        if(m_tenant) {
+            m_tenant->leaveRequest();
         }
-        case chat::Envelope::kUserTypingStopRequest: {
-            *respEnv.mutable_user_typing_stop_response() = co_await m_handlers->handleUserTypingStop(wsData, room_service);
-            break;
-		}
-        case chat::Envelope::kBecomeMemberRequest: {
-            *respEnv.mutable_become_member_response() = co_await m_handlers->handleBecomeMember(wsData, env.become_member_request());
-            break;
-		}
-        case chat::Envelope::kChangeUsernameRequest: {
-            *respEnv.mutable_change_username_response() = co_await m_handlers->handleChangeUsername(wsData, env.change_username_request(), room_service);
-            break;
+    }
+    TenantSlot(const TenantSlot&) = delete;
+    TenantSlot& operator=(const TenantSlot&) = delete;
+
+private:
+    Tenant* m_tenant;
+};
+
+drogon::Task<> MessageHandlerService::processMessage(const WsDataPtr& wsData, const chat::Envelope& env, ClusterRoomService& room_service,
+                                                    chat::Envelope& respEnv) const {
+    HandlerContext ctx{wsData, room_service};
+    // A batch takes no slot of its own, each of its requests takes one.
+    auto* tenant = env.has_batch_request() ? nullptr : tenantOfRequest(wsData->get_unsafe(), env);
+    if(tenant && !tenant->tryEnterRequest()) {
+        tenant->countRejected();
+        m_dispatcher.reject(respEnv, env.payload_case(), chat::STATUS_RATE_LIMITED, "This community is busy, try again shortly.");
+        co_return;
+    }
+    const TenantSlot slot{tenant};
+    co_await m_dispatcher.dispatch(ctx, env, respEnv);
+}
+
+void MessageHandlerService::registerHandlers() {
+    // Every change to a connection's WsData is made by an exclusive job of its ConnectionContext,
+    // so handlers that only read it, exclusive or concurrent, skip the lock.
+    auto* h = m_handlers.get();
+    m_dispatcher
+        .on<chat::InitialAuthRequest>("InitialAuth", [h](HandlerContext& ctx, const chat::InitialAuthRequest& req) {
+            return h->handleAuthInitial(ctx.wsData, req);
+        })
+        .on<chat::InitialRegisterRequest>("InitialRegister", [h](HandlerContext& ctx, const chat::InitialRegisterRequest& req) {
+            return h->handleRegisterInitial(ctx.wsData, req);
+        })
+        .on<chat::AuthRequest>("Auth", [h](HandlerContext& ctx, const chat::AuthRequest& req) {
+            return h->handleAuth(ctx.wsData, req, ctx.room_service);
+        })
+        .on<chat::ResumeSessionRequest>("ResumeSession", [h](HandlerContext& ctx, const chat::ResumeSessionRequest& req) {
+            return h->handleResumeSession(ctx.wsData, req, ctx.room_service);
+        })
+        .on<chat::RegisterRequest>("Register", [h](HandlerContext& ctx, const chat::RegisterRequest& req) {
+            return h->handleRegister(ctx.wsData, req);
+        })
+        .on<chat::SendMessageRequest>("SendMessage", [h](HandlerContext& ctx, const chat::SendMessageRequest& req) {
+            return h->handleSendMessage(ctx.wsData->get_unsafe(), req, ctx.room_service);
+        })
+        .on<chat::JoinRoomRequest>("JoinRoom", [h](HandlerContext& ctx, const chat::JoinRoomRequest& req) {
+            return h->handleJoinRoom(ctx.wsData, req, ctx.room_service);
+        })
+        .on<chat::LeaveRoomRequest>("LeaveRoom", [h](HandlerContext& ctx, const chat::LeaveRoomRequest& req) {
+            return h->handleLeaveRoom(ctx.wsData, req, ctx.room_service);
+        })
+        .on<chat::CreateRoomRequest>("CreateRoom", [h](HandlerContext& ctx, const chat::CreateRoomRequest& req) {
+            return h->handleCreateRoom(ctx.wsData, req, ctx.room_service);
+        })
+        .on<chat::GetMessagesRequest>("GetMessages", [h](HandlerContext& ctx, const chat::GetMessagesRequest& req, chat::GetMessagesResponse& resp) {
+            return h->handleGetMessages(ctx.wsData->get_unsafe(), req, resp);
+        })
+        .on<chat::GetMessagesAroundRequest>("GetMessagesAround", [h](HandlerContext& ctx, const chat::GetMessagesAroundRequest& req, chat::GetMessagesAroundResponse& resp) {
+            return h->handleGetMessagesAround(ctx.wsData->get_unsafe(), req, resp);
+        })
+        .on<chat::SyncRoomRequest>("SyncRoom", [h](HandlerContext& ctx, const chat::SyncRoomRequest& req, chat::SyncRoomResponse& resp) {
+            return h->handleSyncRoom(ctx.wsData->get_unsafe(), req, resp);
+        })
+        .on<chat::SearchMessagesRequest>("SearchMessages", [h](HandlerContext& ctx, const chat::SearchMessagesRequest& req, chat::SearchMessagesResponse& resp) {
+            return h->handleSearchMessages(ctx.wsData->get_unsafe(), req, resp);
+        })
+        .on<chat::GetRoomMembersRequest>("GetRoomMembers", [h](HandlerContext& ctx, const chat::GetRoomMembersRequest& req, chat::GetRoomMembersResponse& resp) {
+            return h->handleGetRoomMembers(ctx.wsData->get_unsafe(), req, resp);
+        })
+        .on<chat::MarkRoomReadRequest>("MarkRoomRead", [h](HandlerContext& ctx, const chat::MarkRoomReadRequest& req, chat::MarkRoomReadResponse& resp) {
+            return h->handleMarkRoomRead(ctx.wsData->get_unsafe(), req, resp);
+        })
+        .on<chat::LogoutRequest>("Logout", [h](HandlerContext& ctx, const chat::LogoutRequest&) {
+            return h->handleLogoutUser(ctx.wsData, ctx.room_service);
+        })
+        .on<chat::RenameRoomRequest>("RenameRoom", [h](HandlerContext& ctx, const chat::RenameRoomRequest& req) {
+            return h->handleRenameRoom(ctx.wsData, req, ctx.room_service);
+        })
+        .on<chat::DeleteRoomRequest>("DeleteRoom", [h](HandlerContext& ctx, const chat::DeleteRoomRequest& req) {
+            return h->handleDeleteRoom(ctx.wsData, req, ctx.room_service);
+        })
+        .on<chat::AssignRoleRequest>("AssignRole", [h](HandlerContext& ctx, const chat::AssignRoleRequest& req) {
+            return h->handleAssignRole(ctx.wsData, req, ctx.room_service);
+        })
+        .on<chat::DeleteMessageRequest>("DeleteMessage", [h](HandlerContext& ctx, const chat::DeleteMessageRequest& req) {
+            return h->handleDeleteMessage(ctx.wsData, req, ctx.room_service);
+        })
+        .on<chat::DeleteUserMessagesRequest>("DeleteUserMessages", [h](HandlerContext& ctx, const chat::DeleteUserMessagesRequest& req) {
+            return h->handleDeleteUserMessages(ctx.wsData, req, ctx.room_service);
+        })
+        .on<chat::SubscribeRoomsRequest>("SubscribeRooms", [h](HandlerContext& ctx, const chat::SubscribeRoomsRequest& req, chat::SubscribeRoomsResponse& resp) {
+            h->handleSubscribeRooms(ctx.wsData->get_unsafe(), req, ctx.room_service, resp);
+        })
+        .on<chat::UserTypingStartRequest>("UserTypingStart", [h](HandlerContext& ctx, const chat::UserTypingStartRequest&, chat::UserTypingStartResponse& resp) {
+            h->handleUserTypingStart(ctx.wsData->get_unsafe(), ctx.room_service, resp);
+        })
+        .on<chat::UserTypingStopRequest>("UserTypingStop", [h](HandlerContext& ctx, const chat::UserTypingStopRequest&, chat::UserTypingStopResponse& resp) {
+            h->handleUserTypingStop(ctx.wsData->get_unsafe(), ctx.room_service, resp);
+        })
+        .on<chat::BecomeMemberRequest>("BecomeMember", [h](HandlerContext& ctx, const chat::BecomeMemberRequest& req) {
+            return h->handleBecomeMember(ctx.wsData, req);
+        })
+        .on<chat::ChangeUsernameRequest>("ChangeUsername", [h](HandlerContext& ctx, const chat::ChangeUsernameRequest& req) {
+            return h->handleChangeUsername(ctx.wsData, req, ctx.room_service);
+        })
+        .on<chat::GetMySaltRequest>("GetMySalt", [h](HandlerContext& ctx, const chat::GetMySaltRequest&) {
+            return h->handleGetSalt(ctx.wsData->get_unsafe());
+        })
+        .on<chat::ChangePasswordRequest>("ChangePassword", [h](HandlerContext& ctx, const chat::ChangePasswordRequest& req) {
+            return h->handleChangePassword(ctx.wsData, req);
+        })
+        .on<chat::SetCompressionRequest>("SetCompression", [h](HandlerContext& ctx, const chat::SetCompressionRequest& req) {
+            return h->handleSetCompression(ctx.wsData, req);
+        })
+        .on<chat::BatchRequest>("Batch", [this](HandlerContext& ctx, const chat::BatchRequest& req, chat::BatchResponse& resp) {
+            return processBatch(ctx.wsData, req, ctx.room_service, resp);
+        });
+}
+
+void MessageHandlerService::registerRateLimits() {
+    const auto& cfg = serverConfig().rate_limits;
+    if(!cfg.enabled) {
+        return;
+    }
+    auto& limiter = RateLimiter::instance();
+    m_dispatcher.forEachRoute([&](chat::Envelope::PayloadCase payload, const char* name) {
+        limiter.configure(payload, name, cfg);
+    });
+    m_dispatcher.use([this, &limiter](HandlerContext& ctx, const chat::Envelope& env, chat::Envelope& respEnv) {
+        const auto& wsData = ctx.wsData->get_unsafe();
+        const auto user_id = wsData.status == USER_STATUS::Authenticated && wsData.user ? std::optional(wsData.user->id) : std::nullopt;
+        if(limiter.admit(wsData.connection_id, user_id, env.payload_case())) {
+            return true;
         }
-        case chat::Envelope::kGetMySaltRequest: {
-            *respEnv.mutable_get_my_salt_response() = co_await m_handlers->handleGetSalt(wsData);
-            break;
+        m_dispatcher.reject(respEnv, env.payload_case(), chat::STATUS_RATE_LIMITED, "Too many requests, slow down.");
+        return false;
+    });
+}
+
+void MessageHandlerService::registerLoadShedding() {
+    const auto& cfg = serverConfig().db_breaker;
+    if(!cfg.enabled || cfg.shed.empty()) {
+        return;
+    }
+    // Indexed by payload case, nullptr for the requests that are never shed.
+    std::vector<common::Counter*> shed;
+    m_dispatcher.forEachRoute([&](chat::Envelope::PayloadCase payload, const char* name) {
+        if(std::find(cfg.shed.begin(), cfg.shed.end(), name) == cfg.shed.end()) {
+            return;
         }
-        case chat::Envelope::kChangePasswordRequest: {
-            *respEnv.mutable_change_password_response() = co_await m_handlers->handleChangePassword(wsData, env.change_password_request());
-            break;
+        const auto index = static_cast<size_t>(payload);
+        if(shed.size() <= index) {
+            shed.resize(index + 1, nullptr);
         }
-        default: {
-            respEnv = common::makeGenericErrorEnvelope("Unknown or empty payload");
-            break;
+        shed[index] = &common::MetricsRegistry::instance().counter(
+            "chat_shed_total", "Requests answered with STATUS_UNAVAILABLE while the database breaker is open, per handler.",
+            "handler=\"" + std::string(name) + "\"");
+    });
+    m_dispatcher.use([this, shed = std::move(shed)](HandlerContext&, const chat::Envelope& env, chat::Envelope& respEnv) {
+        const auto index = static_cast<size_t>(env.payload_case());
+        if(index >= shed.size() || !shed[index] || DbCircuitBreaker::instance().allow()) {
+            return true;
         }
-    }
-    co_return respEnv;
+        shed[index]->inc();
+        m_dispatcher.reject(respEnv, env.payload_case(), chat::STATUS_UNAVAILABLE, "The server is busy, try again later.");
+        return false;
+    });
 }
 
 } // namespace server
@@ -1,6 +1,15 @@
 #include <server/chat/MessageHandlers.h>
 #include <server/chat/WsData.h>
-#include <server/chat/IChatRoomService.h>
+#include <server/chat/ClusterRoomService.h>
+#include <server/chat/RoomDataCache.h>
+#include <server/chat/SessionTokens.h>
+#include <server/chat/MessageKeys.h>
+#include <server/chat/UsernameFilter.h>
+#include <server/chat/UserDirectory.h>
+#include <server/chat/ChangeFeed.h>
+#include <server/db/Repository.h>
+#include <server/db/DbCircuitBreaker.h>
+#include <server/db/CacheInvalidation.h>
 
 #include <server/models/Users.h>
 #include <server/models/Rooms.h>
@@ -9,18 +18,103 @@
 #include <server/models/UserRoomData.h>
 
 #include <server/utils/switch_to_io_loop.h>
+#include <server/utils/when_all.h>
+#include <server/utils/server_config.h>
 #include <common/utils/utils.h>
 #include <common/utils/limits.h>
+#include <common/utils/unicode_classes.h>
+#include <common/utils/utf8_validate.h>
+#include <common/utils/packed_messages.h>
 
-#include <utf8.h>
 
 using namespace drogon::orm;
 namespace models = drogon_model::drogon_test;
 
 namespace server {
 
-MessageHandlers::MessageHandlers(DbClientPtr dbClient)
-    : m_dbClient{std::move(dbClient)} {}
+static CachedRoom toCachedRoom(const models::Rooms& room) {
+    return CachedRoom{
+        .id = room.getValueOfRoomId(),
+        .name = room.getValueOfRoomName(),
+        .owner_id = room.getOwnerId() ? std::optional<int32_t>{*room.getOwnerId()} : std::nullopt,
+        .is_private = room.getValueOfIsPrivate(),
+    };
+}
+
+/// @brief Whether `db` is a transaction, whose reads must not come from the caches, rather than one of the clients.
+static bool isTransaction(const DbClientPtr& db) {
+    return dynamic_cast<const drogon::orm::Transaction*>(db.get()) != nullptr;
+}
+
+/// @brief A hash of a user's room list without the unread counts, the same on every server of a cluster (FNV-1a).
+static uint64_t roomListHash(int32_t user_id, bool joined_only, const google::protobuf::RepeatedPtrField<chat::RoomInfo>& rooms) {
+    uint64_t hash = 14695981039346656037ull;
+    const auto mix = [&hash](const void* data, size_t size) {
+        for(const auto byte : std::span{static_cast<const unsigned char*>(data), size}) {
+            hash = (hash ^ byte) * 1099511628211ull;
+        }
+    };
+    const auto mixValue = [&mix](auto value) { mix(&value, sizeof(value)); };
+    mixValue(user_id);
+    mixValue(joined_only);
+    for(const auto& room : rooms) {
+        mixValue(room.room_id());
+        mixValue(room.room_name().size());
+        mix(room.room_name().data(), room.room_name().size());
+        mixValue(room.is_joined());
+        mixValue(room.has_owner() ? room.owner().user_id() : 0);
+    }
+    return hash;
+}
+
+/**
+ * @brief Sets the `rooms_hash` of a login response and, when the client keeps the same list,
+ * cuts `rooms` down to the unread counts.
+ */
+template<typename Response>
+static void answerRoomList(Response& resp, int32_t user_id, bool joined_only, std::optional<uint64_t> client_hash) {
+    const auto hash = roomListHash(user_id, joined_only, resp.rooms());
+    resp.set_rooms_hash(hash);
+    if(client_hash != hash) {
+        return;
+    }
+    resp.set_rooms_unchanged(true);
+    auto& rooms = *resp.mutable_rooms();
+    int kept = 0;
+    for(int i = 0; i < rooms.size(); ++i) {
+        const auto room_id = rooms[i].room_id();
+        const auto unread = rooms[i].unread_count();
+        if(unread <= 0) {
+            continue;
+        }
+        auto& room = rooms[kept++];
+        room.Clear();
+        room.set_room_id(room_id);
+        room.set_unread_count(unread);
+    }
+    rooms.DeleteSubrange(kept, rooms.size() - kept);
+}
+
+// A successful response carrying the identity of the message sent.
+static void setSentMessage(chat::SendMessageResponse& resp, const StoredMessage& stored) {
+    common::setStatus(resp, chat::STATUS_SUCCESS);
+    resp.set_message_id(stored.message_id);
+    resp.set_timestamp(stored.created_at);
+    resp.set_seq(stored.seq);
+}
+
+MessageHandlers::MessageHandlers(DbClientPtr dbClient, DbClientPtr readDbClient)
+    : m_dbClient{std::move(dbClient)},
+      m_readDbClient{readDbClient ? std::move(readDbClient) : m_dbClient},
+      m_write_pool{DbPoolScaler::instance().poolOf(m_dbClient)},
+      m_read_pool{DbPoolScaler::instance().poolOf(m_readDbClient)} {
+    const auto& cfg = serverConfig().database;
+    m_fast_writes = !cfg.fast_write_client.empty();
+    m_fast_reads = !cfg.fast_read_client.empty() || (m_fast_writes && cfg.read_client == cfg.write_client);
+    if(m_fast_writes || m_fast_reads) {
+        LOG_INFO << "Handlers query through the fast DB clients of their IO loops";
+    }
+}
 
 drogon::Task<chat::InitialAuthResponse> MessageHandlers::handleAuthInitial(const WsDataPtr& wsDataGuarded, const chat::InitialAuthRequest& req) const {
     chat::InitialAuthResponse resp;
@@ -36,15 +130,16 @@ drogon::Task<chat::InitialAuthResponse> MessageHandlers::handleAuthInitial(const
         co_return resp;
     }
     try {
-        auto users = co_await switch_to_io_loop(CoroMapper<models::Users>(m_dbClient)
-            .findBy(Criteria(models::Users::Cols::_username, CompareOperator::EQ, req.username())));
-        if(users.empty()) {
+        // From the primary, a replica may not have the user who just registered yet.
+        auto user = co_await Repository::findUserByName(writeDb(), req.username());
+        if(!user) {
             common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Invalid credentials.");
             co_return resp;
         }
         wsData->status = USER_STATUS::Authenticating;
-        wsData->user = User{.id = 0, .name = req.username()};
-        if (!users.front().getValueOfSalt().empty()) resp.set_salt(users.front().getValueOfSalt());
+        wsData->user = User{.id = 0, .shared_name = std::make_shared<SharedUserName>(req.username())};
+        wsData->publishView();
+        if (!user->getValueOfSalt().empty()) resp.set_salt(user->getValueOfSalt());
 
         common::setStatus(resp, chat::STATUS_SUCCESS);
         co_return resp;
@@ -63,19 +158,19 @@ drogon::Task<chat::InitialRegisterResponse> MessageHandlers::handleRegisterIniti
         common::setStatus(resp, chat::STATUS_FAILURE, "Empty username or password.");
         co_return resp;
     }
-    if (auto error = validateUtf8String(req.username(), common::limits::MAX_USERNAME_LENGTH, "username")) {
+    if (auto error = validateName(req.username(), common::limits::MAX_USERNAME_LENGTH, "username")) {
         common::setStatus(resp, chat::STATUS_FAILURE, *error);
         co_return resp;
     }
     try {
-        auto users = co_await switch_to_io_loop(CoroMapper<models::Users>(m_dbClient)
-            .findBy(Criteria(models::Users::Cols::_username, CompareOperator::EQ, req.username())));
-        if(!users.empty()) {
+        // Most names tried are free, those the filter rules out need no query.
+        if(UsernameFilter::instance().mayExist(req.username()) && co_await Repository::findUserByName(writeDb(), req.username())) {
             common::setStatus(resp, chat::STATUS_FAILURE, "Username already exists.");
             co_return resp;
         }
         wsData->status = USER_STATUS::Registering;
-        wsData->user = User{.id = 0, .name = req.username() };
+        wsData->user = User{.id = 0, .shared_name = std::make_shared<SharedUserName>(req.username())};
+        wsData->publishView();
         common::setStatus(resp, chat::STATUS_SUCCESS);
         co_return resp;
     } catch(const std::exception& e) {
@@ -84,7 +179,8 @@ drogon::Task<chat::InitialRegisterResponse> MessageHandlers::handleRegisterIniti
     }
 }
 
-drogon::Task<chat::AuthResponse> MessageHandlers::handleAuth(const WsDataPtr& wsDataGuarded, const chat::AuthRequest& req, IChatRoomService& room_service) const {
+template<ChatRoomService RoomService>
+drogon::Task<chat::AuthResponse> MessageHandlers::handleAuth(const WsDataPtr& wsDataGuarded, const chat::AuthRequest& req, RoomService& room_service) const {
     chat::AuthResponse resp;
 
     auto wsData = co_await wsDataGuarded->lock_unique();
@@ -100,16 +196,15 @@ drogon::Task<chat::AuthResponse> MessageHandlers::handleAuth(const WsDataPtr& ws
     }
 
     try {
-        auto users = co_await switch_to_io_loop(CoroMapper<models::Users>(m_dbClient)
-            .findBy(Criteria(models::Users::Cols::_username, CompareOperator::EQ, wsData->user->name)));
+        auto found = co_await Repository::findUserByName(writeDb(), *wsData->user->name());
 
-        if (users.empty()) {
+        if (!found) {
             wsData->status = USER_STATUS::Unauthenticated;
             common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "User not found.");
             co_return resp;
         }
 
-        auto user = users.front();
+        auto user = *found;
         if (req.has_password() && req.has_salt()) {
             if (user.getValueOfSalt().empty()) {
                 if (user.getValueOfHashPassword() != req.password()) {
@@ -150,25 +245,22 @@ drogon::Task<chat::AuthResponse> MessageHandlers::handleAuth(const WsDataPtr& ws
             }
         }
 
-        auto rooms = co_await switch_to_io_loop(CoroMapper<models::Rooms>(m_dbClient).findAll());
-        for(const auto& room : rooms) {
-            chat::RoomInfo* room_info = resp.add_rooms();
-            room_info->set_room_id(room.getValueOfRoomId());
-            room_info->set_room_name(room.getValueOfRoomName());
-            auto membership = co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(m_dbClient)
-                .findBy(Criteria(models::RoomMembership::Cols::_user_id, CompareOperator::EQ, user.getValueOfUserId())
-                     && Criteria(models::RoomMembership::Cols::_room_id, CompareOperator::EQ, room.getValueOfRoomId())));
-            if(membership.size()) {
-                room_info->set_is_joined(membership[0].getValueOfMembershipStatus() == "JOINED");
-            }
-
-        }
+        co_await Repository::loadRoomList(readDb(), user.getValueOfUserId(), req.joined_rooms_only(), *resp.mutable_rooms());
+        answerRoomList(resp, user.getValueOfUserId(), req.joined_rooms_only(),
+                       req.has_rooms_hash() ? std::optional{req.rooms_hash()} : std::nullopt);
         chat::UserInfo* user_info = resp.mutable_authenticated_user();
         user_info->set_user_id(*user.getUserId());
         user_info->set_user_name(*user.getUsername());
-        wsData->user->id = *user.getUserId();
+        // From here on the name is the one shared with the user's other connections.
+        wsData->user = User{.id = *user.getUserId(), .shared_name = UserDirectory::instance().acquire(*user.getUserId(), *user.getUsername())};
+        wsData->publishView();
         wsData->status = USER_STATUS::Authenticated;
+        wsData->admission.authenticated();
         co_await room_service.login(*wsData);
+        wsData->resume_token = SessionTokens::instance().issue(*wsData->user);
+        if(!wsData->resume_token.empty()) {
+            resp.set_resume_token(wsData->resume_token);
+        }
         common::setStatus(resp, chat::STATUS_SUCCESS);
         co_return resp;
     } catch (const std::exception& e) {
@@ -177,6 +269,48 @@ drogon::Task<chat::AuthResponse> MessageHandlers::handleAuth(const WsDataPtr& ws
     }
 }
 
+template<ChatRoomService RoomService>
+drogon::Task<chat::ResumeSessionResponse> MessageHandlers::handleResumeSession(const WsDataPtr& wsDataGuarded, const chat::ResumeSessionRequest& req, RoomService& room_service) const {
+    chat::ResumeSessionResponse resp;
+
+    auto wsData = co_await wsDataGuarded->lock_unique();
+
+    if (wsData->status == USER_STATUS::Authenticated) {
+        common::setStatus(resp, chat::STATUS_FAILURE, "Already authenticated.");
+        co_return resp;
+    }
+
+    auto user = SessionTokens::instance().redeem(req.token());
+    if (!user) {
+        common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Invalid or expired session.");
+        co_return resp;
+    }
+
+    try {
+        if (req.with_rooms()) {
+            co_await Repository::loadRoomList(readDb(), user->id, req.joined_rooms_only(), *resp.mutable_rooms());
+            answerRoomList(resp, user->id, req.joined_rooms_only(), req.has_rooms_hash() ? std::optional{req.rooms_hash()} : std::nullopt);
+        }
+        chat::UserInfo* user_info = resp.mutable_authenticated_user();
+        user_info->set_user_id(user->id);
+        user_info->set_user_name(*user->name());
+        wsData->user = std::move(*user);
+        wsData->publishView();
+        wsData->status = USER_STATUS::Authenticated;
+        wsData->admission.authenticated();
+        co_await room_service.login(*wsData);
+        wsData->resume_token = SessionTokens::instance().issue(*wsData->user);
+        if(!wsData->resume_token.empty()) {
+            resp.set_resume_token(wsData->resume_token);
+        }
+        common::setStatus(resp, chat::STATUS_SUCCESS);
+        co_return resp;
+    } catch (const std::exception& e) {
+        common::setStatus(resp, chat::STATUS_FAILURE, std::string("Resume failed: ") + e.what());
+        co_return resp;
+    }
+}
+
 drogon::Task<chat::RegisterResponse> MessageHandlers::handleRegister(const WsDataPtr& wsDataGuarded, const chat::RegisterRequest& req) const {
     chat::RegisterResponse resp;
 
@@ -196,7 +330,7 @@ drogon::Task<chat::RegisterResponse> MessageHandlers::handleRegister(const WsDat
             [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
                 try {
                     models::Users u;
-                    u.setUsername(wsData->user->name);
+                    u.setUsername(*wsData->user->name());
                     u.setHashPassword(req.hash());
                     u.setSalt(req.salt());
                     co_await switch_to_io_loop(CoroMapper<models::Users>(tx).insert(u));
@@ -216,6 +350,7 @@ drogon::Task<chat::RegisterResponse> MessageHandlers::handleRegister(const WsDat
             common::setStatus(resp, chat::STATUS_FAILURE, *err);
             co_return resp;
         }
+        UsernameFilter::instance().add(*wsData->user->name());
         wsData->status = USER_STATUS::Unauthenticated;
         common::setStatus(resp, chat::STATUS_SUCCESS);
         co_return resp;
@@ -227,16 +362,18 @@ drogon::Task<chat::RegisterResponse> MessageHandlers::handleRegister(const WsDat
     }
 }
 
-drogon::Task<chat::SendMessageResponse> MessageHandlers::handleSendMessage(const WsDataPtr& wsDataGuarded, const chat::SendMessageRequest& req, IChatRoomService& room_service) const {
+template<ChatRoomService RoomService>
+drogon::Task<chat::SendMessageResponse> MessageHandlers::handleSendMessage(const WsData& wsData, const chat::SendMessageRequest& req, RoomService& room_service) const {
     chat::SendMessageResponse resp;
+    if(req.has_client_key()) {
+        resp.set_client_key(req.client_key());
+    }
 
-    auto wsData = co_await wsDataGuarded->lock_shared();
-
-    if(wsData->status != USER_STATUS::Authenticated) {
+    if(wsData.status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "User not authenticated.");
         co_return resp;
     }
-    if(!wsData->room) {
+    if(!wsData.room) {
         common::setStatus(resp, chat::STATUS_FAILURE, "User is not in any room.");
         co_return resp;
     }
@@ -249,33 +386,77 @@ drogon::Task<chat::SendMessageResponse> MessageHandlers::handleSendMessage(const
         co_return resp;
     }
 
-    models::Messages inserted_message;
+    if(req.client_key().size() > common::limits::MAX_CLIENT_KEY_LENGTH) {
+        common::setStatus(resp, chat::STATUS_FAILURE, "'client_key' is too long.");
+        co_return resp;
+    }
 
-    try {
-        auto err = co_await WithTransaction(
-            [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
-                try {
-                    models::Messages m;
-                    m.setMessageText(req.message());
-                    m.setRoomId(wsData->room->id);
-                    m.setUserId(wsData->user->id);
-                    inserted_message = co_await switch_to_io_loop(CoroMapper<models::Messages>(tx).insert(m));
-                    co_return std::nullopt;
-                } catch(const DrogonDbException& e) {
-                    const std::string w = e.base().what();
-                    LOG_ERROR << "Message insert error: " << w;
-                    co_return "Database error during message insertion.";
-                }
-            });
+    const int32_t room_id = wsData.room->id;
+    const int32_t user_id = wsData.user->id;
+    const std::string& client_key = req.client_key();
+    if(!client_key.empty()) {
+        if(auto original = MessageKeys::instance().find(user_id, client_key)) {
+            setSentMessage(resp, *original);
+            co_return resp;
+        }
+    }
 
-        if(err) {
+    const bool optimistic = serverConfig().message_delivery.optimistic;
+    StoredMessage inserted_message{};
+
+    if(optimistic) {
+        // Reserve the identity up front so the message can be broadcast before it is committed.
+        auto [message_id, seq] = co_await when_all(MessageIdAllocator::instance().next(), reserveMessageSeq(room_id));
+        if(!message_id || !seq) {
+            common::setStatus(resp, chat::STATUS_FAILURE, "Database error during message insertion.");
+            co_return resp;
+        }
+        inserted_message = StoredMessage{
+            .message_id = *message_id,
+            .created_at = nextMessageTimestamp(),
+            .seq = *seq,
+        };
+    }
+    if(!client_key.empty() && !optimistic) {
+        // The key is claimed pending, the insert assigns the identity.
+        inserted_message.created_at = nextMessageTimestamp();
+    }
+    const int64_t claimed_at = inserted_message.created_at;
+    if(!client_key.empty()) {
+        std::optional<std::string> claim_error;
+        try {
+            if(auto original = co_await MessageKeys::instance().claim(writeDb(), user_id, client_key, inserted_message)) {
+                if(optimistic) {
+                    co_await releaseMessageSeq(room_id, inserted_message.seq);
+                }
+                setSentMessage(resp, *original);
+                co_return resp;
+            }
+        } catch(const DrogonDbException& e) {
+            LOG_ERROR << "Client key claim error: " << e.base().what();
+            claim_error = "Database error during message insertion.";
+        } catch(const std::exception&) {
+            claim_error = "The message is still being sent, retry it.";
+        }
+        if(claim_error) {
+            if(optimistic) {
+                co_await releaseMessageSeq(room_id, inserted_message.seq);
+            }
+            common::setStatus(resp, chat::STATUS_FAILURE, *claim_error);
+            co_return resp;
+        }
+    }
+    if(!optimistic) {
+        if(auto err = co_await persistMessage(room_id, user_id, req.message(), inserted_message, false)) {
+            if(!client_key.empty()) {
+                co_await MessageKeys::instance().release(writeDb(), user_id, client_key);
+            }
             common::setStatus(resp, chat::STATUS_FAILURE, *err);
             co_return resp;
         }
-    } catch(const std::exception& e) {
-        LOG_ERROR << "Inser message error: " << e.what();
-        common::setStatus(resp, chat::STATUS_FAILURE, std::string("Insert message failed: ") + e.what());
-        co_return resp;
+        if(!client_key.empty()) {
+            co_await MessageKeys::instance().settle(writeDb(), user_id, client_key, claimed_at, inserted_message);
+        }
     }
 
     // Build and broadcast RoomMessage
@@ -285,19 +466,50 @@ drogon::Task<chat::SendMessageResponse> MessageHandlers::handleSendMessage(const
     auto* user_info = message_info->mutable_from();
 
     message_info->set_message(req.message());
-    message_info->set_timestamp(inserted_message.getValueOfCreatedAt());
-    message_info->set_message_id(inserted_message.getValueOfMessageId());
+    message_info->set_timestamp(inserted_message.created_at);
+    message_info->set_message_id(inserted_message.message_id);
+    message_info->set_seq(inserted_message.seq);
 
-    user_info->set_user_id(wsData->user->id);
-    user_info->set_user_name(wsData->user->name);
+    user_info->set_user_id(wsData.user->id);
+    user_info->set_user_name(*wsData.user->name());
+    if(!client_key.empty()) {
+        message_info->set_client_key(client_key);
+    }
 
-    co_await room_service.sendToRoom(wsData->room->id, msgEnv);
+    co_await room_service.sendToRoom(room_id, msgEnv);
+    // Only the broadcast says who sent it, history pages do not.
+    message_info->clear_client_key();
 
-    common::setStatus(resp, chat::STATUS_SUCCESS);
+    const bool history_cache = serverConfig().history_cache.enabled;
+    if(history_cache) {
+        MessageHistoryCache::instance().append(room_id, *message_info);
+    }
+
+    if(optimistic) {
+        if(auto err = co_await persistMessage(room_id, user_id, req.message(), inserted_message, true)) {
+            if(!client_key.empty()) {
+                co_await MessageKeys::instance().release(writeDb(), user_id, client_key);
+            }
+            if(history_cache) {
+                MessageHistoryCache::instance().remove(room_id, inserted_message.message_id);
+            }
+            // The room has already seen the message, take it back.
+            chat::Envelope retractEnv;
+            retractEnv.mutable_message_deleted()->set_message_id(inserted_message.message_id);
+            co_await room_service.sendToRoom(room_id, retractEnv);
+
+            common::setStatus(resp, chat::STATUS_FAILURE, *err);
+            co_return resp;
+        }
+    }
+
+    ChangeFeed::instance().messageSent(room_id, user_id, inserted_message, req.message());
+    setSentMessage(resp, inserted_message);
     co_return resp;
 }
 
-drogon::Task<chat::JoinRoomResponse> MessageHandlers::handleJoinRoom(const WsDataPtr& wsDataGuarded, const chat::JoinRoomRequest& req, IChatRoomService& room_service) const {
+template<ChatRoomService RoomService>
+drogon::Task<chat::JoinRoomResponse> MessageHandlers::handleJoinRoom(const WsDataPtr& wsDataGuarded, const chat::JoinRoomRequest& req, RoomService& room_service) const {
     chat::JoinRoomResponse resp;
 
     auto wsData = co_await wsDataGuarded->lock_unique();
@@ -311,67 +523,106 @@ drogon::Task<chat::JoinRoomResponse> MessageHandlers::handleJoinRoom(const WsDat
         
         if(wsData->room) {
             co_await room_service.leaveCurrentRoom(*wsData);
+            ChangeFeed::instance().memberLeft(wsData->room->id, wsData->user->id, "switch");
             wsData->room.reset();
+            wsData->publishView();
         }
 
-        auto rooms = co_await switch_to_io_loop(CoroMapper<models::Rooms>(m_dbClient)
-            .findBy(Criteria(models::Rooms::Cols::_room_id, CompareOperator::EQ, req.room_id())));
-        if(rooms.empty()) {
+        // Announced before the rights are read, a change of them from now on reaches this connection.
+        wsData->view->publish(wsData->user, CurrentRoom{ req.room_id(), chat::UserRights::REGULAR });
+
+        // None of these depend on each other, they share a single round trip.
+        // The roster comes with effective rights, the precedence mirrors getUserRights:
+        // global admin, then room owner, then stored moderator flag.
+        // On demand, the roster is left to GetRoomMembersRequest and only counted here.
+        const bool members_on_demand = req.members_on_demand();
+        auto [room_opt, membership_status, roster] = co_await when_all(
+            findRoom(req.room_id()),
+            getUserMembershipStatus(writeDb(), wsData->user->id, req.room_id()),
+            members_on_demand ? Repository::countRoomMembers(writeDb(), req.room_id()) : Repository::findRoomRoster(writeDb(), req.room_id()));
+        if(!room_opt) {
             common::setStatus(resp, chat::STATUS_NOT_FOUND, "Room does not exist.");
             co_return resp;
         }
 
-        auto room = rooms.front();
-
-        auto membership_status = co_await getUserMembershipStatus(m_dbClient, wsData->user->id, req.room_id());
+        const auto& room = *room_opt;
 
-        if(room.getValueOfIsPrivate() && (!membership_status || *membership_status != chat::MembershipStatus::JOINED)) {
+        if(room.is_private && (!membership_status || *membership_status != chat::MembershipStatus::JOINED)) {
             common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Cannot join private room.");
             co_return resp;
         }
 
-        if(!room.getValueOfIsPrivate() && (!membership_status || *membership_status != chat::MembershipStatus::JOINED)) {
-            co_await setUserMembershipStatus(m_dbClient, wsData->user->id, req.room_id(), chat::MembershipStatus::JOINED);
+        if(!room.is_private && (!membership_status || *membership_status != chat::MembershipStatus::JOINED)) {
+            co_await setUserMembershipStatus(writeDb(), wsData->user->id, req.room_id(), chat::MembershipStatus::JOINED);
+            ChangeFeed::instance().membershipChanged(req.room_id(), wsData->user->id, chat::MembershipStatus::JOINED);
         }
 
-        auto memberships = co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(m_dbClient)
-            .findBy(Criteria(models::RoomMembership::Cols::_room_id, CompareOperator::EQ, req.room_id())));
-
-        for (const auto& membership : memberships) {
-            auto user_model = co_await switch_to_io_loop(CoroMapper<models::Users>(m_dbClient)
-                .findOne(Criteria(models::Users::Cols::_user_id, CompareOperator::EQ, membership.getValueOfUserId())));
-            if (user_model.getUserId()) {
+        std::optional<chat::UserRights> role;
+        bool found_self = false;
+        if (members_on_demand) {
+            // Counted before a first join added the user's membership.
+            const auto counted = roster.empty() ? 0 : static_cast<uint32_t>(roster[0]["members"].template as<int64_t>());
+            resp.set_member_count(counted + (membership_status ? 0 : 1));
+        } else {
+            for (const auto& row : roster) {
                 auto* user_info = resp.add_all_users();
-                user_info->set_user_id(*user_model.getUserId());
-                user_info->set_user_name(user_model.getValueOfUsername());
-
-                auto rights = co_await getUserRights(m_dbClient, *user_model.getUserId(), req.room_id(), room);
-                if (rights) {
-                    user_info->set_user_room_rights(*rights);
+                user_info->set_user_id(row["user_id"].template as<int32_t>());
+                user_info->set_user_name(row["username"].template as<std::string>());
+
+                std::optional<chat::UserRights> rights;
+                chat::UserRights parsed;
+                if (!row["rights"].isNull() && chat::UserRights_Parse(row["rights"].template as<std::string>(), &parsed)) {
+                    rights = parsed;
+                    user_info->set_user_room_rights(parsed);
+                }
+                if (user_info->user_id() == wsData->user->id) {
+                    found_self = true;
+                    role = rights;
                 }
             }
         }
 
-        std::optional<chat::UserRights> role = co_await getUserRights(m_dbClient, wsData->user->id, req.room_id(), room);
-        wsData->room = CurrentRoom{ req.room_id(), role.value_or(chat::UserRights::REGULAR) };
-
-        chat::Envelope user_joined_msg;
-        auto* joined_payload = user_joined_msg.mutable_user_joined();
-        joined_payload->mutable_user()->set_user_id(wsData->user->id);
-        joined_payload->mutable_user()->set_user_name(wsData->user->name);
-        joined_payload->mutable_user()->set_user_room_rights(wsData->room->rights);
-        co_await room_service.sendToRoom(wsData->room->id, user_joined_msg);
-        
-        if(!membership_status) {
-            co_await room_service.sendToRoom(wsData->room->id, user_joined_msg);
+        if (!found_self) {
+            // Joining for the first time, the roster was read before the membership existed, or not read at all.
+            role = co_await getUserRights(writeDb(), wsData->user->id, req.room_id(), room);
+            auto* user_info = resp.add_all_users();
+            user_info->set_user_id(wsData->user->id);
+            user_info->set_user_name(*wsData->user->name());
+            if (role) {
+                user_info->set_user_room_rights(*role);
+            }
         }
+        if (!members_on_demand) {
+            resp.set_member_count(static_cast<uint32_t>(resp.all_users_size()));
+        }
+        wsData->room = CurrentRoom{ req.room_id(), role.value_or(chat::UserRights::REGULAR) };
+        wsData->publishView();
 
-        co_await room_service.joinRoom(*wsData);
-
-        auto active_users_list = co_await room_service.getUsersInRoom(req.room_id(), *wsData);
+        // The room learns about the join, and about a new member, from its next presence delta.
+        co_await room_service.joinRoom(*wsData, !membership_status);
+        ChangeFeed::instance().memberJoined(req.room_id(), wsData->user->id, !membership_status);
 
-        *resp.mutable_active_users() = { std::make_move_iterator(active_users_list.begin()),
-                                        std::make_move_iterator(active_users_list.end()) };
+        std::optional<RosterVersion> known_roster;
+        if(req.has_presence_epoch() && req.has_presence_seq()) {
+            known_roster = RosterVersion{ req.presence_epoch(), req.presence_seq() };
+        }
+        auto active_roster = co_await room_service.getUsersInRoom(req.room_id(), known_roster);
+
+        *resp.mutable_active_users() = { std::make_move_iterator(active_roster.users.begin()),
+                                        std::make_move_iterator(active_roster.users.end()) };
+        *resp.mutable_missed_presence() = { std::make_move_iterator(active_roster.missed.begin()),
+                                            std::make_move_iterator(active_roster.missed.end()) };
+        resp.set_room_id(req.room_id());
+        resp.set_presence_epoch(active_roster.presence_epoch);
+        resp.set_presence_seq(active_roster.presence_seq);
+        resp.set_presence_incremental(active_roster.incremental);
+
+        // Served like the GetMessagesRequest it spares, from the history cache when it holds the room.
+        if(req.has_history()) {
+            auto history = req.history();
+            history.set_limit(std::clamp(history.limit(), -common::limits::MAX_JOIN_HISTORY, common::limits::MAX_JOIN_HISTORY));
+            co_await handleGetMessages(*wsData, history, *resp.mutable_history());
+        }
 
         common::setStatus(resp, chat::STATUS_SUCCESS);
         co_return resp;
@@ -382,7 +633,8 @@ drogon::Task<chat::JoinRoomResponse> MessageHandlers::handleJoinRoom(const WsDat
     }
 }
 
-drogon::Task<chat::LeaveRoomResponse> MessageHandlers::handleLeaveRoom(const WsDataPtr& wsDataGuarded, const chat::LeaveRoomRequest&, IChatRoomService& room_service) const {
+template<ChatRoomService RoomService>
+drogon::Task<chat::LeaveRoomResponse> MessageHandlers::handleLeaveRoom(const WsDataPtr& wsDataGuarded, const chat::LeaveRoomRequest&, RoomService& room_service) const {
     chat::LeaveRoomResponse resp;
 
     auto wsData = co_await wsDataGuarded->lock_unique();
@@ -397,13 +649,16 @@ drogon::Task<chat::LeaveRoomResponse> MessageHandlers::handleLeaveRoom(const WsD
     }
 
     co_await room_service.leaveCurrentRoom(*wsData);
+    ChangeFeed::instance().memberLeft(wsData->room->id, wsData->user->id, "leave");
     wsData->room.reset();
+    wsData->publishView();
 
     common::setStatus(resp, chat::STATUS_SUCCESS);
     co_return resp;
 }
 
-drogon::Task<chat::CreateRoomResponse> MessageHandlers::handleCreateRoom(const WsDataPtr& wsDataGuarded, const chat::CreateRoomRequest& req, IChatRoomService& room_service) const {
+template<ChatRoomService RoomService>
+drogon::Task<chat::CreateRoomResponse> MessageHandlers::handleCreateRoom(const WsDataPtr& wsDataGuarded, const chat::CreateRoomRequest& req, RoomService& room_service) const {
     chat::CreateRoomResponse resp;
 
     auto wsData = co_await wsDataGuarded->lock_shared();
@@ -416,7 +671,7 @@ drogon::Task<chat::CreateRoomResponse> MessageHandlers::handleCreateRoom(const W
         common::setStatus(resp, chat::STATUS_FAILURE, "Empty room name.");
         co_return resp;
     }
-    if (auto error = validateUtf8String(req.room_name(), common::limits::MAX_ROOMNAME_LENGTH, "room name")) {
+    if (auto error = validateName(req.room_name(), common::limits::MAX_ROOMNAME_LENGTH, "room name")) {
         common::setStatus(resp, chat::STATUS_FAILURE, *error);
         co_return resp;
     }
@@ -448,6 +703,7 @@ drogon::Task<chat::CreateRoomResponse> MessageHandlers::handleCreateRoom(const W
             common::setStatus(resp, chat::STATUS_FAILURE, *err);
             co_return resp;
         }
+        RoomDataCache::instance().invalidateRoomUser(room_id, wsData->user->id);
 
         chat::Envelope new_room_msg;
         auto* new_room_resp = new_room_msg.mutable_new_room_created();
@@ -455,7 +711,7 @@ drogon::Task<chat::CreateRoomResponse> MessageHandlers::handleCreateRoom(const W
         new_room_resp->mutable_room()->set_room_name(req.room_name());
         new_room_resp->mutable_room()->mutable_owner()->set_user_id(wsData->user->id);
 
-        co_await room_service.sendToAll(new_room_msg);
+        co_await room_service.sendToDirectory(room_id, new_room_msg);
         common::setStatus(resp, chat::STATUS_SUCCESS);
         co_return resp;
     } catch(const std::exception& e) {
@@ -465,60 +721,297 @@ drogon::Task<chat::CreateRoomResponse> MessageHandlers::handleCreateRoom(const W
     }
 }
 
-drogon::Task<chat::GetMessagesResponse> MessageHandlers::handleGetMessages(const WsDataPtr& wsDataGuarded, const chat::GetMessagesRequest& req) const {
-    chat::GetMessagesResponse resp;
+/// @brief Moves a page into `resp.packed` when the client asked for it and the server offers it.
+template <typename Request, typename Response>
+static void packPage(const Request& req, Response& resp) {
+    if(req.packed() && serverConfig().compression.packed_history) {
+        common::packMessages(resp.message(), *resp.mutable_packed());
+        resp.clear_message();
+    }
+}
 
-    auto wsData = co_await wsDataGuarded->lock_shared();
+drogon::Task<> MessageHandlers::handleGetMessages(const WsData& wsData, const chat::GetMessagesRequest& req, chat::GetMessagesResponse& resp) const {
+    if(wsData.status != USER_STATUS::Authenticated) {
+        common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "User not authenticated.");
+        co_return;
+    }
+    if(!wsData.room) {
+        common::setStatus(resp, chat::STATUS_FAILURE, "User is not in any room.");
+        co_return;
+    }
+    try {
+        const int32_t room_id = wsData.room->id;
+        const auto limit = req.limit();
+        const auto key = req.offset_seq() != 0 ? HistoryKey::Seq : HistoryKey::Timestamp;
+        const int64_t offset = key == HistoryKey::Seq ? req.offset_seq() : req.offset_ts();
+
+        LOG_TRACE << "Limit: " << limit << (key == HistoryKey::Seq ? ", seq: " : ", ts: ") << offset;
+
+        if(serverConfig().history_cache.enabled) {
+            auto& cache = MessageHistoryCache::instance();
+            // The first request for an older page of an uncached room loads the whole tail in one query.
+            // It reads the primary: a lagging replica would leave a gap the tail could never notice.
+            if(limit > 0 && !cache.contains(room_id)) {
+                if(!DbCircuitBreaker::instance().allow()) {
+                    common::setStatus(resp, chat::STATUS_UNAVAILABLE, "The server is busy, try again later.");
+                    co_return;
+                }
+                const auto capacity = std::max<size_t>(serverConfig().history_cache.messages_per_room, 1);
+                const auto version = cache.version(room_id);
+                auto tail = co_await Repository::findMessagesPage(writeDb(), room_id, static_cast<int32_t>(capacity), std::numeric_limits<int64_t>::max(), HistoryKey::Seq);
+                const bool has_all = tail.size() < capacity;
+                cache.fill(room_id, std::move(tail), has_all, version);
+            }
+            if(cache.find(room_id, limit, offset, *resp.mutable_message(), key)) {
+                packPage(req, resp);
+                common::setStatus(resp, chat::STATUS_SUCCESS);
+                co_return;
+            }
+        }
 
-    if(wsData->status != USER_STATUS::Authenticated) {
+        // Only the pages the cache cannot serve are shed, the latest ones keep working while the database struggles.
+        if(!DbCircuitBreaker::instance().allow()) {
+            common::setStatus(resp, chat::STATUS_UNAVAILABLE, "The server is busy, try again later.");
+            co_return;
+        }
+        co_await Repository::findMessagesPage(readDb(), room_id, limit, offset, *resp.mutable_message(), key);
+        packPage(req, resp);
+        common::setStatus(resp, chat::STATUS_SUCCESS);
+    } catch(const std::exception& e) {
+        resp.clear_message();
+        common::setStatus(resp, chat::STATUS_FAILURE, "Failed to retrieve messages: " + std::string(e.what()));
+    }
+}
+
+/// Messages on each side of the anchor of a GetMessagesAround response when the request asks for none, and at most.
+static constexpr int32_t AROUND_DEFAULT_LIMIT = 25;
+static constexpr int32_t AROUND_MAX_LIMIT = 100;
+
+drogon::Task<> MessageHandlers::handleGetMessagesAround(const WsData& wsData, const chat::GetMessagesAroundRequest& req, chat::GetMessagesAroundResponse& resp) const {
+    resp.set_message_id(req.message_id());
+    if(wsData.status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "User not authenticated.");
-        co_return resp;
+        co_return;
     }
-    if(!wsData->room) {
+    if(!wsData.room) {
         common::setStatus(resp, chat::STATUS_FAILURE, "User is not in any room.");
-        co_return resp;
+        co_return;
     }
     try {
-        
-        auto limit = req.limit();
-
-        LOG_TRACE << "Limit: " + std::to_string(limit);
-        LOG_TRACE << "Ts: " + std::to_string(req.offset_ts());
-
-        auto criteria = Criteria(models::Messages::Cols::_created_at, 
-                                limit > 0 ? CompareOperator::LT : CompareOperator::GT, 
-                                req.offset_ts());
-        auto order = limit > 0 ? SortOrder::DESC : SortOrder::ASC;
-        limit = std::abs(limit);
-
-        auto messages = co_await switch_to_io_loop(CoroMapper<models::Messages>(m_dbClient)
-            .orderBy(models::Messages::Cols::_created_at, order)
-            .limit(limit)
-            .findBy(Criteria(models::Messages::Cols::_room_id, CompareOperator::EQ, wsData->room->id) && criteria));
-
-        for(const auto& message : messages) {
-            auto* message_info = resp.add_message();
-            message_info->set_message(message.getValueOfMessageText());
-            LOG_TRACE << std::string("Message text \"") + message.getValueOfMessageText() + "\"";
-            message_info->set_timestamp(message.getValueOfCreatedAt());
-            LOG_TRACE << std::string("Message timestamp \"") + std::to_string(message.getValueOfCreatedAt()) + "\"";
-            message_info->set_message_id(message.getValueOfMessageId());
-            LOG_TRACE << std::string("Message id \"") + std::to_string(message.getValueOfMessageId()) + "\"";
-            auto* user_info = message_info->mutable_from();
-            auto user = message.getUser(m_dbClient); //TODO this is blocking
-
-            user_info->set_user_id(user.getValueOfUserId());
-            user_info->set_user_name(user.getValueOfUsername());
+        const auto count = [](int32_t asked) { return asked > 0 ? std::min(asked, AROUND_MAX_LIMIT) : AROUND_DEFAULT_LIMIT; };
+        if(!DbCircuitBreaker::instance().allow()) {
+            common::setStatus(resp, chat::STATUS_UNAVAILABLE, "The server is busy, try again later.");
+            co_return;
+        }
+        const auto window = co_await Repository::findMessagesAround(readDb(), wsData.room->id, req.message_id(), count(req.before()), count(req.after()),
+                                                                    *resp.mutable_message());
+        if(!window.found) {
+            common::setStatus(resp, chat::STATUS_FAILURE, "Message not found.");
+            co_return;
         }
+        resp.set_has_older(window.has_older);
+        resp.set_has_newer(window.has_newer);
+        packPage(req, resp);
         common::setStatus(resp, chat::STATUS_SUCCESS);
-        co_return resp;
     } catch(const std::exception& e) {
+        resp.clear_message();
         common::setStatus(resp, chat::STATUS_FAILURE, "Failed to retrieve messages: " + std::string(e.what()));
-        co_return resp;
     }
 }
 
-drogon::Task<chat::LogoutResponse> MessageHandlers::handleLogoutUser(const WsDataPtr& wsDataGuarded, IChatRoomService& room_service) const {
+/// Messages and tombstones read per SyncRoom response, each.
+static constexpr int32_t SYNC_PAGE_LIMIT = 500;
+
+drogon::Task<> MessageHandlers::handleSyncRoom(const WsData& wsData, const chat::SyncRoomRequest& req, chat::SyncRoomResponse& resp) const {
+    if(wsData.status != USER_STATUS::Authenticated) {
+        common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "User not authenticated.");
+        co_return;
+    }
+    if(!wsData.room || wsData.room->id != req.room_id()) {
+        common::setStatus(resp, chat::STATUS_FAILURE, "User is not in this room.");
+        co_return;
+    }
+    if(req.has_since_seq()) {
+        co_await syncRoomBySeq(req, resp);
+        co_return;
+    }
+    try {
+        const int32_t room_id = req.room_id();
+        const int64_t since = req.since_cursor();
+        // One more than a page, to tell a full page from a truncated one.
+        co_await Repository::findMessagesPage(readDb(), room_id, -(SYNC_PAGE_LIMIT + 1), since, *resp.mutable_messages());
+        auto tombstones = co_await Repository::findTombstones(readDb(), room_id, since, std::numeric_limits<int64_t>::max(), SYNC_PAGE_LIMIT + 1);
+
+        auto& messages = *resp.mutable_messages();
+        const bool more_messages = messages.size() > SYNC_PAGE_LIMIT;
+        const bool more_tombstones = tombstones.size() > static_cast<size_t>(SYNC_PAGE_LIMIT);
+        if(more_messages) {
+            messages.DeleteSubrange(SYNC_PAGE_LIMIT, messages.size() - SYNC_PAGE_LIMIT);
+        }
+        if(more_tombstones) {
+            tombstones.resize(SYNC_PAGE_LIMIT);
+        }
+
+        // A truncated list is only complete up to its last entry, the cursor can't go past it.
+        int64_t cursor = std::numeric_limits<int64_t>::max();
+        if(more_messages) {
+            cursor = std::min(cursor, messages.rbegin()->timestamp());
+        }
+        if(more_tombstones) {
+            cursor = std::min(cursor, tombstones.back().second);
+        }
+        if(more_messages || more_tombstones) {
+            while(!messages.empty() && messages.rbegin()->timestamp() > cursor) {
+                messages.RemoveLast();
+            }
+            std::erase_if(tombstones, [cursor](const auto& tombstone) { return tombstone.second > cursor; });
+        } else {
+            cursor = since;
+            if(!messages.empty()) {
+                cursor = std::max(cursor, messages.rbegin()->timestamp());
+            }
+            if(!tombstones.empty()) {
+                cursor = std::max(cursor, tombstones.back().second);
+            }
+        }
+
+        resp.mutable_deleted_message_ids()->Reserve(static_cast<int>(tombstones.size()));
+        for(const auto& [message_id, deleted_at] : tombstones) {
+            resp.add_deleted_message_ids(message_id);
+        }
+        resp.set_cursor(cursor);
+        resp.set_has_more(more_messages || more_tombstones);
+        common::setStatus(resp, chat::STATUS_SUCCESS);
+    } catch(const std::exception& e) {
+        resp.clear_messages();
+        resp.clear_deleted_message_ids();
+        common::setStatus(resp, chat::STATUS_FAILURE, "Failed to sync room: " + std::string(e.what()));
+    }
+}
+
+drogon::Task<> MessageHandlers::handleMarkRoomRead(const WsData& wsData, const chat::MarkRoomReadRequest& req, chat::MarkRoomReadResponse& resp) const {
+    if(wsData.status != USER_STATUS::Authenticated) {
+        common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "User not authenticated.");
+        co_return;
+    }
+    try {
+        co_await Repository::markRoomRead(writeDb(), wsData.user->id, req.room_id(), req.seq());
+        common::setStatus(resp, chat::STATUS_SUCCESS);
+    } catch(const std::exception& e) {
+        LOG_ERROR << "Mark room read error: " << e.what();
+        common::setStatus(resp, chat::STATUS_FAILURE, "Failed to mark the room read.");
+    }
+}
+
+drogon::Task<> MessageHandlers::syncRoomBySeq(const chat::SyncRoomRequest& req, chat::SyncRoomResponse& resp) const {
+    try {
+        const int32_t room_id = req.room_id();
+        const int64_t since_seq = req.since_seq();
+        const int64_t since = req.since_cursor();
+        // A message broadcast before it was inserted may commit after ones with a higher seq, so the
+        // cursor stops below the lowest seq still reserved. Read first, the messages read after it
+        // include every one up to it, even on a lagging replica.
+        const auto settled_seq = co_await Repository::findSettledSeq(readDb(), room_id);
+        co_await Repository::findMessagesPage(readDb(), room_id, -(SYNC_PAGE_LIMIT + 1), since_seq, *resp.mutable_messages(), HistoryKey::Seq);
+        auto tombstones = co_await Repository::findTombstones(readDb(), room_id, since, std::numeric_limits<int64_t>::max(), SYNC_PAGE_LIMIT + 1);
+
+        // Each list has its own cursor, a truncated one only moves up to its last entry.
+        auto& messages = *resp.mutable_messages();
+        const bool more_messages = messages.size() > SYNC_PAGE_LIMIT;
+        const bool more_tombstones = tombstones.size() > static_cast<size_t>(SYNC_PAGE_LIMIT);
+        if(more_messages) {
+            messages.DeleteSubrange(SYNC_PAGE_LIMIT, messages.size() - SYNC_PAGE_LIMIT);
+        }
+        if(more_tombstones) {
+            tombstones.resize(SYNC_PAGE_LIMIT);
+        }
+
+        resp.mutable_deleted_message_ids()->Reserve(static_cast<int>(tombstones.size()));
+        for(const auto& [message_id, deleted_at] : tombstones) {
+            resp.add_deleted_message_ids(message_id);
+        }
+        // A full page ends at its last message, the messages after the settled seq come again next time.
+        const int64_t page_end = more_messages ? messages.rbegin()->seq() : std::numeric_limits<int64_t>::max();
+        resp.set_seq_cursor(std::max(since_seq, std::min(page_end, settled_seq.value_or(since_seq))));
+        resp.set_cursor(tombstones.empty() ? since : std::max(since, tombstones.back().second));
+        resp.set_has_more(more_messages || more_tombstones);
+        common::setStatus(resp, chat::STATUS_SUCCESS);
+    } catch(const std::exception& e) {
+        resp.clear_messages();
+        resp.clear_deleted_message_ids();
+        common::setStatus(resp, chat::STATUS_FAILURE, "Failed to sync room: " + std::string(e.what()));
+    }
+}
+
+/// Hits per SearchMessages response when the request asks for none, and at most.
+static constexpr int32_t SEARCH_DEFAULT_LIMIT = 20;
+static constexpr int32_t SEARCH_MAX_LIMIT = 50;
+
+drogon::Task<> MessageHandlers::handleSearchMessages(const WsData& wsData, const chat::SearchMessagesRequest& req, chat::SearchMessagesResponse& resp) const {
+    if(wsData.status != USER_STATUS::Authenticated) {
+        common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "User not authenticated.");
+        co_return;
+    }
+    if(req.query().empty()) {
+        common::setStatus(resp, chat::STATUS_FAILURE, "Empty 'query' field.");
+        co_return;
+    }
+    if (auto error = validateUtf8String(req.query(), common::limits::MAX_SEARCH_QUERY_LENGTH, "search query")) {
+        common::setStatus(resp, chat::STATUS_FAILURE, *error);
+        co_return;
+    }
+    try {
+        const int32_t limit = req.limit() > 0 ? std::min(req.limit(), SEARCH_MAX_LIMIT) : SEARCH_DEFAULT_LIMIT;
+        const int64_t before = req.before_ts() > 0 ? req.before_ts() : std::numeric_limits<int64_t>::max();
+        co_await Repository::searchMessages(readDb(), wsData.user->id, req.query(), req.room_id(), before, limit + 1, *resp.mutable_hits());
+
+        auto& hits = *resp.mutable_hits();
+        resp.set_has_more(hits.size() > limit);
+        if(hits.size() > limit) {
+            hits.DeleteSubrange(limit, hits.size() - limit);
+        }
+        common::setStatus(resp, chat::STATUS_SUCCESS);
+    } catch(const std::exception& e) {
+        resp.clear_hits();
+        common::setStatus(resp, chat::STATUS_FAILURE, "Failed to search messages: " + std::string(e.what()));
+    }
+}
+
+static constexpr int32_t MEMBERS_DEFAULT_LIMIT = 100;
+static constexpr int32_t MEMBERS_MAX_LIMIT = 500;
+
+drogon::Task<> MessageHandlers::handleGetRoomMembers(const WsData& wsData, const chat::GetRoomMembersRequest& req, chat::GetRoomMembersResponse& resp) const {
+    if(wsData.status != USER_STATUS::Authenticated) {
+        common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "User not authenticated.");
+        co_return;
+    }
+    if(!wsData.room || wsData.room->id != req.room_id()) {
+        common::setStatus(resp, chat::STATUS_FAILURE, "User is not in the specified room.");
+        co_return;
+    }
+    if (auto error = validateUtf8String(req.prefix(), common::limits::MAX_USERNAME_LENGTH, "prefix")) {
+        common::setStatus(resp, chat::STATUS_FAILURE, *error);
+        co_return;
+    }
+    try {
+        const int32_t limit = req.limit() > 0 ? static_cast<int32_t>(std::min<uint32_t>(req.limit(), MEMBERS_MAX_LIMIT)) : MEMBERS_DEFAULT_LIMIT;
+        auto& members = *resp.mutable_members();
+        co_await Repository::findRoomMembers(readDb(), req.room_id(), req.prefix(), req.has_after() ? &req.after() : nullptr, limit + 1, members);
+
+        resp.set_has_more(members.size() > limit);
+        if(members.size() > limit) {
+            members.DeleteSubrange(limit, members.size() - limit);
+        }
+        resp.set_room_id(req.room_id());
+        common::setStatus(resp, chat::STATUS_SUCCESS);
+    } catch(const std::exception& e) {
+        resp.clear_members();
+        common::setStatus(resp, chat::STATUS_FAILURE, "Failed to list room members: " + std::string(e.what()));
+    }
+}
+
+template<ChatRoomService RoomService>
+drogon::Task<chat::LogoutResponse> MessageHandlers::handleLogoutUser(const WsDataPtr& wsDataGuarded, RoomService& room_service) const {
     chat::LogoutResponse resp;
 
     auto wsData = co_await wsDataGuarded->lock_unique();
@@ -528,14 +1021,21 @@ drogon::Task<chat::LogoutResponse> MessageHandlers::handleLogoutUser(const WsDat
         co_return resp;
     }
     co_await room_service.logout(*wsData);
+    if(wsData->room) {
+        ChangeFeed::instance().memberLeft(wsData->room->id, wsData->user->id, "logout");
+    }
+    SessionTokens::instance().revoke(wsData->resume_token);
+    wsData->resume_token.clear();
     wsData->room.reset();
     wsData->user.reset();
+    wsData->publishView();
     wsData->status = USER_STATUS::Unauthenticated;
     common::setStatus(resp, chat::STATUS_SUCCESS);
     co_return resp;
 }
 
-drogon::Task<chat::RenameRoomResponse> MessageHandlers::handleRenameRoom(const WsDataPtr& wsDataGuarded, const chat::RenameRoomRequest& req, IChatRoomService& room_service) {
+template<ChatRoomService RoomService>
+drogon::Task<chat::RenameRoomResponse> MessageHandlers::handleRenameRoom(const WsDataPtr& wsDataGuarded, const chat::RenameRoomRequest& req, RoomService& room_service) {
     chat::RenameRoomResponse resp;
 
     auto wsData = co_await wsDataGuarded->lock_shared();
@@ -548,6 +1048,10 @@ drogon::Task<chat::RenameRoomResponse> MessageHandlers::handleRenameRoom(const W
         common::setStatus(resp, chat::STATUS_FAILURE, "Empty room name or id.");
         co_return resp;
     }
+    if (auto error = validateName(req.name(), common::limits::MAX_ROOMNAME_LENGTH, "room name")) {
+        common::setStatus(resp, chat::STATUS_FAILURE, *error);
+        co_return resp;
+    }
     if(!wsData->room || wsData->room->id != req.room_id()) {
         common::setStatus(resp, chat::STATUS_FAILURE, "User is not in the specified room.");
         co_return resp;
@@ -567,6 +1071,7 @@ drogon::Task<chat::RenameRoomResponse> MessageHandlers::handleRenameRoom(const W
                     }
                     room.setRoomName(req.name());
                     co_await switch_to_io_loop(CoroMapper<models::Rooms>(tx).update(room));
+                    co_await CacheInvalidation::instance().notifyRoom(tx, req.room_id());
                     co_return std::nullopt;
                 } catch(const DrogonDbException& e) {
                     const std::string w = e.base().what();
@@ -579,12 +1084,13 @@ drogon::Task<chat::RenameRoomResponse> MessageHandlers::handleRenameRoom(const W
             common::setStatus(resp, chat::STATUS_FAILURE, *err);
             co_return resp;
         }
+        RoomDataCache::instance().invalidateRoom(req.room_id());
 
         chat::Envelope env;
         auto* new_name = env.mutable_new_room_name();
         new_name->set_room_id(wsData->room->id);
         new_name->set_name(req.name());
-        co_await room_service.sendToAll(env);
+        co_await room_service.sendToDirectory(wsData->room->id, env);
         common::setStatus(resp, chat::STATUS_SUCCESS);
         co_return resp;
     } catch(const std::exception& e) {
@@ -594,7 +1100,8 @@ drogon::Task<chat::RenameRoomResponse> MessageHandlers::handleRenameRoom(const W
     }
 }
 
-drogon::Task<chat::DeleteRoomResponse> MessageHandlers::handleDeleteRoom(const WsDataPtr& wsDataGuarded, const chat::DeleteRoomRequest& req, IChatRoomService& room_service) {
+template<ChatRoomService RoomService>
+drogon::Task<chat::DeleteRoomResponse> MessageHandlers::handleDeleteRoom(const WsDataPtr& wsDataGuarded, const chat::DeleteRoomRequest& req, RoomService& room_service) {
     chat::DeleteRoomResponse resp;
 
     auto wsData = co_await wsDataGuarded->lock_shared();
@@ -621,6 +1128,7 @@ drogon::Task<chat::DeleteRoomResponse> MessageHandlers::handleDeleteRoom(const W
                 if (deleted_count == 0) {
                     co_return "Room could not be deleted as it was not found.";
                 }
+                co_await CacheInvalidation::instance().notifyRoom(tx, room_id);
                 co_return std::nullopt;
             } catch(const DrogonDbException& e) {
                 const std::string w = e.base().what();
@@ -638,12 +1146,15 @@ drogon::Task<chat::DeleteRoomResponse> MessageHandlers::handleDeleteRoom(const W
         common::setStatus(resp, chat::STATUS_FAILURE, std::string("Delete room failed: ") + e.what());
         co_return resp;
     }
+    RoomDataCache::instance().invalidateRoom(room_id);
+    MessageHistoryCache::instance().dropRoom(room_id);
     co_await room_service.onRoomDeleted(room_id);
     common::setStatus(resp, chat::STATUS_SUCCESS);
     co_return resp;
 }
 
-drogon::Task<chat::AssignRoleResponse> MessageHandlers::handleAssignRole(const WsDataPtr& wsDataGuarded, const chat::AssignRoleRequest& req, IChatRoomService& room_service) {
+template<ChatRoomService RoomService>
+drogon::Task<chat::AssignRoleResponse> MessageHandlers::handleAssignRole(const WsDataPtr& wsDataGuarded, const chat::AssignRoleRequest& req, RoomService& room_service) {
     chat::AssignRoleResponse resp;
 
     //unfortunately, we need unique lock here
@@ -664,7 +1175,10 @@ drogon::Task<chat::AssignRoleResponse> MessageHandlers::handleAssignRole(const W
 
     try {
         //do ALL db operations first, inside SINGLE transaction
-        auto err = co_await WithTransaction([&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
+        // two concurrent ownership transfers lock the same rows in opposite order, the loser of the deadlock runs again
+        auto err = co_await WithTransaction({.retries = 2}, [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
+            oldOwnerId = 0;
+            oldOwnerNewRole_optional.reset();
             auto targetUserRightsOpt = co_await this->getUserRights(tx, req.user_id(), req.room_id());
             auto targetUserRights = targetUserRightsOpt.value_or(chat::UserRights::REGULAR);
 
@@ -696,7 +1210,7 @@ drogon::Task<chat::AssignRoleResponse> MessageHandlers::handleAssignRole(const W
                 if(oldOwnerId) {
                     //step 4
                     //if there was an old owner, then fetch their current role as per db
-                    oldOwnerNewRole_optional = co_await getUserRights(tx, oldOwnerId, req.room_id(), room);
+                    oldOwnerNewRole_optional = co_await getUserRights(tx, oldOwnerId, req.room_id(), toCachedRoom(room));
 
                     //step 5
                     //if old owner is not a global admin, or had no explicit record for role, or if that role is below `MODERATOR`
@@ -718,10 +1232,14 @@ drogon::Task<chat::AssignRoleResponse> MessageHandlers::handleAssignRole(const W
                     co_return inner_err;
                 }
             }
+            co_await CacheInvalidation::instance().notifyRoom(tx, req.room_id());
 
             co_return std::nullopt;
         });
 
+        // drop cached owner and roles of the room whatever the outcome, a failed commit may still have applied
+        RoomDataCache::instance().invalidateRoom(req.room_id());
+
         if(err) {
             common::setStatus(resp, chat::STATUS_FAILURE, *err);
             co_return resp;
@@ -732,8 +1250,10 @@ drogon::Task<chat::AssignRoleResponse> MessageHandlers::handleAssignRole(const W
 
         if(oldOwnerId) { //special case, owner change
             co_await room_service.updateUserRoomRights(oldOwnerId, req.room_id(), *oldOwnerNewRole_optional, *wsData);
+            ChangeFeed::instance().roleChanged(req.room_id(), oldOwnerId, *oldOwnerNewRole_optional, wsData->user->id);
         }
         co_await room_service.updateUserRoomRights(req.user_id(), req.room_id(), req.new_role(), *wsData);
+        ChangeFeed::instance().roleChanged(req.room_id(), req.user_id(), req.new_role(), wsData->user->id);
 
         common::setStatus(resp, chat::STATUS_SUCCESS);
         co_return resp;
@@ -744,51 +1264,161 @@ drogon::Task<chat::AssignRoleResponse> MessageHandlers::handleAssignRole(const W
     }
 }
 
+drogon::Task<ScopedTransactionResult> MessageHandlers::persistMessage(int32_t room_id, int32_t user_id, const std::string& text, StoredMessage& stored, bool reserved) const {
+    auto error = co_await insertMessage(room_id, user_id, text, stored, reserved);
+    if(error && reserved) {
+        co_await releaseMessageSeq(room_id, stored.seq);
+    }
+    co_return error;
+}
+
+drogon::Task<ScopedTransactionResult> MessageHandlers::insertMessage(int32_t room_id, int32_t user_id, const std::string& text, StoredMessage& stored, bool reserved) const {
+    if(serverConfig().message_batching.enabled) {
+        auto result = reserved
+            ? co_await MessageBatcher::instance().insert(room_id, user_id, text, stored.created_at, stored.message_id, stored.seq)
+            : co_await MessageBatcher::instance().insert(room_id, user_id, text, nextMessageTimestamp());
+        if(!result) {
+            co_return "Database error during message insertion.";
+        }
+        stored = *result;
+        co_return std::nullopt;
+    }
+
+    try {
+        if(reserved) {
+            co_await Repository::insertMessage(writeDb(), stored, room_id, user_id, text);
+        } else {
+            stored = co_await Repository::insertMessage(writeDb(), room_id, user_id, text);
+        }
+        co_return std::nullopt;
+    } catch(const DrogonDbException& e) {
+        LOG_ERROR << "Message insert error: " << e.base().what();
+        co_return "Database error during message insertion.";
+    } catch(const std::exception& e) {
+        LOG_ERROR << "Insert message error: " << e.what();
+        co_return std::string("Insert message failed: ") + e.what();
+    }
+}
+
+drogon::Task<std::optional<int64_t>> MessageHandlers::reserveMessageSeq(int32_t room_id) const {
+    try {
+        co_return co_await Repository::reserveMessageSeq(writeDb(), room_id);
+    } catch(const DrogonDbException& e) {
+        LOG_ERROR << "Message seq reservation error: " << e.base().what();
+        co_return std::nullopt;
+    }
+}
+
+drogon::Task<> MessageHandlers::releaseMessageSeq(int32_t room_id, int64_t seq) const {
+    try {
+        co_await Repository::releaseMessageSeq(writeDb(), room_id, seq);
+    } catch(const DrogonDbException& e) {
+        // The reservation expires on its own, syncs of the room hold their cursor until then.
+        LOG_ERROR << "Message seq release error: " << e.base().what();
+    }
+}
+
 drogon::Task<std::optional<chat::UserRights>> MessageHandlers::getUserRights(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id) const {
-    // 1. Fetch the room object.
+    // 1. Fetch the room object, from the cache unless we are inside a transaction.
+    if(!isTransaction(db)) {
+        auto room = co_await findRoom(room_id);
+        if(!room) {
+            throw std::runtime_error("Room not found.");
+        }
+        co_return co_await getUserRights(db, user_id, room_id, *room);
+    }
+
     auto room = co_await switch_to_io_loop(CoroMapper<models::Rooms>(db)
         .findOne(Criteria(models::Rooms::Cols::_room_id, CompareOperator::EQ, room_id)));
         
     // 2. Delegate to the second overload, passing the fetched room.
-    co_return co_await getUserRights(db, user_id, room_id, room);
+    co_return co_await getUserRights(db, user_id, room_id, toCachedRoom(room));
 }
 
-drogon::Task<std::optional<chat::UserRights>> MessageHandlers::getUserRights(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id, const models::Rooms& room) const {
-    // Check if the user is a global admin first.
-    auto user = co_await switch_to_io_loop(CoroMapper<models::Users>(db)
-        .findBy(
-            Criteria(models::Users::Cols::_user_id, CompareOperator::EQ, user_id) &&
-            Criteria(models::Users::Cols::_is_admin, CompareOperator::EQ, true)));
-    if (!user.empty()){
+drogon::Task<std::optional<chat::UserRights>> MessageHandlers::getUserRights(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id, const CachedRoom& room) const {
+    // Both are looked up at once, on a transaction too, rather than the stored role only after the admin flag.
+    auto [is_admin, stored_role] = co_await when_all(isGlobalAdmin(db, user_id), findStoredUserRole(db, user_id, room_id));
+
+    // A global admin comes first.
+    if (is_admin) {
         co_return chat::UserRights::ADMIN;
     }
 
     // Then, check if they are the owner of this specific room.
-    if (room.getOwnerId() && *room.getOwnerId() == user_id) {
+    if (room.owner_id && *room.owner_id == user_id) {
         co_return chat::UserRights::OWNER;
     }
 
-    // Finally, look for a specific role entry in the user_room_data table.
-    co_return co_await findStoredUserRole(db, user_id, room_id);
+    // Finally, the specific role entry in the user_room_data table.
+    co_return stored_role;
+}
+
+drogon::Task<bool> MessageHandlers::isGlobalAdmin(const drogon::orm::DbClientPtr& db, int32_t user_id) const {
+    auto& cache = RoomDataCache::instance();
+    const bool use_cache = !isTransaction(db);
+    if(use_cache) {
+        if(auto cached = cache.getIsAdmin(user_id)) {
+            co_return *cached;
+        }
+    }
+
+    const auto generation = cache.generation();
+    auto user = co_await switch_to_io_loop(CoroMapper<models::Users>(db)
+        .findBy(
+            Criteria(models::Users::Cols::_user_id, CompareOperator::EQ, user_id) &&
+            Criteria(models::Users::Cols::_is_admin, CompareOperator::EQ, true)));
+    const bool is_admin = !user.empty();
+    if(use_cache) {
+        cache.putIsAdmin(user_id, is_admin, generation);
+    }
+    co_return is_admin;
 }
 
 drogon::Task<std::optional<chat::UserRights>> MessageHandlers::findStoredUserRole(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id) const {
+    auto& cache = RoomDataCache::instance();
+    const bool use_cache = !isTransaction(db);
+    if(use_cache) {
+        if(auto cached = cache.getStoredRole(room_id, user_id)) {
+            co_return *cached;
+        }
+    }
+
+    const auto generation = cache.generation();
     auto data = co_await switch_to_io_loop(CoroMapper<models::UserRoomData>(db)
         .findBy(
             Criteria(models::UserRoomData::Cols::_user_id, CompareOperator::EQ, user_id) &&
             Criteria(models::UserRoomData::Cols::_room_id, CompareOperator::EQ, room_id)));
-    if(data.empty()) {
-        co_return std::nullopt;
+
+    std::optional<chat::UserRights> role;
+    if(!data.empty() && *data.front().getIsModerator()) {
+        role = chat::UserRights::MODERATOR;
+    }
+    if(use_cache) {
+        cache.putStoredRole(room_id, user_id, role, generation);
     }
+    co_return role;
+}
 
-    if(*data.front().getIsModerator()) {
-        co_return chat::UserRights::MODERATOR;
+drogon::Task<std::optional<CachedRoom>> MessageHandlers::findRoom(int32_t room_id) const {
+    auto& cache = RoomDataCache::instance();
+    if(auto cached = cache.getRoom(room_id)) {
+        co_return cached;
     }
 
-    co_return std::nullopt;
+    const auto generation = cache.generation();
+    auto rooms = co_await switch_to_io_loop(CoroMapper<models::Rooms>(writeDb())
+        .findBy(Criteria(models::Rooms::Cols::_room_id, CompareOperator::EQ, room_id)));
+    if(rooms.empty()) {
+        co_return std::nullopt;
+    }
+
+    auto room = toCachedRoom(rooms.front());
+    cache.putRoom(room, generation);
+    co_return room;
 }
 
-drogon::Task<chat::DeleteMessageResponse> MessageHandlers::handleDeleteMessage(const WsDataPtr& wsDataGuarded, const chat::DeleteMessageRequest& req, IChatRoomService& room_service) {
+template<ChatRoomService RoomService>
+drogon::Task<chat::DeleteMessageResponse> MessageHandlers::handleDeleteMessage(const WsDataPtr& wsDataGuarded, const chat::DeleteMessageRequest& req, RoomService& room_service) {
     chat::DeleteMessageResponse resp;
 
     auto wsData = co_await wsDataGuarded->lock_shared();
@@ -809,47 +1439,35 @@ drogon::Task<chat::DeleteMessageResponse> MessageHandlers::handleDeleteMessage(c
     const int32_t messageId = req.message_id();
     const int32_t roomId = wsData->room->id;
     try {
-        auto err = co_await WithTransaction([&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
-            try {
-                auto messages = co_await switch_to_io_loop(CoroMapper<models::Messages>(tx)
-                    .findBy(Criteria(models::Messages::Cols::_message_id, CompareOperator::EQ, messageId) &&
-                            Criteria(models::Messages::Cols::_room_id, CompareOperator::EQ, roomId)));
-                if (messages.empty()) {
-                    co_return "Message not found or does not belong to this room.";
-                }
-                size_t deletedCount = co_await switch_to_io_loop(CoroMapper<models::Messages>(tx)
-                    .deleteBy(Criteria(models::Messages::Cols::_message_id, CompareOperator::EQ, messageId)));
-
-                if (deletedCount == 0) {
-                    co_return "Message could not be deleted.";
-                }
-                co_return std::nullopt;
-            } catch (const DrogonDbException& e) {
-                LOG_ERROR << "Message deletion transaction failed: " << e.base().what();
-                co_return "Database error during message deletion.";
-            }
-        });
-        if (err) {
-            common::setStatus(resp, chat::STATUS_FAILURE, *err);
+        if(!co_await Repository::softDeleteMessage(writeDb(), messageId, roomId)) {
+            common::setStatus(resp, chat::STATUS_FAILURE, "Message not found or does not belong to this room.");
             co_return resp;
         }
+    } catch (const DrogonDbException& e) {
+        LOG_ERROR << "Message deletion failed: " << e.base().what();
+        common::setStatus(resp, chat::STATUS_FAILURE, "Database error during message deletion.");
+        co_return resp;
     } catch (const std::exception& e) {
         LOG_ERROR << "Delete message error: " << e.what();
         common::setStatus(resp, chat::STATUS_FAILURE, std::string("Delete message failed: ") + e.what());
         co_return resp;
     }
     
+    MessageHistoryCache::instance().remove(roomId, messageId);
+
     chat::Envelope deletedNoticeEnv;
     auto* messageDeleted = deletedNoticeEnv.mutable_message_deleted();
     messageDeleted->set_message_id(messageId);
     co_await room_service.sendToRoom(roomId, deletedNoticeEnv);
+    ChangeFeed::instance().messagesDeleted(roomId, wsData->user->id, {messageId});
     
     common::setStatus(resp, chat::STATUS_SUCCESS);
     co_return resp;
 }
 
-drogon::Task<chat::UserTypingStartResponse> MessageHandlers::handleUserTypingStart(const WsDataPtr& wsDataGuarded, IChatRoomService& room_service) const {
-    chat::UserTypingStartResponse resp;
+template<ChatRoomService RoomService>
+drogon::Task<chat::DeleteUserMessagesResponse> MessageHandlers::handleDeleteUserMessages(const WsDataPtr& wsDataGuarded, const chat::DeleteUserMessagesRequest& req, RoomService& room_service) {
+    chat::DeleteUserMessagesResponse resp;
 
     auto wsData = co_await wsDataGuarded->lock_shared();
 
@@ -861,47 +1479,103 @@ drogon::Task<chat::UserTypingStartResponse> MessageHandlers::handleUserTypingSta
         common::setStatus(resp, chat::STATUS_FAILURE, "User is not in any room.");
         co_return resp;
     }
+    if (wsData->room->rights < chat::UserRights::MODERATOR) {
+        common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Insufficient rights to delete messages.");
+        co_return resp;
+    }
+    if (req.count() <= 0 || req.count() > common::limits::MAX_DELETE_USER_MESSAGES) {
+        common::setStatus(resp, chat::STATUS_FAILURE, "'count' must be between 1 and " + std::to_string(common::limits::MAX_DELETE_USER_MESSAGES) + ".");
+        co_return resp;
+    }
 
-    chat::Envelope broadcastEnv;
-    auto* startedTypingMsg = broadcastEnv.mutable_user_started_typing();
+    const int32_t roomId = wsData->room->id;
+    std::vector<int32_t> deleted;
+    try {
+        // Only the messages of users ranked below the moderator, like every other moderation action.
+        auto targetRights = co_await getUserRights(writeDb(), req.user_id(), roomId);
+        if (req.user_id() != wsData->user->id && targetRights.value_or(chat::UserRights::REGULAR) >= wsData->room->rights) {
+            common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Insufficient rights to delete this user's messages.");
+            co_return resp;
+        }
+        deleted = co_await Repository::softDeleteUserMessages(writeDb(), roomId, req.user_id(), req.count());
+    } catch (const DrogonDbException& e) {
+        LOG_ERROR << "Bulk message deletion failed: " << e.base().what();
+        common::setStatus(resp, chat::STATUS_FAILURE, "Database error during message deletion.");
+        co_return resp;
+    } catch (const std::exception& e) {
+        LOG_ERROR << "Delete user messages error: " << e.what();
+        common::setStatus(resp, chat::STATUS_FAILURE, std::string("Delete user messages failed: ") + e.what());
+        co_return resp;
+    }
 
-    auto* userInfo = startedTypingMsg->mutable_user();
-    userInfo->set_user_id(wsData->user->id);
-    userInfo->set_user_name(wsData->user->name);
-    userInfo->set_user_room_rights(wsData->room->rights);
-    
-	co_await room_service.sendToRoom(wsData->room->id, broadcastEnv);
+    if (!deleted.empty()) {
+        for (int32_t messageId : deleted) {
+            MessageHistoryCache::instance().remove(roomId, messageId);
+        }
+        // One notice for the whole batch, a spam cleanup would otherwise flood the room.
+        chat::Envelope deletedNoticeEnv;
+        auto* messageDeleted = deletedNoticeEnv.mutable_message_deleted();
+        messageDeleted->set_message_id(deleted.front());
+        messageDeleted->mutable_message_ids()->Add(deleted.begin() + 1, deleted.end());
+        co_await room_service.sendToRoom(roomId, deletedNoticeEnv);
+        ChangeFeed::instance().messagesDeleted(roomId, wsData->user->id, deleted);
+    }
 
+    resp.set_deleted_count(static_cast<int32_t>(deleted.size()));
     common::setStatus(resp, chat::STATUS_SUCCESS);
     co_return resp;
 }
 
-drogon::Task<chat::UserTypingStopResponse> MessageHandlers::handleUserTypingStop(const WsDataPtr& wsDataGuarded, IChatRoomService& room_service) const {
-    chat::UserTypingStopResponse resp;
-
-    auto wsData = co_await wsDataGuarded->lock_shared();
+template<ChatRoomService RoomService>
+void MessageHandlers::handleSubscribeRooms(const WsData& wsData, const chat::SubscribeRoomsRequest& req, RoomService& room_service, chat::SubscribeRoomsResponse& resp) const {
+    if (wsData.status != USER_STATUS::Authenticated) {
+        common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not authenticated.");
+        return;
+    }
+    room_service.subscribeDirectory(wsData, req.subscribe());
+    common::setStatus(resp, chat::STATUS_SUCCESS);
+}
 
-    if (wsData->status != USER_STATUS::Authenticated) {
+template<ChatRoomService RoomService>
+void MessageHandlers::handleUserTypingStart(const WsData& wsData, RoomService& room_service, chat::UserTypingStartResponse& resp) const {
+    if (wsData.status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not authenticated.");
-        co_return resp;
+        return;
     }
-    if (!wsData->room) {
+    if (!wsData.room) {
         common::setStatus(resp, chat::STATUS_FAILURE, "User is not in any room.");
-        co_return resp;
+        return;
     }
 
-    chat::Envelope broadcastEnv;
-    auto* stoppedTypingMsg = broadcastEnv.mutable_user_stopped_typing();
+    chat::UserInfo userInfo;
+    userInfo.set_user_id(wsData.user->id);
+    userInfo.set_user_name(*wsData.user->name());
+    userInfo.set_user_room_rights(wsData.room->rights);
+
+    room_service.setTyping(wsData.room->id, userInfo, true);
+
+    common::setStatus(resp, chat::STATUS_SUCCESS);
+}
+
+template<ChatRoomService RoomService>
+void MessageHandlers::handleUserTypingStop(const WsData& wsData, RoomService& room_service, chat::UserTypingStopResponse& resp) const {
+    if (wsData.status != USER_STATUS::Authenticated) {
+        common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not authenticated.");
+        return;
+    }
+    if (!wsData.room) {
+        common::setStatus(resp, chat::STATUS_FAILURE, "User is not in any room.");
+        return;
+    }
 
-    auto* userInfo = stoppedTypingMsg->mutable_user();
-    userInfo->set_user_id(wsData->user->id);
-    userInfo->set_user_name(wsData->user->name);
-    userInfo->set_user_room_rights(wsData->room->rights);
+    chat::UserInfo userInfo;
+    userInfo.set_user_id(wsData.user->id);
+    userInfo.set_user_name(*wsData.user->name());
+    userInfo.set_user_room_rights(wsData.room->rights);
 
-    co_await room_service.sendToRoom(wsData->room->id, broadcastEnv);
+    room_service.setTyping(wsData.room->id, userInfo, false);
 
     common::setStatus(resp, chat::STATUS_SUCCESS);
-    co_return resp;
 }
 
 drogon::Task<chat::BecomeMemberResponse> MessageHandlers::handleBecomeMember(const WsDataPtr& wsDataGuarded, const chat::BecomeMemberRequest& req) {
@@ -914,16 +1588,20 @@ drogon::Task<chat::BecomeMemberResponse> MessageHandlers::handleBecomeMember(con
     }
 
     try {
-        auto room = co_await switch_to_io_loop(CoroMapper<models::Rooms>(m_dbClient)
-            .findOne(Criteria(models::Rooms::Cols::_room_id, CompareOperator::EQ, req.room_id())));
-        auto curr_membership = co_await getUserMembershipStatus(m_dbClient, wsData->user->id, req.room_id());
+        auto room = co_await findRoom(req.room_id());
+        if(!room) {
+            common::setStatus(resp, chat::STATUS_NOT_FOUND, "Room does not exist.");
+            co_return resp;
+        }
+        auto curr_membership = co_await getUserMembershipStatus(writeDb(), wsData->user->id, req.room_id());
 
-        if(room.getValueOfIsPrivate() && !curr_membership) {
+        if(room->is_private && !curr_membership) {
             common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not authorized to join this private room.");
             co_return resp;
         }
 
-        co_await setUserMembershipStatus(m_dbClient, wsData->user->id, req.room_id(), chat::MembershipStatus::JOINED);
+        co_await setUserMembershipStatus(writeDb(), wsData->user->id, req.room_id(), chat::MembershipStatus::JOINED);
+        ChangeFeed::instance().membershipChanged(req.room_id(), wsData->user->id, chat::MembershipStatus::JOINED);
 
     } catch (const std::exception& e) {
         LOG_ERROR << "Become member error: " << e.what();
@@ -935,7 +1613,8 @@ drogon::Task<chat::BecomeMemberResponse> MessageHandlers::handleBecomeMember(con
     co_return resp;
 }
 
-drogon::Task<chat::ChangeUsernameResponse> MessageHandlers::handleChangeUsername(const WsDataPtr& wsDataGuarded, const chat::ChangeUsernameRequest& req, IChatRoomService& room_service) {
+template<ChatRoomService RoomService>
+drogon::Task<chat::ChangeUsernameResponse> MessageHandlers::handleChangeUsername(const WsDataPtr& wsDataGuarded, const chat::ChangeUsernameRequest& req, RoomService& room_service) {
     chat::ChangeUsernameResponse resp;
 
     auto wsData = co_await wsDataGuarded->lock_unique();
@@ -944,7 +1623,7 @@ drogon::Task<chat::ChangeUsernameResponse> MessageHandlers::handleChangeUsername
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not authenticated.");
         co_return resp;
     }
-    if (auto error = validateUtf8String(req.new_username(), common::limits::MAX_USERNAME_LENGTH, "new username")) {
+    if (auto error = validateName(req.new_username(), common::limits::MAX_USERNAME_LENGTH, "new username")) {
         common::setStatus(resp, chat::STATUS_FAILURE, *error);
         co_return resp;
     }
@@ -953,10 +1632,12 @@ drogon::Task<chat::ChangeUsernameResponse> MessageHandlers::handleChangeUsername
         auto err = co_await WithTransaction(
             [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
                 try {
-                    auto existingUsers = co_await switch_to_io_loop(CoroMapper<models::Users>(tx)
-                        .findBy(Criteria(models::Users::Cols::_username, CompareOperator::EQ, newUsername)));
-                    if (!existingUsers.empty()) {
-                        co_return "This username is already taken.";
+                    if (UsernameFilter::instance().mayExist(newUsername)) {
+                        auto existingUsers = co_await switch_to_io_loop(CoroMapper<models::Users>(tx)
+                            .findBy(Criteria(models::Users::Cols::_username, CompareOperator::EQ, newUsername)));
+                        if (!existingUsers.empty()) {
+                            co_return "This username is already taken.";
+                        }
                     }
                     auto usersToUpdate = co_await switch_to_io_loop(CoroMapper<models::Users>(tx)
                         .findBy(Criteria(models::Users::Cols::_user_id, CompareOperator::EQ, wsData->user->id)));
@@ -970,7 +1651,12 @@ drogon::Task<chat::ChangeUsernameResponse> MessageHandlers::handleChangeUsername
                     co_return std::nullopt;
                 }
                 catch (const DrogonDbException& e) {
-                    LOG_ERROR << "Username change transaction failed: " << e.base().what();
+                    const std::string w = e.base().what();
+                    LOG_ERROR << "Username change transaction failed: " << w;
+                    // Taken on another server since the filter was loaded.
+                    if (w.find("duplicate key") != std::string::npos) {
+                        co_return "This username is already taken.";
+                    }
                     co_return "Database error during username change.";
                 }
             });
@@ -978,13 +1664,13 @@ drogon::Task<chat::ChangeUsernameResponse> MessageHandlers::handleChangeUsername
             common::setStatus(resp, chat::STATUS_FAILURE, *err);
             co_return resp;
         }
-        wsData->user->name = newUsername;
-
-        chat::Envelope broadcastEnv;
-        auto* usernameChangedMsg = broadcastEnv.mutable_username_changed();
-        usernameChangedMsg->set_user_id(wsData->user->id);
-        usernameChangedMsg->set_new_username(newUsername);
-        co_await room_service.sendToAll(broadcastEnv);
+        // Every connection and session of the user shares the name, see UserDirectory.
+        UserDirectory::instance().rename(wsData->user->id, newUsername);
+        UsernameFilter::instance().add(newUsername);
+        MessageHistoryCache::instance().renameUser(wsData->user->id, newUsername);
+        // Only the rooms that can see the user hear about it, not every connection.
+        auto memberRooms = co_await Repository::findJoinedRoomIds(readDb(), wsData->user->id);
+        co_await room_service.renameUser(wsData->user->id, newUsername, memberRooms);
 
         common::setStatus(resp, chat::STATUS_SUCCESS);
     }
@@ -995,26 +1681,23 @@ drogon::Task<chat::ChangeUsernameResponse> MessageHandlers::handleChangeUsername
     co_return resp;
 }
 
-drogon::Task<chat::GetMySaltResponse> MessageHandlers::handleGetSalt(const WsDataPtr& wsDataGuarded) {
+drogon::Task<chat::GetMySaltResponse> MessageHandlers::handleGetSalt(const WsData& wsData) {
     chat::GetMySaltResponse resp;
 
-    auto wsData = co_await wsDataGuarded->lock_shared();
-
-    if (wsData->status != USER_STATUS::Authenticated) {
+    if (wsData.status != USER_STATUS::Authenticated) {
         common::setStatus(resp, chat::STATUS_UNAUTHORIZED, "Not authenticated.");
         co_return resp;
     }
 
     try {
-        auto users = co_await switch_to_io_loop(CoroMapper<models::Users>(m_dbClient)
-            .findBy(Criteria(models::Users::Cols::_user_id, CompareOperator::EQ, wsData->user->id)));
+        auto found = co_await Repository::findUserById(writeDb(), wsData.user->id);
 
-        if (users.empty()) {
+        if (!found) {
             common::setStatus(resp, chat::STATUS_NOT_FOUND, "User not found in database.");
             co_return resp;
         }
 
-        const auto& user = users.front();
+        const auto& user = *found;
         if (user.getValueOfSalt().empty()) {
             common::setStatus(resp, chat::STATUS_FAILURE, "User account is not migrated and has no salt.");
             co_return resp;
@@ -1023,12 +1706,31 @@ drogon::Task<chat::GetMySaltResponse> MessageHandlers::handleGetSalt(const WsDat
         common::setStatus(resp, chat::STATUS_SUCCESS);
     }
     catch (const DrogonDbException& e) {
-        LOG_ERROR << "Failed to get salt for user " << wsData->user->id << ": " << e.base().what();
+        LOG_ERROR << "Failed to get salt for user " << wsData.user->id << ": " << e.base().what();
         common::setStatus(resp, chat::STATUS_FAILURE, "Database error while fetching user data.");
     }
     co_return resp;
 }
 
+drogon::Task<chat::SetCompressionResponse> MessageHandlers::handleSetCompression(const WsDataPtr& wsDataGuarded, const chat::SetCompressionRequest& req) const {
+    chat::SetCompressionResponse resp;
+
+    auto wsData = co_await wsDataGuarded->lock_unique();
+
+    const bool supported = req.compression() == chat::COMPRESSION_NONE
+        || (req.compression() == chat::COMPRESSION_GZIP && serverConfig().compression.enabled);
+    if (!supported) {
+        common::setStatus(resp, chat::STATUS_FAILURE, "Unsupported compression.");
+    } else {
+        wsData->compression = req.compression();
+        wsData->user_refs = req.user_refs() && serverConfig().compression.user_refs;
+        common::setStatus(resp, chat::STATUS_SUCCESS);
+    }
+    resp.set_compression(wsData->compression);
+    resp.set_user_refs(wsData->user_refs);
+    co_return resp;
+}
+
 drogon::Task<chat::ChangePasswordResponse> MessageHandlers::handleChangePassword(const WsDataPtr& wsDataGuarded, const chat::ChangePasswordRequest& req) {
     chat::ChangePasswordResponse resp;
 
@@ -1076,6 +1778,8 @@ drogon::Task<chat::ChangePasswordResponse> MessageHandlers::handleChangePassword
             common::setStatus(resp, chat::STATUS_FAILURE, *err);
             co_return resp;
         }
+        // Sessions logged in with the old password must not be resumable.
+        SessionTokens::instance().revokeUser(wsData->user->id);
         common::setStatus(resp, chat::STATUS_SUCCESS);
     }
     catch (const std::exception& e) {
@@ -1088,26 +1792,35 @@ drogon::Task<chat::ChangePasswordResponse> MessageHandlers::handleChangePassword
 std::optional<std::string> MessageHandlers::validateUtf8String(
     const std::string_view& textToValidate,
     size_t maxLength,
-    const std::string_view& fieldName) const {
+    const std::string_view& fieldName) {
     
-    try {
-        size_t length = utf8::distance(textToValidate.begin(), textToValidate.end());
-        if (length > maxLength) {
-            return std::string("Field '") + std::string(fieldName) +
-                   "' is too long. Max length: " + std::to_string(maxLength) + " chars.";
-        }
-    }
-    catch (const utf8::invalid_utf8&) {
+    // Counting stops past the limit, a text far over it is turned down without being read through.
+    const auto length = common::utf8Length(textToValidate, maxLength);
+    if (!length) {
         return std::string("Field '") + std::string(fieldName) + "' contains invalid UTF-8 characters.";
     }
-    catch (const std::exception& e) {
-        return std::string("An unexpected error occurred during ") +
-               std::string(fieldName) + " validation: " + e.what();
+    if (*length > maxLength) {
+        return std::string("Field '") + std::string(fieldName) +
+               "' is too long. Max length: " + std::to_string(maxLength) + " chars.";
     }
 
     return std::nullopt;
 }
 
+std::optional<std::string> MessageHandlers::validateName(
+    const std::string_view& name,
+    size_t maxLength,
+    const std::string_view& fieldName) {
+
+    if (auto error = validateUtf8String(name, maxLength, fieldName)) {
+        return error;
+    }
+    if (!common::containsAlphanumeric(name)) {
+        return std::string("Field '") + std::string(fieldName) + "' must contain a letter or a digit.";
+    }
+    return std::nullopt;
+}
+
 drogon::Task<ScopedTransactionResult> MessageHandlers::updateUserRoleInDb(const std::shared_ptr<drogon::orm::Transaction>& tx, int32_t userId, int32_t roomId, chat::UserRights newRole) {
     try {
 
@@ -1132,30 +1845,34 @@ drogon::Task<ScopedTransactionResult> MessageHandlers::updateUserRoleInDb(const
         }
         co_return std::nullopt;
     } catch (const DrogonDbException& e) {
+        // Deadlocks and serialization failures go up to WithTransaction, which runs the transaction again.
+        if(detail::isRetriable(e)) {
+            throw;
+        }
         LOG_ERROR << "Role update/insert failed: " << e.base().what();
         co_return "Database error during role update.";
     }
 }
 
 drogon::Task<std::optional<chat::MembershipStatus>> MessageHandlers::getUserMembershipStatus(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id) {
-    auto room_membership = co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(db)
-        .findBy(Criteria(models::RoomMembership::Cols::_user_id, CompareOperator::EQ, user_id) &&
-                Criteria(models::RoomMembership::Cols::_room_id, CompareOperator::EQ, room_id)));
-
-    if(room_membership.empty()) {
-        co_return std::nullopt;
-    }
-
-    chat::MembershipStatus status;
-
-    if(chat::MembershipStatus_Parse(*room_membership.front().getMembershipStatus(), &status)) {
-        co_return status;
+    auto& cache = RoomDataCache::instance();
+    if(auto cached = cache.getMembership(room_id, user_id)) {
+        co_return *cached;
     }
 
-    co_return std::nullopt;
+    const auto generation = cache.generation();
+    auto result = co_await Repository::findMembershipStatus(db, user_id, room_id);
+    cache.putMembership(room_id, user_id, result, generation);
+    co_return result;
 }
 
 drogon::Task<ScopedTransactionResult> MessageHandlers::setUserMembershipStatus(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id, chat::MembershipStatus status) {
+    // Invalidate on every exit path, including a failed write of unknown outcome.
+    struct InvalidateOnExit {
+        int32_t room_id, user_id;
+        ~InvalidateOnExit() { RoomDataCache::instance().invalidateRoomUser(room_id, user_id); }
+    } invalidate{room_id, user_id};
+
     try {
         auto room_membership = co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(db)
             .findBy(Criteria(models::RoomMembership::Cols::_user_id, CompareOperator::EQ, user_id) &&
@@ -1167,13 +1884,13 @@ drogon::Task<ScopedTransactionResult> MessageHandlers::setUserMembershipStatus(c
             membership.setRoomId(room_id);
             membership.setMembershipStatus(chat::MembershipStatus_Name(status));
             co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(db).insert(membership));
-            co_return std::nullopt;
         } else {
             auto membership = room_membership.front();
             membership.setMembershipStatus(chat::MembershipStatus_Name(status));
             co_await switch_to_io_loop(CoroMapper<models::RoomMembership>(db).update(membership));
-            co_return std::nullopt;
         }
+        co_await CacheInvalidation::instance().notifyRoomUser(db, room_id, user_id);
+        co_return std::nullopt;
     
     } catch(const DrogonDbException& e) {
         LOG_ERROR << "Membership status update/insert failed: " << e.base().what();
@@ -1181,6 +1898,27 @@ drogon::Task<ScopedTransactionResult> MessageHandlers::setUserMembershipStatus(c
     }
 }
 
-
+// The room services the handlers are built for, see ChatRoomService.
+#define INSTANTIATE_HANDLERS(Service) \
+    template drogon::Task<chat::AuthResponse> MessageHandlers::handleAuth(const WsDataPtr&, const chat::AuthRequest&, Service&) const; \
+    template drogon::Task<chat::ResumeSessionResponse> MessageHandlers::handleResumeSession(const WsDataPtr&, const chat::ResumeSessionRequest&, Service&) const; \
+    template drogon::Task<chat::SendMessageResponse> MessageHandlers::handleSendMessage(const WsData&, const chat::SendMessageRequest&, Service&) const; \
+    template drogon::Task<chat::JoinRoomResponse> MessageHandlers::handleJoinRoom(const WsDataPtr&, const chat::JoinRoomRequest&, Service&) const; \
+    template drogon::Task<chat::LeaveRoomResponse> MessageHandlers::handleLeaveRoom(const WsDataPtr&, const chat::LeaveRoomRequest&, Service&) const; \
+    template drogon::Task<chat::CreateRoomResponse> MessageHandlers::handleCreateRoom(const WsDataPtr&, const chat::CreateRoomRequest&, Service&) const; \
+    template drogon::Task<chat::LogoutResponse> MessageHandlers::handleLogoutUser(const WsDataPtr&, Service&) const; \
+    template drogon::Task<chat::RenameRoomResponse> MessageHandlers::handleRenameRoom(const WsDataPtr&, const chat::RenameRoomRequest&, Service&); \
+    template drogon::Task<chat::DeleteRoomResponse> MessageHandlers::handleDeleteRoom(const WsDataPtr&, const chat::DeleteRoomRequest&, Service&); \
+    template drogon::Task<chat::AssignRoleResponse> MessageHandlers::handleAssignRole(const WsDataPtr&, const chat::AssignRoleRequest&, Service&); \
+    template drogon::Task<chat::DeleteMessageResponse> MessageHandlers::handleDeleteMessage(const WsDataPtr&, const chat::DeleteMessageRequest&, Service&); \
+    template drogon::Task<chat::DeleteUserMessagesResponse> MessageHandlers::handleDeleteUserMessages(const WsDataPtr&, const chat::DeleteUserMessagesRequest&, Service&); \
+    template void MessageHandlers::handleSubscribeRooms(const WsData&, const chat::SubscribeRoomsRequest&, Service&, chat::SubscribeRoomsResponse&) const; \
+    template void MessageHandlers::handleUserTypingStart(const WsData&, Service&, chat::UserTypingStartResponse&) const; \
+    template void MessageHandlers::handleUserTypingStop(const WsData&, Service&, chat::UserTypingStopResponse&) const; \
+    template drogon::Task<chat::ChangeUsernameResponse> MessageHandlers::handleChangeUsername(const WsDataPtr&, const chat::ChangeUsernameRequest&, Service&);
+
+INSTANTIATE_HANDLERS(ClusterRoomService)
+INSTANTIATE_HANDLERS(IChatRoomService)
+#undef INSTANTIATE_HANDLERS
 
 } // namespace server
@@ -0,0 +1,151 @@
+#include <server/chat/MessageHistoryCache.h>
+#include <server/utils/server_config.h>
+
+namespace server {
+
+MessageHistoryCache& MessageHistoryCache::instance() {
+    static MessageHistoryCache inst;
+    return inst;
+}
+
+bool MessageHistoryCache::contains(int32_t room_id) const {
+    std::shared_lock lock(m_mutex);
+    return m_rooms.contains(room_id);
+}
+
+bool MessageHistoryCache::find(int32_t room_id, int32_t limit, int64_t offset, google::protobuf::RepeatedPtrField<chat::MessageInfo>& out,
+                               HistoryKey key) const {
+    if(limit == 0) {
+        return false;
+    }
+    const auto position = [key](const chat::MessageInfo& msg) { return key == HistoryKey::Seq ? msg.seq() : msg.timestamp(); };
+
+    std::shared_lock lock(m_mutex);
+    auto it = m_rooms.find(room_id);
+    if(it == m_rooms.end()) {
+        return false;
+    }
+    const auto& tail = it->second;
+    const int first = out.size();
+    const auto taken = [&out, first] { return static_cast<size_t>(out.size() - first); };
+
+    if(limit > 0) {
+        // Older than offset, newest first: complete if the page fills up within the tail.
+        for(auto msg = tail.messages.rbegin(); msg != tail.messages.rend() && taken() < static_cast<size_t>(limit); ++msg) {
+            if(position(*msg) < offset) {
+                *out.Add() = *msg;
+            }
+        }
+        if(taken() < static_cast<size_t>(limit) && !tail.has_all) {
+            out.DeleteSubrange(first, out.size() - first);
+            return false;
+        }
+        return true;
+    }
+
+    // Newer than offset, oldest first: complete if nothing between offset and the tail is missing.
+    if(!tail.has_all && (tail.messages.empty() || offset < position(tail.messages.front()))) {
+        return false;
+    }
+    const auto count = static_cast<size_t>(-static_cast<int64_t>(limit));
+    for(const auto& msg : tail.messages) {
+        if(taken() == count) {
+            break;
+        }
+        if(position(msg) > offset) {
+            *out.Add() = msg;
+        }
+    }
+    return true;
+}
+
+uint64_t MessageHistoryCache::version(int32_t room_id) const {
+    std::shared_lock lock(m_mutex);
+    return version_unsafe(room_id);
+}
+
+uint64_t MessageHistoryCache::version_unsafe(int32_t room_id) const {
+    // Both counters only grow, so the sum changes whenever either does.
+    auto it = m_versions.find(room_id);
+    return m_global_version + (it == m_versions.end() ? 0 : it->second);
+}
+
+void MessageHistoryCache::bump_unsafe(int32_t room_id) {
+    ++m_versions[room_id];
+}
+
+void MessageHistoryCache::fill(int32_t room_id, std::vector<chat::MessageInfo> newest_first, bool has_all, uint64_t observed_version) {
+    std::unique_lock lock(m_mutex);
+    if(version_unsafe(room_id) != observed_version) {
+        return;
+    }
+    if(m_rooms.size() >= MAX_ROOMS && !m_rooms.contains(room_id)) {
+        m_rooms.clear();
+    }
+
+    RoomTail tail;
+    tail.has_all = has_all;
+    for(auto& msg : newest_first) {
+        tail.messages.push_front(std::move(msg));
+    }
+    m_rooms.insert_or_assign(room_id, std::move(tail));
+}
+
+void MessageHistoryCache::append(int32_t room_id, const chat::MessageInfo& message) {
+    const auto capacity = std::max<size_t>(serverConfig().history_cache.messages_per_room, 1);
+
+    std::unique_lock lock(m_mutex);
+    bump_unsafe(room_id);
+    auto it = m_rooms.find(room_id);
+    if(it == m_rooms.end()) {
+        return;
+    }
+    auto& tail = it->second;
+
+    // Concurrent sends may be appended slightly out of order, keep the tail sorted.
+    auto pos = tail.messages.end();
+    while(pos != tail.messages.begin() && std::prev(pos)->seq() > message.seq()) {
+        --pos;
+    }
+    if(pos == tail.messages.begin() && !tail.has_all && !tail.messages.empty()) {
+        // Older than the whole tail, so it is not part of the range the tail covers.
+        return;
+    }
+    tail.messages.insert(pos, message);
+
+    while(tail.messages.size() > capacity) {
+        tail.messages.pop_front();
+        tail.has_all = false;
+    }
+}
+
+void MessageHistoryCache::remove(int32_t room_id, int32_t message_id) {
+    std::unique_lock lock(m_mutex);
+    bump_unsafe(room_id);
+    if(auto it = m_rooms.find(room_id); it != m_rooms.end()) {
+        std::erase_if(it->second.messages, [message_id](const chat::MessageInfo& msg) {
+            return msg.message_id() == message_id;
+        });
+    }
+}
+
+void MessageHistoryCache::dropRoom(int32_t room_id) {
+    std::unique_lock lock(m_mutex);
+    bump_unsafe(room_id);
+    m_rooms.erase(room_id);
+}
+
+void MessageHistoryCache::renameUser(int32_t user_id, const std::string& new_name) {
+    std::unique_lock lock(m_mutex);
+    // Fills of any room may have read the old name.
+    ++m_global_version;
+    for(auto& [room_id, tail] : m_rooms) {
+        for(auto& msg : tail.messages) {
+            if(msg.from().user_id() == user_id) {
+                msg.mutable_from()->set_user_name(new_name);
+            }
+        }
+    }
+}
+
+} // namespace server
@@ -0,0 +1,171 @@
+#include <server/chat/MessageKeys.h>
+#include <server/utils/server_config.h>
+#include <server/utils/switch_to_io_loop.h>
+#include <common/utils/metrics.h>
+
+namespace server {
+
+namespace sql {
+
+// Takes the key, or reads back the message holding it and whether that message was stored. A
+// zero identity claims the key pending, see MessageKeys::settle. A holder committed after the
+// statement took its snapshot is seen by neither half, and no row comes back.
+static const std::string CLAIM_KEY =
+    "WITH claimed AS ("
+        "INSERT INTO message_client_keys (user_id, client_key, message_id, created_at, seq) "
+        "VALUES ($1, $2, NULLIF($3, 0), $4, NULLIF($5, 0)) "
+        "ON CONFLICT (user_id, client_key) DO NOTHING "
+        "RETURNING message_id, created_at, seq"
+    ") "
+    "SELECT message_id, created_at, seq, true AS claimed, true AS stored FROM claimed "
+    "UNION ALL "
+    "SELECT k.message_id, k.created_at, k.seq, false, "
+        "EXISTS (SELECT 1 FROM messages m WHERE m.message_id = k.message_id AND m.created_at = k.created_at) "
+    "FROM message_client_keys k "
+    "WHERE k.user_id = $1 AND k.client_key = $2 AND NOT EXISTS (SELECT 1 FROM claimed)";
+
+// Takes over the key of an attempt that died, unless the holder changed since it was read.
+static const std::string TAKE_OVER_KEY =
+    "UPDATE message_client_keys SET message_id = NULLIF($3, 0), created_at = $4, seq = NULLIF($5, 0) "
+    "WHERE user_id = $1 AND client_key = $2 AND created_at = $6 AND message_id IS NOT DISTINCT FROM NULLIF($7, 0)";
+
+// Only the pending claim made at $6 is settled, not one a retry took over since.
+static const std::string SETTLE_KEY =
+    "UPDATE message_client_keys SET message_id = $3, created_at = $4, seq = $5 "
+    "WHERE user_id = $1 AND client_key = $2 AND created_at = $6 AND message_id IS NULL";
+
+static const std::string RELEASE_KEY =
+    "DELETE FROM message_client_keys WHERE user_id = $1 AND client_key = $2";
+
+static const std::string PURGE_KEYS =
+    "DELETE FROM message_client_keys WHERE created_at < $1";
+
+} // namespace sql
+
+/// How often expired keys are dropped.
+static constexpr double SWEEP_INTERVAL_SECONDS = 30;
+
+/// A claim whose message is not stored this long after it was made belongs to an attempt that died.
+static constexpr std::chrono::minutes STALE_CLAIM_AGE{1};
+
+static std::string entryKey(int32_t user_id, const std::string& key) {
+    return std::to_string(user_id) + ':' + key;
+}
+
+MessageKeys& MessageKeys::instance() {
+    static MessageKeys inst;
+    return inst;
+}
+
+std::optional<StoredMessage> MessageKeys::find(int32_t user_id, const std::string& key) {
+    static auto& duplicates = common::MetricsRegistry::instance().counter(
+        "chat_duplicate_messages_total", "Retried messages answered with the original instead of being sent again.", "found=\"memory\"");
+
+    std::lock_guard lock(m_mutex);
+    auto it = m_entries.find(entryKey(user_id, key));
+    if(it == m_entries.end() || it->second.expires <= std::chrono::steady_clock::now()) {
+        return std::nullopt;
+    }
+    duplicates.inc();
+    return it->second.message;
+}
+
+drogon::Task<std::optional<StoredMessage>> MessageKeys::claim(const drogon::orm::DbClientPtr& db, int32_t user_id, const std::string& key, const StoredMessage& stored) {
+    static auto& duplicates = common::MetricsRegistry::instance().counter(
+        "chat_duplicate_messages_total", "Retried messages answered with the original instead of being sent again.", "found=\"database\"");
+
+    ensureTimer();
+    auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql::CLAIM_KEY, user_id, key, stored.message_id, stored.created_at, stored.seq));
+    if(rows.empty()) {
+        throw std::runtime_error("the client key is held by a message not committed yet");
+    }
+    const auto& row = rows.front();
+    const StoredMessage holder{
+        .message_id = row["message_id"].isNull() ? 0 : row["message_id"].as<int32_t>(),
+        .created_at = row["created_at"].as<int64_t>(),
+        .seq = row["seq"].isNull() ? 0 : row["seq"].as<int64_t>(),
+    };
+    if(row["claimed"].as<bool>()) {
+        if(holder.message_id != 0) {
+            remember(user_id, key, holder);
+        }
+        co_return std::nullopt;
+    }
+    if(row["stored"].as<bool>()) {
+        remember(user_id, key, holder);
+        duplicates.inc();
+        co_return holder;
+    }
+
+    // The holder is still being inserted, or its server went away before it was.
+    const auto stale_before = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch() - STALE_CLAIM_AGE);
+    if(holder.created_at >= stale_before.count()) {
+        throw std::runtime_error("the client key is held by a message not committed yet");
+    }
+    auto taken = co_await switch_to_io_loop(db->execSqlCoro(sql::TAKE_OVER_KEY, user_id, key, stored.message_id, stored.created_at, stored.seq,
+        holder.created_at, holder.message_id));
+    if(taken.affectedRows() == 0) {
+        throw std::runtime_error("the client key was taken over by another retry");
+    }
+    LOG_WARN << "Took over the client key of a message that was never stored, user " << user_id;
+    if(stored.message_id != 0) {
+        remember(user_id, key, stored);
+    }
+    co_return std::nullopt;
+}
+
+drogon::Task<> MessageKeys::settle(const drogon::orm::DbClientPtr& db, int32_t user_id, const std::string& key, int64_t claimed_at, const StoredMessage& stored) {
+    remember(user_id, key, stored);
+    try {
+        co_await switch_to_io_loop(db->execSqlCoro(sql::SETTLE_KEY, user_id, key, stored.message_id, stored.created_at, stored.seq, claimed_at));
+    } catch(const drogon::orm::DrogonDbException& e) {
+        LOG_ERROR << "Failed to settle the client key of a sent message: " << e.base().what();
+    }
+}
+
+drogon::Task<> MessageKeys::release(const drogon::orm::DbClientPtr& db, int32_t user_id, const std::string& key) {
+    {
+        std::lock_guard lock(m_mutex);
+        m_entries.erase(entryKey(user_id, key));
+    }
+    try {
+        co_await switch_to_io_loop(db->execSqlCoro(sql::RELEASE_KEY, user_id, key));
+    } catch(const drogon::orm::DrogonDbException& e) {
+        LOG_ERROR << "Failed to release the client key of an unsent message: " << e.base().what();
+    }
+}
+
+void MessageKeys::remember(int32_t user_id, const std::string& key, const StoredMessage& message) {
+    const auto expires = std::chrono::steady_clock::now() + serverConfig().message_delivery.dedupe_window;
+    std::lock_guard lock(m_mutex);
+    m_entries.insert_or_assign(entryKey(user_id, key), Entry{message, expires});
+}
+
+void MessageKeys::ensureTimer() {
+    std::call_once(m_timer_started, [this] {
+        drogon::app().getIOLoop(0)->runEvery(SWEEP_INTERVAL_SECONDS, [this] { sweep(); });
+    });
+}
+
+void MessageKeys::sweep() {
+    {
+        const auto now = std::chrono::steady_clock::now();
+        std::lock_guard lock(m_mutex);
+        std::erase_if(m_entries, [now](const auto& entry) { return entry.second.expires <= now; });
+    }
+
+    // Every server purges the table, the statements only race to delete the same rows.
+    auto db = writeDbClient();
+    if(!db) {
+        return;
+    }
+    const auto cutoff = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch() - serverConfig().message_delivery.dedupe_window);
+    db->execSqlAsync(sql::PURGE_KEYS,
+        [](const drogon::orm::Result&) {},
+        [](const drogon::orm::DrogonDbException& e) { LOG_WARN << "Failed to purge expired client keys: " << e.base().what(); },
+        static_cast<int64_t>(cutoff.count()));
+}
+
+} // namespace server
@@ -0,0 +1,108 @@
+#include <server/chat/RateLimiter.h>
+
+namespace server {
+
+/// How often buckets that have refilled are dropped.
+static constexpr double SWEEP_INTERVAL_SECONDS = 60;
+
+bool TokenBucket::take(const RateLimit& limit, std::chrono::steady_clock::time_point now) noexcept {
+    const double burst = std::max(limit.burst, 1.0);
+    if(m_tokens < 0) {
+        m_tokens = burst;
+    } else {
+        const double elapsed = std::chrono::duration<double>(now - m_updated).count();
+        m_tokens = std::min(burst, m_tokens + elapsed * limit.rate);
+    }
+    m_updated = now;
+    if(m_tokens < 1) {
+        return false;
+    }
+    m_tokens -= 1;
+    return true;
+}
+
+bool TokenBucket::full(const RateLimit& limit, std::chrono::steady_clock::time_point now) const noexcept {
+    const double elapsed = std::chrono::duration<double>(now - m_updated).count();
+    return m_tokens < 0 || m_tokens + elapsed * limit.rate >= std::max(limit.burst, 1.0);
+}
+
+RateLimiter& RateLimiter::instance() {
+    static RateLimiter inst;
+    return inst;
+}
+
+void RateLimiter::configure(chat::Envelope::PayloadCase payload, const std::string& name, const RateLimitConfig& cfg) {
+    const auto index = static_cast<size_t>(payload);
+    if(m_rules.size() <= index) {
+        m_rules.resize(index + 1);
+    }
+    auto& rule = m_rules[index];
+    if(auto it = cfg.per_connection.find(name); it != cfg.per_connection.end()) {
+        rule.connection = it->second;
+    }
+    if(auto it = cfg.per_user.find(name); it != cfg.per_user.end()) {
+        rule.user = it->second;
+    }
+    rule.rejected = &common::MetricsRegistry::instance().counter(
+        "chat_rate_limited_total", "Requests rejected by the rate limits, per handler.", "handler=\"" + name + "\"");
+}
+
+bool RateLimiter::admit(uint64_t connection_id, std::optional<int32_t> user_id, chat::Envelope::PayloadCase payload) {
+    const auto index = static_cast<size_t>(payload);
+    if(index >= m_rules.size()) {
+        return true;
+    }
+    const auto& rule = m_rules[index];
+    const bool per_connection = rule.connection.rate > 0;
+    const bool per_user = user_id && rule.user.rate > 0;
+    if(!per_connection && !per_user) {
+        return true;
+    }
+    ensureTimer();
+
+    const auto now = std::chrono::steady_clock::now();
+    bool admitted = true;
+    {
+        std::lock_guard lock(m_mutex);
+        // The connection's bucket goes first, a connection over its own limit does not drain its user's bucket too.
+        if(per_connection) {
+            admitted = m_connections[connection_id][index].take(rule.connection, now);
+        }
+        if(admitted && per_user) {
+            admitted = m_users[*user_id][index].take(rule.user, now);
+        }
+    }
+    if(!admitted) {
+        rule.rejected->inc();
+    }
+    return admitted;
+}
+
+void RateLimiter::forget(uint64_t connection_id) {
+    std::lock_guard lock(m_mutex);
+    m_connections.erase(connection_id);
+}
+
+void RateLimiter::ensureTimer() {
+    std::call_once(m_timer_started, [this] {
+        drogon::app().getIOLoop(0)->runEvery(SWEEP_INTERVAL_SECONDS, [this] { sweep(); });
+    });
+}
+
+// Drops the full buckets of one owner, and the owner too once it has none left.
+template <typename Owners, typename LimitOf>
+static void sweepOwners(Owners& owners, std::chrono::steady_clock::time_point now, LimitOf limitOf) {
+    for(auto owner = owners.begin(); owner != owners.end();) {
+        std::erase_if(owner->second, [&](const auto& bucket) { return bucket.second.full(limitOf(bucket.first), now); });
+        owner = owner->second.empty() ? owners.erase(owner) : std::next(owner);
+    }
+}
+
+void RateLimiter::sweep() {
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard lock(m_mutex);
+    sweepOwners(m_connections, now, [this](int payload) -> const RateLimit& { return m_rules[payload].connection; });
+    sweepOwners(m_users, now, [this](int payload) -> const RateLimit& { return m_rules[payload].user; });
+}
+
+} // namespace server
@@ -0,0 +1,131 @@
+#include <server/chat/RoomDataCache.h>
+
+namespace server {
+
+RoomDataCache& RoomDataCache::instance() {
+    static RoomDataCache inst;
+    return inst;
+}
+
+uint64_t RoomDataCache::generation() const {
+    std::shared_lock lock(m_mutex);
+    return m_generation;
+}
+
+bool RoomDataCache::isCurrent_unsafe(uint64_t observed_generation) const noexcept {
+    return observed_generation == m_generation;
+}
+
+RoomDataCache::RoomUserData& RoomDataCache::roomUser_unsafe(int32_t room_id, int32_t user_id) {
+    if(m_room_user_entries >= MAX_ENTRIES) {
+        m_room_users.clear();
+        m_room_user_entries = 0;
+    }
+    auto [it, inserted] = m_room_users[room_id].try_emplace(user_id);
+    if(inserted) {
+        ++m_room_user_entries;
+    }
+    return it->second;
+}
+
+const RoomDataCache::RoomUserData* RoomDataCache::findRoomUser_unsafe(int32_t room_id, int32_t user_id) const {
+    auto room = m_room_users.find(room_id);
+    if(room == m_room_users.end()) {
+        return nullptr;
+    }
+    auto user = room->second.find(user_id);
+    return user == room->second.end() ? nullptr : &user->second;
+}
+
+RoomDataCache::Lookup<CachedRoom> RoomDataCache::getRoom(int32_t room_id) const {
+    std::shared_lock lock(m_mutex);
+    if(auto it = m_rooms.find(room_id); it != m_rooms.end()) {
+        return it->second;
+    }
+    return std::nullopt;
+}
+
+void RoomDataCache::putRoom(const CachedRoom& room, uint64_t observed_generation) {
+    std::unique_lock lock(m_mutex);
+    if(!isCurrent_unsafe(observed_generation)) {
+        return;
+    }
+    if(m_rooms.size() >= MAX_ENTRIES) {
+        m_rooms.clear();
+    }
+    m_rooms.insert_or_assign(room.id, room);
+}
+
+RoomDataCache::Lookup<std::optional<chat::MembershipStatus>> RoomDataCache::getMembership(int32_t room_id, int32_t user_id) const {
+    std::shared_lock lock(m_mutex);
+    if(const auto* data = findRoomUser_unsafe(room_id, user_id)) {
+        return data->membership;
+    }
+    return std::nullopt;
+}
+
+void RoomDataCache::putMembership(int32_t room_id, int32_t user_id, std::optional<chat::MembershipStatus> status, uint64_t observed_generation) {
+    std::unique_lock lock(m_mutex);
+    if(isCurrent_unsafe(observed_generation)) {
+        roomUser_unsafe(room_id, user_id).membership = status;
+    }
+}
+
+RoomDataCache::Lookup<std::optional<chat::UserRights>> RoomDataCache::getStoredRole(int32_t room_id, int32_t user_id) const {
+    std::shared_lock lock(m_mutex);
+    if(const auto* data = findRoomUser_unsafe(room_id, user_id)) {
+        return data->stored_role;
+    }
+    return std::nullopt;
+}
+
+void RoomDataCache::putStoredRole(int32_t room_id, int32_t user_id, std::optional<chat::UserRights> role, uint64_t observed_generation) {
+    std::unique_lock lock(m_mutex);
+    if(isCurrent_unsafe(observed_generation)) {
+        roomUser_unsafe(room_id, user_id).stored_role = role;
+    }
+}
+
+RoomDataCache::Lookup<bool> RoomDataCache::getIsAdmin(int32_t user_id) const {
+    std::shared_lock lock(m_mutex);
+    if(auto it = m_admins.find(user_id); it != m_admins.end()) {
+        return it->second;
+    }
+    return std::nullopt;
+}
+
+void RoomDataCache::putIsAdmin(int32_t user_id, bool is_admin, uint64_t observed_generation) {
+    std::unique_lock lock(m_mutex);
+    if(!isCurrent_unsafe(observed_generation)) {
+        return;
+    }
+    if(m_admins.size() >= MAX_ENTRIES) {
+        m_admins.clear();
+    }
+    m_admins.insert_or_assign(user_id, is_admin);
+}
+
+void RoomDataCache::invalidateRoom(int32_t room_id) {
+    std::unique_lock lock(m_mutex);
+    ++m_generation;
+    m_rooms.erase(room_id);
+    if(auto it = m_room_users.find(room_id); it != m_room_users.end()) {
+        m_room_user_entries -= it->second.size();
+        m_room_users.erase(it);
+    }
+}
+
+void RoomDataCache::invalidateRoomUser(int32_t room_id, int32_t user_id) {
+    std::unique_lock lock(m_mutex);
+    ++m_generation;
+    if(auto room = m_room_users.find(room_id); room != m_room_users.end()) {
+        if(room->second.erase(user_id)) {
+            --m_room_user_entries;
+        }
+        if(room->second.empty()) {
+            m_room_users.erase(room);
+        }
+    }
+}
+
+} // namespace server
@@ -0,0 +1,110 @@
+#include <server/chat/ServerDrain.h>
+#include <server/chat/ChatRoomManager.h>
+#include <server/aggregator/WsClient.h>
+#include <server/utils/server_config.h>
+#include <random>
+
+namespace server {
+
+/// How long the aggregator gets to send the other servers before the clients are told without one.
+static constexpr double SERVER_LIST_TIMEOUT_SECONDS = 2;
+
+/// How often the server checks whether its clients are gone.
+static constexpr double CHECK_INTERVAL_SECONDS = 1;
+
+ServerDrain& ServerDrain::instance() {
+    static ServerDrain inst;
+    return inst;
+}
+
+void ServerDrain::start() {
+    if(m_draining.exchange(true, std::memory_order_acq_rel)) {
+        LOG_WARN << "Stopping without waiting for the drain";
+        drogon::app().quit();
+        return;
+    }
+    armDeadline();
+
+    auto* loop = drogon::app().getLoop();
+    WsClient::instance().drain([this, loop](std::vector<chat::ServerNodeInfo> servers) {
+        loop->queueInLoop([this, servers = std::move(servers)]() mutable { notifyClients(std::move(servers)); });
+    });
+    loop->runAfter(SERVER_LIST_TIMEOUT_SECONDS, [this] { notifyClients({}); });
+}
+
+void ServerDrain::startUpgrade() {
+    if(m_draining.load(std::memory_order_acquire)) {
+        return;
+    }
+    m_upgrading.store(true, std::memory_order_release);
+    m_draining.store(true, std::memory_order_release);
+    LOG_INFO << "Upgrading in place";
+    armDeadline();
+    WsClient::instance().detach();
+    chat::ServerNodeInfo self;
+    self.set_host(common::getEnvVar("SERVER_HOST") + "/ws");
+    notifyClients({std::move(self)});
+}
+
+void ServerDrain::armDeadline() {
+    const auto& cfg = serverConfig().drain;
+    m_deadline = std::chrono::steady_clock::now() + cfg.timeout;
+    LOG_INFO << "Draining " << ChatRoomManager::instance().connectionCount() << " connections over "
+             << cfg.spread.count() << " ms";
+    drogon::app().getLoop()->runEvery(CHECK_INTERVAL_SECONDS, [this] { checkDone(); });
+}
+
+void ServerDrain::notifyClients(std::vector<chat::ServerNodeInfo> servers) {
+    std::call_once(m_notified, [this, &servers] {
+        // The clients go to the servers with the most spare capacity, in proportion to it.
+        // Unless upgrading, the successor is then at this server's address.
+        const auto self = common::getEnvVar("SERVER_HOST") + "/ws";
+        if(!upgrading()) {
+            std::erase_if(servers, [&self](const chat::ServerNodeInfo& server) { return server.host() == self; });
+        }
+        std::vector<double> weights;
+        weights.reserve(servers.size());
+        for(const auto& server : servers) {
+            weights.push_back(server.has_load() ? std::max(1.0 - static_cast<double>(server.load()), 0.05) : 0.5);
+        }
+        LOG_INFO << "Moving the clients to " << servers.size() << " other servers";
+
+        struct Targets {
+            std::vector<std::string> hosts;
+            std::vector<double> weights;
+            uint32_t spread_ms;
+        };
+        auto targets = std::make_shared<Targets>();
+        for(const auto& server : servers) {
+            targets->hosts.push_back(server.host());
+        }
+        targets->weights = std::move(weights);
+        targets->spread_ms = static_cast<uint32_t>(std::clamp<int64_t>(serverConfig().drain.spread.count(), 0, UINT32_MAX));
+
+        ChatRoomManager::instance().forEachConnection([targets](const drogon::WebSocketConnectionPtr& conn) {
+            // Per loop, forEachConnection runs on every IO loop at once.
+            thread_local std::minstd_rand rng{std::random_device{}()};
+            chat::Envelope env;
+            auto* hint = env.mutable_server_draining();
+            if(!targets->hosts.empty()) {
+                std::discrete_distribution<size_t> pick(targets->weights.begin(), targets->weights.end());
+                hint->set_alternative_host(targets->hosts[pick(rng)]);
+            }
+            hint->set_reconnect_delay_ms(std::uniform_int_distribution<uint32_t>(0, targets->spread_ms)(rng));
+            common::sendEnvelope(conn, env);
+        });
+    });
+}
+
+void ServerDrain::checkDone() {
+    const auto connections = ChatRoomManager::instance().connectionCount();
+    if(connections == 0) {
+        LOG_INFO << "Drained, stopping";
+        drogon::app().quit();
+    } else if(std::chrono::steady_clock::now() >= m_deadline) {
+        LOG_INFO << "Drain timed out with " << connections << " connections left, stopping";
+        drogon::app().quit();
+    }
+}
+
+} // namespace server
@@ -0,0 +1,132 @@
+#include <server/chat/SessionTokens.h>
+#include <server/utils/server_config.h>
+
+namespace server {
+
+/// How often expired tokens are dropped.
+static constexpr double SWEEP_INTERVAL_SECONDS = 60;
+
+/// Random bytes per token, sent hex encoded.
+static constexpr size_t TOKEN_BYTES = 32;
+
+static std::string newToken() {
+    std::array<unsigned char, TOKEN_BYTES> bytes;
+    if(!drogon::utils::secureRandomBytes(bytes.data(), bytes.size())) {
+        return {};
+    }
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string token;
+    token.reserve(bytes.size() * 2);
+    for(unsigned char byte : bytes) {
+        token.push_back(digits[byte >> 4]);
+        token.push_back(digits[byte & 0xf]);
+    }
+    return token;
+}
+
+SessionTokens& SessionTokens::instance() {
+    static SessionTokens inst;
+    return inst;
+}
+
+std::string SessionTokens::issue(const User& user) {
+    const auto& cfg = serverConfig().sessions;
+    if(!cfg.enabled) {
+        return {};
+    }
+    auto token = newToken();
+    if(token.empty()) {
+        LOG_ERROR << "No randomness available for a resumption token";
+        return {};
+    }
+    ensureTimer();
+
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard lock(m_mutex);
+    if(m_sessions.size() >= cfg.max_sessions) {
+        sweep_unsafe(now);
+        if(m_sessions.size() >= cfg.max_sessions) {
+            return {};
+        }
+    }
+    m_sessions.emplace(token, Session{user, now + cfg.ttl});
+    return token;
+}
+
+std::optional<User> SessionTokens::redeem(const std::string& token) {
+    if(token.empty()) {
+        return std::nullopt;
+    }
+    std::lock_guard lock(m_mutex);
+    auto it = m_sessions.find(token);
+    if(it == m_sessions.end()) {
+        return std::nullopt;
+    }
+    auto session = std::move(it->second);
+    m_sessions.erase(it);
+    if(session.expires <= std::chrono::steady_clock::now()) {
+        return std::nullopt;
+    }
+    return std::move(session.user);
+}
+
+std::optional<User> SessionTokens::find(const std::string& token) {
+    if(token.empty()) {
+        return std::nullopt;
+    }
+    std::lock_guard lock(m_mutex);
+    auto it = m_sessions.find(token);
+    if(it == m_sessions.end() || it->second.expires <= std::chrono::steady_clock::now()) {
+        return std::nullopt;
+    }
+    return it->second.user;
+}
+
+void SessionTokens::revoke(const std::string& token) {
+    std::lock_guard lock(m_mutex);
+    m_sessions.erase(token);
+}
+
+void SessionTokens::revokeUser(int32_t user_id) {
+    std::lock_guard lock(m_mutex);
+    std::erase_if(m_sessions, [user_id](const auto& session) { return session.second.user.id == user_id; });
+}
+
+std::vector<SessionTokens::Handed> SessionTokens::handOver() {
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<Handed> handed;
+    std::lock_guard lock(m_mutex);
+    handed.reserve(m_sessions.size());
+    for(const auto& [token, session] : m_sessions) {
+        if(session.expires > now) {
+            handed.push_back({token, session.user, std::chrono::ceil<std::chrono::milliseconds>(session.expires - now)});
+        }
+    }
+    return handed;
+}
+
+void SessionTokens::adopt(Handed handed) {
+    if(handed.token.empty() || handed.ttl.count() <= 0) {
+        return;
+    }
+    ensureTimer();
+    std::lock_guard lock(m_mutex);
+    m_sessions.insert_or_assign(std::move(handed.token), Session{std::move(handed.user), std::chrono::steady_clock::now() + handed.ttl});
+}
+
+void SessionTokens::ensureTimer() {
+    std::call_once(m_timer_started, [this] {
+        drogon::app().getIOLoop(0)->runEvery(SWEEP_INTERVAL_SECONDS, [this] { sweep(); });
+    });
+}
+
+void SessionTokens::sweep() {
+    std::lock_guard lock(m_mutex);
+    sweep_unsafe(std::chrono::steady_clock::now());
+}
+
+void SessionTokens::sweep_unsafe(std::chrono::steady_clock::time_point now) {
+    std::erase_if(m_sessions, [now](const auto& session) { return session.second.expires <= now; });
+}
+
+} // namespace server
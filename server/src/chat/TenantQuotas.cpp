@@ -0,0 +1,145 @@
+#include <server/chat/TenantQuotas.h>
+
+namespace server {
+
+static thread_local Tenant* t_current = nullptr;
+
+Tenant* currentTenant() noexcept {
+    return t_current;
+}
+
+void setCurrentTenant(Tenant* tenant) noexcept {
+    t_current = tenant;
+}
+
+/// @brief The counter of one tenant's requests or events held back by a quota.
+static common::Counter& throttled(const std::string& tenant, const char* quota) {
+    return common::MetricsRegistry::instance().counter(
+        "chat_tenant_throttled_total", "Requests rejected, broadcasts dropped and database operations delayed by the tenant quotas.",
+        "tenant=\"" + tenant + "\",quota=\"" + quota + "\"");
+}
+
+Tenant::Tenant(TenantConfig config)
+    : m_config(std::move(config)),
+      m_budget(std::max(m_config.broadcast_burst_bytes, m_config.broadcast_bytes_per_second)),
+      m_budget_updated(std::chrono::steady_clock::now()),
+      m_rejected(&throttled(m_config.name, "in_flight")),
+      m_dropped(&throttled(m_config.name, "broadcast")),
+      m_db_delayed(&throttled(m_config.name, "db_in_flight")) {
+    auto& metrics = common::MetricsRegistry::instance();
+    const auto labels = "tenant=\"" + m_config.name + "\"";
+    metrics.gauge("chat_tenant_requests_in_flight", "Requests of a tenant's rooms being handled right now.",
+        [this] { return static_cast<double>(m_in_flight.load(std::memory_order_relaxed)); }, labels);
+    metrics.gauge("chat_tenant_db_waiting", "Database operations of a tenant waiting for one of its slots.",
+        [this] {
+            std::lock_guard lock(m_db_mutex);
+            return static_cast<double>(m_db_waiting.size());
+        }, labels);
+}
+
+bool Tenant::tryEnterRequest() noexcept {
+    // Counted first and given back when over, so concurrent requests cannot all slip under the limit.
+    const auto in_flight = m_in_flight.fetch_add(1, std::memory_order_acq_rel) + 1;
+    if(m_config.max_in_flight > 0 && in_flight > m_config.max_in_flight) {
+        m_in_flight.fetch_sub(1, std::memory_order_acq_rel);
+        return false;
+    }
+    return true;
+}
+
+void Tenant::leaveRequest() noexcept {
+    m_in_flight.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+bool Tenant::acquireDb(std::function<void()> start) {
+    std::lock_guard lock(m_db_mutex);
+    if(m_db_in_flight < m_config.max_db_in_flight) {
+        ++m_db_in_flight;
+        return true;
+    }
+    m_db_waiting.push_back(std::move(start));
+    return false;
+}
+
+void Tenant::releaseDb() {
+    std::function<void()> next;
+    {
+        std::lock_guard lock(m_db_mutex);
+        if(m_db_waiting.empty()) {
+            --m_db_in_flight;
+            return;
+        }
+        // The slot passes straight to the next operation.
+        next = std::move(m_db_waiting.front());
+        m_db_waiting.pop_front();
+    }
+    next();
+}
+
+void Tenant::refill_unsafe(std::chrono::steady_clock::time_point now) {
+    const double burst = std::max(m_config.broadcast_burst_bytes, m_config.broadcast_bytes_per_second);
+    const double elapsed = std::chrono::duration<double>(now - m_budget_updated).count();
+    m_budget = std::min(burst, m_budget + elapsed * m_config.broadcast_bytes_per_second);
+    m_budget_updated = now;
+}
+
+bool Tenant::overBroadcastBudget() {
+    std::lock_guard lock(m_budget_mutex);
+    refill_unsafe(std::chrono::steady_clock::now());
+    return m_budget < 0;
+}
+
+std::chrono::steady_clock::duration Tenant::chargeBroadcast(size_t bytes) {
+    std::lock_guard lock(m_budget_mutex);
+    refill_unsafe(std::chrono::steady_clock::now());
+    m_budget -= static_cast<double>(bytes);
+    if(m_budget >= 0) {
+        return std::chrono::steady_clock::duration::zero();
+    }
+    return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(-m_budget / m_config.broadcast_bytes_per_second));
+}
+
+TenantQuotas& TenantQuotas::instance() {
+    static TenantQuotas inst;
+    return inst;
+}
+
+TenantQuotas::TenantQuotas() {
+    const auto& cfg = serverConfig().tenants;
+    if(!cfg.enabled) {
+        return;
+    }
+    for(const auto& group : cfg.groups) {
+        auto& tenant = m_tenants.emplace_back(std::make_unique<Tenant>(group));
+        for(const auto& [first, last] : group.rooms) {
+            if(first <= last) {
+                m_ranges.push_back({first, last, tenant.get()});
+            }
+        }
+    }
+    std::sort(m_ranges.begin(), m_ranges.end(), [](const Range& a, const Range& b) { return a.first < b.first; });
+    // Each room has one group, a range overlapping an earlier one is left out.
+    std::vector<Range> ranges;
+    for(const auto& range : m_ranges) {
+        if(!ranges.empty() && range.first <= ranges.back().last) {
+            LOG_WARN << "Rooms " << range.first << " to " << range.last << " of tenant '" << range.tenant->config().name
+                     << "' overlap those of '" << ranges.back().tenant->config().name << "', ignored";
+            continue;
+        }
+        ranges.push_back(range);
+    }
+    m_ranges = std::move(ranges);
+    LOG_INFO << "Tenant quotas on for " << m_tenants.size() << " room group(s)";
+}
+
+Tenant* TenantQuotas::tenantOf(int32_t room_id) const noexcept {
+    // The last range starting at or before the room, the ranges do not overlap.
+    auto it = std::upper_bound(m_ranges.begin(), m_ranges.end(), room_id, [](int32_t id, const Range& range) { return id < range.first; });
+    if(it == m_ranges.begin() || room_id > std::prev(it)->last) {
+        return nullptr;
+    }
+    return std::prev(it)->tenant;
+}
+
+} // namespace server
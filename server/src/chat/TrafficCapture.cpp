@@ -0,0 +1,181 @@
+#include <server/chat/TrafficCapture.h>
+#include <common/utils/capture.h>
+#include <common/utils/metrics.h>
+#include <common/utils/utils.h>
+
+namespace server {
+
+/// @brief The frames written to the capture.
+static common::Counter& capturedFrames() {
+    static auto& counter = common::MetricsRegistry::instance().counter(
+        "chat_capture_frames_total", "Client frames recorded by the traffic capture.");
+    return counter;
+}
+
+/// @brief Overwrites a string with filler of the same length.
+static void blank(std::string* text) {
+    std::fill(text->begin(), text->end(), 'x');
+}
+
+TrafficCapture& TrafficCapture::instance() {
+    static TrafficCapture inst;
+    return inst;
+}
+
+void TrafficCapture::start(const CaptureConfig& config) {
+    if(!config.enabled) {
+        return;
+    }
+    m_out.open(config.output, std::ios::binary | std::ios::trunc);
+    if(!m_out) {
+        LOG_ERROR << "Cannot open capture output " << config.output << ", traffic capture disabled";
+        return;
+    }
+    m_out << common::capture::MAGIC;
+    m_written = common::capture::MAGIC.size();
+    m_max_bytes = config.max_bytes;
+    m_started = std::chrono::steady_clock::now();
+    m_recording.store(true, std::memory_order_release);
+    drogon::app().getLoop()->runEvery(1.0, [this] { flush(); });
+    LOG_INFO << "Capturing client traffic to " << config.output;
+}
+
+uint64_t TrafficCapture::openConnection() noexcept {
+    return recording() ? m_next_connection.fetch_add(1, std::memory_order_relaxed) : 0;
+}
+
+bool TrafficCapture::sanitize(chat::Envelope& request) {
+    switch(request.payload_case()) {
+        case chat::Envelope::kInitialAuthRequest:
+        case chat::Envelope::kAuthRequest:
+        case chat::Envelope::kInitialRegisterRequest:
+        case chat::Envelope::kRegisterRequest:
+        case chat::Envelope::kResumeSessionRequest:
+        case chat::Envelope::kGetMySaltRequest:
+        case chat::Envelope::kChangePasswordRequest:
+        case chat::Envelope::kChangeUsernameRequest:
+        case chat::Envelope::kRegisterServerRequest:
+        case chat::Envelope::kGetServersRequest:
+        case chat::Envelope::kSubscribeServersRequest:
+        case chat::Envelope::kDrainServerRequest:
+        case chat::Envelope::PAYLOAD_NOT_SET:
+            return false;
+        case chat::Envelope::kSendMessageRequest:
+            blank(request.mutable_send_message_request()->mutable_message());
+            return true;
+        case chat::Envelope::kCreateRoomRequest:
+            blank(request.mutable_create_room_request()->mutable_room_name());
+            return true;
+        case chat::Envelope::kRenameRoomRequest:
+            blank(request.mutable_rename_room_request()->mutable_name());
+            return true;
+        case chat::Envelope::kSearchMessagesRequest:
+            blank(request.mutable_search_messages_request()->mutable_query());
+            return true;
+        case chat::Envelope::kGetRoomMembersRequest: {
+            auto& members = *request.mutable_get_room_members_request();
+            blank(members.mutable_prefix());
+            if(members.has_after()) {
+                blank(members.mutable_after()->mutable_user_name());
+            }
+            return true;
+        }
+        case chat::Envelope::kListRoomsRequest: {
+            auto& rooms = *request.mutable_list_rooms_request();
+            blank(rooms.mutable_prefix());
+            if(rooms.has_after_name()) {
+                blank(rooms.mutable_after_name());
+            }
+            return true;
+        }
+        // Ids, counts and flags only.
+        case chat::Envelope::kLogoutRequest:
+        case chat::Envelope::kJoinRoomRequest:
+        case chat::Envelope::kLeaveRoomRequest:
+        case chat::Envelope::kGetMessagesRequest:
+        case chat::Envelope::kGetMessagesAroundRequest:
+        case chat::Envelope::kDeleteRoomRequest:
+        case chat::Envelope::kAssignRoleRequest:
+        case chat::Envelope::kDeleteMessageRequest:
+        case chat::Envelope::kDeleteUserMessagesRequest:
+        case chat::Envelope::kUserTypingStartRequest:
+        case chat::Envelope::kUserTypingStopRequest:
+        case chat::Envelope::kBecomeMemberRequest:
+        case chat::Envelope::kSetCompressionRequest:
+        case chat::Envelope::kGetRoomServerRequest:
+        case chat::Envelope::kSyncRoomRequest:
+        case chat::Envelope::kSubscribeRoomsRequest:
+        case chat::Envelope::kMarkRoomReadRequest:
+            return true;
+        case chat::Envelope::kBatchRequest: {
+            auto& requests = *request.mutable_batch_request()->mutable_requests();
+            google::protobuf::RepeatedPtrField<chat::Envelope> kept;
+            for(auto& nested : requests) {
+                if(sanitize(nested)) {
+                    *kept.Add() = std::move(nested);
+                }
+            }
+            requests.Swap(&kept);
+            return !requests.empty();
+        }
+        // A request added later is dropped until it is known to carry no user text, or what it carries is blanked.
+        default:
+            return false;
+    }
+}
+
+void TrafficCapture::record(uint64_t connection, const chat::Envelope& request) {
+    if(connection == 0 || !recording()) {
+        return;
+    }
+    chat::Envelope copy = request;
+    if(!sanitize(copy)) {
+        return;
+    }
+    append(connection, copy.SerializeAsString());
+}
+
+void TrafficCapture::recordClose(uint64_t connection) {
+    if(connection != 0 && recording()) {
+        append(connection, {});
+    }
+}
+
+void TrafficCapture::append(uint64_t connection, std::string_view frame) {
+    const auto time_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_started).count();
+    std::lock_guard lock(m_mutex);
+    if(m_buffer.size() + frame.size() > MAX_BUFFERED_BYTES) {
+        ++m_dropped;
+        return;
+    }
+    common::capture::appendRecord(m_buffer, static_cast<uint64_t>(time_us), connection, frame);
+    if(!frame.empty()) {
+        capturedFrames().inc();
+    }
+}
+
+void TrafficCapture::flush() {
+    std::string pending;
+    uint64_t dropped = 0;
+    {
+        std::lock_guard lock(m_mutex);
+        pending.swap(m_buffer);
+        std::swap(dropped, m_dropped);
+    }
+    if(dropped > 0) {
+        LOG_WARN << "Dropped " << dropped << " captured frame(s), the output cannot keep up";
+    }
+    if(pending.empty() || !recording()) {
+        return;
+    }
+    m_out << pending;
+    m_out.flush();
+    m_written += pending.size();
+    if(m_written >= m_max_bytes) {
+        m_recording.store(false, std::memory_order_relaxed);
+        m_out.close();
+        LOG_WARN << "Traffic capture reached " << m_written << " bytes, stopped recording";
+    }
+}
+
+} // namespace server
@@ -0,0 +1,97 @@
+#include <server/chat/TypingAggregator.h>
+#include <server/chat/ChatRoomManager.h>
+#include <server/utils/server_config.h>
+
+namespace server {
+
+TypingAggregator& TypingAggregator::instance() {
+    static TypingAggregator inst;
+    return inst;
+}
+
+void TypingAggregator::ensureTimer() {
+    std::call_once(m_timer_started, [this] {
+        const double interval = std::chrono::duration<double>(serverConfig().typing.interval).count();
+        drogon::app().getIOLoop(0)->runEvery(std::max(interval, 0.05), [this] { flush(); });
+    });
+}
+
+void TypingAggregator::setTyping(int32_t room_id, const chat::UserInfo& user, bool typing) {
+    ensureTimer();
+
+    std::lock_guard lock(m_mutex);
+    if(typing) {
+        auto& room = m_rooms[room_id];
+        auto [it, added] = room.users.try_emplace(user.user_id(), user);
+        // A typist renamed or given other rights meanwhile is shown as they are now.
+        if(!added && (it->second.user_name() != user.user_name() || it->second.user_room_rights() != user.user_room_rights()
+                      || it->second.has_user_room_rights() != user.has_user_room_rights())) {
+            it->second = user;
+            added = true;
+        }
+        if(added) {
+            m_dirty.insert(room_id);
+        }
+        return;
+    }
+    if(auto it = m_rooms.find(room_id); it != m_rooms.end() && it->second.users.erase(user.user_id())) {
+        m_dirty.insert(room_id);
+    }
+}
+
+void TypingAggregator::removeUser(int32_t room_id, int32_t user_id) {
+    std::lock_guard lock(m_mutex);
+    if(auto it = m_rooms.find(room_id); it != m_rooms.end() && it->second.users.erase(user_id)) {
+        m_dirty.insert(room_id);
+    }
+}
+
+void TypingAggregator::dropRoom(int32_t room_id) {
+    std::lock_guard lock(m_mutex);
+    m_rooms.erase(room_id);
+    m_dirty.erase(room_id);
+}
+
+void TypingAggregator::flush() {
+    std::vector<std::pair<int32_t, chat::Envelope>> updates;
+    {
+        std::lock_guard lock(m_mutex);
+        if(m_dirty.empty()) {
+            return;
+        }
+        for(int32_t room_id : m_dirty) {
+            auto it = m_rooms.find(room_id);
+            if(it == m_rooms.end()) {
+                continue;
+            }
+            auto& room = it->second;
+
+            chat::Envelope env;
+            auto* snapshot = env.mutable_room_typing_users();
+            for(const auto& [user_id, user] : room.users) {
+                *snapshot->add_users() = user;
+            }
+            // A start and a stop within the same interval leave nothing to tell.
+            auto sent = snapshot->SerializeAsString();
+            snapshot->set_room_id(room_id);
+            if(sent != room.last_sent) {
+                room.last_sent = std::move(sent);
+                updates.emplace_back(room_id, std::move(env));
+            }
+
+            // A room nobody types in is forgotten, the next typist starts it afresh from an empty snapshot.
+            if(room.users.empty()) {
+                m_rooms.erase(it);
+            }
+        }
+        m_dirty.clear();
+    }
+
+    for(auto& [room_id, env] : updates) {
+        drogon::async_run([room_id, env = std::move(env)]() -> drogon::Task<> {
+            co_await ChatRoomManager::instance().sendToRoom(room_id, env);
+        });
+    }
+}
+
+} // namespace server
@@ -0,0 +1,178 @@
+#include <server/chat/UpgradeHandoff.h>
+#include <server/chat/SessionTokens.h>
+#include <server/chat/ServerDrain.h>
+#include <server/chat/UserDirectory.h>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+namespace server {
+
+/// How often the waiting thread looks whether the server is stopping.
+static constexpr int POLL_TIMEOUT_MS = 1000;
+
+UpgradeHandoff& UpgradeHandoff::instance() {
+    static UpgradeHandoff inst;
+    return inst;
+}
+
+void UpgradeHandoff::start(const UpgradeConfig& cfg, std::function<void()> taken_over) {
+    m_thread = std::jthread([this, path = cfg.socket_path, taken_over = std::move(taken_over)](std::stop_token stop) {
+        takeOver(path);
+        drogon::app().getLoop()->queueInLoop(taken_over);
+        serve(path, stop);
+    });
+}
+
+#ifndef _WIN32
+
+/// @brief The address of the socket at `path`, false if it does not fit.
+static bool socketAddress(const std::string& path, sockaddr_un& addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path)) {
+        LOG_ERROR << "Upgrade socket path too long: " << path;
+        return false;
+    }
+    std::memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+/// @brief Whether the process at the other end of `fd` runs as the same user as this one.
+static bool sameUser(int fd) {
+#ifdef SO_PEERCRED
+    ucred cred{};
+    socklen_t length = sizeof(cred);
+    return ::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) == 0 && cred.uid == ::geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return ::getpeereid(fd, &uid, &gid) == 0 && uid == ::geteuid();
+#endif
+}
+
+bool UpgradeHandoff::takeOver(const std::string& path) {
+    sockaddr_un addr;
+    if(!socketAddress(path, addr)) {
+        return false;
+    }
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        return false;
+    }
+    if(::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+        ::close(fd);
+        LOG_INFO << "No server to take over from on " << path;
+        return false;
+    }
+    // Sessions are only taken from a server of our own user, not from whoever bound the path.
+    if(!sameUser(fd)) {
+        ::close(fd);
+        LOG_ERROR << "The process on " << path << " runs as another user, not taking over from it";
+        return false;
+    }
+    // The predecessor writes the handoff and closes, the end of the stream ends it.
+    std::string bytes;
+    char buffer[64 * 1024];
+    ssize_t n;
+    while((n = ::read(fd, buffer, sizeof(buffer))) > 0) {
+        bytes.append(buffer, static_cast<size_t>(n));
+    }
+    ::close(fd);
+    chat::UpgradeHandoff handoff;
+    if(n < 0 || !handoff.ParseFromString(bytes)) {
+        LOG_ERROR << "Malformed handoff from the previous server, its clients log in again";
+        return false;
+    }
+    for(const auto& session : handoff.sessions()) {
+        SessionTokens::instance().adopt({
+            .token = session.token(),
+            .user = {session.user_id(), UserDirectory::instance().acquire(session.user_id(), session.username())},
+            .ttl = std::chrono::milliseconds{session.ttl_ms()},
+        });
+    }
+    LOG_INFO << "Took over " << handoff.sessions_size() << " sessions from the previous server";
+    return true;
+}
+
+void UpgradeHandoff::serve(const std::string& path, std::stop_token stop) {
+    sockaddr_un addr;
+    if(!socketAddress(path, addr)) {
+        return;
+    }
+    const int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listener < 0) {
+        return;
+    }
+    // Left behind by the predecessor, or by a process that did not stop cleanly.
+    ::unlink(path.c_str());
+    // The socket hands out every live session token: only our own user may connect, see also `sameUser`.
+    if(::bind(listener, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0 || ::chmod(path.c_str(), 0600) != 0
+       || ::listen(listener, 1) != 0) {
+        LOG_ERROR << "Failed to listen for an upgrade on " << path << ": " << std::strerror(errno);
+        ::close(listener);
+        return;
+    }
+    pollfd waiting{.fd = listener, .events = POLLIN, .revents = 0};
+    while(!stop.stop_requested()) {
+        if(::poll(&waiting, 1, POLL_TIMEOUT_MS) <= 0) {
+            continue;
+        }
+        const int fd = ::accept(listener, nullptr, nullptr);
+        if(fd < 0) {
+            continue;
+        }
+        if(!sameUser(fd)) {
+            LOG_WARN << "Refused an upgrade handoff to a process of another user";
+            ::close(fd);
+            continue;
+        }
+        chat::UpgradeHandoff handoff;
+        for(auto& handed : SessionTokens::instance().handOver()) {
+            auto* session = handoff.add_sessions();
+            session->set_token(std::move(handed.token));
+            session->set_user_id(handed.user.id);
+            session->set_username(*handed.user.name());
+            session->set_ttl_ms(handed.ttl.count());
+        }
+        const auto bytes = handoff.SerializeAsString();
+        size_t written = 0;
+        while(written < bytes.size()) {
+            const auto n = ::write(fd, bytes.data() + written, bytes.size() - written);
+            if(n <= 0) {
+                break;
+            }
+            written += static_cast<size_t>(n);
+        }
+        ::close(fd);
+        if(written < bytes.size()) {
+            LOG_ERROR << "Handoff to the next server cut short, waiting for it to try again";
+            continue;
+        }
+        LOG_INFO << "Handed " << handoff.sessions_size() << " sessions over to the next server";
+        // The socket is the successor's now, it binds it again.
+        ::close(listener);
+        drogon::app().getLoop()->queueInLoop([] { ServerDrain::instance().startUpgrade(); });
+        return;
+    }
+    ::close(listener);
+}
+
+#else
+
+bool UpgradeHandoff::takeOver(const std::string&) {
+    LOG_WARN << "Upgrades in place are not supported on this platform";
+    return false;
+}
+
+void UpgradeHandoff::serve(const std::string&, std::stop_token) {}
+
+#endif
+
+} // namespace server
@@ -0,0 +1,61 @@
+#include <server/chat/UserDirectory.h>
+#include <common/utils/metrics.h>
+
+namespace server {
+
+UserDirectory& UserDirectory::instance() {
+    static UserDirectory inst;
+    return inst;
+}
+
+UserDirectory::UserDirectory() {
+    common::MetricsRegistry::instance().gauge(
+        "chat_user_directory_entries", "Users with a name shared by their local connections.", [this] { return static_cast<double>(size()); });
+}
+
+std::shared_ptr<SharedUserName> UserDirectory::acquire(int32_t user_id, const std::string& name) {
+    std::lock_guard lock(m_mutex);
+    auto& entry = m_names[user_id];
+    if(auto shared = entry.lock()) {
+        if(*shared->get() != name) {
+            shared->set(name);
+        }
+        return shared;
+    }
+    // The directory itself is a singleton, it outlives every name it hands out.
+    std::shared_ptr<SharedUserName> shared(new SharedUserName(name), [this, user_id](SharedUserName* released) {
+        delete released;
+        this->release(user_id);
+    });
+    entry = shared;
+    return shared;
+}
+
+void UserDirectory::rename(int32_t user_id, const std::string& name) {
+    std::shared_ptr<SharedUserName> shared;
+    {
+        std::lock_guard lock(m_mutex);
+        if(auto it = m_names.find(user_id); it != m_names.end()) {
+            shared = it->second.lock();
+        }
+    }
+    // Set, and released, outside of the lock, the release of the last holder takes it.
+    if(shared) {
+        shared->set(name);
+    }
+}
+
+size_t UserDirectory::size() const {
+    std::lock_guard lock(m_mutex);
+    return m_names.size();
+}
+
+void UserDirectory::release(int32_t user_id) {
+    std::lock_guard lock(m_mutex);
+    // A later acquire may already have replaced the entry with a live one.
+    if(auto it = m_names.find(user_id); it != m_names.end() && it->second.expired()) {
+        m_names.erase(it);
+    }
+}
+
+} // namespace server
@@ -0,0 +1,105 @@
+#include <server/chat/UsernameFilter.h>
+#include <server/utils/server_config.h>
+#include <server/utils/switch_to_io_loop.h>
+#include <cmath>
+
+namespace server {
+
+namespace sql {
+
+// Keyset pages, so loading a large table never holds one huge result.
+static const std::string USERNAMES_PAGE =
+    "SELECT user_id, username FROM users WHERE user_id > $1 ORDER BY user_id LIMIT $2";
+
+} // namespace sql
+
+/// Usernames read per query while loading.
+static constexpr int64_t LOAD_PAGE_SIZE = 10'000;
+
+/// @brief Spreads the bits of a hash, the second hash is derived from the first with it.
+static uint64_t mix(uint64_t x) noexcept {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+UsernameFilter& UsernameFilter::instance() {
+    static UsernameFilter inst;
+    return inst;
+}
+
+UsernameFilter::UsernameFilter() {
+    const auto& cfg = serverConfig().username_filter;
+    m_enabled = cfg.enabled;
+    if(!m_enabled) {
+        return;
+    }
+    // The optimal sizes for n names at a false positive rate p: n * -ln(p) / ln(2)^2 bits, ln(2) * bits / n hashes.
+    const double n = static_cast<double>(std::max<size_t>(cfg.expected_users, 1));
+    const double p = std::clamp(cfg.false_positive_rate, 1e-9, 0.5);
+    const double bits = std::ceil(n * -std::log(p) / (std::log(2.0) * std::log(2.0)));
+    const size_t words = std::max<size_t>(static_cast<size_t>(bits / 64) + 1, 1);
+    m_bit_count = words * 64;
+    m_hash_count = std::max<size_t>(static_cast<size_t>(std::round(std::log(2.0) * static_cast<double>(m_bit_count) / n)), 1);
+    m_words = std::make_unique<std::atomic<uint64_t>[]>(words);
+}
+
+std::pair<uint64_t, uint64_t> UsernameFilter::hashes(std::string_view username) const noexcept {
+    const uint64_t first = std::hash<std::string_view>{}(username);
+    // Odd, so the probes of one name never collapse onto one bit.
+    return {first, mix(first) | 1};
+}
+
+void UsernameFilter::add(std::string_view username) noexcept {
+    if(!m_enabled) {
+        return;
+    }
+    const auto [first, second] = hashes(username);
+    for(size_t i = 0; i < m_hash_count; ++i) {
+        const uint64_t bit = (first + i * second) % m_bit_count;
+        m_words[bit / 64].fetch_or(uint64_t{1} << (bit % 64), std::memory_order_relaxed);
+    }
+}
+
+bool UsernameFilter::mayExist(std::string_view username) const noexcept {
+    if(!m_enabled || !m_loaded.load(std::memory_order_acquire)) {
+        return true;
+    }
+    const auto [first, second] = hashes(username);
+    for(size_t i = 0; i < m_hash_count; ++i) {
+        const uint64_t bit = (first + i * second) % m_bit_count;
+        if(!(m_words[bit / 64].load(std::memory_order_relaxed) & (uint64_t{1} << (bit % 64)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+drogon::Task<size_t> UsernameFilter::load(const drogon::orm::DbClientPtr& db) {
+    if(!m_enabled) {
+        co_return 0;
+    }
+    size_t loaded = 0;
+    int32_t after = 0;
+    for(;;) {
+        auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql::USERNAMES_PAGE, after, LOAD_PAGE_SIZE));
+        for(const auto& row : rows) {
+            add(row["username"].as<std::string>());
+            after = row["user_id"].as<int32_t>();
+        }
+        loaded += rows.size();
+        if(static_cast<int64_t>(rows.size()) < LOAD_PAGE_SIZE) {
+            break;
+        }
+    }
+    if(loaded > serverConfig().username_filter.expected_users) {
+        LOG_WARN << "The username filter is sized for " << serverConfig().username_filter.expected_users << " users but "
+                 << loaded << " exist, raise username_filter.expected_users";
+    }
+    m_loaded.store(true, std::memory_order_release);
+    co_return loaded;
+}
+
+} // namespace server
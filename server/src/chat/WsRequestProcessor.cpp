@@ -1,8 +1,13 @@
 #include <server/chat/WsRequestProcessor.h>
 #include <server/chat/WsData.h>
+#include <server/chat/ConnectionContext.h>
+#include <server/chat/RequestArena.h>
 #include <server/chat/MessageHandlerService.h>
-#include <server/chat/DrogonRoomService.h>
+#include <server/chat/ClusterRoomService.h>
+#include <server/chat/TrafficCapture.h>
+#include <server/utils/server_config.h>
 #include <common/utils/utils.h>
+#include <common/utils/tracing.h>
 
 namespace server {
 
@@ -11,25 +16,213 @@ WsRequestProcessor::WsRequestProcessor(std::unique_ptr<MessageHandlerService> di
 
 WsRequestProcessor::~WsRequestProcessor() = default;
 
-drogon::Task<> WsRequestProcessor::handleIncomingMessage(drogon::WebSocketConnectionPtr conn, std::string bytes) const {
+static drogon::Task<ConnectionContext::Response> malformedResponse() {
+    co_return std::make_shared<const chat::Envelope>(common::makeGenericErrorEnvelope("Malformed protobuf message"));
+}
+
+/// @brief Serializes one frame of a reply, compresses it when the connection asked for it, and sends it.
+static void sendFrame(const drogon::WebSocketConnectionPtr& conn, chat::Compression compression, const chat::Envelope& env, int64_t& sent_bytes) {
+    auto bytes = common::serializeEnvelope(env);
+    if(bytes && compression != chat::COMPRESSION_NONE && bytes->size() >= serverConfig().compression.min_bytes) {
+        bytes = common::compressEnvelope(bytes, compression);
+    }
+    if(bytes) {
+        sent_bytes += static_cast<int64_t>(bytes->size());
+    }
+    sendResponseToConnection(conn, std::move(bytes));
+}
+
+template <typename Item>
+static void copyItems(const google::protobuf::RepeatedPtrField<Item>& from, int begin, int end, google::protobuf::RepeatedPtrField<Item>& to) {
+    to.Reserve(end - begin);
+    for(int i = begin; i < end; ++i) {
+        *to.Add() = from[i];
+    }
+}
+
+/// @brief All fields of a login response besides its rooms, a field added later is carried along.
+template <typename LoginResponse>
+static void copyLoginFields(const LoginResponse& from, LoginResponse& to) {
+    to.CopyFrom(from);
+    to.clear_rooms();
+}
+
+/**
+ * @brief Sends `count` items as chunks of at most `per_chunk` items and `max_bytes` bytes, the response itself carrying the last one.
+ * @details `item_bytes` gives the encoded size of an item, `fill_chunk` builds the chunk envelope of
+ * items [begin, end), `fill_last` the response with the items from `begin` on. Only one frame is
+ * held in memory at a time.
+ */
+static void sendChunked(int count, size_t per_chunk, size_t max_bytes, const std::function<size_t(int)>& item_bytes,
+                        const std::function<void(chat::Envelope&, int, int)>& fill_chunk,
+                        const std::function<void(chat::Envelope&, int)>& fill_last, const std::function<void(const chat::Envelope&)>& send) {
+    int begin = 0;
+    for(;;) {
+        int end = begin;
+        size_t bytes = 0;
+        while(end < count && static_cast<size_t>(end - begin) < per_chunk) {
+            const size_t next = item_bytes(end);
+            if(end > begin && bytes + next > max_bytes) {
+                break;
+            }
+            bytes += next;
+            ++end;
+        }
+        if(end == count) {
+            break;
+        }
+        chat::Envelope chunk;
+        fill_chunk(chunk, begin, end);
+        send(chunk);
+        begin = end;
+    }
+    chat::Envelope last;
+    fill_last(last, begin);
+    send(last);
+}
+
+static void sendReply(const drogon::WebSocketConnectionPtr& conn, const WsDataPtr& wsData, const chat::Envelope& response,
+                      const common::TracePtr& trace) {
+    common::Span span("reply", trace);
+    // Replies are sent on the connection's loop, where its WsData is only ever changed by its own jobs.
+    const auto compression = wsData->get_unsafe().compression;
+    int64_t sent_bytes = 0;
+    const auto send = [&](const chat::Envelope& env) { sendFrame(conn, compression, env, sent_bytes); };
+
+    // Large history pages and room lists go out in bounded frames the client can show as they come,
+    // instead of one frame serialized in full next to the response it was built from.
+    const auto& chunking = serverConfig().chunked_responses;
+    const auto per_chunk = chunking.items_per_chunk;
+    const auto max_bytes = chunking.max_chunk_bytes;
+    const auto larger = [&](int count, const google::protobuf::MessageLite& resp) {
+        return chunking.enabled && (static_cast<size_t>(count) > per_chunk || resp.ByteSizeLong() > max_bytes);
+    };
+    // A packed page has no items to split, it is sent whole.
+    if(response.has_get_messages_response() && !response.get_messages_response().has_packed() && larger(response.get_messages_response().message_size(), response.get_messages_response())) {
+        const auto& resp = response.get_messages_response();
+        sendChunked(resp.message_size(), per_chunk, max_bytes, [&](int i) { return resp.message(i).ByteSizeLong(); },
+            [&](chat::Envelope& env, int begin, int end) { copyItems(resp.message(), begin, end, *env.mutable_messages_chunk()->mutable_message()); },
+            [&](chat::Envelope& env, int begin) {
+                auto& last = *env.mutable_get_messages_response();
+                *last.mutable_status() = resp.status();
+                copyItems(resp.message(), begin, resp.message_size(), *last.mutable_message());
+            },
+            send);
+    } else if(response.has_auth_response() && larger(response.auth_response().rooms_size(), response.auth_response())) {
+        const auto& resp = response.auth_response();
+        sendChunked(resp.rooms_size(), per_chunk, max_bytes, [&](int i) { return resp.rooms(i).ByteSizeLong(); },
+            [&](chat::Envelope& env, int begin, int end) { copyItems(resp.rooms(), begin, end, *env.mutable_room_list_chunk()->mutable_rooms()); },
+            [&](chat::Envelope& env, int begin) {
+                auto& last = *env.mutable_auth_response();
+                copyLoginFields(resp, last);
+                copyItems(resp.rooms(), begin, resp.rooms_size(), *last.mutable_rooms());
+            },
+            send);
+    } else if(response.has_resume_session_response() && larger(response.resume_session_response().rooms_size(), response.resume_session_response())) {
+        const auto& resp = response.resume_session_response();
+        sendChunked(resp.rooms_size(), per_chunk, max_bytes, [&](int i) { return resp.rooms(i).ByteSizeLong(); },
+            [&](chat::Envelope& env, int begin, int end) { copyItems(resp.rooms(), begin, end, *env.mutable_room_list_chunk()->mutable_rooms()); },
+            [&](chat::Envelope& env, int begin) {
+                auto& last = *env.mutable_resume_session_response();
+                copyLoginFields(resp, last);
+                copyItems(resp.rooms(), begin, resp.rooms_size(), *last.mutable_rooms());
+            },
+            send);
+    } else {
+        send(response);
+    }
+    if(span) {
+        span.setAttribute("message.bytes", sent_bytes);
+    }
+}
+
+void WsRequestProcessor::handleIncomingMessage(const drogon::WebSocketConnectionPtr& conn, std::string_view bytes) const {
+    auto ctx = conn->getContext<ConnectionContext>();
+    if(!ctx) {
+        return;
+    }
+
+    // Owned by the request's callbacks, the trace is written out once the reply has been sent.
+    auto trace = common::Tracer::instance().sample("chat.request");
+
+    auto exchange = std::make_shared<RequestArena>();
+    bool parsed = false;
+    {
+        common::Span span("parse", trace);
+        span.setAttribute("message.bytes", static_cast<int64_t>(bytes.size()));
+        // Straight from the frame, one pass that copies the strings onto the arena and nothing else.
+        parsed = exchange->request->ParseFromArray(bytes.data(), static_cast<int>(bytes.size()));
+    }
+    if(parsed && trace) {
+        trace->setName(m_dispatcher->requestName(exchange->request->payload_case()));
+    }
+    if(parsed && ctx->captureId() != 0) {
+        TrafficCapture::instance().record(ctx->captureId(), *exchange->request);
+    }
+
+    // Nothing to wait for, so the request is answered on the spot and its reply is still in order.
+    if(parsed && ctx->idle() && m_dispatcher->isImmediate(*exchange->request)) {
+        answerImmediately(conn, ctx->data(), *exchange, trace);
+        return;
+    }
+
+    ConnectionContext::Request request;
+    request.reply = [conn, wsData = ctx->data(), trace](const chat::Envelope& response) {
+        sendReply(conn, wsData, response, trace);
+    };
+    if(!parsed) {
+        request.run = malformedResponse;
+    } else {
+        request.concurrent = MessageHandlerService::canRunConcurrently(*exchange->request);
+        request.run = [this, conn, wsData = ctx->data(), exchange = std::move(exchange), trace, queued = std::chrono::steady_clock::now()]() mutable {
+            if(trace) {
+                trace->addSpan("queue", queued, std::chrono::steady_clock::now());
+            }
+            return processRequest(conn, wsData, std::move(exchange), std::move(trace));
+        };
+    }
+    ctx->postRequest(std::move(request));
+}
+
+void WsRequestProcessor::answerImmediately(const drogon::WebSocketConnectionPtr& conn, const WsDataPtr& wsData, RequestArena& exchange,
+                                           const common::TracePtr& trace) const {
+    common::setCurrentTrace(trace);
+    try {
+        ClusterRoomService room_service{conn};
+        m_dispatcher->processImmediately(wsData, *exchange.request, room_service, *exchange.response);
+    } catch(const std::exception& e) {
+        if(trace) {
+            trace->setAttribute("error", std::string(e.what()));
+        }
+        LOG_ERROR << "Critical error in WsRequestProcessor::answerImmediately: " << e.what();
+        *exchange.response = common::makeGenericErrorEnvelope("Critical server error during message handling.");
+    }
+    common::setCurrentTrace(nullptr);
+    sendReply(conn, wsData, *exchange.response, trace);
+}
+
+drogon::Task<ConnectionContext::Response> WsRequestProcessor::processRequest(drogon::WebSocketConnectionPtr conn, WsDataPtr wsData,
+                                                                             std::shared_ptr<RequestArena> exchange, common::TracePtr trace) const {
+    common::setCurrentTrace(trace);
     try {
         auto initialThreadIdx = drogon::app().getCurrentThreadIndex();
 
-        chat::Envelope env;
-        if(!env.ParseFromString(bytes)) {
-            common::sendEnvelope(conn, common::makeGenericErrorEnvelope("Malformed protobuf message"));
-            co_return;
-        }
-        DrogonRoomService room_service{conn};
-        common::sendEnvelope(conn, co_await m_dispatcher->processMessage(conn->getContext<WsDataGuarded>(), env, room_service));
-        
+        ClusterRoomService room_service{conn};
+        co_await m_dispatcher->processMessage(wsData, *exchange->request, room_service, *exchange->response);
+
         if(initialThreadIdx != drogon::app().getCurrentThreadIndex()) {
             throw std::runtime_error("thread idx mismatch! did you forget switch_to_io_loop?");
         }
+        common::setCurrentTrace(nullptr);
+        co_return RequestArena::responseOf(exchange);
     } catch(const std::exception& e) {
-        LOG_ERROR << "Critical error in WsRequestProcessor::handleIncomingMessage: " << e.what();
-        common::sendEnvelope(conn, common::makeGenericErrorEnvelope("Critical server error during message handling."));
-        co_return;
+        common::setCurrentTrace(nullptr);
+        if(trace) {
+            trace->setAttribute("error", std::string(e.what()));
+        }
+        LOG_ERROR << "Critical error in WsRequestProcessor::processRequest: " << e.what();
+        *exchange->response = common::makeGenericErrorEnvelope("Critical server error during message handling.");
+        co_return RequestArena::responseOf(exchange);
     }
 }
 
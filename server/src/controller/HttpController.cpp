@@ -1,4 +1,12 @@
 #include <server/controller/HttpController.h>
+#include <server/chat/CacheWarmup.h>
+#include <server/chat/ServerDrain.h>
+#include <server/chat/HistoryExport.h>
+#include <server/chat/SessionTokens.h>
+#include <server/chat/Introspection.h>
+#include <server/db/Repository.h>
+#include <server/utils/server_config.h>
+#include <common/utils/metrics.h>
 
 namespace server {
 
@@ -12,6 +20,141 @@ void HttpController::healthCheck([[maybe_unused]] const HttpRequestPtr& req, std
     callback(resp);
 }
 
+void HttpController::readinessCheck([[maybe_unused]] const HttpRequestPtr& req, std::function<void(const HttpResponsePtr&)>&& callback) const {
+    const bool draining = ServerDrain::instance().draining();
+    const bool ready = CacheWarmup::instance().ready() && !draining;
+    auto resp = HttpResponse::newHttpResponse();
+    resp->setStatusCode(ready ? k200OK : k503ServiceUnavailable);
+    resp->setContentTypeCode(CT_TEXT_PLAIN);
+    resp->setBody(ready ? "READY" : draining ? "DRAINING" : "STARTING");
+    callback(resp);
+}
+
+void HttpController::metrics([[maybe_unused]] const HttpRequestPtr& req, std::function<void(const HttpResponsePtr&)>&& callback) const {
+    auto resp = HttpResponse::newHttpResponse();
+    resp->setStatusCode(k200OK);
+    resp->setContentTypeCodeAndCustomString(CT_TEXT_PLAIN, "text/plain; version=0.0.4; charset=utf-8");
+    resp->setBody(common::MetricsRegistry::instance().render());
+    callback(resp);
+}
+
+static HttpResponsePtr textResponse(HttpStatusCode code, const std::string& body) {
+    auto resp = HttpResponse::newHttpResponse();
+    resp->setStatusCode(code);
+    resp->setContentTypeCode(CT_TEXT_PLAIN);
+    resp->setBody(body);
+    return resp;
+}
+
+/// @brief The user whose session token the request carries as `Authorization: Bearer <token>`.
+static auto sessionUser(const HttpRequestPtr& req) {
+    static const std::string bearer = "Bearer ";
+    const auto authorization = req->getHeader("Authorization");
+    return authorization.starts_with(bearer)
+        ? SessionTokens::instance().find(authorization.substr(bearer.size()))
+        : std::nullopt;
+}
+
+drogon::Task<HttpResponsePtr> HttpController::exportHistory(HttpRequestPtr req, int32_t room_id) const {
+    if(!serverConfig().history_export.enabled) {
+        co_return textResponse(k404NotFound, "Not found");
+    }
+    const auto user = sessionUser(req);
+    if(!user) {
+        co_return textResponse(k401Unauthorized, "Invalid or expired session");
+    }
+
+    const auto format_param = req->getParameter("format");
+    const auto compress_param = req->getParameter("compress");
+    if(!format_param.empty() && format_param != "ndjson" && format_param != "protobuf") {
+        co_return textResponse(k400BadRequest, "format must be ndjson or protobuf");
+    }
+    if(!compress_param.empty() && compress_param != "gzip" && compress_param != "none") {
+        co_return textResponse(k400BadRequest, "compress must be gzip or none");
+    }
+    const auto format = format_param == "protobuf" ? HistoryExport::Format::Protobuf : HistoryExport::Format::Ndjson;
+    const bool gzip = compress_param != "none";
+
+    std::optional<int64_t> last_seq;
+    try {
+        last_seq = co_await Repository::findModeratedLastSeq(readDbClient(), user->id, room_id);
+    } catch(const std::exception& e) {
+        LOG_ERROR << "History export of room " << room_id << " not started: " << e.what();
+        co_return textResponse(k503ServiceUnavailable, "Try again later");
+    }
+    if(!last_seq) {
+        co_return textResponse(k403Forbidden, "Only the room's moderators may export it");
+    }
+
+    auto slot = HistoryExport::instance().tryAcquire();
+    if(!slot) {
+        co_return textResponse(k429TooManyRequests, "Too many exports running, try again later");
+    }
+    // The slot goes with the response if the client leaves before the stream starts.
+    auto resp = HttpResponse::newAsyncStreamResponse([slot, room_id, last_seq = *last_seq, format, gzip](ResponseStreamPtr stream) {
+        drogon::async_run([slot, stream = std::move(stream), room_id, last_seq, format, gzip]() mutable -> drogon::Task<> {
+            co_await HistoryExport::instance().stream(std::move(slot), std::move(stream), room_id, last_seq, format, gzip);
+        });
+    });
+    const std::string extension = std::string(format == HistoryExport::Format::Ndjson ? ".ndjson" : ".pb") + (gzip ? ".gz" : "");
+    resp->setContentTypeCodeAndCustomString(CT_CUSTOM, gzip ? "application/gzip"
+        : format == HistoryExport::Format::Ndjson ? "application/x-ndjson" : "application/octet-stream");
+    resp->addHeader("Content-Disposition", "attachment; filename=\"room-" + std::to_string(room_id) + extension + "\"");
+    resp->addHeader("X-Export-Last-Seq", std::to_string(*last_seq));
+    co_return resp;
+}
+
+/**
+ * @brief Runs `serve` once the session of the request turns out to be a global admin's, answers the error otherwise.
+ * @param action What the admin is about to do, for the logs and the 403.
+ */
+static void asGlobalAdmin(const HttpRequestPtr& req, std::function<void(const HttpResponsePtr&)>&& callback, std::string action,
+                          std::function<void(std::function<void(const HttpResponsePtr&)>)> serve) {
+    const auto user = sessionUser(req);
+    if(!user) {
+        callback(textResponse(k401Unauthorized, "Invalid or expired session"));
+        return;
+    }
+    drogon::async_run([user_id = user->id, callback = std::move(callback), action = std::move(action), serve = std::move(serve)]() -> drogon::Task<> {
+        bool admin = false;
+        try {
+            const auto row = co_await Repository::findUserById(readDbClient(), user_id);
+            admin = row && row->getValueOfIsAdmin();
+        } catch(const std::exception& e) {
+            LOG_ERROR << action << " for user " << user_id << " not started: " << e.what();
+            callback(textResponse(k503ServiceUnavailable, "Try again later"));
+            co_return;
+        }
+        if(!admin) {
+            callback(textResponse(k403Forbidden, "Only global admins may " + action));
+            co_return;
+        }
+        serve(std::move(callback));
+    });
+}
+
+void HttpController::introspect(const HttpRequestPtr& req, std::function<void(const HttpResponsePtr&)>&& callback) const {
+    if(!serverConfig().introspection.enabled) {
+        callback(textResponse(k404NotFound, "Not found"));
+        return;
+    }
+    asGlobalAdmin(req, std::move(callback), "introspect the server", [](std::function<void(const HttpResponsePtr&)> callback) {
+        Introspection::collect(serverConfig().introspection, [callback = std::move(callback)](Json::Value snapshot) {
+            callback(HttpResponse::newHttpJsonResponse(std::move(snapshot)));
+        });
+    });
+}
+
+void HttpController::profile(const HttpRequestPtr& req, std::function<void(const HttpResponsePtr&)>&& callback, const std::string& kind) const {
+    if(!serverConfig().profiling.enabled) {
+        callback(textResponse(k404NotFound, "Not found"));
+        return;
+    }
+    asGlobalAdmin(req, std::move(callback), "profile the server", [req, kind](std::function<void(const HttpResponsePtr&)> callback) {
+        common::serveProfile(serverConfig().profiling, req, kind, std::move(callback));
+    });
+}
+
 } // namespace http
 
 } // namespace server
@@ -3,7 +3,16 @@
 #include <server/chat/MessageHandlerService.h>
 #include <server/chat/MessageHandlers.h>
 #include <server/chat/WsData.h>
+#include <server/chat/ConnectionContext.h>
 #include <server/chat/ChatRoomManager.h>
+#include <server/chat/RateLimiter.h>
+#include <server/chat/CacheWarmup.h>
+#include <server/chat/ServerDrain.h>
+#include <server/chat/ConnectionAdmission.h>
+#include <server/chat/IdleReaper.h>
+#include <server/chat/TrafficCapture.h>
+#include <server/chat/ChangeFeed.h>
+#include <server/utils/server_config.h>
 #include <common/utils/utils.h>
 #include <common/version.h>
 
@@ -12,14 +21,14 @@ namespace server {
 WsController::WsController() {
     LOG_INFO << "Constructing WsController service chain...";
 
-    auto dbClient = drogon::app().getDbClient();
+    auto dbClient = writeDbClient();
     if(!dbClient) {
         LOG_FATAL << "Database client is not available! Aborting.";
         drogon::app().quit();
         return;
     }
 
-    auto handlers = std::make_unique<MessageHandlers>(dbClient);
+    auto handlers = std::make_unique<MessageHandlers>(dbClient, readDbClient());
     auto dispatcher = std::make_unique<MessageHandlerService>(std::move(handlers));
     m_requestProcessor = std::make_unique<WsRequestProcessor>(std::move(dispatcher));
 
@@ -28,28 +37,93 @@ WsController::WsController() {
 
 WsController::~WsController() = default;
 
+/// @brief Turns a connection away with a `ServerBusy` telling when to come back, then closes it with 1013 Try Again Later.
+static void refuseBusy(const drogon::WebSocketConnectionPtr& conn, std::chrono::milliseconds retry_after, const std::string& reason) {
+    chat::Envelope busyEnv;
+    busyEnv.mutable_server_busy()->set_retry_after_ms(static_cast<uint32_t>(retry_after.count()));
+    busyEnv.mutable_server_busy()->set_reason(reason);
+    common::sendEnvelope(conn, busyEnv);
+    conn->shutdown(static_cast<drogon::CloseCode>(1013), reason);
+}
+
 void WsController::handleNewConnection([[maybe_unused]] const drogon::HttpRequestPtr& req, const drogon::WebSocketConnectionPtr& conn) {
     LOG_TRACE << "WS connect: " << conn->peerAddr().toIpPort();
-    conn->setContext(WsDataGuarded::create());
+    if(!CacheWarmup::instance().ready()) {
+        // 1013 Try Again Later, drogon has no name for it.
+        conn->shutdown(static_cast<drogon::CloseCode>(1013), "Server is starting");
+        return;
+    }
+    // A client the kernel gave to the process being upgraded retries, and lands on its successor sooner or later.
+    if(ServerDrain::instance().upgrading()) {
+        refuseBusy(conn, serverConfig().upgrade.retry_after, "Server is upgrading");
+        return;
+    }
+    if(ServerDrain::instance().draining()) {
+        conn->shutdown(drogon::CloseCode::kEndpointGone, "Server is shutting down");
+        return;
+    }
+    auto admitted = ConnectionAdmission::instance().admit();
+    if(const auto* retry_after = std::get_if<ConnectionAdmission::RetryAfter>(&admitted)) {
+        LOG_DEBUG << "WS refused, over the admission limits: " << conn->peerAddr().toIpPort();
+        refuseBusy(conn, *retry_after, "Server is busy");
+        return;
+    }
+    conn->setContext(std::make_shared<ConnectionContext>(std::get<ConnectionAdmission::Ticket>(std::move(admitted))));
+    IdleReaper::instance().watch(conn);
+    if(const auto timeout = serverConfig().admission.auth_timeout; timeout.count() > 0) {
+        // A connection that never logs in would hold its slot among the unauthenticated ones for good.
+        trantor::EventLoop::getEventLoopOfCurrentThread()->runAfter(std::chrono::duration<double>(timeout).count(),
+            [weak = std::weak_ptr<drogon::WebSocketConnection>(conn)] {
+                const auto conn = weak.lock();
+                if(!conn) {
+                    return;
+                }
+                // Only the ticket's own flag is read, it is atomic.
+                if(const auto ctx = conn->getContext<ConnectionContext>(); ctx && ctx->data()->get_unsafe().admission.unauthenticated()) {
+                    conn->shutdown(drogon::CloseCode::kViolation, "Not logged in in time");
+                }
+            });
+    }
     chat::Envelope helloEnv;
     helloEnv.mutable_server_hello()->set_type(chat::ServerType::TYPE_SERVER);
     helloEnv.mutable_server_hello()->set_protocol_version(common::version::PROTOCOL_VERSION);
+    if(serverConfig().compression.enabled) {
+        helloEnv.mutable_server_hello()->add_compression(chat::COMPRESSION_GZIP);
+    }
+    helloEnv.mutable_server_hello()->set_packed_history(serverConfig().compression.packed_history);
+    helloEnv.mutable_server_hello()->set_user_refs(serverConfig().compression.user_refs);
+    helloEnv.mutable_server_hello()->set_max_batch(static_cast<uint32_t>(serverConfig().pipeline.max_batch));
     common::sendEnvelope(conn, helloEnv);
 }
 
 void WsController::handleNewMessage(const drogon::WebSocketConnectionPtr& conn, std::string&& msg_str, const drogon::WebSocketMessageType& type) {
+    // Whatever the frame, the client is alive.
+    if(const auto ctx = conn->getContext<ConnectionContext>()) {
+        ctx->touch();
+    }
     if(type != drogon::WebSocketMessageType::Binary) {
         LOG_TRACE << "Non-binary WS message received from " << conn->peerAddr().toIpPort() << ". Ignoring.";
         return;
     }
 
-    drogon::async_run(std::bind(&WsRequestProcessor::handleIncomingMessage, m_requestProcessor.get(), conn, std::move(msg_str)));
+    // Parsed in place, the frame is released as soon as this returns.
+    m_requestProcessor->handleIncomingMessage(conn, msg_str);
 }
 
 void WsController::handleConnectionClosed(const drogon::WebSocketConnectionPtr& conn) {
     LOG_TRACE << "WS closed: " << conn->peerAddr().toIpPort();
-    drogon::async_run([conn]() -> drogon::Task<> {
-        auto wsDataProxy = co_await conn->getContext<WsDataGuarded>()->lock_shared();
+    auto ctx = conn->getContext<ConnectionContext>();
+    if(!ctx) {
+        return;
+    }
+    TrafficCapture::instance().recordClose(ctx->captureId());
+    // Runs after the request in progress, requests still waiting are dropped.
+    ctx->close([conn, wsData = ctx->data()]() -> drogon::Task<> {
+        auto wsDataProxy = co_await wsData->lock_shared();
+        RateLimiter::instance().forget(wsDataProxy->connection_id);
+        if(wsDataProxy->user && wsDataProxy->room) {
+            ChangeFeed::instance().memberLeft(wsDataProxy->room->id, wsDataProxy->user->id, "disconnect");
+        }
         co_await ChatRoomManager::instance().unregisterConnection(conn, *wsDataProxy);
         // https://github.com/drogonframework/drogon/blob/afd0930530b8ec116f18bc5044b9920fcf0f5422/examples/redis/controllers/WsClient.cc#L141
         conn->clearContext();
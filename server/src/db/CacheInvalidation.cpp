@@ -0,0 +1,96 @@
+#include <server/db/CacheInvalidation.h>
+#include <server/chat/RoomDataCache.h>
+#include <server/utils/server_config.h>
+#include <server/utils/switch_to_io_loop.h>
+#include <random>
+
+namespace server {
+
+namespace sql {
+
+static const std::string CHANNEL = "chat_cache_invalidation";
+
+static const std::string NOTIFY =
+    "SELECT pg_notify($1, $2)";
+
+} // namespace sql
+
+CacheInvalidation& CacheInvalidation::instance() {
+    static CacheInvalidation inst;
+    return inst;
+}
+
+CacheInvalidation::CacheInvalidation() {
+    std::random_device rd;
+    m_origin = std::to_string((static_cast<uint64_t>(rd()) << 32) | rd());
+}
+
+void CacheInvalidation::start() {
+    if(!serverConfig().cluster.cache_notify) {
+        LOG_INFO << "Cache invalidations are not exchanged with the other servers";
+        return;
+    }
+    std::call_once(m_started, [this] {
+        auto db = writeDbClient();
+        if(!db) {
+            return;
+        }
+        m_listener = drogon::orm::DbListener::newPgListener(db->connectionInfo(), drogon::app().getLoop());
+        if(!m_listener) {
+            LOG_ERROR << "Failed to open the cache invalidation listener, entries changed on the other servers stay cached";
+            return;
+        }
+        m_listener->listen(sql::CHANNEL, [this](const std::string&, const std::string& payload) {
+            apply(payload);
+        });
+        LOG_INFO << "Listening for cache invalidations on " << sql::CHANNEL;
+    });
+}
+
+drogon::Task<> CacheInvalidation::notifyRoom(const drogon::orm::DbClientPtr& db, int32_t room_id) const {
+    co_await notify(db, m_origin + " room " + std::to_string(room_id));
+}
+
+drogon::Task<> CacheInvalidation::notifyRoomUser(const drogon::orm::DbClientPtr& db, int32_t room_id, int32_t user_id) const {
+    co_await notify(db, m_origin + " room_user " + std::to_string(room_id) + " " + std::to_string(user_id));
+}
+
+drogon::Task<> CacheInvalidation::notify(const drogon::orm::DbClientPtr& db, std::string payload) const {
+    if(!serverConfig().cluster.cache_notify) {
+        co_return;
+    }
+    co_await switch_to_io_loop(db->execSqlCoro(sql::NOTIFY, sql::CHANNEL, payload));
+}
+
+// The next space separated field of `payload`, removed from it.
+static std::string_view nextField(std::string_view& payload) {
+    const auto end = std::min(payload.find(' '), payload.size());
+    const auto field = payload.substr(0, end);
+    payload.remove_prefix(std::min(end + 1, payload.size()));
+    return field;
+}
+
+static std::optional<int32_t> parseId(std::string_view field) {
+    int32_t id;
+    auto [ptr, ec] = std::from_chars(field.data(), field.data() + field.size(), id);
+    return ec == std::errc{} && ptr == field.data() + field.size() ? std::optional{id} : std::nullopt;
+}
+
+void CacheInvalidation::apply(std::string_view payload) const {
+    const auto notification = payload;
+    if(nextField(payload) == m_origin) {
+        return;
+    }
+    const auto kind = nextField(payload);
+    const auto room_id = parseId(nextField(payload));
+    const auto user_id = kind == "room_user" ? parseId(nextField(payload)) : std::nullopt;
+    if(kind == "room" && room_id) {
+        RoomDataCache::instance().invalidateRoom(*room_id);
+    } else if(kind == "room_user" && room_id && user_id) {
+        RoomDataCache::instance().invalidateRoomUser(*room_id, *user_id);
+    } else {
+        LOG_WARN << "Malformed cache invalidation: " << notification;
+    }
+}
+
+} // namespace server
@@ -0,0 +1,101 @@
+#include <server/db/DbCircuitBreaker.h>
+#include <common/utils/metrics.h>
+#include <drogon/orm/Exception.h>
+#include <trantor/utils/Logger.h>
+
+namespace server {
+
+DbCircuitBreaker& DbCircuitBreaker::instance() {
+    static DbCircuitBreaker inst;
+    return inst;
+}
+
+DbCircuitBreaker::DbCircuitBreaker()
+    : m_cfg{serverConfig().db_breaker},
+      m_buckets(static_cast<size_t>(std::max<int64_t>(m_cfg.window.count(), 1))) {
+    common::MetricsRegistry::instance().gauge(
+        "db_breaker_open", "Whether non-critical requests are shed because the database is failing or slow.",
+        [this] { return open() ? 1.0 : 0.0; });
+}
+
+bool DbCircuitBreaker::isOutage(const std::exception_ptr& error) noexcept {
+    if(!error) {
+        return false;
+    }
+    try {
+        std::rethrow_exception(error);
+    } catch(const drogon::orm::TimeoutError&) {
+        return true;
+    } catch(const drogon::orm::BrokenConnection&) {
+        return true;
+    } catch(...) {
+        return false;
+    }
+}
+
+void DbCircuitBreaker::record(std::chrono::steady_clock::duration latency, const std::exception_ptr& error) noexcept {
+    const auto now = std::chrono::steady_clock::now();
+    const int64_t second = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
+    const bool failed = isOutage(error);
+
+    std::lock_guard lock(m_mutex);
+    auto& bucket = m_buckets[static_cast<size_t>(second) % m_buckets.size()];
+    if(bucket.second != second) {
+        bucket = Bucket{second};
+    }
+    ++bucket.total;
+    bucket.failed += failed ? 1 : 0;
+    bucket.slow += latency >= m_cfg.slow_query ? 1 : 0;
+    judge(now);
+}
+
+bool DbCircuitBreaker::allow() noexcept {
+    if(!m_cfg.enabled) {
+        return true;
+    }
+    if(!m_open.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    // Nothing may report while everything is shed, so an expired breaker is judged here too.
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard lock(m_mutex);
+    if(now >= m_open_until) {
+        judge(now);
+    }
+    return !m_open.load(std::memory_order_relaxed);
+}
+
+void DbCircuitBreaker::judge(std::chrono::steady_clock::time_point now) {
+    const bool was_open = m_open.load(std::memory_order_relaxed);
+    if(was_open && now < m_open_until) {
+        return;
+    }
+
+    const int64_t second = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
+    const int64_t oldest = second - static_cast<int64_t>(m_buckets.size()) + 1;
+    uint64_t total = 0, failed = 0, slow = 0;
+    for(const auto& bucket : m_buckets) {
+        if(bucket.second >= oldest) {
+            total += bucket.total;
+            failed += bucket.failed;
+            slow += bucket.slow;
+        }
+    }
+
+    const bool unhealthy = total >= std::max<size_t>(m_cfg.min_queries, 1)
+        && (static_cast<double>(failed) >= m_cfg.error_ratio * static_cast<double>(total)
+            || static_cast<double>(slow) >= m_cfg.slow_ratio * static_cast<double>(total));
+    if(unhealthy) {
+        m_open_until = now + m_cfg.open_for;
+        if(!was_open) {
+            m_open.store(true, std::memory_order_relaxed);
+            LOG_WARN << "Database unhealthy, " << failed << " failed and " << slow << " slow of the last " << total
+                     << " queries: shedding non-critical requests";
+        }
+    } else if(was_open) {
+        m_open.store(false, std::memory_order_relaxed);
+        LOG_INFO << "Database healthy again, no longer shedding requests";
+    }
+}
+
+} // namespace server
@@ -0,0 +1,174 @@
+#include <server/db/DbPoolScaler.h>
+#include <server/utils/switch_to_io_loop.h>
+#include <common/utils/metrics.h>
+
+namespace server {
+
+/// @brief The pools resized, by direction.
+static common::Counter& resizes(const std::string& pool, const char* direction) {
+    return common::MetricsRegistry::instance().counter(
+        "db_pool_resizes_total", "Times a shared DB pool was grown or shrunk by a step.",
+        "pool=\"" + pool + "\",direction=\"" + direction + "\"");
+}
+
+ElasticDbPool::ElasticDbPool(std::string name, drogon::orm::DbClientPtr base)
+    : m_name(std::move(name)),
+      m_members(std::make_shared<const std::vector<drogon::orm::DbClientPtr>>(std::vector{std::move(base)})) {
+    auto& metrics = common::MetricsRegistry::instance();
+    const auto labels = "pool=\"" + m_name + "\"";
+    metrics.gauge("db_pool_added_connections", "Connections added to a shared DB pool under load, on top of its configured ones.",
+        [this] { return static_cast<double>(addedConnections()); }, labels);
+    metrics.gauge("db_pool_busy_ratio", "The fraction of the last window's samples in which a shared DB pool had no free connection.",
+        [this] { return m_busy_ratio.load(std::memory_order_relaxed); }, labels);
+}
+
+drogon::orm::DbClientPtr ElasticDbPool::pick() const {
+    const auto members = m_members.load(std::memory_order_acquire);
+    if(members->size() == 1) {
+        return members->front();
+    }
+    for(const auto& member : *members) {
+        if(member->hasAvailableConnections()) {
+            return member;
+        }
+    }
+    // All busy, the operations queue on the clients in turn.
+    return (*members)[m_next.fetch_add(1, std::memory_order_relaxed) % members->size()];
+}
+
+bool ElasticDbPool::busy() const {
+    const auto members = m_members.load(std::memory_order_acquire);
+    return std::none_of(members->begin(), members->end(), [](const auto& member) { return member->hasAvailableConnections(); });
+}
+
+bool ElasticDbPool::baseBusy() const {
+    return !m_members.load(std::memory_order_acquire)->front()->hasAvailableConnections();
+}
+
+void ElasticDbPool::publish(std::vector<drogon::orm::DbClientPtr> members, size_t added) {
+    m_added.store(added, std::memory_order_relaxed);
+    m_members.store(std::make_shared<const std::vector<drogon::orm::DbClientPtr>>(std::move(members)), std::memory_order_release);
+}
+
+void ElasticDbPool::grow(size_t step, std::chrono::milliseconds timeout) {
+    auto client = drogon::orm::DbClient::newPgClient(m_conn_info, step);
+    if(timeout.count() > 0) {
+        client->setTimeout(std::chrono::duration<double>(timeout).count());
+    }
+    auto members = *m_members.load(std::memory_order_acquire);
+    members.push_back(std::move(client));
+    publish(std::move(members), addedConnections() + step);
+    resizes(m_name, "grow").inc();
+    LOG_INFO << "DB pool '" << m_name << "' grown, " << addedConnections() << " connections added";
+}
+
+void ElasticDbPool::shrink(size_t step, std::chrono::seconds retire_after) {
+    auto members = *m_members.load(std::memory_order_acquire);
+    if(members.size() <= 1) {
+        return;
+    }
+    // Operations picked it just before, or still running on it, finish before it goes.
+    m_retiring.emplace_back(std::move(members.back()), std::chrono::steady_clock::now() + retire_after);
+    members.pop_back();
+    publish(std::move(members), addedConnections() - std::min(step, addedConnections()));
+    resizes(m_name, "shrink").inc();
+    LOG_INFO << "DB pool '" << m_name << "' shrunk, " << addedConnections() << " connections added";
+}
+
+DbPoolScaler& DbPoolScaler::instance() {
+    static DbPoolScaler inst;
+    return inst;
+}
+
+ElasticDbPool* DbPoolScaler::poolOf(const drogon::orm::DbClientPtr& client) {
+    const auto& cfg = serverConfig();
+    if(!cfg.db_pool.enabled || !client) {
+        return nullptr;
+    }
+    std::lock_guard lock(m_mutex);
+    for(const auto* name : {&cfg.database.write_client, &cfg.database.read_client}) {
+        if(drogon::app().getDbClient(*name) != client) {
+            continue;
+        }
+        for(const auto& pool : m_pools) {
+            if(pool->name() == *name) {
+                return pool.get();
+            }
+        }
+        return m_pools.emplace_back(std::make_unique<ElasticDbPool>(*name, client)).get();
+    }
+    return nullptr;
+}
+
+void DbPoolScaler::start() {
+    m_cfg = serverConfig().db_pool;
+    if(!m_cfg.enabled) {
+        return;
+    }
+    for(const auto& name : {serverConfig().database.write_client, serverConfig().database.read_client}) {
+        poolOf(drogon::app().getDbClient(name));
+    }
+    std::lock_guard lock(m_mutex);
+    for(auto& pool : m_pools) {
+        const auto& base = pool->m_members.load(std::memory_order_acquire)->front();
+        if(base->type() != drogon::orm::ClientType::PostgreSQL) {
+            LOG_WARN << "DB pool '" << pool->name() << "' is not a PostgreSQL client, not resized";
+            continue;
+        }
+        pool->m_conn_info = base->connectionInfo();
+    }
+
+    common::MetricsRegistry::instance().gauge("db_operations_in_flight",
+        "Operations awaited through switch_to_io_loop and not completed yet, the fast clients' included.",
+        [] { return static_cast<double>(dbOperationCounters().in_flight.load(std::memory_order_relaxed)); });
+    common::MetricsRegistry::instance().gauge("db_pool_mean_operation_seconds",
+        "The mean time of the operations awaited through switch_to_io_loop in the last window, waiting for a connection included.",
+        [this] { return m_mean_latency.load(std::memory_order_relaxed); });
+
+    auto* loop = drogon::app().getLoop();
+    loop->runEvery(std::chrono::duration<double>(m_cfg.sample_interval).count(), [this] {
+        std::lock_guard lock(m_mutex);
+        for(auto& pool : m_pools) {
+            ++pool->m_samples;
+            if(pool->baseBusy()) {
+                ++pool->m_base_busy_samples;
+                if(pool->busy()) {
+                    ++pool->m_busy_samples;
+                }
+            }
+        }
+    });
+    loop->runEvery(std::chrono::duration<double>(m_cfg.window).count(), [this] { judge(); });
+    LOG_INFO << "Resizing " << m_pools.size() << " DB pool(s) by up to " << m_cfg.max_added_connections << " connections";
+}
+
+void DbPoolScaler::judge() {
+    std::lock_guard lock(m_mutex);
+    const auto operations = m_operations.exchange(0, std::memory_order_relaxed);
+    const auto operation_ns = m_operation_ns.exchange(0, std::memory_order_relaxed);
+    m_mean_latency.store(operations > 0 ? static_cast<double>(operation_ns) / static_cast<double>(operations) / 1e9 : 0,
+                         std::memory_order_relaxed);
+
+    const auto now = std::chrono::steady_clock::now();
+    for(auto& pool : m_pools) {
+        std::erase_if(pool->m_retiring, [now](const auto& retiring) { return retiring.second <= now; });
+        const double busy_ratio = pool->m_samples > 0 ? static_cast<double>(pool->m_busy_samples) / static_cast<double>(pool->m_samples) : 0;
+        pool->m_busy_ratio.store(busy_ratio, std::memory_order_relaxed);
+        const bool idle = pool->m_base_busy_samples == 0;
+        pool->m_samples = 0;
+        pool->m_busy_samples = 0;
+        pool->m_base_busy_samples = 0;
+        if(pool->m_conn_info.empty()) {
+            continue;
+        }
+        pool->m_idle_windows = idle ? pool->m_idle_windows + 1 : 0;
+        if(busy_ratio >= m_cfg.grow_busy_ratio && pool->addedConnections() + m_cfg.step <= m_cfg.max_added_connections) {
+            pool->grow(m_cfg.step, m_cfg.query_timeout);
+        } else if(pool->m_idle_windows >= m_cfg.shrink_idle_windows && pool->addedConnections() > 0) {
+            pool->shrink(m_cfg.step, m_cfg.retire_after);
+            pool->m_idle_windows = 0;
+        }
+    }
+}
+
+} // namespace server
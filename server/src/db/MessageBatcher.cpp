@@ -0,0 +1,194 @@
+#include <server/db/MessageBatcher.h>
+#include <server/db/MessageCompression.h>
+#include <server/utils/server_config.h>
+#include <common/utils/loop_monitor.h>
+
+namespace server {
+
+/// @brief The hard limit of rows per statement, keeping the bound parameters well below PostgreSQL's 65535.
+static constexpr size_t MAX_ROWS_PER_STATEMENT = 1000;
+
+int64_t nextMessageTimestamp() {
+    static std::atomic<int64_t> last{0};
+    const int64_t now = trantor::Date::now().microSecondsSinceEpoch();
+    int64_t prev = last.load(std::memory_order_relaxed);
+    int64_t next;
+    do {
+        next = std::max(now, prev + 1);
+    } while(!last.compare_exchange_weak(prev, next, std::memory_order_relaxed));
+    return next;
+}
+
+MessageBatcher& MessageBatcher::instance() {
+    static MessageBatcher inst;
+    return inst;
+}
+
+MessageBatcher::MessageBatcher()
+    : m_dbClient{writeDbClient()},
+      m_pool{DbPoolScaler::instance().poolOf(m_dbClient)},
+      m_queues(std::max<size_t>(drogon::app().getThreadNum(), 1)) {}
+
+MessageBatcher::InsertAwaitable MessageBatcher::insert(int32_t room_id, int32_t user_id, std::string text, int64_t created_at,
+                                                       std::optional<int32_t> message_id, std::optional<int64_t> seq) {
+    return InsertAwaitable{*this, Pending{
+        .room_id = room_id,
+        .user_id = user_id,
+        .text = std::move(text),
+        .created_at = created_at,
+        .message_id = message_id,
+        .seq = seq,
+        .handle = nullptr,
+        .loop_index = 0,
+        .result = std::nullopt,
+        .trace = nullptr,
+        .queued_at = {},
+    }};
+}
+
+void MessageBatcher::InsertAwaitable::await_suspend(std::coroutine_handle<> h) {
+    m_pending.handle = h;
+    m_pending.loop_index = drogon::app().getCurrentThreadIndex();
+    m_pending.trace = common::currentTrace();
+    if(m_pending.trace) {
+        m_pending.queued_at = std::chrono::steady_clock::now();
+    }
+    if(m_pending.loop_index >= m_batcher.m_queues.size()) {
+        m_pending.loop_index = 0; // Fallback to the first IO thread.
+    }
+    // Runs inline when already on the loop, which is the normal case for handlers.
+    drogon::app().getIOLoop(m_pending.loop_index)->runInLoop([batcher = &m_batcher, pending = &m_pending] {
+        batcher->enqueue(pending);
+    });
+}
+
+void MessageBatcher::enqueue(Pending* pending) {
+    const auto& cfg = serverConfig().message_batching;
+    const auto loop_index = pending->loop_index;
+    auto& queue = m_queues[loop_index];
+
+    queue.pending.push_back(pending);
+
+    const auto max_batch = std::clamp<size_t>(cfg.max_batch_size, 1, MAX_ROWS_PER_STATEMENT);
+    if(queue.pending.size() >= max_batch) {
+        flush(loop_index);
+        return;
+    }
+
+    if(!queue.flush_armed) {
+        queue.flush_armed = true;
+        const double window_seconds = std::chrono::duration<double>(cfg.window).count();
+        drogon::app().getIOLoop(loop_index)->runAfter(window_seconds, [this, loop_index] {
+            flush(loop_index);
+        });
+    }
+}
+
+void MessageBatcher::flush(size_t loop_index) {
+    auto& queue = m_queues[loop_index];
+    // A timer armed for an already flushed batch may fire early for the next one, which is harmless.
+    queue.flush_armed = false;
+    if(queue.pending.empty()) {
+        return;
+    }
+
+    std::vector<Pending*> auto_ids;
+    std::vector<Pending*> reserved_ids;
+    for(auto* pending : queue.pending) {
+        (pending->message_id ? reserved_ids : auto_ids).push_back(pending);
+    }
+    queue.pending.clear();
+
+    LOG_TRACE << "Flushing " << auto_ids.size() + reserved_ids.size() << " message(s) from loop " << loop_index;
+
+    if(!auto_ids.empty()) {
+        execute(std::move(auto_ids), false);
+    }
+    if(!reserved_ids.empty()) {
+        execute(std::move(reserved_ids), true);
+    }
+}
+
+void MessageBatcher::execute(std::vector<Pending*> entries, bool explicit_ids) {
+    // Rows without a seq lock their room's row as they take one, rooms in ascending order keep two
+    // batches from deadlocking. The sort is stable, the messages of one room stay in send order.
+    std::stable_sort(entries.begin(), entries.end(), [](const Pending* a, const Pending* b) { return a->room_id < b->room_id; });
+    auto batch = std::make_shared<std::vector<Pending*>>(std::move(entries));
+    const size_t columns = explicit_ids ? 8 : 6;
+
+    std::string sql = explicit_ids
+        ? "INSERT INTO messages (room_id, user_id, message_text, message_body, dictionary_id, created_at, message_id, seq) VALUES "
+        : "INSERT INTO messages (room_id, user_id, message_text, message_body, dictionary_id, created_at) VALUES ";
+    sql.reserve(sql.size() + batch->size() * 45 + 40);
+    for(size_t i = 0; i < batch->size(); ++i) {
+        const size_t p = i * columns;
+        sql += i ? ",(" : "(";
+        for(size_t c = 1; c <= columns; ++c) {
+            sql += (c > 1 ? ",$" : "$") + std::to_string(p + c);
+        }
+        sql += ")";
+    }
+    sql += " RETURNING message_id, created_at, seq";
+
+    const auto db = m_pool ? m_pool->pick() : m_dbClient;
+    auto binder = *db << std::move(sql);
+    for(auto* pending : *batch) {
+        // The text is not needed past the insert, the handler keeps its own copy.
+        auto stored = MessageCompression::instance().encodeForWrite(std::move(pending->text));
+        binder << pending->room_id << pending->user_id << std::move(stored.text) << std::move(stored.body) << stored.dictionary_id
+               << pending->created_at;
+        if(explicit_ids) {
+            binder << *pending->message_id << *pending->seq;
+        }
+    }
+    binder >> [batch, explicit_ids](const drogon::orm::Result& result) {
+        complete(*batch, &result, explicit_ids);
+    };
+    binder >> [batch, explicit_ids](const drogon::orm::DrogonDbException& e) {
+        LOG_ERROR << "Batched message insert of " << batch->size() << " row(s) failed: " << e.base().what();
+        complete(*batch, nullptr, explicit_ids);
+    };
+    binder.exec();
+}
+
+void MessageBatcher::complete(std::vector<Pending*>& batch, const drogon::orm::Result* result, bool explicit_ids) {
+    if(result) {
+        if(result->size() == batch.size() && explicit_ids) {
+            // The statement is all or nothing, every row was written with the ID it was given.
+            for(auto* pending : batch) {
+                pending->result = StoredMessage{
+                    .message_id = *pending->message_id,
+                    .created_at = pending->created_at,
+                    .seq = *pending->seq,
+                };
+            }
+        } else if(result->size() == batch.size()) {
+            // SERIAL ids are drawn in VALUES order, so ascending ids line up with the batch.
+            std::vector<StoredMessage> rows;
+            rows.reserve(result->size());
+            for(const auto& row : *result) {
+                rows.push_back(StoredMessage{
+                    .message_id = row["message_id"].as<int32_t>(),
+                    .created_at = row["created_at"].as<int64_t>(),
+                    .seq = row["seq"].as<int64_t>(),
+                });
+            }
+            std::sort(rows.begin(), rows.end(), [](const StoredMessage& a, const StoredMessage& b) {
+                return a.message_id < b.message_id;
+            });
+            for(size_t i = 0; i < batch.size(); ++i) {
+                batch[i]->result = rows[i];
+            }
+        } else {
+            LOG_ERROR << "Batched message insert returned " << result->size() << " row(s) for " << batch.size() << " message(s)";
+        }
+    }
+
+    for(auto* pending : batch) {
+        // Read before resuming, the entry lives in the frame being resumed.
+        const auto handle = pending->handle;
+        common::LoopMonitor::instance().queueInLoop(pending->loop_index, [handle] { handle.resume(); });
+    }
+}
+
+} // namespace server
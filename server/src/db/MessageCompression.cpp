@@ -0,0 +1,315 @@
+#include <server/db/MessageCompression.h>
+#include <server/utils/server_config.h>
+#include <server/utils/switch_to_io_loop.h>
+#include <common/utils/limits.h>
+#include <zdict.h>
+#include <zstd.h>
+
+namespace server {
+
+namespace sql {
+
+static const std::string DICTIONARIES_AFTER =
+    "SELECT dictionary_id, dictionary FROM message_dictionaries WHERE dictionary_id > $1 ORDER BY dictionary_id";
+
+static const std::string INSERT_DICTIONARY =
+    "INSERT INTO message_dictionaries (dictionary) VALUES ($1) RETURNING dictionary_id";
+
+// The newest messages on the primary key, walked backwards across the partitions.
+static const std::string TRAINING_SAMPLES =
+    "SELECT message_text FROM messages WHERE message_text IS NOT NULL AND deleted_at IS NULL "
+    "ORDER BY message_id DESC LIMIT $1";
+
+// The next ids on the primary key, compressed or not, so the walk does not depend on what is left to do.
+static const std::string NEXT_MESSAGES =
+    "SELECT message_id, created_at, message_text FROM messages WHERE message_id > $1 ORDER BY message_id LIMIT $2";
+
+// Rows written as text meanwhile by no one else are the only ones changed, the arrays line up.
+static const std::string COMPRESS_MESSAGES =
+    "UPDATE messages m SET message_text = NULL, message_body = v.body, dictionary_id = $1 "
+    "FROM unnest($2::integer[], $3::bigint[], $4::bytea[]) AS v(message_id, created_at, body) "
+    "WHERE m.message_id = v.message_id AND m.created_at = v.created_at AND m.message_text IS NOT NULL";
+
+} // namespace sql
+
+/// How long a training that failed or lacked samples is put off.
+static constexpr std::chrono::minutes TRAINING_RETRY{60};
+
+/// Fewer samples than this make a dictionary not worth having.
+static constexpr size_t MIN_TRAINING_SAMPLES = 1000;
+
+/// How many batches of already compressed ids a run skips through before calling it a day.
+static constexpr int MAX_SKIPPED_BATCHES = 20;
+
+/// The largest body decompressed, a message never gets near it.
+static constexpr size_t MAX_BODY_BYTES = common::limits::MAX_MESSAGE_LENGTH * 4;
+
+static ZSTD_CCtx* compressionContext() {
+    thread_local const std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> context{ZSTD_createCCtx(), &ZSTD_freeCCtx};
+    return context.get();
+}
+
+static ZSTD_DCtx* decompressionContext() {
+    thread_local const std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> context{ZSTD_createDCtx(), &ZSTD_freeDCtx};
+    return context.get();
+}
+
+/// A list of values as a PostgreSQL array literal, `{a,b}`.
+template<typename Range, typename Format>
+static std::string arrayLiteral(const Range& values, Format format) {
+    std::string literal = "{";
+    for(const auto& value : values) {
+        if(literal.size() > 1) {
+            literal += ',';
+        }
+        format(literal, value);
+    }
+    literal += '}';
+    return literal;
+}
+
+MessageCompression& MessageCompression::instance() {
+    static MessageCompression inst;
+    return inst;
+}
+
+MessageCompression::MessageCompression()
+    : m_dbClient{writeDbClient()},
+      m_decoders{std::make_shared<const Decoders>()} {}
+
+void MessageCompression::start() {
+    const auto& cfg = serverConfig().message_compression;
+    if((!cfg.enabled && !cfg.compress_on_write) || !m_dbClient) {
+        return;
+    }
+    std::call_once(m_timer_started, [this, &cfg] {
+        const auto run = [this] { drogon::async_run([this]() -> drogon::Task<> { co_await this->run(); }); };
+        drogon::app().getIOLoop(0)->queueInLoop(run);
+        drogon::app().getIOLoop(0)->runEvery(std::max<double>(cfg.interval.count(), 1), run);
+    });
+}
+
+std::optional<std::vector<char>> MessageCompression::compress(const Encoder& encoder, std::string_view text) {
+    if(text.size() < serverConfig().message_compression.min_bytes) {
+        return std::nullopt;
+    }
+    std::vector<char> body(ZSTD_compressBound(text.size()));
+    const auto size = ZSTD_compress_usingCDict(compressionContext(), body.data(), body.size(), text.data(), text.size(), encoder.dictionary.get());
+    if(ZSTD_isError(size) || size >= text.size()) {
+        return std::nullopt;
+    }
+    body.resize(size);
+    return body;
+}
+
+MessageCompression::StoredBody MessageCompression::encodeForWrite(std::string text) const {
+    const auto encoder = m_encoder.load(std::memory_order_acquire);
+    if(encoder && serverConfig().message_compression.compress_on_write) {
+        if(auto body = compress(*encoder, text)) {
+            return StoredBody{.text = std::nullopt, .body = std::move(body), .dictionary_id = encoder->dictionary_id};
+        }
+    }
+    return StoredBody{.text = std::move(text), .body = std::nullopt, .dictionary_id = std::nullopt};
+}
+
+drogon::Task<> MessageCompression::prepare(const drogon::orm::DbClientPtr& db, const drogon::orm::Result& rows) {
+    const auto decoders = m_decoders.load(std::memory_order_acquire);
+    for(const auto& row : rows) {
+        if(!row["dictionary_id"].isNull() && !decoders->contains(row["dictionary_id"].as<int32_t>())) {
+            // Dictionaries are only ever added, the missing one is among the newer ones.
+            co_await loadNewer(db);
+            co_return;
+        }
+    }
+}
+
+drogon::Task<> MessageCompression::loadNewer(const drogon::orm::DbClientPtr& db) {
+    const auto known = m_decoders.load(std::memory_order_acquire);
+    const int32_t newest = known->empty() ? 0 : known->rbegin()->first;
+    auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql::DICTIONARIES_AFTER, newest));
+    if(rows.empty()) {
+        co_return;
+    }
+
+    const int level = std::clamp(serverConfig().message_compression.level, 1, ZSTD_maxCLevel());
+    std::lock_guard lock(m_load_mutex);
+    auto decoders = *m_decoders.load(std::memory_order_acquire);
+    std::shared_ptr<const Encoder> encoder;
+    for(size_t i = 0; i < rows.size(); ++i) {
+        const auto id = rows[i]["dictionary_id"].as<int32_t>();
+        const auto dictionary = rows[i]["dictionary"].as<std::vector<char>>();
+        std::shared_ptr<ZSTD_DDict_s> decoder{ZSTD_createDDict(dictionary.data(), dictionary.size()), &ZSTD_freeDDict};
+        if(!decoder) {
+            LOG_ERROR << "Message dictionary " << id << " could not be loaded";
+            continue;
+        }
+        decoders.emplace(id, std::move(decoder));
+        if(i + 1 == rows.size()) {
+            std::shared_ptr<ZSTD_CDict_s> cdict{ZSTD_createCDict(dictionary.data(), dictionary.size(), level), &ZSTD_freeCDict};
+            if(cdict) {
+                encoder = std::make_shared<const Encoder>(Encoder{id, std::move(cdict)});
+            }
+        }
+    }
+    m_decoders.store(std::make_shared<const Decoders>(std::move(decoders)), std::memory_order_release);
+    // Loads running side by side may finish out of order, the newest dictionary stays the one compressed with.
+    const auto current = m_encoder.load(std::memory_order_acquire);
+    if(encoder && (!current || current->dictionary_id < encoder->dictionary_id)) {
+        m_encoder.store(std::move(encoder), std::memory_order_release);
+    }
+    LOG_INFO << "Loaded " << rows.size() << " message dictionar" << (rows.size() == 1 ? "y" : "ies");
+}
+
+std::string MessageCompression::text(const drogon::orm::Row& row) const {
+    if(!row["message_text"].isNull()) {
+        return row["message_text"].as<std::string>();
+    }
+    const auto id = row["dictionary_id"].as<int32_t>();
+    const auto body = row["message_body"].as<std::vector<char>>();
+    const auto decoders = m_decoders.load(std::memory_order_acquire);
+    const auto decoder = decoders->find(id);
+    if(decoder == decoders->end()) {
+        throw std::runtime_error("message compressed with unknown dictionary " + std::to_string(id));
+    }
+    const auto size = ZSTD_getFrameContentSize(body.data(), body.size());
+    if(size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN || size > MAX_BODY_BYTES) {
+        throw std::runtime_error("corrupt compressed message body");
+    }
+    std::string text(size, '\0');
+    const auto written = ZSTD_decompress_usingDDict(decompressionContext(), text.data(), text.size(), body.data(), body.size(), decoder->second.get());
+    if(ZSTD_isError(written) || written != size) {
+        throw std::runtime_error("corrupt compressed message body");
+    }
+    return text;
+}
+
+drogon::Task<> MessageCompression::run() {
+    if(m_running.exchange(true)) {
+        co_return;
+    }
+    // Cleared however the run ends, a flag left set would stop the job for good.
+    struct ClearOnExit {
+        std::atomic<bool>& flag;
+        ~ClearOnExit() { flag = false; }
+    } clear{m_running};
+    try {
+        co_await loadNewer(m_dbClient);
+        if(serverConfig().message_compression.enabled) {
+            if(!m_encoder.load(std::memory_order_acquire)) {
+                co_await train();
+            } else {
+                co_await recompressBatch();
+            }
+        }
+    } catch(const drogon::orm::DrogonDbException& e) {
+        LOG_ERROR << "Message compression failed: " << e.base().what();
+    } catch(const std::exception& e) {
+        LOG_ERROR << "Message compression failed: " << e.what();
+    }
+}
+
+drogon::Task<> MessageCompression::train() {
+    if(m_training || std::chrono::steady_clock::now() < m_next_training) {
+        co_return;
+    }
+    const auto& cfg = serverConfig().message_compression;
+    m_next_training = std::chrono::steady_clock::now() + TRAINING_RETRY;
+    auto rows = co_await switch_to_io_loop(m_dbClient->execSqlCoro(sql::TRAINING_SAMPLES, static_cast<int64_t>(cfg.train_samples)));
+    if(rows.size() < MIN_TRAINING_SAMPLES) {
+        LOG_INFO << "Only " << rows.size() << " messages to train a dictionary on, trying again later";
+        co_return;
+    }
+
+    std::string samples;
+    std::vector<size_t> sizes;
+    sizes.reserve(rows.size());
+    for(const auto& row : rows) {
+        const auto text = row["message_text"].as<std::string>();
+        samples += text;
+        sizes.push_back(text.size());
+    }
+
+    // Training takes a while, on the main loop it holds up no connection.
+    m_training = true;
+    drogon::app().getLoop()->queueInLoop([this, samples = std::move(samples), sizes = std::move(sizes), capacity = cfg.dictionary_bytes] {
+        auto dictionary = std::make_shared<std::vector<char>>(capacity);
+        const auto size = ZDICT_trainFromBuffer(dictionary->data(), dictionary->size(), samples.data(), sizes.data(), static_cast<unsigned>(sizes.size()));
+        if(ZDICT_isError(size)) {
+            LOG_WARN << "Could not train a message dictionary: " << ZDICT_getErrorName(size);
+            m_training = false;
+            return;
+        }
+        dictionary->resize(size);
+        drogon::async_run([this, dictionary]() -> drogon::Task<> {
+            try {
+                auto rows = co_await switch_to_io_loop(m_dbClient->execSqlCoro(sql::INSERT_DICTIONARY, *dictionary));
+                LOG_INFO << "Trained message dictionary " << rows.front()["dictionary_id"].as<int32_t>() << " of " << dictionary->size() << " bytes";
+                co_await loadNewer(m_dbClient);
+            } catch(const drogon::orm::DrogonDbException& e) {
+                LOG_ERROR << "Could not store the message dictionary: " << e.base().what();
+            } catch(const std::exception& e) {
+                LOG_ERROR << "Could not store the message dictionary: " << e.what();
+            }
+            m_training = false;
+        });
+    });
+}
+
+drogon::Task<> MessageCompression::recompressBatch() {
+    const auto& cfg = serverConfig().message_compression;
+    const int64_t cutoff = std::chrono::duration_cast<std::chrono::microseconds>(
+        (std::chrono::system_clock::now() - cfg.recompress_after).time_since_epoch()).count();
+    const auto batch = static_cast<int64_t>(std::max<size_t>(cfg.batch_size, 1));
+    // Held for the run, the rows of one statement share a dictionary.
+    const auto encoder = m_encoder.load(std::memory_order_acquire);
+
+    for(int skipped = 0; skipped < MAX_SKIPPED_BATCHES; ++skipped) {
+        auto rows = co_await switch_to_io_loop(m_dbClient->execSqlCoro(sql::NEXT_MESSAGES, m_cursor, batch));
+        std::vector<int32_t> ids;
+        std::vector<int64_t> created;
+        std::vector<std::vector<char>> bodies;
+        int32_t cursor = m_cursor;
+        bool reached_recent = false;
+        for(const auto& row : rows) {
+            if(row["created_at"].as<int64_t>() >= cutoff) {
+                // Ids are handed out in about time order, the ones after are recent too.
+                reached_recent = true;
+                break;
+            }
+            cursor = row["message_id"].as<int32_t>();
+            if(row["message_text"].isNull()) {
+                continue;
+            }
+            auto body = compress(*encoder, row["message_text"].as<std::string>());
+            if(!body) {
+                continue;
+            }
+            ids.push_back(cursor);
+            created.push_back(row["created_at"].as<int64_t>());
+            bodies.push_back(std::move(*body));
+        }
+
+        if(!ids.empty()) {
+            const auto number = [](std::string& out, auto value) { out += std::to_string(value); };
+            const auto bytea = [](std::string& out, const std::vector<char>& body) {
+                static constexpr char HEX[] = "0123456789abcdef";
+                out += "\"\\\\x";
+                for(const char c : body) {
+                    out += HEX[static_cast<unsigned char>(c) >> 4];
+                    out += HEX[static_cast<unsigned char>(c) & 0xf];
+                }
+                out += '"';
+            };
+            co_await switch_to_io_loop(m_dbClient->execSqlCoro(sql::COMPRESS_MESSAGES, encoder->dictionary_id,
+                arrayLiteral(ids, number), arrayLiteral(created, number), arrayLiteral(bodies, bytea)));
+            LOG_DEBUG << "Compressed " << ids.size() << " messages up to id " << cursor;
+        }
+        m_cursor = cursor;
+        // Only a batch with nothing left to compress is skipped through, one with work waits for the next run.
+        if(!ids.empty() || reached_recent || rows.size() < static_cast<size_t>(batch)) {
+            co_return;
+        }
+    }
+}
+
+} // namespace server
@@ -0,0 +1,50 @@
+#include <server/db/MessageIdAllocator.h>
+#include <server/utils/switch_to_io_loop.h>
+#include <server/utils/server_config.h>
+
+namespace server {
+
+MessageIdAllocator& MessageIdAllocator::instance() {
+    static MessageIdAllocator inst;
+    return inst;
+}
+
+MessageIdAllocator::MessageIdAllocator()
+    : m_dbClient{writeDbClient()} {}
+
+std::optional<int32_t> MessageIdAllocator::tryTake() {
+    std::lock_guard lock(m_mutex);
+    if(m_reserved.empty()) {
+        return std::nullopt;
+    }
+    auto id = m_reserved.front();
+    m_reserved.pop_front();
+    return id;
+}
+
+drogon::Task<std::optional<int32_t>> MessageIdAllocator::next() {
+    if(auto id = tryTake()) {
+        co_return id;
+    }
+
+    // Concurrent refills may each reserve a block, the surplus just stays in the reserve.
+    try {
+        const auto block_size = std::max<int64_t>(serverConfig().message_delivery.id_block_size, 1);
+        auto result = co_await switch_to_io_loop(m_dbClient->execSqlCoro(
+            "SELECT nextval(pg_get_serial_sequence('messages', 'message_id'))::integer AS id "
+            "FROM generate_series(1, $1)",
+            block_size));
+
+        std::lock_guard lock(m_mutex);
+        for(const auto& row : result) {
+            m_reserved.push_back(row["id"].as<int32_t>());
+        }
+    } catch(const drogon::orm::DrogonDbException& e) {
+        LOG_ERROR << "Failed to reserve message ids: " << e.base().what();
+        co_return std::nullopt;
+    }
+
+    co_return tryTake();
+}
+
+} // namespace server
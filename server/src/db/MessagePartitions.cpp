@@ -0,0 +1,187 @@
+#include <server/db/MessagePartitions.h>
+#include <server/utils/scoped_coro_transaction.h>
+#include <server/utils/server_config.h>
+#include <server/utils/switch_to_io_loop.h>
+
+namespace server {
+
+namespace sql {
+
+static const std::string PARTITIONS =
+    "SELECT c.relname AS name, pg_get_expr(c.relpartbound, c.oid) AS bound "
+    "FROM pg_inherits i JOIN pg_class c ON c.oid = i.inhrelid "
+    "WHERE i.inhparent = 'messages'::regclass";
+
+// Any value, it only has to be the same on every server.
+static const std::string CREATION_LOCK =
+    "SELECT pg_advisory_xact_lock(7349021156)";
+
+} // namespace sql
+
+using namespace std::chrono;
+
+/// Microseconds since the epoch at the start of a month, UTC, like `created_at`.
+static int64_t monthStart(year_month month) {
+    return duration_cast<microseconds>(sys_days{month / 1}.time_since_epoch()).count();
+}
+
+static std::string partitionName(year_month month) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "messages_p%04d%02u", static_cast<int>(month.year()), static_cast<unsigned>(month.month()));
+    return name;
+}
+
+/// One end of a range bound as `pg_get_expr` prints it, `MINVALUE`, `MAXVALUE` or a number, quoted or not.
+static std::optional<int64_t> parseBoundValue(std::string_view value) {
+    if(value == "MINVALUE") {
+        return std::numeric_limits<int64_t>::min();
+    }
+    if(value == "MAXVALUE") {
+        return std::numeric_limits<int64_t>::max();
+    }
+    if(value.size() >= 2 && value.front() == '\'' && value.back() == '\'') {
+        value = value.substr(1, value.size() - 2);
+    }
+    int64_t v;
+    auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), v);
+    return ec == std::errc{} && ptr == value.data() + value.size() ? std::optional{v} : std::nullopt;
+}
+
+/// Parses `FOR VALUES FROM (a) TO (b)`, anything else (a default partition) gives nullopt.
+static std::optional<std::pair<int64_t, int64_t>> parseRangeBound(std::string_view bound) {
+    const auto between = [&bound](std::string_view open) -> std::optional<std::string_view> {
+        auto begin = bound.find(open);
+        if(begin == std::string_view::npos) {
+            return std::nullopt;
+        }
+        begin += open.size();
+        auto end = bound.find(')', begin);
+        if(end == std::string_view::npos) {
+            return std::nullopt;
+        }
+        return bound.substr(begin, end - begin);
+    };
+    auto from = between("FROM (");
+    auto to = between("TO (");
+    if(!from || !to) {
+        return std::nullopt;
+    }
+    auto fromValue = parseBoundValue(*from);
+    auto toValue = parseBoundValue(*to);
+    if(!fromValue || !toValue) {
+        return std::nullopt;
+    }
+    return std::pair{*fromValue, *toValue};
+}
+
+MessagePartitions& MessagePartitions::instance() {
+    static MessagePartitions inst;
+    return inst;
+}
+
+MessagePartitions::MessagePartitions()
+    : m_dbClient{writeDbClient()} {}
+
+void MessagePartitions::start() {
+    const auto& cfg = serverConfig().message_partitions;
+    if(!cfg.enabled || !m_dbClient) {
+        return;
+    }
+    std::call_once(m_timer_started, [this, &cfg] {
+        const auto run = [this] { drogon::async_run([this]() -> drogon::Task<> { co_await maintain(); }); };
+        drogon::app().getIOLoop(0)->queueInLoop(run);
+        drogon::app().getIOLoop(0)->runEvery(std::max<double>(cfg.interval.count(), 60), run);
+    });
+}
+
+drogon::Task<> MessagePartitions::maintain() {
+    if(m_running.exchange(true)) {
+        co_return;
+    }
+    try {
+        auto partitions = co_await listPartitions();
+        co_await createUpcoming(partitions);
+        if(serverConfig().message_partitions.retention.count() > 0) {
+            co_await retireExpired(partitions);
+        }
+    } catch(const drogon::orm::DrogonDbException& e) {
+        LOG_ERROR << "Message partition maintenance failed: " << e.base().what();
+    }
+    m_running = false;
+}
+
+drogon::Task<std::vector<MessagePartitions::Partition>> MessagePartitions::listPartitions() {
+    auto rows = co_await switch_to_io_loop(m_dbClient->execSqlCoro(sql::PARTITIONS));
+    std::vector<Partition> partitions;
+    partitions.reserve(rows.size());
+    for(const auto& row : rows) {
+        const auto name = row["name"].as<std::string>();
+        if(auto range = parseRangeBound(row["bound"].as<std::string>())) {
+            partitions.push_back(Partition{name, range->first, range->second});
+        } else {
+            LOG_WARN << "Ignoring messages partition " << name << " without a range bound";
+        }
+    }
+    co_return partitions;
+}
+
+drogon::Task<> MessagePartitions::createUpcoming(const std::vector<Partition>& partitions) {
+    const auto today = year_month_day{floor<days>(system_clock::now())};
+    const year_month current = today.year() / today.month();
+    const int ahead = std::max(serverConfig().message_partitions.months_ahead, 1);
+
+    std::vector<year_month> missing;
+    for(int i = 0; i <= ahead; ++i) {
+        const year_month month = current + months{i};
+        const int64_t from = monthStart(month);
+        const int64_t to = monthStart(month + months{1});
+        // A partition overlapping the month, like the one the migration attached, already takes its messages.
+        const bool covered = std::ranges::any_of(partitions, [from, to](const Partition& p) { return p.from < to && from < p.to; });
+        if(!covered) {
+            missing.push_back(month);
+        }
+    }
+    if(missing.empty()) {
+        co_return;
+    }
+
+    auto err = co_await WithTransaction([&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
+        co_await switch_to_io_loop(tx->execSqlCoro(sql::CREATION_LOCK));
+        for(const year_month month : missing) {
+            // DDL takes no parameters, the bounds are plain numbers.
+            co_await switch_to_io_loop(tx->execSqlCoro(
+                "CREATE TABLE IF NOT EXISTS " + partitionName(month) + " PARTITION OF messages "
+                "FOR VALUES FROM (" + std::to_string(monthStart(month)) + ") TO (" + std::to_string(monthStart(month + months{1})) + ")"));
+        }
+        co_return std::nullopt;
+    });
+    if(err) {
+        // Usually another server creating the same partitions first, the next run sees them.
+        LOG_WARN << "Could not create messages partitions: " << *err;
+        co_return;
+    }
+    LOG_INFO << "Created " << missing.size() << " messages partitions";
+}
+
+drogon::Task<> MessagePartitions::retireExpired(const std::vector<Partition>& partitions) {
+    const auto& cfg = serverConfig().message_partitions;
+    const int64_t cutoff = duration_cast<microseconds>((system_clock::now() - cfg.retention).time_since_epoch()).count();
+    for(const auto& partition : partitions) {
+        if(partition.to > cutoff) {
+            continue;
+        }
+        try {
+            // Concurrently, so inserts into the current partitions are not blocked meanwhile.
+            // It cannot run in a transaction.
+            co_await switch_to_io_loop(m_dbClient->execSqlCoro("ALTER TABLE messages DETACH PARTITION \"" + partition.name + "\" CONCURRENTLY"));
+            if(!cfg.keep_detached) {
+                co_await switch_to_io_loop(m_dbClient->execSqlCoro("DROP TABLE \"" + partition.name + "\""));
+            }
+            LOG_INFO << (cfg.keep_detached ? "Detached" : "Dropped") << " expired messages partition " << partition.name;
+        } catch(const drogon::orm::DrogonDbException& e) {
+            LOG_WARN << "Could not detach messages partition " << partition.name << ": " << e.base().what();
+        }
+    }
+}
+
+} // namespace server
@@ -0,0 +1,564 @@
+#include <server/db/Repository.h>
+#include <server/db/MessageCompression.h>
+#include <server/utils/switch_to_io_loop.h>
+#include <json/json.h>
+
+namespace server {
+
+namespace models = drogon_model::drogon_test;
+
+namespace sql {
+
+static const std::string USER_BY_NAME =
+    "SELECT * FROM users WHERE username = $1";
+
+static const std::string USER_BY_ID =
+    "SELECT * FROM users WHERE user_id = $1";
+
+static const std::string MEMBERSHIP_STATUS =
+    "SELECT membership_status::text AS membership_status FROM room_membership "
+    "WHERE user_id = $1 AND room_id = $2";
+
+static const std::string JOINED_ROOM_IDS =
+    "SELECT room_id FROM room_membership WHERE user_id = $1 AND membership_status = 'JOINED'";
+
+// The effective rights as in the join roster, ranked like chat::UserRights, 0 for regular members.
+static const std::string ROOM_MEMBERS =
+    "SELECT * FROM ("
+    "SELECT u.user_id, u.username, "
+    "CASE WHEN u.is_admin THEN 3 WHEN r.owner_id = u.user_id THEN 2 WHEN urd.is_moderator THEN 1 ELSE 0 END AS rights "
+    "FROM room_membership rm "
+    "JOIN users u ON u.user_id = rm.user_id "
+    "JOIN rooms r ON r.room_id = rm.room_id "
+    "LEFT JOIN user_room_data urd ON urd.user_id = rm.user_id AND urd.room_id = rm.room_id "
+    "WHERE rm.room_id = $1 AND u.username ILIKE $2"
+    ") m "
+    "WHERE m.rights < $3 OR (m.rights = $3 AND (m.username, m.user_id) > ($4, $5)) "
+    "ORDER BY m.rights DESC, m.username, m.user_id LIMIT $6";
+
+// Every member of a room with their effective rights, NULL for regular members.
+static const std::string ROOM_ROSTER =
+    "SELECT u.user_id, u.username, "
+    "CASE WHEN u.is_admin THEN 'ADMIN' "
+    "WHEN r.owner_id = u.user_id THEN 'OWNER' "
+    "WHEN urd.is_moderator THEN 'MODERATOR' "
+    "END AS rights "
+    "FROM room_membership rm "
+    "JOIN users u ON u.user_id = rm.user_id "
+    "JOIN rooms r ON r.room_id = rm.room_id "
+    "LEFT JOIN user_room_data urd ON urd.user_id = rm.user_id AND urd.room_id = rm.room_id "
+    "WHERE rm.room_id = $1";
+
+// Joined members only, as in ROOM_DIRECTORY, so a room shows the same count in both.
+static const std::string ROOM_MEMBER_COUNT =
+    "SELECT count(*) AS members FROM room_membership WHERE room_id = $1 AND membership_status = 'JOINED'";
+
+// The unread counts come from the room's last seq, nothing is counted per message.
+static const std::string JOINED_ROOM_LIST =
+    "SELECT r.room_id, r.room_name, rm.membership_status::text AS membership_status, "
+    "GREATEST(r.last_seq - c.last_read_seq, 0) AS unread_count "
+    "FROM room_membership rm "
+    "JOIN rooms r ON r.room_id = rm.room_id "
+    "LEFT JOIN room_read_cursors c ON c.room_id = r.room_id AND c.user_id = $1 "
+    "WHERE rm.user_id = $1 AND rm.membership_status = 'JOINED' "
+    "ORDER BY r.room_id";
+
+static const std::string ROOM_LIST =
+    "SELECT r.room_id, r.room_name, rm.membership_status::text AS membership_status, "
+    "GREATEST(r.last_seq - c.last_read_seq, 0) AS unread_count "
+    "FROM rooms r "
+    "LEFT JOIN room_membership rm ON rm.room_id = r.room_id AND rm.user_id = $1 "
+    "LEFT JOIN room_read_cursors c ON c.room_id = r.room_id AND c.user_id = $1 "
+    "ORDER BY r.room_id";
+
+static const std::string ROOM_DIRECTORY =
+    "SELECT r.room_id, r.room_name, "
+    "(SELECT count(*) FROM room_membership rm WHERE rm.room_id = r.room_id AND rm.membership_status = 'JOINED') AS member_count "
+    "FROM rooms r ORDER BY r.room_id";
+
+// A limit of 0 becomes LIMIT NULL, which does not limit the page.
+static const std::string MESSAGES_OLDER =
+    "SELECT m.message_id, m.message_text, m.message_body, m.dictionary_id, m.created_at, m.seq, u.user_id, u.username "
+    "FROM messages m JOIN users u ON u.user_id = m.user_id "
+    "WHERE m.room_id = $1 AND m.created_at < $2 AND m.deleted_at IS NULL "
+    "ORDER BY m.created_at DESC LIMIT NULLIF($3, 0)";
+
+static const std::string MESSAGES_NEWER =
+    "SELECT m.message_id, m.message_text, m.message_body, m.dictionary_id, m.created_at, m.seq, u.user_id, u.username "
+    "FROM messages m JOIN users u ON u.user_id = m.user_id "
+    "WHERE m.room_id = $1 AND m.created_at > $2 AND m.deleted_at IS NULL "
+    "ORDER BY m.created_at ASC LIMIT NULLIF($3, 0)";
+
+// The same pages keyed by seq, on idx_messages_room_seq. They read every partition, a seq says nothing of the time.
+static const std::string MESSAGES_OLDER_SEQ =
+    "SELECT m.message_id, m.message_text, m.message_body, m.dictionary_id, m.created_at, m.seq, u.user_id, u.username "
+    "FROM messages m JOIN users u ON u.user_id = m.user_id "
+    "WHERE m.room_id = $1 AND m.seq < $2 AND m.deleted_at IS NULL "
+    "ORDER BY m.seq DESC LIMIT NULLIF($3, 0)";
+
+static const std::string MESSAGES_NEWER_SEQ =
+    "SELECT m.message_id, m.message_text, m.message_body, m.dictionary_id, m.created_at, m.seq, u.user_id, u.username "
+    "FROM messages m JOIN users u ON u.user_id = m.user_id "
+    "WHERE m.room_id = $1 AND m.seq > $2 AND m.deleted_at IS NULL "
+    "ORDER BY m.seq ASC LIMIT NULLIF($3, 0)";
+
+// The window of GetMessagesAround, oldest first: the anchor and up to $3 + 1 older messages, then up to
+// $4 + 1 newer ones, both sides on idx_messages_room_seq. The one past each side tells whether the room goes on.
+static const std::string MESSAGES_AROUND =
+    "WITH anchor AS (SELECT seq FROM messages WHERE message_id = $2 AND room_id = $1) "
+    "SELECT * FROM ("
+    "(SELECT m.message_id, m.message_text, m.message_body, m.dictionary_id, m.created_at, m.seq, u.user_id, u.username, a.seq AS anchor_seq "
+    "FROM anchor a JOIN messages m ON m.room_id = $1 AND m.seq <= a.seq JOIN users u ON u.user_id = m.user_id "
+    "WHERE m.deleted_at IS NULL ORDER BY m.seq DESC LIMIT $3 + 2) "
+    "UNION ALL "
+    "(SELECT m.message_id, m.message_text, m.message_body, m.dictionary_id, m.created_at, m.seq, u.user_id, u.username, a.seq AS anchor_seq "
+    "FROM anchor a JOIN messages m ON m.room_id = $1 AND m.seq > a.seq JOIN users u ON u.user_id = m.user_id "
+    "WHERE m.deleted_at IS NULL ORDER BY m.seq ASC LIMIT $4 + 1)"
+    ") w ORDER BY seq ASC";
+
+// The tsvector expression must stay the one of idx_messages_text_search for the index to be used.
+// Public rooms and the private rooms the user joined.
+static const std::string SEARCH_MESSAGES_FROM =
+    "SELECT m.message_id, m.message_text, m.message_body, m.dictionary_id, m.created_at, m.seq, m.room_id, u.user_id, u.username "
+    "FROM messages m JOIN users u ON u.user_id = m.user_id "
+    "JOIN rooms r ON r.room_id = m.room_id "
+    "LEFT JOIN room_membership rm ON rm.room_id = m.room_id AND rm.user_id = $2 "
+    "WHERE to_tsvector('simple', m.message_text) @@ websearch_to_tsquery('simple', $1) "
+    "AND m.created_at < $3 AND m.deleted_at IS NULL "
+    "AND (NOT r.is_private OR rm.membership_status = 'JOINED') ";
+
+static const std::string SEARCH_MESSAGES =
+    SEARCH_MESSAGES_FROM + "ORDER BY m.created_at DESC LIMIT $4";
+
+static const std::string SEARCH_ROOM_MESSAGES =
+    SEARCH_MESSAGES_FROM + "AND m.room_id = $5 ORDER BY m.created_at DESC LIMIT $4";
+
+static const std::string TOMBSTONES =
+    "SELECT message_id, deleted_at FROM message_tombstones "
+    "WHERE room_id = $1 AND deleted_at > $2 AND deleted_at <= $3 "
+    "ORDER BY deleted_at ASC LIMIT $4";
+
+// Marks the rows of the CTE deleted and records their tombstones in the same statement,
+// which is atomic on its own. Returns the ids actually deleted.
+static const std::string SOFT_DELETE_TAIL =
+    "RETURNING m.message_id, m.room_id, m.deleted_at"
+    "), tombstones AS ("
+        "INSERT INTO message_tombstones (message_id, room_id, deleted_at) "
+        "SELECT message_id, room_id, deleted_at FROM deleted "
+        "ON CONFLICT (message_id) DO NOTHING"
+    ") "
+    "SELECT message_id FROM deleted";
+
+static const std::string SOFT_DELETE_MESSAGE =
+    "WITH deleted AS ("
+        "UPDATE messages m SET deleted_at = (EXTRACT(EPOCH FROM NOW()) * 1000000)::bigint "
+        "WHERE m.message_id = $1 AND m.room_id = $2 AND m.deleted_at IS NULL "
+    + SOFT_DELETE_TAIL;
+
+// The partition key is matched too, so each row is updated through its own partition.
+static const std::string SOFT_DELETE_USER_MESSAGES =
+    "WITH deleted AS ("
+        "UPDATE messages m SET deleted_at = (EXTRACT(EPOCH FROM NOW()) * 1000000)::bigint "
+        "FROM ("
+            "SELECT message_id, created_at FROM messages "
+            "WHERE room_id = $1 AND user_id = $2 AND deleted_at IS NULL "
+            "ORDER BY created_at DESC LIMIT $3"
+        ") newest "
+        "WHERE m.message_id = newest.message_id AND m.created_at = newest.created_at "
+    + SOFT_DELETE_TAIL;
+
+static const std::string INSERT_MESSAGE =
+    "INSERT INTO messages (room_id, user_id, message_text, message_body, dictionary_id) VALUES ($1, $2, $3, $4, $5) "
+    "RETURNING message_id, created_at, seq";
+
+static const std::string INSERT_MESSAGE_WITH_ID =
+    "INSERT INTO messages (message_id, room_id, user_id, message_text, message_body, dictionary_id, created_at, seq) "
+    "VALUES ($1, $2, $3, $4, $5, $6, $7, $8)";
+
+// Inserts nothing for a room that does not exist.
+static const std::string MARK_ROOM_READ =
+    "INSERT INTO room_read_cursors (user_id, room_id, last_read_seq) "
+    "SELECT $1, r.room_id, LEAST($3, r.last_seq) FROM rooms r WHERE r.room_id = $2 "
+    "ON CONFLICT (user_id, room_id) DO UPDATE "
+    "SET last_read_seq = GREATEST(room_read_cursors.last_read_seq, EXCLUDED.last_read_seq)";
+
+// Global admins, the owner and the room's moderators, as in MessageHandlers::getUserRights.
+static const std::string MODERATED_ROOM_LAST_SEQ =
+    "SELECT r.last_seq FROM rooms r JOIN users u ON u.user_id = $1 "
+    "LEFT JOIN user_room_data d ON d.user_id = u.user_id AND d.room_id = r.room_id "
+    "WHERE r.room_id = $2 AND (u.is_admin OR r.owner_id = u.user_id OR COALESCE(d.is_moderator, false))";
+
+// A reservation older than this belongs to a server that died before it inserted or released it.
+// Longer than any insert takes, a message committing after it could be skipped by a sync.
+static const std::string SEQ_RESERVATION_TIMEOUT = "interval '1 minute'";
+
+// Commits right away, so the room's row is only locked for the statement. The seq stays
+// reserved in reserved_message_seqs until the message is inserted or the seq is released.
+static const std::string RESERVE_MESSAGE_SEQ =
+    "WITH taken AS (UPDATE rooms SET last_seq = last_seq + 1 WHERE room_id = $1 RETURNING room_id, last_seq) "
+    "INSERT INTO reserved_message_seqs (room_id, seq) SELECT room_id, last_seq FROM taken RETURNING seq AS last_seq";
+
+// The expired reservations of the room go along with the released one.
+static const std::string RELEASE_MESSAGE_SEQ =
+    "DELETE FROM reserved_message_seqs WHERE room_id = $1 AND (seq = $2 OR reserved_at < now() - " + SEQ_RESERVATION_TIMEOUT + ")";
+
+// Every seq up to it is either committed or will never be, the one before the lowest live reservation.
+static const std::string ROOM_SETTLED_SEQ =
+    "SELECT COALESCE((SELECT MIN(s.seq) - 1 FROM reserved_message_seqs s "
+    "WHERE s.room_id = r.room_id AND s.reserved_at >= now() - " + SEQ_RESERVATION_TIMEOUT + "), r.last_seq) AS settled_seq "
+    "FROM rooms r WHERE r.room_id = $1";
+
+// The statements above that read a table, with the types of their parameters and sample values
+// for them. The inserts of messages read nothing and are left out.
+struct PlannedQuery {
+    std::string_view name;
+    const std::string& text;
+    std::string_view types;
+    std::string_view args;
+};
+
+static const PlannedQuery PLANNED_QUERIES[] = {
+    {"USER_BY_NAME", USER_BY_NAME, "text", "'plan_check'"},
+    {"USER_BY_ID", USER_BY_ID, "integer", "1"},
+    {"MEMBERSHIP_STATUS", MEMBERSHIP_STATUS, "integer, integer", "1, 1"},
+    {"JOINED_ROOM_IDS", JOINED_ROOM_IDS, "integer", "1"},
+    {"ROOM_MEMBERS", ROOM_MEMBERS, "integer, text, integer, text, integer, integer", "1, 'a%', 4, '', 0, 50"},
+    {"ROOM_ROSTER", ROOM_ROSTER, "integer", "1"},
+    {"ROOM_MEMBER_COUNT", ROOM_MEMBER_COUNT, "integer", "1"},
+    {"JOINED_ROOM_LIST", JOINED_ROOM_LIST, "integer", "1"},
+    {"ROOM_LIST", ROOM_LIST, "integer", "1"},
+    {"ROOM_DIRECTORY", ROOM_DIRECTORY, "", ""},
+    {"MESSAGES_OLDER", MESSAGES_OLDER, "integer, bigint, integer", "1, 9223372036854775807, 50"},
+    {"MESSAGES_NEWER", MESSAGES_NEWER, "integer, bigint, integer", "1, 0, 50"},
+    {"MESSAGES_OLDER_SEQ", MESSAGES_OLDER_SEQ, "integer, bigint, integer", "1, 9223372036854775807, 50"},
+    {"MESSAGES_NEWER_SEQ", MESSAGES_NEWER_SEQ, "integer, bigint, integer", "1, 0, 50"},
+    {"MESSAGES_AROUND", MESSAGES_AROUND, "integer, integer, integer, integer", "1, 1, 25, 25"},
+    {"SEARCH_MESSAGES", SEARCH_MESSAGES, "text, integer, bigint, integer", "'hello', 1, 9223372036854775807, 20"},
+    {"SEARCH_ROOM_MESSAGES", SEARCH_ROOM_MESSAGES, "text, integer, bigint, integer, integer", "'hello', 1, 9223372036854775807, 20, 1"},
+    {"TOMBSTONES", TOMBSTONES, "integer, bigint, bigint, integer", "1, 0, 9223372036854775807, 100"},
+    {"SOFT_DELETE_MESSAGE", SOFT_DELETE_MESSAGE, "integer, integer", "1, 1"},
+    {"SOFT_DELETE_USER_MESSAGES", SOFT_DELETE_USER_MESSAGES, "integer, integer, integer", "1, 1, 10"},
+    {"MARK_ROOM_READ", MARK_ROOM_READ, "integer, integer, bigint", "1, 1, 1"},
+    {"MODERATED_ROOM_LAST_SEQ", MODERATED_ROOM_LAST_SEQ, "integer, integer", "1, 1"},
+    {"RESERVE_MESSAGE_SEQ", RESERVE_MESSAGE_SEQ, "integer", "1"},
+    {"RELEASE_MESSAGE_SEQ", RELEASE_MESSAGE_SEQ, "integer, bigint", "1, 1"},
+    {"ROOM_SETTLED_SEQ", ROOM_SETTLED_SEQ, "integer", "1"},
+};
+
+} // namespace sql
+
+drogon::Task<std::optional<models::Users>> Repository::findUserByName(const drogon::orm::DbClientPtr& db, const std::string& username) {
+    auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql::USER_BY_NAME, username));
+    if(rows.empty()) {
+        co_return std::nullopt;
+    }
+    co_return models::Users(rows.front());
+}
+
+drogon::Task<std::optional<models::Users>> Repository::findUserById(const drogon::orm::DbClientPtr& db, int32_t user_id) {
+    auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql::USER_BY_ID, user_id));
+    if(rows.empty()) {
+        co_return std::nullopt;
+    }
+    co_return models::Users(rows.front());
+}
+
+drogon::Task<std::optional<chat::MembershipStatus>> Repository::findMembershipStatus(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id) {
+    auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql::MEMBERSHIP_STATUS, user_id, room_id));
+    chat::MembershipStatus status;
+    if(rows.empty() || rows.front()["membership_status"].isNull()
+       || !chat::MembershipStatus_Parse(rows.front()["membership_status"].as<std::string>(), &status)) {
+        co_return std::nullopt;
+    }
+    co_return status;
+}
+
+drogon::Task<std::vector<int32_t>> Repository::findJoinedRoomIds(const drogon::orm::DbClientPtr& db, int32_t user_id) {
+    auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql::JOINED_ROOM_IDS, user_id));
+
+    std::vector<int32_t> room_ids;
+    room_ids.reserve(rows.size());
+    for(const auto& row : rows) {
+        room_ids.push_back(row["room_id"].as<int32_t>());
+    }
+    co_return room_ids;
+}
+
+drogon::Task<drogon::orm::Result> Repository::findRoomRoster(const drogon::orm::DbClientPtr& db, int32_t room_id) {
+    co_return co_await switch_to_io_loop(db->execSqlCoro(sql::ROOM_ROSTER, room_id));
+}
+
+drogon::Task<drogon::orm::Result> Repository::countRoomMembers(const drogon::orm::DbClientPtr& db, int32_t room_id) {
+    co_return co_await switch_to_io_loop(db->execSqlCoro(sql::ROOM_MEMBER_COUNT, room_id));
+}
+
+drogon::Task<> Repository::loadRoomList(const drogon::orm::DbClientPtr& db, int32_t user_id, bool joined_only, google::protobuf::RepeatedPtrField<chat::RoomInfo>& out) {
+    auto rooms = co_await switch_to_io_loop(db->execSqlCoro(joined_only ? sql::JOINED_ROOM_LIST : sql::ROOM_LIST, user_id));
+
+    out.Reserve(out.size() + static_cast<int>(rooms.size()));
+    for(const auto& row : rooms) {
+        chat::RoomInfo* room_info = out.Add();
+        room_info->set_room_id(row["room_id"].as<int32_t>());
+        room_info->set_room_name(row["room_name"].as<std::string>());
+        if(!row["membership_status"].isNull()) {
+            room_info->set_is_joined(row["membership_status"].as<std::string>() == "JOINED");
+        }
+        if(!row["unread_count"].isNull()) {
+            room_info->set_unread_count(row["unread_count"].as<int64_t>());
+        }
+    }
+}
+
+drogon::Task<> Repository::loadRoomDirectory(const drogon::orm::DbClientPtr& db, google::protobuf::RepeatedPtrField<chat::RoomDirectoryEntry>& out) {
+    auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql::ROOM_DIRECTORY));
+
+    out.Reserve(out.size() + static_cast<int>(rows.size()));
+    for(const auto& row : rows) {
+        auto* entry = out.Add();
+        entry->set_room_id(row["room_id"].as<int32_t>());
+        entry->set_room_name(row["room_name"].as<std::string>());
+        entry->set_member_count(static_cast<uint32_t>(row["member_count"].as<int64_t>()));
+    }
+}
+
+// A row of MESSAGES_OLDER or MESSAGES_NEWER into the message it describes, once MessageCompression prepared the rows.
+static void readMessage(const drogon::orm::Row& row, chat::MessageInfo& message_info) {
+    message_info.set_message(MessageCompression::instance().text(row));
+    message_info.set_timestamp(row["created_at"].as<int64_t>());
+    message_info.set_message_id(row["message_id"].as<int32_t>());
+    message_info.set_seq(row["seq"].as<int64_t>());
+    auto* user_info = message_info.mutable_from();
+    user_info->set_user_id(row["user_id"].as<int32_t>());
+    user_info->set_user_name(row["username"].as<std::string>());
+}
+
+static drogon::Task<drogon::orm::Result> queryMessagesPage(const drogon::orm::DbClientPtr& db, int32_t room_id, int32_t limit, int64_t offset, HistoryKey key) {
+    const auto& query = key == HistoryKey::Seq
+        ? (limit >= 0 ? sql::MESSAGES_OLDER_SEQ : sql::MESSAGES_NEWER_SEQ)
+        : (limit >= 0 ? sql::MESSAGES_OLDER : sql::MESSAGES_NEWER);
+    auto rows = co_await switch_to_io_loop(db->execSqlCoro(query, room_id, offset, std::abs(limit)));
+    co_await MessageCompression::instance().prepare(db, rows);
+    co_return rows;
+}
+
+drogon::Task<std::vector<chat::MessageInfo>> Repository::findMessagesPage(const drogon::orm::DbClientPtr& db, int32_t room_id, int32_t limit, int64_t offset, HistoryKey key) {
+    auto rows = co_await queryMessagesPage(db, room_id, limit, offset, key);
+
+    std::vector<chat::MessageInfo> messages;
+    messages.reserve(rows.size());
+    for(const auto& row : rows) {
+        readMessage(row, messages.emplace_back());
+    }
+    co_return messages;
+}
+
+drogon::Task<> Repository::findMessagesPage(const drogon::orm::DbClientPtr& db, int32_t room_id, int32_t limit, int64_t offset,
+                                            google::protobuf::RepeatedPtrField<chat::MessageInfo>& out, HistoryKey key) {
+    auto rows = co_await queryMessagesPage(db, room_id, limit, offset, key);
+
+    out.Reserve(out.size() + static_cast<int>(rows.size()));
+    for(const auto& row : rows) {
+        readMessage(row, *out.Add());
+    }
+}
+
+drogon::Task<Repository::MessageWindow> Repository::findMessagesAround(const drogon::orm::DbClientPtr& db, int32_t room_id, int32_t message_id,
+                                                                       int32_t before, int32_t after,
+                                                                       google::protobuf::RepeatedPtrField<chat::MessageInfo>& out) {
+    auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql::MESSAGES_AROUND, room_id, message_id, before, after));
+    co_await MessageCompression::instance().prepare(db, rows);
+
+    MessageWindow window;
+    if(rows.empty()) {
+        co_return window;
+    }
+    window.found = true;
+    const auto anchor_seq = rows[0]["anchor_seq"].as<int64_t>();
+    size_t older = 0;
+    size_t newer = 0;
+    for(const auto& row : rows) {
+        const auto seq = row["seq"].as<int64_t>();
+        older += seq < anchor_seq;
+        newer += seq > anchor_seq;
+    }
+    window.has_older = older > static_cast<size_t>(before);
+    window.has_newer = newer > static_cast<size_t>(after);
+    const size_t begin = window.has_older ? older - before : 0;
+    const size_t end = rows.size() - (window.has_newer ? newer - after : 0);
+
+    out.Reserve(out.size() + static_cast<int>(end - begin));
+    for(size_t i = begin; i < end; ++i) {
+        readMessage(rows[i], *out.Add());
+    }
+    co_return window;
+}
+
+drogon::Task<> Repository::searchMessages(const drogon::orm::DbClientPtr& db, int32_t user_id, const std::string& query, int32_t room_id,
+                                          int64_t before_ts, int32_t limit, google::protobuf::RepeatedPtrField<chat::SearchHit>& out) {
+    auto rows = room_id != 0
+        ? co_await switch_to_io_loop(db->execSqlCoro(sql::SEARCH_ROOM_MESSAGES, query, user_id, before_ts, limit, room_id))
+        : co_await switch_to_io_loop(db->execSqlCoro(sql::SEARCH_MESSAGES, query, user_id, before_ts, limit));
+    co_await MessageCompression::instance().prepare(db, rows);
+
+    out.Reserve(out.size() + static_cast<int>(rows.size()));
+    for(const auto& row : rows) {
+        auto* hit = out.Add();
+        hit->set_room_id(row["room_id"].as<int32_t>());
+        readMessage(row, *hit->mutable_message());
+    }
+}
+
+// `prefix` as a pattern of ILIKE, its own wildcards escaped.
+static std::string prefixPattern(std::string_view prefix) {
+    std::string pattern;
+    pattern.reserve(prefix.size() + 1);
+    for(char c : prefix) {
+        if(c == '%' || c == '_' || c == '\\') {
+            pattern.push_back('\\');
+        }
+        pattern.push_back(c);
+    }
+    pattern.push_back('%');
+    return pattern;
+}
+
+drogon::Task<> Repository::findRoomMembers(const drogon::orm::DbClientPtr& db, int32_t room_id, std::string_view prefix, const chat::UserInfo* after,
+                                           int32_t limit, google::protobuf::RepeatedPtrField<chat::UserInfo>& out) {
+    // Past the highest rights, the first page starts from the top.
+    const int32_t after_rights = after ? static_cast<int32_t>(after->user_room_rights()) : static_cast<int32_t>(chat::UserRights::ADMIN) + 1;
+    const std::string after_name = after ? after->user_name() : std::string{};
+    const int32_t after_id = after ? after->user_id() : 0;
+    auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql::ROOM_MEMBERS, room_id, prefixPattern(prefix), after_rights, after_name, after_id, limit));
+
+    out.Reserve(out.size() + static_cast<int>(rows.size()));
+    for(const auto& row : rows) {
+        auto* member = out.Add();
+        member->set_user_id(row["user_id"].as<int32_t>());
+        member->set_user_name(row["username"].as<std::string>());
+        if(const auto rights = row["rights"].as<int32_t>(); rights > 0 && chat::UserRights_IsValid(rights)) {
+            member->set_user_room_rights(static_cast<chat::UserRights>(rights));
+        }
+    }
+}
+
+drogon::Task<std::vector<std::pair<int32_t, int64_t>>> Repository::findTombstones(const drogon::orm::DbClientPtr& db, int32_t room_id, int64_t since, int64_t until, int32_t limit) {
+    auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql::TOMBSTONES, room_id, since, until, limit));
+
+    std::vector<std::pair<int32_t, int64_t>> tombstones;
+    tombstones.reserve(rows.size());
+    for(const auto& row : rows) {
+        tombstones.emplace_back(row["message_id"].as<int32_t>(), row["deleted_at"].as<int64_t>());
+    }
+    co_return tombstones;
+}
+
+drogon::Task<bool> Repository::softDeleteMessage(const drogon::orm::DbClientPtr& db, int32_t message_id, int32_t room_id) {
+    auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql::SOFT_DELETE_MESSAGE, message_id, room_id));
+    co_return !rows.empty();
+}
+
+drogon::Task<std::vector<int32_t>> Repository::softDeleteUserMessages(const drogon::orm::DbClientPtr& db, int32_t room_id, int32_t user_id, int32_t count) {
+    auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql::SOFT_DELETE_USER_MESSAGES, room_id, user_id, count));
+
+    std::vector<int32_t> message_ids;
+    message_ids.reserve(rows.size());
+    for(const auto& row : rows) {
+        message_ids.push_back(row["message_id"].as<int32_t>());
+    }
+    co_return message_ids;
+}
+
+drogon::Task<StoredMessage> Repository::insertMessage(const drogon::orm::DbClientPtr& db, int32_t room_id, int32_t user_id, const std::string& text) {
+    auto stored = MessageCompression::instance().encodeForWrite(text);
+    auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql::INSERT_MESSAGE, room_id, user_id, stored.text, stored.body, stored.dictionary_id));
+    co_return StoredMessage{
+        .message_id = rows.front()["message_id"].as<int32_t>(),
+        .created_at = rows.front()["created_at"].as<int64_t>(),
+        .seq = rows.front()["seq"].as<int64_t>(),
+    };
+}
+
+drogon::Task<void> Repository::insertMessage(const drogon::orm::DbClientPtr& db, const StoredMessage& stored, int32_t room_id, int32_t user_id, const std::string& text) {
+    auto body = MessageCompression::instance().encodeForWrite(text);
+    co_await switch_to_io_loop(db->execSqlCoro(sql::INSERT_MESSAGE_WITH_ID,
+        stored.message_id, room_id, user_id, body.text, body.body, body.dictionary_id, stored.created_at, stored.seq));
+}
+
+drogon::Task<> Repository::markRoomRead(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id, int64_t seq) {
+    co_await switch_to_io_loop(db->execSqlCoro(sql::MARK_ROOM_READ, user_id, room_id, seq));
+}
+
+drogon::Task<std::optional<int64_t>> Repository::findModeratedLastSeq(const drogon::orm::DbClientPtr& db, int32_t user_id, int32_t room_id) {
+    auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql::MODERATED_ROOM_LAST_SEQ, user_id, room_id));
+    if(rows.empty()) {
+        co_return std::nullopt;
+    }
+    co_return rows.front()["last_seq"].as<int64_t>();
+}
+
+drogon::Task<std::optional<int64_t>> Repository::reserveMessageSeq(const drogon::orm::DbClientPtr& db, int32_t room_id) {
+    auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql::RESERVE_MESSAGE_SEQ, room_id));
+    if(rows.empty()) {
+        co_return std::nullopt;
+    }
+    co_return rows.front()["last_seq"].as<int64_t>();
+}
+
+drogon::Task<void> Repository::releaseMessageSeq(const drogon::orm::DbClientPtr& db, int32_t room_id, int64_t seq) {
+    co_await switch_to_io_loop(db->execSqlCoro(sql::RELEASE_MESSAGE_SEQ, room_id, seq));
+}
+
+drogon::Task<std::optional<int64_t>> Repository::findSettledSeq(const drogon::orm::DbClientPtr& db, int32_t room_id) {
+    auto rows = co_await switch_to_io_loop(db->execSqlCoro(sql::ROOM_SETTLED_SEQ, room_id));
+    if(rows.empty()) {
+        co_return std::nullopt;
+    }
+    co_return rows.front()["settled_seq"].as<int64_t>();
+}
+
+// Appends the relations read by a sequential scan anywhere under `plan`, a node of EXPLAIN (FORMAT JSON).
+static void collectSeqScans(const Json::Value& plan, std::vector<std::string>& out) {
+    if(plan["Node Type"].asString() == "Seq Scan") {
+        out.push_back(plan["Relation Name"].asString());
+    }
+    for(const auto& child : plan["Plans"]) {
+        collectSeqScans(child, out);
+    }
+}
+
+drogon::Task<std::vector<std::string>> Repository::findSequentialScans(const drogon::orm::DbClientPtr& db) {
+    // Prepared statements outlive the transaction, each is deallocated right after it is explained.
+    // The transaction is rolled back, it only scopes the setting to this connection.
+    auto tx = co_await switch_to_io_loop(db->newTransactionCoro());
+    co_await switch_to_io_loop(tx->execSqlCoro("SET LOCAL enable_seqscan = off"));
+
+    std::vector<std::string> scans;
+    Json::CharReaderBuilder builder;
+    const std::unique_ptr<Json::CharReader> reader{builder.newCharReader()};
+    for(const auto& query : sql::PLANNED_QUERIES) {
+        const std::string types = query.types.empty() ? std::string{} : "(" + std::string{query.types} + ")";
+        const std::string args = query.args.empty() ? std::string{} : "(" + std::string{query.args} + ")";
+        co_await switch_to_io_loop(tx->execSqlCoro("PREPARE plan_check " + types + " AS " + query.text));
+        auto rows = co_await switch_to_io_loop(tx->execSqlCoro("EXPLAIN (FORMAT JSON) EXECUTE plan_check " + args));
+        co_await switch_to_io_loop(tx->execSqlCoro("DEALLOCATE plan_check"));
+
+        const auto text = rows.front()["QUERY PLAN"].as<std::string>();
+        Json::Value plans;
+        std::string errors;
+        if(!reader->parse(text.data(), text.data() + text.size(), &plans, &errors)) {
+            scans.push_back(std::string{query.name} + ": unreadable plan, " + errors);
+            continue;
+        }
+        std::vector<std::string> relations;
+        for(const auto& plan : plans) {
+            collectSeqScans(plan["Plan"], relations);
+        }
+        for(const auto& relation : relations) {
+            scans.push_back(std::string{query.name} + ": " + relation);
+        }
+    }
+    tx->rollback();
+    co_return scans;
+}
+
+} // namespace server
@@ -8,6 +8,9 @@ using namespace drogon_model::drogon_test;
 
 namespace server {
 
+/// Key of the advisory lock serializing the migrations of the servers sharing a database.
+static constexpr int64_t MIGRATION_LOCK_KEY = 5173920446;
+
 struct MigrationFile {
     int64_t    timestamp;
     std::string name;
@@ -31,24 +34,6 @@ std::optional<int64_t> parseTimestamp(std::string_view s) noexcept {
     return ec==std::errc{} ? std::optional{v} : std::nullopt;
 }
 
-std::string trim(std::string_view str) {
-    auto start = str.find_first_not_of(" \t\n\r\f\v"sv);
-    if(start == std::string_view::npos) {
-        return "";
-    }
-    auto end = str.find_last_not_of(" \t\n\r\f\v"sv);
-    return std::string(str.substr(start, end - start + 1));
-}
-
-auto split_and_trim(const std::string& content) {
-    return content 
-        | std::views::split(';')
-        | std::views::transform([](auto&& range) {
-            return std::string_view(range.begin(), range.end());
-        })
-        | std::views::transform(trim);
-}
-
 std::optional<std::vector<MigrationFile>> scanMigrationFiles(const std::filesystem::path &dir) {
     std::vector<MigrationFile> out;
     if(!std::filesystem::exists(dir) || !std::filesystem::is_directory(dir)) {
@@ -78,7 +63,124 @@ std::optional<std::vector<MigrationFile>> scanMigrationFiles(const std::filesyst
     return out;
 }
 
-drogon::Task<bool> applyMigration([[maybe_unused]] drogon::orm::DbClientPtr db, const MigrationFile& f) {
+static bool isIdentifierChar(char c) noexcept {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || static_cast<unsigned char>(c) >= 0x80;
+}
+
+std::vector<std::string> splitSqlStatements(std::string_view script) {
+    std::vector<std::string> statements;
+    const size_t n = script.size();
+    size_t start = 0;
+    bool has_code = false;
+    const auto endStatement = [&](size_t end) {
+        if(has_code) {
+            statements.push_back(trim(script.substr(start, end - start)));
+        }
+        start = end + 1;
+        has_code = false;
+    };
+
+    size_t i = 0;
+    while(i < n) {
+        const char c = script[i];
+        if(c == '-' && i + 1 < n && script[i + 1] == '-') {
+            const auto eol = script.find('\n', i);
+            i = eol == std::string_view::npos ? n : eol + 1;
+            continue;
+        }
+        if(c == '/' && i + 1 < n && script[i + 1] == '*') {
+            // Block comments nest in PostgreSQL.
+            int depth = 1;
+            i += 2;
+            while(i < n && depth > 0) {
+                if(script.substr(i, 2) == "/*"sv) {
+                    ++depth;
+                    i += 2;
+                } else if(script.substr(i, 2) == "*/"sv) {
+                    --depth;
+                    i += 2;
+                } else {
+                    ++i;
+                }
+            }
+            continue;
+        }
+        if(c == ';') {
+            endStatement(i);
+            ++i;
+            continue;
+        }
+        if(!std::isspace(static_cast<unsigned char>(c))) {
+            has_code = true;
+        }
+        if(c == '\'' || c == '"') {
+            // Doubled quotes escape themselves, backslashes only escape in E'' strings.
+            const bool backslashes = c == '\'' && i > 0 && (script[i - 1] == 'E' || script[i - 1] == 'e') && (i < 2 || !isIdentifierChar(script[i - 2]));
+            ++i;
+            while(i < n) {
+                if(backslashes && script[i] == '\\') {
+                    i += 2;
+                } else if(script[i] == c) {
+                    if(i + 1 < n && script[i + 1] == c) {
+                        i += 2;
+                        continue;
+                    }
+                    ++i;
+                    break;
+                } else {
+                    ++i;
+                }
+            }
+            continue;
+        }
+        if(c == '$' && (i == 0 || !isIdentifierChar(script[i - 1]))) {
+            // $tag$ ... $tag$, a tag never starts with a digit so $1 parameters are not one.
+            size_t tag_end = i + 1;
+            if(tag_end < n && !std::isdigit(static_cast<unsigned char>(script[tag_end]))) {
+                while(tag_end < n && isIdentifierChar(script[tag_end])) {
+                    ++tag_end;
+                }
+            }
+            if(tag_end < n && script[tag_end] == '$') {
+                const auto tag = script.substr(i, tag_end - i + 1);
+                const auto close = script.find(tag, tag_end + 1);
+                i = close == std::string_view::npos ? n : close + tag.size();
+                continue;
+            }
+        }
+        ++i;
+    }
+    if(start < n) {
+        endStatement(n);
+    }
+    return statements;
+}
+
+bool isNonTransactional(std::string_view script) {
+    size_t pos = 0;
+    while(pos < script.size()) {
+        auto eol = script.find('\n', pos);
+        if(eol == std::string_view::npos) {
+            eol = script.size();
+        }
+        const auto line = trim(script.substr(pos, eol - pos));
+        pos = eol + 1;
+        if(line.empty()) {
+            continue;
+        }
+        if(!line.starts_with("--")) {
+            return false;
+        }
+        std::string directive;
+        std::ranges::copy_if(line.substr(2), std::back_inserter(directive), [](char ch) { return !std::isspace(static_cast<unsigned char>(ch)); });
+        if(directive == "migrate:no-transaction") {
+            return true;
+        }
+    }
+    return false;
+}
+
+drogon::Task<bool> applyMigration(drogon::orm::DbClientPtr db, const MigrationFile& f) {
     std::ifstream file(f.fullPath);
     if (!file) {
         LOG_FATAL << "Error opening file: "sv << f.fullPath;
@@ -89,7 +191,24 @@ drogon::Task<bool> applyMigration([[maybe_unused]] drogon::orm::DbClientPtr db,
                        std::istreambuf_iterator<char>());
     file.close();
 
-    auto sql_commands = split_and_trim(content);
+    const auto sql_commands = splitSqlStatements(content);
+
+    if(isNonTransactional(content)) {
+        LOG_INFO << "Running "sv << f.filename << " outside of a transaction"sv;
+        try {
+            for(const auto& command : sql_commands) {
+                co_await db->execSqlCoro(command);
+            }
+            Migrations m;
+            m.setTimestamp(f.timestamp);
+            m.setName(f.name);
+            co_await CoroMapper<Migrations>(db).insert(m);
+        } catch(const DrogonDbException& e) {
+            LOG_FATAL << "Migration statement failed, the ones before it stay applied: "sv << e.base().what();
+            co_return false;
+        }
+        co_return true;
+    }
 
     auto err = co_await WithTransaction(
         [&](const auto& tx) -> drogon::Task<ScopedTransactionResult> {
@@ -127,24 +246,8 @@ drogon::Task<bool> applyMigrationFile(drogon::orm::DbClientPtr db, const Migrati
     co_return true;
 }
 
-drogon::Task<bool> applyMigrationFiles(drogon::orm::DbClientPtr db) {
-    auto latest = co_await CoroMapper<Migrations>(db)
-                    .orderBy(Migrations::Cols::_timestamp, SortOrder::DESC)
-                    .limit(1)
-                    .findAll();
-
-    int64_t lastTs = latest.empty() ? 0 : latest[0].getValueOfTimestamp();
-
-    auto migrationFiles = scanMigrationFiles("db/migrations"sv);
-
-    if(!migrationFiles) {
-        LOG_FATAL << "Could not enumerate migrations."sv;
-        co_return false;
-    } else {
-        LOG_INFO << "Found "sv << migrationFiles->size() << " migration files"sv;
-    }
-
-    for (const auto &f : *migrationFiles) {
+drogon::Task<bool> applyMigrationFiles(drogon::orm::DbClientPtr db, const std::vector<MigrationFile>& migrationFiles, int64_t lastTs) {
+    for (const auto &f : migrationFiles) {
         if(f.timestamp <= lastTs) {
             LOG_INFO << "Skipping: "sv << f.filename;
             continue;
@@ -161,24 +264,50 @@ drogon::Task<bool> applyMigrationFiles(drogon::orm::DbClientPtr db) {
     co_return true;
 }
 
-drogon::Task<bool> MigrateDatabase(drogon::orm::DbClientPtr db) {
-    bool exists = true;
+/// The timestamp of the newest applied migration, in one query. nullopt when there is no migrations table yet.
+drogon::Task<std::optional<int64_t>> latestAppliedMigration(drogon::orm::DbClientPtr db) {
     try {
-        db->execSqlSync("SELECT * FROM migrations"s);
-    } catch(std::exception&) {
-        exists = false;
+        auto rows = co_await db->execSqlCoro("SELECT COALESCE(MAX(\"timestamp\"), 0) AS latest FROM migrations"s);
+        co_return rows.front()["latest"].as<int64_t>();
+    } catch(const DrogonDbException&) {
+        co_return std::nullopt;
+    }
+}
+
+drogon::Task<bool> MigrateDatabase(drogon::orm::DbClientPtr db) {
+    auto migrationFiles = scanMigrationFiles("db/migrations"sv);
+    if(!migrationFiles) {
+        LOG_FATAL << "Could not enumerate migrations."sv;
+        co_return false;
+    }
+    LOG_INFO << "Found "sv << migrationFiles->size() << " migration files"sv;
+    const int64_t newest = migrationFiles->empty() ? 0 : migrationFiles->back().timestamp;
+
+    // Every server of a rolling restart but the first finds the schema current, without waiting for the lock.
+    if(auto applied = co_await latestAppliedMigration(db); applied && *applied >= newest) {
+        LOG_INFO << "Schema is up to date"sv;
+        co_return true;
     }
 
-    if(!exists) {
+    // Released when the transaction ends with this function, however it returns.
+    auto lock = co_await db->newTransactionCoro();
+    LOG_INFO << "Waiting for the migration lock"sv;
+    co_await lock->execSqlCoro("SELECT pg_advisory_xact_lock($1)"s, MIGRATION_LOCK_KEY);
+    LOG_INFO << "Acquired the migration lock"sv;
+
+    // Again, another server may have migrated while this one waited.
+    auto applied = co_await latestAppliedMigration(db);
+    if(!applied) {
         LOG_INFO << "No migrations table; running main.sql"sv;
         auto success = co_await applyMigrationFile(db, {0, "main"s, "main.sql"s, "db/main.sql"sv});
         if(!success) {
             LOG_FATAL << "Could not apply main.sql"sv;
             co_return false;
         }
+        applied = 0;
     }
 
-    auto success = co_await applyMigrationFiles(db);
+    auto success = co_await applyMigrationFiles(db, *migrationFiles, *applied);
 
     if(!success) {
         LOG_FATAL << "Could not migrate db"sv;
@@ -1,23 +1,63 @@
 
 #include <server/controller/WsController.h>
 #include <server/db/migrations.h>
+#include <server/db/MessagePartitions.h>
+#include <server/db/MessageCompression.h>
+#include <server/db/CacheInvalidation.h>
+#include <server/db/DbPoolScaler.h>
+#include <server/db/Repository.h>
+#include <server/chat/CacheWarmup.h>
+#include <server/chat/ServerDrain.h>
+#include <server/chat/TrafficCapture.h>
+#include <server/chat/ChangeFeed.h>
+#include <server/chat/UpgradeHandoff.h>
+#include <server/utils/server_config.h>
+#include <server/utils/cpu_pinning.h>
 #include <server/aggregator/WsClient.h>
+#include <common/utils/loop_monitor.h>
+#include <common/utils/tracing.h>
+#include <common/utils/tls.h>
+#include <fstream>
 
-int main() {
-    server::WsClient aggregator_client{};
+// Every client the `database` section names must be one of `db_clients`, Drogon asserts on an unknown one.
+static bool checkDbClients(const std::string& path) {
+    std::ifstream file(path);
+    Json::Value root;
+    file >> root;
+    const auto missing = server::serverConfig().database.missingClients(root["db_clients"]);
+    for(const auto& name : missing) {
+        LOG_FATAL << "The database section names the client '" << name << "', which db_clients does not have";
+    }
+    return missing.empty();
+}
 
+int main() {
     std::filesystem::create_directory("logs");
 
     LOG_INFO << "Starting Drogon application...";
     drogon::app().loadConfigFile("config.json");
+    if(!checkDbClients("config.json")) {
+        return 1;
+    }
     drogon::app().setUnicodeEscapingInJson(false); //TODO verify if we need this
                                                    //prevents jsoncpp from turning utf into escaped codepoints
+    // Before the loops and the DB client threads start, they inherit the main thread's CPUs.
+    server::prepareCpuPinning(server::serverConfig().cpu_pinning);
+    if(!common::addTlsListener(server::serverConfig().tls)) {
+        return 1;
+    }
+    // The successor of an upgrade in place binds the port while this process still listens on it.
+    if(server::serverConfig().upgrade.enabled) {
+        drogon::app().enableReusePort();
+    }
 
     // Setup and run migrations before the app starts serving
-    drogon::app().registerBeginningAdvice([&aggregator_client]() {
+    drogon::app().registerBeginningAdvice([]() {
+        server::pinIoLoops(server::serverConfig().cpu_pinning);
+
         LOG_INFO << "Preparing to apply migrations...";
 
-        auto dbClient = drogon::app().getDbClient();
+        auto dbClient = server::writeDbClient();
         if(!dbClient) {
             LOG_FATAL << "Failed to get DB client. Check your config.json. Aborting migrations.";
             drogon::app().quit(); // Quit if DB client is not available
@@ -28,7 +68,18 @@ int main() {
             auto success = drogon::sync_wait(server::MigrateDatabase(dbClient));
             if(success) {
                 LOG_INFO << "Migrations check/apply process completed.";
-            } else {
+            }
+            if(success && server::serverConfig().database.verify_plans) {
+                const auto scans = drogon::sync_wait(server::Repository::findSequentialScans(dbClient));
+                for(const auto& scan : scans) {
+                    LOG_FATAL << "Hot query planned with a sequential scan, " << scan;
+                }
+                success = scans.empty();
+                if(success) {
+                    LOG_INFO << "Every hot query is planned on an index.";
+                }
+            }
+            if(!success) {
                 drogon::app().quit();
             }
         } catch(const drogon::orm::DrogonDbException &e) {
@@ -42,7 +93,41 @@ int main() {
             drogon::app().quit();
         }
 
-        aggregator_client.start(common::getEnvVar("AGGREGATOR_ADDR"));
+        server::MessagePartitions::instance().start();
+        server::MessageCompression::instance().start();
+        server::CacheInvalidation::instance().start();
+        server::DbPoolScaler::instance().start();
+
+        const auto& monitor = server::serverConfig().loop_monitor;
+        common::LoopMonitor::instance().start({monitor.sample_interval, monitor.warn_lag, monitor.warn_queue_depth});
+        const auto& tracing = server::serverConfig().tracing;
+        common::Tracer::instance().start({.sample_rate = tracing.sample_rate, .output = tracing.output});
+        server::TrafficCapture::instance().start(server::serverConfig().capture);
+        server::ChangeFeed::instance().start(server::serverConfig().change_feed);
+
+        // Registration with the aggregator overlaps the warmup, the server reports itself
+        // full until the caches are loaded.
+        if(!server::serverConfig().upgrade.enabled) {
+            server::WsClient::instance().start(common::getEnvVar("AGGREGATOR_ADDR"));
+        }
+        drogon::async_run([]() -> drogon::Task<> {
+            co_await server::CacheWarmup::instance().run();
+            const auto& upgrade = server::serverConfig().upgrade;
+            if(!upgrade.enabled) {
+                server::WsClient::instance().reportLoad();
+                co_return;
+            }
+            // Registered only once the predecessor left the aggregator, the two would take the host from each other.
+            server::UpgradeHandoff::instance().start(upgrade, [] {
+                server::WsClient::instance().start(common::getEnvVar("AGGREGATOR_ADDR"));
+                server::WsClient::instance().reportLoad();
+            });
+        });
+    });
+
+    // Clients are moved to the other servers over time, rather than all dropped at once.
+    drogon::app().setTermSignalHandler([]() {
+        drogon::app().getLoop()->queueInLoop([] { server::ServerDrain::instance().start(); });
     });
 
     LOG_INFO << "Entering main loop...";
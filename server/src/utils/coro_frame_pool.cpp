@@ -0,0 +1,71 @@
+#include <server/utils/coro_frame_pool.h>
+#include <array>
+#include <new>
+#include <utility>
+
+namespace server::frame_pool {
+
+namespace {
+
+/// @brief A free frame, the link to the next one stored in the frame itself.
+struct FreeFrame {
+    FreeFrame* next;
+};
+
+constexpr std::size_t CLASSES = MAX_POOLED / GRANULE;
+
+/// @brief The free frames of one thread, one list per size class.
+struct ThreadPool {
+    std::array<FreeFrame*, CLASSES> free{};
+    std::array<std::size_t, CLASSES> cached{};
+
+    ~ThreadPool() {
+        for(auto* frame : free) {
+            while(frame) {
+                ::operator delete(std::exchange(frame, frame->next));
+            }
+        }
+        // Frames freed later in the thread's exit go straight to the global allocator.
+        free.fill(nullptr);
+        cached.fill(MAX_CACHED);
+    }
+};
+
+thread_local ThreadPool t_pool;
+
+/// @brief The class of a frame size in (0, MAX_POOLED], class `i` holding frames of (i + 1) * GRANULE bytes.
+std::size_t sizeClass(std::size_t size) noexcept {
+    return (size - 1) / GRANULE;
+}
+
+} // namespace
+
+void* allocate(std::size_t size) {
+    if(size == 0 || size > MAX_POOLED) {
+        return ::operator new(size);
+    }
+    const auto cls = sizeClass(size);
+    if(auto* frame = t_pool.free[cls]) {
+        t_pool.free[cls] = frame->next;
+        --t_pool.cached[cls];
+        return frame;
+    }
+    // The whole class size, so the frame can serve any size of its class once freed.
+    return ::operator new((cls + 1) * GRANULE);
+}
+
+void deallocate(void* ptr, std::size_t size) noexcept {
+    if(size == 0 || size > MAX_POOLED) {
+        ::operator delete(ptr);
+        return;
+    }
+    const auto cls = sizeClass(size);
+    if(t_pool.cached[cls] >= MAX_CACHED) {
+        ::operator delete(ptr);
+        return;
+    }
+    t_pool.free[cls] = new(ptr) FreeFrame{t_pool.free[cls]};
+    ++t_pool.cached[cls];
+}
+
+} // namespace server::frame_pool
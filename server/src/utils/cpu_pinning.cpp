@@ -0,0 +1,182 @@
+#include <server/utils/cpu_pinning.h>
+#include <algorithm>
+#include <sstream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace server {
+
+#ifdef __linux__
+
+/// @brief The CPUs planned by `prepareCpuPinning()`, read by `pinIoLoops()` once the loops run.
+struct CpuPlan {
+    std::vector<int> io;
+    std::vector<int> shared;
+    std::unordered_map<int, int> node_of;
+};
+
+static CpuPlan& plan() {
+    static CpuPlan inst;
+    return inst;
+}
+
+static int nodeOf(const CpuPlan& cpus, int cpu) {
+    const auto it = cpus.node_of.find(cpu);
+    return it == cpus.node_of.end() ? 0 : it->second;
+}
+
+/// @brief Parses a sysfs CPU list such as "0-3,8-11".
+static std::vector<int> parseCpuList(const std::string& text) {
+    std::vector<int> cpus;
+    std::istringstream in(text);
+    std::string range;
+    while(std::getline(in, range, ',')) {
+        const auto dash = range.find('-');
+        try {
+            const int first = std::stoi(range.substr(0, dash));
+            const int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for(int cpu = first; cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        } catch(const std::exception&) {
+            // A blank or malformed entry, e.g. the trailing newline.
+        }
+    }
+    return cpus;
+}
+
+/// @brief The NUMA node of every CPU the kernel lists, machines without NUMA have none listed.
+static std::unordered_map<int, int> numaNodes() {
+    std::unordered_map<int, int> node_of;
+    std::error_code ec;
+    for(const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", ec)) {
+        const auto name = entry.path().filename().string();
+        if(!name.starts_with("node") || name.size() == 4 || !std::all_of(name.begin() + 4, name.end(), ::isdigit)) {
+            continue;
+        }
+        std::ifstream list(entry.path() / "cpulist");
+        std::string text;
+        std::getline(list, text);
+        for(const int cpu : parseCpuList(text)) {
+            node_of[cpu] = std::stoi(name.substr(4));
+        }
+    }
+    return node_of;
+}
+
+static std::vector<int> allowedCpus() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    std::vector<int> cpus;
+    if(sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if(CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    return cpus;
+}
+
+static bool setAffinity(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(const int cpu : cpus) {
+        if(cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+static std::string describe(const std::vector<int>& cpus) {
+    std::string out;
+    for(const int cpu : cpus) {
+        out += (out.empty() ? "" : ",") + std::to_string(cpu);
+    }
+    return out;
+}
+
+void prepareCpuPinning(const CpuPinningConfig& config) {
+    if(!config.enabled) {
+        return;
+    }
+    auto& cpus = plan();
+    cpus.node_of = numaNodes();
+    const auto threads = drogon::app().getThreadNum();
+    auto allowed = allowedCpus();
+    if(allowed.empty()) {
+        LOG_ERROR << "Cannot read the CPUs the server may run on, threads are not pinned";
+        return;
+    }
+
+    cpus.io = config.io_cpus;
+    if(cpus.io.empty()) {
+        // Node by node, so neighbouring loops and their shared threads stay on one node as long as they fit.
+        auto by_node = allowed;
+        std::stable_sort(by_node.begin(), by_node.end(), [&](int a, int b) { return nodeOf(cpus, a) < nodeOf(cpus, b); });
+        for(size_t i = 0; i < threads; ++i) {
+            cpus.io.push_back(by_node[i % by_node.size()]);
+        }
+        if(threads > by_node.size()) {
+            LOG_WARN << threads << " IO loops on " << by_node.size() << " CPUs, some loops share a CPU";
+        }
+    } else if(cpus.io.size() < threads) {
+        LOG_WARN << "cpu_pinning.io_cpus lists " << cpus.io.size() << " CPUs for " << threads << " IO loops, the list is reused";
+        for(size_t i = cpus.io.size(); i < threads; ++i) {
+            cpus.io.push_back(cpus.io[i % config.io_cpus.size()]);
+        }
+    }
+    cpus.io.resize(threads);
+
+    cpus.shared = config.shared_cpus;
+    if(cpus.shared.empty()) {
+        std::erase_if(allowed, [&](int cpu) { return std::find(cpus.io.begin(), cpus.io.end(), cpu) != cpus.io.end(); });
+        cpus.shared = allowed.empty() ? allowedCpus() : allowed;
+    }
+    if(!setAffinity(cpus.shared)) {
+        LOG_ERROR << "Cannot restrict the shared threads to CPUs " << describe(cpus.shared);
+    } else {
+        LOG_INFO << "Main loop, DB clients and other threads on CPUs " << describe(cpus.shared);
+    }
+
+    drogon::app().enableReusePort(config.reuse_port);
+    if(config.reuse_port) {
+        LOG_INFO << "Every IO loop listens for itself with SO_REUSEPORT";
+    }
+}
+
+void pinIoLoops(const CpuPinningConfig& config) {
+    const auto& cpus = plan();
+    if(!config.enabled || cpus.io.empty()) {
+        return;
+    }
+    for(size_t i = 0; i < cpus.io.size(); ++i) {
+        const int cpu = cpus.io[i];
+        const int node = nodeOf(cpus, cpu);
+        drogon::app().getIOLoop(i)->runInLoop([i, cpu, node] {
+            if(setAffinity({cpu})) {
+                LOG_INFO << "IO loop " << i << " pinned to CPU " << cpu << " (NUMA node " << node << ")";
+            } else {
+                LOG_ERROR << "Cannot pin IO loop " << i << " to CPU " << cpu;
+            }
+        });
+    }
+}
+
+#else
+
+void prepareCpuPinning(const CpuPinningConfig& config) {
+    if(config.enabled) {
+        LOG_WARN << "CPU pinning is only supported on Linux, threads are not pinned";
+    }
+}
+
+void pinIoLoops(const CpuPinningConfig&) {}
+
+#endif
+
+} // namespace server